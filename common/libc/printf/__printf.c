@@ -344,15 +344,21 @@ __pf_setbase(PF *pf, int ch)
 
 /*
  * Function to print "spc" instances of the fill character.
+ * Emits in chunks rather than a callback per character; wide
+ * fields are common when printing tables.
  */
 static
 void
 __pf_fill(PF *pf, int spc)
 {
-	char f = pf->fillchar;
-	int i;
-	for (i=0; i<spc; i++) {
-		__pf_print(pf, &f, 1);
+	char f[16];
+	int chunk;
+
+	memset(f, pf->fillchar, sizeof(f));
+	while (spc > 0) {
+		chunk = spc < (int)sizeof(f) ? spc : (int)sizeof(f);
+		__pf_print(pf, f, chunk);
+		spc -= chunk;
 	}
 }
 
@@ -368,8 +374,13 @@ __pf_printstuff(PF *pf,
 		const char *prefix, const char *prefix2,
 		const char *stuff)
 {
+	/* Measure everything once. */
+	size_t plen = strlen(prefix);
+	size_t p2len = strlen(prefix2);
+	size_t slen = strlen(stuff);
+
 	/* Total length to print. */
-	int len = strlen(prefix)+strlen(prefix2)+strlen(stuff);
+	int len = plen+p2len+slen;
 
 	/* Get field width and compute amount of padding in "spc". */
 	int spc = pf->spacing;
@@ -386,8 +397,8 @@ __pf_printstuff(PF *pf,
 	}
 
 	/* Print the prefixes. */
-	__pf_print(pf, prefix, strlen(prefix));
-	__pf_print(pf, prefix2, strlen(prefix2));
+	__pf_print(pf, prefix, plen);
+	__pf_print(pf, prefix2, p2len);
 
 	/* If padding on left and the fill char *is* 0, pad here. */
 	if (spc > 0 && pf->rightspc==0 && pf->fillchar=='0') {
@@ -395,7 +406,7 @@ __pf_printstuff(PF *pf,
 	}
 
 	/* Print the actual string. */
-	__pf_print(pf, stuff, strlen(stuff));
+	__pf_print(pf, stuff, slen);
 
 	/* If padding on the right, pad afterwards. */
 	if (spc > 0 && pf->rightspc!=0) {
@@ -403,12 +414,34 @@ __pf_printstuff(PF *pf,
 	}
 }
 
+/*
+ * Lookup table of all two-digit decimal numbers in order. Converting
+ * two digits per step halves the number of divisions, which matters
+ * because for long long operands each division is a library call
+ * (__umoddi3/__udivdi3).
+ */
+static const char __pf_decpairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
 /*
  * Function to convert a number to ascii and then print it.
  *
  * Works from right to left in a buffer of NUMBER_BUF_SIZE bytes.
  * NUMBER_BUF_SIZE is set so that the longest number string we can
  * generate (a long long printed in octal) will fit. See above.
+ *
+ * Decimal conversion goes through the two-digit lookup table above;
+ * hex and octal use shifts and masks instead of division, which for
+ * long long operands would otherwise be a library call per digit.
  */
 static
 void
@@ -420,6 +453,7 @@ __pf_printnum(PF *pf)
 	char buf[NUMBER_BUF_SIZE];   /* Accumulation buffer for string. */
 	char *x;                     /* Current pointer into buf. */
 	unsigned INTTYPE xnum;       /* Current value to print. */
+	unsigned pair;               /* Index into the two-digit table. */
 	const char *bprefix;         /* Base prefix (0, 0x, or nothing) */
 	const char *sprefix;         /* Sign prefix (- or nothing) */
 
@@ -433,30 +467,40 @@ __pf_printnum(PF *pf)
 	xnum = pf->num;
 
 	/*
-	 * Convert a single digit.
-	 * Do this loop at least once - that way 0 prints as 0 and not "".
+	 * Convert the digits, least significant first. Each branch
+	 * emits at least one digit even for a zero value - that way 0
+	 * prints as 0 and not "".
 	 */
-	do {
-		/*
-		 * Get the digit character for the least significant
-		 * part of xnum.
-		 */
-		*x = digits[xnum % pf->base];
-
-		/*
-		 * Back up the pointer to point to the next space to the left.
-		 */
-		x--;
-
-		/*
-		 * Drop the value of the digit we just printed from xnum.
-		 */
-		xnum = xnum / pf->base;
-
-		/*
-		 * If xnum hits 0 there's no more number left.
-		 */
-	} while (xnum > 0);
+	switch (pf->base) {
+	case 10:
+		while (xnum >= 100) {
+			pair = (unsigned)(xnum % 100) * 2;
+			*x-- = __pf_decpairs[pair+1];
+			*x-- = __pf_decpairs[pair];
+			xnum = xnum / 100;
+		}
+		pair = (unsigned)xnum * 2;
+		*x-- = __pf_decpairs[pair+1];
+		if (xnum >= 10) {
+			*x-- = __pf_decpairs[pair];
+		}
+		break;
+	case 16:
+		do {
+			*x-- = digits[xnum & 0xf];
+			xnum = xnum >> 4;
+		} while (xnum > 0);
+		break;
+	case 8:
+		do {
+			*x-- = digits[xnum & 07];
+			xnum = xnum >> 3;
+		} while (xnum > 0);
+		break;
+	default:
+		/* __pf_setbase generates no other bases */
+		assert(0);
+	}
 
 	/*
 	 * x points to the *next* slot in the buffer to use.
@@ -564,15 +608,17 @@ __pf_send(PF *pf, int ch)
 
 /*
  * Do a whole printf session.
- * Create and initialize a printf state object,
- * then send it each character from the format string.
+ * Create and initialize a printf state object, then work through the
+ * format string. Literal text (everything up to the next %) is sent
+ * onward as one block rather than a callback per character; only the
+ * insides of %-formats go through the per-character machinery.
  */
 int
 __vprintf(void (*func)(void *clientdata, const char *str, size_t len),
 	  void *clientdata, const char *format, va_list ap)
 {
 	PF pf;
-	int i;
+	size_t i, start;
 
 	pf.sendfunc = func;
 	pf.clientdata = clientdata;
@@ -584,8 +630,27 @@ __vprintf(void (*func)(void *clientdata, const char *str, size_t len),
 	pf.charcount = 0;
 	__pf_endfield(&pf);
 
-	for (i=0; format[i]; i++) {
+	i = 0;
+	while (format[i]) {
+		if (pf.in_pct == 0) {
+			/* Find the extent of the literal run. */
+			start = i;
+			while (format[i] && format[i] != '%') {
+				i++;
+			}
+			if (i > start) {
+				__pf_print(&pf, format+start, i-start);
+			}
+			if (format[i] == 0) {
+				break;
+			}
+			/* format[i] is the %; start a format. */
+			pf.in_pct = 1;
+			i++;
+			continue;
+		}
 		__pf_send(&pf, format[i]);
+		i++;
 	}
 
 	return pf.charcount;
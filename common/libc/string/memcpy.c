@@ -47,39 +47,63 @@
 void *
 memcpy(void *dst, const void *src, size_t len)
 {
-	size_t i;
+	char *d = dst;
+	const char *s = src;
 
 	/*
 	 * memcpy does not support overlapping buffers, so always do it
 	 * forwards. (Don't change this without adjusting memmove.)
 	 *
-	 * For speedy copying, optimize the common case where both pointers
-	 * and the length are word-aligned, and copy word-at-a-time instead
-	 * of byte-at-a-time. Otherwise, copy by bytes.
+	 * For speedy copying, go word-at-a-time whenever the two
+	 * pointers are mutually aligned - that is, whenever they're
+	 * the same distance from a word boundary, which covers both
+	 * fully aligned buffers and equally misaligned ones. Copy
+	 * bytes up to the boundary, then words, unrolled four at a
+	 * time so the loop overhead is amortized and the loads can
+	 * overlap the stores, and finish the tail by bytes. Pointers
+	 * with different alignments get the plain byte loop.
 	 *
 	 * The alignment logic below should be portable. We rely on
 	 * the compiler to be reasonably intelligent about optimizing
 	 * the divides and modulos out. Fortunately, it is.
 	 */
 
-	if ((uintptr_t)dst % sizeof(long) == 0 &&
-	    (uintptr_t)src % sizeof(long) == 0 &&
-	    len % sizeof(long) == 0) {
+	if ((((uintptr_t)d ^ (uintptr_t)s) % sizeof(long)) == 0 &&
+	    len >= sizeof(long)) {
 
-		long *d = dst;
-		const long *s = src;
+		while ((uintptr_t)d % sizeof(long) != 0) {
+			*d++ = *s++;
+			len--;
+		}
+
+		long *dw = (long *)d;
+		const long *sw = (const long *)s;
 
-		for (i=0; i<len/sizeof(long); i++) {
-			d[i] = s[i];
+		while (len >= 4 * sizeof(long)) {
+			long w0 = sw[0];
+			long w1 = sw[1];
+			long w2 = sw[2];
+			long w3 = sw[3];
+			dw[0] = w0;
+			dw[1] = w1;
+			dw[2] = w2;
+			dw[3] = w3;
+			dw += 4;
+			sw += 4;
+			len -= 4 * sizeof(long);
+		}
+		while (len >= sizeof(long)) {
+			*dw++ = *sw++;
+			len -= sizeof(long);
 		}
+
+		d = (char *)dw;
+		s = (const char *)sw;
 	}
-	else {
-		char *d = dst;
-		const char *s = src;
 
-		for (i=0; i<len; i++) {
-			d[i] = s[i];
-		}
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
 	}
 
 	return dst;
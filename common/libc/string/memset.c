@@ -42,10 +42,51 @@ void *
 memset(void *ptr, int ch, size_t len)
 {
 	char *p = ptr;
-	size_t i;
 
-	for (i=0; i<len; i++) {
-		p[i] = ch;
+	/*
+	 * For blocks of at least a word, replicate the fill byte
+	 * through a whole word and store word-at-a-time: bytes up to
+	 * the first word boundary, then words unrolled four at a time,
+	 * then the tail by bytes. Short blocks just take the byte
+	 * loop.
+	 */
+
+	if (len >= sizeof(long)) {
+		unsigned long fill = (unsigned char)ch;
+
+		fill |= fill << 8;
+		fill |= fill << 16;
+		if (sizeof(long) > 4) {
+			/* Two shifts to dodge a bogus warning on ILP32 */
+			fill |= (fill << 16) << 16;
+		}
+
+		while ((uintptr_t)p % sizeof(long) != 0) {
+			*p++ = ch;
+			len--;
+		}
+
+		unsigned long *lp = (unsigned long *)p;
+
+		while (len >= 4 * sizeof(long)) {
+			lp[0] = fill;
+			lp[1] = fill;
+			lp[2] = fill;
+			lp[3] = fill;
+			lp += 4;
+			len -= 4 * sizeof(long);
+		}
+		while (len >= sizeof(long)) {
+			*lp++ = fill;
+			len -= sizeof(long);
+		}
+
+		p = (char *)lp;
+	}
+
+	while (len > 0) {
+		*p++ = ch;
+		len--;
 	}
 
 	return ptr;
@@ -43,12 +43,44 @@
  * C standard string function: find leftmost instance of a character
  * in a string.
  */
+
+/* Word-at-a-time zero-byte detection; see strlen.c */
+#define ONES ((unsigned long)-1 / 0xff)
+#define HIGHS (ONES * 0x80)
+#define HASZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
 char *
 strchr(const char *s, int ch_arg)
 {
 	/* avoid sign-extension problems */
 	const char ch = ch_arg;
 
+	/*
+	 * Scan word-at-a-time: replicate the target byte through a
+	 * word, then a word contains the target exactly when XORing
+	 * with the replicated word leaves a zero byte. Stop on either
+	 * the target or the terminator and finish by bytes. Bytes up
+	 * to the first word boundary are checked individually, and
+	 * aligned word reads can't fault (see strlen.c).
+	 */
+	while ((uintptr_t)s % sizeof(unsigned long) != 0) {
+		if (*s == ch) {
+			return (char *)s;
+		}
+		if (*s == 0) {
+			return NULL;
+		}
+		s++;
+	}
+
+	const unsigned long rep = ONES * (unsigned char)ch;
+	const unsigned long *w = (const unsigned long *)s;
+
+	while (!HASZERO(*w) && !HASZERO(*w ^ rep)) {
+		w++;
+	}
+	s = (const char *)w;
+
 	/* scan from left to right */
 	while (*s) {
 		/* if we hit it, return it */
@@ -44,6 +44,11 @@
  * sort order.
  */
 
+/* Word-at-a-time zero-byte detection; see strlen.c */
+#define ONES ((unsigned long)-1 / 0xff)
+#define HIGHS (ONES * 0x80)
+#define HASZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
 int
 strcmp(const char *a, const char *b)
 {
@@ -63,10 +68,40 @@ strcmp(const char *a, const char *b)
 	 * B.
 	 */
 
-	for (i=0; a[i]!=0 && a[i]==b[i]; i++) {
+	i = 0;
+
+	/*
+	 * When the strings are mutually aligned, compare them
+	 * word-at-a-time: first bytes up to a word boundary, then
+	 * whole words as long as they're equal and free of zero
+	 * bytes (aligned word reads can't fault; see strlen.c), then
+	 * drop back to bytes for the difference or the tail.
+	 */
+	if ((((uintptr_t)a ^ (uintptr_t)b) % sizeof(unsigned long)) == 0) {
+		while ((uintptr_t)(a + i) % sizeof(unsigned long) != 0) {
+			if (a[i] == 0 || a[i] != b[i]) {
+				goto order;
+			}
+			i++;
+		}
+		while (1) {
+			unsigned long wa, wb;
+
+			wa = *(const unsigned long *)(a + i);
+			wb = *(const unsigned long *)(b + i);
+			if (wa != wb || HASZERO(wa)) {
+				break;
+			}
+			i += sizeof(unsigned long);
+		}
+	}
+
+	for (; a[i]!=0 && a[i]==b[i]; i++) {
 		/* nothing */
 	}
 
+ order:
+
 	/*
 	 * If A is greater than B, return 1. If A is less than B,
 	 * return -1.  If they're the same, return 0. Since we have
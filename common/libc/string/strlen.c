@@ -43,13 +43,45 @@
  * C standard string function: get length of a string
  */
 
+/*
+ * Word-at-a-time zero-byte detection: (x - ONES) borrows out of any
+ * zero byte, and masking with ~x and the high bits leaves a nonzero
+ * result exactly when some byte of x is zero. ONES is a word with
+ * 0x01 in every byte, HIGHS has 0x80 in every byte; the divide-by-ff
+ * builds them for whatever size long is.
+ */
+#define ONES ((unsigned long)-1 / 0xff)
+#define HIGHS (ONES * 0x80)
+#define HASZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
 size_t
 strlen(const char *str)
 {
-	size_t ret = 0;
+	const char *s = str;
+
+	/*
+	 * Bytes up to the first word boundary. Reading the aligned
+	 * words after that never crosses a page the string doesn't
+	 * touch, so the word loop can't fault even though it may read
+	 * a few bytes past the terminator.
+	 */
+	while ((uintptr_t)s % sizeof(unsigned long) != 0) {
+		if (*s == 0) {
+			return s - str;
+		}
+		s++;
+	}
+
+	const unsigned long *w = (const unsigned long *)s;
+
+	while (!HASZERO(*w)) {
+		w++;
+	}
 
-	while (str[ret]) {
-		ret++;
+	/* The zero byte is somewhere in this word; find it. */
+	s = (const char *)w;
+	while (*s) {
+		s++;
 	}
-	return ret;
+	return s - str;
 }
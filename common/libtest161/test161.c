@@ -177,6 +177,105 @@ secprintf(const char * secret, const char * msg, const char * name)
 
 #endif
 
+/*
+ * Metrics reporting.
+ *
+ * Benchmark code reports its numbers as single-line tagged records so
+ * the test161 perf targets (and anything else watching the output) can
+ * parse results instead of scraping each benchmark's human-readable
+ * lines with per-test regexes:
+ *
+ *	METRIC type=counter name=NAME value=V unit=UNIT
+ *	METRIC type=duration name=NAME value=V unit=ns
+ *	METRIC type=percentiles name=NAME n=N p50=V p90=V p99=V unit=UNIT
+ *
+ * A record is the fixed METRIC prefix followed by space-separated
+ * key=value tags; parsers should key on the prefix and the type tag
+ * and not depend on tag order. Names and units are forced to single
+ * tokens here (anything that isn't alphanumeric or ./_- becomes a
+ * dash), so callers can pass the same human-readable labels they
+ * print elsewhere.
+ *
+ * Percentiles are passed in precomputed; sorting the sample array is
+ * the benchmark's business, not ours.
+ */
+
+#define METRIC_TOKENLEN 64
+
+static void
+metric_token(char *buf, size_t max, const char *str)
+{
+	size_t i;
+	char c;
+
+	for (i = 0; i + 1 < max && str[i] != 0; i++) {
+		c = str[i];
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		    (c >= '0' && c <= '9') ||
+		    c == '.' || c == '/' || c == '_' || c == '-') {
+			buf[i] = c;
+		}
+		else {
+			buf[i] = '-';
+		}
+	}
+	buf[i] = 0;
+}
+
+static int
+metric_emit(const char *line)
+{
+#ifdef _KERNEL
+	return kprintf("%s\n", line);
+#else
+	return say("%s\n", line);
+#endif
+}
+
+int
+metric_counter(const char *name, unsigned long long value, const char *unit)
+{
+	char ntok[METRIC_TOKENLEN], utok[METRIC_TOKENLEN];
+	char line[192];
+
+	metric_token(ntok, sizeof(ntok), name);
+	metric_token(utok, sizeof(utok), unit);
+	snprintf(line, sizeof(line),
+		 "METRIC type=counter name=%s value=%llu unit=%s",
+		 ntok, value, utok);
+	return metric_emit(line);
+}
+
+int
+metric_duration(const char *name, unsigned long long ns)
+{
+	char ntok[METRIC_TOKENLEN];
+	char line[192];
+
+	metric_token(ntok, sizeof(ntok), name);
+	snprintf(line, sizeof(line),
+		 "METRIC type=duration name=%s value=%llu unit=ns",
+		 ntok, ns);
+	return metric_emit(line);
+}
+
+int
+metric_percentiles(const char *name, unsigned n,
+		   unsigned long long p50, unsigned long long p90,
+		   unsigned long long p99, const char *unit)
+{
+	char ntok[METRIC_TOKENLEN], utok[METRIC_TOKENLEN];
+	char line[256];
+
+	metric_token(ntok, sizeof(ntok), name);
+	metric_token(utok, sizeof(utok), unit);
+	snprintf(line, sizeof(line),
+		 "METRIC type=percentiles name=%s n=%u "
+		 "p50=%llu p90=%llu p99=%llu unit=%s",
+		 ntok, n, p50, p90, p99, utok);
+	return metric_emit(line);
+}
+
 #ifdef _KERNEL
 void test161_bootstrap()
 {
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2013
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+#include <membar.h>
+
+/*
+ * Atomic operations, built on the LL/SC instructions like the
+ * spinlock_data_* operations in machine/spinlock.h; see there for the
+ * rules on LL/SC (in short: SC succeeds only if nothing touched the
+ * word since our LL, and nothing may access memory in between).
+ *
+ * On mips the only barrier instruction is sync, a full barrier, so
+ * the acquire and release operations are stronger than they promise
+ * and the read-modify-write operations get their full-barrier
+ * semantics from a sync on each side. On sys161 sync is cheap; don't
+ * tune these, fix the algorithm instead.
+ */
+
+ATOMIC_INLINE
+uint32_t
+atomic_load_acquire(volatile uint32_t *a)
+{
+	uint32_t val;
+
+	val = *a;
+	membar_any_any();
+	return val;
+}
+
+ATOMIC_INLINE
+void
+atomic_store_release(volatile uint32_t *a, uint32_t val)
+{
+	membar_any_any();
+	*a = val;
+}
+
+ATOMIC_INLINE
+uint32_t
+atomic_fetch_add(volatile uint32_t *a, uint32_t n)
+{
+	uint32_t x;
+	uint32_t y;
+
+	membar_any_any();
+	do {
+		__asm volatile(
+			".set push;"	 /* save assembler mode */
+			".set mips32;"	 /* allow MIPS32 instructions */
+			".set volatile;" /* avoid unwanted optimization */
+			"ll %0, 0(%2);"	 /*   x = *a */
+			"addu %1, %0, %3;" /* y = x + n (registers only) */
+			"sc %1, 0(%2);"	 /*   *a = y; y = success? */
+			".set pop"	 /* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (a), "r" (n));
+	} while (y == 0);
+	membar_any_any();
+	return x;
+}
+
+ATOMIC_INLINE
+uint32_t
+atomic_xchg(volatile uint32_t *a, uint32_t val)
+{
+	uint32_t x;
+	uint32_t y;
+
+	membar_any_any();
+	do {
+		y = val;
+		__asm volatile(
+			".set push;"	 /* save assembler mode */
+			".set mips32;"	 /* allow MIPS32 instructions */
+			".set volatile;" /* avoid unwanted optimization */
+			"ll %0, 0(%2);"	 /*   x = *a */
+			"sc %1, 0(%2);"	 /*   *a = y; y = success? */
+			".set pop"	 /* restore assembler mode */
+			: "=&r" (x), "+r" (y)
+			: "r" (a));
+	} while (y == 0);
+	membar_any_any();
+	return x;
+}
+
+/*
+ * The branch between the LL and SC is legal; only memory accesses
+ * invalidate the link. Y is 1 on SC success, 0 on SC failure, and 2
+ * if the comparison failed and the SC was skipped.
+ */
+ATOMIC_INLINE
+uint32_t
+atomic_cas(volatile uint32_t *a, uint32_t expected, uint32_t newval)
+{
+	uint32_t x;
+	uint32_t y;
+
+	membar_any_any();
+	for (;;) {
+		y = newval;
+		__asm volatile(
+			".set push;"	 /* save assembler mode */
+			".set mips32;"	 /* allow MIPS32 instructions */
+			".set volatile;" /* avoid unwanted optimization */
+			"ll %0, 0(%2);"	 /*   x = *a */
+			"bne %0, %3, 1f;"/*   skip the store on mismatch */
+			"nop;"
+			"sc %1, 0(%2);"	 /*   *a = y; y = success? */
+			"b 2f;"
+			"nop;"
+			"1: li %1, 2;"	 /*   flag the mismatch */
+			"2:"
+			".set pop"	 /* restore assembler mode */
+			: "=&r" (x), "+r" (y)
+			: "r" (a), "r" (expected));
+		if (y != 0) {
+			/* mismatch (y==2) or successful swap (y==1) */
+			break;
+		}
+		/* SC failed; retry */
+	}
+	membar_any_any();
+	return x;
+}
+
+#endif /* _MIPS_ATOMIC_H_ */
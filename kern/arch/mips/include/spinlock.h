@@ -46,6 +46,13 @@ SPINLOCK_INLINE
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 SPINLOCK_INLINE
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
+SPINLOCK_INLINE
+spinlock_data_t spinlock_data_xchg(volatile spinlock_data_t *sd,
+				   spinlock_data_t val);
+SPINLOCK_INLINE
+spinlock_data_t spinlock_data_cas(volatile spinlock_data_t *sd,
+				  spinlock_data_t expected,
+				  spinlock_data_t newval);
 
 ////////////////////////////////////////////////////////////
 
@@ -118,5 +125,72 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+/*
+ * Atomically exchange a spinlock_data_t, returning the old value.
+ * Unlike test-and-set we can't fake a result if the SC fails, so
+ * retry until it succeeds.
+ */
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_xchg(volatile spinlock_data_t *sd, spinlock_data_t val)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	do {
+		y = val;
+		__asm volatile(
+			".set push;"	/* save assembler mode */
+			".set mips32;"	/* allow MIPS32 instructions */
+			".set volatile;"/* avoid unwanted optimization */
+			"ll %0, 0(%2);"	/*   x = *sd */
+			"sc %1, 0(%2);"	/*   *sd = y; y = success? */
+			".set pop"	/* restore assembler mode */
+			: "=&r" (x), "+r" (y) : "r" (sd));
+	} while (y == 0);
+	return x;
+}
+
+/*
+ * Atomically compare-and-swap a spinlock_data_t: if *SD equals
+ * EXPECTED, store NEWVAL. Returns the value read, so the swap
+ * happened iff the return value equals EXPECTED. The branch between
+ * the LL and SC is legal; only memory accesses invalidate the link.
+ * Y is 1 on SC success, 0 on SC failure, and 2 if the comparison
+ * failed and the SC was skipped.
+ */
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_cas(volatile spinlock_data_t *sd, spinlock_data_t expected,
+		  spinlock_data_t newval)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	for (;;) {
+		y = newval;
+		__asm volatile(
+			".set push;"	 /* save assembler mode */
+			".set mips32;"	 /* allow MIPS32 instructions */
+			".set volatile;" /* avoid unwanted optimization */
+			"ll %0, 0(%2);"	 /*   x = *sd */
+			"bne %0, %3, 1f;"/*   skip the store on mismatch */
+			"nop;"
+			"sc %1, 0(%2);"	 /*   *sd = y; y = success? */
+			"b 2f;"
+			"nop;"
+			"1: li %1, 2;"	 /*   flag the mismatch */
+			"2:"
+			".set pop"	 /* restore assembler mode */
+			: "=&r" (x), "+r" (y)
+			: "r" (sd), "r" (expected));
+		if (y != 0) {
+			/* mismatch (y==2) or successful swap (y==1) */
+			return x;
+		}
+		/* SC failed; retry */
+	}
+}
+
 
 #endif /* _MIPS_SPINLOCK_H_ */
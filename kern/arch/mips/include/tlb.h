@@ -60,13 +60,24 @@ void tlb_write(uint32_t entryhi, uint32_t entrylo, uint32_t index);
 void tlb_read(uint32_t *entryhi, uint32_t *entrylo, uint32_t index);
 int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
+/*
+ *   tlb_setasid: load ENTRYHI (normally just an ASID in the TLBHI_PID
+ *        field) into c0_entryhi without touching the TLB itself. The
+ *        PID field of c0_entryhi is what the MMU matches user
+ *        references against, so this is how the "current" address
+ *        space ID is switched.
+ */
+void tlb_setasid(uint32_t entryhi);
+
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
- * bits that aren't assigned a meaning.
+ * The MIPS has a 6-bit address space ID in TLBHI_PID; entries only
+ * match when their PID equals the one live in c0_entryhi (the VM
+ * system uses this to avoid flushing the whole TLB on context
+ * switch). TLBLO_GLOBAL exempts an entry from PID matching; it is
+ * used only for the kseg2 window onto high physical memory (see
+ * vm_fault), which belongs to every address space alike.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
  * ever set by the processor. If you set it, writes are permitted. If
@@ -78,14 +89,18 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PID_SHIFT  6
+
+/* Number of distinct address space IDs (6-bit field) */
+#define NUM_ASIDS  64
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
 #define TLBLO_NOCACHE 0x00000800
 #define TLBLO_DIRTY   0x00000400
 #define TLBLO_VALID   0x00000200
-/*      TLBLO_GLOBAL  0x00000100 */
+#define TLBLO_GLOBAL  0x00000100
 
 /*
  * Values for completely invalid TLB entries. The TLB entry index should
@@ -101,5 +116,12 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 #define NUM_TLB  64
 
+/*
+ * Number of low TLB slots the random register never selects. Entries
+ * written there with tlb_write stay until explicitly overwritten
+ * (the conventional MIPS "wired" entries).
+ */
+#define NUM_TLB_WIRED  8
+
 
 #endif /* _MIPS_TLB_H_ */
@@ -104,5 +104,17 @@ __DEAD void mips_usermode(struct trapframe *tf);
 extern vaddr_t cpustacks[];
 extern vaddr_t cputhreads[];
 
+/*
+ * Per-CPU top-level page table pointer for the assembly TLB refill
+ * handler (see cpu.c).
+ */
+extern vaddr_t cpuptbases[];
+
+/*
+ * Per-CPU pid of the current process, for the assembly fast syscall
+ * path (see cpu.c).
+ */
+extern uint32_t cpupids[];
+
 
 #endif /* _MIPS_TRAPFRAME_H_ */
@@ -38,6 +38,17 @@
 #define PAGE_SIZE  4096         /* size of VM page */
 #define PAGE_FRAME 0xfffff000   /* mask for getting page number from addr */
 
+/*
+ * Page-coloring geometry. The r3000's on-chip caches are physically
+ * indexed and direct-mapped, 16K in the standard configuration, so a
+ * physical page's cache footprint is determined by its frame number
+ * modulo 16K/PAGE_SIZE. The page allocator uses this to give
+ * virtually-contiguous user pages distinct, repeatable cache colors.
+ */
+#define VM_CACHESIZE 16384      /* primary cache size, direct-mapped */
+#define VM_CACHELINE 16         /* primary cache line size, in bytes */
+#define VM_NCOLORS   (VM_CACHESIZE / PAGE_SIZE)
+
 /*
  * MIPS-I hardwired memory layout:
  *    0xc0000000 - 0xffffffff   kseg2 (kernel, tlb-mapped)
@@ -55,9 +66,12 @@
 
 /*
  * The first 512 megs of physical space can be addressed in both kseg0 and
- * kseg1. We use kseg0 for the kernel. This macro returns the kernel virtual
- * address of a given physical address within that range. (We assume we're
- * not using systems with more physical space than that anyway.)
+ * kseg1. We use kseg0 for the kernel, and that used to be the hard cap on
+ * usable RAM. Physical memory above MIPS_DIRECTMEM_SIZE is instead
+ * reached through a linear window filling all of kseg2, whose TLB entries
+ * the fault path reloads on demand (see vm_fault), extending the
+ * reachable physical space to 1.5 gigs. This macro returns the kernel
+ * virtual address of a given physical address in either range.
  *
  * N.B. If you, say, call a function that returns a paddr or 0 on error,
  * check the paddr for being 0 *before* you use this macro. While paddr 0
@@ -65,7 +79,13 @@
  * exception handler code) when converted to a vaddr it's *not* NULL, *is*
  * a valid address, and will make a *huge* mess if you scribble on it.
  */
-#define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
+#define MIPS_DIRECTMEM_SIZE  0x20000000
+#define MIPS_KSEG2_SIZE      0x40000000
+
+#define PADDR_TO_KVADDR(paddr) \
+	((paddr) < MIPS_DIRECTMEM_SIZE ? \
+	 (paddr) + MIPS_KSEG0 : \
+	 (paddr) - MIPS_DIRECTMEM_SIZE + MIPS_KSEG2)
 
 /*
  * The top of user space. (Actually, the address immediately above the
@@ -100,13 +120,14 @@
  * called exactly once when the VM system initializes to take over
  * management of physical memory.
  *
- * ram_stealmem can be used before ram_getsize is called to allocate
- * memory that cannot be freed later. This is intended for use early
- * in bootup before VM initialization is complete.
+ * ram_carve can be used before ram_getfirstfree is called to allocate
+ * aligned memory that cannot be freed later. This is intended for use
+ * early in bootup before VM initialization is complete; vm_bootstrap
+ * places the coremap with it.
  */
 
 void ram_bootstrap(void);
-paddr_t ram_stealmem(unsigned long npages);
+paddr_t ram_carve(size_t size, size_t align);
 paddr_t ram_getsize(void);
 paddr_t ram_getfirstfree(void);
 
@@ -116,11 +137,16 @@ paddr_t ram_getfirstfree(void);
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct addrspace;
+
 struct tlbshootdown {
 	/*
-	 * Change this to what you need for your VM design.
+	 * The page to invalidate, identified by the owning address
+	 * space (for its ASID) and virtual address. ts_as == NULL is
+	 * the overflow marker meaning "flush the whole TLB".
 	 */
-	int ts_placeholder;
+	struct addrspace *ts_as;
+	vaddr_t ts_vaddr;
 };
 
 #define TLBSHOOTDOWN_MAX 16
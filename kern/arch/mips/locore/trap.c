@@ -36,9 +36,12 @@
 #include <spl.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
 #include <vm.h>
+#include <ksyms.h>
 #include <mainbus.h>
 #include <syscall.h>
+#include <trapstat.h>
 
 
 /* in exception-*.S */
@@ -66,6 +69,55 @@ static const char *const trapcodenames[NTRAPCODES] = {
 	"Arithmetic overflow",
 };
 
+/*
+ * Exception statistics (see trapstat.h). Counted per cpu, indexed by
+ * c_number like the paging statistics, so the trap path never bounces
+ * a shared counter between cpus; the dump sums the cpus. The utlb
+ * counter separates fast-path TLB refill misses from the general
+ * exceptions, which arrive here with the same TLBL/TLBS codes.
+ */
+static struct {
+	uint64_t ts_counts[NTRAPCODES];
+	uint64_t ts_utlb;
+} trapstats_pcpu[VM_MAXCPUS];
+
+void
+trapstat_dump(void)
+{
+	uint64_t counts[NTRAPCODES];
+	uint64_t utlb, total;
+	unsigned i, j;
+
+	utlb = total = 0;
+	for (i = 0; i < NTRAPCODES; i++) {
+		counts[i] = 0;
+	}
+	for (j = 0; j < VM_MAXCPUS; j++) {
+		for (i = 0; i < NTRAPCODES; i++) {
+			counts[i] += trapstats_pcpu[j].ts_counts[i];
+		}
+		utlb += trapstats_pcpu[j].ts_utlb;
+	}
+
+	for (i = 0; i < NTRAPCODES; i++) {
+		if (counts[i] == 0) {
+			continue;
+		}
+		kprintf("%-24s %llu\n", trapcodenames[i],
+			(unsigned long long)counts[i]);
+		total += counts[i];
+	}
+	kprintf("%-24s %llu\n", "(utlb refill misses)",
+		(unsigned long long)utlb);
+	kprintf("%-24s %llu\n", "Total", (unsigned long long)total);
+}
+
+void
+trapstat_reset(void)
+{
+	bzero(trapstats_pcpu, sizeof(trapstats_pcpu));
+}
+
 /*
  * Function called when user-level code hits a fatal fault.
  */
@@ -128,9 +180,10 @@ void
 mips_trap(struct trapframe *tf)
 {
 	uint32_t code;
-	/*bool isutlb; -- not used */
+	bool isutlb;
 	bool iskern;
 	int spl;
+	char sym[64];
 
 	/* The trap frame is supposed to be 35 registers long. */
 	KASSERT(sizeof(struct trapframe)==(35*4));
@@ -139,11 +192,19 @@ mips_trap(struct trapframe *tf)
 	 * Extract the exception code info from the register fields.
 	 */
 	code = (tf->tf_cause & CCA_CODE) >> CCA_CODESHIFT;
-	/*isutlb = (tf->tf_cause & CCA_UTLB) != 0;*/
+	isutlb = (tf->tf_cause & CCA_UTLB) != 0;
 	iskern = (tf->tf_status & CST_KUp) == 0;
 
 	KASSERT(code < NTRAPCODES);
 
+	/* Count it. (During early boot there's no curcpu yet.) */
+	if (curthread != NULL) {
+		trapstats_pcpu[curcpu->c_number].ts_counts[code]++;
+		if (isutlb) {
+			trapstats_pcpu[curcpu->c_number].ts_utlb++;
+		}
+	}
+
 	/* Make sure we haven't run off our stack */
 	if (curthread != NULL && curthread->t_stack != NULL) {
 		KASSERT((vaddr_t)tf > (vaddr_t)curthread->t_stack);
@@ -214,6 +275,17 @@ mips_trap(struct trapframe *tf)
 	spl = splhigh();
 	splx(spl);
 
+	/*
+	 * If the OOM responder (vm.c) condemned this process, exit
+	 * now instead of dispatching. We came from user mode, so no
+	 * kernel locks or resources are held. (Interrupts taken from
+	 * user mode don't pass this point, but a condemned process -
+	 * one that is thrashing - faults again immediately.)
+	 */
+	if (!iskern && curproc != NULL && curproc->p_oomkill) {
+		sys__exit(SIGKILL);
+	}
+
 	/* Syscall? Call the syscall handler and return. */
 	if (code == EX_SYS) {
 		/* Interrupts should have been on while in user mode. */
@@ -311,8 +383,9 @@ mips_trap(struct trapframe *tf)
 
 	kprintf("panic: Fatal exception %u (%s) in kernel mode\n", code,
 		trapcodenames[code]);
-	kprintf("panic: EPC 0x%x, exception vaddr 0x%x\n",
-		tf->tf_epc, tf->tf_vaddr);
+	kprintf("panic: EPC 0x%x (%s), exception vaddr 0x%x\n",
+		tf->tf_epc, ksyms_format(tf->tf_epc, sym, sizeof(sym)),
+		tf->tf_vaddr);
 
 	panic("I can't handle this... I think I'll just die now...\n");
 
@@ -336,6 +409,8 @@ mips_trap(struct trapframe *tf)
 
 	cputhreads[curcpu->c_number] = (vaddr_t)curthread;
 	cpustacks[curcpu->c_number] = (vaddr_t)curthread->t_stack + STACK_SIZE;
+	cpupids[curcpu->c_number] =
+		curthread->t_proc ? (uint32_t)curthread->t_proc->p_pid : 0;
 
 	/*
 	 * This assertion will fail if either
@@ -381,6 +456,8 @@ mips_usermode(struct trapframe *tf)
 
 	cputhreads[curcpu->c_number] = (vaddr_t)curthread;
 	cpustacks[curcpu->c_number] = (vaddr_t)curthread->t_stack + STACK_SIZE;
+	cpupids[curcpu->c_number] =
+		curthread->t_proc ? (uint32_t)curthread->t_proc->p_pid : 0;
 
 	/*
 	 * This assertion will fail if either
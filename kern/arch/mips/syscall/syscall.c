@@ -38,6 +38,9 @@
 #include <endian.h>
 #include <copyinout.h>
 #include <addrspace.h>
+#include <cpu.h>
+#include <syscallstat.h>
+#include "opt-net.h"
 
 
 /*
@@ -85,6 +88,7 @@ syscall(struct trapframe *tf)
 	int32_t retval;
 	int64_t retval64;
 	bool is64bit_retval = false;
+	uint32_t startcycles;
 	int err;
 
 	KASSERT(curthread != NULL);
@@ -105,6 +109,9 @@ syscall(struct trapframe *tf)
 	retval = 0;
 	retval64 = 0;
 
+	// One flag test when sampling is off
+	startcycles = syscallstat_on ? cpu_cyclecount() : 0;
+
 	switch (callno) {
 	    case SYS_reboot: // 119
 		err = sys_reboot(tf->tf_a0);
@@ -119,9 +126,15 @@ syscall(struct trapframe *tf)
 		case SYS_open: // 45
 		err = sys_open((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2, &retval);
 		break;
+		case SYS_dup: // 47
+		err = sys_dup(tf->tf_a0, &retval);
+		break;
 		case SYS_dup2: // 48
 		err = sys_dup2(tf->tf_a0, tf->tf_a1, &retval);
 		break;
+		case SYS_pipe: // 46
+		err = sys_pipe((userptr_t)tf->tf_a0);
+		break;
 		case SYS_close: // 49
 		err = sys_close(tf->tf_a0);
 		break;
@@ -131,6 +144,34 @@ syscall(struct trapframe *tf)
 		case SYS_write: // 55
 		err = sys_write(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, &retval);
 		break;
+		case SYS_readv: // 52
+		err = sys_readv(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, &retval);
+		break;
+		case SYS_writev: // 57
+		err = sys_writev(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, &retval);
+		break;
+		case SYS_pread: // 51
+		case SYS_pwrite: // 56
+		{
+			// The 64-bit offset is the fourth argument; it can't
+			// go in a register pair (a3 isn't aligned), so it's
+			// on the stack at sp+16.
+			uint64_t offset;
+			err = copyin((userptr_t)(tf->tf_sp + 16), &offset, sizeof(offset));
+			if (err) {
+				break;
+			}
+
+			if (callno == SYS_pread) {
+				err = sys_pread(tf->tf_a0, (userptr_t)tf->tf_a1,
+						tf->tf_a2, offset, &retval);
+			}
+			else {
+				err = sys_pwrite(tf->tf_a0, (userptr_t)tf->tf_a1,
+						 tf->tf_a2, offset, &retval);
+			}
+			break;
+		}
 		case SYS_lseek: // 59
 		{
 			is64bit_retval = true;
@@ -153,15 +194,41 @@ syscall(struct trapframe *tf)
 
 			break;
 		}
+		case SYS_fsync: // 62
+		err = sys_fsync(tf->tf_a0);
+		break;
+		case SYS_poll: // 66
+		err = sys_poll((userptr_t)tf->tf_a0, tf->tf_a1,
+			       (int)tf->tf_a2, &retval);
+		break;
+		case SYS_getdirentry: // 54
+		err = sys_getdirentry(tf->tf_a0, (userptr_t)tf->tf_a1,
+				      tf->tf_a2, &retval);
+		break;
 		case SYS_remove: // 68
 		err = sys_remove((userptr_t)tf->tf_a0);
 		break;
+		case SYS_mkdir: // 69
+		err = sys_mkdir((userptr_t)tf->tf_a0, tf->tf_a1);
+		break;
+		case SYS_rmdir: // 70
+		err = sys_rmdir((userptr_t)tf->tf_a0);
+		break;
 		case SYS_chdir: // 74
 		err = sys_chdir((userptr_t)tf->tf_a0);
 		break;
 		case SYS___getcwd: // 76
 		err = sys___getcwd((userptr_t)tf->tf_a0, tf->tf_a1, &retval);
 		break;
+		case SYS_stat: // 81
+		err = sys_stat((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+		case SYS_fstat: // 82
+		err = sys_fstat(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+		case SYS_lstat: // 83
+		err = sys_lstat((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
 
 		case SYS_fork: // 0
 		err = sys_fork(tf, &retval);
@@ -169,12 +236,18 @@ syscall(struct trapframe *tf)
 		case SYS_execv: // 2
 		err = sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
 		break;
+		case SYS_spawn: // 122
+		err = sys_spawn((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1, &retval);
+		break;
 		case SYS__exit: // 3
 		err = sys__exit(tf->tf_a0);
 		break;
 		case SYS_waitpid: // 4
 		err = sys_waitpid(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2, &retval);
 		break;
+		case SYS_getrusage: // 35
+		err = sys_getrusage(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
 		case SYS_getpid: // 5
 		err = sys_getpid(&retval);
 		break;
@@ -183,12 +256,179 @@ syscall(struct trapframe *tf)
 		err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
 		break;
 
+		case SYS_mmap: // 8
+		{
+			/*
+			 * Six arguments: addr, len, prot, flags in
+			 * registers; fd in the first stack slot and
+			 * the 64-bit offset in the next aligned pair,
+			 * per the calling convention (cf. lseek).
+			 */
+			int fd;
+			off_t offset;
+
+			err = copyin((userptr_t)(tf->tf_sp + 16), &fd,
+				     sizeof(fd));
+			if (err) {
+				break;
+			}
+			err = copyin((userptr_t)(tf->tf_sp + 24), &offset,
+				     sizeof(offset));
+			if (err) {
+				break;
+			}
+
+			err = sys_mmap((vaddr_t)tf->tf_a0,
+				       (size_t)tf->tf_a1,
+				       (int)tf->tf_a2, (int)tf->tf_a3,
+				       fd, offset, &retval);
+			break;
+		}
+
+		case SYS_munmap: // 9
+		err = sys_munmap((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+
+		case SYS_madvise: // 11
+		err = sys_madvise((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1,
+				  (int)tf->tf_a2);
+		break;
+
+		case SYS_mlock: // 13
+		err = sys_mlock((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+
+		case SYS_munlock: // 14
+		err = sys_munlock((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+
+		case SYS_shmget: // 123
+		err = sys_shmget(tf->tf_a0, (size_t)tf->tf_a1, &retval);
+		break;
+
+		case SYS_shmat: // 124
+		err = sys_shmat((int)tf->tf_a0, &retval);
+		break;
+
+		case SYS_futex: // 125
+		err = sys_futex((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+				tf->tf_a2, &retval);
+		break;
+
+		case SYS_tfork: // 128
+		err = sys_tfork((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+				tf->tf_a2, &retval);
+		break;
+
+		case SYS_texit: // 129
+		err = sys_texit((userptr_t)tf->tf_a0);
+		break;
+
+		case SYS_setaffinity: // 130
+		err = sys_setaffinity(tf->tf_a0);
+		break;
+
+		case SYS_settls: // 131
+		err = sys_settls((userptr_t)tf->tf_a0);
+		break;
+
+		case SYS_gettls: // 132
+		err = sys_gettls(&retval);
+		break;
+
+		case SYS_fadvise: // 133
+		{
+			// The 64-bit offset rides in a2/a3 (cf. lseek); the
+			// 64-bit length and the advice follow on the stack.
+			uint64_t offset, len;
+			int advice;
+
+			join32to64(tf->tf_a2, tf->tf_a3, &offset);
+			err = copyin((userptr_t)(tf->tf_sp + 16), &len,
+				     sizeof(len));
+			if (err) {
+				break;
+			}
+			err = copyin((userptr_t)(tf->tf_sp + 24), &advice,
+				     sizeof(advice));
+			if (err) {
+				break;
+			}
+			err = sys_fadvise(tf->tf_a0, offset, len, advice);
+			break;
+		}
+
+		case SYS_openat: // 134
+		err = sys_openat(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2,
+				 tf->tf_a3, &retval);
+		break;
+
+		case SYS_checkpoint: // 135
+		err = sys_checkpoint(tf, (userptr_t)tf->tf_a0, &retval);
+		break;
+
+#if OPT_NET
+		case SYS_socket: // 98
+		err = sys_socket(tf->tf_a0, tf->tf_a1, tf->tf_a2, &retval);
+		break;
+
+		case SYS_bind: // 99
+		err = sys_bind(tf->tf_a0, (userptr_t)tf->tf_a1, tf->tf_a2);
+		break;
+
+		case SYS_recvfrom: // 109
+		case SYS_sendto: // 110
+		{
+			// The address pointer and length are the fifth and
+			// sixth arguments, on the stack at sp+16 and sp+20.
+			uint32_t extra[2];
+			err = copyin((userptr_t)(tf->tf_sp + 16), extra,
+				     sizeof(extra));
+			if (err) {
+				break;
+			}
+
+			if (callno == SYS_sendto) {
+				err = sys_sendto(tf->tf_a0,
+						 (userptr_t)tf->tf_a1,
+						 tf->tf_a2, tf->tf_a3,
+						 (userptr_t)extra[0],
+						 extra[1], &retval);
+			}
+			else {
+				err = sys_recvfrom(tf->tf_a0,
+						   (userptr_t)tf->tf_a1,
+						   tf->tf_a2, tf->tf_a3,
+						   (userptr_t)extra[0],
+						   (userptr_t)extra[1],
+						   &retval);
+			}
+			break;
+		}
+#endif
+
+		case SYS___vmstats: // 126
+		err = sys___vmstats((userptr_t)tf->tf_a0);
+		break;
+
+		case SYS___getvmstats: // 127
+		err = sys___getvmstats((pid_t)tf->tf_a0,
+				       (userptr_t)tf->tf_a1);
+		break;
+
+		case SYS___kheapstats: // 121
+		err = sys___kheapstats((userptr_t)tf->tf_a0);
+		break;
+
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
 		err = ENOSYS;
 		break;
 	}
 
+	if (syscallstat_on) {
+		syscallstat_record(callno, startcycles);
+	}
 
 	if (err) {
 		/*
@@ -232,7 +472,9 @@ syscall(struct trapframe *tf)
 void
 enter_forked_process(void* data, unsigned long ndata)
 {
-	KASSERT(ndata == 1);
+	// The second data word is the parent's TLS base; the child
+	// continues the same user thread, so keep it.
+	curthread->t_usertls = (userptr_t)ndata;
 
 	struct trapframe *tf = (struct trapframe *)data;
 
@@ -250,3 +492,21 @@ enter_forked_process(void* data, unsigned long ndata)
 	// Switch to user mode with this trapframe
 	mips_usermode(&tf_stack);
 }
+
+/*
+ * Enter user mode for a process rebuilt by checkpoint restore. Unlike
+ * enter_forked_process this runs in the restoring thread itself, with
+ * the saved trapframe already on its stack, and checkpoint() reports
+ * 1 rather than 0 in the process that resumes from it.
+ */
+void
+enter_restored_process(struct trapframe *tf)
+{
+	tf->tf_v0 = 1;
+	tf->tf_a3 = 0;		// signal no error
+	tf->tf_epc += 4;	// advance past the syscall
+
+	as_activate();
+
+	mips_usermode(tf);
+}
@@ -37,7 +37,9 @@
 #include <mips/trapframe.h>
 #include <platform/maxcpus.h>
 #include <cpu.h>
+#include <clock.h>
 #include <thread.h>
+#include <mainbus.h>
 
 ////////////////////////////////////////////////////////////
 
@@ -67,6 +69,23 @@
 vaddr_t cpustacks[MAXCPUS];
 vaddr_t cputhreads[MAXCPUS];
 
+/*
+ * Top-level page table (pt_l1) of the address space active on each
+ * CPU, or 0 when there is none. Maintained by as_activate and
+ * as_deactivate, and read by the assembly TLB refill handler in
+ * exception-mips1.S, which can't chase curthread->...->pt_l1 with
+ * only k0/k1 to work in.
+ */
+vaddr_t cpuptbases[MAXCPUS];
+
+/*
+ * Pid of the process running on each CPU. Refreshed alongside
+ * cpustacks[]/cputhreads[] whenever a thread heads to user mode, and
+ * read by the assembly fast path in exception-mips1.S that answers
+ * getpid without building a trapframe.
+ */
+uint32_t cpupids[MAXCPUS];
+
 /*
  * Do machine-dependent initialization of the cpu structure or things
  * associated with a new cpu. Note that we're not running on the new
@@ -178,6 +197,29 @@ cpu_identify(char *buf, size_t max)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Cycle counter.
+ *
+ * Coprocessor 0 register 9 counts cycles. On System/161 the timer
+ * interrupt code restarts it when it writes c0_compare (see
+ * lamebus_machdep.c), so deltas are only meaningful while interrupts
+ * stay off on this cpu; that is all the lock profiler needs.
+ */
+uint32_t
+cpu_cyclecount(void)
+{
+	uint32_t count;
+
+	__asm volatile(".set push;"	/* save assembler mode */
+		       ".set mips32;"	/* allow mips32 instructions */
+		       "mfc0 %0,$9;"	/* get c0_count */
+		       ".set pop"	/* restore assembler mode */
+		       : "=r" (count));
+	return count;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Interrupt control.
  *
@@ -288,12 +330,34 @@ wait(void)
 
 /*
  * Idle the processor until something happens.
+ *
+ * Go tickless while we're at it: an idle cpu has no timeslices to
+ * account and nothing to schedule, so ask the clock code how far the
+ * next real deadline is and program the timer for that instead of
+ * taking HZ do-nothing interrupts a second. Whatever ends the wait -
+ * the delayed timer interrupt or some other wakeup - the skipped
+ * ticks get credited before we return (the timer interrupt path does
+ * its own crediting; see mainbus_timer_unskip).
  */
 void
 cpu_idle(void)
 {
+	uint32_t nticks, elapsed;
+
+	nticks = timer_idleticks();
+	if (nticks > 1) {
+		mainbus_timer_skip(nticks);
+	}
+
 	wait();
         cpu_irqonoff();
+
+	if (nticks > 1) {
+		elapsed = mainbus_timer_unskip();
+		if (elapsed > 0) {
+			hardclock_catchup(elapsed);
+		}
+	}
 }
 
 /*
@@ -51,14 +51,13 @@ ram_bootstrap(void)
 	ramsize = mainbus_ramsize();
 
 	/*
-	 * This is the same as the last physical address, as long as
-	 * we have less than 512 megabytes of memory. If we had more,
-	 * we wouldn't be able to access it all through kseg0 and
-	 * everything would get a lot more complicated. This is not a
-	 * case we are going to worry about.
+	 * Kseg0 can only reach the first 512 megabytes directly; RAM
+	 * beyond that is reached through the kseg2 window, which adds
+	 * another gigabyte (see PADDR_TO_KVADDR). Physical memory past
+	 * 1.5G would be unreachable, so clamp there.
 	 */
-	if (ramsize > 512*1024*1024) {
-		ramsize = 512*1024*1024;
+	if (ramsize > (size_t)MIPS_DIRECTMEM_SIZE + MIPS_KSEG2_SIZE) {
+		ramsize = (size_t)MIPS_DIRECTMEM_SIZE + MIPS_KSEG2_SIZE;
 	}
 
 	lastpaddr = ramsize;
@@ -74,40 +73,39 @@ ram_bootstrap(void)
 }
 
 /*
- * This function is for allocating physical memory prior to VM
- * initialization.
+ * This function is for carving out physical memory prior to VM
+ * initialization: SIZE bytes at an ALIGN-byte boundary (ALIGN must be
+ * a power of 2). Because it is byte-granular, several boot-time
+ * structures can share a page instead of each rounding up to one;
+ * whatever is left of the last partial page is absorbed when
+ * ram_getfirstfree() rounds up.
  *
- * The pages it hands back will not be reported to the VM system when
- * the VM system calls ram_getsize(). If it's desired to free up these
- * pages later on after bootup is complete, some mechanism for adding
- * them to the VM system's page management must be implemented.
- * Alternatively, one can do enough VM initialization early so that
- * this function is never needed.
+ * The memory it hands back can never be freed and is not reported to
+ * the VM system by ram_getfirstfree().
  *
  * Note: while the error return value of 0 is a legal physical address,
  * it's not a legal *allocatable* physical address, because it's the
  * page with the exception handlers on it.
  *
- * This function should not be called once the VM system is initialized,
+ * This function may not be called once the VM system is initialized,
  * so it is not synchronized.
  */
 paddr_t
-ram_stealmem(unsigned long npages)
+ram_carve(size_t size, size_t align)
 {
-	// We don't allow stealmem to work
-	KASSERT(0);
-
-	size_t size;
 	paddr_t paddr;
 
-	size = npages * PAGE_SIZE;
+	/* Only before ram_getfirstfree() zeroes the bounds. */
+	KASSERT(lastpaddr != 0);
 
-	if (firstpaddr + size > lastpaddr) {
+	KASSERT(align > 0);
+	KASSERT((align & (align - 1)) == 0);
+
+	paddr = (firstpaddr + align - 1) & ~(paddr_t)(align - 1);
+	if (paddr > lastpaddr || size > lastpaddr - paddr) {
 		return 0;
 	}
-
-	paddr = firstpaddr;
-	firstpaddr += size;
+	firstpaddr = paddr + size;
 
 	return paddr;
 }
@@ -138,9 +136,9 @@ ram_getsize(void)
  * initializes in order to find out what memory it has available to
  * manage.
  *
- * It can only be called once, and once called ram_stealmem() will
- * no longer work, as that would invalidate the result it returned
- * and lead to multiple things using the same memory.
+ * It can only be called once, and once called ram_carve() will no
+ * longer work, as that would invalidate the result it returned and
+ * lead to multiple things using the same memory.
  *
  * This function should not be called once the VM system is initialized,
  * so it is not synchronized.
@@ -150,7 +148,8 @@ ram_getfirstfree(void)
 {
 	paddr_t ret;
 
-	ret = firstpaddr;
+	/* Round any partial page the carves used up to a page bound. */
+	ret = ROUNDUP(firstpaddr, PAGE_SIZE);
 	firstpaddr = lastpaddr = 0;
 	return ret;
 }
@@ -32,6 +32,7 @@
 #include <lib.h>
 #include <mips/specialreg.h>
 #include <mips/trapframe.h>
+#include <platform/maxcpus.h>
 #include <cpu.h>
 #include <spl.h>
 #include <clock.h>
@@ -39,6 +40,8 @@
 #include <current.h>
 #include <membar.h>
 #include <synch.h>
+#include <softirq.h>
+#include <kprof.h>
 #include <mainbus.h>
 #include <sys161/bus.h>
 #include <lamebus/lamebus.h>
@@ -76,6 +79,129 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Read the on-chip cycle counter. System/161 restarts the count when
+ * c0_compare is written (that's what makes reloading the same compare
+ * value above give a periodic interrupt), so this reads as cycles
+ * since the last mips_timer_set.
+ */
+static
+uint32_t
+mips_timer_read(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+/*
+ * Hardclock periods covered by the currently programmed timer
+ * interval on each cpu: 0 for the normal one-tick cadence, more after
+ * mainbus_timer_skip. Each slot is only touched by its own cpu with
+ * interrupts off.
+ */
+static uint32_t mips_timer_skipticks[MAXCPUS];
+
+/*
+ * Cycles banked at each timer reload, per cpu. Writing c0_compare
+ * restarts the count, so every place that reprograms the timer first
+ * banks the cycles the old interval accumulated; the banked total
+ * plus the live count is then a monotonic per-boot cycle clock (see
+ * mainbus_cycles). Each slot is only touched by its own cpu with
+ * interrupts off.
+ */
+static uint64_t mips_timer_cycletotals[MAXCPUS];
+
+static
+void
+mips_timer_bank(uint32_t count)
+{
+	mips_timer_cycletotals[curcpu->c_number] += count;
+}
+
+/*
+ * Program the timer to next fire NTICKS hardclock periods from now.
+ * Interrupts must be off; the skip ends either in the timer interrupt
+ * (which credits the skipped ticks itself) or in mainbus_timer_unskip.
+ */
+void
+mainbus_timer_skip(uint32_t nticks)
+{
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(nticks >= 1 && nticks <= HZ);
+
+	mips_timer_skipticks[curcpu->c_number] = nticks;
+	mips_timer_bank(mips_timer_read());
+	mips_timer_set((CPU_FREQUENCY / HZ) * nticks);
+}
+
+/*
+ * Return to the regular cadence after a skip ended by a non-timer
+ * wakeup. Returns the whole hardclock periods that passed while
+ * skipping, for the caller to credit; 0 if the timer interrupt
+ * already ended the skip (or none was in progress).
+ */
+uint32_t
+mainbus_timer_unskip(void)
+{
+	uint32_t nticks, elapsed, count;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	nticks = mips_timer_skipticks[curcpu->c_number];
+	if (nticks == 0) {
+		return 0;
+	}
+	mips_timer_skipticks[curcpu->c_number] = 0;
+
+	count = mips_timer_read();
+	mips_timer_bank(count);
+	elapsed = count / (CPU_FREQUENCY / HZ);
+	mips_timer_set(CPU_FREQUENCY / HZ);
+	if (elapsed > nticks) {
+		/* Shouldn't happen; don't credit more than we skipped. */
+		elapsed = nticks;
+	}
+	return elapsed;
+}
+
+/*
+ * Monotonic cycle clock: the banked totals plus the live count.
+ * Interrupts must be off across the two reads so the timer interrupt
+ * can't bank the live count in between. Each cpu's epoch starts when
+ * its timer is first programmed, so timestamps are monotonic on each
+ * cpu but only approximately comparable across cpus.
+ */
+uint64_t
+mainbus_cycles(void)
+{
+	uint64_t total;
+	int spl;
+
+	spl = splhigh();
+	total = mips_timer_cycletotals[curcpu->c_number] + mips_timer_read();
+	splx(spl);
+	return total;
+}
+
+/*
+ * Convert a cycle count or delta to nanoseconds. At 25 MHz each cycle
+ * is exactly 40 ns, so this doesn't lose precision; it is, however,
+ * only as accurate as the compiled-in CPU_FREQUENCY (see above).
+ */
+uint64_t
+mainbus_cycles_to_ns(uint64_t cycles)
+{
+	return cycles * (1000000000 / CPU_FREQUENCY);
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -285,6 +411,15 @@ mainbus_debugger(void)
 	ltrace_stop(0);
 }
 
+/*
+ * Print the per-slot interrupt statistics.
+ */
+void
+mainbus_dumpirqstats(void)
+{
+	lamebus_dumpstats(lamebus);
+}
+
 /*
  * Interrupt dispatcher.
  */
@@ -309,13 +444,46 @@ mainbus_interrupt(struct trapframe *tf)
 		seen = true;
 	}
 	if (cause & LAMEBUS_IPI_BIT) {
-		interprocessor_interrupt();
+		/*
+		 * Ack the (level-triggered) IPI line before draining
+		 * the mailbox: a command posted after the ack simply
+		 * re-raises the line. Clearing afterwards would open
+		 * a window where a command posted between the drain
+		 * and the clear never interrupts, now that senders
+		 * skip raising the line when the mailbox was already
+		 * nonempty.
+		 */
 		lamebus_clear_ipi(lamebus, curcpu);
+		interprocessor_interrupt();
 		seen = true;
 	}
+
+	/*
+	 * Run completion work the device handlers deferred, before
+	 * the timer processing: hardclock may switch threads, which
+	 * would postpone anything dispatched after it until this
+	 * context runs again.
+	 */
+	softirq_dispatch();
+
 	if (cause & MIPS_TIMER_BIT) {
+		uint32_t skipped;
+
+		/*
+		 * If this cpu was skipping ticks (tickless idle), this
+		 * one interrupt stands in for all of them; credit all
+		 * but the tick hardclock() itself delivers.
+		 */
+		skipped = mips_timer_skipticks[curcpu->c_number];
+		mips_timer_skipticks[curcpu->c_number] = 0;
+		if (skipped > 1) {
+			hardclock_catchup(skipped - 1);
+		}
 		/* Reset the timer (this clears the interrupt) */
+		mips_timer_bank(mips_timer_read());
 		mips_timer_set(CPU_FREQUENCY / HZ);
+		/* Feed the interrupted pc to the sampling profiler */
+		kprof_sample(tf->tf_epc);
 		/* and call hardclock */
 		hardclock();
 		seen = true;
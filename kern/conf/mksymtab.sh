@@ -0,0 +1,107 @@
+#!/bin/sh
+#
+# mksymtab.sh - emit symtab.c, the kernel's embedded symbol table, in
+#               the current directory (a build directory).
+#
+# Usage: mksymtab.sh [NM KERNEL]
+#
+# With no arguments, emits an empty table to satisfy the first link.
+# With a nm program and a linked kernel, emits the real table for the
+# relink: the kernel's text symbols, sorted by address, with the names
+# packed into one string blob. Only text symbols go in, since the
+# table exists to turn program counters into function names.
+
+#
+# Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+#	The President and Fellows of Harvard College.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+# 3. Neither the name of the University nor the names of its contributors
+#    may be used to endorse or promote products derived from this software
+#    without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+#
+
+if [ ! -f autoconf.c ]; then
+    #
+    # If there's no file autoconf.c, we are in the wrong place.
+    #
+    echo "$0: Not in a kernel build directory" 1>&2
+    exit 1
+fi
+
+echo '/* This file is automatically generated. Edits will be lost. */'
+echo '#include <types.h>'
+echo '#include <ksyms.h>'
+echo ''
+
+if [ "x$1" = x ]; then
+    #
+    # Empty table for the first link; the relink replaces it.
+    #
+    echo 'const unsigned ksyms_count = 0;'
+    echo 'const uint32_t ksyms_addrs[] = { 0 };'
+    echo 'const uint32_t ksyms_nameoffs[] = { 0 };'
+    echo 'const char ksyms_names[] = "";'
+    exit 0
+fi
+
+NM="$1"
+KERNEL="$2"
+
+#
+# nm -n sorts by address, which is the order the binary search in
+# ksyms.c expects.
+#
+
+"$NM" -n "$KERNEL" | awk '
+    BEGIN {
+	n = 0;
+    }
+    $2 == "T" || $2 == "t" {
+	addrs[n] = $1;
+	names[n] = $3;
+	n++;
+    }
+    END {
+	printf "const unsigned ksyms_count = %d;\n", n;
+	printf "\n";
+	printf "const uint32_t ksyms_addrs[] = {\n";
+	for (i = 0; i < n; i++) {
+	    printf "\t0x%s,\n", addrs[i];
+	}
+	printf "};\n";
+	printf "\n";
+	printf "const uint32_t ksyms_nameoffs[] = {\n";
+	off = 0;
+	for (i = 0; i < n; i++) {
+	    printf "\t%d,\n", off;
+	    off += length(names[i]) + 1;
+	}
+	printf "};\n";
+	printf "\n";
+	printf "const char ksyms_names[] =\n";
+	for (i = 0; i < n; i++) {
+	    printf "\t\"%s\\0\"\n", names[i];
+	}
+	printf ";\n";
+    }
+'
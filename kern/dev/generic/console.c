@@ -49,6 +49,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/poll.h>
 #include <lib.h>
 #include <uio.h>
 #include <cpu.h>
@@ -56,7 +57,9 @@
 #include <current.h>
 #include <synch.h>
 #include <generic/console.h>
+#include <klog.h>
 #include <vfs.h>
+#include <vnode.h>
 #include <device.h>
 #include "autoconf.h"
 
@@ -65,6 +68,13 @@
  */
 static struct con_softc *the_console = NULL;
 
+/*
+ * The kernel log drain port, if any: a second console-class device
+ * (con1) that carries only klog output, so the real console stays
+ * free for userland. Output-only; input arriving on it is dropped.
+ */
+static struct con_softc *the_logport = NULL;
+
 /*
  * Lock so user I/Os are atomic.
  * We use two locks so readers waiting for input don't lock out writers.
@@ -109,28 +119,79 @@ flush_delay_buf(void)
 
 //////////////////////////////////////////////////
 
+/*
+ * Take the oldest character out of the output ring, or return -1 if
+ * the ring is empty. Caller holds cs_outlock.
+ */
+static
+int
+con_outbuf_pop(struct con_softc *cs)
+{
+	unsigned char ch;
+
+	if (ringbuf_consume(&cs->cs_outring, &ch, 1) == 0) {
+		return -1;
+	}
+	return ch;
+}
+
 /*
  * Print a character, using polling instead of interrupts to wait for
- * I/O completion.
+ * I/O completion. Anything still in the output ring is flushed first,
+ * so output appears in order. This is the path used with interrupts
+ * off and during panics; don't re-take the spinlock if a panic came
+ * from inside the buffering code.
  */
 static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	bool dolock;
+	int bch;
+
+	dolock = !spinlock_do_i_hold(&cs->cs_outlock);
+	if (dolock) {
+		spinlock_acquire(&cs->cs_outlock);
+	}
+	while ((bch = con_outbuf_pop(cs)) >= 0) {
+		cs->cs_sendpolled(cs->cs_devdata, bch);
+	}
 	cs->cs_sendpolled(cs->cs_devdata, ch);
+	if (dolock) {
+		spinlock_release(&cs->cs_outlock);
+	}
 }
 
 //////////////////////////////////////////////////
 
 /*
- * Print a character, using interrupts to wait for I/O completion.
+ * Print a character by appending it to the output ring and returning;
+ * the device's write-done interrupt drains the ring (con_start), so
+ * the caller never waits on the hardware. If the ring is full, the
+ * oldest character is pushed out by polling to make room, which
+ * degrades to roughly the old synchronous behavior under sustained
+ * bursts.
  */
 static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	unsigned char c = ch;
+
+	spinlock_acquire(&cs->cs_outlock);
+
+	if (ringbuf_produce(&cs->cs_outring, &c, 1) == 0) {
+		/* Ring full; push the oldest character out to make room. */
+		cs->cs_sendpolled(cs->cs_devdata, con_outbuf_pop(cs));
+		ringbuf_produce(&cs->cs_outring, &c, 1);
+	}
+
+	if (!cs->cs_outbusy) {
+		cs->cs_outbusy = true;
+		cs->cs_send(cs->cs_devdata, con_outbuf_pop(cs));
+	}
+
+	spinlock_release(&cs->cs_outlock);
 }
 
 /*
@@ -141,50 +202,84 @@ int
 getch_intr(struct con_softc *cs)
 {
 	unsigned char ret;
+	uint32_t n;
 
 	P(cs->cs_rsem);
-	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
-	cs->cs_gotchars_tail =
-		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+	n = ringbuf_consume(&cs->cs_inring, &ret, 1);
+	KASSERT(n == 1);	/* the semaphore counts the ring's bytes */
 	return ret;
 }
 
 /*
  * Called from underlying device when a read-ready interrupt occurs.
  *
- * Note: if gotchars_head == gotchars_tail, the buffer is empty. Thus
- * if gotchars_head+1 == gotchars_tail, the buffer is full. A slightly
- * tidier way to implement this check (that avoids wasting a slot,
- * too) would be with a second semaphore used with a nonblocking P,
- * but we don't have that in OS/161.
+ * The input ring is single-producer (us) single-consumer (getch), so
+ * it needs no lock; the semaphore count tracks the bytes in the ring.
  */
 void
 con_input(void *vcs, int ch)
 {
 	struct con_softc *cs = vcs;
-	unsigned nexthead;
+	unsigned char c = ch;
 
-	nexthead = (cs->cs_gotchars_head + 1) % CONSOLE_INPUT_BUFFER_SIZE;
-	if (nexthead == cs->cs_gotchars_tail) {
-		/* overflow; drop character */
+	if (cs->cs_rsem == NULL) {
+		/* the klog drain port is output-only; drop input */
 		return;
 	}
 
-	cs->cs_gotchars[cs->cs_gotchars_head] = ch;
-	cs->cs_gotchars_head = nexthead;
+	if (ringbuf_produce(&cs->cs_inring, &c, 1) == 0) {
+		/* overflow; drop character */
+		return;
+	}
 
 	V(cs->cs_rsem);
+
+	/* The console may have just become readable. */
+	pollnotify();
 }
 
 /*
  * Called from underlying device when a write-done interrupt occurs.
+ * Send the next buffered character, or fall idle if there isn't one.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
+	int ch;
+
+	spinlock_acquire(&cs->cs_outlock);
+	ch = con_outbuf_pop(cs);
+	if (ch >= 0) {
+		cs->cs_send(cs->cs_devdata, ch);
+	}
+	else {
+		cs->cs_outbusy = false;
+	}
+	spinlock_release(&cs->cs_outlock);
+}
+
+//////////////////////////////////////////////////
+
+/*
+ * Kernel log sink, registered with klog_setdrain when a second
+ * console-class device attaches. Uses the same buffered/polled output
+ * machinery as the console itself, so draining the log normally just
+ * appends to the port's output ring and doesn't wait on the hardware.
+ */
+static
+void
+con_klogdrain(void *vcs, const char *data, size_t len)
+{
+	struct con_softc *cs = vcs;
+	size_t i;
 
-	V(cs->cs_wsem);
+	for (i=0; i<len; i++) {
+		if (data[i]=='\n') {
+			putch_to(cs, '\r');
+		}
+		putch_to(cs, data[i]);
+	}
 }
 
 //////////////////////////////////////////////////
@@ -197,6 +292,24 @@ con_start(void *vcs)
  * not, and does not.
  */
 
+/*
+ * Print one character on CS, buffered if the current context allows
+ * sleeping for the write-done interrupt and polled if it doesn't.
+ */
+static
+void
+putch_to(struct con_softc *cs, int ch)
+{
+	if (curthread->t_in_interrupt ||
+	    curthread->t_curspl > 0 ||
+	    curcpu->c_spinlocks > 0) {
+		putch_polled(cs, ch);
+	}
+	else {
+		putch_intr(cs, ch);
+	}
+}
+
 void
 putch(int ch)
 {
@@ -205,13 +318,8 @@ putch(int ch)
 	if (cs==NULL) {
 		putch_delayed(ch);
 	}
-	else if (curthread->t_in_interrupt ||
-		 curthread->t_curspl > 0 ||
-		 curcpu->c_spinlocks > 0) {
-		putch_polled(cs, ch);
-	}
 	else {
-		putch_intr(cs, ch);
+		putch_to(cs, ch);
 	}
 }
 
@@ -302,10 +410,31 @@ con_ioctl(struct device *dev, int op, userptr_t data)
 	return EINVAL;
 }
 
+/*
+ * Readable when there are buffered input characters; always writable,
+ * since putch buffers (or polls) rather than waiting. The unlocked
+ * peek at the input ring is harmless: a stale answer is no worse
+ * than a character arriving just after we looked, and con_input's
+ * pollnotify wakes any sleeping poller.
+ */
+static
+int
+con_poll(struct device *dev, int events, int *revents)
+{
+	struct con_softc *cs = dev->d_data;
+
+	*revents = events & POLLOUT;
+	if ((events & POLLIN) && ringbuf_used(&cs->cs_inring) > 0) {
+		*revents |= POLLIN;
+	}
+	return 0;
+}
+
 static const struct device_ops console_devops = {
 	.devop_eachopen = con_eachopen,
 	.devop_io = con_io,
 	.devop_ioctl = con_ioctl,
+	.devop_poll = con_poll,
 };
 
 static
@@ -343,49 +472,69 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct semaphore *rsem;
 	struct lock *rlk, *wlk;
 
 	/*
-	 * Only allow one system console.
-	 * Further devices that could be the system console are ignored.
+	 * Unit 0 becomes the system console; unit 1, if present,
+	 * becomes the kernel log drain port. Further devices that
+	 * could be the system console are ignored.
 	 *
 	 * Do not hardwire the console to be "con1" instead of "con0",
 	 * or these asserts will go off.
 	 */
-	if (unit>0) {
+	if (unit>1) {
 		KASSERT(the_console!=NULL);
 		return ENODEV;
 	}
+
+	if (unit==1) {
+		KASSERT(the_console!=NULL);
+		KASSERT(the_logport==NULL);
+
+		/*
+		 * Output only: cs_rsem stays NULL, which tells
+		 * con_input to drop anything typed at this port, and
+		 * the input ring is never initialized. Not attached
+		 * to the VFS; it's reachable only through klog.
+		 */
+		cs->cs_rsem = NULL;
+
+		spinlock_init(&cs->cs_outlock);
+		ringbuf_init(&cs->cs_outring, cs->cs_outbuf,
+			     CONSOLE_OUTPUT_BUFFER_SIZE);
+		cs->cs_outbusy = false;
+
+		the_logport = cs;
+		klog_setdrain(con_klogdrain, cs);
+		return 0;
+	}
 	KASSERT(the_console==NULL);
 
 	rsem = sem_create("console read", 0);
 	if (rsem == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
-		sem_destroy(rsem);
-		return ENOMEM;
-	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
 		sem_destroy(rsem);
-		sem_destroy(wsem);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
 		sem_destroy(rsem);
-		sem_destroy(wsem);
 		return ENOMEM;
 	}
 
 	cs->cs_rsem = rsem;
-	cs->cs_wsem = wsem;
-	cs->cs_gotchars_head = 0;
-	cs->cs_gotchars_tail = 0;
+	ringbuf_init(&cs->cs_inring, cs->cs_inbuf,
+		     CONSOLE_INPUT_BUFFER_SIZE);
+
+	spinlock_init(&cs->cs_outlock);
+	ringbuf_init(&cs->cs_outring, cs->cs_outbuf,
+		     CONSOLE_OUTPUT_BUFFER_SIZE);
+	cs->cs_outbusy = false;
 
 	the_console = cs;
 	con_userlock_read = rlk;
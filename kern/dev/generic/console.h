@@ -30,6 +30,9 @@
 #ifndef _GENERIC_CONSOLE_H_
 #define _GENERIC_CONSOLE_H_
 
+#include <spinlock.h>
+#include <ringbuf.h>
+
 /*
  * Device data for the hardware-independent system console.
  *
@@ -38,6 +41,7 @@
  */
 
 #define CONSOLE_INPUT_BUFFER_SIZE 32
+#define CONSOLE_OUTPUT_BUFFER_SIZE 4096
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -45,12 +49,26 @@ struct con_softc {
 	void (*cs_send)(void *devdata, int ch);
 	void (*cs_sendpolled)(void *devdata, int ch);
 
-	/* initialized by config routine */
+	/*
+	 * Input ring: filled by the read-ready interrupt (con_input),
+	 * drained by getch. SPSC, so no lock.
+	 */
 	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
-	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
-	unsigned cs_gotchars_head;	/* next slot to put a char in */
-	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+	struct ringbuf cs_inring;
+	unsigned char cs_inbuf[CONSOLE_INPUT_BUFFER_SIZE];
+
+	/*
+	 * Output ring: putch appends and returns; the device's
+	 * write-done interrupt (con_start) drains it one character at
+	 * a time. Polled output flushes the ring synchronously first
+	 * so everything appears in order. The spinlock serializes the
+	 * many producers and the busy-flag handshake with the
+	 * interrupt side.
+	 */
+	struct spinlock cs_outlock;	/* protects the ring and busy flag */
+	struct ringbuf cs_outring;
+	unsigned char cs_outbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
+	volatile bool cs_outbusy;	/* write in flight on the device */
 };
 
 /*
@@ -102,6 +102,7 @@ static const struct device_ops random_devops = {
 	.devop_eachopen = randeachopen,
 	.devop_io = randio,
 	.devop_ioctl = randioctl,
+	.devop_poll = dev_poll_always,
 };
 
 /*
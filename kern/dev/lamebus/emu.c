@@ -49,6 +49,8 @@
 #include <uio.h>
 #include <membar.h>
 #include <synch.h>
+#include <thread.h>
+#include <current.h>
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
@@ -91,6 +93,102 @@
 #define EMU_RES_UNKNOWN      12
 #define EMU_RES_UNSUPP       13
 
+////////////////////////////////////////////////////////////
+//
+// Per-file state
+//
+
+/*
+ * Per-open-file driver state. Each hardware handle the filesystem
+ * holds open for a regular file gets one of these; operations on
+ * different files queue on their own f_lock and meet at e_lock only
+ * for the length of a device transaction, so independent readers
+ * interleave their device waits instead of strictly alternating.
+ *
+ * f_dbuf holds the chunk currently being handed to the caller; f_sbuf
+ * is where emu_settle deposits a completed read-ahead. A read that
+ * consumes staged data just swaps the two pointers. Both buffers are
+ * allocated lazily, so handles that are never read or written stay
+ * cheap.
+ *
+ * The d-fields are protected by f_lock. The s-fields are protected by
+ * e_lock, because emu_settle stages data on behalf of whichever
+ * thread happens to need the device next, and that thread holds only
+ * its own file's lock.
+ */
+struct emu_file {
+	uint32_t f_handle;	/* hardware file handle */
+	struct lock *f_lock;	/* serializes operations on this file */
+
+	char *f_dbuf;		/* chunk being consumed (f_lock) */
+	bool f_dvalid;		/* f_dbuf holds valid data */
+	uint32_t f_dpos;	/* consumption point within f_dbuf */
+	uint32_t f_doffset;	/* file offset of the unconsumed data */
+	uint32_t f_dlen;	/* amount of unconsumed data */
+	bool f_dwasfull;	/* chunk was a full EMU_MAXIO */
+
+	char *f_sbuf;		/* staged read-ahead data (e_lock) */
+	bool f_svalid;		/* f_sbuf holds valid data */
+	uint32_t f_soffset;	/* file offset of the staged data */
+	uint32_t f_slen;	/* amount of staged data */
+	bool f_swasfull;	/* staged chunk was a full EMU_MAXIO */
+
+	uint32_t f_lastend;	/* end of the last read; sequential detect */
+};
+
+static
+struct emu_file *
+emu_file_create(uint32_t handle)
+{
+	struct emu_file *file;
+
+	file = kmalloc(sizeof(struct emu_file));
+	if (file == NULL) {
+		return NULL;
+	}
+	file->f_lock = lock_create("emufs-file");
+	if (file->f_lock == NULL) {
+		kfree(file);
+		return NULL;
+	}
+	file->f_handle = handle;
+	file->f_dbuf = NULL;
+	file->f_dvalid = false;
+	file->f_dpos = 0;
+	file->f_doffset = 0;
+	file->f_dlen = 0;
+	file->f_dwasfull = false;
+	file->f_sbuf = NULL;
+	file->f_svalid = false;
+	file->f_soffset = 0;
+	file->f_slen = 0;
+	file->f_swasfull = false;
+	file->f_lastend = 0;
+	return file;
+}
+
+/*
+ * Only call this once the file can have no pending operation and no
+ * other users, i.e. at reclaim time after emu_close has settled the
+ * device.
+ */
+static
+void
+emu_file_destroy(struct emu_file *file)
+{
+	if (file->f_dbuf != NULL) {
+		kfree(file->f_dbuf);
+	}
+	if (file->f_sbuf != NULL) {
+		kfree(file->f_sbuf);
+	}
+	lock_destroy(file->f_lock);
+	kfree(file);
+}
+
+//
+////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////
 //
 // Hardware ops
@@ -171,6 +269,87 @@ emu_waitdone(struct emu_softc *sc)
 	return translate_err(sc, sc->e_result);
 }
 
+/*
+ * Settle any in-flight pipelined operation, leaving the device idle.
+ *
+ * For a read-ahead, the data (if any) is staged into the owning
+ * file's f_sbuf for later use; read-ahead errors are simply dropped,
+ * since a foreground read of the same range will repeat the operation
+ * and see the error itself. For a write-behind, errors stick in
+ * e_werror and are reported by the next write or fsync.
+ */
+static
+void
+emu_settle(struct emu_softc *sc)
+{
+	struct emu_file *file;
+	uint32_t ralen;
+	int result;
+
+	KASSERT(lock_do_i_hold(sc->e_lock));
+
+	switch (sc->e_pending) {
+	    case EMU_PEND_NONE:
+		return;
+	    case EMU_PEND_READ:
+		file = sc->e_pendfile;
+		result = emu_waitdone(sc);
+		if (result == 0) {
+			ralen = emu_rreg(sc, REG_IOLEN);
+			sc->e_iostat.io_rops++;
+			sc->e_iostat.io_rbytes += ralen;
+			if (ralen > 0) {
+				membar_load_load();
+				memcpy(file->f_sbuf, sc->e_iobuf, ralen);
+				file->f_soffset = sc->e_pendoffset;
+				file->f_slen = ralen;
+				file->f_swasfull = (ralen == EMU_MAXIO);
+				file->f_svalid = true;
+			}
+		}
+		break;
+	    case EMU_PEND_WRITE:
+		result = emu_waitdone(sc);
+		if (result) {
+			sc->e_werror = result;
+		}
+		break;
+	}
+	sc->e_pending = EMU_PEND_NONE;
+	sc->e_pendfile = NULL;
+}
+
+/*
+ * Start reading the chunk of FILE that begins at END, without waiting
+ * for it. Only legal when the device is idle; only worthwhile when
+ * the access pattern looks sequential. If there's no memory for a
+ * staging buffer, we just don't pipeline.
+ */
+static
+void
+emu_startreadahead(struct emu_softc *sc, struct emu_file *file, uint32_t end)
+{
+	KASSERT(lock_do_i_hold(sc->e_lock));
+	KASSERT(lock_do_i_hold(file->f_lock));
+	KASSERT(sc->e_pending == EMU_PEND_NONE);
+	KASSERT(!file->f_svalid);
+
+	if (file->f_sbuf == NULL) {
+		file->f_sbuf = kmalloc(EMU_MAXIO);
+		if (file->f_sbuf == NULL) {
+			return;
+		}
+	}
+
+	sc->e_pending = EMU_PEND_READ;
+	sc->e_pendfile = file;
+	sc->e_pendoffset = end;
+	emu_wreg(sc, REG_HANDLE, file->f_handle);
+	emu_wreg(sc, REG_IOLEN, EMU_MAXIO);
+	emu_wreg(sc, REG_OFFSET, end);
+	emu_wreg(sc, REG_OPER, EMU_OP_READ);
+}
+
 /*
  * Common file open routine (for both VOP_LOOKUP and VOP_CREATE).  Not
  * for VOP_EACHOPEN. At the hardware level, we need to "open" files in
@@ -204,6 +383,7 @@ emu_open(struct emu_softc *sc, uint32_t handle, const char *name,
 	(void)mode;
 
 	lock_acquire(sc->e_lock);
+	emu_settle(sc);
 
 	strcpy(sc->e_iobuf, name);
 	membar_store_store();
@@ -239,6 +419,12 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 		lock_acquire(sc->e_lock);
 	}
 
+	/*
+	 * Settling finishes any read-ahead in flight under this handle,
+	 * so nothing touches it (or its emu_file) after we close it.
+	 */
+	emu_settle(sc);
+
 	while (1) {
 		/* Retry operation up to 10 times */
 
@@ -262,13 +448,17 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 }
 
 /*
- * Common code for read and readdir.
+ * Common code for read and readdir, with no read-ahead involvement.
+ * This path does hold the device across the uiomove; it's only used
+ * for directories, whose offsets are magic cookies and which have no
+ * per-file buffer to bounce through.
  */
 static
 int
 emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	   uint32_t op, struct uio *uio)
 {
+	uint32_t amt;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_READ);
@@ -279,6 +469,7 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	}
 
 	lock_acquire(sc->e_lock);
+	emu_settle(sc);
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
@@ -289,8 +480,11 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 		goto out;
 	}
 
+	amt = emu_rreg(sc, REG_IOLEN);
+	sc->e_iostat.io_rops++;
+	sc->e_iostat.io_rbytes += amt;
 	membar_load_load();
-	result = uiomove(sc->e_iobuf, emu_rreg(sc, REG_IOLEN), uio);
+	result = uiomove(sc->e_iobuf, amt, uio);
 
 	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
 
@@ -300,14 +494,147 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 }
 
 /*
- * Read from a hardware-level file handle.
+ * Read from a hardware-level file.
+ *
+ * Sequential reads are pipelined: the next chunk is requested from
+ * the device before the current one is handed to the caller, so the
+ * host-side file access overlaps the caller's uiomove. A read at
+ * offset 0, or one continuing the previous read of the same file,
+ * counts as sequential. Data read ahead is staged in the file's
+ * f_sbuf by emu_settle.
+ *
+ * The device lock is held only while the device is actually
+ * programmed and its window copied; the uiomove, which can fault and
+ * sleep in the VM system, runs with only this file's lock held, so
+ * readers of other files can use the device meanwhile. Directory
+ * reads, whose offsets are magic cookies rather than byte counts,
+ * bypass all of this via emu_doread.
  */
 static
 int
-emu_read(struct emu_softc *sc, uint32_t handle, uint32_t len,
+emu_read(struct emu_softc *sc, struct emu_file *file, uint32_t len,
 	 struct uio *uio)
 {
-	return emu_doread(sc, handle, len, EMU_OP_READ, uio);
+	uint32_t amt, newend;
+	bool sequential, willempty;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	if (uio->uio_offset > (off_t)0xffffffff) {
+		/* beyond the largest size the file can have; generate EOF */
+		return 0;
+	}
+
+	lock_acquire(file->f_lock);
+	if (file->f_dbuf == NULL) {
+		file->f_dbuf = kmalloc(EMU_MAXIO);
+		if (file->f_dbuf == NULL) {
+			lock_release(file->f_lock);
+			return ENOMEM;
+		}
+	}
+
+	lock_acquire(sc->e_lock);
+	emu_settle(sc);
+
+	if (file->f_svalid && !file->f_dvalid &&
+	    file->f_soffset == (uint32_t)uio->uio_offset) {
+		/*
+		 * The staged chunk is what the caller wants; promote
+		 * it to the consumption buffer by swapping pointers.
+		 */
+		char *tmp = file->f_dbuf;
+		file->f_dbuf = file->f_sbuf;
+		file->f_sbuf = tmp;
+		file->f_dvalid = true;
+		file->f_dpos = 0;
+		file->f_doffset = file->f_soffset;
+		file->f_dlen = file->f_slen;
+		file->f_dwasfull = file->f_swasfull;
+		file->f_svalid = false;
+	}
+
+	if (file->f_dvalid && file->f_doffset == (uint32_t)uio->uio_offset) {
+		/*
+		 * Serve from the buffered chunk. If this read will
+		 * empty it and it was full-size, start the next
+		 * read-ahead before copying out, so the device works
+		 * while we do.
+		 */
+		amt = file->f_dlen;
+		if (amt > len) {
+			amt = len;
+		}
+		newend = file->f_doffset + amt;
+		willempty = (amt == file->f_dlen);
+		if (willempty && file->f_dwasfull) {
+			emu_startreadahead(sc, file, newend);
+		}
+		lock_release(sc->e_lock);
+
+		result = uiomove(file->f_dbuf + file->f_dpos, amt, uio);
+		if (result) {
+			file->f_dvalid = false;
+			lock_release(file->f_lock);
+			return result;
+		}
+		if (willempty) {
+			file->f_dvalid = false;
+		}
+		else {
+			file->f_dpos += amt;
+			file->f_doffset += amt;
+			file->f_dlen -= amt;
+		}
+		file->f_lastend = newend;
+		lock_release(file->f_lock);
+		return 0;
+	}
+
+	/* Miss; anything buffered for this file is no longer interesting. */
+	file->f_dvalid = false;
+	file->f_svalid = false;
+
+	sequential = ((uint32_t)uio->uio_offset == file->f_lastend);
+
+	emu_wreg(sc, REG_HANDLE, file->f_handle);
+	emu_wreg(sc, REG_IOLEN, len);
+	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
+	emu_wreg(sc, REG_OPER, EMU_OP_READ);
+	result = emu_waitdone(sc);
+	if (result) {
+		lock_release(sc->e_lock);
+		lock_release(file->f_lock);
+		return result;
+	}
+
+	amt = emu_rreg(sc, REG_IOLEN);
+	newend = emu_rreg(sc, REG_OFFSET);
+	sc->e_iostat.io_rops++;
+	sc->e_iostat.io_rbytes += amt;
+	membar_load_load();
+
+	/*
+	 * Bounce through f_dbuf so the device window can be reused as
+	 * soon as we let go of e_lock.
+	 */
+	memcpy(file->f_dbuf, sc->e_iobuf, amt);
+	if (sequential && amt == len) {
+		emu_startreadahead(sc, file, newend);
+	}
+	lock_release(sc->e_lock);
+
+	result = uiomove(file->f_dbuf, amt, uio);
+	uio->uio_offset = newend;
+	if (result) {
+		lock_release(file->f_lock);
+		return result;
+	}
+
+	file->f_lastend = newend;
+	lock_release(file->f_lock);
+	return 0;
 }
 
 /*
@@ -322,37 +649,102 @@ emu_readdir(struct emu_softc *sc, uint32_t handle, uint32_t len,
 }
 
 /*
- * Write to a hardware-level file handle.
+ * Write to a hardware-level file.
+ *
+ * Writes go out behind: the data is copied to the on-card buffer and
+ * the operation started, but we don't wait for it to finish; whoever
+ * next needs the device settles it. A failed behind-write sticks in
+ * e_werror and is reported by the next write or fsync on the device,
+ * which is the usual write-behind contract.
+ *
+ * The data is copied in through f_dbuf with only this file's lock
+ * held, so a fault taken during the copyin doesn't hold up the
+ * device; only the memcpy into the device window happens under
+ * e_lock.
  */
 static
 int
-emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
+emu_write(struct emu_softc *sc, struct emu_file *file, uint32_t len,
 	  struct uio *uio)
 {
+	uint32_t offset;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_WRITE);
+	KASSERT(len <= EMU_MAXIO);
 
 	if (uio->uio_offset > (off_t)0xffffffff) {
 		return EFBIG;
 	}
 
+	lock_acquire(file->f_lock);
+	if (file->f_dbuf == NULL) {
+		file->f_dbuf = kmalloc(EMU_MAXIO);
+		if (file->f_dbuf == NULL) {
+			lock_release(file->f_lock);
+			return ENOMEM;
+		}
+	}
+
 	lock_acquire(sc->e_lock);
+	emu_settle(sc);
 
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
+	/* Writing under staged read-ahead data invalidates it. */
+	file->f_svalid = false;
 
-	result = uiomove(sc->e_iobuf, len, uio);
-	membar_store_store();
+	if (sc->e_werror) {
+		result = sc->e_werror;
+		sc->e_werror = 0;
+		lock_release(sc->e_lock);
+		lock_release(file->f_lock);
+		return result;
+	}
+	lock_release(sc->e_lock);
+
+	/* Any buffered read data is invalid too, and f_dbuf is ours. */
+	file->f_dvalid = false;
+
+	offset = uio->uio_offset;
+	result = uiomove(file->f_dbuf, len, uio);
 	if (result) {
-		goto out;
+		lock_release(file->f_lock);
+		return result;
 	}
 
+	lock_acquire(sc->e_lock);
+	emu_settle(sc);
+
+	emu_wreg(sc, REG_HANDLE, file->f_handle);
+	emu_wreg(sc, REG_IOLEN, len);
+	emu_wreg(sc, REG_OFFSET, offset);
+	memcpy(sc->e_iobuf, file->f_dbuf, len);
+	membar_store_store();
+
+	sc->e_pending = EMU_PEND_WRITE;
+	sc->e_pendfile = file;
+	sc->e_iostat.io_wops++;
+	sc->e_iostat.io_wbytes += len;
 	emu_wreg(sc, REG_OPER, EMU_OP_WRITE);
-	result = emu_waitdone(sc);
 
- out:
+	lock_release(sc->e_lock);
+	lock_release(file->f_lock);
+	return 0;
+}
+
+/*
+ * Flush write-behind state: wait out any in-flight operation and
+ * report any error a behind-write left stuck.
+ */
+static
+int
+emu_dosync(struct emu_softc *sc)
+{
+	int result;
+
+	lock_acquire(sc->e_lock);
+	emu_settle(sc);
+	result = sc->e_werror;
+	sc->e_werror = 0;
 	lock_release(sc->e_lock);
 	return result;
 }
@@ -367,6 +759,7 @@ emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 	int result;
 
 	lock_acquire(sc->e_lock);
+	emu_settle(sc);
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_OPER, EMU_OP_GETSIZE);
@@ -380,24 +773,31 @@ emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 }
 
 /*
- * Truncate a hardware-level file handle.
+ * Truncate a hardware-level file.
  */
 static
 int
-emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
+emu_trunc(struct emu_softc *sc, struct emu_file *file, off_t len)
 {
 	int result;
 
 	KASSERT(len >= 0);
 
+	lock_acquire(file->f_lock);
 	lock_acquire(sc->e_lock);
+	emu_settle(sc);
 
-	emu_wreg(sc, REG_HANDLE, handle);
+	/* The buffered data may describe blocks that no longer exist. */
+	file->f_dvalid = false;
+	file->f_svalid = false;
+
+	emu_wreg(sc, REG_HANDLE, file->f_handle);
 	emu_wreg(sc, REG_IOLEN, len);
 	emu_wreg(sc, REG_OPER, EMU_OP_TRUNC);
 	result = emu_waitdone(sc);
 
 	lock_release(sc->e_lock);
+	lock_release(file->f_lock);
 	return result;
 }
 
@@ -473,31 +873,20 @@ emufs_reclaim(struct vnode *v)
 	int result;
 
 	/*
-	 * Need all of these locks, e_lock to protect the device,
-	 * vfs_biglock to protect the fs-related material, and
-	 * vn_countlock for the reference count.
+	 * Need both of these locks, e_lock to protect the device and
+	 * vfs_biglock to protect the fs-related material (including
+	 * the vnode table, so once vnode_tryreclaim sees us as the
+	 * last reference, nobody can pick the vnode up again).
 	 */
 
 	vfs_biglock_acquire();
 	lock_acquire(ef->ef_emu->e_lock);
-	spinlock_acquire(&ev->ev_v.vn_countlock);
 
-	if (ev->ev_v.vn_refcount > 1) {
-		/* consume the reference VOP_DECREF passed us */
-		ev->ev_v.vn_refcount--;
-
-		spinlock_release(&ev->ev_v.vn_countlock);
+	if (!vnode_tryreclaim(&ev->ev_v)) {
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
-	KASSERT(ev->ev_v.vn_refcount == 1);
-
-	/*
-	 * Since we hold e_lock and are the last ref, nobody can increment
-	 * the refcount, so we can release vn_countlock.
-	 */
-	spinlock_release(&ev->ev_v.vn_countlock);
 
 	/* emu_close retries on I/O error */
 	result = emu_close(ev->ev_emu, ev->ev_handle);
@@ -529,6 +918,9 @@ emufs_reclaim(struct vnode *v)
 	lock_release(ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
+	if (ev->ev_file != NULL) {
+		emu_file_destroy(ev->ev_file);
+	}
 	kfree(ev);
 	return 0;
 }
@@ -555,7 +947,7 @@ emufs_read(struct vnode *v, struct uio *uio)
 
 		oldresid = uio->uio_resid;
 
-		result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
+		result = emu_read(ev->ev_emu, ev->ev_file, amt, uio);
 		if (result) {
 			return result;
 		}
@@ -603,6 +995,22 @@ emufs_write(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	/*
+	 * O_APPEND: position the write at the current size. The
+	 * hardware has no append operation, so this takes an extra
+	 * device op and isn't atomic against another appender racing
+	 * between the two ops; good enough for a testing filesystem.
+	 */
+	if (curthread->t_ioappend) {
+		off_t size;
+
+		result = emu_getsize(ev->ev_emu, ev->ev_handle, &size);
+		if (result) {
+			return result;
+		}
+		uio->uio_offset = size;
+	}
+
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -611,7 +1019,7 @@ emufs_write(struct vnode *v, struct uio *uio)
 
 		oldresid = uio->uio_resid;
 
-		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
+		result = emu_write(ev->ev_emu, ev->ev_file, amt, uio);
 		if (result) {
 			return result;
 		}
@@ -708,13 +1116,16 @@ emufs_isseekable(struct vnode *v)
 
 /*
  * VOP_FSYNC
+ *
+ * Settles any write still going out behind and reports its fate.
  */
 static
 int
 emufs_fsync(struct vnode *v)
 {
-	(void)v;
-	return 0;
+	struct emufs_vnode *ev = v->vn_data;
+
+	return emu_dosync(ev->ev_emu);
 }
 
 /*
@@ -725,7 +1136,7 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	return emu_trunc(ev->ev_emu, ev->ev_file, len);
 }
 
 /*
@@ -1086,6 +1497,7 @@ static const struct vnode_ops emufs_fileops = {
 	.vop_stat = emufs_stat,
 	.vop_gettype = emufs_file_gettype,
 	.vop_isseekable = emufs_isseekable,
+	.vop_poll = vnode_poll_generic,
 	.vop_fsync = emufs_fsync,
 	.vop_mmap = emufs_mmap,
 	.vop_truncate = emufs_truncate,
@@ -1120,6 +1532,7 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_stat = emufs_stat,
 	.vop_gettype = emufs_dir_gettype,
 	.vop_isseekable = emufs_isseekable,
+	.vop_poll = vnode_poll_generic,
 	.vop_fsync = emufs_void_op_isdir,
 	.vop_mmap = emufs_void_op_isdir,
 	.vop_truncate = emufs_truncate_isdir,
@@ -1179,12 +1592,28 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	if (isdir) {
+		/* Directories bypass the per-file pipeline entirely. */
+		ev->ev_file = NULL;
+	}
+	else {
+		ev->ev_file = emu_file_create(handle);
+		if (ev->ev_file == NULL) {
+			lock_release(ef->ef_emu->e_lock);
+			vfs_biglock_release();
+			kfree(ev);
+			return ENOMEM;
+		}
+	}
 
 	result = vnode_init(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			    &ef->ef_fs, ev);
 	if (result) {
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
+		if (ev->ev_file != NULL) {
+			emu_file_destroy(ev->ev_file);
+		}
 		kfree(ev);
 		return result;
 	}
@@ -1195,6 +1624,9 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 		vnode_cleanup(&ev->ev_v);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
+		if (ev->ev_file != NULL) {
+			emu_file_destroy(ev->ev_file);
+		}
 		kfree(ev);
 		return result;
 	}
@@ -1221,8 +1653,9 @@ static
 int
 emufs_sync(struct fs *fs)
 {
-	(void)fs;
-	return 0;
+	struct emufs_fs *ef = fs->fs_data;
+
+	return emu_dosync(ef->ef_emu);
 }
 
 /*
@@ -1351,7 +1784,14 @@ config_emu(struct emu_softc *sc, int emuno)
 	}
 	sc->e_iobuf = bus_map_area(sc->e_busdata, sc->e_buspos, EMU_BUFFER);
 
+	sc->e_pending = EMU_PEND_NONE;
+	sc->e_pendfile = NULL;
+	sc->e_werror = 0;
+
 	snprintf(name, sizeof(name), "emu%d", emuno);
 
+	/* Register for the iostat report. */
+	iostat_register(&sc->e_iostat, name);
+
 	return emufs_addtovfs(sc, name);
 }
@@ -30,6 +30,8 @@
 #ifndef _LAMEBUS_EMU_H_
 #define _LAMEBUS_EMU_H_
 
+#include <iostat.h>
+
 
 #define EMU_MAXIO       16384
 #define EMU_ROOTHANDLE  0
@@ -40,6 +42,13 @@
  * all the filesystem stuff goes elsewhere.
  */
 
+/* Values for e_pending */
+#define EMU_PEND_NONE   0	/* device idle */
+#define EMU_PEND_READ   1	/* read-ahead in flight */
+#define EMU_PEND_WRITE  2	/* write-behind in flight */
+
+struct emu_file;	/* per-open-file state; private to emu.c */
+
 struct emu_softc {
 	/* Initialized by lower-level attach code */
 	void *e_busdata;
@@ -51,6 +60,22 @@ struct emu_softc {
 	struct semaphore *e_sem;
 	void *e_iobuf;
 
+	/*
+	 * Pipelining state, all protected by e_lock. At most one
+	 * operation is ever in flight on the device; e_pending records
+	 * whether that operation is a read-ahead or a write-behind
+	 * that must be settled before the device is touched again, and
+	 * e_pendfile which open file it belongs to. The staging
+	 * buffers and sequential-read state are per-file and live in
+	 * struct emu_file.
+	 */
+	int e_pending;			/* what's in flight, if anything */
+	struct emu_file *e_pendfile;	/* file of the in-flight op */
+	uint32_t e_pendoffset;		/* offset of an in-flight read */
+	int e_werror;			/* sticky write-behind error */
+
+	struct iostat e_iostat;		/* I/O statistics (e_lock) */
+
 	/* Written by the interrupt handler */
 	uint32_t e_result;
 };
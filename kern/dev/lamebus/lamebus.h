@@ -84,11 +84,27 @@ struct lamebus_softc {
 
 	/* Accessed from interrupts; synchronized with ls_lock */
 	uint32_t     ls_slotsinuse;
+	uint32_t     ls_irqready;	/* slots with a handler installed */
 	void        *ls_devdata[LB_NSLOTS];
 	lb_irqfunc   ls_irqfuncs[LB_NSLOTS];
 
+	/* Interrupt statistics, updated under ls_lock */
+	uint64_t     ls_irqcounts[LB_NSLOTS];	/* interrupts dispatched */
+	uint64_t     ls_irqcycles[LB_NSLOTS];	/* cycles spent in handlers */
+
 	/* Read-only once set early in boot */
 	unsigned     ls_uniprocessor;
+
+	/*
+	 * Config ROM contents for each slot, read once at init time.
+	 * The ROM is constant, and going to the bus for it is an
+	 * uncached read, so probing works from this cache instead of
+	 * rescanning the hardware for every attachment attempted
+	 * during boot.
+	 */
+	uint32_t     ls_vids[LB_NSLOTS];
+	uint32_t     ls_dids[LB_NSLOTS];
+	uint32_t     ls_drls[LB_NSLOTS];
 };
 
 /*
@@ -147,6 +163,11 @@ void lamebus_unmask_interrupt(struct lamebus_softc *, int slot);
  */
 void lamebus_interrupt(struct lamebus_softc *);
 
+/*
+ * Print the per-slot interrupt statistics.
+ */
+void lamebus_dumpstats(struct lamebus_softc *);
+
 /*
  * Have the LAMEbus controller power the system off.
  */
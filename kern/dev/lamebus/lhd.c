@@ -36,7 +36,11 @@
 #include <lib.h>
 #include <uio.h>
 #include <membar.h>
-#include <synch.h>
+#include <wchan.h>
+#include <current.h>
+#include <thread.h>
+#include <softirq.h>
+#include <ktrace.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -60,6 +64,13 @@
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+/*
+ * How many dispatches a nonempty class may be passed over before it is
+ * served regardless of priority, so a flush storm in a high class
+ * can't starve background writeback forever.
+ */
+#define LHD_STARVELIMIT 16
+
 /*
  * Shortcut for reading a register.
  */
@@ -95,42 +106,280 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 	return EAGAIN;
 }
 
+////////////////////////////////////////////////////////////
+// Request queue
+
+/*
+ * Insert REQ into the pending queue for its priority class, which is
+ * kept sorted by starting sector. (Requests for the same sector stay
+ * in submission order.)
+ */
+static
+void
+lhd_enqueue(struct lhd_softc *lh, struct lhd_request *req)
+{
+	struct lhd_request **p;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_qlock));
+	KASSERT(req->lr_class < IOPRI_NCLASSES);
+
+	for (p = &lh->lh_queue[req->lr_class]; *p != NULL;
+	     p = &(*p)->lr_next) {
+		if ((*p)->lr_sector > req->lr_sector) {
+			break;
+		}
+	}
+	req->lr_next = *p;
+	*p = req;
+}
+
+/*
+ * Choose the next request: from the most urgent nonempty class -
+ * unless some lower class has been passed over LHD_STARVELIMIT times
+ * while nonempty, in which case that class is served instead so heavy
+ * high-class traffic can't starve it outright. Within the chosen
+ * class, C-LOOK: the lowest starting sector at or above the sweep
+ * position, wrapping to the lowest sector queued when the upward
+ * sweep runs out. Dequeues and returns the request, or returns NULL
+ * if all the queues are empty.
+ */
+static
+struct lhd_request *
+lhd_dequeue(struct lhd_softc *lh)
+{
+	struct lhd_request **p, *req;
+	unsigned c, pick;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_qlock));
+
+	pick = IOPRI_NCLASSES;
+	for (c = 0; c < IOPRI_NCLASSES; c++) {
+		if (lh->lh_queue[c] == NULL) {
+			continue;
+		}
+		if (pick == IOPRI_NCLASSES) {
+			pick = c;
+		}
+		if (lh->lh_starve[c] >= LHD_STARVELIMIT) {
+			pick = c;
+			break;
+		}
+	}
+	if (pick == IOPRI_NCLASSES) {
+		return NULL;
+	}
+
+	/* Age the classes we passed over. */
+	for (c = 0; c < IOPRI_NCLASSES; c++) {
+		if (c != pick && lh->lh_queue[c] != NULL) {
+			lh->lh_starve[c]++;
+		}
+	}
+	lh->lh_starve[pick] = 0;
+
+	for (p = &lh->lh_queue[pick]; *p != NULL; p = &(*p)->lr_next) {
+		if ((*p)->lr_sector >= lh->lh_headsector) {
+			break;
+		}
+	}
+	if (*p == NULL) {
+		/* Nothing at or above the sweep position; wrap around. */
+		p = &lh->lh_queue[pick];
+	}
+	req = *p;
+	*p = req->lr_next;
+	req->lr_next = NULL;
+	return req;
+}
+
+/*
+ * Program the hardware for the next sector of LH_CURRENT. For writes
+ * this is where the data is copied to the on-card buffer; dispatch can
+ * happen at interrupt level, which is why request data must be kernel
+ * memory.
+ */
+static
+void
+lhd_startio(struct lhd_softc *lh)
+{
+	struct lhd_request *req = lh->lh_current;
+	uint32_t sector;
+	uint32_t statval = LHD_WORKING;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_qlock));
+	KASSERT(req != NULL);
+	KASSERT(req->lr_xferred < req->lr_nsectors);
+
+	sector = req->lr_sector + req->lr_xferred;
+	if (req->lr_iswrite) {
+		memcpy(lh->lh_buf,
+		       (char *)req->lr_data + req->lr_xferred * LHD_SECTSIZE,
+		       LHD_SECTSIZE);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+		lh->lh_iostat.io_wbytes += LHD_SECTSIZE;
+	}
+	lh->lh_headsector = sector + 1;
+	lhd_wreg(lh, LHD_REG_SECT, sector);
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Submit a request. The queue is served in seek order, not submission
+ * order. Completion (success or failure) is reported by calling
+ * LR_CALLBACK at softirq level; the callback may submit further
+ * requests but may not sleep.
+ */
+void
+lhd_submit(struct lhd_softc *lh, struct lhd_request *req)
+{
+	KASSERT(req->lr_nsectors > 0);
+	KASSERT(req->lr_data != NULL);
+	KASSERT(req->lr_callback != NULL);
+	KASSERT(req->lr_class < IOPRI_NCLASSES);
+	/* XXX this check can overflow */
+	KASSERT(req->lr_sector + req->lr_nsectors <= lh->lh_dev.d_blocks);
+
+	req->lr_result = 0;
+	req->lr_xferred = 0;
+
+	spinlock_acquire(&lh->lh_qlock);
+	if (req->lr_iswrite) {
+		lh->lh_iostat.io_wops++;
+	}
+	else {
+		lh->lh_iostat.io_rops++;
+	}
+	lhd_enqueue(lh, req);
+	if (lh->lh_current == NULL) {
+		lh->lh_current = lhd_dequeue(lh);
+		lhd_startio(lh);
+	}
+	spinlock_release(&lh->lh_qlock);
+}
+
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Callback for lhd_submit_sync: flag the completion word and wake the
+ * submitter.
  */
 static
 void
-lhd_iodone(struct lhd_softc *lh, int err)
+lhd_syncdone(struct lhd_request *req)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	req->lr_donesync = 1;
+	waitaddr_wake(&req->lr_donesync, WAITADDR_ALL);
+}
+
+/*
+ * Submit a request and sleep until it completes. Thread context only.
+ */
+int
+lhd_submit_sync(struct lhd_softc *lh, struct lhd_request *req)
+{
+	req->lr_callback = lhd_syncdone;
+	req->lr_donesync = 0;
+	lhd_submit(lh, req);
+	while (req->lr_donesync == 0) {
+		waitaddr_sleep(&req->lr_donesync, 0);
+	}
+	return req->lr_result;
 }
 
 /*
  * Interrupt handler for lhd.
- * Read the status register; if an operation finished, clear the status
- * register and report completion.
+ *
+ * Read the status register; if an operation finished, step the current
+ * request along right here: copy the sector (512 bytes, bounded work)
+ * and program the next one, whether it's the middle of a multi-sector
+ * request or the first sector of the next queued request. This way the
+ * disk never sits idle waiting for softirq dispatch, and the middle
+ * sectors of a big transfer cost no softirq round-trips at all. Only
+ * the completion callback, which does scheduler work, is deferred to
+ * softirq level.
  */
 void
 lhd_irq(void *vlh)
 {
 	struct lhd_softc *lh = vlh;
+	struct lhd_request *req;
 	uint32_t val;
+	int result;
 
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
 	switch (val & LHD_STATEMASK) {
 	    case LHD_IDLE:
 	    case LHD_WORKING:
-		break;
+		return;
 	    case LHD_OK:
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
 		break;
 	}
+
+	result = lhd_code_to_errno(lh, val);
+
+	spinlock_acquire(&lh->lh_qlock);
+	req = lh->lh_current;
+	KASSERT(req != NULL);
+
+	if (result == 0 && !req->lr_iswrite) {
+		membar_load_load();
+		memcpy((char *)req->lr_data + req->lr_xferred * LHD_SECTSIZE,
+		       lh->lh_buf, LHD_SECTSIZE);
+		lh->lh_iostat.io_rbytes += LHD_SECTSIZE;
+	}
+	if (result == 0) {
+		req->lr_xferred++;
+		if (req->lr_xferred < req->lr_nsectors) {
+			/* More sectors to go in this request. */
+			lhd_startio(lh);
+			spinlock_release(&lh->lh_qlock);
+			return;
+		}
+	}
+
+	/*
+	 * The request is finished, for better or worse. Start its
+	 * successor and hand it to the softirq handler for the
+	 * callback. The softirq always runs before this interrupt
+	 * handler can see another completion (softirq_dispatch runs
+	 * later in the same mainbus_interrupt invocation, and the next
+	 * completion is a full disk operation away), so a single
+	 * finished slot suffices.
+	 */
+	req->lr_result = result;
+	KASSERT(lh->lh_finished == NULL);
+	lh->lh_finished = req;
+	lh->lh_current = lhd_dequeue(lh);
+	if (lh->lh_current != NULL) {
+		lhd_startio(lh);
+	}
+	spinlock_release(&lh->lh_qlock);
+
+	softirq_raise(lh->lh_softirq);
+}
+
+/*
+ * Softirq (bottom-half) handler: make the completion callback for the
+ * request lhd_irq finished. Runs with interrupts enabled, in interrupt
+ * context; by now the disk is already seeking for the next request.
+ */
+static
+void
+lhd_softirq(void *vlh)
+{
+	struct lhd_softc *lh = vlh;
+	struct lhd_request *req;
+
+	spinlock_acquire(&lh->lh_qlock);
+	req = lh->lh_finished;
+	lh->lh_finished = NULL;
+	spinlock_release(&lh->lh_qlock);
+
+	KASSERT(req != NULL);
+	req->lr_callback(req);
 }
 
 /*
@@ -181,19 +430,28 @@ lhd_reset(struct lhd_softc *lh)
 
 /*
  * I/O function (for both reads and writes)
+ *
+ * The common callers (the file system, swap) pass a single kernel
+ * buffer; that case queues the whole transfer as one request, so
+ * concurrent I/O from several threads gets sorted into seek order.
+ * Other uios (user pointers, scatter/gather) bounce through a sector
+ * buffer, since request data must be kernel memory that dispatch can
+ * reach at interrupt level.
  */
 static
 int
 lhd_io(struct device *d, struct uio *uio)
 {
 	struct lhd_softc *lh = d->d_data;
+	struct lhd_request req;
 
 	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
 	uint32_t i;
-	uint32_t statval = LHD_WORKING;
+	size_t xbytes;
+	char *buf;
 	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
@@ -207,67 +465,70 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
+	req.lr_iswrite = (uio->uio_rw == UIO_WRITE);
+	req.lr_class = curthread->t_iopri;
+	req.lr_cookie = NULL;
+
+	KTRACE(req.lr_iswrite ? KTR_LHD_WRITE : KTR_LHD_READ, sector, len);
+
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1) {
+		/* One kernel buffer: do the whole thing as one request. */
+		req.lr_sector = sector;
+		req.lr_nsectors = len;
+		req.lr_data = uio->uio_iov->iov_kbase;
+		result = lhd_submit_sync(lh, &req);
+
+		/* Advance the uio past what got done, as uiomove would. */
+		xbytes = req.lr_xferred * LHD_SECTSIZE;
+		uio->uio_iov->iov_kbase =
+			(char *)uio->uio_iov->iov_kbase + xbytes;
+		uio->uio_iov->iov_len -= xbytes;
+		uio->uio_resid -= xbytes;
+		uio->uio_offset += xbytes;
+		return result;
+	}
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	buf = kmalloc(LHD_SECTSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	req.lr_nsectors = 1;
+	req.lr_data = buf;
+	result = 0;
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
+	/* Loop over all the sectors we were asked to do. */
+	for (i=0; i<len; i++) {
 		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			membar_store_store();
+			result = uiomove(buf, LHD_SECTSIZE, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			membar_load_load();
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
+		req.lr_sector = sector+i;
+		result = lhd_submit_sync(lh, &req);
 		if (result) {
-			return result;
+			break;
+		}
+		if (uio->uio_rw == UIO_READ) {
+			result = uiomove(buf, LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
 		}
 	}
-
-	return 0;
+	kfree(buf);
+	return result;
 }
 
 static const struct device_ops lhd_devops = {
 	.devop_eachopen = lhd_eachopen,
 	.devop_io = lhd_io,
 	.devop_ioctl = lhd_ioctl,
+	.devop_poll = dev_poll_always,
 };
 
 /*
@@ -284,17 +545,21 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
+	/* Completions are finished at softirq level. */
+	lh->lh_softirq = softirq_establish("lhd", lhd_softirq, lh);
+
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_qlock);
+	for (unsigned c = 0; c < IOPRI_NCLASSES; c++) {
+		lh->lh_queue[c] = NULL;
+		lh->lh_starve[c] = 0;
 	}
+	lh->lh_current = NULL;
+	lh->lh_finished = NULL;
+	lh->lh_headsector = 0;
+
+	/* Register for the iostat report. */
+	iostat_register(&lh->lh_iostat, name);
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_ops = &lhd_devops;
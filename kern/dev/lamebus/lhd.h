@@ -30,13 +30,44 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <spinlock.h>
 #include <device.h>
+#include <iopri.h>
+#include <iostat.h>
 
 /*
  * Our sector size
  */
 #define LHD_SECTSIZE  512
 
+/*
+ * One disk request. Submitters fill in the top block and hand the
+ * request to lhd_submit (asynchronous; LR_CALLBACK runs at softirq
+ * level when the transfer finishes or fails, so it may not sleep) or
+ * lhd_submit_sync (fills in the callback itself and sleeps until
+ * completion; thread context only). The data buffer must be kernel
+ * memory, LR_NSECTORS * LHD_SECTSIZE bytes, and must stay put until
+ * completion. LR_RESULT is an errno value, valid at completion.
+ */
+struct lhd_request {
+	/* Filled in by the submitter */
+	uint32_t lr_sector;		/* First sector of the transfer */
+	uint32_t lr_nsectors;		/* Length in sectors */
+	void *lr_data;			/* Kernel buffer for the data */
+	bool lr_iswrite;		/* True if writing to disk */
+	unsigned lr_class;		/* Priority class (IOPRI_ constant) */
+	void (*lr_callback)(struct lhd_request *); /* Completion upcall */
+	void *lr_cookie;		/* For the submitter's use */
+
+	/* Filled in by the driver */
+	int lr_result;			/* Errno result of the transfer */
+
+	/* Driver internal */
+	struct lhd_request *lr_next;	/* Queue link */
+	uint32_t lr_xferred;		/* Sectors completed so far */
+	volatile unsigned lr_donesync;	/* Completion word for sync waits */
+};
+
 /*
  * Hardware device data associated with lhd (LAMEbus hard disk)
  */
@@ -51,13 +82,38 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	unsigned lh_softirq;		/* Softirq number for completions */
+
+	/*
+	 * The request queue: one pending list per priority class
+	 * (page-ins above ordinary synchronous I/O above metadata
+	 * writes above background writeback), each sorted by starting
+	 * sector and dispatched C-LOOK style from lh_headsector
+	 * upward, wrapping to the lowest sector when the upward sweep
+	 * runs out. Dispatch serves the most urgent nonempty class;
+	 * lh_starve counts how often a nonempty class was passed over,
+	 * so a lower class is served anyway once it has aged long
+	 * enough. The hardware does one sector at a time, so
+	 * lh_current is worked through sector by sector from the
+	 * completion handler.
+	 */
+	struct spinlock lh_qlock;	/* Protects the fields below */
+	struct lhd_request *lh_queue[IOPRI_NCLASSES]; /* Pending, by class */
+	unsigned lh_starve[IOPRI_NCLASSES]; /* Dispatches missed, per class */
+	struct lhd_request *lh_current;	/* Request on the hardware, if any */
+	struct lhd_request *lh_finished;/* Awaiting its completion callback */
+	uint32_t lh_headsector;		/* C-LOOK sweep position */
 
 	struct device lh_dev;		/* VFS device structure */
+	struct iostat lh_iostat;	/* I/O statistics */
 };
 
+/* Submit a request; completion is reported through LR_CALLBACK. */
+void lhd_submit(struct lhd_softc *lh, struct lhd_request *req);
+
+/* Submit and sleep until done; returns the errno result. */
+int lhd_submit_sync(struct lhd_softc *lh, struct lhd_request *req);
+
 /* Functions called by lower-level drivers */
 void lhd_irq(/*struct lhd_softc*/ void *);	/* Interrupt handler */
 
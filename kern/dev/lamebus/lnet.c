@@ -27,20 +27,317 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * LAMEbus network card (lnet) driver.
+ *
+ * The card is simple: one receive buffer and one transmit buffer on
+ * the card, an interrupt apiece, and a status register carrying our
+ * 16-bit station address. It holds exactly one incoming frame at a
+ * time and drops further arrivals until we acknowledge the receive
+ * interrupt, so the interrupt handler copies each frame into a
+ * preallocated pool frame and re-arms the card immediately; protocol
+ * code then works on the pool frame in place (see lnet.h), which
+ * keeps that one unavoidable copy the only one on the receive path.
+ */
+
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
-/*#include <lamebus/lnet.h>*/ /* not yet */
+#include <uio.h>
+#include <membar.h>
+#include <wchan.h>
+#include <synch.h>
+#include <softirq.h>
+#include <platform/bus.h>
+#include <lamebus/lnet.h>
 #include "autoconf.h"
+#include "opt-net.h"
+
+#if OPT_NET
+#include <net.h>
+#endif
+
+/* Registers (offsets within slot) */
+#define LNET_REG_RECVINT  0   /* Frame waiting in receive buffer */
+#define LNET_REG_XMITINT  4   /* Transmit finished */
+#define LNET_REG_CONTROL  8   /* Control */
+#define LNET_REG_STATUS   12  /* Status */
+
+/* Control bits */
+#define LNET_CTRL_XMIT    1   /* Start transmitting the transmit buffer */
+
+/* Status bits */
+#define LNET_STAT_HWADDR  0xffff   /* Our station address */
+#define LNET_STAT_XMITIP  0x10000  /* Transmit in progress */
+
+/* Buffers (offsets within slot); each is LNET_BUFSIZE bytes */
+#define LNET_RECVBUF      32768
+#define LNET_XMITBUF      49152
+
+/*
+ * Shortcut for reading a register.
+ */
+static
+inline
+uint32_t lnet_rdreg(struct lnet_softc *ln, uint32_t reg)
+{
+	return bus_read_register(ln->ln_busdata, ln->ln_buspos, reg);
+}
+
+/*
+ * Shortcut for writing a register.
+ */
+static
+inline
+void lnet_wreg(struct lnet_softc *ln, uint32_t reg, uint32_t val)
+{
+	bus_write_register(ln->ln_busdata, ln->ln_buspos, reg, val);
+}
 
+/*
+ * Transmit one frame. We own the card's transmit buffer while the
+ * transmit lock is held, so the payload can be moved straight from
+ * the submitter's uio (user or kernel memory; uiomove may sleep on a
+ * page fault, which is why this is a sleep lock) into the card with
+ * no staging buffer in between.
+ */
 int
-config_lnet(struct lnet_softc *sc, int lnetno)
+lnet_transmit(struct lnet_softc *ln, uint16_t to, uint16_t proto,
+	      const void *hdr, size_t hdrlen, struct uio *payload)
 {
-	(void)sc;
+	struct lnet_linkhdr lnh;
+	size_t len;
+	int result;
+
+	len = hdrlen + payload->uio_resid;
+	KASSERT(len <= LNET_MTU);
+
+	lnh.lnh_to = to;
+	lnh.lnh_from = ln->ln_hwaddr;
+	lnh.lnh_proto = proto;
+	lnh.lnh_len = len;
 
-	kprintf("lnet%d: No network support in system\n", lnetno);
+	lock_acquire(ln->ln_xmitlock);
+	KASSERT((lnet_rdreg(ln, LNET_REG_STATUS) & LNET_STAT_XMITIP) == 0);
 
-	return ENODEV;
+	memcpy(ln->ln_xmitbuf, &lnh, sizeof(lnh));
+	if (hdrlen > 0) {
+		memcpy((char *)ln->ln_xmitbuf + sizeof(lnh), hdr, hdrlen);
+	}
+	result = uiomove((char *)ln->ln_xmitbuf + sizeof(lnh) + hdrlen,
+			 payload->uio_resid, payload);
+	if (result) {
+		/* Nothing was started; just give the buffer back. */
+		lock_release(ln->ln_xmitlock);
+		return result;
+	}
+
+	ln->ln_xmitdone = 0;
+	membar_store_store();
+	lnet_wreg(ln, LNET_REG_CONTROL, LNET_CTRL_XMIT);
+
+	while (ln->ln_xmitdone == 0) {
+		waitaddr_sleep(&ln->ln_xmitdone, 0);
+	}
+	ln->ln_txframes++;
+
+	lock_release(ln->ln_xmitlock);
+	return 0;
 }
 
+/*
+ * Receive: sleep until the interrupt handler has queued a frame, then
+ * dequeue and return it.
+ */
+struct lnet_frame *
+lnet_recv(struct lnet_softc *ln)
+{
+	struct lnet_frame *lf;
+
+	P(ln->ln_rxsem);
 
+	spinlock_acquire(&ln->ln_rxlock);
+	lf = ln->ln_rxhead;
+	KASSERT(lf != NULL);
+	ln->ln_rxhead = lf->lf_next;
+	if (ln->ln_rxhead == NULL) {
+		ln->ln_rxtail = NULL;
+	}
+	lf->lf_next = NULL;
+	spinlock_release(&ln->ln_rxlock);
+
+	return lf;
+}
+
+/*
+ * Return a frame to the receive pool.
+ */
+void
+lnet_frame_free(struct lnet_softc *ln, struct lnet_frame *lf)
+{
+	spinlock_acquire(&ln->ln_rxlock);
+	lf->lf_next = ln->ln_freelist;
+	ln->ln_freelist = lf;
+	spinlock_release(&ln->ln_rxlock);
+}
+
+/*
+ * Interrupt handler for lnet.
+ *
+ * On receive, copy the frame off the card into a pool frame and ack
+ * the receive interrupt right away so the card can take the next
+ * arrival; if the pool is empty the frame is dropped (the card would
+ * have dropped it anyway had we left the interrupt pending). The
+ * semaphore V for the consumer, like the transmit wakeup, is
+ * scheduler work and is deferred to softirq level.
+ */
+void
+lnet_irq(void *vln)
+{
+	struct lnet_softc *ln = vln;
+	struct lnet_linkhdr lnh;
+	struct lnet_frame *lf;
+	bool work = false;
+
+	if (lnet_rdreg(ln, LNET_REG_RECVINT) != 0) {
+		membar_load_load();
+		memcpy(&lnh, ln->ln_recvbuf, sizeof(lnh));
+
+		spinlock_acquire(&ln->ln_rxlock);
+		lf = ln->ln_freelist;
+		if (lf == NULL || lnh.lnh_len > LNET_MTU) {
+			ln->ln_rxdropped++;
+		}
+		else {
+			ln->ln_freelist = lf->lf_next;
+			lf->lf_from = lnh.lnh_from;
+			lf->lf_proto = lnh.lnh_proto;
+			lf->lf_len = lnh.lnh_len;
+			memcpy(lf->lf_data,
+			       (char *)ln->ln_recvbuf + sizeof(lnh),
+			       lnh.lnh_len);
+			lf->lf_next = NULL;
+			if (ln->ln_rxtail != NULL) {
+				ln->ln_rxtail->lf_next = lf;
+			}
+			else {
+				ln->ln_rxhead = lf;
+			}
+			ln->ln_rxtail = lf;
+			ln->ln_rxnew++;
+			ln->ln_rxframes++;
+			work = true;
+		}
+		spinlock_release(&ln->ln_rxlock);
+
+		/* Done with the card's buffer; re-arm receive. */
+		lnet_wreg(ln, LNET_REG_RECVINT, 0);
+	}
+
+	if (lnet_rdreg(ln, LNET_REG_XMITINT) != 0) {
+		lnet_wreg(ln, LNET_REG_XMITINT, 0);
+		ln->ln_xmitdone = 1;
+
+		spinlock_acquire(&ln->ln_rxlock);
+		ln->ln_xmitfin = true;
+		spinlock_release(&ln->ln_rxlock);
+		work = true;
+	}
+
+	if (work) {
+		softirq_raise(ln->ln_softirq);
+	}
+}
+
+/*
+ * Softirq (bottom-half) handler: V the receive semaphore once per
+ * frame the interrupt handler queued, and wake a waiting transmitter.
+ * Runs with interrupts enabled, in interrupt context.
+ */
+static
+void
+lnet_softirq(void *vln)
+{
+	struct lnet_softc *ln = vln;
+	unsigned nrx;
+	bool txfin;
+
+	spinlock_acquire(&ln->ln_rxlock);
+	nrx = ln->ln_rxnew;
+	ln->ln_rxnew = 0;
+	txfin = ln->ln_xmitfin;
+	ln->ln_xmitfin = false;
+	spinlock_release(&ln->ln_rxlock);
+
+	while (nrx > 0) {
+		V(ln->ln_rxsem);
+		nrx--;
+	}
+	if (txfin) {
+		waitaddr_wake(&ln->ln_xmitdone, WAITADDR_ALL);
+	}
+}
+
+/*
+ * Setup routine called by autoconf.c when an lnet is found.
+ */
+int
+config_lnet(struct lnet_softc *ln, int lnetno)
+{
+	struct lnet_frame *frames;
+	unsigned i;
+
+	ln->ln_hwaddr = lnet_rdreg(ln, LNET_REG_STATUS) & LNET_STAT_HWADDR;
+
+	/* Get pointers to the on-card buffers. */
+	ln->ln_recvbuf = bus_map_area(ln->ln_busdata, ln->ln_buspos,
+				      LNET_RECVBUF);
+	ln->ln_xmitbuf = bus_map_area(ln->ln_busdata, ln->ln_buspos,
+				      LNET_XMITBUF);
+
+	/* Set up the receive pool and queues. */
+	frames = kmalloc(LNET_NFRAMES * sizeof(struct lnet_frame));
+	if (frames == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&ln->ln_rxlock);
+	ln->ln_rxhead = NULL;
+	ln->ln_rxtail = NULL;
+	ln->ln_freelist = NULL;
+	for (i=0; i<LNET_NFRAMES; i++) {
+		frames[i].lf_next = ln->ln_freelist;
+		ln->ln_freelist = &frames[i];
+	}
+	ln->ln_rxnew = 0;
+	ln->ln_xmitfin = false;
+
+	ln->ln_rxsem = sem_create("lnet_rx", 0);
+	if (ln->ln_rxsem == NULL) {
+		kfree(frames);
+		return ENOMEM;
+	}
+	ln->ln_xmitlock = lock_create("lnet_xmit");
+	if (ln->ln_xmitlock == NULL) {
+		sem_destroy(ln->ln_rxsem);
+		kfree(frames);
+		return ENOMEM;
+	}
+	ln->ln_xmitdone = 0;
+
+	ln->ln_rxframes = 0;
+	ln->ln_txframes = 0;
+	ln->ln_rxdropped = 0;
+
+	/* Completions are finished at softirq level. */
+	ln->ln_softirq = softirq_establish("lnet", lnet_softirq, ln);
+
+	kprintf("lnet%d: station %04x\n", lnetno, ln->ln_hwaddr);
+
+#if OPT_NET
+	net_attach(ln);
+#else
+	kprintf("lnet%d: no network stack configured\n", lnetno);
+#endif
+
+	return 0;
+}
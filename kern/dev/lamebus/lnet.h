@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LAMEBUS_LNET_H_
+#define _LAMEBUS_LNET_H_
+
+#include <spinlock.h>
+
+struct uio; /* from uio.h */
+struct semaphore; /* from synch.h */
+struct lock; /* from synch.h */
+
+/*
+ * The network card moves whole frames: the sender deposits one in the
+ * on-card transmit buffer and pokes the control register, and the
+ * card delivers it to the station named in the first 16-bit word of
+ * the frame (0xffff reaches everyone). Each frame starts with this
+ * link header; the card itself only ever looks at lnh_to.
+ */
+struct lnet_linkhdr {
+	uint16_t lnh_to;	/* destination station; 0xffff = broadcast */
+	uint16_t lnh_from;	/* source station */
+	uint16_t lnh_proto;	/* payload protocol (LNET_PROTO_*) */
+	uint16_t lnh_len;	/* payload length in bytes */
+};
+
+#define LNET_BROADCAST	0xffff	/* broadcast station address */
+#define LNET_PROTO_IP	0x0800	/* payload is an IP datagram */
+
+/*
+ * Largest payload one frame can carry: the on-card buffers are
+ * LNET_BUFSIZE bytes (see lnet.c) and the link header takes 8.
+ */
+#define LNET_BUFSIZE	4096
+#define LNET_MTU	(LNET_BUFSIZE - sizeof(struct lnet_linkhdr))
+
+/*
+ * One received frame. The interrupt handler copies an arriving frame
+ * off the card into one of these and queues it; lnet_recv hands it to
+ * protocol code, which works on the payload in place (no further
+ * copies) and gives the frame back with lnet_frame_free when done.
+ */
+struct lnet_frame {
+	struct lnet_frame *lf_next;	/* freelist / queue link */
+	uint16_t lf_from;		/* link source station */
+	uint16_t lf_proto;		/* link protocol */
+	uint16_t lf_len;		/* bytes valid in lf_data */
+	uint16_t lf__pad;		/* keep lf_data 4-byte aligned,
+					   so protocol headers can be
+					   read in place */
+	uint8_t lf_data[LNET_MTU];	/* the payload */
+};
+
+/* Frames in the receive pool; arrivals beyond this are dropped. */
+#define LNET_NFRAMES	16
+
+/*
+ * Hardware device data associated with lnet (LAMEbus network card)
+ */
+struct lnet_softc {
+	/* Initialized by lower-level attach code */
+	void *ln_busdata;		/* The bus we're on */
+	uint32_t ln_buspos;		/* Our slot on that bus */
+	int ln_unit;			/* What number lnet we are */
+
+	/*
+	 * Initialized by config_lnet
+	 */
+
+	uint16_t ln_hwaddr;		/* Our station address */
+	void *ln_recvbuf;		/* On-card receive buffer */
+	void *ln_xmitbuf;		/* On-card transmit buffer */
+	unsigned ln_softirq;		/* Softirq number for completions */
+
+	/*
+	 * Receive side. The interrupt handler fills frames and
+	 * appends them to the rx queue; lnet_recv sleeps on the
+	 * semaphore (one count per queued frame, V'd at softirq
+	 * level) and pops them off.
+	 */
+	struct spinlock ln_rxlock;	/* Protects the five below */
+	struct lnet_frame *ln_rxhead;	/* Received frames, oldest first */
+	struct lnet_frame *ln_rxtail;
+	struct lnet_frame *ln_freelist;	/* Idle frames */
+	unsigned ln_rxnew;		/* Frames queued since last softirq */
+	bool ln_xmitfin;		/* Transmit completed, wake pending */
+	struct semaphore *ln_rxsem;	/* Counts frames on the rx queue */
+
+	/* Transmit side: one frame on the card at a time. */
+	struct lock *ln_xmitlock;	/* Serializes transmitters */
+	volatile unsigned ln_xmitdone;	/* Completion word for the waiter */
+
+	/* Statistics; maintained unlocked, indicative, not exact. */
+	uint32_t ln_rxframes;		/* Frames received */
+	uint32_t ln_txframes;		/* Frames transmitted */
+	uint32_t ln_rxdropped;		/* Frames dropped, pool empty */
+};
+
+/*
+ * Transmit one frame to station TO: HDR/HDRLEN (kernel memory;
+ * protocol headers, may be NULL/0) followed by PAYLOAD, which is
+ * taken straight from its uio (user or kernel memory) into the
+ * on-card buffer, so there is no intermediate kernel copy. At most
+ * LNET_MTU bytes together; sleeps until the card is done. Thread
+ * context only.
+ */
+int lnet_transmit(struct lnet_softc *ln, uint16_t to, uint16_t proto,
+		  const void *hdr, size_t hdrlen, struct uio *payload);
+
+/*
+ * Receive: sleep until a frame arrives and return it. The frame
+ * belongs to the caller until passed back via lnet_frame_free.
+ */
+struct lnet_frame *lnet_recv(struct lnet_softc *ln);
+void lnet_frame_free(struct lnet_softc *ln, struct lnet_frame *lf);
+
+/* Functions called by lower-level drivers */
+void lnet_irq(/*struct lnet_softc*/ void *);	/* Interrupt handler */
+
+#endif /* _LAMEBUS_LNET_H_ */
@@ -30,6 +30,7 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <softirq.h>
 #include <platform/bus.h>
 #include <lamebus/lser.h>
 #include "autoconf.h"
@@ -49,9 +50,7 @@ lser_irq(void *vsc)
 {
 	struct lser_softc *sc = vsc;
 	uint32_t x;
-	bool clear_to_write = false;
-	bool got_a_read = false;
-	uint32_t ch = 0;
+	bool raise = false;
 
 	spinlock_acquire(&sc->ls_lock);
 
@@ -59,7 +58,8 @@ lser_irq(void *vsc)
 	if (x & LSER_IRQ_ACTIVE) {
 		x = LSER_IRQ_ENABLE;
 		sc->ls_wbusy = 0;
-		clear_to_write = true;
+		sc->ls_sirq_write = true;
+		raise = true;
 		bus_write_register(sc->ls_busdata, sc->ls_buspos,
 				   LSER_REG_WIRQ, x);
 	}
@@ -67,15 +67,51 @@ lser_irq(void *vsc)
 	x = bus_read_register(sc->ls_busdata, sc->ls_buspos, LSER_REG_RIRQ);
 	if (x & LSER_IRQ_ACTIVE) {
 		x = LSER_IRQ_ENABLE;
-		ch = bus_read_register(sc->ls_busdata, sc->ls_buspos,
-				       LSER_REG_CHAR);
-		got_a_read = true;
+		sc->ls_sirq_char = bus_read_register(sc->ls_busdata,
+						     sc->ls_buspos,
+						     LSER_REG_CHAR);
+		sc->ls_sirq_gotchar = true;
+		sc->ls_iostat.io_rops++;
+		sc->ls_iostat.io_rbytes++;
+		raise = true;
 		bus_write_register(sc->ls_busdata, sc->ls_buspos,
 				   LSER_REG_RIRQ, x);
 	}
 
 	spinlock_release(&sc->ls_lock);
 
+	/*
+	 * The upcalls (restarting output, delivering input) do
+	 * scheduler work; run them at softirq level, with interrupts
+	 * back on. The device buffers one character, so the single
+	 * saved char can't lose anything the hardware wouldn't.
+	 */
+	if (raise) {
+		softirq_raise(sc->ls_softirq);
+	}
+}
+
+/*
+ * Softirq (bottom-half) handler: make the upcalls for whatever
+ * lser_irq noted. Runs with interrupts enabled, in interrupt context.
+ */
+static
+void
+lser_softirq(void *vsc)
+{
+	struct lser_softc *sc = vsc;
+	bool clear_to_write;
+	bool got_a_read;
+	uint32_t ch;
+
+	spinlock_acquire(&sc->ls_lock);
+	clear_to_write = sc->ls_sirq_write;
+	sc->ls_sirq_write = false;
+	got_a_read = sc->ls_sirq_gotchar;
+	sc->ls_sirq_gotchar = false;
+	ch = sc->ls_sirq_char;
+	spinlock_release(&sc->ls_lock);
+
 	if (clear_to_write && sc->ls_start != NULL) {
 		sc->ls_start(sc->ls_devdata);
 	}
@@ -106,6 +142,8 @@ lser_write(void *vls, int ch)
 		panic("lser: Not clear to write\n");
 	}
 	ls->ls_wbusy = true;
+	ls->ls_iostat.io_wops++;
+	ls->ls_iostat.io_wbytes++;
 
 	bus_write_register(ls->ls_busdata, ls->ls_buspos, LSER_REG_CHAR, ch);
 
@@ -151,6 +189,8 @@ lser_writepolled(void *vsc, int ch)
 	}
 
 	/* Send the character. */
+	sc->ls_iostat.io_wops++;
+	sc->ls_iostat.io_wbytes++;
 	bus_write_register(sc->ls_busdata, sc->ls_buspos, LSER_REG_CHAR, ch);
 
 	/* Wait until it's done. */
@@ -174,7 +214,7 @@ lser_writepolled(void *vsc, int ch)
 int
 config_lser(struct lser_softc *sc, int lserno)
 {
-	(void)lserno;
+	char name[32];
 
 	/*
 	 * Enable interrupting.
@@ -183,6 +223,15 @@ config_lser(struct lser_softc *sc, int lserno)
 	spinlock_init(&sc->ls_lock);
 	sc->ls_wbusy = false;
 
+	sc->ls_sirq_write = false;
+	sc->ls_sirq_gotchar = false;
+	sc->ls_sirq_char = 0;
+	sc->ls_softirq = softirq_establish("lser", lser_softirq, sc);
+
+	/* Register for the iostat report. */
+	snprintf(name, sizeof(name), "lser%d", lserno);
+	iostat_register(&sc->ls_iostat, name);
+
 	bus_write_register(sc->ls_busdata, sc->ls_buspos,
 			   LSER_REG_RIRQ, LSER_IRQ_ENABLE);
 	bus_write_register(sc->ls_busdata, sc->ls_buspos,
@@ -31,11 +31,17 @@
 #define _LAMEBUS_LSER_H_
 
 #include <spinlock.h>
+#include <iostat.h>
 
 struct lser_softc {
 	/* Initialized by config function */
 	struct spinlock ls_lock;    /* protects ls_wbusy and device regs */
 	volatile bool ls_wbusy;     /* true if write in progress */
+	unsigned ls_softirq;        /* softirq number for completions */
+	bool ls_sirq_write;         /* clear-to-write pending (ls_lock) */
+	bool ls_sirq_gotchar;       /* input char pending (ls_lock) */
+	uint32_t ls_sirq_char;      /* the pending input char (ls_lock) */
+	struct iostat ls_iostat;    /* I/O statistics (ls_lock) */
 
 	/* Initialized by lower-level attachment function */
 	void *ls_busdata;
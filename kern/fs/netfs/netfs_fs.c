@@ -0,0 +1,503 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * netfs RPC engine and whole-filesystem operations.
+ *
+ * Each call is a netfs_rpc on the caller's stack, stamped with a
+ * transaction id and chained on the pending list. The receive thread
+ * matches replies to pending calls by id; the watchdog thread
+ * retransmits calls whose replies are overdue and eventually gives up
+ * on them. Because calls complete independently, any number of
+ * threads can have calls in flight at once, and one thread can keep
+ * several outstanding (see netfs_read in netfs_vnops.c) - this is the
+ * point of netfs; emufs can do none of it.
+ *
+ * Locking: nf_lock protects the pending list and the xid counter. It
+ * is taken only from thread context and never while holding a socket
+ * lock, so sending while holding it (as the watchdog does) is safe.
+ * Completion uses the nq_done word and waitaddr, like lhd requests.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <membar.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <wchan.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <fs.h>
+#include <net.h>
+#include <netfs.h>
+
+#include "netfsprivate.h"
+
+////////////////////////////////////////////////////////////
+//
+// RPC engine
+//
+
+/*
+ * Push one call onto the wire: the request header, then the send data
+ * (a path or write data) if there is any. The socket binds itself to
+ * an ephemeral port on the first send.
+ */
+static
+int
+netfs_sendreq(struct netfs_fs *nf, struct netfs_rpc *rpc)
+{
+	struct iovec iov[2];
+	struct uio ku;
+	size_t len;
+
+	iov[0].iov_kbase = &rpc->nq_req;
+	iov[0].iov_len = sizeof(rpc->nq_req);
+	len = sizeof(rpc->nq_req);
+	if (rpc->nq_sendbuf != NULL) {
+		iov[1].iov_kbase = (void *)rpc->nq_sendbuf;
+		iov[1].iov_len = rpc->nq_req.nr_len;
+		len += rpc->nq_req.nr_len;
+	}
+
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = rpc->nq_sendbuf != NULL ? 2 : 1;
+	ku.uio_offset = 0;
+	ku.uio_resid = len;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = NULL;
+
+	return net_socket_sendto(nf->nf_socket, &ku,
+				 NETFS_SERVERADDR, NETFS_PORT);
+}
+
+/*
+ * Complete a call: fill in the reply fields and release the waiter.
+ * The call must already be off the pending list.
+ */
+static
+void
+netfs_finish(struct netfs_rpc *rpc, uint32_t result, uint32_t val,
+	     uint32_t rlen)
+{
+	rpc->nq_result = result;
+	rpc->nq_val = val;
+	rpc->nq_rlen = rlen;
+	membar_store_store();
+	rpc->nq_done = 1;
+	waitaddr_wake(&rpc->nq_done, WAITADDR_ALL);
+}
+
+/*
+ * Start a call: stamp it, put it on the pending list, and send it.
+ * Send errors are ignored on purpose - a failed send looks exactly
+ * like a lost datagram, and the watchdog handles those.
+ */
+void
+netfs_rpc_start(struct netfs_fs *nf, struct netfs_rpc *rpc,
+		uint32_t op, uint32_t handle, uint32_t offset,
+		uint32_t len, const void *sendbuf,
+		void *recvbuf, uint32_t recvmax)
+{
+	rpc->nq_req.nr_op = op;
+	rpc->nq_req.nr_handle = handle;
+	rpc->nq_req.nr_offset = offset;
+	rpc->nq_req.nr_len = len;
+	rpc->nq_sendbuf = sendbuf;
+	rpc->nq_recvbuf = recvbuf;
+	rpc->nq_recvmax = recvmax;
+	rpc->nq_result = NETFS_RES_UNKNOWN;
+	rpc->nq_val = 0;
+	rpc->nq_rlen = 0;
+	rpc->nq_age = 0;
+	rpc->nq_tries = 1;
+	rpc->nq_done = 0;
+
+	lock_acquire(nf->nf_lock);
+	rpc->nq_req.nr_xid = nf->nf_nextxid++;
+	rpc->nq_next = nf->nf_pending;
+	nf->nf_pending = rpc;
+	lock_release(nf->nf_lock);
+
+	(void)netfs_sendreq(nf, rpc);
+}
+
+/*
+ * Map a wire result code onto an errno. Unlike the emu device, where
+ * a bad-request code means our own driver is broken and panicking is
+ * right, here the far side is a process on the host that we shouldn't
+ * trust that far; complain and fail the operation instead.
+ */
+static
+int
+netfs_translate(uint32_t code)
+{
+	switch (code) {
+	    case NETFS_RES_SUCCESS: return 0;
+	    case NETFS_RES_GONE: return ETIMEDOUT;
+	    case NETFS_RES_BADPATH: return ENOENT;
+	    case NETFS_RES_EXISTS: return EEXIST;
+	    case NETFS_RES_ISDIR: return EISDIR;
+	    case NETFS_RES_MEDIA: return EIO;
+	    case NETFS_RES_NOHANDLES: return ENFILE;
+	    case NETFS_RES_NOSPACE: return ENOSPC;
+	    case NETFS_RES_NOTDIR: return ENOTDIR;
+	    case NETFS_RES_UNSUPP: return ENOSYS;
+	    case NETFS_RES_BADHANDLE:
+	    case NETFS_RES_BADOP:
+	    case NETFS_RES_BADSIZE:
+		kprintf("netfs: server rejected request (code %u)\n", code);
+		return EIO;
+	    case NETFS_RES_UNKNOWN: return EIO;
+	}
+	kprintf("netfs: server sent invalid result code %u\n", code);
+	return EIO;
+}
+
+/*
+ * Wait for a call started with netfs_rpc_start. Returns an errno;
+ * VAL_RET and RLEN_RET, which may be NULL, are filled in on success.
+ */
+int
+netfs_rpc_wait(struct netfs_fs *nf, struct netfs_rpc *rpc,
+	       uint32_t *val_ret, uint32_t *rlen_ret)
+{
+	int result;
+
+	(void)nf;
+
+	while (rpc->nq_done == 0) {
+		waitaddr_sleep(&rpc->nq_done, 0);
+	}
+	membar_load_load();
+
+	result = netfs_translate(rpc->nq_result);
+	if (result) {
+		return result;
+	}
+	if (val_ret != NULL) {
+		*val_ret = rpc->nq_val;
+	}
+	if (rlen_ret != NULL) {
+		*rlen_ret = rpc->nq_rlen;
+	}
+	return 0;
+}
+
+/*
+ * One whole call, for the many operations that don't pipeline.
+ */
+int
+netfs_rpc(struct netfs_fs *nf, uint32_t op, uint32_t handle,
+	  uint32_t offset, uint32_t len, const void *sendbuf,
+	  void *recvbuf, uint32_t recvmax,
+	  uint32_t *val_ret, uint32_t *rlen_ret)
+{
+	struct netfs_rpc rpc;
+
+	netfs_rpc_start(nf, &rpc, op, handle, offset, len, sendbuf,
+			recvbuf, recvmax);
+	return netfs_rpc_wait(nf, &rpc, val_ret, rlen_ret);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Receive and watchdog threads
+//
+
+/*
+ * The receive thread: take datagrams from the server and complete the
+ * calls they answer. Replies for calls no longer pending (the server
+ * answering both the original and a retransmit, or answering after we
+ * gave up) are dropped here, which is what makes retransmission safe
+ * on this end.
+ */
+static
+void
+netfs_receive_thread(void *data, unsigned long num)
+{
+	struct netfs_fs *nf = data;
+	struct netfs_reply *reply;
+	struct netfs_rpc *rpc, **rpcp;
+	struct iovec iov;
+	struct uio ku;
+	char *buf;
+	size_t buflen, got;
+	uint32_t dlen;
+	int result;
+
+	(void)num;
+
+	buflen = sizeof(struct netfs_reply) + NETFS_MAXIO;
+	buf = kmalloc(buflen);
+	if (buf == NULL) {
+		panic("netfs: Out of memory\n");
+	}
+	reply = (struct netfs_reply *)buf;
+
+	for (;;) {
+		uio_kinit(&iov, &ku, buf, buflen, 0, UIO_READ);
+		result = net_socket_recvfrom(nf->nf_socket, &ku, NULL, NULL);
+		if (result) {
+			/* shouldn't happen; don't spin if it does */
+			clocksleep(1);
+			continue;
+		}
+		got = buflen - ku.uio_resid;
+		if (got < sizeof(struct netfs_reply)) {
+			/* runt; not from our server */
+			continue;
+		}
+
+		lock_acquire(nf->nf_lock);
+		for (rpcp = &nf->nf_pending;
+		     (rpc = *rpcp) != NULL;
+		     rpcp = &rpc->nq_next) {
+			if (rpc->nq_req.nr_xid == reply->np_xid) {
+				*rpcp = rpc->nq_next;
+				break;
+			}
+		}
+		lock_release(nf->nf_lock);
+
+		if (rpc == NULL) {
+			/* duplicate or stale reply */
+			continue;
+		}
+
+		/*
+		 * Copy out however much reply data there actually is,
+		 * but pass np_len through raw: for the open ops it's
+		 * a flag, not a byte count.
+		 */
+		dlen = got - sizeof(struct netfs_reply);
+		if (dlen > reply->np_len) {
+			dlen = reply->np_len;
+		}
+		if (dlen > rpc->nq_recvmax) {
+			dlen = rpc->nq_recvmax;
+		}
+		if (dlen > 0) {
+			memcpy(rpc->nq_recvbuf, reply + 1, dlen);
+		}
+		netfs_finish(rpc, reply->np_result, reply->np_val,
+			     reply->np_len);
+	}
+}
+
+/*
+ * The watchdog thread: once a second, age every pending call.
+ * Overdue calls get retransmitted; calls that have been sent
+ * NETFS_MAXTRIES times get taken off the list and failed, which
+ * netfs_translate turns into ETIMEDOUT.
+ */
+static
+void
+netfs_watchdog_thread(void *data, unsigned long num)
+{
+	struct netfs_fs *nf = data;
+	struct netfs_rpc *rpc, **rpcp;
+
+	(void)num;
+
+	for (;;) {
+		clocksleep(1);
+
+		lock_acquire(nf->nf_lock);
+		rpcp = &nf->nf_pending;
+		while ((rpc = *rpcp) != NULL) {
+			rpc->nq_age++;
+			if (rpc->nq_age < NETFS_TIMEOUT) {
+				rpcp = &rpc->nq_next;
+				continue;
+			}
+			if (rpc->nq_tries >= NETFS_MAXTRIES) {
+				*rpcp = rpc->nq_next;
+				netfs_finish(rpc, NETFS_RES_GONE, 0, 0);
+				continue;
+			}
+			rpc->nq_age = 0;
+			rpc->nq_tries++;
+			(void)netfs_sendreq(nf, rpc);
+			rpcp = &rpc->nq_next;
+		}
+		lock_release(nf->nf_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Whole-filesystem functions
+//
+
+/*
+ * FSOP_SYNC - have the server settle everything it has from us.
+ */
+static
+int
+netfs_sync(struct fs *fs)
+{
+	struct netfs_fs *nf = fs->fs_data;
+
+	return netfs_rpc(nf, NETFS_OP_SYNC, NETFS_ROOTHANDLE, 0, 0,
+			 NULL, NULL, 0, NULL, NULL);
+}
+
+/*
+ * FSOP_GETVOLNAME
+ */
+static
+const char *
+netfs_getvolname(struct fs *fs)
+{
+	/* We don't have a volume name beyond the device name */
+	(void)fs;
+	return NULL;
+}
+
+/*
+ * FSOP_GETROOT
+ */
+static
+int
+netfs_getroot(struct fs *fs, struct vnode **ret)
+{
+	struct netfs_fs *nf;
+
+	KASSERT(fs != NULL);
+
+	nf = fs->fs_data;
+
+	KASSERT(nf != NULL);
+	KASSERT(nf->nf_root != NULL);
+
+	VOP_INCREF(&nf->nf_root->nv_v);
+	*ret = &nf->nf_root->nv_v;
+	return 0;
+}
+
+/*
+ * FSOP_UNMOUNT
+ */
+static
+int
+netfs_unmount(struct fs *fs)
+{
+	/* Always prohibit unmount, as we're not really "mounted" */
+	(void)fs;
+	return EBUSY;
+}
+
+/*
+ * Function table for the netfs file system.
+ */
+static const struct fs_ops netfs_fsops = {
+	.fsop_sync = netfs_sync,
+	.fsop_getvolname = netfs_getvolname,
+	.fsop_getroot = netfs_getroot,
+	.fsop_unmount = netfs_unmount,
+};
+
+////////////////////////////////////////////////////////////
+//
+// Attachment
+//
+
+/*
+ * Called by net_attach once the stack is up. As with emufs we're not
+ * really mounted, just on the VFS name list; the root vnode uses the
+ * constant handle, so no traffic happens until someone looks at
+ * netfs: - which matters, as the server may not be running.
+ */
+void
+netfs_attach(void)
+{
+	struct netfs_fs *nf;
+	int result;
+
+	nf = kmalloc(sizeof(struct netfs_fs));
+	if (nf == NULL) {
+		panic("netfs: Out of memory\n");
+	}
+
+	nf->nf_fs.fs_data = nf;
+	nf->nf_fs.fs_ops = &netfs_fsops;
+
+	result = net_socket_create(&nf->nf_socket);
+	if (result) {
+		panic("netfs: cannot create socket: %s\n", strerror(result));
+	}
+
+	nf->nf_lock = lock_create("netfs");
+	nf->nf_vlock = lock_create("netfs-vnodes");
+	if (nf->nf_lock == NULL || nf->nf_vlock == NULL) {
+		panic("netfs: Out of memory\n");
+	}
+	nf->nf_pending = NULL;
+	nf->nf_nextxid = 1;
+
+	nf->nf_vnodes = vnodearray_create();
+	if (nf->nf_vnodes == NULL) {
+		panic("netfs: Out of memory\n");
+	}
+	nf->nf_root = NULL;
+
+	result = netfs_loadvnode(nf, NETFS_ROOTHANDLE, 1, &nf->nf_root);
+	if (result) {
+		panic("netfs: cannot load root: %s\n", strerror(result));
+	}
+
+	result = thread_fork("netfs_recv", NULL,
+			     netfs_receive_thread, nf, 0);
+	if (result) {
+		panic("netfs: cannot start receive thread: %s\n",
+		      strerror(result));
+	}
+	result = thread_fork("netfs_timer", NULL,
+			     netfs_watchdog_thread, nf, 0);
+	if (result) {
+		panic("netfs: cannot start watchdog thread: %s\n",
+		      strerror(result));
+	}
+
+	result = vfs_addfs("netfs", &nf->nf_fs);
+	if (result) {
+		panic("netfs: cannot attach: %s\n", strerror(result));
+	}
+
+	kprintf("netfs: remote files at %u.%u.%u.%u port %u\n",
+		(NETFS_SERVERADDR >> 24) & 0xff,
+		(NETFS_SERVERADDR >> 16) & 0xff,
+		(NETFS_SERVERADDR >> 8) & 0xff,
+		NETFS_SERVERADDR & 0xff, NETFS_PORT);
+}
@@ -0,0 +1,756 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * netfs vnode operations. These parallel emufs closely - same file
+ * model, same locking shape around the vnode table - except that the
+ * operations are RPCs rather than device register exercises, and
+ * VOP_READ exploits that by keeping a window of read requests in
+ * flight instead of waiting out a full round trip per chunk.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+
+#include "netfsprivate.h"
+
+////////////////////////////////////////////////////////////
+//
+// Open-family RPC helper
+//
+
+/*
+ * Common open routine (for VOP_LOOKUP and VOP_CREAT). The request
+ * carries the name (with its NUL, relative to the directory's
+ * handle); the reply carries the new handle and whether it's a
+ * directory.
+ */
+static
+int
+netfs_tryopen(struct vnode *dir, const char *name, uint32_t op,
+	      struct netfs_vnode **ret)
+{
+	struct netfs_vnode *nv = dir->vn_data;
+	struct netfs_fs *nf = dir->vn_fs->fs_data;
+	uint32_t handle, isdir;
+	int result;
+
+	result = netfs_rpc(nf, op, nv->nv_handle, 0, strlen(name) + 1,
+			   name, NULL, 0, &handle, &isdir);
+	if (result) {
+		return result;
+	}
+
+	result = netfs_loadvnode(nf, handle, isdir != 0, ret);
+	if (result) {
+		(void)netfs_rpc(nf, NETFS_OP_CLOSE, handle, 0, 0,
+				NULL, NULL, 0, NULL, NULL);
+		return result;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Vnode operations
+//
+
+/*
+ * VOP_EACHOPEN on files
+ */
+static
+int
+netfs_eachopen(struct vnode *v, int openflags)
+{
+	/*
+	 * As in emufs: creation flags and access modes were already
+	 * dealt with by the time we get here.
+	 */
+
+	(void)v;
+	(void)openflags;
+
+	return 0;
+}
+
+/*
+ * VOP_EACHOPEN on directories
+ */
+static
+int
+netfs_eachopendir(struct vnode *v, int openflags)
+{
+	switch (openflags & O_ACCMODE) {
+	    case O_RDONLY:
+		break;
+	    case O_WRONLY:
+	    case O_RDWR:
+	    default:
+		return EISDIR;
+	}
+	if (openflags & O_APPEND) {
+		return EISDIR;
+	}
+
+	(void)v;
+	return 0;
+}
+
+/*
+ * VOP_RECLAIM
+ */
+static
+int
+netfs_reclaim(struct vnode *v)
+{
+	struct netfs_vnode *nv = v->vn_data;
+	struct netfs_fs *nf = v->vn_fs->fs_data;
+	unsigned ix, i, num;
+	int result;
+
+	/*
+	 * As in emufs: vfs_biglock protects the fs-related material,
+	 * nf_vlock the vnode table, so once vnode_tryreclaim sees us
+	 * as the last reference, nobody can pick the vnode up again.
+	 */
+
+	vfs_biglock_acquire();
+	lock_acquire(nf->nf_vlock);
+
+	if (!vnode_tryreclaim(&nv->nv_v)) {
+		lock_release(nf->nf_vlock);
+		vfs_biglock_release();
+		return EBUSY;
+	}
+
+	result = netfs_rpc(nf, NETFS_OP_CLOSE, nv->nv_handle, 0, 0,
+			   NULL, NULL, 0, NULL, NULL);
+	if (result) {
+		lock_release(nf->nf_vlock);
+		vfs_biglock_release();
+		return result;
+	}
+
+	num = vnodearray_num(nf->nf_vnodes);
+	ix = num;
+	for (i=0; i<num; i++) {
+		struct vnode *vx;
+
+		vx = vnodearray_get(nf->nf_vnodes, i);
+		if (vx == v) {
+			ix = i;
+			break;
+		}
+	}
+	if (ix == num) {
+		panic("netfs: reclaim vnode %u not in vnode pool\n",
+		      nv->nv_handle);
+	}
+
+	vnodearray_remove(nf->nf_vnodes, ix);
+	vnode_cleanup(&nv->nv_v);
+
+	lock_release(nf->nf_vlock);
+	vfs_biglock_release();
+
+	kfree(nv);
+	return 0;
+}
+
+/*
+ * VOP_READ
+ *
+ * The pipelined case. Reads are split into NETFS_MAXIO chunks as in
+ * emufs, but up to NETFS_WINDOW chunk requests are kept outstanding:
+ * issue ahead, then wait for the oldest, copy it out, and issue the
+ * next, so the server works on later chunks while earlier ones are
+ * in the copyout. A reply shorter than asked for means EOF; requests
+ * already in flight past that point come back empty and are drained,
+ * since the call records live on our stack.
+ */
+static
+int
+netfs_read(struct vnode *v, struct uio *uio)
+{
+	struct netfs_vnode *nv = v->vn_data;
+	struct netfs_fs *nf = v->vn_fs->fs_data;
+	struct {
+		struct netfs_rpc rpc;
+		char *buf;
+		uint32_t asked;
+	} win[NETFS_WINDOW];
+	unsigned head, tail, inflight;
+	uint32_t amt, rlen;
+	off_t offset;
+	size_t planned;
+	bool eof;
+	unsigned i;
+	int result, r;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	for (i=0; i<NETFS_WINDOW; i++) {
+		win[i].buf = kmalloc(NETFS_MAXIO);
+		if (win[i].buf == NULL) {
+			while (i > 0) {
+				i--;
+				kfree(win[i].buf);
+			}
+			return ENOMEM;
+		}
+	}
+
+	/*
+	 * Plan issuance off our own counters; uio's offset and resid
+	 * advance only as replies are copied out, in issue order.
+	 */
+	offset = uio->uio_offset;
+	planned = uio->uio_resid;
+	head = tail = inflight = 0;
+	eof = false;
+	result = 0;
+
+	while (1) {
+		while (inflight < NETFS_WINDOW && planned > 0 &&
+		       !eof && result == 0) {
+			amt = planned;
+			if (amt > NETFS_MAXIO) {
+				amt = NETFS_MAXIO;
+			}
+			win[head].asked = amt;
+			netfs_rpc_start(nf, &win[head].rpc, NETFS_OP_READ,
+					nv->nv_handle, offset, amt, NULL,
+					win[head].buf, amt);
+			offset += amt;
+			planned -= amt;
+			head = (head + 1) % NETFS_WINDOW;
+			inflight++;
+		}
+		if (inflight == 0) {
+			break;
+		}
+
+		i = tail;
+		tail = (tail + 1) % NETFS_WINDOW;
+		inflight--;
+
+		r = netfs_rpc_wait(nf, &win[i].rpc, NULL, &rlen);
+		if (result) {
+			/* already failing; just draining */
+			continue;
+		}
+		if (r) {
+			result = r;
+			continue;
+		}
+		if (rlen > win[i].asked) {
+			/* server claims more than asked; don't believe it */
+			rlen = win[i].asked;
+		}
+		r = uiomove(win[i].buf, rlen, uio);
+		if (r) {
+			result = r;
+			continue;
+		}
+		if (rlen < win[i].asked) {
+			/* short read - EOF */
+			eof = true;
+		}
+	}
+
+	for (i=0; i<NETFS_WINDOW; i++) {
+		kfree(win[i].buf);
+	}
+	return result;
+}
+
+/*
+ * VOP_READDIR
+ *
+ * The offset is an entry index, not a byte count, so it's set by
+ * hand rather than left to uiomove.
+ */
+static
+int
+netfs_getdirentry(struct vnode *v, struct uio *uio)
+{
+	struct netfs_vnode *nv = v->vn_data;
+	struct netfs_fs *nf = v->vn_fs->fs_data;
+	char buf[NAME_MAX+1];
+	uint32_t amt, rlen;
+	off_t index;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	amt = uio->uio_resid;
+	if (amt > sizeof(buf)) {
+		amt = sizeof(buf);
+	}
+	index = uio->uio_offset;
+
+	result = netfs_rpc(nf, NETFS_OP_READDIR, nv->nv_handle,
+			   index, amt, NULL, buf, amt, NULL, &rlen);
+	if (result) {
+		return result;
+	}
+	if (rlen > amt) {
+		rlen = amt;
+	}
+	if (rlen == 0) {
+		/* end of directory */
+		return 0;
+	}
+
+	result = uiomove(buf, rlen, uio);
+	if (result) {
+		return result;
+	}
+	uio->uio_offset = index + 1;
+	return 0;
+}
+
+/*
+ * VOP_WRITE
+ *
+ * Not pipelined: each chunk is copied into a bounce buffer and must
+ * be acknowledged before the next goes out, so a failure leaves the
+ * file's contents determined. If a chunk fails, the uio is backed up
+ * over it so the caller's byte accounting stays right.
+ */
+static
+int
+netfs_write(struct vnode *v, struct uio *uio)
+{
+	struct netfs_vnode *nv = v->vn_data;
+	struct netfs_fs *nf = v->vn_fs->fs_data;
+	char *kbuf;
+	uint32_t amt;
+	off_t offset;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_WRITE);
+
+	kbuf = kmalloc(NETFS_MAXIO);
+	if (kbuf == NULL) {
+		return ENOMEM;
+	}
+
+	result = 0;
+	while (uio->uio_resid > 0) {
+		amt = uio->uio_resid;
+		if (amt > NETFS_MAXIO) {
+			amt = NETFS_MAXIO;
+		}
+		offset = uio->uio_offset;
+
+		result = uiomove(kbuf, amt, uio);
+		if (result) {
+			break;
+		}
+
+		result = netfs_rpc(nf, NETFS_OP_WRITE, nv->nv_handle,
+				   offset, amt, kbuf, NULL, 0, NULL, NULL);
+		if (result) {
+			uio->uio_resid += amt;
+			uio->uio_offset -= amt;
+			break;
+		}
+	}
+
+	kfree(kbuf);
+	return result;
+}
+
+/*
+ * VOP_IOCTL
+ */
+static
+int
+netfs_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	/*
+	 * No ioctls.
+	 */
+
+	(void)v;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+/*
+ * VOP_STAT
+ */
+static
+int
+netfs_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct netfs_vnode *nv = v->vn_data;
+	struct netfs_fs *nf = v->vn_fs->fs_data;
+	uint32_t size;
+	int result;
+
+	bzero(statbuf, sizeof(struct stat));
+
+	result = netfs_rpc(nf, NETFS_OP_GETSIZE, nv->nv_handle, 0, 0,
+			   NULL, NULL, 0, &size, NULL);
+	if (result) {
+		return result;
+	}
+	statbuf->st_size = size;
+
+	result = VOP_GETTYPE(v, &statbuf->st_mode);
+	if (result) {
+		return result;
+	}
+	statbuf->st_mode |= 0644; /* possibly a lie */
+	statbuf->st_nlink = 1;    /* might be a lie, but doesn't matter much */
+	statbuf->st_blocks = 0;   /* almost certainly a lie */
+
+	return 0;
+}
+
+/*
+ * VOP_GETTYPE for files
+ */
+static
+int
+netfs_file_gettype(struct vnode *v, uint32_t *result)
+{
+	(void)v;
+	*result = S_IFREG;
+	return 0;
+}
+
+/*
+ * VOP_GETTYPE for directories
+ */
+static
+int
+netfs_dir_gettype(struct vnode *v, uint32_t *result)
+{
+	(void)v;
+	*result = S_IFDIR;
+	return 0;
+}
+
+/*
+ * VOP_ISSEEKABLE
+ */
+static
+bool
+netfs_isseekable(struct vnode *v)
+{
+	(void)v;
+	return true;
+}
+
+/*
+ * VOP_FSYNC
+ */
+static
+int
+netfs_fsync(struct vnode *v)
+{
+	struct netfs_vnode *nv = v->vn_data;
+	struct netfs_fs *nf = v->vn_fs->fs_data;
+
+	return netfs_rpc(nf, NETFS_OP_SYNC, nv->nv_handle, 0, 0,
+			 NULL, NULL, 0, NULL, NULL);
+}
+
+/*
+ * VOP_TRUNCATE
+ */
+static
+int
+netfs_truncate(struct vnode *v, off_t len)
+{
+	struct netfs_vnode *nv = v->vn_data;
+	struct netfs_fs *nf = v->vn_fs->fs_data;
+
+	return netfs_rpc(nf, NETFS_OP_TRUNC, nv->nv_handle, len, 0,
+			 NULL, NULL, 0, NULL, NULL);
+}
+
+/*
+ * VOP_CREAT
+ */
+static
+int
+netfs_creat(struct vnode *dir, const char *name, bool excl, mode_t mode,
+	    struct vnode **ret)
+{
+	struct netfs_vnode *newguy;
+	int result;
+
+	(void)mode;
+
+	result = netfs_tryopen(dir, name,
+			       excl ? NETFS_OP_EXCLCREATE : NETFS_OP_CREATE,
+			       &newguy);
+	if (result) {
+		return result;
+	}
+
+	*ret = &newguy->nv_v;
+	return 0;
+}
+
+/*
+ * VOP_LOOKUP
+ */
+static
+int
+netfs_lookup(struct vnode *dir, char *pathname, struct vnode **ret)
+{
+	struct netfs_vnode *newguy;
+	int result;
+
+	result = netfs_tryopen(dir, pathname, NETFS_OP_OPEN, &newguy);
+	if (result) {
+		return result;
+	}
+
+	*ret = &newguy->nv_v;
+	return 0;
+}
+
+/*
+ * VOP_LOOKPARENT
+ */
+static
+int
+netfs_lookparent(struct vnode *dir, char *pathname, struct vnode **ret,
+		 char *buf, size_t len)
+{
+	char *s;
+
+	s = strrchr(pathname, '/');
+	if (s==NULL) {
+		/* just a last component, no directory part */
+		if (strlen(pathname)+1 > len) {
+			return ENAMETOOLONG;
+		}
+		VOP_INCREF(dir);
+		*ret = dir;
+		strcpy(buf, pathname);
+		return 0;
+	}
+
+	*s = 0;
+	s++;
+	if (strlen(s)+1 > len) {
+		return ENAMETOOLONG;
+	}
+	strcpy(buf, s);
+
+	return netfs_lookup(dir, pathname, ret);
+}
+
+/*
+ * VOP_NAMEFILE
+ */
+static
+int
+netfs_namefile(struct vnode *v, struct uio *uio)
+{
+	struct netfs_vnode *nv = v->vn_data;
+	struct netfs_fs *nf = v->vn_fs->fs_data;
+
+	if (nv == nf->nf_root) {
+		/*
+		 * Root directory - name is empty string
+		 */
+		return 0;
+	}
+
+	(void)uio;
+
+	return ENOSYS;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Function tables
+//
+
+/*
+ * Function table for netfs files.
+ */
+static const struct vnode_ops netfs_fileops = {
+	.vop_magic = VOP_MAGIC,	/* mark this a valid vnode ops table */
+
+	.vop_eachopen = netfs_eachopen,
+	.vop_reclaim = netfs_reclaim,
+
+	.vop_read = netfs_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_write = netfs_write,
+	.vop_ioctl = netfs_ioctl,
+	.vop_stat = netfs_stat,
+	.vop_gettype = netfs_file_gettype,
+	.vop_isseekable = netfs_isseekable,
+	.vop_poll = vnode_poll_generic,
+	.vop_fsync = netfs_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = netfs_truncate,
+	.vop_namefile = vopfail_uio_notdir,
+
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+/*
+ * Function table for netfs directories. The namespace-changing ops
+ * the protocol doesn't carry are ENOSYS, as on emufs.
+ */
+static const struct vnode_ops netfs_dirops = {
+	.vop_magic = VOP_MAGIC,	/* mark this a valid vnode ops table */
+
+	.vop_eachopen = netfs_eachopendir,
+	.vop_reclaim = netfs_reclaim,
+
+	.vop_read = vopfail_uio_isdir,
+	.vop_readlink = vopfail_uio_isdir,
+	.vop_getdirentry = netfs_getdirentry,
+	.vop_write = vopfail_uio_isdir,
+	.vop_ioctl = netfs_ioctl,
+	.vop_stat = netfs_stat,
+	.vop_gettype = netfs_dir_gettype,
+	.vop_isseekable = netfs_isseekable,
+	.vop_poll = vnode_poll_generic,
+	.vop_fsync = netfs_fsync,
+	.vop_mmap = vopfail_mmap_isdir,
+	.vop_truncate = vopfail_truncate_isdir,
+	.vop_namefile = netfs_namefile,
+
+	.vop_creat = netfs_creat,
+	.vop_symlink = vopfail_symlink_nosys,
+	.vop_mkdir = vopfail_mkdir_nosys,
+	.vop_link = vopfail_link_nosys,
+	.vop_remove = vopfail_string_nosys,
+	.vop_rmdir = vopfail_string_nosys,
+	.vop_rename = vopfail_rename_nosys,
+
+	.vop_lookup = netfs_lookup,
+	.vop_lookparent = netfs_lookparent,
+};
+
+////////////////////////////////////////////////////////////
+//
+// Vnode table
+//
+
+/*
+ * Function to load a vnode into memory.
+ */
+int
+netfs_loadvnode(struct netfs_fs *nf, uint32_t handle, int isdir,
+		struct netfs_vnode **ret)
+{
+	struct vnode *v;
+	struct netfs_vnode *nv;
+	unsigned i, num;
+	int result;
+
+	vfs_biglock_acquire();
+	lock_acquire(nf->nf_vlock);
+
+	num = vnodearray_num(nf->nf_vnodes);
+	for (i=0; i<num; i++) {
+		v = vnodearray_get(nf->nf_vnodes, i);
+		nv = v->vn_data;
+		if (nv->nv_handle == handle) {
+			/* Found */
+
+			VOP_INCREF(&nv->nv_v);
+
+			lock_release(nf->nf_vlock);
+			vfs_biglock_release();
+			*ret = nv;
+			return 0;
+		}
+	}
+
+	/* Didn't have one; create it */
+
+	nv = kmalloc(sizeof(struct netfs_vnode));
+	if (nv==NULL) {
+		lock_release(nf->nf_vlock);
+		vfs_biglock_release();
+		return ENOMEM;
+	}
+
+	nv->nv_handle = handle;
+
+	result = vnode_init(&nv->nv_v, isdir ? &netfs_dirops : &netfs_fileops,
+			    &nf->nf_fs, nv);
+	if (result) {
+		lock_release(nf->nf_vlock);
+		vfs_biglock_release();
+		kfree(nv);
+		return result;
+	}
+
+	result = vnodearray_add(nf->nf_vnodes, &nv->nv_v, NULL);
+	if (result) {
+		/* note: vnode_cleanup undoes vnode_init - it does not kfree */
+		vnode_cleanup(&nv->nv_v);
+		lock_release(nf->nf_vlock);
+		vfs_biglock_release();
+		kfree(nv);
+		return result;
+	}
+
+	lock_release(nf->nf_vlock);
+	vfs_biglock_release();
+
+	*ret = nv;
+	return 0;
+}
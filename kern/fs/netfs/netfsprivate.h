@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _NETFS_NETFSPRIVATE_H_
+#define _NETFS_NETFSPRIVATE_H_
+
+#include <vnode.h>
+#include <fs.h>
+
+/*
+ * netfs: a remote-file client over UDP (see net/net.c), in the image
+ * of emufs but without its one-operation-at-a-time device: every
+ * request is a datagram tagged with a transaction id, so any number
+ * can be in flight and replies may come back in any order.
+ *
+ * The server is a host-side daemon with emufs-like semantics: files
+ * named by small integer handles, opened by path relative to another
+ * handle, with NETFS_ROOTHANDLE always valid. Since UDP can drop
+ * datagrams, requests are retransmitted on a timer (see the watchdog
+ * in netfs_fs.c); the server is expected to cache transaction ids so
+ * a retransmitted non-idempotent operation isn't performed twice.
+ */
+
+struct uio; /* from uio.h */
+
+/*
+ * Wire format. All fields 32-bit and, like the rest of the stack,
+ * big-endian like the hardware, so no swapping is done.
+ *
+ * A request is a netfs_req optionally followed by data: the path for
+ * the open ops, the file data for WRITE. A reply is a netfs_reply
+ * optionally followed by data: the file data for READ, the entry
+ * name for READDIR.
+ */
+
+struct netfs_req {
+	uint32_t nr_op;			/* NETFS_OP_* */
+	uint32_t nr_xid;		/* transaction id; echoed in reply */
+	uint32_t nr_handle;		/* file handle (open: directory) */
+	uint32_t nr_offset;		/* file offset / readdir index */
+	uint32_t nr_len;		/* data bytes wanted or following */
+};
+
+struct netfs_reply {
+	uint32_t np_xid;		/* matches the request */
+	uint32_t np_result;		/* NETFS_RES_* */
+	uint32_t np_val;		/* handle (open), size (getsize) */
+	uint32_t np_len;		/* data bytes following; for the
+					   open ops, nonzero = directory */
+};
+
+/* Operations */
+#define NETFS_OP_OPEN		1
+#define NETFS_OP_CREATE		2
+#define NETFS_OP_EXCLCREATE	3
+#define NETFS_OP_CLOSE		4
+#define NETFS_OP_READ		5
+#define NETFS_OP_READDIR	6
+#define NETFS_OP_WRITE		7
+#define NETFS_OP_GETSIZE	8
+#define NETFS_OP_TRUNC		9
+#define NETFS_OP_SYNC		10
+
+/* Result codes, as for the emu device */
+#define NETFS_RES_SUCCESS	1
+#define NETFS_RES_BADHANDLE	2
+#define NETFS_RES_BADOP		3
+#define NETFS_RES_BADPATH	4
+#define NETFS_RES_BADSIZE	5
+#define NETFS_RES_EXISTS	6
+#define NETFS_RES_ISDIR		7
+#define NETFS_RES_MEDIA		8
+#define NETFS_RES_NOHANDLES	9
+#define NETFS_RES_NOSPACE	10
+#define NETFS_RES_NOTDIR	11
+#define NETFS_RES_UNKNOWN	12
+#define NETFS_RES_UNSUPP	13
+
+/* The root directory's handle, valid without an open. */
+#define NETFS_ROOTHANDLE	0
+
+/*
+ * Where the server lives: the conventional station for the host
+ * gateway, and the netfs service port.
+ */
+#define NETFS_SERVERADDR	0x0aa10001	/* 10.161.0.1 */
+#define NETFS_PORT		7161
+
+/*
+ * Most data one request or reply can carry (kept under the socket
+ * payload limit with room for either header), and how many read
+ * requests VOP_READ keeps in flight.
+ */
+#define NETFS_MAXIO		4000
+#define NETFS_WINDOW		4
+
+/* How the watchdog treats a pending call: seconds and tries. */
+#define NETFS_TIMEOUT		2
+#define NETFS_MAXTRIES		5
+
+/*
+ * One outstanding call. Lives on the caller's stack; the caller may
+ * not return until nq_done is set. The receive thread fills in the
+ * reply fields (copying at most nq_recvmax data bytes to nq_recvbuf)
+ * and sets nq_done; the watchdog retransmits from the stashed
+ * request, or gives up and completes the call with NETFS_RES_GONE.
+ */
+#define NETFS_RES_GONE		0	/* never sent by the server */
+
+struct netfs_rpc {
+	struct netfs_rpc *nq_next;	/* pending-list link */
+	struct netfs_req nq_req;	/* the request, for retransmit */
+	const void *nq_sendbuf;		/* data after the header, or NULL */
+
+	void *nq_recvbuf;		/* where reply data goes, or NULL */
+	uint32_t nq_recvmax;		/* its size */
+
+	uint32_t nq_result;		/* NETFS_RES_* from the reply */
+	uint32_t nq_val;		/* np_val from the reply */
+	uint32_t nq_rlen;		/* np_len from the reply */
+
+	unsigned nq_age;		/* watchdog ticks since last send */
+	unsigned nq_tries;		/* sends so far */
+	volatile unsigned nq_done;	/* completion word */
+};
+
+/*
+ * Filesystem and vnode objects.
+ */
+struct netfs_fs {
+	struct fs nf_fs;		/* VFS filesystem object */
+	struct vnode *nf_socket;	/* our datagram socket */
+	struct lock *nf_lock;		/* xids and the pending list */
+	struct netfs_rpc *nf_pending;	/* calls awaiting replies */
+	uint32_t nf_nextxid;		/* next transaction id */
+
+	struct lock *nf_vlock;		/* vnode table */
+	struct vnodearray *nf_vnodes;	/* vnodes loaded so far */
+	struct netfs_vnode *nf_root;	/* the root directory */
+};
+
+struct netfs_vnode {
+	struct vnode nv_v;		/* abstract vnode */
+	uint32_t nv_handle;		/* server file handle */
+};
+
+/*
+ * The RPC engine (netfs_fs.c). netfs_rpc issues one call and waits;
+ * start/wait are split out so VOP_READ can keep a window of calls in
+ * flight. Results are errnos (already translated); VAL_RET and
+ * RLEN_RET may be NULL.
+ */
+void netfs_rpc_start(struct netfs_fs *nf, struct netfs_rpc *rpc,
+		     uint32_t op, uint32_t handle, uint32_t offset,
+		     uint32_t len, const void *sendbuf,
+		     void *recvbuf, uint32_t recvmax);
+int netfs_rpc_wait(struct netfs_fs *nf, struct netfs_rpc *rpc,
+		   uint32_t *val_ret, uint32_t *rlen_ret);
+int netfs_rpc(struct netfs_fs *nf, uint32_t op, uint32_t handle,
+	      uint32_t offset, uint32_t len, const void *sendbuf,
+	      void *recvbuf, uint32_t recvmax,
+	      uint32_t *val_ret, uint32_t *rlen_ret);
+
+/* Vnode table lookup/creation (netfs_vnops.c). */
+int netfs_loadvnode(struct netfs_fs *nf, uint32_t handle, int isdir,
+		    struct netfs_vnode **ret);
+
+#endif /* _NETFS_NETFSPRIVATE_H_ */
@@ -55,6 +55,7 @@ struct semfs_sem {
 	struct lock *sems_lock;			/* Lock to protect count */
 	struct cv *sems_cv;			/* CV to wait */
 	unsigned sems_count;			/* Semaphore count */
+	unsigned sems_waiters;			/* Threads asleep on the cv */
 	bool sems_hasvnode;			/* The vnode exists */
 	bool sems_linked;			/* In the directory */
 };
@@ -80,6 +81,14 @@ struct semfs_vnode {
 	struct vnode semv_absvn;		/* Abstract vnode */
 	struct semfs *semv_semfs;		/* Back-pointer to fs */
 	unsigned semv_semnum;			/* Which semaphore */
+
+	/*
+	 * The semaphore itself, or NULL for the root dir. The
+	 * semaphore object cannot be destroyed while its vnode
+	 * exists (see semfs_remove and semfs_reclaim), so P/V can
+	 * follow this pointer without taking the table lock.
+	 */
+	struct semfs_sem *semv_sem;
 };
 
 /*
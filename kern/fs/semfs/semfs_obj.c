@@ -63,6 +63,7 @@ semfs_sem_create(const char *name)
 		goto fail_lock;
 	}
 	sem->sems_count = 0;
+	sem->sems_waiters = 0;
 	sem->sems_hasvnode = false;
 	sem->sems_linked = false;
 	return sem;
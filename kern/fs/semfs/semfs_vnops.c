@@ -107,9 +107,10 @@ semfs_fsync(struct vnode *vn)
 // semaphore ops
 
 /*
- * XXX fold these two together
+ * Look up a semaphore by number. This is only for paths that don't
+ * have the vnode in hand (directory operations); P/V use the pointer
+ * cached in the vnode and never touch the table lock.
  */
-
 static
 struct semfs_sem *
 semfs_getsembynum(struct semfs *semfs, unsigned semnum)
@@ -123,33 +124,26 @@ semfs_getsembynum(struct semfs *semfs, unsigned semnum)
 	return sem;
 }
 
-static
-struct semfs_sem *
-semfs_getsem(struct semfs_vnode *semv)
-{
-	struct semfs *semfs = semv->semv_semfs;
-
-	return semfs_getsembynum(semfs, semv->semv_semnum);
-}
-
 /*
  * Wakeup helper. We only need to wake up if there are sleepers, which
- * should only be the case if the old count is 0; and we only
- * potentially need to wake more than one sleeper if the new count
- * will be more than 1.
+ * should only be the case if the old count is 0. Wake one sleeper per
+ * unit posted (each needs at least one unit to make progress) rather
+ * than broadcasting; waking more than that is a thundering herd where
+ * the extras just recheck the count and go back to sleep.
  */
 static
 void
 semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
 {
+	unsigned nwake;
+
 	if (sem->sems_count > 0 || newcount == 0) {
 		return;
 	}
-	if (newcount == 1) {
+	nwake = sem->sems_waiters < newcount ? sem->sems_waiters : newcount;
+	while (nwake > 0) {
 		cv_signal(sem->sems_cv, sem->sems_lock);
-	}
-	else {
-		cv_broadcast(sem->sems_cv, sem->sems_lock);
+		nwake--;
 	}
 }
 
@@ -161,9 +155,9 @@ int
 semfs_semstat(struct vnode *vn, struct stat *buf)
 {
 	struct semfs_vnode *semv = vn->vn_data;
-	struct semfs_sem *sem;
+	struct semfs_sem *sem = semv->semv_sem;
 
-	sem = semfs_getsem(semv);
+	KASSERT(sem != NULL);
 
 	bzero(buf, sizeof(*buf));
 
@@ -189,10 +183,10 @@ int
 semfs_read(struct vnode *vn, struct uio *uio)
 {
 	struct semfs_vnode *semv = vn->vn_data;
-	struct semfs_sem *sem;
+	struct semfs_sem *sem = semv->semv_sem;
 	size_t consume;
 
-	sem = semfs_getsem(semv);
+	KASSERT(sem != NULL);
 
 	lock_acquire(sem->sems_lock);
 	while (uio->uio_resid > 0) {
@@ -215,7 +209,9 @@ semfs_read(struct vnode *vn, struct uio *uio)
 		if (sem->sems_count == 0) {
 			DEBUG(DB_SEMFS, "semfs: sem%u: blocking\n",
 			      semv->semv_semnum);
+			sem->sems_waiters++;
 			cv_wait(sem->sems_cv, sem->sems_lock);
+			sem->sems_waiters--;
 		}
 	}
 	lock_release(sem->sems_lock);
@@ -231,10 +227,10 @@ int
 semfs_write(struct vnode *vn, struct uio *uio)
 {
 	struct semfs_vnode *semv = vn->vn_data;
-	struct semfs_sem *sem;
+	struct semfs_sem *sem = semv->semv_sem;
 	unsigned newcount;
 
-	sem = semfs_getsem(semv);
+	KASSERT(sem != NULL);
 
 	lock_acquire(sem->sems_lock);
 	while (uio->uio_resid > 0) {
@@ -281,7 +277,8 @@ semfs_truncate(struct vnode *vn, off_t len)
 	}
 	newcount = len;
 
-	sem = semfs_getsem(semv);
+	sem = semv->semv_sem;
+	KASSERT(sem != NULL);
 
 	lock_acquire(sem->sems_lock);
 	semfs_wakeup(sem, newcount);
@@ -603,19 +600,11 @@ semfs_reclaim(struct vnode *vn)
 
 	lock_acquire(semfs->semfs_tablelock);
 
-	/* vnode refcount is protected by the vnode's ->vn_countlock */
-	spinlock_acquire(&vn->vn_countlock);
-	if (vn->vn_refcount > 1) {
-		/* consume the reference VOP_DECREF passed us */
-		vn->vn_refcount--;
-
-		spinlock_release(&vn->vn_countlock);
+	if (!vnode_tryreclaim(vn)) {
 		lock_release(semfs->semfs_tablelock);
 		return EBUSY;
 	}
 
-	spinlock_release(&vn->vn_countlock);
-
 	/* remove from the table */
 	num = vnodearray_num(semfs->semfs_vnodes);
 	for (i=0; i<num; i++) {
@@ -662,6 +651,7 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_stat = semfs_dirstat,
 	.vop_gettype = semfs_gettype,
 	.vop_isseekable = semfs_isseekable,
+	.vop_poll = vnode_poll_generic,
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
@@ -695,6 +685,7 @@ static const struct vnode_ops semfs_semops = {
 	.vop_stat = semfs_semstat,
 	.vop_gettype = semfs_gettype,
 	.vop_isseekable = semfs_isseekable,
+	.vop_poll = vnode_poll_generic,
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_perm,
 	.vop_truncate = semfs_truncate,
@@ -736,6 +727,15 @@ semfs_vnode_create(struct semfs *semfs, unsigned semnum)
 
 	semv->semv_semfs = semfs;
 	semv->semv_semnum = semnum;
+	if (semnum == SEMFS_ROOTDIR) {
+		semv->semv_sem = NULL;
+	}
+	else {
+		/* The caller holds the table lock. */
+		KASSERT(lock_do_i_hold(semfs->semfs_tablelock));
+		semv->semv_sem = semfs_semarray_get(semfs->semfs_sems, semnum);
+		KASSERT(semv->semv_sem != NULL);
+	}
 
 	result = vnode_init(&semv->semv_absvn, optable,
 			    &semfs->semfs_absfs, semv);
@@ -33,59 +33,955 @@
  * Block allocation.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
+#include <vfs.h>
+#include <thread.h>
+#include <current.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 /*
- * Zero out a disk block.
+ * Zero out a disk block, by establishing it in the buffer cache as
+ * all zeros. No write happens now; the zeros reach the disk at sync
+ * or eviction time, and usually get overwritten in the cache first.
+ * INO is the inode of the file the block is being allocated to, for
+ * per-file sync.
  */
 static
 int
-sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
+sfs_clearblock(struct sfs_fs *sfs, daddr_t block, uint32_t ino)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct sfs_buf *b;
+	int result;
+
+	result = sfs_bgetzero(sfs, block, ino, &b);
+	if (result) {
+		return result;
+	}
+	sfs_brelease(sfs, b);
+	return 0;
+}
+
+/*
+ * Note that the freemap block covering BLOCK's bit has been modified,
+ * so sync writes back only the freemap blocks that actually changed.
+ */
+void
+sfs_freemap_markdirty(struct sfs_fs *sfs, daddr_t block)
+{
+	sfs->sfs_freemapdirty = true;
+	if (sfs->sfs_freemapdirtymap != NULL) {
+		sfs->sfs_freemapdirtymap[block / SFS_BITSPERBLOCK] = 1;
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Freemap regions and the free-space summary
+//
+// The freemap is not read in at mount time; its blocks are read on
+// first use. A "region" is the stretch of the volume covered by one
+// freemap block (SFS_BITSPERBLOCK blocks, one bit each), and
+// sfs_regionfree counts the free blocks in each region, so the search
+// paths can step over regions that are entirely in use without ever
+// reading their freemap blocks.
+//
+// The region counts and the volume-wide free total are persisted in
+// the summary region (see kern/sfs.h): a clean summary read at mount
+// supplies them all and no freemap I/O happens until something
+// allocates or frees. The summary is marked unclean on disk before
+// the first freemap write-back after mount (sfs_summary_invalidate,
+// called from the journal sync), and rewritten clean whenever a sync
+// finishes with the freemap fully on disk (sfs_summary_persist), so a
+// crash at any point leaves it unclean and the next mount falls back
+// to reading the freemap and recounting - the price is one full scan,
+// not correctness.
+//
+// The free block bitmap itself consists of SFS_FREEMAPBLOCKS 512-byte
+// sectors of bits, one bit for each sector on the filesystem, rounded
+// up to a whole number of sectors of bits; the excess bits past the
+// end of the volume are marked "in use" by mksfs and never freed, so
+// counting the zero bits of any freemap block counts exactly the free
+// blocks in its region. The sectors used by the superblock and the
+// bitmap itself are likewise marked in use by mksfs.
+
+/*
+ * True if sfs_regionfree[region] can be trusted: either the region's
+ * freemap block has been read and counted, or all the counts were
+ * adopted from a clean summary at mount. (The window where neither
+ * holds is mount-time bootstrap on a volume with no usable summary.)
+ */
+static
+bool
+sfs_region_known(struct sfs_fs *sfs, uint32_t region)
+{
+	return sfs->sfs_regionvalid || sfs->sfs_freemaploaded[region];
+}
+
+/*
+ * Read REGION's freemap block in if it isn't already, and set its
+ * free count from the bits. If the count was adopted from the summary
+ * it already matches (the clean flag guarantees it), but the bits
+ * just read are the truth, so the total is adjusted by any delta
+ * rather than asserted.
+ */
+static
+int
+sfs_freemap_load(struct sfs_fs *sfs, uint32_t region)
+{
+	char *data;
+	uint16_t count;
+	unsigned i, b;
+	int result;
+
+	if (sfs->sfs_freemaploaded[region]) {
+		return 0;
+	}
+
+	data = bitmap_getdata(sfs->sfs_freemap) + region*SFS_BLOCKSIZE;
+	result = sfs_readblock(sfs, SFS_FREEMAP_START + region, data,
+			       SFS_BLOCKSIZE);
+	if (result) {
+		return result;
+	}
+
+	count = 0;
+	for (i=0; i<SFS_BLOCKSIZE; i++) {
+		for (b=0; b<CHAR_BIT; b++) {
+			if ((data[i] & (1 << b)) == 0) {
+				count++;
+			}
+		}
+	}
+
+	sfs->sfs_nfreeblocks += count - sfs->sfs_regionfree[region];
+	sfs->sfs_regionfree[region] = count;
+	sfs->sfs_freemaploaded[region] = 1;
+	return 0;
+}
+
+/*
+ * Same, for paths that have no way to fail: the freemap bit for a
+ * block being freed must be loaded before it can be cleared, and if
+ * the disk won't even read we have no good options left.
+ */
+static
+void
+sfs_freemap_require(struct sfs_fs *sfs, uint32_t region)
+{
+	int result;
+
+	result = sfs_freemap_load(sfs, region);
+	if (result) {
+		panic("sfs: %s: error %d reading freemap block %u\n",
+		      sfs->sfs_sb.sb_volname, result, region);
+	}
+}
+
+/*
+ * Mark BLOCK in use / free again, keeping the region and volume free
+ * counts in step with the bits and dirtying the freemap block.
+ */
+void
+sfs_freemap_mark(struct sfs_fs *sfs, daddr_t block)
+{
+	uint32_t region = block / SFS_BITSPERBLOCK;
+
+	sfs_freemap_require(sfs, region);
+	bitmap_mark(sfs->sfs_freemap, block);
+	KASSERT(sfs->sfs_regionfree[region] > 0);
+	sfs->sfs_regionfree[region]--;
+	KASSERT(sfs->sfs_nfreeblocks > 0);
+	sfs->sfs_nfreeblocks--;
+	sfs_freemap_markdirty(sfs, block);
+}
+
+void
+sfs_freemap_unmark(struct sfs_fs *sfs, daddr_t block)
+{
+	uint32_t region = block / SFS_BITSPERBLOCK;
+
+	sfs_freemap_require(sfs, region);
+	bitmap_unmark(sfs->sfs_freemap, block);
+	sfs->sfs_regionfree[region]++;
+	sfs->sfs_nfreeblocks++;
+	sfs_freemap_markdirty(sfs, block);
+}
+
+/*
+ * True if the superblock names a summary region we're willing to use.
+ * The size check guards against reading or writing past a region made
+ * by some other layout; since the volume size never changes it should
+ * never fail in practice.
+ */
+static
+bool
+sfs_summary_ok(struct sfs_fs *sfs)
+{
+	return sfs->sfs_sb.sb_summarystart != 0 &&
+		sfs->sfs_sb.sb_summaryblocks ==
+			SFS_SUMMARYBLOCKS(sfs->sfs_sb.sb_nblocks);
+}
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+/*
+ * Write the summary header. CLEAN asserts that the counts in the
+ * region match the freemap as it is on disk.
+ */
+static
+int
+sfs_summary_writeheader(struct sfs_fs *sfs, bool clean)
+{
+	struct sfs_sheader sh;
+
+	COMPILE_ASSERT(sizeof(struct sfs_sheader) == SFS_BLOCKSIZE);
+
+	bzero(&sh, sizeof(sh));
+	sh.sh_magic = SFS_SUMMARY_MAGIC;
+	sh.sh_clean = clean ? 1 : 0;
+	sh.sh_nfree = sfs->sfs_nfreeblocks;
+	sh.sh_nregions = SFS_FREEMAPBLOCKS(sfs->sfs_sb.sb_nblocks);
+
+	return sfs_writeblock(sfs, sfs->sfs_sb.sb_summarystart, &sh,
+			      sizeof(sh));
+}
+
+/*
+ * Mark the on-disk summary unclean. Called (from the journal sync)
+ * before the first freemap change is written back, so a crash can
+ * never leave a clean summary describing a freemap that then changed.
+ */
+int
+sfs_summary_invalidate(struct sfs_fs *sfs)
+{
+	int result;
+
+	if (!sfs->sfs_summaryclean) {
+		return 0;
+	}
+	if (!sfs_summary_ok(sfs)) {
+		sfs->sfs_summaryclean = false;
+		return 0;
+	}
+	result = sfs_summary_writeheader(sfs, false);
+	if (result) {
+		return result;
+	}
+	sfs->sfs_summaryclean = false;
+	return 0;
+}
+
+/*
+ * Rewrite the summary clean: the counts first, then the header that
+ * vouches for them, so a crash partway through leaves it unclean.
+ * Called when a sync finishes with no freemap changes pending, which
+ * is the only time the in-memory counts match the disk.
+ */
+int
+sfs_summary_persist(struct sfs_fs *sfs)
+{
+	char block[SFS_BLOCKSIZE];
+	uint32_t nregions, done, n, i;
+	int result;
+
+	KASSERT(sfs->sfs_freemapdirty == false);
+
+	if (sfs->sfs_summaryclean || !sfs_summary_ok(sfs)) {
+		return 0;
+	}
+
+	nregions = SFS_FREEMAPBLOCKS(sfs->sfs_sb.sb_nblocks);
+	for (done=0, i=1; done<nregions; done+=n, i++) {
+		n = nregions - done;
+		if (n > SFS_SUMMARY_PERBLOCK) {
+			n = SFS_SUMMARY_PERBLOCK;
+		}
+		bzero(block, sizeof(block));
+		memcpy(block, &sfs->sfs_regionfree[done],
+		       n * sizeof(uint16_t));
+		result = sfs_writeblock(sfs,
+					sfs->sfs_sb.sb_summarystart + i,
+					block, sizeof(block));
+		if (result) {
+			return result;
+		}
+	}
+
+	result = sfs_summary_writeheader(sfs, true);
+	if (result) {
+		return result;
+	}
+	sfs->sfs_summaryclean = true;
+	return 0;
+}
+
+/*
+ * Mount-time setup for the allocator. With a clean summary on the
+ * volume, adopt its counts and do no freemap I/O at all; mount is
+ * then done as soon as the superblock and summary have been read.
+ * Otherwise read the freemap and count it the slow way, and if the
+ * volume has no summary region yet (the superblock fields were
+ * reserved space on older volumes), carve one out so the next mount
+ * is fast.
+ */
+int
+sfs_balloc_bootstrap(struct sfs_fs *sfs)
+{
+	struct sfs_sheader sh;
+	char block[SFS_BLOCKSIZE];
+	uint32_t nregions, summaryblocks, done, n, i;
+	daddr_t runstart;
+	uint32_t runlen;
+	int result;
+
+	nregions = SFS_FREEMAPBLOCKS(sfs->sfs_sb.sb_nblocks);
+
+	if (sfs_summary_ok(sfs)) {
+		result = sfs_readblock(sfs, sfs->sfs_sb.sb_summarystart,
+				       &sh, sizeof(sh));
+		if (result) {
+			return result;
+		}
+		if (sh.sh_magic == SFS_SUMMARY_MAGIC && sh.sh_clean != 0 &&
+		    sh.sh_nregions == nregions &&
+		    sh.sh_nfree <= sfs->sfs_sb.sb_nblocks) {
+			for (done=0, i=1; done<nregions; done+=n, i++) {
+				n = nregions - done;
+				if (n > SFS_SUMMARY_PERBLOCK) {
+					n = SFS_SUMMARY_PERBLOCK;
+				}
+				result = sfs_readblock(sfs,
+					sfs->sfs_sb.sb_summarystart + i,
+					block, sizeof(block));
+				if (result) {
+					return result;
+				}
+				memcpy(&sfs->sfs_regionfree[done], block,
+				       n * sizeof(uint16_t));
+			}
+			sfs->sfs_nfreeblocks = sh.sh_nfree;
+			sfs->sfs_summaryclean = true;
+			sfs->sfs_regionvalid = true;
+			return 0;
+		}
+		kprintf("sfs: %s: free-space summary is stale; "
+			"recounting\n", sfs->sfs_sb.sb_volname);
+	}
+
+	/* No usable summary; read and count the whole freemap. */
+	for (i=0; i<nregions; i++) {
+		result = sfs_freemap_load(sfs, i);
+		if (result) {
+			return result;
+		}
+	}
+	sfs->sfs_regionvalid = true;
+
+	if (sfs->sfs_sb.sb_summarystart != 0) {
+		/* Stale region; the first full sync rewrites it clean. */
+		return 0;
+	}
+
+	/*
+	 * Carve out a summary region, insisting on a contiguous run
+	 * just as the journal carve does.
+	 */
+	summaryblocks = SFS_SUMMARYBLOCKS(sfs->sfs_sb.sb_nblocks);
+	runstart = 0;
+	for (;;) {
+		daddr_t searchfrom = runstart;
+
+		result = sfs_freemap_findrun(sfs, searchfrom, summaryblocks,
+					     &runstart, &runlen);
+		if (result) {
+			break;
+		}
+		if (runlen == summaryblocks) {
+			break;
+		}
+		if (runstart < searchfrom ||
+		    runstart + runlen >= sfs->sfs_sb.sb_nblocks) {
+			result = ENOSPC;
+			break;
+		}
+		runstart = runstart + runlen;
+	}
+	if (result) {
+		kprintf("sfs: %s: no room for a free-space summary; "
+			"running without one\n", sfs->sfs_sb.sb_volname);
+		return 0;
+	}
+
+	for (i=0; i<summaryblocks; i++) {
+		sfs_freemap_mark(sfs, runstart + i);
+	}
+	sfs->sfs_sb.sb_summarystart = runstart;
+	sfs->sfs_sb.sb_summaryblocks = summaryblocks;
+	sfs->sfs_superdirty = true;
+
+	/* The freshly carved region holds garbage; say so on disk. */
+	return sfs_summary_writeheader(sfs, false);
 }
 
 /*
  * Allocate a block.
  */
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock, uint32_t ino)
 {
+	uint32_t runlen;
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	/* Blocks promised to delayed-allocation ranges are spoken for. */
+	if (sfs->sfs_nfreeblocks <= sfs->sfs_ndelayed) {
+		return ENOSPC;
+	}
+
+	result = sfs_freemap_findrun(sfs, 0, 1, diskblock, &runlen);
 	if (result) {
 		return result;
 	}
-	sfs->sfs_freemapdirty = true;
+	sfs_freemap_mark(sfs, *diskblock);
+
+	/* Clear block before returning it */
+	result = sfs_clearblock(sfs, *diskblock, ino);
+	if (result) {
+		sfs_freemap_unmark(sfs, *diskblock);
+	}
+	return result;
+}
+
+/*
+ * Extent allocation for file data blocks.
+ *
+ * Allocating data blocks one freemap search at a time scatters
+ * sequentially written files all over the disk, and reading them
+ * back then seeks for every block. Instead, when a file needs a data
+ * block we reserve a run of up to SFS_EXTENT_SIZE contiguous blocks
+ * for its vnode, mark the whole run in the freemap right away so
+ * nobody else takes it, and dole the run out block by block as the
+ * file grows. The reservation is remembered in the vnode
+ * (sv_extnext/sv_extcount); whatever is left of it is handed back to
+ * the freemap when the file is truncated or its vnode reclaimed.
+ *
+ * sv_alloc_hint remembers where the file's last block landed, so the
+ * next reservation is sought just after it and consecutive extents
+ * of the same file tend to be adjacent too.
+ */
+
+/* How many contiguous blocks to try to reserve at a time. */
+#define SFS_EXTENT_SIZE		16
+
+/*
+ * Find a run of free blocks, searching from START and wrapping
+ * around. Takes the first free block found and as many contiguous
+ * free blocks after it as are available, up to WANT. Regions whose
+ * free count is zero are stepped over without reading their freemap
+ * blocks. Returns ENOSPC if there are no free blocks at all, or an
+ * error from reading the freemap.
+ */
+int
+sfs_freemap_findrun(struct sfs_fs *sfs, daddr_t start, uint32_t want,
+		    daddr_t *runstart, uint32_t *runlen)
+{
+	uint32_t nblocks = sfs->sfs_sb.sb_nblocks;
+	daddr_t candidate;
+	uint32_t i, len, skip, region, nextregion;
+	int result;
+
+	if (start >= nblocks) {
+		start = 0;
+	}
+
+	for (i=0; i<nblocks; i++) {
+		candidate = start + i;
+		if (candidate >= nblocks) {
+			candidate -= nblocks;
+		}
+
+		region = candidate / SFS_BITSPERBLOCK;
+		if (sfs_region_known(sfs, region) &&
+		    sfs->sfs_regionfree[region] == 0) {
+			/* Region entirely in use; step over the rest. */
+			skip = SFS_BITSPERBLOCK -
+				candidate % SFS_BITSPERBLOCK;
+			if (skip > nblocks - candidate) {
+				skip = nblocks - candidate;
+			}
+			i += skip - 1;
+			continue;
+		}
 
-	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
-		panic("sfs: %s: balloc: invalid block %u\n",
-		      sfs->sfs_sb.sb_volname, *diskblock);
+		result = sfs_freemap_load(sfs, region);
+		if (result) {
+			return result;
+		}
+		if (bitmap_isset(sfs->sfs_freemap, candidate)) {
+			continue;
+		}
+
+		/* Found a free block; see how far the run extends. */
+		len = 1;
+		while (len < want && candidate + len < nblocks) {
+			nextregion = (candidate + len) / SFS_BITSPERBLOCK;
+			if (nextregion != region) {
+				if (sfs_region_known(sfs, nextregion) &&
+				    sfs->sfs_regionfree[nextregion] == 0) {
+					break;
+				}
+				result = sfs_freemap_load(sfs, nextregion);
+				if (result) {
+					/* Settle for what we have. */
+					break;
+				}
+				region = nextregion;
+			}
+			if (bitmap_isset(sfs->sfs_freemap,
+					 candidate + len)) {
+				break;
+			}
+			len++;
+		}
+		*runstart = candidate;
+		*runlen = len;
+		return 0;
 	}
 
+	return ENOSPC;
+}
+
+/*
+ * Give back the unused part of a file's reserved extent, if any.
+ * Called when the file is truncated or its vnode reclaimed; also
+ * used internally when a reservation must be abandoned.
+ */
+void
+sfs_extent_release(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	while (sv->sv_extcount > 0) {
+		sfs_freemap_unmark(sfs, sv->sv_extnext);
+		sv->sv_extnext++;
+		sv->sv_extcount--;
+	}
+}
+
+/*
+ * Allocate a data block for a file, using (and if necessary
+ * replenishing) the file's reserved extent.
+ */
+int
+sfs_balloc_file(struct sfs_fs *sfs, struct sfs_vnode *sv,
+		daddr_t *diskblock)
+{
+	daddr_t runstart;
+	uint32_t runlen, avail, want, i;
+	int result;
+
+	if (sv->sv_extcount == 0) {
+		/*
+		 * No reservation; get a new run, looking just past
+		 * the file's previous block so consecutive extents
+		 * line up. If the disk is too fragmented for a run
+		 * we still get a single block. Blocks promised to
+		 * delayed-allocation ranges don't count as available.
+		 */
+		avail = sfs->sfs_nfreeblocks - sfs->sfs_ndelayed;
+		if (avail == 0) {
+			return ENOSPC;
+		}
+		want = SFS_EXTENT_SIZE < avail ? SFS_EXTENT_SIZE : avail;
+		result = sfs_freemap_findrun(sfs,
+					     sv->sv_alloc_hint > 0 ?
+					     sv->sv_alloc_hint + 1 : 0,
+					     want,
+					     &runstart, &runlen);
+		if (result) {
+			return result;
+		}
+		for (i=0; i<runlen; i++) {
+			sfs_freemap_mark(sfs, runstart + i);
+		}
+		sv->sv_extnext = runstart;
+		sv->sv_extcount = runlen;
+	}
+
+	*diskblock = sv->sv_extnext;
+	sv->sv_extnext++;
+	sv->sv_extcount--;
+	sv->sv_alloc_hint = *diskblock;
+
 	/* Clear block before returning it */
-	result = sfs_clearblock(sfs, *diskblock);
+	result = sfs_clearblock(sfs, *diskblock, sv->sv_ino);
 	if (result) {
-		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		sfs_freemap_unmark(sfs, *diskblock);
+		sfs_extent_release(sfs, sv);
 	}
 	return result;
 }
 
+////////////////////////////////////////////////////////////
+//
+// Delayed allocation
+//
+// Even with extent reservations, data blocks get their disk addresses
+// at write() time, so interleaved writers leapfrog each other's
+// extents and each file's layout reflects write order. Instead, a
+// buffered write to a new block of a regular file doesn't pick a disk
+// block at all: the block joins the vnode's pending range, its data is
+// established in the buffer cache under a placeholder address beyond
+// the end of the volume, and only the free-space accounting
+// (sfs_ndelayed) is charged. When the range is flushed - at sync,
+// fsync, eviction of a dirty buffer, or reclaim - the whole
+// accumulated range is bound at once: one contiguous disk run is
+// allocated for it, the inode's block pointers are filled in, and the
+// cached buffers are renumbered from their placeholders to their real
+// homes. A file written in many small appends thus ends up laid out as
+// if it had been preallocated.
+//
+// Placeholder addresses are derived from (inode, file block), so they
+// are stable and unique without any extra state; sfs_dalloc_usable
+// checks that the volume is small enough for the placeholder space to
+// fit in a daddr_t (true for any disk sys161 supports). A placeholder
+// block always has its buffer in the cache - the cache treats unbound
+// buffers as pinned - so reads and overwrites of a pending block hit
+// the cached data, and nothing ever does device I/O on a placeholder
+// address.
+
+/*
+ * Cap on unbound delayed blocks per volume. Each one pins a buffer in
+ * the 64-buffer cache, so the pending ranges must never come close to
+ * filling it; reserving past the cap binds everything first.
+ */
+#define SFS_DALLOC_MAXPENDING	32
+
+/*
+ * Placeholder address space per inode. The file block is folded
+ * modulo this span: each vnode has at most one pending range, the
+ * range is contiguous, and it can't grow longer than
+ * SFS_DALLOC_MAXPENDING, so as long as the span exceeds the cap no
+ * two pending blocks of a file collide. (Using the largest possible
+ * file block instead would burst the 32-bit placeholder space now
+ * that the triple indirect tree makes files of two million blocks
+ * representable.)
+ */
+#define SFS_DALLOC_SPAN		64
+
+/* The placeholder address of FILEBLOCK of SV. */
+#define SFS_DALLOC_BLOCK(sfs, sv, fileblock) \
+	((sfs)->sfs_sb.sb_nblocks + \
+	 (daddr_t)(sv)->sv_ino * SFS_DALLOC_SPAN + \
+	 (fileblock) % SFS_DALLOC_SPAN)
+
+/*
+ * True if the volume is small enough that every placeholder address
+ * fits in a daddr_t. (If not, delayed allocation is just not used.)
+ */
+static
+bool
+sfs_dalloc_usable(struct sfs_fs *sfs)
+{
+	uint64_t maxplaceholder;
+
+	/* The modulus trick in SFS_DALLOC_BLOCK depends on this. */
+	COMPILE_ASSERT(SFS_DALLOC_MAXPENDING < SFS_DALLOC_SPAN);
+
+	maxplaceholder = (uint64_t)sfs->sfs_sb.sb_nblocks *
+		(SFS_DALLOC_SPAN + 1) + SFS_DALLOC_SPAN;
+	return maxplaceholder <= 0xffffffff;
+}
+
+/*
+ * Policy check: should a new data block of SV get delayed allocation?
+ * Directory blocks keep immediate allocation (they're metadata and go
+ * through the journal promptly), and O_DIRECT writes want to reach the
+ * disk now, not sit in the cache waiting for a disk address.
+ */
+bool
+sfs_dalloc_wanted(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	if (sv->sv_i.sfi_type != SFS_TYPE_FILE) {
+		return false;
+	}
+	if (curthread->t_iodirect) {
+		return false;
+	}
+	return sfs_dalloc_usable(sfs);
+}
+
+/*
+ * If FILEBLOCK is in SV's pending range, hand back its placeholder
+ * address and return true. Used by sfs_bmap before it consults the
+ * inode, for reads and overwrites of not-yet-bound blocks.
+ */
+bool
+sfs_dalloc_lookup(struct sfs_fs *sfs, struct sfs_vnode *sv,
+		  uint32_t fileblock, daddr_t *diskblock)
+{
+	if (sv->sv_dlcount == 0 || fileblock < sv->sv_dlstart ||
+	    fileblock - sv->sv_dlstart >= sv->sv_dlcount) {
+		return false;
+	}
+	*diskblock = SFS_DALLOC_BLOCK(sfs, sv, fileblock);
+	return true;
+}
+
+/*
+ * Bind SV's pending range: allocate contiguous disk runs for it, fill
+ * in the inode's block pointers, and renumber the cached buffers from
+ * their placeholders to their real addresses. No data I/O happens
+ * here; the buffers stay dirty and go out with the next flush.
+ *
+ * The reservation accounting guarantees the freemap has at least
+ * sv_dlcount free blocks, so only fragmentation can split the range
+ * across several runs.
+ */
+int
+sfs_dalloc_bind(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_buf *idb;
+	uint32_t *idbuf;
+	daddr_t runstart, block;
+	uint32_t runlen, fileblock, idoff, i, j;
+	bool wasbinding;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	/*
+	 * Mark a bind in progress so that a flush triggered underneath
+	 * us (the indirect-block fetch below can evict) doesn't try to
+	 * bind again; it just writes out whatever is already bound.
+	 */
+	wasbinding = sfs->sfs_dlbinding;
+	sfs->sfs_dlbinding = true;
+
+	while (sv->sv_dlcount > 0) {
+		result = sfs_freemap_findrun(sfs,
+					     sv->sv_alloc_hint > 0 ?
+					     sv->sv_alloc_hint + 1 : 0,
+					     sv->sv_dlcount,
+					     &runstart, &runlen);
+		if (result) {
+			/* The reservation promised these blocks exist. */
+			panic("sfs: %s: no space binding delayed blocks "
+			      "of file %u\n", sfs->sfs_sb.sb_volname,
+			      sv->sv_ino);
+		}
+		for (i=0; i<runlen; i++) {
+			sfs_freemap_mark(sfs, runstart + i);
+		}
+
+		for (i=0; i<runlen; i++) {
+			fileblock = sv->sv_dlstart;
+			block = runstart + i;
+
+			if (fileblock < SFS_NDIRECT) {
+				sv->sv_i.sfi_direct[fileblock] = block;
+			}
+			else {
+				/*
+				 * The indirect chain down to the leaf
+				 * was built when the range was
+				 * reserved, so the walk can't need to
+				 * allocate.
+				 */
+				result = sfs_bmap_tree(sv, fileblock, false,
+						       &idb, &idoff);
+				if (result) {
+					/* Give back the unbound tail. */
+					for (j=i; j<runlen; j++) {
+						sfs_freemap_unmark(sfs,
+							      runstart + j);
+					}
+					sfs->sfs_dlbinding = wasbinding;
+					return result;
+				}
+				KASSERT(idb != NULL);
+				idbuf = sfs_bdata(idb);
+				idbuf[idoff] = block;
+				sfs_bmarkdirty(idb, sv->sv_ino);
+				sfs_brelease(sfs, idb);
+			}
+			sfs_ino_markdirty(sv);
+
+			sfs_cache_renumber(sfs,
+					   SFS_DALLOC_BLOCK(sfs, sv, fileblock),
+					   block);
+
+			sv->sv_alloc_hint = block;
+			sv->sv_dlstart++;
+			sv->sv_dlcount--;
+			KASSERT(sfs->sfs_ndelayed > 0);
+			sfs->sfs_ndelayed--;
+		}
+	}
+
+	sfs->sfs_dlbinding = wasbinding;
+	return 0;
+}
+
+/*
+ * Bind every vnode's pending range, pushing each updated inode into
+ * its cache buffer so a flush gathered afterward captures the final
+ * layout. Called from the journal flush path.
+ */
+int
+sfs_dalloc_bindall(struct sfs_fs *sfs)
+{
+	struct vnode *v;
+	struct sfs_vnode *sv;
+	unsigned i, num;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	num = vnodearray_num(sfs->sfs_vnodes);
+	for (i=0; i<num; i++) {
+		v = vnodearray_get(sfs->sfs_vnodes, i);
+		sv = v->vn_data;
+		if (sv->sv_dlcount == 0) {
+			continue;
+		}
+		result = sfs_dalloc_bind(sfs, sv);
+		if (result == 0) {
+			result = sfs_sync_inode(sv);
+		}
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Reserve delayed allocation for FILEBLOCK of SV and hand back its
+ * placeholder address. Establishes the block as zeros in the cache,
+ * like sfs_clearblock does for an immediate allocation. A write that
+ * doesn't extend the pending range binds it first and starts a new
+ * one; delayed allocation is aimed at append-style writers, and one
+ * range per vnode keeps the bookkeeping trivial.
+ */
+int
+sfs_dalloc_reserve(struct sfs_fs *sfs, struct sfs_vnode *sv,
+		   uint32_t fileblock, daddr_t *diskblock)
+{
+	struct sfs_buf *b;
+	daddr_t pblock;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs->sfs_nfreeblocks <= sfs->sfs_ndelayed) {
+		return ENOSPC;
+	}
+
+	/* Too many buffers pinned? Bind everything and start over. */
+	if (sfs->sfs_ndelayed >= SFS_DALLOC_MAXPENDING) {
+		result = sfs_dalloc_bindall(sfs);
+		if (result) {
+			return result;
+		}
+	}
+
+	if (sv->sv_dlcount > 0 &&
+	    fileblock != sv->sv_dlstart + sv->sv_dlcount) {
+		result = sfs_dalloc_bind(sfs, sv);
+		if (result) {
+			return result;
+		}
+	}
+
+	/*
+	 * Establish the zeroed block under its placeholder address.
+	 * This can evict, and the eviction flush can bind and clear
+	 * the pending range, so the range is only extended afterward.
+	 */
+	pblock = SFS_DALLOC_BLOCK(sfs, sv, fileblock);
+	result = sfs_bgetzero(sfs, pblock, sv->sv_ino, &b);
+	if (result) {
+		return result;
+	}
+	sfs_brelease(sfs, b);
+
+	if (sv->sv_dlcount == 0) {
+		sv->sv_dlstart = fileblock;
+	}
+	KASSERT(fileblock == sv->sv_dlstart + sv->sv_dlcount);
+	sv->sv_dlcount++;
+	sfs->sfs_ndelayed++;
+
+	*diskblock = pblock;
+	return 0;
+}
+
+/*
+ * Drop the part of SV's pending range at or past file block BLOCKLEN.
+ * For truncation: the dropped blocks never had disk addresses, so
+ * there's nothing to free, just cached data to discard and promises
+ * to take back.
+ */
+void
+sfs_dalloc_truncate(struct sfs_fs *sfs, struct sfs_vnode *sv,
+		    uint32_t blocklen)
+{
+	uint32_t fileblock;
+
+	while (sv->sv_dlcount > 0 &&
+	       sv->sv_dlstart + sv->sv_dlcount > blocklen) {
+		fileblock = sv->sv_dlstart + sv->sv_dlcount - 1;
+		sfs_cache_discard(sfs, SFS_DALLOC_BLOCK(sfs, sv, fileblock));
+		sv->sv_dlcount--;
+		KASSERT(sfs->sfs_ndelayed > 0);
+		sfs->sfs_ndelayed--;
+	}
+}
+
 /*
  * Free a block.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
-	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	sfs_cache_discard(sfs, diskblock);
+	sfs_freemap_unmark(sfs, diskblock);
+}
+
+/*
+ * Free a run of LEN contiguous blocks starting at START. The buffer
+ * cache copies are still discarded one block at a time, but the
+ * freemap bits are cleared word-at-a-time and each affected freemap
+ * block is marked dirty once rather than once per bit, so truncating
+ * a large extent-allocated file updates each freemap block once.
+ */
+void
+sfs_bfree_run(struct sfs_fs *sfs, daddr_t start, uint32_t len)
+{
+	daddr_t block, regionend;
+	uint32_t region, n;
+
+	KASSERT(len > 0);
+
+	for (block = start; block < start + len; block++) {
+		sfs_cache_discard(sfs, block);
+	}
+
+	/*
+	 * Load, credit, and dirty each freemap block the run touches,
+	 * once rather than once per bit.
+	 */
+	for (block = start; block < start + len; block = regionend) {
+		region = block / SFS_BITSPERBLOCK;
+		regionend = (daddr_t)(region + 1) * SFS_BITSPERBLOCK;
+		n = (start + len < regionend ? start + len : regionend)
+			- block;
+		sfs_freemap_require(sfs, region);
+		sfs->sfs_regionfree[region] += n;
+		sfs_freemap_markdirty(sfs, block);
+	}
+
+	bitmap_unmarkrange(sfs->sfs_freemap, start, len);
+	sfs->sfs_nfreeblocks += len;
 }
 
 /*
@@ -98,6 +994,7 @@ sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
 		panic("sfs: %s: sfs_bused called on out of range block %u\n",
 		      sfs->sfs_sb.sb_volname, diskblock);
 	}
+	sfs_freemap_require(sfs, diskblock / SFS_BITSPERBLOCK);
 	return bitmap_isset(sfs->sfs_freemap, diskblock);
 }
 
@@ -39,36 +39,244 @@
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Look in the vnode's extent cache for a mapping of FILEBLOCK.
+ * Returns true and fills in *DISKBLOCK on a hit. Only existing
+ * mappings are cached, so a hit is valid regardless of doalloc.
+ */
+static
+bool
+sfs_bmapcache_lookup(struct sfs_vnode *sv, uint32_t fileblock,
+		     daddr_t *diskblock)
+{
+	struct sfs_bmapextent *sbe;
+	unsigned i;
+
+	for (i=0; i<SFS_BMAPCACHE_SIZE; i++) {
+		sbe = &sv->sv_bmapcache[i];
+		if (sbe->sbe_len > 0 && fileblock >= sbe->sbe_fileblock &&
+		    fileblock - sbe->sbe_fileblock < sbe->sbe_len) {
+			*diskblock = sbe->sbe_diskblock +
+				(fileblock - sbe->sbe_fileblock);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Remember that FILEBLOCK maps to DISKBLOCK. Grows the matching
+ * cached extent when the new mapping continues it (the common case
+ * for sequential I/O over extent-allocated files); otherwise evicts
+ * round-robin.
+ */
+static
+void
+sfs_bmapcache_note(struct sfs_vnode *sv, uint32_t fileblock,
+		   daddr_t diskblock)
+{
+	struct sfs_bmapextent *sbe;
+	unsigned i;
+
+	KASSERT(diskblock != 0);
+
+	for (i=0; i<SFS_BMAPCACHE_SIZE; i++) {
+		sbe = &sv->sv_bmapcache[i];
+		if (sbe->sbe_len > 0 &&
+		    fileblock == sbe->sbe_fileblock + sbe->sbe_len &&
+		    diskblock == sbe->sbe_diskblock + sbe->sbe_len) {
+			sbe->sbe_len++;
+			return;
+		}
+	}
+
+	sbe = &sv->sv_bmapcache[sv->sv_bmapnext];
+	sv->sv_bmapnext = (sv->sv_bmapnext + 1) % SFS_BMAPCACHE_SIZE;
+	sbe->sbe_fileblock = fileblock;
+	sbe->sbe_diskblock = diskblock;
+	sbe->sbe_len = 1;
+}
+
+/*
+ * Drop all cached mappings; called when truncation frees blocks.
+ */
+static
+void
+sfs_bmapcache_invalidate(struct sfs_vnode *sv)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_BMAPCACHE_SIZE; i++) {
+		sv->sv_bmapcache[i].sbe_len = 0;
+	}
+}
+
+/*
+ * Number of file blocks mapped by an indirect-block subtree LEVELS
+ * deep. (Level 1 is a plain indirect block; level 0 is a single data
+ * block.)
+ */
+static
+uint32_t
+sfs_idspan(unsigned levels)
+{
+	uint32_t span;
+	unsigned i;
+
+	span = 1;
+	for (i=0; i<levels; i++) {
+		span *= SFS_DBPERIDB;
+	}
+	return span;
+}
+
+/*
+ * Walk the indirection trees to the leaf slot that holds FILEBLOCK's
+ * disk address. FILEBLOCK is the absolute block number in the file and
+ * must be at or past the direct blocks. On success *IDB_RET holds the
+ * leaf indirect block (acquired; the caller releases it) and
+ * *IDOFF_RET the slot within it.
+ *
+ * If DOALLOC is set, missing indirect blocks along the way are
+ * allocated; they are metadata and so get disk addresses immediately,
+ * never delayed ones. If DOALLOC is not set and the chain runs out,
+ * *IDB_RET comes back NULL and the caller should treat the block as a
+ * hole.
+ *
+ * This code assumes at most one tree of each depth, which is what fits
+ * in the inode.
+ */
+int
+sfs_bmap_tree(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+	      struct sfs_buf **idb_ret, uint32_t *idoff_ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *idb;
+	uint32_t *idbuf;
+	uint32_t *roots[3];
+	daddr_t idblock, block;
+	uint32_t span, idoff;
+	unsigned levels, level;
+	int result;
+
+	KASSERT(fileblock >= SFS_NDIRECT);
+	fileblock -= SFS_NDIRECT;
+
+	roots[0] = &sv->sv_i.sfi_indirect;
+	roots[1] = &sv->sv_i.sfi_dindirect;
+	roots[2] = &sv->sv_i.sfi_tindirect;
+
+	/*
+	 * Pick the tree: the single, double, and triple indirect ranges
+	 * follow one another, each SFS_DBPERIDB times the size of the
+	 * last.
+	 */
+	for (levels = 1; levels <= 3; levels++) {
+		if (fileblock < sfs_idspan(levels)) {
+			break;
+		}
+		fileblock -= sfs_idspan(levels);
+	}
+	if (levels > 3) {
+		return EFBIG;
+	}
+
+	/* Get the tree's root block, allocating it if we're allowed to. */
+	idblock = *roots[levels - 1];
+	if (idblock == 0) {
+		if (!doalloc) {
+			*idb_ret = NULL;
+			return 0;
+		}
+		result = sfs_balloc(sfs, &idblock, sv->sv_ino);
+		if (result) {
+			return result;
+		}
+		*roots[levels - 1] = idblock;
+		sfs_ino_markdirty(sv);
+	}
+
+	/*
+	 * Descend. At every level above the leaf the entry we index to
+	 * is a child indirect block; sfs_balloc establishes new blocks
+	 * as zeros in the buffer cache, so a freshly allocated child is
+	 * immediately usable.
+	 */
+	for (level = levels; level > 1; level--) {
+		span = sfs_idspan(level - 1);
+		idoff = fileblock / span;
+		fileblock = fileblock % span;
+
+		result = sfs_bget(sfs, idblock, &idb);
+		if (result) {
+			return result;
+		}
+		idbuf = sfs_bdata(idb);
+		block = idbuf[idoff];
+
+		if (block == 0) {
+			if (!doalloc) {
+				sfs_brelease(sfs, idb);
+				*idb_ret = NULL;
+				return 0;
+			}
+			result = sfs_balloc(sfs, &block, sv->sv_ino);
+			if (result) {
+				sfs_brelease(sfs, idb);
+				return result;
+			}
+			idbuf[idoff] = block;
+			sfs_bmarkdirty(idb, sv->sv_ino);
+		}
+		sfs_brelease(sfs, idb);
+		idblock = block;
+	}
+
+	/* The leaf indirect block; its entries are data blocks. */
+	result = sfs_bget(sfs, idblock, &idb);
+	if (result) {
+		return result;
+	}
+	*idb_ret = idb;
+	*idoff_ret = fileblock;
+	return 0;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
  * allocated.
+ *
+ * Mappings that have been resolved once are served from the vnode's
+ * extent cache without touching the inode or indirect blocks.
  */
 int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	 daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *idb;
+	uint32_t *idbuf;
 	daddr_t block;
-	daddr_t idblock;
-	uint32_t idnum, idoff;
+	uint32_t idoff;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
-	/* Since we're using a static buffer, we'd better be locked. */
 	KASSERT(vfs_biglock_do_i_hold());
 
+	/* Try the extent cache first. */
+	if (sfs_bmapcache_lookup(sv, fileblock, diskblock)) {
+		return 0;
+	}
+
+	/*
+	 * A block in the pending delayed-allocation range has no disk
+	 * address yet; its placeholder address finds the cached data.
+	 */
+	if (sfs_dalloc_lookup(sfs, sv, fileblock, diskblock)) {
+		return 0;
+	}
+
 	/*
 	 * If the block we want is one of the direct blocks...
 	 */
@@ -82,14 +290,24 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			/*
+			 * Ordinary file data: defer choosing a disk
+			 * block until writeback. The inode is not
+			 * touched; the mapping is pending in the vnode.
+			 */
+			if (sfs_dalloc_wanted(sfs, sv)) {
+				return sfs_dalloc_reserve(sfs, sv, fileblock,
+							  diskblock);
+			}
+
+			result = sfs_balloc_file(sfs, sv, &block);
 			if (result) {
 				return result;
 			}
 
 			/* Remember what we allocated; mark inode dirty */
 			sv->sv_i.sfi_direct[fileblock] = block;
-			sv->sv_dirty = true;
+			sfs_ino_markdirty(sv);
 		}
 
 		/*
@@ -100,133 +318,219 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 			      "marked free\n", sfs->sfs_sb.sb_volname,
 			      block, fileblock, sv->sv_ino);
 		}
+		if (block != 0) {
+			sfs_bmapcache_note(sv, fileblock, block);
+		}
 		*diskblock = block;
 		return 0;
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
-	 */
-
-	fileblock -= SFS_NDIRECT;
-
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
-
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
+	 * It's not a direct block; find its slot in the indirection
+	 * trees, building out the chain of indirect blocks if we're
+	 * allocating.
 	 */
-	if (idnum >= SFS_NINDIRECT) {
-		return EFBIG;
+	result = sfs_bmap_tree(sv, fileblock, doalloc, &idb, &idoff);
+	if (result) {
+		return result;
 	}
-
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
-
-	if (idblock==0 && !doalloc) {
+	if (idb == NULL) {
 		/*
-		 * There's no indirect block allocated. We weren't
-		 * asked to allocate anything, so pretend the indirect
-		 * block was filled with all zeros.
+		 * Part of the chain doesn't exist and we weren't asked
+		 * to allocate anything, so pretend the missing blocks
+		 * were filled with all zeros.
 		 */
+		KASSERT(!doalloc);
 		*diskblock = 0;
 		return 0;
 	}
-	else if (idblock==0) {
-		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
-		 */
-		result = sfs_balloc(sfs, &idblock);
-		if (result) {
-			return result;
-		}
-
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+	idbuf = sfs_bdata(idb);
 
-		/* Mark the inode dirty */
-		sv->sv_dirty = true;
+	/* Get the block out of the leaf indirect block buffer */
+	block = idbuf[idoff];
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
-	}
-	else {
+	/* If there's no block there, allocate one */
+	if (block==0 && doalloc) {
 		/*
-		 * We already have an indirect block allocated; load it.
+		 * As with the direct case: ordinary file data gets its
+		 * disk block at writeback time. The indirect chain was
+		 * built above, so the bind will have a place to put the
+		 * real block number.
 		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
+		if (sfs_dalloc_wanted(sfs, sv)) {
+			sfs_brelease(sfs, idb);
+			return sfs_dalloc_reserve(sfs, sv, fileblock,
+						  diskblock);
 		}
-	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
-
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+		result = sfs_balloc_file(sfs, sv, &block);
 		if (result) {
+			sfs_brelease(sfs, idb);
 			return result;
 		}
 
-		/* Remember the block we allocated */
+		/* Remember the block we allocated; write-back at sync */
 		idbuf[idoff] = block;
-
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+		sfs_bmarkdirty(idb, sv->sv_ino);
 	}
 
+	sfs_brelease(sfs, idb);
+
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
 		panic("sfs: %s: Data block %u (block %u of file %u) "
 		      "marked free\n", sfs->sfs_sb.sb_volname,
 		      block, fileblock, sv->sv_ino);
 	}
+	if (block != 0) {
+		sfs_bmapcache_note(sv, fileblock, block);
+	}
 	*diskblock = block;
 	return 0;
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Run accumulator for sfs_itrunc. Extent-allocated files free long
+ * strings of consecutive disk blocks, so instead of calling sfs_bfree
+ * once per block (one freemap update per bit) the truncate walk feeds
+ * each block through here: consecutive blocks grow the pending run,
+ * and a break flushes it with one sfs_bfree_run call.
  */
+static
+void
+sfs_blockrun_add(struct sfs_fs *sfs, daddr_t *runstart, uint32_t *runlen,
+		 daddr_t block)
+{
+	if (*runlen > 0 && block == *runstart + *runlen) {
+		(*runlen)++;
+		return;
+	}
+	if (*runlen > 0) {
+		sfs_bfree_run(sfs, *runstart, *runlen);
+	}
+	*runstart = block;
+	*runlen = 1;
+}
+
+/*
+ * Free the blocks past BLOCKLEN in the indirect-block subtree rooted
+ * at IDBLOCK. LEVEL gives its depth: at level 1 the entries are data
+ * blocks, above that they are child indirect blocks. BASEBLOCK is the
+ * first file block the subtree maps. Freed blocks go through the run
+ * accumulator. Sets *EMPTY if the subtree no longer maps anything, in
+ * which case the caller frees IDBLOCK itself and clears its slot.
+ */
+static
 int
-sfs_itrunc(struct sfs_vnode *sv, off_t len)
+sfs_itrunc_tree(struct sfs_fs *sfs, struct sfs_vnode *sv, daddr_t idblock,
+		unsigned level, uint32_t baseblock, uint32_t blocklen,
+		daddr_t *runstart, uint32_t *runlen, bool *empty)
 {
+	struct sfs_buf *idb;
+	uint32_t *idbuf;
+	uint32_t span;
+	uint32_t entrybase;
+	uint32_t j;
+	int result;
+	int hasnonzero, iddirty;
+	bool subempty;
+
+	KASSERT(idblock != 0);
+
+	/* File blocks mapped by each entry. */
+	span = sfs_idspan(level - 1);
+
+	result = sfs_bget(sfs, idblock, &idb);
+	if (result) {
+		return result;
+	}
+	idbuf = sfs_bdata(idb);
+
+	hasnonzero = 0;
+	iddirty = 0;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		if (idbuf[j] == 0) {
+			continue;
+		}
+		entrybase = baseblock + j*span;
+		if (blocklen >= entrybase + span) {
+			/* Entirely below the new EOF; keep it. */
+			hasnonzero = 1;
+			continue;
+		}
+		if (level > 1) {
+			/* Prune the child subtree first. */
+			result = sfs_itrunc_tree(sfs, sv, idbuf[j], level-1,
+						 entrybase, blocklen,
+						 runstart, runlen, &subempty);
+			if (result) {
+				sfs_brelease(sfs, idb);
+				return result;
+			}
+			if (!subempty) {
+				hasnonzero = 1;
+				continue;
+			}
+		}
+		/* A data block past the new EOF, or an emptied child. */
+		sfs_blockrun_add(sfs, runstart, runlen, idbuf[j]);
+		idbuf[j] = 0;
+		iddirty = 1;
+	}
+
+	*empty = !hasnonzero;
+	if (hasnonzero && iddirty) {
+		/* Write-back happens at sync time */
+		sfs_bmarkdirty(idb, sv->sv_ino);
+	}
 	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
+	 * If the block came up empty, release it without marking it
+	 * dirty; the caller's deferred free discards the cached copy.
 	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	sfs_brelease(sfs, idb);
+	return 0;
+}
 
+/*
+ * Called for ftruncate() and from sfs_reclaim.
+ */
+int
+sfs_itrunc(struct sfs_vnode *sv, off_t len)
+{
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t *roots[3];
 
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j;
+	uint32_t i;
+	unsigned level;
 	daddr_t block, idblock;
-	uint32_t baseblock, highblock;
+	daddr_t runstart;
+	uint32_t runlen;
+	uint32_t baseblock, span;
 	int result;
-	int hasnonzero, iddirty;
-
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	bool empty;
 
 	vfs_biglock_acquire();
 
+	/* Any reserved extent is beyond the new EOF; give it back. */
+	sfs_extent_release(sfs, sv);
+	sv->sv_alloc_hint = 0;
+
+	/*
+	 * Delayed blocks past the new EOF never got disk addresses;
+	 * just drop them.
+	 */
+	sfs_dalloc_truncate(sfs, sv, blocklen);
+
+	/* Cached block mappings past the new EOF are about to go stale. */
+	sfs_bmapcache_invalidate(sv);
+
+	/* No run pending yet. */
+	runstart = 0;
+	runlen = 0;
+
 	/*
 	 * Go through the direct blocks. Discard any that are
 	 * past the limit we're truncating to.
@@ -234,68 +538,67 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	for (i=0; i<SFS_NDIRECT; i++) {
 		block = sv->sv_i.sfi_direct[i];
 		if (i >= blocklen && block != 0) {
-			sfs_bfree(sfs, block);
+			sfs_blockrun_add(sfs, &runstart, &runlen, block);
 			sv->sv_i.sfi_direct[i] = 0;
-			sv->sv_dirty = true;
+			sfs_ino_markdirty(sv);
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
+	/*
+	 * Go through the indirection trees, shallowest range first.
+	 * (Joining each emptied tree root to the pending run is
+	 * deliberate: indirect blocks often sit right next to the data
+	 * blocks they map.)
+	 */
+	roots[0] = &sv->sv_i.sfi_indirect;
+	roots[1] = &sv->sv_i.sfi_dindirect;
+	roots[2] = &sv->sv_i.sfi_tindirect;
 
-	/* The lowest block in the indirect block */
 	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			vfs_biglock_release();
-			return result;
-		}
-
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
-		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
+	for (level = 1; level <= 3; level++) {
+		span = sfs_idspan(level);
+		idblock = *roots[level - 1];
+		if (idblock != 0 && blocklen < baseblock + span) {
+			/* We're past the proposed EOF; may need to free stuff */
+			result = sfs_itrunc_tree(sfs, sv, idblock, level,
+						 baseblock, blocklen,
+						 &runstart, &runlen, &empty);
 			if (result) {
+				if (runlen > 0) {
+					sfs_bfree_run(sfs, runstart, runlen);
+				}
 				vfs_biglock_release();
 				return result;
 			}
+			if (empty) {
+				sfs_blockrun_add(sfs, &runstart, &runlen,
+						 idblock);
+				*roots[level - 1] = 0;
+				sfs_ino_markdirty(sv);
+			}
 		}
+		baseblock += span;
+	}
+
+	/* Flush the last pending run. */
+	if (runlen > 0) {
+		sfs_bfree_run(sfs, runstart, runlen);
 	}
 
 	/* Set the file size */
 	sv->sv_i.sfi_size = len;
 
 	/* Mark the inode dirty */
-	sv->sv_dirty = true;
+	sfs_ino_markdirty(sv);
+
+	/*
+	 * If this was a directory, the cached block image and the name
+	 * index no longer describe its contents.
+	 */
+	if (sv->sv_i.sfi_type == SFS_TYPE_DIR) {
+		sv->sv_dirvalid = false;
+		sfs_dirhash_destroy(sv);
+	}
 
 	vfs_biglock_release();
 	return 0;
@@ -0,0 +1,520 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Block buffer cache.
+ *
+ * Every partial-sector operation and all metadata I/O used to go
+ * through one global static buffer and straight to the disk. Instead
+ * we keep a per-volume pool of block buffers with hashed lookup and
+ * LRU eviction, so hot blocks (inodes, directory blocks, indirect
+ * blocks) stay in memory and repeated writes to the same block can be
+ * coalesced until sync or eviction.
+ *
+ * Everything in here runs under vfs_biglock, like the rest of SFS, so
+ * no further locking is needed. If SFS ever gets fine-grained
+ * locking, each buffer will need its own busy flag.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vfs.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/*
+ * Number of buffers per volume, and the hash table size used to look
+ * them up by block number. The pool is ~32K of data per mounted
+ * volume, which is cheap even on small sys161 memory configs.
+ */
+#define SFS_CACHE_NBUFS     64
+#define SFS_CACHE_HASHSIZE  32
+
+/*
+ * One cached disk block.
+ */
+struct sfs_buf {
+	daddr_t b_block;		/* block number, if valid */
+	unsigned b_refcount;		/* in active use this many times */
+	unsigned b_stamp;		/* LRU timestamp (0 = never used) */
+	bool b_valid;			/* contents match some disk block */
+	bool b_dirty;			/* contents newer than the disk */
+	uint32_t b_owner;		/* inode whose file dirtied this
+					   block (SFS_NOINO: volume
+					   metadata); set with b_dirty */
+	struct sfs_buf *b_hashnext;	/* next buffer in hash chain */
+	char b_data[SFS_BLOCKSIZE];	/* the data itself */
+};
+
+/*
+ * The cache for one volume: the buffer pool plus the hash table over
+ * the valid buffers in it.
+ */
+struct sfs_bufcache {
+	struct sfs_buf *c_hash[SFS_CACHE_HASHSIZE];
+	struct sfs_buf c_bufs[SFS_CACHE_NBUFS];
+	unsigned c_nextstamp;
+};
+
+/*
+ * Hash function. Block numbers are small and sequential, so just
+ * taking them mod the table size spreads fine.
+ */
+static
+unsigned
+sfs_cache_hash(daddr_t block)
+{
+	return block % SFS_CACHE_HASHSIZE;
+}
+
+/*
+ * Find the buffer caching BLOCK, or NULL if there isn't one.
+ */
+static
+struct sfs_buf *
+sfs_cache_find(struct sfs_bufcache *cache, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	for (b = cache->c_hash[sfs_cache_hash(block)];
+	     b != NULL;
+	     b = b->b_hashnext) {
+		KASSERT(b->b_valid);
+		if (b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Detach a valid buffer from the hash table.
+ */
+static
+void
+sfs_cache_unhash(struct sfs_bufcache *cache, struct sfs_buf *b)
+{
+	struct sfs_buf **p;
+
+	KASSERT(b->b_valid);
+	for (p = &cache->c_hash[sfs_cache_hash(b->b_block)];
+	     *p != NULL;
+	     p = &(*p)->b_hashnext) {
+		if (*p == b) {
+			*p = b->b_hashnext;
+			b->b_hashnext = NULL;
+			return;
+		}
+	}
+	panic("sfs: buffer for block %u not in hash table\n", b->b_block);
+}
+
+/*
+ * Choose a buffer to (re)use for a new block: prefer a never-used or
+ * invalidated buffer; otherwise take the least recently released one
+ * that's not in active use, writing it back first if it's dirty.
+ */
+static
+int
+sfs_cache_getbuf(struct sfs_fs *sfs, struct sfs_buf **ret)
+{
+	struct sfs_bufcache *cache = sfs->sfs_cache;
+	struct sfs_buf *b, *victim;
+	unsigned i;
+	int result;
+
+	victim = NULL;
+	for (i=0; i<SFS_CACHE_NBUFS; i++) {
+		b = &cache->c_bufs[i];
+		if (!b->b_valid) {
+			*ret = b;
+			return 0;
+		}
+		if (b->b_refcount > 0) {
+			continue;
+		}
+		if (b->b_block >= sfs->sfs_sb.sb_nblocks) {
+			/*
+			 * Delayed-allocation block with no disk home
+			 * yet; it can't be written out, so it's pinned
+			 * until sfs_dalloc_bind renumbers it.
+			 */
+			continue;
+		}
+		if (victim == NULL || b->b_stamp < victim->b_stamp) {
+			victim = b;
+		}
+	}
+	if (victim == NULL) {
+		/* All buffers busy; should not happen with sane callers. */
+		panic("sfs: %s: buffer cache exhausted\n",
+		      sfs->sfs_sb.sb_volname);
+	}
+	if (victim->b_dirty) {
+		/*
+		 * Flush through the journal rather than writing the
+		 * victim directly, so no metadata write ever reaches
+		 * its home location without being journaled first.
+		 */
+		result = sfs_jnl_sync(sfs);
+		if (result) {
+			return result;
+		}
+		KASSERT(!victim->b_dirty);
+	}
+	sfs_cache_unhash(cache, victim);
+	victim->b_valid = false;
+	*ret = victim;
+	return 0;
+}
+
+/*
+ * Install a freshly filled buffer in the hash table and hand back a
+ * reference to it.
+ */
+static
+void
+sfs_cache_install(struct sfs_bufcache *cache, struct sfs_buf *b,
+		  daddr_t block, struct sfs_buf **ret)
+{
+	unsigned hash;
+
+	KASSERT(!b->b_valid);
+
+	b->b_block = block;
+	b->b_refcount = 1;
+	b->b_valid = true;
+	b->b_owner = SFS_NOINO;
+
+	hash = sfs_cache_hash(block);
+	b->b_hashnext = cache->c_hash[hash];
+	cache->c_hash[hash] = b;
+
+	*ret = b;
+}
+
+/*
+ * Get a buffer for BLOCK, reading the block in from disk if it's not
+ * already cached. The buffer comes back with a reference held; the
+ * caller must release it with sfs_brelease.
+ */
+int
+sfs_bget(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret)
+{
+	struct sfs_bufcache *cache = sfs->sfs_cache;
+	struct sfs_buf *b;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	b = sfs_cache_find(cache, block);
+	if (b != NULL) {
+		b->b_refcount++;
+		*ret = b;
+		return 0;
+	}
+
+	result = sfs_cache_getbuf(sfs, &b);
+	if (result) {
+		return result;
+	}
+
+	result = sfs_readblock(sfs, block, b->b_data, SFS_BLOCKSIZE);
+	if (result) {
+		return result;
+	}
+
+	sfs_cache_install(cache, b, block, ret);
+	return 0;
+}
+
+/*
+ * Hit-only lookup: return a referenced buffer for BLOCK if one is
+ * already cached, or NULL without doing any I/O. Used by the
+ * whole-block I/O path, which otherwise bypasses the cache.
+ */
+struct sfs_buf *
+sfs_cache_lookup(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	b = sfs_cache_find(sfs->sfs_cache, block);
+	if (b != NULL) {
+		b->b_refcount++;
+	}
+	return b;
+}
+
+/*
+ * Like sfs_bget, but for blocks whose on-disk contents are known to
+ * be dead (e.g. just allocated): zero the buffer instead of reading
+ * it, and mark it dirty so the zeros eventually reach the disk.
+ */
+int
+sfs_bgetzero(struct sfs_fs *sfs, daddr_t block, uint32_t ino,
+	     struct sfs_buf **ret)
+{
+	struct sfs_bufcache *cache = sfs->sfs_cache;
+	struct sfs_buf *b;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	b = sfs_cache_find(cache, block);
+	if (b == NULL) {
+		result = sfs_cache_getbuf(sfs, &b);
+		if (result) {
+			return result;
+		}
+		sfs_cache_install(cache, b, block, &b);
+	}
+	else {
+		b->b_refcount++;
+	}
+
+	bzero(b->b_data, sizeof(b->b_data));
+	b->b_dirty = true;
+	b->b_owner = ino;
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get the data area of a buffer.
+ */
+void *
+sfs_bdata(struct sfs_buf *b)
+{
+	KASSERT(b->b_valid);
+	return b->b_data;
+}
+
+/*
+ * Mark a buffer dirty after modifying its data, recording which
+ * file's sync needs to flush it: INO is the owning file's inode
+ * number, or SFS_NOINO for volume metadata. Blocks belong to one
+ * file at a time, so a plain assignment suffices.
+ */
+void
+sfs_bmarkdirty(struct sfs_buf *b, uint32_t ino)
+{
+	KASSERT(b->b_valid);
+	KASSERT(b->b_refcount > 0);
+	b->b_dirty = true;
+	b->b_owner = ino;
+}
+
+/*
+ * Get the block number of a buffer. For the journal code, which
+ * needs the home address of each dirty image.
+ */
+daddr_t
+sfs_bblock(struct sfs_buf *b)
+{
+	KASSERT(b->b_valid);
+	return b->b_block;
+}
+
+/*
+ * Mark a buffer clean again. For the journal code, after it has
+ * written the image to its home location itself.
+ */
+void
+sfs_bmarkclean(struct sfs_buf *b)
+{
+	KASSERT(b->b_valid);
+	b->b_dirty = false;
+}
+
+/*
+ * Collect up to MAX dirty buffers for the journal code, restricted to
+ * those owned by inode INO (SFS_INO_ANY matches everything). Buffers
+ * that are in active use are included; their current images are what
+ * a direct writeback would have produced anyway.
+ */
+unsigned
+sfs_cache_getdirty(struct sfs_fs *sfs, uint32_t ino,
+		   struct sfs_buf **list, unsigned max)
+{
+	struct sfs_bufcache *cache = sfs->sfs_cache;
+	struct sfs_buf *b;
+	unsigned i, n;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	n = 0;
+	for (i=0; i<SFS_CACHE_NBUFS && n<max; i++) {
+		b = &cache->c_bufs[i];
+		if (!b->b_valid || !b->b_dirty) {
+			continue;
+		}
+		if (b->b_block >= sfs->sfs_sb.sb_nblocks) {
+			/*
+			 * Unbound delayed-allocation block; there's no
+			 * disk address to write it to. The flush binds
+			 * pending ranges before gathering, so this is
+			 * only seen by a flush running underneath a
+			 * bind.
+			 */
+			continue;
+		}
+		if (ino != SFS_INO_ANY && b->b_owner != ino) {
+			continue;
+		}
+		list[n++] = b;
+	}
+	return n;
+}
+
+/*
+ * Release a reference to a buffer. The data stays cached (and any
+ * dirty contents stay in memory) until the buffer gets evicted or
+ * synced.
+ */
+void
+sfs_brelease(struct sfs_fs *sfs, struct sfs_buf *b)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(b->b_valid);
+	KASSERT(b->b_refcount > 0);
+
+	b->b_refcount--;
+	b->b_stamp = ++sfs->sfs_cache->c_nextstamp;
+}
+
+/*
+ * Throw away any cached copy of BLOCK, dirty or not. Called when the
+ * block is freed, so writing it back would be wasted work.
+ */
+void
+sfs_cache_discard(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_bufcache *cache = sfs->sfs_cache;
+	struct sfs_buf *b;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	b = sfs_cache_find(cache, block);
+	if (b == NULL) {
+		return;
+	}
+	KASSERT(b->b_refcount == 0);
+	sfs_cache_unhash(cache, b);
+	b->b_valid = false;
+	b->b_dirty = false;
+}
+
+/*
+ * Drop the cached copy of BLOCK if it's clean and unreferenced, else
+ * do nothing. Used for FADV_NOREUSE drop-behind, where losing the
+ * block is only a missed optimization, never a correctness issue.
+ */
+void
+sfs_cache_dropclean(struct sfs_fs *sfs, daddr_t block)
+{
+	struct sfs_bufcache *cache = sfs->sfs_cache;
+	struct sfs_buf *b;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	b = sfs_cache_find(cache, block);
+	if (b == NULL || b->b_refcount > 0 || b->b_dirty) {
+		return;
+	}
+	sfs_cache_unhash(cache, b);
+	b->b_valid = false;
+}
+
+/*
+ * Move the buffer caching OLDBLOCK to NEWBLOCK. Used when a delayed
+ * allocation binds: the data was cached under a placeholder address
+ * and now has a real disk home. The buffer must exist (reserving the
+ * block created it, and unbound buffers are never evicted) and stays
+ * dirty; nothing may be cached at NEWBLOCK, since it was a free block
+ * until just now.
+ */
+void
+sfs_cache_renumber(struct sfs_fs *sfs, daddr_t oldblock, daddr_t newblock)
+{
+	struct sfs_bufcache *cache = sfs->sfs_cache;
+	struct sfs_buf *b;
+	unsigned hash;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	b = sfs_cache_find(cache, oldblock);
+	if (b == NULL) {
+		panic("sfs: %s: no buffer for delayed block %u\n",
+		      sfs->sfs_sb.sb_volname, oldblock);
+	}
+	KASSERT(b->b_dirty);
+	KASSERT(sfs_cache_find(cache, newblock) == NULL);
+
+	sfs_cache_unhash(cache, b);
+	b->b_block = newblock;
+	hash = sfs_cache_hash(newblock);
+	b->b_hashnext = cache->c_hash[hash];
+	cache->c_hash[hash] = b;
+}
+
+/*
+ * Constructor. Called from sfs_fs_create; the cache starts out with
+ * all buffers invalid.
+ */
+struct sfs_bufcache *
+sfs_cache_create(void)
+{
+	struct sfs_bufcache *cache;
+
+	cache = kmalloc(sizeof(struct sfs_bufcache));
+	if (cache == NULL) {
+		return NULL;
+	}
+	bzero(cache, sizeof(*cache));
+	return cache;
+}
+
+/*
+ * Destructor. All dirty data should have been synced by now.
+ */
+void
+sfs_cache_destroy(struct sfs_bufcache *cache)
+{
+	unsigned i;
+
+	for (i=0; i<SFS_CACHE_NBUFS; i++) {
+		KASSERT(cache->c_bufs[i].b_refcount == 0);
+		KASSERT(!cache->c_bufs[i].b_dirty);
+	}
+	kfree(cache);
+}
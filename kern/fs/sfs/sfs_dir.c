@@ -42,17 +42,48 @@
 /*
  * Read the directory entry out of slot SLOT of a directory vnode.
  * The "slot" is the index of the directory entry, starting at 0.
+ *
+ * Reads go through a one-block cache hanging off the vnode: the block
+ * containing the slot is fetched with a single sfs_metaio and
+ * subsequent slots in the same block are served from memory. This
+ * makes iteration and linear search cost one metadata read per
+ * directory block rather than per entry. If the cache buffer can't be
+ * allocated, fall back to reading the one entry directly.
  */
 static
 int
 sfs_readdir(struct sfs_vnode *sv, int slot, struct sfs_direntry *sd)
 {
 	off_t actualpos;
+	uint32_t vnblock, blockoffset;
+	int result;
 
 	/* Compute the actual position in the directory to read. */
 	actualpos = slot * sizeof(struct sfs_direntry);
 
-	return sfs_metaio(sv, actualpos, sd, sizeof(*sd), UIO_READ);
+	vnblock = actualpos / SFS_BLOCKSIZE;
+	blockoffset = actualpos % SFS_BLOCKSIZE;
+
+	if (sv->sv_dirbuf == NULL) {
+		sv->sv_dirbuf = kmalloc(SFS_BLOCKSIZE);
+		if (sv->sv_dirbuf == NULL) {
+			return sfs_metaio(sv, actualpos, sd, sizeof(*sd),
+					  UIO_READ);
+		}
+	}
+
+	if (!sv->sv_dirvalid || sv->sv_dirvnblock != vnblock) {
+		result = sfs_metaio(sv, (off_t)vnblock * SFS_BLOCKSIZE,
+				    sv->sv_dirbuf, SFS_BLOCKSIZE, UIO_READ);
+		if (result) {
+			return result;
+		}
+		sv->sv_dirvnblock = vnblock;
+		sv->sv_dirvalid = true;
+	}
+
+	memcpy(sd, sv->sv_dirbuf + blockoffset, sizeof(*sd));
+	return 0;
 }
 
 /*
@@ -69,6 +100,9 @@ sfs_writedir(struct sfs_vnode *sv, int slot, struct sfs_direntry *sd)
 	KASSERT(slot>=0);
 	actualpos = slot * sizeof(struct sfs_direntry);
 
+	/* The cached block image (if any) is now stale. */
+	sv->sv_dirvalid = false;
+
 	return sfs_metaio(sv, actualpos, sd, sizeof(*sd), UIO_WRITE);
 }
 
@@ -95,10 +129,287 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+/*
+ * In-memory directory name index.
+ *
+ * Large directories make the linear scan in sfs_dir_findname (which
+ * runs for every path component looked up, every creat collision
+ * check, and every remove) painfully slow. So each directory vnode
+ * can carry a hash table mapping names to slots, plus a list of the
+ * free slots, built by scanning the directory once on first use and
+ * kept in step by sfs_dir_link and sfs_dir_unlink afterwards.
+ *
+ * The index is advisory: if it can't be allocated, or falls out of
+ * step because a bookkeeping allocation fails, it's thrown away and
+ * searches fall back to the linear scan until it's rebuilt. Changing
+ * the on-disk format to hold the index was considered and rejected;
+ * nothing else in this SFS versions the disk layout, and existing
+ * volumes should keep working.
+ *
+ * Like everything else at this level, protected by vfs_biglock.
+ */
+
+/* Number of hash buckets; busy directories just chain deeper. */
+#define SFS_DIRHASH_BUCKETS	64
+
+struct sfs_dirhash_entry {
+	struct sfs_dirhash_entry *sde_next;	/* bucket chain */
+	uint32_t sde_ino;			/* inode number */
+	int sde_slot;				/* slot in the directory */
+	char sde_name[SFS_NAMELEN];		/* the name */
+};
+
+struct sfs_dirhash_freeslot {
+	struct sfs_dirhash_freeslot *sdf_next;
+	int sdf_slot;				/* an empty slot */
+};
+
+struct sfs_dirhash {
+	struct sfs_dirhash_entry *dh_buckets[SFS_DIRHASH_BUCKETS];
+	struct sfs_dirhash_freeslot *dh_freeslots;
+};
+
+/*
+ * Hash a name into a bucket number.
+ */
+static
+unsigned
+sfs_dirhash_hash(const char *name)
+{
+	unsigned val = 5381;
+
+	while (*name) {
+		val = val*33 + (unsigned char)*name;
+		name++;
+	}
+	return val % SFS_DIRHASH_BUCKETS;
+}
+
+/*
+ * Throw away a directory's name index, if it has one. Searches fall
+ * back to the linear scan until the index gets rebuilt.
+ */
+void
+sfs_dirhash_destroy(struct sfs_vnode *sv)
+{
+	struct sfs_dirhash *dh = sv->sv_dirhash;
+	struct sfs_dirhash_entry *sde;
+	struct sfs_dirhash_freeslot *sdf;
+	unsigned i;
+
+	if (dh == NULL) {
+		return;
+	}
+
+	for (i=0; i<SFS_DIRHASH_BUCKETS; i++) {
+		while ((sde = dh->dh_buckets[i]) != NULL) {
+			dh->dh_buckets[i] = sde->sde_next;
+			kfree(sde);
+		}
+	}
+	while ((sdf = dh->dh_freeslots) != NULL) {
+		dh->dh_freeslots = sdf->sdf_next;
+		kfree(sdf);
+	}
+	kfree(dh);
+	sv->sv_dirhash = NULL;
+}
+
+/*
+ * Find the index entry for a name, or NULL.
+ */
+static
+struct sfs_dirhash_entry *
+sfs_dirhash_find(struct sfs_dirhash *dh, const char *name)
+{
+	struct sfs_dirhash_entry *sde;
+
+	sde = dh->dh_buckets[sfs_dirhash_hash(name)];
+	while (sde != NULL) {
+		if (!strcmp(sde->sde_name, name)) {
+			return sde;
+		}
+		sde = sde->sde_next;
+	}
+	return NULL;
+}
+
+/*
+ * Add a name to the index. Returns ENOMEM if the entry can't be
+ * allocated; the caller is expected to discard the index then.
+ */
+static
+int
+sfs_dirhash_insert(struct sfs_dirhash *dh, const char *name,
+		   uint32_t ino, int slot)
+{
+	struct sfs_dirhash_entry *sde;
+	unsigned bucket;
+
+	sde = kmalloc(sizeof(*sde));
+	if (sde == NULL) {
+		return ENOMEM;
+	}
+	sde->sde_ino = ino;
+	sde->sde_slot = slot;
+	strcpy(sde->sde_name, name);
+
+	bucket = sfs_dirhash_hash(name);
+	sde->sde_next = dh->dh_buckets[bucket];
+	dh->dh_buckets[bucket] = sde;
+	return 0;
+}
+
+/*
+ * Record a free slot in the index. Same ENOMEM contract as
+ * sfs_dirhash_insert.
+ */
+static
+int
+sfs_dirhash_addfree(struct sfs_dirhash *dh, int slot)
+{
+	struct sfs_dirhash_freeslot *sdf;
+
+	sdf = kmalloc(sizeof(*sdf));
+	if (sdf == NULL) {
+		return ENOMEM;
+	}
+	sdf->sdf_slot = slot;
+	sdf->sdf_next = dh->dh_freeslots;
+	dh->dh_freeslots = sdf;
+	return 0;
+}
+
+/*
+ * Build the index for a directory by scanning it once. Best effort:
+ * on any failure the partial index is thrown away and we leave
+ * sv_dirhash NULL, which makes the callers use the linear scan.
+ */
+static
+void
+sfs_dirhash_build(struct sfs_vnode *sv)
+{
+	struct sfs_dirhash *dh;
+	struct sfs_direntry tsd;
+	int nentries, i, result;
+
+	KASSERT(sv->sv_dirhash == NULL);
+
+	dh = kmalloc(sizeof(*dh));
+	if (dh == NULL) {
+		return;
+	}
+	for (i=0; i<SFS_DIRHASH_BUCKETS; i++) {
+		dh->dh_buckets[i] = NULL;
+	}
+	dh->dh_freeslots = NULL;
+	sv->sv_dirhash = dh;
+
+	nentries = sfs_dir_nentries(sv);
+	for (i=0; i<nentries; i++) {
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			sfs_dirhash_destroy(sv);
+			return;
+		}
+		if (tsd.sfd_ino == SFS_NOINO) {
+			result = sfs_dirhash_addfree(dh, i);
+		}
+		else {
+			/* Ensure null termination, just in case */
+			tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+
+			/* Each name may legally appear only once... */
+			KASSERT(sfs_dirhash_find(dh, tsd.sfd_name) == NULL);
+
+			result = sfs_dirhash_insert(dh, tsd.sfd_name,
+						    tsd.sfd_ino, i);
+		}
+		if (result) {
+			sfs_dirhash_destroy(sv);
+			return;
+		}
+	}
+}
+
+/*
+ * Update the index (if there is one) after a successful
+ * sfs_dir_link into SLOT.
+ */
+static
+void
+sfs_dirhash_notelink(struct sfs_vnode *sv, const char *name,
+		     uint32_t ino, int slot)
+{
+	struct sfs_dirhash *dh = sv->sv_dirhash;
+	struct sfs_dirhash_freeslot *sdf, **sdfp;
+
+	if (dh == NULL) {
+		return;
+	}
+
+	/* If the slot came off the free list, take it off. */
+	for (sdfp = &dh->dh_freeslots; (sdf = *sdfp) != NULL;
+	     sdfp = &sdf->sdf_next) {
+		if (sdf->sdf_slot == slot) {
+			*sdfp = sdf->sdf_next;
+			kfree(sdf);
+			break;
+		}
+	}
+
+	if (sfs_dirhash_insert(dh, name, ino, slot)) {
+		/* Can't record the new name; the index is now wrong. */
+		sfs_dirhash_destroy(sv);
+	}
+}
+
+/*
+ * Update the index (if there is one) after a successful
+ * sfs_dir_unlink of SLOT.
+ */
+static
+void
+sfs_dirhash_noteunlink(struct sfs_vnode *sv, int slot)
+{
+	struct sfs_dirhash *dh = sv->sv_dirhash;
+	struct sfs_dirhash_entry *sde, **sdep;
+	unsigned i;
+
+	if (dh == NULL) {
+		return;
+	}
+
+	/*
+	 * Unlink is by slot, not by name, so hunt through the buckets.
+	 * This is a memory walk, not I/O, and unlinks are much rarer
+	 * than lookups.
+	 */
+	for (i=0; i<SFS_DIRHASH_BUCKETS; i++) {
+		for (sdep = &dh->dh_buckets[i]; (sde = *sdep) != NULL;
+		     sdep = &sde->sde_next) {
+			if (sde->sde_slot == slot) {
+				*sdep = sde->sde_next;
+				kfree(sde);
+				goto found;
+			}
+		}
+	}
+ found:
+	if (sfs_dirhash_addfree(dh, slot)) {
+		/* Can't record the free slot; the index is now wrong. */
+		sfs_dirhash_destroy(sv);
+	}
+}
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
  * empty directory slot if one is found.
+ *
+ * Served from the name index when possible, so the expected cost is
+ * O(1) rather than a read of every slot; the scan below is the
+ * fallback for when the index can't be built.
  */
 int
 sfs_dir_findname(struct sfs_vnode *sv, const char *name,
@@ -107,6 +418,29 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	struct sfs_direntry tsd;
 	int found, nentries, i, result;
 
+	if (sv->sv_dirhash == NULL) {
+		sfs_dirhash_build(sv);
+	}
+	if (sv->sv_dirhash != NULL) {
+		struct sfs_dirhash *dh = sv->sv_dirhash;
+		struct sfs_dirhash_entry *sde;
+
+		if (emptyslot != NULL && dh->dh_freeslots != NULL) {
+			*emptyslot = dh->dh_freeslots->sdf_slot;
+		}
+		sde = sfs_dirhash_find(dh, name);
+		if (sde == NULL) {
+			return ENOENT;
+		}
+		if (slot != NULL) {
+			*slot = sde->sde_slot;
+		}
+		if (ino != NULL) {
+			*ino = sde->sde_ino;
+		}
+		return 0;
+	}
+
 	nentries = sfs_dir_nentries(sv);
 
 	/* For each slot... */
@@ -186,7 +520,77 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
-	return sfs_writedir(sv, emptyslot, &sd);
+	result = sfs_writedir(sv, emptyslot, &sd);
+	if (result == 0) {
+		sfs_dirhash_notelink(sv, name, ino, emptyslot);
+	}
+	return result;
+}
+
+/*
+ * Find the name of an inode in a directory, for constructing pathnames
+ * (VOP_NAMEFILE). A plain scan; this runs for getcwd, not for lookups,
+ * and the name index is keyed the other way around.
+ */
+int
+sfs_dir_findino(struct sfs_vnode *sv, uint32_t ino, char *namebuf)
+{
+	struct sfs_direntry tsd;
+	int nentries, i, result;
+
+	nentries = sfs_dir_nentries(sv);
+
+	for (i=0; i<nentries; i++) {
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			return result;
+		}
+		if (tsd.sfd_ino != ino) {
+			continue;
+		}
+		/* Ensure null termination, just in case */
+		tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+		if (!strcmp(tsd.sfd_name, ".") || !strcmp(tsd.sfd_name, "..")) {
+			/* A directory's own entries for itself don't count. */
+			continue;
+		}
+		strcpy(namebuf, tsd.sfd_name);
+		return 0;
+	}
+
+	return ENOENT;
+}
+
+/*
+ * Check whether a directory is empty, i.e. contains nothing besides
+ * its "." and ".." entries. Used by rmdir.
+ */
+int
+sfs_dir_checkempty(struct sfs_vnode *sv)
+{
+	struct sfs_direntry tsd;
+	int nentries, i, result;
+
+	nentries = sfs_dir_nentries(sv);
+
+	for (i=0; i<nentries; i++) {
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			return result;
+		}
+		if (tsd.sfd_ino == SFS_NOINO) {
+			/* Free slot; skip it. */
+			continue;
+		}
+		/* Ensure null termination, just in case */
+		tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+		if (!strcmp(tsd.sfd_name, ".") || !strcmp(tsd.sfd_name, "..")) {
+			continue;
+		}
+		return ENOTEMPTY;
+	}
+
+	return 0;
 }
 
 /*
@@ -196,13 +600,60 @@ int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_direntry sd;
+	int result;
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, slot, &sd);
+	result = sfs_writedir(sv, slot, &sd);
+	if (result == 0) {
+		sfs_dirhash_noteunlink(sv, slot);
+	}
+	return result;
+}
+
+/*
+ * Read one directory name, for VOP_GETDIRENTRY: the name in the first
+ * non-empty slot at or after the cursor in UIO's offset field, which
+ * counts slots, not bytes. Leaves the cursor on the slot after the
+ * one returned. Reaching the end of the directory transfers nothing.
+ *
+ * Thanks to the block cache in sfs_readdir, iterating a whole
+ * directory this way costs one metadata read per directory block.
+ */
+int
+sfs_dir_getdirentry(struct sfs_vnode *sv, struct uio *uio)
+{
+	struct sfs_direntry tsd;
+	int nentries, slot, result;
+
+	nentries = sfs_dir_nentries(sv);
+	slot = uio->uio_offset;
+
+	while (slot < nentries) {
+		result = sfs_readdir(sv, slot, &tsd);
+		if (result) {
+			return result;
+		}
+		slot++;
+		if (tsd.sfd_ino == SFS_NOINO) {
+			/* Free slot; skip it. */
+			continue;
+		}
+		/* Ensure null termination, just in case */
+		tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+		result = uiomove(tsd.sfd_name, strlen(tsd.sfd_name), uio);
+		if (result) {
+			return result;
+		}
+		break;
+	}
+
+	/* The offset field is a slot cursor, not a byte count. */
+	uio->uio_offset = slot;
+	return 0;
 }
 
 /*
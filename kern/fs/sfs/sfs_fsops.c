@@ -40,6 +40,9 @@
 #include <bitmap.h>
 #include <uio.h>
 #include <vfs.h>
+#include <iopri.h>
+#include <thread.h>
+#include <current.h>
 #include <device.h>
 #include <sfs.h>
 #include "sfsprivate.h"
@@ -51,117 +54,13 @@
 #define SFS_FS_FREEMAPBLOCKS(sfs)  SFS_FREEMAPBLOCKS(SFS_FS_NBLOCKS(sfs))
 
 /*
- * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
- *
- * The free block bitmap consists of SFS_FREEMAPBLOCKS 512-byte
- * sectors of bits, one bit for each sector on the filesystem. The
- * number of blocks in the bitmap is thus rounded up to the nearest
- * multiple of 512*8 = 4096. (This rounded number is SFS_FREEMAPBITS.)
- * This means that the bitmap will (in general) contain space for some
- * number of invalid sectors that are actually beyond the end of the
- * disk device. This is ok. These sectors are supposed to be marked
- * "in use" by mksfs and never get marked "free".
- *
- * The sectors used by the superblock and the bitmap itself are
- * likewise marked in use by mksfs.
- */
-static
-int
-sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
-{
-	uint32_t j, freemapblocks;
-	char *freemapdata;
-	int result;
-
-	/* Number of blocks in the free block bitmap. */
-	freemapblocks = SFS_FS_FREEMAPBLOCKS(sfs);
-
-	/* Pointer to our freemap data in memory. */
-	freemapdata = bitmap_getdata(sfs->sfs_freemap);
-
-	/* For each block in the free block bitmap... */
-	for (j=0; j<freemapblocks; j++) {
-
-		/* Get a pointer to its data */
-		void *ptr = freemapdata + j*SFS_BLOCKSIZE;
-
-		/* and read or write it. The freemap starts at sector 2. */
-		if (rw == UIO_READ) {
-			result = sfs_readblock(sfs, SFS_FREEMAP_START+j, ptr,
-					       SFS_BLOCKSIZE);
-		}
-		else {
-			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, ptr,
-						SFS_BLOCKSIZE);
-		}
-
-		/* If we failed, stop. */
-		if (result) {
-			return result;
-		}
-	}
-	return 0;
-}
-
-/*
- * Sync routine for the vnode table.
+ * The freemap is no longer read in at mount time; its blocks are read
+ * on first use by the allocation paths in sfs_balloc.c, guided by the
+ * persisted free-space summary. Writes go out through the metadata
+ * journal (sfs_jnl_sync), which consults the per-block dirty flags in
+ * sfs_freemapdirtymap and only pushes the freemap blocks whose bits
+ * actually changed.
  */
-static
-int
-sfs_sync_vnodes(struct sfs_fs *sfs)
-{
-	unsigned i, num;
-
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
-	}
-	return 0;
-}
-
-/*
- * Sync routine for the freemap.
- */
-static
-int
-sfs_sync_freemap(struct sfs_fs *sfs)
-{
-	int result;
-
-	if (sfs->sfs_freemapdirty) {
-		result = sfs_freemapio(sfs, UIO_WRITE);
-		if (result) {
-			return result;
-		}
-		sfs->sfs_freemapdirty = false;
-	}
-
-	return 0;
-}
-
-/*
- * Sync routine for the superblock.
- */
-static
-int
-sfs_sync_superblock(struct sfs_fs *sfs)
-{
-	int result;
-
-	if (sfs->sfs_superdirty) {
-		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
-					sizeof(sfs->sfs_sb));
-		if (result) {
-			return result;
-		}
-		sfs->sfs_superdirty = false;
-	}
-	return 0;
-}
 
 /*
  * Sync routine. This is what gets invoked if you do FS_SYNC on the
@@ -172,8 +71,19 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs;
+	unsigned oldpri;
 	int result;
 
+	/*
+	 * A sync flush can queue hundreds of writes; run them as
+	 * background writeback so they don't delay page-ins and other
+	 * synchronous I/O at the disk.
+	 */
+	oldpri = curthread->t_iopri;
+	if (oldpri < IOPRI_ASYNC) {
+		curthread->t_iopri = IOPRI_ASYNC;
+	}
+
 	vfs_biglock_acquire();
 
 	/*
@@ -208,28 +118,32 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* If any vnodes need to be written, write them. */
-	result = sfs_sync_vnodes(sfs);
-	if (result) {
-		vfs_biglock_release();
-		return result;
-	}
-
-	/* If the free block map needs to be written, write it. */
-	result = sfs_sync_freemap(sfs);
+	/*
+	 * Capture any dirty inodes into the buffer cache, so the
+	 * journal sync below writes them out with everything else.
+	 * (This used to fsync every loaded vnode, which pushed a
+	 * separate journal batch per file.)
+	 */
+	result = sfs_ino_syncall(sfs);
 	if (result) {
 		vfs_biglock_release();
+		curthread->t_iopri = oldpri;
 		return result;
 	}
 
-	/* If the superblock needs to be written, write it. */
-	result = sfs_sync_superblock(sfs);
+	/*
+	 * Push all dirty metadata - buffer cache blocks, freemap
+	 * blocks, and the superblock - out through the journal.
+	 */
+	result = sfs_jnl_sync(sfs);
 	if (result) {
 		vfs_biglock_release();
+		curthread->t_iopri = oldpri;
 		return result;
 	}
 
 	vfs_biglock_release();
+	curthread->t_iopri = oldpri;
 	return 0;
 }
 
@@ -262,6 +176,17 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
+	if (sfs->sfs_freemapdirtymap != NULL) {
+		kfree(sfs->sfs_freemapdirtymap);
+	}
+	if (sfs->sfs_freemaploaded != NULL) {
+		kfree(sfs->sfs_freemaploaded);
+	}
+	if (sfs->sfs_regionfree != NULL) {
+		kfree(sfs->sfs_regionfree);
+	}
+	sfs_cache_destroy(sfs->sfs_cache);
+	hashtable_destroy(sfs->sfs_vnhash);
 	vnodearray_destroy(sfs->sfs_vnodes);
 	KASSERT(sfs->sfs_device == NULL);
 	kfree(sfs);
@@ -289,10 +214,18 @@ sfs_unmount(struct fs *fs)
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
+	KASSERT(sfs->sfs_dirtyinodes == NULL);
+	KASSERT(sfs->sfs_ndelayed == 0);
 
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
+	/* Drop any queued prefetches that still point at this volume */
+	sfs_readahead_purge(sfs);
+
+	/* And take it out of the periodic writeback queue */
+	sfs_writeback_purge(sfs);
+
 	/* Destroy the fs object; once we start nuking stuff we can't fail. */
 	sfs_fs_destroy(sfs);
 
@@ -355,13 +288,45 @@ sfs_fs_create(void)
 	if (sfs->sfs_vnodes == NULL) {
 		goto cleanup_object;
 	}
+	sfs->sfs_vnhash = hashtable_create(SFS_VNHASH_SIZE);
+	if (sfs->sfs_vnhash == NULL) {
+		goto cleanup_vnodes;
+	}
 
 	/* freemap */
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
+	sfs->sfs_freemapdirtymap = NULL;
+	sfs->sfs_freemaploaded = NULL;
+	sfs->sfs_regionfree = NULL;
+	sfs->sfs_regionvalid = false;
+	sfs->sfs_summaryclean = false;
+	sfs->sfs_nfreeblocks = 0;
+
+	/* delayed allocation */
+	sfs->sfs_ndelayed = 0;
+	sfs->sfs_dlbinding = false;
+
+	/* journal */
+	sfs->sfs_jnlsequence = 0;
+
+	/* dirty-inode tracking */
+	sfs->sfs_dirtyinodes = NULL;
+	sfs->sfs_wbnext = NULL;
+	sfs->sfs_wbqueued = false;
+
+	/* buffer cache */
+	sfs->sfs_cache = sfs_cache_create();
+	if (sfs->sfs_cache == NULL) {
+		goto cleanup_vnhash;
+	}
 
 	return sfs;
 
+cleanup_vnhash:
+	hashtable_destroy(sfs->sfs_vnhash);
+cleanup_vnodes:
+	vnodearray_destroy(sfs->sfs_vnodes);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -448,7 +413,10 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
 
-	/* Load free block bitmap */
+	/*
+	 * Set up the free block bitmap. Nothing is read into it here;
+	 * its blocks are loaded on first use.
+	 */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
 	if (sfs->sfs_freemap == NULL) {
 		sfs->sfs_device = NULL;
@@ -456,7 +424,57 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		vfs_biglock_release();
 		return ENOMEM;
 	}
-	result = sfs_freemapio(sfs, UIO_READ);
+
+	/* Per-freemap-block dirty flags; all clean to start with. */
+	sfs->sfs_freemapdirtymap = kmalloc(SFS_FS_FREEMAPBLOCKS(sfs));
+	if (sfs->sfs_freemapdirtymap == NULL) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return ENOMEM;
+	}
+	bzero(sfs->sfs_freemapdirtymap, SFS_FS_FREEMAPBLOCKS(sfs));
+
+	/* Per-freemap-block loaded flags; all unloaded to start with. */
+	sfs->sfs_freemaploaded = kmalloc(SFS_FS_FREEMAPBLOCKS(sfs));
+	if (sfs->sfs_freemaploaded == NULL) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return ENOMEM;
+	}
+	bzero(sfs->sfs_freemaploaded, SFS_FS_FREEMAPBLOCKS(sfs));
+
+	/* Per-freemap-block free counts. */
+	sfs->sfs_regionfree = kmalloc(SFS_FS_FREEMAPBLOCKS(sfs) *
+				      sizeof(uint16_t));
+	if (sfs->sfs_regionfree == NULL) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return ENOMEM;
+	}
+	bzero(sfs->sfs_regionfree,
+	      SFS_FS_FREEMAPBLOCKS(sfs) * sizeof(uint16_t));
+
+	/*
+	 * Replay any committed journal batch left by a crash, or set
+	 * up a journal if the volume doesn't have one yet.
+	 */
+	result = sfs_jnl_bootstrap(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
+	/*
+	 * Adopt the free-space summary, or on a volume without a
+	 * clean one, read and count the freemap and carve a summary
+	 * region for next time.
+	 */
+	result = sfs_balloc_bootstrap(sfs);
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
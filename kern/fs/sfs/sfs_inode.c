@@ -35,11 +35,48 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <iopri.h>
+#include <workqueue.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 
+/*
+ * Match callback for the loaded-vnode table. Inode numbers are block
+ * numbers, already well spread, so they serve as their own hash; the
+ * comparison here is just the collision check.
+ */
+static
+bool
+sfs_vnhash_match(const struct hashlink *hl, const void *key)
+{
+	const struct sfs_vnode *sv = hl->hl_self;
+
+	return sv->sv_ino == *(const uint32_t *)key;
+}
+
+/*
+ * Find the loaded vnode for INO, or NULL. Replaces what used to be a
+ * linear scan of the vnode array on every open.
+ */
+static
+struct sfs_vnode *
+sfs_vnhash_find(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct hashlink *hl;
+
+	hl = hashtable_find(sfs->sfs_vnhash, ino, sfs_vnhash_match, &ino);
+	if (hl == NULL) {
+		return NULL;
+	}
+	return hl->hl_self;
+}
+
 /*
  * Write an on-disk inode structure back out to disk.
  */
@@ -47,19 +84,192 @@ int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
 	int result;
 
 	if (sv->sv_dirty) {
-		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
-					sizeof(sv->sv_i));
+		result = sfs_bget(sfs, sv->sv_ino, &b);
 		if (result) {
 			return result;
 		}
+		memcpy(sfs_bdata(b), &sv->sv_i, sizeof(sv->sv_i));
+		sfs_bmarkdirty(b, sv->sv_ino);
+		sfs_brelease(sfs, b);
 		sv->sv_dirty = false;
 	}
 	return 0;
 }
 
+////////////////////////////////////////////////////////////
+//
+// Dirty-inode tracking
+//
+// Inode updates - size changes, link counts, block pointers - land
+// only in the in-memory copy (sv_i), and each volume keeps a list of
+// the vnodes whose copy is dirty. The list is drained by
+// sfs_ino_syncall, which copies each dirty inode into its buffer
+// cache block, so however many times an inode was updated in the
+// interval, its block is written once, in the same journal batch as
+// the other dirty metadata. The drain happens on fsync and the global
+// sync as before, and also periodically: the first inode dirtied on a
+// volume schedules a delayed flush of the volume on the shared
+// workqueue, so a write-heavy process no longer rewrites its inode
+// block hundreds of times a second, but its metadata also can't sit
+// in memory indefinitely.
+//
+// Everything here runs under vfs_biglock, including the workqueue
+// handler, which is what makes the raw sfs pointers in the writeback
+// queue safe: sfs_writeback_purge unlinks a volume before unmount
+// frees it.
+
+/* How long dirty inodes may sit in memory before they're flushed. */
+#define SFS_WRITEBACK_TICKS	(5 * HZ)
+
+static struct sfs_fs *sfs_wbqueue;	/* volumes with a flush scheduled */
+static struct work sfs_wbwork;
+static bool sfs_wbworkinit;
+
+/*
+ * Workqueue handler: flush the metadata of every volume in the
+ * writeback queue, as background I/O so foreground operations don't
+ * stall behind it. Failures are only logged; the dirty inodes stay
+ * dirty and the next flush or sync retries.
+ */
+static
+void
+sfs_wbworker(struct work *wk, void *data)
+{
+	struct sfs_fs *sfs;
+	unsigned oldpri;
+	int result;
+
+	(void)wk;
+	(void)data;
+
+	oldpri = curthread->t_iopri;
+	curthread->t_iopri = IOPRI_ASYNC;
+
+	vfs_biglock_acquire();
+	while (sfs_wbqueue != NULL) {
+		sfs = sfs_wbqueue;
+		sfs_wbqueue = sfs->sfs_wbnext;
+		sfs->sfs_wbqueued = false;
+
+		result = sfs_ino_syncall(sfs);
+		if (result == 0) {
+			result = sfs_jnl_sync(sfs);
+		}
+		if (result) {
+			kprintf("sfs: %s: warning: periodic writeback "
+				"failed: %s\n", sfs->sfs_sb.sb_volname,
+				strerror(result));
+		}
+	}
+	vfs_biglock_release();
+
+	curthread->t_iopri = oldpri;
+}
+
+/*
+ * Mark SV's in-memory inode dirty, putting it on its volume's dirty
+ * list and scheduling the periodic flush if it isn't already.
+ */
+void
+sfs_ino_markdirty(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	sv->sv_dirty = true;
+	if (!sv->sv_ondirtylist) {
+		sv->sv_dirtynext = sfs->sfs_dirtyinodes;
+		sfs->sfs_dirtyinodes = sv;
+		sv->sv_ondirtylist = true;
+	}
+
+	if (!sfs_wbworkinit) {
+		work_init(&sfs_wbwork, sfs_wbworker, NULL);
+		sfs_wbworkinit = true;
+	}
+	if (!sfs->sfs_wbqueued) {
+		sfs->sfs_wbnext = sfs_wbqueue;
+		sfs_wbqueue = sfs;
+		sfs->sfs_wbqueued = true;
+		work_submit_delayed(&sfs_wbwork, SFS_WRITEBACK_TICKS);
+	}
+}
+
+/*
+ * Copy every dirty inode on SFS's list into the buffer cache, so the
+ * next journal sync writes them out. Entries already clean (synced
+ * individually by fsync or reclaim) just fall off the list. On error
+ * the remaining entries stay listed for the next attempt.
+ */
+int
+sfs_ino_syncall(struct sfs_fs *sfs)
+{
+	struct sfs_vnode *sv;
+	int result;
+
+	while ((sv = sfs->sfs_dirtyinodes) != NULL) {
+		result = sfs_sync_inode(sv);
+		if (result) {
+			return result;
+		}
+		sfs->sfs_dirtyinodes = sv->sv_dirtynext;
+		sv->sv_ondirtylist = false;
+	}
+	return 0;
+}
+
+/*
+ * Take SV off its volume's dirty list if it's there. Called from
+ * reclaim before the vnode is freed; fsync leaves clean vnodes on the
+ * list, so reclaim can find one listed even after syncing it.
+ */
+static
+void
+sfs_ino_evictdirty(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **p;
+
+	if (!sv->sv_ondirtylist) {
+		return;
+	}
+	for (p = &sfs->sfs_dirtyinodes; *p != NULL;
+	     p = &(*p)->sv_dirtynext) {
+		if (*p == sv) {
+			*p = sv->sv_dirtynext;
+			break;
+		}
+	}
+	sv->sv_ondirtylist = false;
+}
+
+/*
+ * Remove SFS from the writeback queue. Called from sfs_unmount, with
+ * the dirty-inode list already drained by the preceding sync.
+ */
+void
+sfs_writeback_purge(struct sfs_fs *sfs)
+{
+	struct sfs_fs **p;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs->sfs_wbqueued) {
+		return;
+	}
+	for (p = &sfs_wbqueue; *p != NULL; p = &(*p)->sfs_wbnext) {
+		if (*p == sfs) {
+			*p = sfs->sfs_wbnext;
+			break;
+		}
+	}
+	sfs->sfs_wbqueued = false;
+}
+
 /*
  * Called when the vnode refcount (in-memory usage count) hits zero.
  *
@@ -80,18 +290,13 @@ sfs_reclaim(struct vnode *v)
 	 * decision was made to reclaim it. (You must also synchronize
 	 * this with sfs_loadvnode.)
 	 */
-	spinlock_acquire(&v->vn_countlock);
-	if (v->vn_refcount != 1) {
-
-		/* consume the reference VOP_DECREF gave us */
-		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
-
-		spinlock_release(&v->vn_countlock);
+	if (!vnode_tryreclaim(v)) {
 		vfs_biglock_release();
 		return EBUSY;
 	}
-	spinlock_release(&v->vn_countlock);
+
+	/* Give back any reserved but unused extent blocks. */
+	sfs_extent_release(sfs, sv);
 
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
@@ -102,6 +307,19 @@ sfs_reclaim(struct vnode *v)
 		}
 	}
 
+	/*
+	 * Delayed-allocation blocks must get disk addresses before the
+	 * vnode goes away; their placeholders are derived from it.
+	 * (For an erased file the truncation above dropped them.)
+	 */
+	if (sv->sv_dlcount > 0) {
+		result = sfs_dalloc_bind(sfs, sv);
+		if (result) {
+			vfs_biglock_release();
+			return result;
+		}
+	}
+
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
@@ -130,12 +348,20 @@ sfs_reclaim(struct vnode *v)
 		      sfs->sfs_sb.sb_volname, sv->sv_ino);
 	}
 	vnodearray_remove(sfs->sfs_vnodes, ix);
+	hashtable_remove(sfs->sfs_vnhash, &sv->sv_hashlink);
+	hashlink_cleanup(&sv->sv_hashlink);
+	sfs_ino_evictdirty(sfs, sv);
 
 	vnode_cleanup(&sv->sv_absvn);
 
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
+	if (sv->sv_dirbuf != NULL) {
+		kfree(sv->sv_dirbuf);
+	}
+	sfs_dirhash_destroy(sv);
+	rwlock_destroy(sv->sv_lock);
 	kfree(sv);
 
 	/* Done */
@@ -150,19 +376,15 @@ int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
+	unsigned i;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
+	/* Look in the hash table of loaded vnodes */
+	sv = sfs_vnhash_find(sfs, ino);
+	if (sv != NULL) {
+		/* Found */
 
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
@@ -170,16 +392,12 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 			      sfs->sfs_sb.sb_volname, sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
+		/* forcetype is only allowed when creating objects */
+		KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			/* forcetype is only allowed when creating objects */
-			KASSERT(forcetype==SFS_TYPE_INVAL);
-
-			VOP_INCREF(&sv->sv_absvn);
-			*ret = sv;
-			return 0;
-		}
+		VOP_INCREF(&sv->sv_absvn);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
@@ -188,6 +406,27 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	if (sv==NULL) {
 		return ENOMEM;
 	}
+	sv->sv_lock = rwlock_create("sfs vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		return ENOMEM;
+	}
+	sv->sv_dirtynext = NULL;
+	sv->sv_ondirtylist = false;
+	sv->sv_dirbuf = NULL;
+	sv->sv_dirvalid = false;
+	sv->sv_dirhash = NULL;
+	sv->sv_extnext = 0;
+	sv->sv_extcount = 0;
+	sv->sv_alloc_hint = 0;
+	sv->sv_dlstart = 0;
+	sv->sv_dlcount = 0;
+	for (i=0; i<SFS_BMAPCACHE_SIZE; i++) {
+		sv->sv_bmapcache[i].sbe_len = 0;
+	}
+	sv->sv_bmapnext = 0;
+	sv->sv_raend = 0;
+	sv->sv_ranext = 0;
 
 	/* Must be in an allocated block */
 	if (!sfs_bused(sfs, ino)) {
@@ -195,11 +434,18 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		      "unallocated block\n", sfs->sfs_sb.sb_volname, ino);
 	}
 
-	/* Read the block the inode is in */
-	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
-	if (result) {
-		kfree(sv);
-		return result;
+	/* Read the block the inode is in, via the buffer cache */
+	{
+		struct sfs_buf *b;
+
+		result = sfs_bget(sfs, ino, &b);
+		if (result) {
+			rwlock_destroy(sv->sv_lock);
+			kfree(sv);
+			return result;
+		}
+		memcpy(&sv->sv_i, sfs_bdata(b), sizeof(sv->sv_i));
+		sfs_brelease(sfs, b);
 	}
 
 	/* Not dirty yet */
@@ -235,6 +481,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		rwlock_destroy(sv->sv_lock);
 		kfree(sv);
 		return result;
 	}
@@ -246,10 +493,24 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
 	if (result) {
 		vnode_cleanup(&sv->sv_absvn);
+		rwlock_destroy(sv->sv_lock);
 		kfree(sv);
 		return result;
 	}
 
+	/* And to the hash table */
+	hashlink_init(&sv->sv_hashlink, sv);
+	hashtable_add(sfs->sfs_vnhash, &sv->sv_hashlink, ino);
+
+	/*
+	 * If FORCETYPE dirtied the inode above, it couldn't be listed
+	 * then (the abstract vnode wasn't initialized yet); list it
+	 * now.
+	 */
+	if (sv->sv_dirty) {
+		sfs_ino_markdirty(sv);
+	}
+
 	/* Hand it back */
 	*ret = sv;
 	return 0;
@@ -269,7 +530,13 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	/*
+	 * The inode's own number isn't known until the allocation
+	 * returns, so the zeroed block starts out owned as volume
+	 * metadata; the first sfs_sync_inode re-dirties it with the
+	 * right owner.
+	 */
+	result = sfs_balloc(sfs, &ino, SFS_NOINO);
 	if (result) {
 		return result;
 	}
@@ -34,9 +34,15 @@
  */
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
 #include <lib.h>
 #include <uio.h>
+#include <workqueue.h>
+#include <vm.h>
 #include <vfs.h>
+#include <iopri.h>
+#include <thread.h>
+#include <current.h>
 #include <device.h>
 #include <sfs.h>
 #include "sfsprivate.h"
@@ -124,11 +130,234 @@ sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
 	struct iovec iov;
 	struct uio ku;
+	unsigned oldpri;
+	int result;
 
 	KASSERT(len == SFS_BLOCKSIZE);
 
+	/*
+	 * Metadata writes rank below ordinary synchronous I/O at the
+	 * disk, but only demote: a flush that's already running as
+	 * background writeback stays background.
+	 */
+	oldpri = curthread->t_iopri;
+	if (oldpri < IOPRI_META) {
+		curthread->t_iopri = IOPRI_META;
+	}
+
 	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	result = sfs_rwblock(sfs, &ku);
+
+	curthread->t_iopri = oldpri;
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Readahead
+//
+// After a read completes we may queue the next few blocks of the file
+// for prefetching. The prefetch itself runs on the shared workqueue at
+// IOPRI_ASYNC, so it never delays foreground I/O at the disk; it pulls
+// blocks into the buffer cache with sfs_bget, and since sfs_blockio and
+// sfs_partialio consult the cache on every operation, a later read of a
+// prefetched block is served from memory.
+//
+// How wide the window is (if there is one at all) is steered by the
+// caller's fadvise hint, delivered in curthread->t_ioadvice the same
+// way O_DIRECT is: FADV_SEQUENTIAL prefetches aggressively,
+// FADV_RANDOM not at all, and the default waits until reads are
+// observed to form a sequential run. FADV_NOREUSE additionally drops
+// clean cached blocks behind the read so a one-pass scan of a big file
+// doesn't evict everything else.
+//
+// The queue of pending prefetches is a single global ring shared by
+// all volumes. Everything here - enqueueing, the worker, and the
+// unmount-time purge - runs under vfs_biglock, which is what makes the
+// raw sfs pointers in the ring safe: a volume can't finish unmounting
+// until its entries have been purged.
+
+#define SFS_RAWINDOW	4	/* default window, once sequential */
+#define SFS_RASEQWINDOW	16	/* window under FADV_SEQUENTIAL */
+#define SFS_RAQUEUESIZE	32	/* pending prefetches; excess dropped */
+
+static struct {
+	struct sfs_fs *ra_sfs;
+	daddr_t ra_block;
+} sfs_raqueue[SFS_RAQUEUESIZE];
+static unsigned sfs_rahead;	/* next slot to service */
+static unsigned sfs_ranum;	/* entries in the ring */
+static struct work sfs_rawork;
+static bool sfs_raworkinit;
+
+/*
+ * Workqueue handler: pull queued blocks into the buffer cache.
+ * Failures are ignored; a prefetch that doesn't happen just means the
+ * foreground read pays for the I/O itself later.
+ */
+static
+void
+sfs_raworker(struct work *wk, void *data)
+{
+	struct sfs_fs *sfs;
+	struct sfs_buf *b;
+	daddr_t block;
+	unsigned oldpri;
+	int result;
+
+	(void)wk;
+	(void)data;
+
+	oldpri = curthread->t_iopri;
+	curthread->t_iopri = IOPRI_ASYNC;
+
+	vfs_biglock_acquire();
+	while (sfs_ranum > 0) {
+		sfs = sfs_raqueue[sfs_rahead].ra_sfs;
+		block = sfs_raqueue[sfs_rahead].ra_block;
+		sfs_rahead = (sfs_rahead + 1) % SFS_RAQUEUESIZE;
+		sfs_ranum--;
+
+		result = sfs_bget(sfs, block, &b);
+		if (result == 0) {
+			sfs_brelease(sfs, b);
+		}
+	}
+	vfs_biglock_release();
+
+	curthread->t_iopri = oldpri;
+}
+
+/*
+ * Queue one block for prefetching. If the ring is full, drop the
+ * request; it was only a hint.
+ */
+static
+void
+sfs_rasubmit(struct sfs_fs *sfs, daddr_t block)
+{
+	unsigned slot;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (!sfs_raworkinit) {
+		work_init(&sfs_rawork, sfs_raworker, NULL);
+		sfs_raworkinit = true;
+	}
+
+	if (sfs_ranum == SFS_RAQUEUESIZE) {
+		return;
+	}
+	slot = (sfs_rahead + sfs_ranum) % SFS_RAQUEUESIZE;
+	sfs_raqueue[slot].ra_sfs = sfs;
+	sfs_raqueue[slot].ra_block = block;
+	sfs_ranum++;
+
+	work_submit(&sfs_rawork);
+}
+
+/*
+ * Remove any queued prefetches for SFS. Called from sfs_unmount, with
+ * vfs_biglock held, before the fs is torn down.
+ */
+void
+sfs_readahead_purge(struct sfs_fs *sfs)
+{
+	unsigned i, slot, kept;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	kept = 0;
+	for (i = 0; i < sfs_ranum; i++) {
+		slot = (sfs_rahead + i) % SFS_RAQUEUESIZE;
+		if (sfs_raqueue[slot].ra_sfs == sfs) {
+			continue;
+		}
+		sfs_raqueue[(sfs_rahead + kept) % SFS_RAQUEUESIZE] =
+			sfs_raqueue[slot];
+		kept++;
+	}
+	sfs_ranum = kept;
+}
+
+/*
+ * Plan readahead after a read of [START, END) completed. Decides the
+ * window from the fadvise hint, does NOREUSE drop-behind, and queues
+ * any not-yet-prefetched blocks in the window.
+ */
+static
+void
+sfs_readahead(struct sfs_vnode *sv, off_t start, off_t end)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t window, endblk, limitblk;
+	daddr_t diskblock;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (end <= start) {
+		return;
+	}
+
+	switch (curthread->t_ioadvice) {
+	    case FADV_RANDOM:
+		window = 0;
+		break;
+	    case FADV_SEQUENTIAL:
+		window = SFS_RASEQWINDOW;
+		break;
+	    default:
+		/*
+		 * NORMAL and NOREUSE: only prefetch once reads are
+		 * seen to be sequential. (A first read at offset 0
+		 * doesn't qualify by itself; plenty of programs read
+		 * one header and seek away.)
+		 */
+		window = (start > 0 && start == sv->sv_raend) ?
+			SFS_RAWINDOW : 0;
+		break;
+	}
+	sv->sv_raend = end;
+
+	if (curthread->t_ioadvice == FADV_NOREUSE) {
+		uint32_t blk = start / SFS_BLOCKSIZE;
+		/* rounds down: a partially-read tail block may be reused */
+		uint32_t lastblk = end / SFS_BLOCKSIZE;
+
+		for (; blk < lastblk; blk++) {
+			result = sfs_bmap(sv, blk, false, &diskblock);
+			if (result || diskblock == 0) {
+				continue;
+			}
+			sfs_cache_dropclean(sfs, diskblock);
+		}
+	}
+
+	if (window == 0) {
+		return;
+	}
+
+	endblk = (end + SFS_BLOCKSIZE - 1) / SFS_BLOCKSIZE;
+	limitblk = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	if (sv->sv_ranext < endblk) {
+		sv->sv_ranext = endblk;
+	}
+	while (sv->sv_ranext < limitblk && sv->sv_ranext < endblk + window) {
+		result = sfs_bmap(sv, sv->sv_ranext, false, &diskblock);
+		if (result) {
+			return;
+		}
+		/*
+		 * Skip holes, and also delayed-allocation placeholders:
+		 * those have no disk home to prefetch from, and their
+		 * data is already in the cache anyway.
+		 */
+		if (diskblock != 0 && diskblock < sfs->sfs_sb.sb_nblocks) {
+			sfs_rasubmit(sfs, diskblock);
+		}
+		sv->sv_ranext++;
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -150,16 +379,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -168,8 +389,6 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	bool doalloc = (uio->uio_rw==UIO_WRITE);
 
 	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
-
-	/* We're using a global static buffer; it had better be locked */
 	KASSERT(vfs_biglock_do_i_hold());
 
 	/* Compute the block offset of this block in the file */
@@ -184,42 +403,138 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Hand the caller zeros; nothing to cache.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
+		return uiomovezeros(len, uio);
 	}
-	else {
+
+	if (curthread->t_iodirect) {
+		char *buf;
+
 		/*
-		 * Read the block.
+		 * O_DIRECT: only the EOF tail of an aligned read gets
+		 * here (sfs_io rejects unaligned requests up front).
+		 * Use a cached copy if one exists, for coherence with
+		 * pending partial-block writes, but on a miss bounce
+		 * through a transient buffer rather than populating
+		 * the cache.
 		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
+		KASSERT(uio->uio_rw == UIO_READ);
+		b = sfs_cache_lookup(sfs, diskblock);
+		if (b != NULL) {
+			result = uiomove((char *)sfs_bdata(b) + skipstart,
+					 len, uio);
+			sfs_brelease(sfs, b);
 			return result;
 		}
+		buf = kmalloc(SFS_BLOCKSIZE);
+		if (buf == NULL) {
+			return ENOMEM;
+		}
+		result = sfs_readblock(sfs, diskblock, buf, SFS_BLOCKSIZE);
+		if (result == 0) {
+			result = uiomove(buf + skipstart, len, uio);
+		}
+		kfree(buf);
+		return result;
+	}
+
+	/*
+	 * Get the block from the buffer cache. On a cache hit this
+	 * costs no I/O at all.
+	 */
+	result = sfs_bget(sfs, diskblock, &b);
+	if (result) {
+		return result;
+	}
+
+	if (uio->uio_rw == UIO_READ && uio->uio_segflg == UIO_USERSPACE) {
+		/* Copy out with vfs_biglock released; see sfs_blockio. */
+		vfs_biglock_release();
+		result = uiomove((char *)sfs_bdata(b) + skipstart, len, uio);
+		vfs_biglock_acquire();
+		sfs_brelease(sfs, b);
+		return result;
 	}
 
 	/*
 	 * Now perform the requested operation into/out of the buffer.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = uiomove((char *)sfs_bdata(b) + skipstart, len, uio);
 	if (result) {
+		sfs_brelease(sfs, b);
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * If it was a write, mark the buffer dirty; write-back happens
+	 * at sync or eviction, so back-to-back small writes to the
+	 * same block coalesce.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		sfs_bmarkdirty(b, sv->sv_ino);
 	}
 
+	sfs_brelease(sfs, b);
 	return 0;
 }
 
+/*
+ * Write one whole block to disk straight out of a wired user page.
+ *
+ * The device layer requires request data to be kernel memory it can
+ * reach at interrupt level, so a user uio normally bounces through a
+ * per-sector staging buffer in the driver: one copy into the staging
+ * buffer and a second into the device transfer buffer. Wiring the
+ * user frame (vm_page_wire) and handing the device its KSEG0 alias
+ * instead means the driver copies each sector directly from the user
+ * frame, and the whole block goes down as a single queued request.
+ *
+ * The caller has already established that the block's bytes sit in
+ * one page of a single-iovec user uio.
+ */
+static
+int
+sfs_userblockio(struct sfs_vnode *sv, struct uio *uio, daddr_t diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t uaddr;
+	unsigned pfn;
+	size_t done;
+	char *kaddr;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+	KASSERT(uio->uio_iovcnt == 1);
+	KASSERT(uio->uio_iov->iov_len >= SFS_BLOCKSIZE);
+
+	uaddr = (vaddr_t)uio->uio_iov->iov_ubase;
+
+	result = vm_page_wire(uio->uio_iov->iov_ubase, &pfn);
+	if (result) {
+		return result;
+	}
+	kaddr = (char *)PADDR_TO_KVADDR(idx_to_pa(pfn)) +
+		(uaddr & ~(vaddr_t)PAGE_FRAME);
+
+	SFSUIO(&iov, &ku, kaddr, diskblock, UIO_WRITE);
+	result = sfs_rwblock(sfs, &ku);
+
+	vm_page_decref(pfn);
+
+	/* Advance the caller's uio past what got written. */
+	done = SFS_BLOCKSIZE - ku.uio_resid;
+	uio->uio_iov->iov_ubase = (userptr_t)(uaddr + done);
+	uio->uio_iov->iov_len -= done;
+	uio->uio_resid -= done;
+	uio->uio_offset += done;
+
+	return result;
+}
+
 /*
  * Do I/O (either read or write) of a single whole block.
  */
@@ -228,6 +543,7 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
 	daddr_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -257,6 +573,74 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
+	/*
+	 * If the buffer cache already has this block (e.g. from an
+	 * earlier partial-sector op), go through the cached copy so we
+	 * don't read stale data or clobber pending dirty data.
+	 */
+	b = sfs_cache_lookup(sfs, diskblock);
+	if (b != NULL) {
+		if (uio->uio_rw == UIO_READ &&
+		    uio->uio_segflg == UIO_USERSPACE) {
+			/*
+			 * Copy out of the cached block with vfs_biglock
+			 * released, so readers copying cached data don't
+			 * serialize on it. This is safe only because the
+			 * caller holds sv_lock (true for every user-space
+			 * read; see sfs_read): that keeps writers and
+			 * truncate off this file, while our hold on the
+			 * buffer keeps it from being evicted. The copy
+			 * may fault and re-enter the filesystem, which is
+			 * also why the lock must not be held - see the
+			 * fault-path discussion in sfs_read.
+			 */
+			vfs_biglock_release();
+			result = uiomove(sfs_bdata(b), SFS_BLOCKSIZE, uio);
+			vfs_biglock_acquire();
+			sfs_brelease(sfs, b);
+			return result;
+		}
+		result = uiomove(sfs_bdata(b), SFS_BLOCKSIZE, uio);
+		if (result == 0 && uio->uio_rw == UIO_WRITE) {
+			if (curthread->t_iodirect) {
+				/*
+				 * O_DIRECT: keep the cached copy
+				 * coherent, but push the block out now
+				 * rather than leaving the write parked
+				 * in the cache.
+				 */
+				result = sfs_writeblock(sfs, diskblock,
+							sfs_bdata(b),
+							SFS_BLOCKSIZE);
+				if (result == 0) {
+					sfs_bmarkclean(b);
+				}
+			}
+			else {
+				sfs_bmarkdirty(b, sv->sv_ino);
+			}
+		}
+		sfs_brelease(sfs, b);
+		return result;
+	}
+
+	/*
+	 * Zero-copy write: if the block's bytes come from a single
+	 * user buffer and don't straddle a page boundary, write them
+	 * to disk straight out of the wired user frame. Reads are not
+	 * done this way because the device would then store into a
+	 * frame that may be copy-on-write shared with another process.
+	 */
+	if (uio->uio_rw == UIO_WRITE && uio->uio_segflg == UIO_USERSPACE &&
+	    uio->uio_iovcnt == 1) {
+		vaddr_t uaddr = (vaddr_t)uio->uio_iov->iov_ubase;
+
+		if (uaddr / PAGE_SIZE ==
+		    (uaddr + SFS_BLOCKSIZE - 1) / PAGE_SIZE) {
+			return sfs_userblockio(sv, uio, diskblock);
+		}
+	}
+
 	/*
 	 * Do the I/O directly to the uio region. Save the uio_offset,
 	 * and substitute one that makes sense to the device.
@@ -287,6 +671,12 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
+ *
+ * Called with vfs_biglock held and, for user-space uios, with sv_lock
+ * held as well (shared for reads, exclusive for writes - see
+ * sfs_read/sfs_write). vfs_biglock may be dropped and retaken around
+ * cached-read copies, so state not pinned down by sv_lock or a held
+ * buffer must not be presumed stable across the block loop.
  */
 int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
@@ -295,8 +685,45 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	uint32_t nblocks, i;
 	int result = 0;
 	uint32_t origresid, extraresid = 0;
+	off_t startoff;
+
+	/*
+	 * O_APPEND: the position comes from the current file size,
+	 * not from the caller's offset. Deciding it here, under
+	 * vfs_biglock, makes it atomic against the cached inode;
+	 * the fd layer reads the resulting uio_offset back for its
+	 * bookkeeping afterwards.
+	 */
+	if (curthread->t_ioappend && uio->uio_rw == UIO_WRITE) {
+		uio->uio_offset = sv->sv_i.sfi_size;
+	}
 
 	origresid = uio->uio_resid;
+	startoff = uio->uio_offset;
+
+	/*
+	 * O_DIRECT callers must issue block-aligned I/O. (The EOF tail
+	 * of an aligned read is the one exception; it's trimmed below
+	 * and sfs_partialio handles it without touching the cache.)
+	 */
+	if (curthread->t_iodirect &&
+	    (uio->uio_offset % SFS_BLOCKSIZE != 0 ||
+	     uio->uio_resid % SFS_BLOCKSIZE != 0)) {
+		return EINVAL;
+	}
+
+	/*
+	 * An O_DIRECT write writes through the cache to the disk, so
+	 * any blocks still pending delayed allocation need their real
+	 * disk addresses now.
+	 */
+	if (curthread->t_iodirect && uio->uio_rw == UIO_WRITE &&
+	    sv->sv_dlcount > 0) {
+		result = sfs_dalloc_bind(sv->sv_absvn.vn_fs->fs_data, sv);
+		if (result) {
+			return result;
+		}
+	}
 
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
@@ -378,12 +805,18 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	    uio->uio_rw == UIO_WRITE &&
 	    uio->uio_offset > (off_t)sv->sv_i.sfi_size) {
 		sv->sv_i.sfi_size = uio->uio_offset;
-		sv->sv_dirty = true;
+		sfs_ino_markdirty(sv);
 	}
 
 	/* Add in any extra amount we couldn't read because of EOF */
 	uio->uio_resid += extraresid;
 
+	/* Prefetch ahead of successful reads; pointless under O_DIRECT */
+	if (uio->uio_rw == UIO_READ && result == 0 &&
+	    !curthread->t_iodirect) {
+		sfs_readahead(sv, startoff, uio->uio_offset);
+	}
+
 	/* Done */
 	return result;
 }
@@ -407,6 +840,7 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *b;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -414,16 +848,6 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
 	KASSERT(vfs_biglock_do_i_hold());
 
 	/* Figure out which block of the vnode (directory, whatever) this is */
@@ -446,35 +870,31 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block from the buffer cache */
+	result = sfs_bget(sfs, diskblock, &b);
 	if (result) {
 		return result;
 	}
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, (char *)sfs_bdata(b) + blockoffset, len);
 	}
 	else {
-		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		/* Update the selected region; it goes out at sync time */
+		memcpy((char *)sfs_bdata(b) + blockoffset, data, len);
+		sfs_bmarkdirty(b, sv->sv_ino);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
 		if (endpos > (off_t)sv->sv_i.sfi_size) {
 			sv->sv_i.sfi_size = endpos;
-			sv->sv_dirty = true;
+			sfs_ino_markdirty(sv);
 		}
 	}
 
+	sfs_brelease(sfs, b);
+
 	/* Done */
 	return 0;
 }
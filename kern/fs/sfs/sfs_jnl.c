@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Metadata journal.
+ *
+ * Metadata updates used to reach the disk as a sequence of individual
+ * block writes; a crash partway through a create or remove could leave
+ * the volume inconsistent (a directory entry without its inode, a
+ * freemap bit without its block, and so on).
+ *
+ * Instead, all dirty metadata - buffer cache blocks, freemap blocks
+ * and the superblock - is pushed out in batches through a small
+ * write-ahead log: the block images are written to the journal region
+ * first, then a header committing them, then the images to their home
+ * locations, then a header retiring the batch. After a crash,
+ * recovery replays whatever committed batch the header describes;
+ * either all of a batch's blocks take effect or none of them do.
+ *
+ * This is also a group commit: every operation that ran since the
+ * last sync has its metadata gathered into the same batches, so a
+ * burst of creates costs one journal write per batch rather than one
+ * per operation.
+ *
+ * Batches are cut at sync time and when the buffer cache must evict a
+ * dirty block. All of SFS runs under vfs_biglock, so a batch cut at
+ * sync always sees quiescent metadata; an eviction-forced batch can
+ * in principle capture the middle of an operation, but with a
+ * 64-buffer cache and operations touching a handful of blocks that is
+ * rare, and even then the batch still applies atomically.
+ *
+ * The journal region is carved out of the ordinary block pool the
+ * first time a volume without one is mounted, and recorded in
+ * previously-reserved superblock fields, so old volumes keep working
+ * and get upgraded in place. If there's no room for a journal the
+ * volume runs without one, with the old (unlogged) write behavior.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <vfs.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/*
+ * Write the journal header with the given sequence number and record
+ * list. COUNT of zero (BLOCKS may then be NULL) marks the journal
+ * clean.
+ */
+static
+int
+sfs_jnl_writeheader(struct sfs_fs *sfs, uint32_t sequence,
+		    uint32_t count, const daddr_t *blocks)
+{
+	struct sfs_jheader *jh;
+	uint32_t i;
+	int result;
+
+	KASSERT(count <= SFS_JOURNAL_MAXRECS);
+
+	/*
+	 * Not on the stack; this runs at the bottom of the write path
+	 * when the buffer cache evicts.
+	 */
+	jh = kmalloc(sizeof(*jh));
+	if (jh == NULL) {
+		return ENOMEM;
+	}
+
+	bzero(jh, sizeof(*jh));
+	jh->jh_magic = SFS_JOURNAL_MAGIC;
+	jh->jh_sequence = sequence;
+	jh->jh_count = count;
+	for (i=0; i<count; i++) {
+		jh->jh_blocks[i] = blocks[i];
+	}
+
+	result = sfs_writeblock(sfs, sfs->sfs_sb.sb_journalstart, jh,
+				sizeof(*jh));
+	kfree(jh);
+	return result;
+}
+
+/*
+ * Mount-time initialization: replay a committed batch left over from
+ * a crash, or carve out a journal region if the volume doesn't have
+ * one yet. The carve loads freemap blocks as it searches; the replay
+ * happens first, so the blocks read reflect it. The superblock is
+ * written back by the first sync if we change it.
+ */
+int
+sfs_jnl_bootstrap(struct sfs_fs *sfs)
+{
+	struct sfs_jheader jh;
+	char blockbuf[SFS_BLOCKSIZE];
+	daddr_t runstart;
+	uint32_t runlen, i;
+	int result;
+
+	COMPILE_ASSERT(sizeof(struct sfs_jheader) == SFS_BLOCKSIZE);
+	COMPILE_ASSERT(SFS_JOURNAL_MAXRECS < SFS_JOURNAL_BLOCKS);
+
+	if (sfs->sfs_sb.sb_journalstart != 0) {
+		/* Existing journal; check for a batch to replay. */
+		result = sfs_readblock(sfs, sfs->sfs_sb.sb_journalstart,
+				       &jh, sizeof(jh));
+		if (result) {
+			return result;
+		}
+		if (jh.jh_magic != SFS_JOURNAL_MAGIC ||
+		    jh.jh_count > SFS_JOURNAL_MAXRECS) {
+			kprintf("sfs: %s: bad journal header; "
+				"reinitializing journal\n",
+				sfs->sfs_sb.sb_volname);
+			sfs->sfs_jnlsequence = 1;
+			return sfs_jnl_writeheader(sfs, 1, 0, NULL);
+		}
+		if (jh.jh_count == 0) {
+			/* Clean. */
+			sfs->sfs_jnlsequence = jh.jh_sequence;
+			return 0;
+		}
+
+		kprintf("sfs: %s: replaying %u journaled blocks\n",
+			sfs->sfs_sb.sb_volname, jh.jh_count);
+		for (i=0; i<jh.jh_count; i++) {
+			result = sfs_readblock(sfs,
+					sfs->sfs_sb.sb_journalstart + 1 + i,
+					blockbuf, sizeof(blockbuf));
+			if (result) {
+				return result;
+			}
+			result = sfs_writeblock(sfs, jh.jh_blocks[i],
+						blockbuf, sizeof(blockbuf));
+			if (result) {
+				return result;
+			}
+		}
+		sfs->sfs_jnlsequence = jh.jh_sequence + 1;
+		return sfs_jnl_writeheader(sfs, sfs->sfs_jnlsequence, 0, NULL);
+	}
+
+	/*
+	 * No journal yet (the superblock fields were reserved space on
+	 * older volumes); find a contiguous run for one.
+	 */
+	runstart = 0;
+	for (;;) {
+		daddr_t searchfrom = runstart;
+
+		result = sfs_freemap_findrun(sfs, searchfrom,
+					     SFS_JOURNAL_BLOCKS,
+					     &runstart, &runlen);
+		if (result) {
+			break;
+		}
+		if (runlen == SFS_JOURNAL_BLOCKS) {
+			break;
+		}
+		/*
+		 * Too short; look past it. findrun wraps, so a result
+		 * behind the search point means we've been all the
+		 * way around without finding a long enough run.
+		 */
+		if (runstart < searchfrom ||
+		    runstart + runlen >= sfs->sfs_sb.sb_nblocks) {
+			result = ENOSPC;
+			break;
+		}
+		runstart = runstart + runlen;
+	}
+	if (result) {
+		kprintf("sfs: %s: no room for a journal; "
+			"running without one\n", sfs->sfs_sb.sb_volname);
+		return 0;
+	}
+
+	for (i=0; i<SFS_JOURNAL_BLOCKS; i++) {
+		sfs_freemap_mark(sfs, runstart + i);
+	}
+	sfs->sfs_sb.sb_journalstart = runstart;
+	sfs->sfs_sb.sb_journalblocks = SFS_JOURNAL_BLOCKS;
+	sfs->sfs_superdirty = true;
+
+	sfs->sfs_jnlsequence = 1;
+	return sfs_jnl_writeheader(sfs, 1, 0, NULL);
+}
+
+/*
+ * Push dirty metadata out through the journal, a batch at a time.
+ * Replaces the separate cache/freemap/superblock write-back passes;
+ * also called when the buffer cache must evict a dirty block. On a
+ * volume without a journal the images just go straight home.
+ *
+ * INO restricts the cache buffers flushed to those owned by one file
+ * (SFS_INO_ANY flushes everything). The superblock and freemap are
+ * always included when dirty: a single file's durability needs its
+ * allocations on disk too, and they're at most a few blocks. Each
+ * journal batch records exactly the blocks it writes, so a filtered
+ * batch replays just as safely as a full one.
+ */
+static
+int
+sfs_jnl_dosync(struct sfs_fs *sfs, uint32_t ino)
+{
+	struct sfs_buf *bufs[SFS_JOURNAL_MAXRECS];
+	daddr_t blocks[SFS_JOURNAL_MAXRECS];
+	void *images[SFS_JOURNAL_MAXRECS];
+	unsigned nbufs, n, i;
+	int freemapblock[SFS_JOURNAL_MAXRECS];
+	bool super;
+	char *freemapdata;
+	uint32_t j, freemapblocks;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	/*
+	 * First bind any pending delayed-allocation ranges, choosing
+	 * disk homes for data blocks that don't have one and updating
+	 * the owning inodes, so the batches below capture the final
+	 * layout. Skipped when this flush was itself triggered from
+	 * inside a bind (by an eviction); that flush just writes what
+	 * is already bound.
+	 */
+	if (!sfs->sfs_dlbinding) {
+		result = sfs_dalloc_bindall(sfs);
+		if (result) {
+			return result;
+		}
+	}
+
+	/*
+	 * The batches below rewrite freemap blocks on disk, so the
+	 * persisted free-space summary is about to go stale. Mark it
+	 * unclean first, before anything is committed, so a crash
+	 * can't leave a clean summary describing a changed freemap.
+	 */
+	if (sfs->sfs_freemapdirty) {
+		result = sfs_summary_invalidate(sfs);
+		if (result) {
+			return result;
+		}
+	}
+
+	freemapblocks = SFS_FREEMAPBLOCKS(sfs->sfs_sb.sb_nblocks);
+	freemapdata = bitmap_getdata(sfs->sfs_freemap);
+
+	for (;;) {
+		/*
+		 * Gather a batch: the superblock, dirty freemap
+		 * blocks, then dirty cache buffers.
+		 */
+		n = 0;
+		super = false;
+		if (sfs->sfs_superdirty) {
+			blocks[n] = SFS_SUPER_BLOCK;
+			images[n] = &sfs->sfs_sb;
+			freemapblock[n] = -1;
+			super = true;
+			n++;
+		}
+		KASSERT(sfs->sfs_freemapdirtymap != NULL);
+		for (j=0; j<freemapblocks && n<SFS_JOURNAL_MAXRECS; j++) {
+			if (!sfs->sfs_freemapdirtymap[j]) {
+				continue;
+			}
+			blocks[n] = SFS_FREEMAP_START + j;
+			images[n] = freemapdata + j*SFS_BLOCKSIZE;
+			freemapblock[n] = j;
+			n++;
+		}
+		nbufs = sfs_cache_getdirty(sfs, ino, bufs,
+					   SFS_JOURNAL_MAXRECS - n);
+		for (i=0; i<nbufs; i++) {
+			blocks[n] = sfs_bblock(bufs[i]);
+			images[n] = sfs_bdata(bufs[i]);
+			freemapblock[n] = -1;
+			n++;
+		}
+
+		if (n == 0) {
+			sfs->sfs_freemapdirty = false;
+			/* Everything is on disk; freshen the summary. */
+			return sfs_summary_persist(sfs);
+		}
+
+		if (sfs->sfs_sb.sb_journalstart != 0) {
+			/* Commit the batch: images first, then header. */
+			for (i=0; i<n; i++) {
+				result = sfs_writeblock(sfs,
+					sfs->sfs_sb.sb_journalstart + 1 + i,
+					images[i], SFS_BLOCKSIZE);
+				if (result) {
+					return result;
+				}
+			}
+			sfs->sfs_jnlsequence++;
+			result = sfs_jnl_writeheader(sfs,
+						     sfs->sfs_jnlsequence,
+						     n, blocks);
+			if (result) {
+				return result;
+			}
+		}
+
+		/* Checkpoint: write the images to their homes. */
+		for (i=0; i<n; i++) {
+			result = sfs_writeblock(sfs, blocks[i], images[i],
+						SFS_BLOCKSIZE);
+			if (result) {
+				return result;
+			}
+		}
+
+		/* Retire the batch and mark everything in it clean. */
+		if (sfs->sfs_sb.sb_journalstart != 0) {
+			sfs->sfs_jnlsequence++;
+			result = sfs_jnl_writeheader(sfs,
+						     sfs->sfs_jnlsequence,
+						     0, NULL);
+			if (result) {
+				return result;
+			}
+		}
+		if (super) {
+			sfs->sfs_superdirty = false;
+		}
+		for (i=0; i<n; i++) {
+			if (freemapblock[i] >= 0) {
+				sfs->sfs_freemapdirtymap[freemapblock[i]] = 0;
+			}
+		}
+		for (i=0; i<nbufs; i++) {
+			sfs_bmarkclean(bufs[i]);
+		}
+	}
+}
+
+/*
+ * Whole-volume sync: unmount, the sync() call, dirty eviction.
+ */
+int
+sfs_jnl_sync(struct sfs_fs *sfs)
+{
+	return sfs_jnl_dosync(sfs, SFS_INO_ANY);
+}
+
+/*
+ * Single-file sync, for fsync(): flushes only the file's own dirty
+ * blocks (data, indirect blocks, inode) plus the superblock and
+ * freemap, leaving everyone else's dirty data in the cache.
+ */
+int
+sfs_jnl_syncvnode(struct sfs_fs *sfs, uint32_t ino)
+{
+	return sfs_jnl_dosync(sfs, ino);
+}
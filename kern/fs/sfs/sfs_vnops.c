@@ -35,8 +35,10 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <limits.h>
 #include <stat.h>
 #include <lib.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <sfs.h>
@@ -98,13 +100,56 @@ int
 sfs_read(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	bool dolock;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
+	/*
+	 * Take the file lock shared, so readers of the same file run
+	 * concurrently. (The parallelism materializes in sfs_io, which
+	 * drops vfs_biglock while copying out of cached blocks.)
+	 *
+	 * Kernel-originated reads bypass sv_lock. The important such
+	 * caller is the fault path, which pages demand-loaded
+	 * executables in through VOP_READ: a reader that holds sv_lock
+	 * and faults in uiomove can re-enter here on the same vnode,
+	 * and blocking on sv_lock then - even shared, since a queued
+	 * writer stalls new readers - would deadlock against
+	 * ourselves. Kernel uios cannot fault, and they hold
+	 * vfs_biglock across the whole operation as always, so they
+	 * give up nothing by skipping the lock.
+	 */
+	dolock = (uio->uio_segflg == UIO_USERSPACE);
+	if (dolock) {
+		rwlock_acquire_read(sv->sv_lock);
+	}
 	vfs_biglock_acquire();
 	result = sfs_io(sv, uio);
 	vfs_biglock_release();
+	if (dolock) {
+		rwlock_release_read(sv->sv_lock);
+	}
+
+	return result;
+}
+
+/*
+ * Called for getdirentry(). sfs_dir_getdirentry() does the work.
+ */
+static
+int
+sfs_getdirentry(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+	KASSERT(uio->uio_offset >= 0);
+
+	vfs_biglock_acquire();
+	result = sfs_dir_getdirentry(sv, uio);
+	vfs_biglock_release();
 
 	return result;
 }
@@ -121,9 +166,16 @@ sfs_write(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	/*
+	 * Writers are exclusive: against each other (two appends must
+	 * not interleave) and against readers, who may be copying out
+	 * of this file's cached blocks with vfs_biglock released.
+	 */
+	rwlock_acquire_write(sv->sv_lock);
 	vfs_biglock_acquire();
 	result = sfs_io(sv, uio);
 	vfs_biglock_release();
+	rwlock_release_write(sv->sv_lock);
 
 	return result;
 }
@@ -216,16 +268,24 @@ sfs_isseekable(struct vnode *v)
 /*
  * Called for fsync(), and also on filesystem unmount, global sync(),
  * and some other cases.
+ *
+ * Pushes this file's dirty blocks (and its inode) out through the
+ * journal without flushing the rest of the volume, so one file's
+ * durability doesn't stall on everyone else's dirty data.
  */
 static
 int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	int result;
 
 	vfs_biglock_acquire();
 	result = sfs_sync_inode(sv);
+	if (result == 0) {
+		result = sfs_jnl_syncvnode(sfs, sv->sv_ino);
+	}
 	vfs_biglock_release();
 
 	return result;
@@ -250,28 +310,92 @@ int
 sfs_truncate(struct vnode *v, off_t len)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	int result;
 
-	return sfs_itrunc(sv, len);
+	/*
+	 * Exclusive, like a write: truncation moves the EOF and frees
+	 * blocks, neither of which may happen under a reader. The other
+	 * truncation site, sfs_reclaim erasing an unlinked file, runs
+	 * without sv_lock; the refcount is zero there, so no file I/O
+	 * can be in flight.
+	 */
+	rwlock_acquire_write(sv->sv_lock);
+	result = sfs_itrunc(sv, len);
+	rwlock_release_write(sv->sv_lock);
+
+	return result;
 }
 
 /*
- * Get the full pathname for a file. This only needs to work on directories.
- * Since we don't support subdirectories, assume it's the root directory
- * and hand back the empty string. (The VFS layer takes care of the
- * device name, leading slash, etc.)
+ * Get the full pathname for a file. This only needs to work on
+ * directories. Walk up through the ".." entries, looking up each
+ * directory's name in its parent, and build the path back to front.
+ * The root directory comes out as the empty string. (The VFS layer
+ * takes care of the device name.)
  */
 static
 int
 sfs_namefile(struct vnode *vv, struct uio *uio)
 {
 	struct sfs_vnode *sv = vv->vn_data;
-	KASSERT(sv->sv_ino == SFS_ROOTDIR_INO);
+	struct sfs_vnode *parent;
+	char name[SFS_NAMELEN];
+	char *path;
+	size_t pos, len;
+	int result;
 
-	/* send back the empty string - just return */
+	vfs_biglock_acquire();
 
-	(void)uio;
+	if (sv->sv_ino == SFS_ROOTDIR_INO) {
+		/* Root directory - send back the empty string. */
+		vfs_biglock_release();
+		return 0;
+	}
 
-	return 0;
+	path = kmalloc(PATH_MAX);
+	if (path == NULL) {
+		vfs_biglock_release();
+		return ENOMEM;
+	}
+	pos = PATH_MAX;
+
+	VOP_INCREF(&sv->sv_absvn);
+	while (sv->sv_ino != SFS_ROOTDIR_INO) {
+		result = sfs_lookonce(sv, "..", &parent, NULL);
+		if (result) {
+			goto fail;
+		}
+		result = sfs_dir_findino(parent, sv->sv_ino, name);
+		if (result) {
+			VOP_DECREF(&parent->sv_absvn);
+			goto fail;
+		}
+		len = strlen(name);
+		if (pos < len + 1) {
+			VOP_DECREF(&parent->sv_absvn);
+			result = ENAMETOOLONG;
+			goto fail;
+		}
+		pos -= len;
+		memcpy(path + pos, name, len);
+		pos--;
+		path[pos] = '/';
+
+		VOP_DECREF(&sv->sv_absvn);
+		sv = parent;
+	}
+	VOP_DECREF(&sv->sv_absvn);
+
+	result = uiomove(path + pos, PATH_MAX - pos, uio);
+	kfree(path);
+	vfs_biglock_release();
+	return result;
+
+ fail:
+	VOP_DECREF(&sv->sv_absvn);
+	kfree(path);
+	vfs_biglock_release();
+	return result;
 }
 
 /*
@@ -338,7 +462,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
-	newguy->sv_dirty = true;
+	sfs_ino_markdirty(newguy);
 
 	*ret = &newguy->sv_absvn;
 
@@ -346,6 +470,85 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	return 0;
 }
 
+/*
+ * Create a directory.
+ *
+ * The new directory gets on-disk "." and ".." entries like any other
+ * Unix filesystem, so ".." keeps working across reboots. (The root
+ * directory has neither - volumes written by mksfs never did - so the
+ * path walk in sfs_lookpath resolves "." and ".." itself and only
+ * falls through to these entries when crossing back out of a
+ * subdirectory.)
+ */
+static
+int
+sfs_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_vnode *newguy;
+	uint32_t ino;
+	int result;
+
+	vfs_biglock_acquire();
+
+	/* We don't currently support directory permissions; ignore MODE */
+	(void)mode;
+
+	/* Look up the name. We want to make sure it *doesn't* exist. */
+	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
+	if (result!=0 && result!=ENOENT) {
+		vfs_biglock_release();
+		return result;
+	}
+	if (result==0) {
+		vfs_biglock_release();
+		return EEXIST;
+	}
+
+	result = sfs_makeobj(sfs, SFS_TYPE_DIR, &newguy);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
+	result = sfs_dir_link(newguy, ".", newguy->sv_ino, NULL);
+	if (result) {
+		goto bad;
+	}
+	result = sfs_dir_link(newguy, "..", sv->sv_ino, NULL);
+	if (result) {
+		goto bad;
+	}
+	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
+	if (result) {
+		goto bad;
+	}
+
+	/* The parent's entry and the new directory's own "." */
+	newguy->sv_i.sfi_linkcount = 2;
+	sfs_ino_markdirty(newguy);
+
+	/* The new directory's ".." */
+	sv->sv_i.sfi_linkcount++;
+	sfs_ino_markdirty(sv);
+
+	VOP_DECREF(&newguy->sv_absvn);
+
+	vfs_biglock_release();
+	return 0;
+
+ bad:
+	/*
+	 * The new directory's linkcount is still 0, so dropping the
+	 * reference reclaims it, which truncates it (erasing whatever
+	 * entries we managed to make) and frees the inode.
+	 */
+	VOP_DECREF(&newguy->sv_absvn);
+	vfs_biglock_release();
+	return result;
+}
+
 /*
  * Make a hard link to a file.
  * The VFS layer should prevent this being called unless both
@@ -378,7 +581,7 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 
 	/* and update the link count, marking the inode dirty */
 	f->sv_i.sfi_linkcount++;
-	f->sv_dirty = true;
+	sfs_ino_markdirty(f);
 
 	vfs_biglock_release();
 	return 0;
@@ -405,13 +608,20 @@ sfs_remove(struct vnode *dir, const char *name)
 		return result;
 	}
 
+	/* Directories come off with rmdir, not remove. */
+	if (victim->sv_i.sfi_type == SFS_TYPE_DIR) {
+		VOP_DECREF(&victim->sv_absvn);
+		vfs_biglock_release();
+		return EISDIR;
+	}
+
 	/* Erase its directory entry. */
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
-		victim->sv_dirty = true;
+		sfs_ino_markdirty(victim);
 	}
 
 	/* Discard the reference that sfs_lookonce got us */
@@ -422,36 +632,109 @@ sfs_remove(struct vnode *dir, const char *name)
 }
 
 /*
- * Rename a file.
+ * Delete a directory, which must be empty.
+ */
+static
+int
+sfs_rmdir(struct vnode *dir, const char *name)
+{
+	struct sfs_vnode *sv = dir->vn_data;
+	struct sfs_vnode *victim;
+	int slot;
+	int result;
+
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return EINVAL;
+	}
+
+	vfs_biglock_acquire();
+
+	/* Look for the directory and fetch a vnode for it. */
+	result = sfs_lookonce(sv, name, &victim, &slot);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
+	if (victim->sv_i.sfi_type != SFS_TYPE_DIR) {
+		result = ENOTDIR;
+		goto out;
+	}
+
+	/* Only "." and ".." may be left in it. */
+	result = sfs_dir_checkempty(victim);
+	if (result) {
+		goto out;
+	}
+
+	/* Erase its directory entry. */
+	result = sfs_dir_unlink(sv, slot);
+	if (result) {
+		goto out;
+	}
+
+	/* The victim's ".." is gone with it. */
+	KASSERT(sv->sv_i.sfi_linkcount > 1);
+	sv->sv_i.sfi_linkcount--;
+	sfs_ino_markdirty(sv);
+
+	/* And so are our entry for it and its own ".". */
+	KASSERT(victim->sv_i.sfi_linkcount == 2);
+	victim->sv_i.sfi_linkcount -= 2;
+	sfs_ino_markdirty(victim);
+
+	/*
+	 * The space comes back when the vnode is reclaimed: linkcount
+	 * 0 makes reclaim truncate the directory body and free the
+	 * inode, once any processes still holding it as their current
+	 * directory have let go.
+	 */
+
+ out:
+	/* Discard the reference that sfs_lookonce got us */
+	VOP_DECREF(&victim->sv_absvn);
+
+	vfs_biglock_release();
+	return result;
+}
+
+/*
+ * Rename a file, or a directory within one directory.
  *
- * Since we don't support subdirectories, assumes that the two
- * directories passed are the same.
+ * Cross-directory renames of files work the same way as renames
+ * within a directory: link under the new name, unlink the old one.
+ * Cross-directory renames of directories would additionally need to
+ * rewrite the victim's ".." entry and refuse destinations inside the
+ * victim itself; we don't support them (yet?).
  */
 static
 int
 sfs_rename(struct vnode *d1, const char *n1,
 	   struct vnode *d2, const char *n2)
 {
-	struct sfs_vnode *sv = d1->vn_data;
-	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_vnode *sv1 = d1->vn_data;
+	struct sfs_vnode *sv2 = d2->vn_data;
+	struct sfs_fs *sfs = sv1->sv_absvn.vn_fs->fs_data;
 	struct sfs_vnode *g1;
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
+	KASSERT(d1->vn_fs == d2->vn_fs);
 
-	KASSERT(d1==d2);
-	KASSERT(sv->sv_ino == SFS_ROOTDIR_INO);
+	vfs_biglock_acquire();
 
 	/* Look up the old name of the file and get its inode and slot number*/
-	result = sfs_lookonce(sv, n1, &g1, &slot1);
+	result = sfs_lookonce(sv1, n1, &g1, &slot1);
 	if (result) {
 		vfs_biglock_release();
 		return result;
 	}
 
-	/* We don't support subdirectories */
-	KASSERT(g1->sv_i.sfi_type == SFS_TYPE_FILE);
+	/* Directories can only be renamed in place; see above. */
+	if (d1 != d2 && g1->sv_i.sfi_type == SFS_TYPE_DIR) {
+		result = EINVAL;
+		goto puke;
+	}
 
 	/*
 	 * Link it under the new name.
@@ -461,17 +744,17 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 * the new name doesn't already exist; might as well use the
 	 * existing link routine.
 	 */
-	result = sfs_dir_link(sv, n2, g1->sv_ino, &slot2);
+	result = sfs_dir_link(sv2, n2, g1->sv_ino, &slot2);
 	if (result) {
 		goto puke;
 	}
 
 	/* Increment the link count, and mark inode dirty */
 	g1->sv_i.sfi_linkcount++;
-	g1->sv_dirty = true;
+	sfs_ino_markdirty(g1);
 
 	/* Unlink the old slot */
-	result = sfs_dir_unlink(sv, slot1);
+	result = sfs_dir_unlink(sv1, slot1);
 	if (result) {
 		goto puke_harder;
 	}
@@ -482,7 +765,7 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 */
 	KASSERT(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
-	g1->sv_dirty = true;
+	sfs_ino_markdirty(g1);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
@@ -494,7 +777,7 @@ sfs_rename(struct vnode *d1, const char *n1,
 	/*
 	 * Error recovery: try to undo what we already did
 	 */
-	result2 = sfs_dir_unlink(sv, slot2);
+	result2 = sfs_dir_unlink(sv2, slot2);
 	if (result2) {
 		kprintf("sfs: %s: rename: %s\n",
 			sfs->sfs_sb.sb_volname, strerror(result));
@@ -512,11 +795,80 @@ sfs_rename(struct vnode *d1, const char *n1,
 }
 
 /*
- * lookparent returns the last path component as a string and the
- * directory it's in as a vnode.
+ * Resolve a path, possibly containing several components, relative to
+ * SV. Hands back a new reference; the caller keeps its own. An empty
+ * path (or one that's all slashes) resolves to SV itself.
+ *
+ * Each component is one sfs_lookonce, which the directory name index
+ * serves in O(1) expected, so a deep path costs a few hash probes
+ * rather than a scan of anything. The path string is not modified;
+ * the VFS layer caches whole-path translations keyed on it.
  *
- * Since we don't support subdirectories, this is very easy -
- * return the root dir and copy the path.
+ * "." is resolved here without touching the disk, and ".." of the
+ * root is the root itself; the root directory predates subdirectory
+ * support and has no "." or ".." entries on disk. Other directories
+ * do (sfs_mkdir makes them), which is what the sfs_lookonce of ".."
+ * finds.
+ */
+static
+int
+sfs_lookpath(struct sfs_vnode *sv, const char *path,
+	     struct sfs_vnode **ret)
+{
+	struct sfs_vnode *next;
+	char name[SFS_NAMELEN];
+	const char *slash;
+	size_t len;
+	int result;
+
+	VOP_INCREF(&sv->sv_absvn);
+
+	while (*path != 0) {
+		/* Pull out the next component; skip empty ones. */
+		slash = strchr(path, '/');
+		len = (slash != NULL) ? (size_t)(slash - path) :
+			strlen(path);
+		if (len == 0) {
+			path++;
+			continue;
+		}
+		if (len >= sizeof(name)) {
+			VOP_DECREF(&sv->sv_absvn);
+			return ENAMETOOLONG;
+		}
+		memcpy(name, path, len);
+		name[len] = 0;
+		path += len;
+
+		if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
+			VOP_DECREF(&sv->sv_absvn);
+			return ENOTDIR;
+		}
+		if (!strcmp(name, ".")) {
+			continue;
+		}
+		if (!strcmp(name, "..") && sv->sv_ino == SFS_ROOTDIR_INO) {
+			/* The root is its own parent. */
+			continue;
+		}
+
+		result = sfs_lookonce(sv, name, &next, NULL);
+		if (result) {
+			VOP_DECREF(&sv->sv_absvn);
+			return result;
+		}
+		VOP_DECREF(&sv->sv_absvn);
+		sv = next;
+	}
+
+	*ret = sv;
+	return 0;
+}
+
+/*
+ * lookparent returns the last path component as a string and the
+ * directory it's in as a vnode: resolve everything up to the last
+ * slash with sfs_lookpath and copy out what's after it.
  */
 static
 int
@@ -524,6 +876,9 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 		  char *buf, size_t buflen)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_vnode *parent;
+	char *lastslash;
+	int result;
 
 	vfs_biglock_acquire();
 
@@ -532,24 +887,50 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 		return ENOTDIR;
 	}
 
+	/* Discard trailing slashes; "a/b/" names the same thing as "a/b". */
+	lastslash = path + strlen(path);
+	while (lastslash > path && lastslash[-1] == '/') {
+		lastslash--;
+		*lastslash = 0;
+	}
+
+	lastslash = strrchr(path, '/');
+	if (lastslash != NULL) {
+		*lastslash = 0;
+		result = sfs_lookpath(sv, path, &parent);
+		if (result) {
+			vfs_biglock_release();
+			return result;
+		}
+		if (parent->sv_i.sfi_type != SFS_TYPE_DIR) {
+			VOP_DECREF(&parent->sv_absvn);
+			vfs_biglock_release();
+			return ENOTDIR;
+		}
+		path = lastslash + 1;
+	}
+	else {
+		/* Just a name; it's relative to this directory. */
+		VOP_INCREF(&sv->sv_absvn);
+		parent = sv;
+	}
+
 	if (strlen(path)+1 > buflen) {
+		VOP_DECREF(&parent->sv_absvn);
 		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
 
-	VOP_INCREF(&sv->sv_absvn);
-	*ret = &sv->sv_absvn;
+	*ret = &parent->sv_absvn;
 
 	vfs_biglock_release();
 	return 0;
 }
 
 /*
- * Lookup gets a vnode for a pathname.
- *
- * Since we don't support subdirectories, it's easy - just look up the
- * name.
+ * Lookup gets a vnode for a pathname. sfs_lookpath walks the
+ * components.
  */
 static
 int
@@ -566,7 +947,7 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 		return ENOTDIR;
 	}
 
-	result = sfs_lookonce(sv, path, &final, NULL);
+	result = sfs_lookpath(sv, path, &final);
 	if (result) {
 		vfs_biglock_release();
 		return result;
@@ -598,6 +979,7 @@ const struct vnode_ops sfs_fileops = {
 	.vop_stat = sfs_stat,
 	.vop_gettype = sfs_gettype,
 	.vop_isseekable = sfs_isseekable,
+	.vop_poll = vnode_poll_generic,
 	.vop_fsync = sfs_fsync,
 	.vop_mmap = sfs_mmap,
 	.vop_truncate = sfs_truncate,
@@ -626,12 +1008,13 @@ const struct vnode_ops sfs_dirops = {
 
 	.vop_read = vopfail_uio_isdir,
 	.vop_readlink = vopfail_uio_inval,
-	.vop_getdirentry = vopfail_uio_nosys,
+	.vop_getdirentry = sfs_getdirentry,
 	.vop_write = vopfail_uio_isdir,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
 	.vop_gettype = sfs_gettype,
 	.vop_isseekable = sfs_isseekable,
+	.vop_poll = vnode_poll_generic,
 	.vop_fsync = sfs_fsync,
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
@@ -639,10 +1022,10 @@ const struct vnode_ops sfs_dirops = {
 
 	.vop_creat = sfs_creat,
 	.vop_symlink = vopfail_symlink_nosys,
-	.vop_mkdir = vopfail_mkdir_nosys,
+	.vop_mkdir = sfs_mkdir,
 	.vop_link = sfs_link,
 	.vop_remove = sfs_remove,
-	.vop_rmdir = vopfail_string_nosys,
+	.vop_rmdir = sfs_rmdir,
 	.vop_rename = sfs_rename,
 
 	.vop_lookup = sfs_lookup,
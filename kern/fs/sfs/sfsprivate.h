@@ -43,13 +43,36 @@ extern const struct vnode_ops sfs_dirops;
 
 
 /* Functions in sfs_balloc.c */
-int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_balloc_bootstrap(struct sfs_fs *sfs);
+int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock, uint32_t ino);
+int sfs_balloc_file(struct sfs_fs *sfs, struct sfs_vnode *sv,
+		daddr_t *diskblock);
+void sfs_extent_release(struct sfs_fs *sfs, struct sfs_vnode *sv);
+bool sfs_dalloc_wanted(struct sfs_fs *sfs, struct sfs_vnode *sv);
+bool sfs_dalloc_lookup(struct sfs_fs *sfs, struct sfs_vnode *sv,
+		uint32_t fileblock, daddr_t *diskblock);
+int sfs_dalloc_reserve(struct sfs_fs *sfs, struct sfs_vnode *sv,
+		uint32_t fileblock, daddr_t *diskblock);
+int sfs_dalloc_bind(struct sfs_fs *sfs, struct sfs_vnode *sv);
+int sfs_dalloc_bindall(struct sfs_fs *sfs);
+void sfs_dalloc_truncate(struct sfs_fs *sfs, struct sfs_vnode *sv,
+		uint32_t blocklen);
+void sfs_freemap_markdirty(struct sfs_fs *sfs, daddr_t block);
+void sfs_freemap_mark(struct sfs_fs *sfs, daddr_t block);
+void sfs_freemap_unmark(struct sfs_fs *sfs, daddr_t block);
+int sfs_freemap_findrun(struct sfs_fs *sfs, daddr_t start, uint32_t want,
+		daddr_t *runstart, uint32_t *runlen);
+int sfs_summary_invalidate(struct sfs_fs *sfs);
+int sfs_summary_persist(struct sfs_fs *sfs);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
+void sfs_bfree_run(struct sfs_fs *sfs, daddr_t start, uint32_t len);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
 /* Functions in sfs_bmap.c */
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
+int sfs_bmap_tree(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+		struct sfs_buf **idb_ret, uint32_t *idoff_ret);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
 
 /* Functions in sfs_dir.c */
@@ -58,24 +81,60 @@ int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 int sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino,
 		int *slot);
 int sfs_dir_unlink(struct sfs_vnode *sv, int slot);
+int sfs_dir_findino(struct sfs_vnode *sv, uint32_t ino, char *namebuf);
+int sfs_dir_checkempty(struct sfs_vnode *sv);
+int sfs_dir_getdirentry(struct sfs_vnode *sv, struct uio *uio);
+void sfs_dirhash_destroy(struct sfs_vnode *sv);
 int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
 
 /* Functions in sfs_inode.c */
 int sfs_sync_inode(struct sfs_vnode *sv);
+void sfs_ino_markdirty(struct sfs_vnode *sv);
+int sfs_ino_syncall(struct sfs_fs *sfs);
+void sfs_writeback_purge(struct sfs_fs *sfs);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		struct sfs_vnode **ret);
 int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
 int sfs_getroot(struct fs *fs, struct vnode **ret);
 
+/* Functions in sfs_buf.c */
+struct sfs_buf; /* opaque */
+struct sfs_bufcache *sfs_cache_create(void);
+void sfs_cache_destroy(struct sfs_bufcache *cache);
+int sfs_bget(struct sfs_fs *sfs, daddr_t block, struct sfs_buf **ret);
+struct sfs_buf *sfs_cache_lookup(struct sfs_fs *sfs, daddr_t block);
+int sfs_bgetzero(struct sfs_fs *sfs, daddr_t block, uint32_t ino,
+		struct sfs_buf **ret);
+void *sfs_bdata(struct sfs_buf *b);
+void sfs_bmarkdirty(struct sfs_buf *b, uint32_t ino);
+void sfs_brelease(struct sfs_fs *sfs, struct sfs_buf *b);
+void sfs_cache_discard(struct sfs_fs *sfs, daddr_t block);
+void sfs_cache_dropclean(struct sfs_fs *sfs, daddr_t block);
+void sfs_cache_renumber(struct sfs_fs *sfs, daddr_t oldblock,
+		daddr_t newblock);
+daddr_t sfs_bblock(struct sfs_buf *b);
+void sfs_bmarkclean(struct sfs_buf *b);
+
+/* Owner filter value matching every buffer, for whole-volume sync. */
+#define SFS_INO_ANY ((uint32_t)-1)
+unsigned sfs_cache_getdirty(struct sfs_fs *sfs, uint32_t ino,
+		struct sfs_buf **list, unsigned max);
+
+/* Functions in sfs_jnl.c */
+int sfs_jnl_bootstrap(struct sfs_fs *sfs);
+int sfs_jnl_sync(struct sfs_fs *sfs);
+int sfs_jnl_syncvnode(struct sfs_fs *sfs, uint32_t ino);
+
 /* Functions in sfs_io.c */
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
+void sfs_readahead_purge(struct sfs_fs *sfs);
 
 
 #endif /* _SFSPRIVATE_H_ */
@@ -38,7 +38,7 @@
 #include <vm.h>
 #include <spinlock.h>
 #include <synch.h>
-#include "opt-dumbvm.h"
+#include <mips/tlb.h>
 
 struct vnode;
 
@@ -53,24 +53,74 @@ struct vnode;
 #define L1_INDEX(vaddr) (VPN(vaddr) >> 10)
 #define L2_INDEX(vaddr) (VPN(vaddr) & 0x3FF)
 
-/* Page table entry structure - each entry is 32 bits */
+/*
+ * Page table entry structure.
+ *
+ * pte_fast is the entry in TLB EntryLo format when the page is
+ * resident and can be mapped without running any C code (the dirty
+ * bit is included exactly when a write may proceed directly), and 0
+ * whenever a fault on the page needs the full vm_fault path. It is
+ * what the assembly TLB refill handler reads; keep it in sync with
+ * pte_sync_fast below after changing any other field.
+ *
+ * The field offsets of pte_fast (0) and referenced (13) are
+ * hardcoded in the refill handler in exception-mips1.S, as is the
+ * total entry size (20); change them together.
+ */
 struct pte {
+	uint32_t pte_fast;	/* Precomputed EntryLo; 0 = take slow path */
 	uint32_t pfn;	/* Physical frame number when in RAM */
 	uint32_t swap_slot;	/* Swap slot number when swapped */
 	uint8_t state : 2;	/* UNALLOC/ZERO/RAM/SWAP */
 	uint8_t dirty : 1;	/* Set when page is modified */
 	uint8_t readonly : 1;	/* Set for read-only pages */
-	uint8_t referenced : 1;	/* Set when page is accessed */
-	uint8_t _padding : 3;	/* Unused padding bits for alignment */
-	struct lock *pte_lock;	/* Lock for this specific page table entry */
+	uint8_t cow : 1;	/* Shared copy-on-write; write faults copy */
+	uint8_t shm : 1;	/* Shared-memory page; fork shares, never COW */
+	uint8_t wired : 1;	/* mlocked; resident and never evicted */
+	uint8_t busy : 1;	/* Page-in I/O in flight, PTE lock dropped */
+	uint8_t referenced;	/* Set on access; own byte so the asm
+				   refill handler can store to it */
+	struct lock *pte_lock;	/* PTE lock; shared by the whole L2 node */
 };
 
+/*
+ * Recompute pte_fast from the other fields; call (with the PTE lock
+ * held) after any change to state, pfn, readonly, or cow. Read-only
+ * and copy-on-write pages are fast-mappable without the dirty bit,
+ * so their first write still takes the modify fault into vm_fault.
+ */
+static
+inline
+void
+pte_sync_fast(struct pte *pte)
+{
+	if (pte->state == PTE_STATE_RAM) {
+		pte->pte_fast = (pte->pfn << 12) | TLBLO_VALID;
+		if (!pte->readonly && !pte->cow) {
+			pte->pte_fast |= TLBLO_DIRTY;
+		}
+	}
+	else {
+		pte->pte_fast = 0;
+	}
+}
+
 /* Size of first and second level page tables */
 #define PT_L1_SIZE 1024 /* 10 bits -> 4 KiB L1 table */
 #define PT_L2_SIZE 1024 /* 10 bits -> 4 KiB L2 page */
 
-/* Number of pages in user stack */
+/*
+ * User stack sizing. STACKPAGES is the initial window mapped at exec
+ * time; the stack then grows on demand as faults land just below the
+ * mapped region (see as_grow_stack), down to at most STACKPAGES_MAX
+ * pages. Addresses below the cap are never part of the stack, so at
+ * least STACKGUARDPAGES of unmapped gap always separate the deepest
+ * possible stack from anything mapped beneath it, and runaway
+ * recursion faults instead of silently walking into other mappings.
+ */
 #define STACKPAGES 18 /* 16 pages = 64KB, 2 extra pages to allow 64KB argv in the tests */
+#define STACKPAGES_MAX 256	/* growth cap: 1 MB of stack */
+#define STACKGUARDPAGES 4	/* unmapped gap kept below the cap */
 
 /* Region flags */
 struct region {
@@ -79,7 +129,24 @@ struct region {
 	int readable; /* Read permission */
 	int writeable; /* Write permission */
 	int executable; /* Execute permission */
-	struct region *next; /* Next region in linked list */
+
+	/*
+	 * File backing for demand paging. Set for ELF segments; the
+	 * vnode is held (referenced) for the life of the region.
+	 * backing_offset is the file offset corresponding to vbase;
+	 * backing_filesize is how many bytes starting at vbase come
+	 * from the file (the rest is zero-fill/bss).
+	 */
+	struct vnode *backing_vn; /* executable vnode, or NULL */
+	off_t backing_offset; /* file offset of vbase */
+	size_t backing_filesize; /* file bytes from vbase */
+
+	/*
+	 * Access-pattern advice from madvise: MADV_SEQUENTIAL makes
+	 * the fault path prefetch ahead of file-backed faults;
+	 * anything else (the default 0, MADV_NORMAL) doesn't.
+	 */
+	int advice;
 };
 
 /*
@@ -87,36 +154,107 @@ struct region {
  * space of a process.
  */
 struct addrspace {
-#if OPT_DUMBVM
-        vaddr_t as_vbase1;
-        paddr_t as_pbase1;
-        size_t as_npages1;
-        vaddr_t as_vbase2;
-        paddr_t as_pbase2;
-        size_t as_npages2;
-        paddr_t as_stackpbase;
-#else
-		/* Two-level page table - dynamically allocated */
-		struct pte **pt_l1; /* First level page table */
-
-		/* List of memory regions */
-		struct region *regions;
-
-		/* Heap management */
-		vaddr_t heap_start; /* Start address of heap */
-		vaddr_t heap_end; /* Current end address of heap (break) */
-
-		/* Lock for page table operations */
-		struct spinlock pt_lock;
-#endif
+	/* Link for the deferred-destroy queue (see asreaper in proc.c) */
+	struct addrspace *as_reapnext;
+	/* Two-level page table - dynamically allocated */
+	struct pte **pt_l1; /* First level page table */
+
+	/*
+	 * Memory regions, sorted by vbase in a resizable
+	 * array so the fault path can binary-search them.
+	 * as_lastreg caches the index of the last region a
+	 * lookup hit; faults cluster by region, so most
+	 * lookups are one compare. (It's advisory: races just
+	 * cost a search.)
+	 */
+	struct region *regions; /* sorted array */
+	unsigned nregions; /* entries in use */
+	unsigned regionsmax; /* array capacity */
+	unsigned as_lastreg; /* last-hit cache */
+
+	/* Heap management */
+	vaddr_t heap_start; /* Start address of heap */
+	vaddr_t heap_end; /* Current end address of heap (break) */
+
+	/*
+	 * Lowest mapped stack address; USERSTACK is the top.
+	 * Moves down (under pt_lock) as the stack grows on
+	 * demand in as_grow_stack. 0 if no stack is defined.
+	 */
+	vaddr_t as_stackbase;
+
+	/* Lock for page table operations */
+	struct spinlock pt_lock;
+
+	/*
+	 * Per-CPU address space ID, as last assigned by
+	 * vm_asid_activate; 0 means none. Written only by the
+	 * owning CPU under the ASID lock in vm.c.
+	 */
+	uint8_t as_asid[VM_MAXCPUS];
+
+	/* Arena chunks backing the page-table nodes (ptarena.c) */
+	struct ptarena *as_ptchunks;
+
+	/*
+	 * Paging counters for __getvmstats (kern/vmstat.h).
+	 * Updated without locking by the fault and eviction
+	 * paths, like the global vmstat counters: indicative,
+	 * not exact.
+	 */
+	uint32_t as_faults; /* vm_fault entries */
+	uint32_t as_cowfaults; /* copy-on-write breaks */
+	uint32_t as_swapins; /* pages read back from swap */
+	uint32_t as_evictions; /* pages evicted to swap */
+	uint32_t as_swapslots; /* swap slots currently held */
+
+	/*
+	 * Pages charged against the commit limit (see
+	 * vm_commit_charge), given back in one piece by
+	 * as_destroy. Changed only by the owning process
+	 * (region setup, sbrk), so no extra locking.
+	 */
+	size_t as_commit;
+
+	/*
+	 * Pages wired by mlock, counted against
+	 * MLOCK_MAXPAGES. Changed only by the owning process
+	 * under the PTE locks, like the wired bits
+	 * themselves. Wirings are not inherited by fork.
+	 */
+	unsigned as_wiredpages;
 };
 
 /*
  * Functions to manage page tables
  */
 struct pte *pt_get_pte(struct addrspace *as, vaddr_t vaddr, bool create);
+
+/*
+ * Wait until no page-in I/O is in flight on PTE (see the busy bit
+ * above and the swap-in path in vm_fault). Call with the PTE lock
+ * held before interpreting or changing the entry's state; the lock is
+ * dropped and retaken while waiting. In vm.c.
+ */
+void pte_pagein_wait(struct pte *pte);
 int pt_alloc_l2(struct addrspace *as, int l1_index);
 
+/*
+ * Arena allocator for page-table nodes (ptarena.c). Nodes are
+ * page-aligned, bump-allocated from chunks the address space owns,
+ * and all freed together by ptarena_destroy in as_destroy.
+ */
+struct ptarena;
+void *ptarena_alloc(struct addrspace *as, size_t sz);
+void ptarena_destroy(struct addrspace *as);
+
+/*
+ * Find the region containing VADDR, or NULL. Binary search plus the
+ * last-hit cache; pointers returned are invalidated by the next
+ * as_define_region call.
+ */
+struct region *as_find_region(struct addrspace *as, vaddr_t vaddr);
+
 /*
  * Functions in addrspace.c:
  *
@@ -153,9 +291,6 @@ int pt_alloc_l2(struct addrspace *as, int l1_index);
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
- *
- * Note that when using dumbvm, addrspace.c is not used and these
- * functions are found in dumbvm.c.
  */
 
 struct addrspace *as_create(void);
@@ -173,6 +308,46 @@ int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+/*
+ * Grow the stack region down to cover FAULTADDRESS (page-aligned).
+ * Called from vm_fault; EFAULT past the cap, ENOMEM if the growth
+ * would exceed the commit limit.
+ */
+int               as_grow_stack(struct addrspace *as, vaddr_t faultaddress);
+
+/*
+ * Remove the region whose base and size match VADDR/SZ exactly,
+ * releasing its frames (with batched TLB shootdown), swap slots,
+ * commit charge, and file backing reference. EINVAL if no such
+ * region. Used by munmap and for backing out failed attachments.
+ */
+int as_undefine_region(struct addrspace *as, vaddr_t vaddr, size_t sz);
+
+/*
+ * Release the frames and swap slots behind NPAGES pages at VADDR
+ * without touching the region list or commit charge; the next touch
+ * zero-fills or refills from backing. Used by madvise(MADV_DONTNEED).
+ */
+void as_drop_pages(struct addrspace *as, vaddr_t vaddr, size_t npages);
+
+/*
+ * Attach file backing to the region containing VADDR, so its pages
+ * fault in from the executable instead of being loaded eagerly.
+ * Takes a reference on VN. OFFSET/FILESIZE describe the segment as
+ * in its ELF program header (relative to VADDR, not the page-aligned
+ * region base).
+ */
+int as_set_region_backing(struct addrspace *as, vaddr_t vaddr,
+                          struct vnode *vn, off_t offset, size_t filesize);
+
+/*
+ * Look up file backing for the page at VADDR. Returns true and fills
+ * in the vnode, file offset, and number of valid file bytes for that
+ * page if it has any; false for anonymous or pure-bss pages.
+ */
+bool as_page_backing(struct addrspace *as, vaddr_t vaddr,
+                     struct vnode **vn, off_t *offset, size_t *len);
+
 
 /*
  * Functions in loadelf.c
@@ -126,6 +126,93 @@ array_add(struct array *a, void *val, unsigned *index_ret)
 	return 0;
 }
 
+/*
+ * Inline-storage array (resizeable array of fixed-size elements stored
+ * contiguously) and operations.
+ *
+ * This is the by-value counterpart of struct array above. Where struct
+ * array holds void pointers to elements allocated elsewhere, struct
+ * valarray holds the elements themselves in one allocation, so walking
+ * it touches consecutive memory instead of chasing a pointer per
+ * element. The operations mirror the pointer array's, except that each
+ * takes the element size and that get returns a pointer into the
+ * array's own storage.
+ *
+ * Caveats that don't apply to the pointer array:
+ *
+ *    - Pointers returned by get (and stored by callers) are
+ *      invalidated when the array grows via preallocate, setsize, or
+ *      add, and by remove, which slides later elements down. Only use
+ *      this for elements that nothing else holds a long-term pointer
+ *      to; identity objects (threads, vnodes, cpus) don't qualify.
+ *
+ *    - set and add copy *VAL into the array rather than storing VAL.
+ */
+
+struct valarray {
+	void *v;
+	unsigned num, max;
+};
+
+struct valarray *valarray_create(void);
+void valarray_destroy(struct valarray *);
+void valarray_init(struct valarray *);
+void valarray_cleanup(struct valarray *);
+ARRAYINLINE unsigned valarray_num(const struct valarray *);
+ARRAYINLINE void *valarray_get(const struct valarray *, size_t elemsize,
+			       unsigned index);
+ARRAYINLINE void valarray_set(struct valarray *, size_t elemsize,
+			      unsigned index, const void *val);
+int valarray_preallocate(struct valarray *, size_t elemsize, unsigned num);
+int valarray_setsize(struct valarray *, size_t elemsize, unsigned num);
+ARRAYINLINE int valarray_add(struct valarray *, size_t elemsize,
+			     const void *val, unsigned *index_ret);
+void valarray_remove(struct valarray *, size_t elemsize, unsigned index);
+
+/*
+ * Inlining for base valarray operations
+ */
+
+ARRAYINLINE unsigned
+valarray_num(const struct valarray *a)
+{
+	return a->num;
+}
+
+ARRAYINLINE void *
+valarray_get(const struct valarray *a, size_t elemsize, unsigned index)
+{
+	ARRAYASSERT(index < a->num);
+	return (char *)a->v + index*elemsize;
+}
+
+ARRAYINLINE void
+valarray_set(struct valarray *a, size_t elemsize, unsigned index,
+	     const void *val)
+{
+	ARRAYASSERT(index < a->num);
+	memcpy((char *)a->v + index*elemsize, val, elemsize);
+}
+
+ARRAYINLINE int
+valarray_add(struct valarray *a, size_t elemsize, const void *val,
+	     unsigned *index_ret)
+{
+	unsigned index;
+	int ret;
+
+	index = a->num;
+	ret = valarray_setsize(a, elemsize, index+1);
+	if (ret) {
+		return ret;
+	}
+	memcpy((char *)a->v + index*elemsize, val, elemsize);
+	if (index_ret != NULL) {
+		*index_ret = index;
+	}
+	return 0;
+}
+
 /*
  * Bits for declaring and defining typed arrays.
  *
@@ -163,6 +250,14 @@ array_add(struct array *a, void *val, unsigned *index_ret)
  *
  * The operations on typed arrays are the same as the operations on
  * the base array, except typed.
+ *
+ * DECLVALARRAY_BYTYPE, DECLVALARRAY, DEFVALARRAY_BYTYPE, and
+ * DEFVALARRAY are the corresponding macros for inline-storage arrays;
+ * DECLVALARRAY(foo) declares "struct foovalarray", an array of "struct
+ * foo" elements stored by value. The typed operations supply the
+ * element size, so they have the same signatures as the pointer
+ * array's, except that get returns a pointer into the array's storage
+ * and set/add copy *VAL. The pointer-invalidation caveats above apply.
  */
 
 #define DECLARRAY_BYTYPE(ARRAY, T, INLINE) \
@@ -258,6 +353,101 @@ array_add(struct array *a, void *val, unsigned *index_ret)
 #define DECLARRAY(T, INLINE) DECLARRAY_BYTYPE(T##array, struct T, INLINE)
 #define DEFARRAY(T, INLINE) DEFARRAY_BYTYPE(T##array, struct T, INLINE)
 
+#define DECLVALARRAY_BYTYPE(ARRAY, T, INLINE) \
+	struct ARRAY {						\
+		struct valarray varr;				\
+	};							\
+								\
+	INLINE struct ARRAY *ARRAY##_create(void);		\
+	INLINE void ARRAY##_destroy(struct ARRAY *a);		\
+	INLINE void ARRAY##_init(struct ARRAY *a);		\
+	INLINE void ARRAY##_cleanup(struct ARRAY *a);		\
+	INLINE unsigned ARRAY##_num(const struct ARRAY *a);	\
+	INLINE T *ARRAY##_get(const struct ARRAY *a, unsigned index); \
+	INLINE void ARRAY##_set(struct ARRAY *a, unsigned index, const T *val); \
+	INLINE int ARRAY##_preallocate(struct ARRAY *a, unsigned num);	\
+	INLINE int ARRAY##_setsize(struct ARRAY *a, unsigned num);	\
+	INLINE int ARRAY##_add(struct ARRAY *a, const T *val, unsigned *index_ret); \
+	INLINE void ARRAY##_remove(struct ARRAY *a, unsigned index)
+
+#define DEFVALARRAY_BYTYPE(ARRAY, T, INLINE) \
+	INLINE struct ARRAY *					\
+	ARRAY##_create(void)					\
+	{							\
+		struct ARRAY *a = kmalloc(sizeof(*a));		\
+		if (a == NULL) {				\
+			return NULL;				\
+		}						\
+		valarray_init(&a->varr);			\
+		return a;					\
+	}							\
+								\
+	INLINE void						\
+	ARRAY##_destroy(struct ARRAY *a)			\
+	{							\
+		valarray_cleanup(&a->varr);			\
+		kfree(a);					\
+	}							\
+								\
+	INLINE void						\
+	ARRAY##_init(struct ARRAY *a)				\
+	{							\
+		valarray_init(&a->varr);			\
+	}							\
+								\
+	INLINE void						\
+	ARRAY##_cleanup(struct ARRAY *a)			\
+	{							\
+		valarray_cleanup(&a->varr);			\
+	}							\
+								\
+	INLINE unsigned						\
+	ARRAY##_num(const struct ARRAY *a)			\
+	{							\
+		return valarray_num(&a->varr);			\
+	}							\
+								\
+	INLINE T *						\
+	ARRAY##_get(const struct ARRAY *a, unsigned index)	\
+	{							\
+		return (T *)valarray_get(&a->varr, sizeof(T), index); \
+	}							\
+								\
+	INLINE void						\
+	ARRAY##_set(struct ARRAY *a, unsigned index, const T *val) \
+	{							\
+		valarray_set(&a->varr, sizeof(T), index, val);	\
+	}							\
+								\
+	INLINE int						\
+	ARRAY##_preallocate(struct ARRAY *a, unsigned num)	\
+	{							\
+		return valarray_preallocate(&a->varr, sizeof(T), num); \
+	}							\
+								\
+	INLINE int						\
+	ARRAY##_setsize(struct ARRAY *a, unsigned num)		\
+	{							\
+		return valarray_setsize(&a->varr, sizeof(T), num); \
+	}							\
+								\
+	INLINE int						\
+	ARRAY##_add(struct ARRAY *a, const T *val, unsigned *index_ret) \
+	{							\
+		return valarray_add(&a->varr, sizeof(T), val, index_ret); \
+	}							\
+								\
+	INLINE void						\
+	ARRAY##_remove(struct ARRAY *a, unsigned index)		\
+	{							\
+		valarray_remove(&a->varr, sizeof(T), index);	\
+	}
+
+#define DECLVALARRAY(T, INLINE) \
+	DECLVALARRAY_BYTYPE(T##valarray, struct T, INLINE)
+#define DEFVALARRAY(T, INLINE) \
+	DEFVALARRAY_BYTYPE(T##valarray, struct T, INLINE)
+
 /*
  * This is how you declare an array of strings; it works out as
  * an array of pointers to char.
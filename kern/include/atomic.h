@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2013
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on 32-bit words.
+ *
+ * These are for lock-free code: reference counts, the per-cpu wakeup
+ * rings, statistics that must not be lost. Code that holds a lock
+ * over its updates does not need them (and code that thinks it needs
+ * them should usually try a lock first).
+ *
+ * Memory-order contract:
+ *
+ * The read-modify-write operations (atomic_fetch_add, atomic_xchg,
+ * atomic_cas) are full memory barriers: all memory accesses before
+ * the operation complete before it, and none after it start until it
+ * is done. This holds for atomic_cas whether or not the swap happens.
+ *
+ * atomic_load_acquire performs the load before any memory access
+ * that follows it; use it to read a flag or pointer another cpu
+ * published. atomic_store_release performs the store after every
+ * memory access that precedes it; use it to do the publishing. A
+ * release-store that is read by an acquire-load thus transfers
+ * everything written before the store to the reader. (These replace
+ * the open-coded init/membar_store_store/publish pattern for new
+ * code; the membars remain for ordering between plain accesses.)
+ *
+ * atomic_fetch_add returns the old value; there is no separate
+ * subtract, since adding the two's complement ((uint32_t)-n) is the
+ * same thing. atomic_cas returns the value actually read, so the
+ * swap happened iff the return value equals the expected value.
+ */
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+ATOMIC_INLINE uint32_t atomic_load_acquire(volatile uint32_t *a);
+ATOMIC_INLINE void atomic_store_release(volatile uint32_t *a, uint32_t val);
+ATOMIC_INLINE uint32_t atomic_fetch_add(volatile uint32_t *a, uint32_t n);
+ATOMIC_INLINE uint32_t atomic_xchg(volatile uint32_t *a, uint32_t val);
+ATOMIC_INLINE uint32_t atomic_cas(volatile uint32_t *a,
+				  uint32_t expected, uint32_t newval);
+
+/* Get the implementation. */
+#include <machine/atomic.h>
+
+#endif /* _ATOMIC_H_ */
@@ -38,8 +38,19 @@
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *     bitmap_findrun - locate a run of COUNT contiguous clear bits and
+ *                      return the index of the first, without setting
+ *                      them. First fit, starting from a rotor that
+ *                      bitmap_allocrun advances. Returns ENOSPC if no
+ *                      such run exists.
+ *     bitmap_allocrun - locate a run of COUNT contiguous clear bits,
+ *                      set them all, and return the index of the first.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
+ *     bitmap_markrange - set a range of clear bits, whole words at a
+ *                      time where the range covers them.
+ *     bitmap_unmarkrange - clear a range of set bits, whole words at a
+ *                      time where the range covers them.
  *     bitmap_isset   - return whether a particular bit is set or not.
  *     bitmap_destroy - destroy bitmap.
  */
@@ -50,8 +61,16 @@ struct bitmap;  /* Opaque. */
 struct bitmap *bitmap_create(unsigned nbits);
 void          *bitmap_getdata(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, unsigned *index);
+int            bitmap_findrun(struct bitmap *, unsigned count,
+                              unsigned *index);
+int            bitmap_allocrun(struct bitmap *, unsigned count,
+                               unsigned *index);
 void           bitmap_mark(struct bitmap *, unsigned index);
 void           bitmap_unmark(struct bitmap *, unsigned index);
+void           bitmap_markrange(struct bitmap *, unsigned index,
+                                unsigned count);
+void           bitmap_unmarkrange(struct bitmap *, unsigned index,
+                                  unsigned count);
 int            bitmap_isset(struct bitmap *, unsigned index);
 void           bitmap_destroy(struct bitmap *);
 
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+/*
+ * Process checkpoint and restore.
+ *
+ * checkpoint(path) freezes the calling process into a file: its
+ * memory layout and page contents, its open files (by path, flags,
+ * and offset), and its register state. The "ckrestore" menu command
+ * rebuilds a new process from the file and drops it into user mode
+ * exactly where checkpoint was called; checkpoint returns 0 in the
+ * run that made the file and 1 in every restored run, so a program
+ * can warm itself up once and then be relaunched past the warmup.
+ *
+ * The file is laid out as a header, an array of segment records, an
+ * array of fd records, the trapframe, and then a page-aligned data
+ * area with each segment's pages stored contiguously in address
+ * order. Pages with no content - never touched, or never written and
+ * not file-backed - are left as holes and read back as zeros.
+ *
+ * Restore is lazy where it can be: each ordinary segment is rebuilt
+ * as a region whose file backing is the checkpoint file itself, so
+ * its pages fault in on first touch just like a demand-paged
+ * executable. The stack and the heap can't carry file backing (the
+ * stack region's base moves as it grows, and the heap isn't a
+ * region), so their pages are copied in eagerly at restore time;
+ * both are small next to a warmed data segment.
+ *
+ * What doesn't survive: descriptors with no reopenable path (pipes,
+ * sockets, files opened by relative openat) are skipped, descriptors
+ * that shared one handle come back with separate offsets, the cwd is
+ * the cwd of whoever runs ckrestore, and shared memory doesn't
+ * checkpoint at all (EINVAL). Other threads can't be captured, so
+ * only single-threaded processes may checkpoint.
+ *
+ * See proc/checkpoint.c for the implementation.
+ */
+
+struct trapframe;
+
+/* First word of the file; bump the version when the layout changes. */
+#define CKPT_MAGIC	0x636b7074	/* "ckpt" */
+#define CKPT_VERSION	1
+
+/* Segment kinds. */
+#define CKPT_SEG_REGION	0	/* ordinary region; restored lazily */
+#define CKPT_SEG_STACK	1	/* stack region; pages copied eagerly */
+#define CKPT_SEG_HEAP	2	/* heap pages; copied eagerly */
+
+struct ckpt_header {
+	uint32_t ch_magic;	/* CKPT_MAGIC */
+	uint32_t ch_version;	/* CKPT_VERSION */
+	uint32_t ch_nsegs;	/* segment records that follow */
+	uint32_t ch_nfds;	/* fd records after those */
+	uint32_t ch_tfsize;	/* sizeof(struct trapframe), for sanity */
+	uint32_t ch_dataoff;	/* page-aligned start of the data area */
+	vaddr_t ch_heapstart;	/* heap bounds, restored verbatim */
+	vaddr_t ch_heapend;
+	vaddr_t ch_stackbase;	/* lowest mapped stack address */
+	vaddr_t ch_usertls;	/* thread's TLS base (see settls) */
+	char ch_name[64];	/* process name, for the restored proc */
+};
+
+struct ckpt_seg {
+	uint32_t cs_kind;	/* CKPT_SEG_* */
+	vaddr_t cs_vbase;	/* base virtual address */
+	uint32_t cs_npages;	/* pages in the segment */
+	uint8_t cs_readable;	/* region permissions */
+	uint8_t cs_writeable;
+	uint8_t cs_executable;
+	uint8_t cs_pad;
+	int32_t cs_advice;	/* madvise advice, restored verbatim */
+	uint32_t cs_dataoff;	/* file offset of this segment's pages */
+};
+
+struct ckpt_fd {
+	int32_t cf_fd;		/* descriptor number */
+	int32_t cf_flags;	/* open flags (fh_flags) */
+	int32_t cf_fdflags;	/* descriptor flags (fd_flags) */
+	int32_t cf_advice;	/* FADV_* hint (fh_advice) */
+	off_t cf_offset;	/* file position */
+	char cf_path[PATH_MAX];	/* path to reopen */
+};
+
+/*
+ * Write the calling process's state to PATH. TF is the trapframe of
+ * the checkpoint syscall itself; a restored process resumes from it.
+ */
+int checkpoint_save(char *path, struct trapframe *tf);
+
+/*
+ * Rebuild a process from the file at PATH. Must be called from a
+ * fresh thread in a fresh process (see cmd_ckrestore in menu.c);
+ * enters user mode and does not return on success.
+ */
+int checkpoint_restore(char *path);
+
+#endif /* _CHECKPOINT_H_ */
@@ -48,17 +48,76 @@
 void hardclock_bootstrap(void);
 void hardclock(void);
 
+/*
+ * Tickless idle support. timer_idleticks() reports how many whole
+ * hardclocks this cpu may skip while idle without missing a timer
+ * wheel deadline (at most HZ, i.e. one second); cpu_idle uses it to
+ * program the hardware timer past the regular tick. When the skip
+ * ends, the skipped ticks are credited with hardclock_catchup(),
+ * which advances c_hardclocks and, on the boot cpu, the timer wheel.
+ * The periodic scheduler work skipped along the way is work an idle
+ * cpu had none of.
+ */
+uint32_t timer_idleticks(void);
+void hardclock_catchup(uint32_t nticks);
+
 /*
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
  */
 void timerclock(void);
 
+/*
+ * Timer callouts, with hardclock-tick resolution. Timers live on a
+ * hashed timer wheel driven from hardclock() on the boot CPU.
+ *
+ * Embed a struct timer in your own structure (or put it on the stack)
+ * and set it up with timer_init; only tm_func and tm_data are yours
+ * to look at, the rest belongs to the wheel. Callbacks run in
+ * interrupt context on the boot CPU and so must not sleep.
+ *
+ * init		Prepare a timer. FUNC is called with the timer and DATA
+ *		when the timer expires.
+ * arm		Schedule the timer to fire TICKS hardclocks from now
+ *		(at least one tick). The timer must not already be armed.
+ * cancel	Unschedule the timer. Returns true if it was armed and
+ *		the callback will now not run; false if it already fired
+ *		or was never armed. Does not wait for a callback that is
+ *		currently running on another CPU.
+ * now		Return the current tick count (ticks since boot).
+ */
+struct timer {
+	struct timer *tm_next;	/* Next timer in wheel bucket (internal) */
+	struct timer *tm_prev;	/* Previous timer in bucket (internal) */
+	uint64_t tm_expiry;	/* Absolute expiry tick (internal) */
+	void (*tm_func)(struct timer *, void *); /* Expiry callback */
+	void *tm_data;		/* Argument for the callback */
+	bool tm_armed;		/* True while on the wheel (internal) */
+};
+
+void timer_init(struct timer *tm,
+		void (*func)(struct timer *, void *), void *data);
+void timer_arm(struct timer *tm, uint32_t ticks);
+bool timer_cancel(struct timer *tm);
+uint64_t timer_now(void);
+
 /*
  * gettime() may be used to fetch the current time of day.
  */
 void gettime(struct timespec *ret);
 
+/*
+ * Monotonic high-resolution time, for benchmarks and instrumentation.
+ * cycles() counts processor cycles since boot; nanotime() is the same
+ * clock converted to a timespec. Unlike the wall time from gettime(),
+ * which comes from the real-time clock device and costs a bus access,
+ * these read the on-chip cycle counter, never go backwards, and are
+ * cheap enough for hot paths. Timestamps are monotonic on each cpu
+ * but only approximately comparable across cpus.
+ */
+uint64_t cycles(void);
+void nanotime(struct timespec *ret);
+
 /*
  * arithmetic on times
  *
@@ -50,6 +50,16 @@
  * returns the actual length of string found in GOT. DEST is always
  * null-terminated on success. LEN and GOT include the null terminator.
  *
+ * copyinv and copyoutv are scatter/gather versions of copyin and
+ * copyout for uiomove: they copy LEN bytes between a kernel buffer
+ * and the user-side segments described by IOV/IOVCNT, validating all
+ * the user address ranges and setting up fault recovery once for the
+ * whole transfer instead of once per segment. The last segment used
+ * may be only partially filled; LEN must not exceed the total length
+ * of the segments. On EFAULT an unspecified amount of data may have
+ * been transferred; callers are expected to abandon the transfer, as
+ * callers of plain copyin/copyout do.
+ *
  * All of these functions return 0 on success, EFAULT if a memory
  * addressing error was encountered, or (for the string versions)
  * ENAMETOOLONG if the space available was insufficient.
@@ -64,8 +74,13 @@
  * vm/copyinout.c.
  */
 
+struct iovec; /* from kern/iovec.h */
+
 int copyin(const_userptr_t usersrc, void *dest, size_t len);
 int copyout(const void *src, userptr_t userdest, size_t len);
+int copyinv(const struct iovec *iov, unsigned iovcnt, void *dest, size_t len);
+int copyoutv(const void *src, const struct iovec *iov, unsigned iovcnt,
+	     size_t len);
 int copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *got);
 int copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *got);
 
@@ -33,10 +33,46 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <percpu.h>      /* for PERCPU_CACHELINE */
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 extern unsigned num_cpus;
 
+struct wchan; /* from wchan.h */
+
+/*
+ * Number of run queue priority levels compiled in. The number
+ * actually in use is the (runtime-settable) sched_numprios; see
+ * schedule() in thread.c. Queue 0 is the highest priority.
+ */
+#define SCHED_NUMPRIOS_MAX 8
+
+/* Capacity of each cpu's cache of retired thread/stack pairs. */
+#define THREADCACHE_MAX 4
+
+/* Slots in the remote-wakeup ring. Must be a power of 2. */
+#define WAKEUPRING_SIZE 16
+
+/*
+ * Buckets in the run-queue depth histogram; the last bucket collects
+ * all depths of SCHEDSTAT_NUMDEPTHS-1 or more.
+ */
+#define SCHEDSTAT_NUMDEPTHS 8
+
+/*
+ * Scheduler statistics, one set per cpu. Written only by the owning
+ * cpu (from thread_switch and the clock interrupt); read unlocked and
+ * possibly stale by the schedstat menu command, which is fine for
+ * statistics.
+ */
+struct schedstat {
+	unsigned ss_switches;	/* Context switches completed */
+	unsigned ss_preempts;	/* Of those, requeued still-runnable */
+	unsigned ss_steals;	/* Threads stolen from other cpus */
+	unsigned ss_waitticks;	/* Total ticks from runnable to dispatch */
+	unsigned ss_depths[SCHEDSTAT_NUMDEPTHS]; /* Depth samples, per tick */
+};
+
 /*
  * Per-cpu structure
  *
@@ -61,16 +97,65 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	bool c_insoftirq;		/* True inside softirq_dispatch */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct schedstat c_schedstat;	/* Scheduler statistics */
+	void *c_percpu;			/* Per-cpu data area (percpu.h) */
+
+	/*
+	 * The reaper thread for this cpu sleeps on c_reapwchan and
+	 * drains c_zombies when poked from thread_switch. It is
+	 * pinned here, so these are used only by this cpu too.
+	 */
+	struct wchan *c_reapwchan;	/* Where the reaper sleeps */
+	struct spinlock c_reaplock;	/* Guards the above */
+	bool c_hasreaper;		/* True once the reaper runs */
+
+	/*
+	 * Retired thread/stack pairs cached for reuse by
+	 * thread_fork. Mostly used by this cpu, but locked so
+	 * thread_wait_for_count can drain all the caches.
+	 */
+	struct thread *c_threadcache[THREADCACHE_MAX];
+	unsigned c_nthreadcache;
+	struct spinlock c_threadcache_lock;
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * This section starts on its own cacheline: c_isidle is polled
+	 * by every cpu looking for an idle target in
+	 * thread_make_runnable, and without the padding it shares a
+	 * line with the owner-written fields above (c_hardclocks and
+	 * the schedstat counters are updated every tick), so each tick
+	 * would yank the line away from the pollers.
 	 */
-	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	bool c_isidle __ALIGNED(PERCPU_CACHELINE);
+					/* True if this cpu is idle */
+
+	/* Per-priority run queues for this cpu; index 0 is highest */
+	struct threadlist c_runqueue[SCHED_NUMPRIOS_MAX];
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Remote wakeup ring. Other cpus making one of our threads
+	 * runnable publish it here lock-free instead of bouncing our
+	 * runqueue lock's cacheline; we drain it into the runqueue
+	 * ourselves at each context switch. Producers claim slots by
+	 * compare-and-swap on c_wakeup_head; c_wakeup_tail is
+	 * advanced only by us. See sched_wakeup_enqueue in thread.c.
+	 *
+	 * The ring gets a cacheline of its own so producers hammering
+	 * c_wakeup_head don't contend with the runqueue lock above,
+	 * and c_wakeup_tail gets one so our tail advances don't bounce
+	 * the producers' head line back either.
+	 */
+	struct thread * volatile c_wakeups[WAKEUPRING_SIZE]
+					__ALIGNED(PERCPU_CACHELINE);
+	volatile spinlock_data_t c_wakeup_head;
+	volatile spinlock_data_t c_wakeup_tail __ALIGNED(PERCPU_CACHELINE);
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -84,11 +169,19 @@ struct cpu {
 	 * dependent and might reasonably be either an address space
 	 * and vaddr pair, or a paddr, or something else.
 	 */
-	uint32_t c_ipi_pending;		/* One bit for each IPI number */
+	uint32_t c_ipi_pending __ALIGNED(PERCPU_CACHELINE);
+					/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	unsigned c_numshootdown;
 	struct spinlock c_ipi_lock;
 
+	/*
+	 * Pending softirq bits (softirq.h). Lives with the IPI block
+	 * rather than the private fields because steered softirqs are
+	 * marked pending by other cpus; updated with atomic ops.
+	 */
+	volatile uint32_t c_softirq_pending;
+
 	/*
 	 * Accessed by other cpus. Protected inside hangman.c.
 	 */
@@ -110,6 +203,12 @@ struct cpu {
  */
 struct cpu *cpu_create(unsigned hardware_number);
 void cpu_machdep_init(struct cpu *);
+
+/*
+ * Look up a cpu by its software number (boot order, c_number).
+ * Returns NULL if no such cpu. For affinity and interrupt steering.
+ */
+struct cpu *cpu_getbynumber(unsigned cpunum);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
@@ -126,6 +225,14 @@ void cpu_identify(char *buf, size_t max);
 void cpu_irqoff(void);
 void cpu_irqon(void);
 
+/*
+ * Read the current CPU's free-running cycle counter. Only deltas are
+ * meaningful, and (on platforms where the timer interrupt reloads
+ * the counter, like System/161) only deltas taken with interrupts
+ * off on this CPU. Used by the lock contention profiler.
+ */
+uint32_t cpu_cyclecount(void);
+
 /*
  * Idle or shut down (respectively) the processor.
  *
@@ -156,6 +263,13 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_batch queues several shootdowns on the target with
+ * a single IPI; if the queue overflows it collapses to one whole-TLB
+ * flush request instead of panicking.
+ * ipi_tlbshootdown_broadcast sends one batch IPI to every other CPU
+ * that might hold TLB entries for the affected address space(s), as
+ * judged by vm_tlbshootdown_needed(), and waits for the targets to
+ * drain their queues so the mappings are dead when it returns.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,10 +280,15 @@ void cpu_halt(void);
 #define IPI_OFFLINE		1	/* CPU is requested to go offline */
 #define IPI_UNIDLE		2	/* Runnable threads are available */
 #define IPI_TLBSHOOTDOWN	3	/* MMU mapping(s) need invalidation */
+#define IPI_SOFTIRQ		4	/* A softirq was steered to this cpu */
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_batch(struct cpu *target,
+			    const struct tlbshootdown *mappings, unsigned n);
+void ipi_tlbshootdown_broadcast(const struct tlbshootdown *mappings,
+				unsigned n);
 
 void interprocessor_interrupt(void);
 
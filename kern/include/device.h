@@ -56,11 +56,14 @@ struct device {
  *      devop_eachopen - called on each open call to allow denying the open
  *      devop_io - for both reads and writes (the uio indicates the direction)
  *      devop_ioctl - miscellaneous control operations
+ *      devop_poll - report which I/O would not block, as per vop_poll;
+ *                   devices without waiting I/O can use dev_poll_always
  */
 struct device_ops {
 	int (*devop_eachopen)(struct device *, int flags_from_open);
 	int (*devop_io)(struct device *, struct uio *);
 	int (*devop_ioctl)(struct device *, int op, userptr_t data);
+	int (*devop_poll)(struct device *, int events, int *revents);
 };
 
 /*
@@ -69,6 +72,10 @@ struct device_ops {
 #define DEVOP_EACHOPEN(d, f)	((d)->d_ops->devop_eachopen(d, f))
 #define DEVOP_IO(d, u)		((d)->d_ops->devop_io(d, u))
 #define DEVOP_IOCTL(d, op, p)	((d)->d_ops->devop_ioctl(d, op, p))
+#define DEVOP_POLL(d, ev, rev)	((d)->d_ops->devop_poll(d, ev, rev))
+
+/* devop_poll for devices that never block: reports everything ready. */
+int dev_poll_always(struct device *dev, int events, int *revents);
 
 
 /* Create vnode for a vfs-level device. */
@@ -45,6 +45,7 @@ struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+	struct emu_file *ev_file;	/* driver per-file state (files only) */
 };
 
 struct emufs_fs {
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HASHTABLE_H_
+#define _HASHTABLE_H_
+
+#include <spinlock.h>
+
+/*
+ * Chained hash table, intrusive style: objects that live in a table
+ * embed a struct hashlink and the table links those together, so
+ * insertion and removal never allocate. Like threadlistnode, the
+ * link carries a self pointer back to the containing object, set by
+ * hashlink_init, because doing offsetof arithmetic on lookup results
+ * is gross.
+ *
+ * The caller hashes its own keys (the hash32_* helpers below cover
+ * the common cases; an integer key that is already well spread can
+ * be its own hash) and passes the full 32-bit hash in. The table
+ * keeps it in the link, both to pick the bucket and as a cheap
+ * filter before the match callback runs.
+ *
+ * Concurrency: operations take one of a fixed set of bucket locks
+ * (each bucket maps to exactly one; buckets are power-of-two and at
+ * least HASHTABLE_NUMLOCKS, so the low bits of the hash pick both),
+ * so operations on different buckets mostly don't contend and none
+ * of add/remove/find/iterate ever sleeps. hashtable_setsize takes
+ * every bucket lock, and allocates, so it can block everything
+ * briefly and may only be called from thread context.
+ */
+
+struct hashlink {
+	struct hashlink *hl_next;	/* bucket chain */
+	uint32_t hl_hash;		/* full hash of this entry's key */
+	void *hl_self;			/* the containing object */
+};
+
+/* Number of bucket locks; buckets share them cyclically. */
+#define HASHTABLE_NUMLOCKS 16
+
+struct hashtable {
+	struct hashlink **ht_buckets;	/* ht_mask+1 chain heads */
+	uint32_t ht_mask;		/* number of buckets - 1 */
+	volatile uint32_t ht_count;	/* entries in the table */
+	struct spinlock ht_locks[HASHTABLE_NUMLOCKS];
+};
+
+/* Initialize a link; SELF is the object the link is embedded in. */
+void hashlink_init(struct hashlink *hl, void *self);
+void hashlink_cleanup(struct hashlink *hl);
+
+/*
+ * Create and destroy a table. NUMBUCKETS must be a power of two, at
+ * least HASHTABLE_NUMLOCKS. The table must be empty at destroy.
+ */
+struct hashtable *hashtable_create(uint32_t numbuckets);
+void hashtable_destroy(struct hashtable *ht);
+
+/* Number of entries. From outside the locks this is a snapshot. */
+uint32_t hashtable_count(const struct hashtable *ht);
+
+/*
+ * Add HL, whose key hashes to HASH. Duplicate keys are the caller's
+ * problem: the table happily stores them, and find returns one.
+ */
+void hashtable_add(struct hashtable *ht, struct hashlink *hl, uint32_t hash);
+
+/* Remove HL, which must be in the table. */
+void hashtable_remove(struct hashtable *ht, struct hashlink *hl);
+
+/*
+ * Find an entry whose key hashes to HASH and for which MATCH returns
+ * true, or return NULL. MATCH runs with the bucket lock held: it
+ * must not sleep and must not operate on the table.
+ */
+struct hashlink *hashtable_find(struct hashtable *ht, uint32_t hash,
+				bool (*match)(const struct hashlink *hl,
+					      const void *key),
+				const void *key);
+
+/*
+ * Call FUNC on every entry, in no particular order, until it returns
+ * false. Same rules as MATCH: bucket lock held, no sleeping, no
+ * table operations (including removing the entry passed in).
+ */
+void hashtable_iterate(struct hashtable *ht,
+		       bool (*func)(struct hashlink *hl, void *ctx),
+		       void *ctx);
+
+/*
+ * Grow (or shrink) to NUMBUCKETS buckets, rehashing every entry.
+ * Returns ENOMEM if the new bucket array can't be allocated, leaving
+ * the table as it was. A table is worth growing when hashtable_count
+ * exceeds a couple times the bucket count.
+ */
+int hashtable_setsize(struct hashtable *ht, uint32_t numbuckets);
+
+/*
+ * Hash helpers: FNV-1a over arbitrary bytes or a string, and a
+ * multiplicative scatter for integers whose low bits are biased
+ * (sequential IDs can skip it and be their own hash).
+ */
+uint32_t hash32_buf(const void *buf, size_t len);
+uint32_t hash32_str(const char *s);
+uint32_t hash32_int(uint32_t val);
+
+#endif /* _HASHTABLE_H_ */
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _IOPRI_H_
+#define _IOPRI_H_
+
+/*
+ * I/O priority hint, carried on the current thread (t_iopri) and read
+ * by disk drivers when a request is queued. Lower values are more
+ * urgent.
+ *
+ * The default is IOPRI_NORMAL; paths that know better set the hint
+ * around their I/O and restore the old value afterward. Code that
+ * refines the hint partway through an operation must only ever lower
+ * the urgency it inherited (numerically raise it), so that, say, the
+ * metadata writes done on behalf of a background flush don't jump
+ * ahead of foreground I/O.
+ */
+#define IOPRI_PAGEIN	0	/* a faulting process is blocked on this */
+#define IOPRI_NORMAL	1	/* ordinary synchronous I/O */
+#define IOPRI_META	2	/* filesystem metadata writes */
+#define IOPRI_ASYNC	3	/* background writeback */
+#define IOPRI_NCLASSES	4
+
+#endif /* _IOPRI_H_ */
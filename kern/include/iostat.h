@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _IOSTAT_H_
+#define _IOSTAT_H_
+
+/*
+ * Per-device I/O statistics registry.
+ *
+ * Each device driver embeds a struct iostat in its softc, registers
+ * it once at config time, and bumps the counters on its I/O paths
+ * (under whatever lock the driver already holds there, so the counts
+ * cost nothing extra). The "iostat" menu command dumps every
+ * registered device. The dump reads the counters without taking the
+ * drivers' locks; a report torn across a concurrent update is off by
+ * one operation, which doesn't matter for statistics.
+ */
+
+/* Length of the stored device name, including the NUL. */
+#define IOSTAT_NAMELEN 16
+
+struct iostat {
+	char io_name[IOSTAT_NAMELEN];	/* device name, e.g. "lhd0" */
+	uint64_t io_rops;		/* read operations */
+	uint64_t io_wops;		/* write operations */
+	uint64_t io_rbytes;		/* bytes read */
+	uint64_t io_wbytes;		/* bytes written */
+	struct iostat *io_next;		/* registry link (internal) */
+};
+
+/*
+ * Add IO to the registry under NAME (copied; the caller's buffer may
+ * be transient). IO must never go away; it zeroes the counters.
+ */
+void iostat_register(struct iostat *io, const char *name);
+
+/* Print one line per registered device. */
+void iostat_dump(void);
+
+#endif /* _IOSTAT_H_ */
@@ -49,6 +49,17 @@
 #define O_TRUNC      16      /* Truncate file upon open */
 #define O_APPEND     32      /* All writes happen at EOF (optional feature) */
 #define O_NOCTTY     64      /* Required by POSIX, != 0, but does nothing */
+#define O_NONBLOCK  128      /* I/O that would block fails with EAGAIN */
+#define O_DIRECT    256      /* Bypass fs caching; I/O must be block-aligned */
+
+/*
+ * Advice values for fadvise. (No WILLNEED/DONTNEED; we have no
+ * mechanism for prefetching an arbitrary range on demand.)
+ */
+#define FADV_NORMAL     0    /* no special treatment */
+#define FADV_RANDOM     1    /* expect random access; don't read ahead */
+#define FADV_SEQUENTIAL 2    /* expect sequential access; read further ahead */
+#define FADV_NOREUSE    3    /* data is read once; drop it behind the read */
 
 /* Additional related definition */
 #define O_ACCMODE     3      /* mask for O_RDONLY/O_WRONLY/O_RDWR */
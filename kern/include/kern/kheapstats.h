@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_KHEAPSTATS_H_
+#define _KERN_KHEAPSTATS_H_
+
+/*
+ * Kernel heap telemetry, for returning allocator health via the
+ * __kheapstats() call (and the khstat menu command).
+ *
+ * The subpage allocator in kmalloc.c carves pages into blocks of a
+ * fixed set of sizes ("classes"); allocations too big for that get
+ * whole pages directly. The counters here are kept permanently, not
+ * behind the kmalloc debug switches, so long-running instances can
+ * be watched for slow leaks (a class's live count that only ever
+ * grows) and fragmentation (many pages held, few blocks live).
+ */
+
+/* Number of size classes; must match NSIZES in kmalloc.c. */
+#define KHEAP_NCLASSES 8
+
+struct kheapclassstats {
+	uint32_t ks_size;	/* block size of this class, in bytes */
+	uint32_t ks_live;	/* blocks allocated and not yet freed */
+	uint32_t ks_freeblocks;	/* free blocks on the class's pages */
+	uint32_t ks_pages;	/* pages the class currently owns */
+	uint32_t ks_maxpages;	/* most pages ever owned at once */
+};
+
+struct kheapstats {
+	struct kheapclassstats kh_classes[KHEAP_NCLASSES];
+	uint32_t kh_bigallocs;	/* whole-page allocations, ever */
+	uint32_t kh_bigfrees;	/* whole-page frees, ever */
+	uint32_t kh_bigpages;	/* pages handed to those allocations, ever */
+	uint32_t kh_fragpct;	/* % of subpage heap bytes sitting free */
+};
+
+#endif /* _KERN_KHEAPSTATS_H_ */
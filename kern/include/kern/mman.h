@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Definitions for mmap/munmap, shared with libc's <sys/mman.h>.
+ */
+
+/*
+ * Protection bits. These are requests; the region machinery stores
+ * them as its readable/writeable/executable flags and the fault path
+ * enforces them.
+ */
+#define PROT_NONE	0x0000	/* no access */
+#define PROT_READ	0x0001	/* pages may be read */
+#define PROT_WRITE	0x0002	/* pages may be written */
+#define PROT_EXEC	0x0004	/* pages may be executed */
+
+/*
+ * Mapping flags. Exactly one of MAP_SHARED or MAP_PRIVATE must be
+ * given; only MAP_PRIVATE is supported (for shared anonymous memory
+ * use shmget/shmat, and writing file pages back is not implemented).
+ */
+#define MAP_SHARED	0x0001	/* share changes (not supported) */
+#define MAP_PRIVATE	0x0002	/* changes stay in this process */
+#define MAP_FIXED	0x0004	/* map exactly at the given address */
+#define MAP_ANON	0x0010	/* anonymous zero-fill; fd ignored */
+
+/* Return value of mmap on failure. */
+#define MAP_FAILED	((void *)-1)
+
+/*
+ * Advice for madvise. NORMAL and RANDOM turn readahead off for the
+ * affected regions; SEQUENTIAL turns it on, so a fault on a
+ * file-backed page also prefetches the pages after it. WILLNEED
+ * prefetches the range in the background right away; DONTNEED drops
+ * the range's frames and swap slots without writing anything out
+ * (anonymous pages read back as zeros, file-backed pages refill from
+ * the file).
+ */
+#define MADV_NORMAL	0	/* no special treatment */
+#define MADV_RANDOM	1	/* expect random access */
+#define MADV_SEQUENTIAL	2	/* expect sequential access */
+#define MADV_WILLNEED	3	/* will need this range soon */
+#define MADV_DONTNEED	4	/* don't need this range for a while */
+
+#endif /* _KERN_MMAN_H_ */
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_NET_H_
+#define _KERN_NET_H_
+
+/*
+ * Socket definitions, visible to both the kernel and userland.
+ *
+ * The stack is deliberately minimal: UDP datagrams over IPv4 over
+ * the LAMEbus network card, nothing else. Stations get the address
+ * 10.161.x.y where x.y is their 16-bit hardware address; there is no
+ * ARP, no routing, and no fragmentation, so one datagram fits in one
+ * link frame. socket()/bind()/sendto()/recvfrom() are supported;
+ * close() closes a socket like any other file descriptor.
+ */
+
+/* Address/protocol families. Only AF_INET exists. */
+#define AF_INET		2
+
+/* Socket types. Only SOCK_DGRAM exists. */
+#define SOCK_DGRAM	2
+
+/* Protocols. Only UDP exists; 0 in socket() also means UDP. */
+#define IPPROTO_UDP	17
+
+/* Special addresses. */
+#define INADDR_ANY	0x00000000	/* bind: any local address */
+#define INADDR_BROADCAST 0xffffffff	/* sendto: everyone on the link */
+
+/*
+ * A socket address: IPv4 address and UDP port, both in host byte
+ * order (which on our big-endian hardware is also network byte
+ * order). This takes the place of the Berkeley sockaddr tangle.
+ */
+struct netaddr {
+	uint32_t na_addr;		/* IPv4 address */
+	uint16_t na_port;		/* UDP port */
+	uint16_t na__pad;		/* reserved; set to 0 */
+};
+
+#endif /* _KERN_NET_H_ */
@@ -41,8 +41,8 @@
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
 #define SFS_NINDIRECT     1             /* # of indirect blocks in inode */
-#define SFS_NDINDIRECT    0             /* # of 2x indirect blocks in inode */
-#define SFS_NTINDIRECT    0             /* # of 3x indirect blocks in inode */
+#define SFS_NDINDIRECT    1             /* # of 2x indirect blocks in inode */
+#define SFS_NTINDIRECT    1             /* # of 3x indirect blocks in inode */
 #define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SUPER_BLOCK   0             /* block the superblock lives in */
@@ -74,11 +74,83 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_journalstart;	/* 1st block of metadata journal, or 0 */
+	uint32_t sb_journalblocks;	/* size of the journal region */
+	uint32_t sb_summarystart;	/* 1st block of free-space summary, or 0 */
+	uint32_t sb_summaryblocks;	/* size of the summary region */
+	uint32_t reserved[114];			/* unused, set to 0 */
+};
+
+/*
+ * Metadata journal.
+ *
+ * The journal is a run of blocks reserved out of the ordinary block
+ * pool; its location is recorded in the superblock. Volumes made by
+ * older mksfs have zeros there (the fields were reserved space) and
+ * get a journal carved out on first mount.
+ *
+ * The first block of the region holds the header below; the rest hold
+ * block images. A batch of metadata updates is committed by writing
+ * the images and then the header naming their home block numbers, and
+ * retired, once the images have also reached their home locations, by
+ * writing a header with a count of zero. Recovery after a crash just
+ * replays whatever committed batch the header describes.
+ */
+
+#define SFS_JOURNAL_MAGIC	0x5f4a4e4c	/* journal header id */
+#define SFS_JOURNAL_BLOCKS	33		/* header + 32 block images */
+#define SFS_JOURNAL_MAXRECS	32		/* images per batch */
+
+struct sfs_jheader {
+	uint32_t jh_magic;		/* Should be SFS_JOURNAL_MAGIC */
+	uint32_t jh_sequence;		/* Bumped on every header write */
+	uint32_t jh_count;		/* # committed images; 0 = clean */
+	uint32_t jh_blocks[125];	/* Home block numbers of the images */
+};
+
+/*
+ * Free-space summary.
+ *
+ * Like the journal, the summary is a small run of blocks carved out
+ * of the ordinary block pool and recorded in (formerly reserved)
+ * superblock fields; volumes from older mksfs get one carved out on
+ * first mount. It holds the number of free blocks under each block of
+ * the freemap, so that mount doesn't have to read the whole freemap
+ * to know where the free space is, and a total, so the free-block
+ * tally doesn't have to be recounted.
+ *
+ * The first block of the region holds the header below; the rest hold
+ * the per-freemap-block counts, packed SFS_SUMMARY_PERBLOCK to a
+ * block. The counts are only meaningful while sh_clean is set, which
+ * is only the case when they match the freemap as it is on disk; the
+ * header is rewritten with sh_clean zero before any change to the
+ * freemap is written out, and rewritten clean, counts first, whenever
+ * a sync finishes with no freemap changes pending.
+ */
+
+#define SFS_SUMMARY_MAGIC	0x5f46524d	/* summary header id */
+#define SFS_SUMMARY_PERBLOCK	(SFS_BLOCKSIZE/sizeof(uint16_t))
+
+/* Size of the summary region (in blocks): a header plus the counts */
+#define SFS_SUMMARYBLOCKS(nblocks) \
+	(1 + SFS_ROUNDUP(SFS_FREEMAPBLOCKS(nblocks), \
+			 SFS_SUMMARY_PERBLOCK)/SFS_SUMMARY_PERBLOCK)
+
+struct sfs_sheader {
+	uint32_t sh_magic;		/* Should be SFS_SUMMARY_MAGIC */
+	uint32_t sh_clean;		/* 1 if counts match the on-disk freemap */
+	uint32_t sh_nfree;		/* Total free blocks on the volume */
+	uint32_t sh_nregions;		/* Number of counts that follow */
+	uint16_t sh_pad[248];		/* unused, set to 0 */
 };
 
 /*
  * On-disk inode
+ *
+ * The double and triple indirect pointers were carved out of the waste
+ * space, which older volumes are required to keep zeroed, so volumes
+ * from before they existed read correctly (their big trees are simply
+ * absent).
  */
 struct sfs_dinode {
 	uint32_t sfi_size;			/* Size of this file (bytes) */
@@ -86,7 +158,9 @@ struct sfs_dinode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dindirect;			/* Double indirect block */
+	uint32_t sfi_tindirect;			/* Triple indirect block */
+	uint32_t sfi_waste[128-5-SFS_NDIRECT];	/* unused space, set to 0 */
 };
 
 /*
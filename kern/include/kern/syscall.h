@@ -59,10 +59,10 @@
 #define SYS_mmap         8
 #define SYS_munmap       9
 #define SYS_mprotect     10
-//#define SYS_madvise    11
+#define SYS_madvise      11
 //#define SYS_mincore    12
-//#define SYS_mlock      13
-//#define SYS_munlock    14
+#define SYS_mlock        13
+#define SYS_munlock      14
 //#define SYS_munlockall 15
 //#define SYS_minherit   16
 //                              (security/credentials)
@@ -86,7 +86,7 @@
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
 //#define SYS_wait4      34
-//#define SYS_getrusage  35
+#define SYS_getrusage    35
 //                              (resource limits)
 //#define SYS_getrlimit  36
 //#define SYS_setrlimit  37
@@ -109,12 +109,12 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
+#define SYS_readv        52
 //#define SYS_preadv     53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
+#define SYS_writev       57
 //#define SYS_pwritev    58
 #define SYS_lseek        59
 #define SYS_flock        60
@@ -180,8 +180,8 @@
 #define SYS_getpeername  106
 #define SYS_getsockopt   107
 #define SYS_setsockopt   108
-//#define SYS_recvfrom   109
-//#define SYS_sendto     110
+#define SYS_recvfrom     109
+#define SYS_sendto       110
 //#define SYS_recvmsg    111
 //#define SYS_sendmsg    112
 
@@ -196,6 +196,32 @@
 #define SYS_sync         118
 #define SYS_reboot       119
 //#define SYS___sysctl   120
+#define SYS___kheapstats 121
+//                              (combined fork+exec; no standard number)
+#define SYS_spawn        122
+//                              (shared memory; kernel picks attach address)
+#define SYS_shmget       123
+#define SYS_shmat        124
+//                              (userland blocking; see kern/futex.h)
+#define SYS_futex        125
+//                              (paging statistics; see kern/vmstat.h)
+#define SYS___vmstats    126
+//                              (per-process paging statistics, by pid)
+#define SYS___getvmstats 127
+//                              (extra kernel threads in one process)
+#define SYS_tfork        128
+#define SYS_texit        129
+//                              (pin the calling thread to one cpu)
+#define SYS_setaffinity  130
+//                              (per-thread TLS base; see userland <tls.h>)
+#define SYS_settls       131
+#define SYS_gettls       132
+//  (access-pattern advice; see FADV_* in <kern/fcntl.h>)
+#define SYS_fadvise      133
+//                              (open relative to an open directory)
+#define SYS_openat       134
+//  (freeze the process to a file; see kern <checkpoint.h>)
+#define SYS_checkpoint   135
 
 /*CALLEND*/
 
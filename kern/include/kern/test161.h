@@ -69,6 +69,19 @@ int secprintf(const char *secret, const char *msg, const char *name);
 int snsecprintf(size_t len, char *buffer, const char *secret, const char *msg, const char *name);
 int partial_credit(const char *secret, const char *name, int scored, int total);
 
+/*
+ * Benchmark metrics: single-line tagged records ("METRIC type=...
+ * name=... value=...") that the test161 perf targets parse. See
+ * common/libtest161/test161.c for the format. Names and units are
+ * reduced to single tokens, so human-readable labels are fine.
+ */
+int metric_counter(const char *name, unsigned long long value,
+		   const char *unit);
+int metric_duration(const char *name, unsigned long long ns);
+int metric_percentiles(const char *name, unsigned n,
+		       unsigned long long p50, unsigned long long p90,
+		       unsigned long long p99, const char *unit);
+
 #ifdef _KERNEL
 void test161_bootstrap(void);
 #endif
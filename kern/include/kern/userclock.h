@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_USERCLOCK_H_
+#define _KERN_USERCLOCK_H_
+
+/*
+ * Layout of the shared clock page.
+ *
+ * The kernel keeps one physical page with the current time of day,
+ * refreshed from hardclock, and maps it read-only at USERCLOCK_ADDR
+ * in every user address space. Userland can read the time from it
+ * without a system call; the kernel's __time also serves from it
+ * instead of going to the clock device.
+ *
+ * The fields are guarded by a version counter: it is odd while the
+ * kernel is updating, and changes across every update. Readers fetch
+ * the version, skip it if odd, read the fields, and reread the
+ * version; if it changed, retry. A version of zero means the clock
+ * has not been initialized yet and the reader must fall back to the
+ * __time system call.
+ *
+ * The time has hardclock-tick granularity: the page is refreshed HZ
+ * times a second, not on every read.
+ *
+ * This file must be includable from userland.
+ */
+
+/*
+ * Where the page sits: below the window the user stack can grow
+ * down into (USERSTACK minus STACKPAGES_MAX plus the guard gap; see
+ * addrspace.h). mmap and shmat also cap their placements here, so
+ * nothing can squat in the stack's growth window.
+ */
+#define USERCLOCK_ADDR  0x7fe00000
+
+struct userclock {
+	volatile __u32 uc_version;	/* seqcount: odd = update in progress */
+	volatile __u32 uc_pad;		/* align uc_secs */
+	volatile __time_t uc_secs;	/* seconds since the epoch */
+	volatile __u32 uc_nsecs;	/* nanoseconds */
+};
+
+#endif /* _KERN_USERCLOCK_H_ */
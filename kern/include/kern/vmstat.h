@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_VMSTAT_H_
+#define _KERN_VMSTAT_H_
+
+/*
+ * VM telemetry, for returning paging activity via the __vmstats()
+ * call (and the vmstat menu command). Must be includable from
+ * userland.
+ *
+ * The event counters count since boot and are kept per cpu inside
+ * the kernel; a read sums them, so successive reads can be diffed to
+ * get rates. The page counts are a snapshot of coremap occupancy at
+ * the time of the read. Counters are updated without locking, like
+ * the heap stats: indicative, not exact.
+ */
+
+struct vmstats {
+	/* Events since boot */
+	uint32_t vms_faults;		/* vm_fault entries */
+	uint32_t vms_zerofills;		/* pages materialized (zero or file) */
+	uint32_t vms_prezeroed;		/* of those, from the zero pool */
+	uint32_t vms_cowfaults;		/* copy-on-write breaks */
+	uint32_t vms_rofaults;		/* write faults on read-only entries */
+	uint32_t vms_swapins;		/* pages read back from swap */
+	uint32_t vms_swapouts;		/* pages written to swap */
+	uint32_t vms_evictions;		/* pages evicted to swap */
+	uint32_t vms_zswapouts;		/* of those, kept compressed in RAM */
+	uint32_t vms_zswapins;		/* swapins served from the zswap tier */
+	uint32_t vms_pdruns;		/* pagedaemon wakeups */
+	uint32_t vms_migrations;	/* pages moved by compaction */
+	uint32_t vms_scrubs;		/* periodic TLB scrubs */
+
+	/* Coremap occupancy, in pages, at the time of the read */
+	uint32_t vms_pages_total;
+	uint32_t vms_pages_free;
+	uint32_t vms_pages_kernel;
+	uint32_t vms_pages_user;
+	uint32_t vms_pages_evicting;
+
+	/* Commit accounting, in pages (see vm_commit_charge) */
+	uint32_t vms_commit;
+	uint32_t vms_commit_limit;
+};
+
+/*
+ * Per-process paging figures, for __getvmstats() (and the ps menu
+ * command). The event counters count since the address space was
+ * created (exec starts over), so successive reads can be diffed for
+ * a per-process fault rate; the page counts are a snapshot. Same
+ * no-locking rules as above: indicative, not exact.
+ */
+struct pvmstats {
+	/* Events over the life of the address space */
+	uint32_t pvs_faults;		/* vm_fault entries */
+	uint32_t pvs_cowfaults;		/* copy-on-write breaks */
+	uint32_t pvs_swapins;		/* pages read back from swap */
+	uint32_t pvs_evictions;		/* pages evicted to swap */
+
+	/* Footprint at the time of the read */
+	uint32_t pvs_resident;		/* pages resident in RAM */
+	uint32_t pvs_swapslots;		/* swap slots currently held */
+};
+
+#endif /* _KERN_VMSTAT_H_ */
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KLOG_H_
+#define _KLOG_H_
+
+/*
+ * Kernel log ring.
+ *
+ * All kprintf output is mirrored here, and DEBUG() output goes here
+ * *only* (see the DEBUG macro in <lib.h>), so debug chatter no longer
+ * interleaves with userland console I/O or adds polled-serial latency
+ * to it. The retained window is readable through the "klog:" device;
+ * if a second console port is configured (see config_con), everything
+ * logged is also drained to that port as it arrives.
+ *
+ * klog_write must work from any context: interrupt handlers,
+ * interrupts off, spinlocks held, and during panic. It must not
+ * kprintf, for the obvious reason.
+ */
+
+/* Size of the retained window, in bytes. */
+#define KLOG_BUFSIZE	8192
+
+/* Append LEN bytes of DATA to the log. */
+void klog_write(const char *data, size_t len);
+
+/*
+ * Register a sink that receives everything logged from now on. The
+ * sink is called outside the klog lock and may take its own
+ * spinlocks, but must work in the same contexts klog_write does.
+ * Only one sink is supported; the console driver uses this to drain
+ * the log to the second console port when one is configured.
+ */
+void klog_setdrain(void (*drain)(void *ctx, const char *data, size_t len),
+		   void *ctx);
+
+/*
+ * Function to create and attach klog: (called by vfs_bootstrap)
+ */
+void klogdev_create(void);
+
+#endif /* _KLOG_H_ */
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KMEMCACHE_H_
+#define _KMEMCACHE_H_
+
+/*
+ * Named object caches with constructed-state reuse, for types that
+ * are created and destroyed on hot paths (processes, vnodes, file
+ * handles).
+ *
+ * Building such an object means a kmalloc plus creating its locks,
+ * CVs, and sub-arrays - several more allocations - and tearing it
+ * down undoes all of that, only for the next fork or open to redo
+ * it. A kmem_cache keeps freed objects in their constructed state:
+ * the constructor runs when an object is first built, the destructor
+ * only when the cache gives the memory back, and in between
+ * allocation is a freelist pop of an object whose locks are already
+ * initialized. The invariant is that objects handed to
+ * kmem_cache_free are in the same state the constructor left them
+ * in; the caller resets its own plain fields after allocating.
+ *
+ * The constructor may allocate (that's the point) and returns 0 or
+ * an errno; on failure the raw memory is released and the alloc
+ * returns NULL. Alloc and free may both sleep and may not be called
+ * from interrupt context.
+ *
+ * Each cache registers a shrinker, so the pagedaemon empties the
+ * freelists under memory pressure; and because shrinkers are never
+ * unregistered, caches cannot be destroyed. Create them once at
+ * bootstrap for types that live as long as the system.
+ */
+
+struct kmem_cache;	/* Opaque. */
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *),
+				     void (*dtor)(void *));
+
+/* Get a constructed object, or NULL on out-of-memory. */
+void *kmem_cache_alloc(struct kmem_cache *kc);
+
+/* Return OBJ, restored to constructed state, for reuse. */
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+
+#endif /* _KMEMCACHE_H_ */
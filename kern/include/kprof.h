@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KPROF_H_
+#define _KPROF_H_
+
+/*
+ * Sampling kernel profiler.
+ *
+ * Each timer interrupt hands the interrupted program counter to
+ * kprof_sample, which counts it in a per-cpu hash of pc buckets:
+ * HZ samples per cpu per second, a few loads and stores each, cheap
+ * enough to leave running under real workloads. Where the samples
+ * pile up is where the kernel spends its time; the dump symbolizes
+ * them against the kernel's embedded symbol table (see ksyms.h).
+ *
+ * The usual sampling caveats apply: code that runs with interrupts
+ * off is charged to the instruction that re-enables them, user-mode
+ * pcs all land in user text (the dump doesn't symbolize them), and a
+ * cpu skipping ticks in tickless idle under-samples its idle loop.
+ * Buckets that lose the hash-collision fight are counted as lost
+ * rather than misfiled.
+ *
+ * "kprof" from the menu dumps the merged table, hottest pc first;
+ * "kprof on|off|reset" controls sampling.
+ */
+
+/* One pc bucket; kp_count == 0 marks a free slot. */
+struct kprof_bucket {
+	uint32_t kp_pc;		/* Sampled program counter */
+	uint32_t kp_count;	/* Samples that hit it */
+};
+
+/* Buckets per cpu; must be a power of two. */
+#define KPROF_LOGBUCKETS	10
+#define KPROF_BUCKETS		(1 << KPROF_LOGBUCKETS)
+
+/* Cheap enable test; kprof_sample checks it itself. */
+extern bool kprof_on;
+
+/*
+ * Count one sample. Called from the timer interrupt with interrupts
+ * off, so it can use the current cpu's table without locks.
+ */
+void kprof_sample(uint32_t pc);
+
+/* Allocate the tables; called from boot once the cpus are counted. */
+void kprof_bootstrap(void);
+
+/* Turn sampling on or off / discard all samples. */
+void kprof_enable(bool on);
+void kprof_reset(void);
+
+/* Merge, sort, and print the tables, for the menu command. */
+void kprof_dump(void);
+
+#endif /* _KPROF_H_ */
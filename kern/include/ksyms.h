@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KSYMS_H_
+#define _KSYMS_H_
+
+/*
+ * Kernel symbol table.
+ *
+ * The build embeds a table of the kernel's own text symbols in the
+ * image: after the first link, mksymtab.sh runs nm on the kernel and
+ * generates symtab.c (much as newvers.sh generates vers.c), and the
+ * kernel is relinked with it. Only text symbols are recorded, sorted
+ * by address with the names packed into one string blob, so the table
+ * costs tens of kilobytes rather than a full ELF symbol table.
+ *
+ * This lets the profiler and the fatal-trap report print
+ * function+offset directly instead of raw pcs that have to be decoded
+ * offline against the matching build tree - which silently produces
+ * garbage whenever the image and the tree drift apart.
+ *
+ * The relink doesn't invalidate the recorded addresses: symtab.o
+ * contains only data, which the linker script places after all the
+ * text, so the text layout from the first link is unchanged in the
+ * second.
+ */
+
+/* The generated table (symtab.c in the build directory). */
+extern const unsigned ksyms_count;
+extern const uint32_t ksyms_addrs[];	/* symbol addresses, ascending */
+extern const uint32_t ksyms_nameoffs[];	/* each name's offset in the blob */
+extern const char ksyms_names[];	/* names, \0-separated */
+
+/*
+ * Find the function containing PC. Returns false if PC doesn't lie in
+ * the kernel text (or the table is empty); otherwise hands back the
+ * function name and PC's offset within the function.
+ */
+bool ksyms_lookup(vaddr_t pc, const char **name, vaddr_t *offset);
+
+/*
+ * Format PC into BUF as "name+0x<offset>", or "0x<pc>" if it doesn't
+ * resolve. Returns BUF, for use inline in kprintf argument lists.
+ */
+const char *ksyms_format(vaddr_t pc, char *buf, size_t maxlen);
+
+#endif /* _KSYMS_H_ */
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KTRACE_H_
+#define _KTRACE_H_
+
+/*
+ * Kernel event tracer.
+ *
+ * DEBUG() is too slow to leave on in hot paths: it formats text and
+ * serializes on the console. A tracepoint instead appends a
+ * fixed-size binary record - tracepoint id, cycle timestamp, two
+ * payload words - to a per-cpu ring, overwriting the oldest record
+ * when the ring fills. With tracing off a tracepoint costs one flag
+ * test; with it on, a handful of stores at IPL_HIGH and no locks, so
+ * tracepoints can sit in vm_fault, thread_switch, and the disk driver
+ * without distorting what they measure.
+ *
+ * Timestamps come from the per-cpu cycle counter, so they order
+ * events within one cpu only; the decoder prints each cpu's ring
+ * separately, oldest record first. Like lockstat, this is a profiler,
+ * not an audit: draining while tracing is on reads the rings racily
+ * and can show a torn record at the write position, and reset is only
+ * clean with tracing off.
+ *
+ * Drain with the "ktrace" menu command (also takes on/off/reset) or
+ * by reading the "ktrace:" device, which decodes the rings to the
+ * same text so userland tools can collect them.
+ *
+ * Tracepoints can also be mirrored to the trace161 trace control
+ * device ("ktrace host" / "ktrace nohost"): each record does one
+ * ltrace_debug write with the tracepoint id in the top byte and the
+ * low 24 bits of arg0 below it, and the host records it with its own
+ * timestamp. That puts guest events on the same timeline as sys161's
+ * disk and interrupt model, costs the guest one register write, and
+ * works even on a plain sys161 (the write is just ignored).
+ */
+
+/* One trace record. */
+struct ktrace_record {
+	uint32_t kr_id;		/* Tracepoint id (KTR_*) */
+	uint32_t kr_cycles;	/* cpu_cyclecount() at the event */
+	uint32_t kr_arg0;	/* Payload; meaning depends on kr_id */
+	uint32_t kr_arg1;
+};
+
+/* Tracepoint ids. Keep ktrace_name() in ktrace.c in step. */
+#define KTR_NONE		0  /* never logged; marks an empty slot */
+#define KTR_VM_FAULT		1  /* arg0 faultaddress, arg1 faulttype */
+#define KTR_THREAD_SWITCH	2  /* arg0 old thread, arg1 new thread */
+#define KTR_LHD_READ		3  /* arg0 first sector, arg1 sector count */
+#define KTR_LHD_WRITE		4  /* arg0 first sector, arg1 sector count */
+
+/* Records buffered per cpu. */
+#define KTRACE_PERCPU		256
+
+/* Cheap enable test for the tracepoint macro. */
+extern bool ktrace_on;
+
+/* Pack a record into an ltrace_debug code for host-side capture. */
+#define KTRACE_HOSTCODE(id, arg0) (((id) << 24) | ((arg0) & 0x00ffffff))
+
+/* Log one event. Use the macro at tracepoints. */
+void ktrace_record(uint32_t id, uint32_t arg0, uint32_t arg1);
+
+#define KTRACE(id, arg0, arg1) do {				\
+		if (ktrace_on) {				\
+			ktrace_record((id), (arg0), (arg1));	\
+		}						\
+	} while (0)
+
+/* Allocate the rings; called from boot once the cpus are counted. */
+void ktrace_bootstrap(void);
+
+/* Turn tracing on or off / discard all buffered records. */
+void ktrace_enable(bool on);
+void ktrace_reset(void);
+
+/* Turn mirroring to the trace161 control device on or off. */
+void ktrace_hostenable(bool on);
+
+/* Decode and print the rings, for the menu command. */
+void ktrace_dump(void);
+
+/* Create and attach the "ktrace:" device; called from vfs_bootstrap. */
+void ktracedev_create(void);
+
+#endif /* _KTRACE_H_ */
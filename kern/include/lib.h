@@ -52,12 +52,13 @@
  * it's in <cdefs.h>.
  *
  * Regular assertions (KASSERT) are disabled by the kernel config
- * option "noasserts". DEBUGASSERT could be controlled by kernel
- * config also, but since it's likely to be wanted only rarely during
- * testing there doesn't seem much point; one can just edit this file
- * temporarily instead.
+ * option "noasserts". Debug assertions (DEBUGASSERT) are off by
+ * default and enabled by the kernel config option "debugasserts";
+ * keeping the two independent lets a benchmark kernel retain the
+ * cheap invariant checks without paying for the expensive ones.
  */
 #include "opt-noasserts.h"
+#include "opt-debugasserts.h"
 
 #if OPT_NOASSERTS
 #define KASSERT(expr) ((void)(expr))
@@ -66,11 +67,11 @@
 	((expr) ? (void)0 : badassert(#expr, __FILE__, __LINE__, __func__))
 #endif
 
-#if 1 /* no debug asserts */
-#define DEBUGASSERT(expr) ((void)(expr))
-#else
+#if OPT_DEBUGASSERTS
 #define DEBUGASSERT(expr) \
 	((expr) ? (void)0 : badassert(#expr, __FILE__, __LINE__, __func__))
+#else
+#define DEBUGASSERT(expr) ((void)(expr))
 #endif
 
 /*
@@ -93,7 +94,10 @@
 extern uint32_t dbflags;
 
 /*
- * DEBUG() is for conditionally printing debug messages to the console.
+ * DEBUG() is for conditionally printing debug messages to the kernel
+ * log (see klog.h) - not the console, so debug chatter doesn't get
+ * mixed into (or slow down) the output of user programs. Read the
+ * messages back via the klog: device or the second console port.
  *
  * The idea is that you put lots of lines of the form
  *
@@ -108,7 +112,7 @@ extern uint32_t dbflags;
  *
  * DEBUG is a varargs macro. These were added to the language in C99.
  */
-#define DEBUG(d, ...) ((dbflags & (d)) ? kprintf(__VA_ARGS__) : 0)
+#define DEBUG(d, ...) ((dbflags & (d)) ? klogprintf(__VA_ARGS__) : 0)
 
 /*
  * Random number generator, using the random device.
@@ -126,15 +130,37 @@ uint32_t random(void);
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
  */
+struct kheapstats; /* from kern/kheapstats.h */
+
+/*
+ * Allocation modes for kmalloc_flags. Plain kmalloc is KM_SLEEP: it
+ * may block waiting for memory. KM_NOSLEEP is for atomic context
+ * (interrupt handlers, softirq callbacks, code holding spinlocks):
+ * it never blocks, drawing any fresh pages from a small per-CPU
+ * reserve the pagedaemon keeps stocked, and fails with NULL instead
+ * of waiting. Blocks from either mode are freed with kfree.
+ */
+#define KM_SLEEP	0
+#define KM_NOSLEEP	1
+
 void *kmalloc(size_t size);
+void *kmalloc_flags(size_t size, int flags);
 void kfree(void *ptr);
+
+/* Free N blocks with one round of allocator bookkeeping; NULLs skipped */
+void kfree_bulk(void **ptrs, unsigned n);
 void kheap_printstats(void);
 void kheap_printused(void);
 unsigned long kheap_getused(void);
+void kheap_getstats(struct kheapstats *ks);
+void kheap_printclassstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
 
+/* Register the allocator's cache shrinker; called once from boot() */
+void kheap_shrinker_bootstrap(void);
+
 /*
  * C string functions.
  *
@@ -171,6 +197,8 @@ void beep(void);
  * Higher-level console output.
  *
  * kprintf is like printf, only in the kernel.
+ * klogprintf is like kprintf, but goes only to the kernel log ring
+ * (see klog.h), not to the console.
  * panic prepends the string "panic: " to the message printed, and then
  * resets the system.
  * badassert calls panic in a way suitable for an assertion failure.
@@ -181,6 +209,7 @@ void beep(void);
  * threads are created.
  */
 int kprintf(const char *format, ...) __PF(1,2);
+int klogprintf(const char *format, ...) __PF(1,2);
 __DEAD void panic(const char *format, ...) __PF(1,2);
 __DEAD void badassert(const char *expr, const char *file,
 		      int line, const char *func);
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention profiler.
+ *
+ * A lockstat records what one lock costs us: how often it is taken,
+ * how often the acquirer had to wait, and roughly how long the
+ * waiting and the holding took. Instrumentation is opt-in per lock:
+ * get a slot with lockstat_register and hang the returned pointer on
+ * the lock (splk_stat for spinlocks, lk_stat for sleep locks).
+ * Unregistered locks pay only a pointer test per acquire.
+ *
+ * Spinlocks are measured in cycles off the on-chip cycle counter,
+ * which is safe because a spinlock is held entirely at IPL_HIGH on
+ * one cpu. Sleep locks can block and migrate while held, so they are
+ * measured in hardclock ticks instead; per-cpu tick counts are only
+ * approximately in step, so those numbers are coarse. All counters
+ * are updated without extra locking - most fields are serialized by
+ * the instrumented lock itself, and the rest may drop the odd
+ * update. This is a profiler, not an audit.
+ *
+ * The "lockstat" menu command dumps the table, worst waiters first;
+ * "lockstat reset" rebaselines the counters.
+ */
+
+struct lockstat {
+	char ls_name[32];	/* Name for the dump */
+	bool ls_inuse;		/* Table slot is allocated */
+
+	uint64_t ls_acquires;	/* Total acquisitions */
+	uint64_t ls_contended;	/* Acquisitions that had to wait */
+	uint64_t ls_spincycles;	/* Spinlocks: cycles spent spinning */
+	uint64_t ls_holdcycles;	/* Spinlocks: cycles spent holding */
+	uint64_t ls_waitticks;	/* Sleep locks: hardclocks spent waiting */
+	uint64_t ls_holdticks;	/* Sleep locks: hardclocks spent holding */
+
+	uint32_t ls_cyclestamp;	/* Cycle count at acquire (internal) */
+	unsigned ls_tickstamp;	/* c_hardclocks at acquire (internal) */
+};
+
+/* How many locks can be instrumented at once. */
+#define LOCKSTAT_MAXLOCKS 64
+
+/*
+ * Allocate a slot. Returns NULL (harmlessly - the lock just goes
+ * unprofiled) if the table is full. There is no unregister; slots
+ * are meant for long-lived locks.
+ */
+struct lockstat *lockstat_register(const char *name);
+
+/*
+ * Update hooks, called from spinlock.c / synch.c with the
+ * instrumented lock held. The acquire hooks also stamp the hold
+ * start; STARTCYCLES/STARTTICKS is the timestamp taken before the
+ * acquisition attempt, consulted only if CONTENDED.
+ */
+void lockstat_spin_acquired(struct lockstat *ls, uint32_t startcycles,
+			    bool contended);
+void lockstat_spin_releasing(struct lockstat *ls);
+void lockstat_sleep_acquired(struct lockstat *ls, unsigned startticks,
+			     bool contended);
+void lockstat_sleep_releasing(struct lockstat *ls);
+
+/* Print or rebaseline the table, for the "lockstat" menu command. */
+void lockstat_dump(void);
+void lockstat_reset(void);
+
+#endif /* _LOCKSTAT_H_ */
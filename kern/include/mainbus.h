@@ -55,9 +55,38 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Tickless idle support (see cpu_idle).
+ *
+ * mainbus_timer_skip programs this cpu's hardclock source to next
+ * fire NTICKS hardclock periods from now instead of one, so an idle
+ * cpu isn't woken HZ times a second for nothing. If the skip ends
+ * early (some other interrupt wakes the cpu), mainbus_timer_unskip
+ * restores the regular cadence and returns the number of whole
+ * hardclock periods that elapsed while skipping, which the caller
+ * credits via hardclock_catchup; if the skip ran to completion, the
+ * timer interrupt path does the crediting and unskip returns 0.
+ * Both must be called with interrupts off on the current cpu.
+ */
+void mainbus_timer_skip(uint32_t nticks);
+uint32_t mainbus_timer_unskip(void);
+
+/*
+ * Monotonic per-boot cycle clock, for the MI cycles()/nanotime()
+ * interface in clock.h. mainbus_cycles returns cycles since this
+ * cpu's timer started (monotonic on each cpu; only approximately
+ * comparable across cpus); mainbus_cycles_to_ns converts a cycle
+ * count or delta to nanoseconds.
+ */
+uint64_t mainbus_cycles(void);
+uint64_t mainbus_cycles_to_ns(uint64_t cycles);
+
 /* Request breaking into the debugger, where available. */
 void mainbus_debugger(void);
 
+/* Print the bus's per-device interrupt statistics. */
+void mainbus_dumpirqstats(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _NET_H_
+#define _NET_H_
+
+/*
+ * Kernel interface to the network stack (net/net.c): UDP/IP over the
+ * LAMEbus network card. See kern/net.h for the userland-visible
+ * definitions and the scope of what's supported.
+ *
+ * Sockets are anonymous vnodes, like pipe ends (vfs/pipe.c), so they
+ * live in the ordinary file table and close() and fork() sharing come
+ * for free. VOP_READ receives a datagram (discarding the sender);
+ * sendto/recvfrom go through the functions below, which the socket
+ * system calls use after looking up the descriptor.
+ */
+
+struct uio; /* from uio.h */
+struct vnode; /* from vnode.h */
+struct lnet_softc; /* from lamebus/lnet.h */
+
+/*
+ * Called by the network card driver at config time: adopt the card,
+ * derive our address, and start the input thread. Only the first
+ * card is used.
+ */
+void net_attach(struct lnet_softc *ln);
+
+/* Our IPv4 address; ENETDOWN if no card has attached. */
+int net_getaddr(uint32_t *addr_ret);
+
+/*
+ * Create a socket, handing back a referenced vnode for it; and tell
+ * whether some vnode is one of ours (descriptors get checked with
+ * this before the casts below).
+ */
+int net_socket_create(struct vnode **vn_ret);
+bool net_is_socket(struct vnode *vn);
+
+/* Bind the socket to a local UDP port. */
+int net_socket_bind(struct vnode *vn, uint16_t port);
+
+/*
+ * Send the contents of UIO as one datagram to ADDR:PORT, and receive
+ * one datagram into UIO (truncating if it doesn't fit, like UDP
+ * everywhere), reporting the sender if the pointers aren't NULL.
+ * Receiving blocks until a datagram arrives; an unbound socket is
+ * bound to an ephemeral port on first send.
+ */
+int net_socket_sendto(struct vnode *vn, struct uio *uio,
+		      uint32_t addr, uint16_t port);
+int net_socket_recvfrom(struct vnode *vn, struct uio *uio,
+			uint32_t *addr_ret, uint16_t *port_ret);
+
+#endif /* _NET_H_ */
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PERCPU_H_
+#define _PERCPU_H_
+
+/*
+ * Per-cpu data allocator.
+ *
+ * Every cpu carries a fixed-size per-cpu area, set up in cpu_create.
+ * Subsystems that want cpu-local state (allocator magazines, trace
+ * buffers, statistics counters) carve a chunk out of it with
+ * percpu_alloc instead of growing struct cpu and recompiling the
+ * world. An allocation is an offset, valid in every cpu's area,
+ * including areas of cpus that come up later; percpu_get turns it
+ * into a pointer to the calling cpu's copy, which is private to that
+ * cpu unless the subsystem arranges otherwise.
+ *
+ * Chunks are cacheline-aligned so two cpus' hot counters never share
+ * a line, and come zeroed. There is no percpu_free: the facility is
+ * for long-lived subsystem state, allocated at bootstrap or first
+ * use. Allocation panics if the area is exhausted - that is a
+ * compile-time-ish sizing problem, not a runtime condition.
+ */
+
+struct cpu; /* from cpu.h */
+
+/* Size of each cpu's area, and the alignment of allocations. */
+#define PERCPU_AREASIZE		4096
+#define PERCPU_CACHELINE	64
+
+/* Carve out SIZE bytes; returns the offset of the new chunk. */
+size_t percpu_alloc(size_t size);
+
+/* This cpu's copy of the chunk at OFFSET. */
+void *percpu_get(size_t offset);
+
+/* Cpu C's copy, for cross-cpu aggregation (e.g. summing counters). */
+void *percpu_getcpu(size_t offset, struct cpu *c);
+
+/* For cpu_create only: set up C's area. */
+void percpu_area_init(struct cpu *c);
+
+#endif /* _PERCPU_H_ */
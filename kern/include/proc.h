@@ -40,6 +40,7 @@
 #include <array.h>
 
 struct addrspace;
+struct bitmap;
 struct thread;
 struct vnode;
 
@@ -50,9 +51,13 @@ DECLARRAY_BYTYPE(procarray, struct proc, ITEMINLINE);
 struct file_handle {
 	struct vnode *fh_vnode;		/* The vnode this file refers to */
 	off_t fh_offset;			/* Current position in the file */
-	unsigned fh_refcount;		/* Number of references to this file handle */
+	volatile spinlock_data_t fh_refcount;	/* References (atomic) */
 	int fh_flags;				/* Open flags (O_RDONLY, etc.) */
-	struct lock *fh_lock;		/* Lock for this file handle */
+	int fh_advice;				/* FADV_* hint from fadvise */
+	char *fh_path;				/* Path opened with, for checkpoint;
+						   NULL for pipes and sockets */
+	struct lock *fh_lock;		/* Lock for fh_offset */
+	struct file_handle *fh_next;	/* Free list link (see files.c) */
 };
 
 /* File descriptor table entry */
@@ -86,12 +91,24 @@ struct proc {
 	pid_t p_pid;		/* PID */
 	int p_retval;		/* The exit code */
 	bool p_has_exited;		/* Has process exited? */
+	bool p_oomkill;		/* Condemned by the OOM responder (vm.c);
+				   the victim exits on its next trap
+				   from user mode. */
 	struct cv *p_cv;			/* For parent to wait on */
 	struct lock *p_cv_lock;		/* Lock for cv */
 	struct proc *p_parent;		/* Parent (or NULL) */
 	struct procarray *p_children;		/* Children */
 	struct lock *p_children_lock;		/* Lock for children */
 
+	/*
+	 * CPU accounting (p_lock). Cycles from this process's exited
+	 * threads land in p_runcycles via proc_remthread; waitpid
+	 * folds a reaped child's total (its own plus its children's)
+	 * into p_childcycles. getrusage reads both.
+	 */
+	uint64_t p_runcycles;		/* Cycles of exited threads */
+	uint64_t p_childcycles;		/* Cycles of reaped children */
+
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
 
@@ -101,7 +118,9 @@ struct proc {
 	/* File descriptor table */
 	struct file_descriptor *p_fdtable;	/* Open file table */
 	int p_fdtable_size;					/* Size of file table */
-	struct lock *p_fdtable_lock;		/* Lock for file table */
+	struct bitmap *p_fdmap;				/* In-use fds, for O(1) allocation */
+	struct lock *p_fdtable_lock;		/* Lock for file table mutations;
+										   fd lookup is lock-free */
 };
 
 /* This is the process structure for the kernel and for kernel-only threads. */
@@ -131,6 +150,14 @@ struct addrspace *proc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *proc_setas(struct addrspace *);
 
+/* ADDRESS SPACE REAPER */
+
+/* Fork the background address-space reaper. Called once from boot(). */
+void asreaper_bootstrap(void);
+
+/* Queue a detached address space for deferred destruction. */
+void asreaper_enqueue(struct addrspace *as);
+
 /* PID HADNLING */
 
 /* Initialize the PID table. Should be called early in the boot process. */
@@ -148,6 +175,16 @@ int pid_alloc(struct proc *proc, pid_t *pid);
 /* Free a PID. */
 int pid_free(pid_t pid);
 
+struct pvmstats; /* from kern/vmstat.h */
+
+/*
+ * Snapshot a process's name, exit state, and paging statistics by
+ * pid, for the ps menu command and sys___getvmstats. NAMEBUF and
+ * EXITED_RET may be NULL. Returns ESRCH if the pid is unused.
+ */
+int proc_getvmstats(pid_t pid, char *namebuf, size_t bufmax,
+		    bool *exited_ret, struct pvmstats *pvs);
+
 /* FILE HANDLING */
 
 /* Allocate, initialize, return a new file_handle with refcount==1 (or error) */
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RINGBUF_H_
+#define _RINGBUF_H_
+
+#include <cdefs.h>
+#include <percpu.h>	/* for PERCPU_CACHELINE */
+
+/*
+ * Ring buffers.
+ *
+ * Two flavors, both lock-free, both requiring power-of-two capacity:
+ *
+ * struct ringbuf is a byte ring for one producer and one consumer
+ * (each may be an interrupt handler). The indexes are free-running
+ * and wrap naturally, so the full capacity is usable - no wasted
+ * slot. Each side owns its index and keeps a cached copy of the
+ * other side's, refreshed only when the ring looks full (producer)
+ * or empty (consumer), so in steady state neither side reads the
+ * cacheline the other is writing. Bulk produce/consume move data
+ * with at most two memcpys.
+ *
+ * struct mpscring is a pointer ring for many producers and one
+ * consumer (the shape of the per-cpu wakeup queue). Producers claim
+ * a slot by compare-and-swap on the head index and then publish the
+ * pointer into it; NULL marks a slot not yet published, so NULL
+ * cannot be enqueued. There is no bulk interface - slots are claimed
+ * one at a time.
+ *
+ * If the producers or consumers on one side are in thread context
+ * and more than one, serialize them externally; "single" means
+ * single at a time, not single for all time.
+ */
+
+struct ringbuf {
+	uint8_t *rb_data;	/* backing store, rb_mask+1 bytes */
+	uint32_t rb_mask;	/* capacity - 1 */
+
+	/* Producer side: rb_head owned, rb_tailcache refreshed on full */
+	volatile uint32_t rb_head __ALIGNED(PERCPU_CACHELINE);
+	uint32_t rb_tailcache;
+
+	/* Consumer side: rb_tail owned, rb_headcache refreshed on empty */
+	volatile uint32_t rb_tail __ALIGNED(PERCPU_CACHELINE);
+	uint32_t rb_headcache;
+};
+
+/* Set up RB over BUF, which holds SIZE (a power of two) bytes. */
+void ringbuf_init(struct ringbuf *rb, void *buf, uint32_t size);
+
+/*
+ * Copy up to LEN bytes from SRC into the ring; returns the number
+ * actually enqueued, which is less than LEN only if the ring fills.
+ */
+uint32_t ringbuf_produce(struct ringbuf *rb, const void *src, uint32_t len);
+
+/*
+ * Copy up to LEN bytes out of the ring into DST; returns the number
+ * actually dequeued, which is less than LEN only if the ring empties.
+ */
+uint32_t ringbuf_consume(struct ringbuf *rb, void *dst, uint32_t len);
+
+/*
+ * Bytes currently in the ring. From anyone but the producer or the
+ * consumer this is a snapshot that may be stale by the time it's
+ * used; fine for polling and statistics.
+ */
+uint32_t ringbuf_used(const struct ringbuf *rb);
+
+struct mpscring {
+	void * volatile *mr_slots;	/* backing store, mr_mask+1 slots */
+	uint32_t mr_mask;		/* capacity - 1 */
+
+	/* Claimed by producers with compare-and-swap */
+	volatile uint32_t mr_head __ALIGNED(PERCPU_CACHELINE);
+
+	/* Owned by the consumer */
+	volatile uint32_t mr_tail __ALIGNED(PERCPU_CACHELINE);
+};
+
+/* Set up MR over SLOTS, which holds SIZE (a power of two) pointers. */
+void mpscring_init(struct mpscring *mr, void * volatile *slots,
+		   uint32_t size);
+
+/* Enqueue PTR (not NULL); returns false if the ring is full. */
+bool mpscring_tryput(struct mpscring *mr, void *ptr);
+
+/*
+ * Dequeue the oldest pointer, or return NULL if the ring is empty or
+ * its oldest slot is claimed but not yet published (in which case
+ * trying again will eventually succeed).
+ */
+void *mpscring_get(struct mpscring *mr);
+
+#endif /* _RINGBUF_H_ */
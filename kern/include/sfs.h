@@ -41,6 +41,7 @@
  */
 #include <fs.h>
 #include <vnode.h>
+#include <hashtable.h>
 
 /*
  * Get on-disk structures and constants that are made available to
@@ -48,6 +49,22 @@
  */
 #include <kern/sfs.h>
 
+struct sfs_dirhash;	/* in-memory directory name index (sfs_dir.c) */
+struct rwlock;		/* in synch.h */
+
+/*
+ * One cached file-block-run to disk-block-run mapping. A zero length
+ * marks an unused entry. (See sfs_bmap.c.)
+ */
+struct sfs_bmapextent {
+	uint32_t sbe_fileblock;		/* first file block of the run */
+	daddr_t sbe_diskblock;		/* first disk block of the run */
+	uint32_t sbe_len;		/* length of the run in blocks */
+};
+
+/* Number of cached extents per vnode. */
+#define SFS_BMAPCACHE_SIZE	8
+
 /*
  * In-memory inode
  */
@@ -56,8 +73,97 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct sfs_vnode *sv_dirtynext; /* volume's dirty-inode list link */
+	bool sv_ondirtylist;            /* true if on that list */
+
+	/*
+	 * File-range lock for regular files. Reads take it shared and
+	 * writes and truncates take it exclusive, so readers of the
+	 * same file can run concurrently while writers see neither
+	 * partial reads nor each other.
+	 *
+	 * Lock coupling rules: sv_lock is always taken before
+	 * vfs_biglock, never while holding it. Everything underneath -
+	 * sfs_bmap, the buffer cache, sv_i and the other fields of this
+	 * structure - is still protected by vfs_biglock alone; sv_lock
+	 * only orders whole file operations against each other. The
+	 * truncate path takes it exclusive in sfs_truncate, except that
+	 * sfs_reclaim erases dead files without it (the refcount is
+	 * zero, so no I/O can be in flight). Directory contents are
+	 * metadata and stay entirely under vfs_biglock; directory
+	 * vnodes never use this lock. Kernel-space uios also bypass it;
+	 * see sfs_read() for why.
+	 */
+	struct rwlock *sv_lock;		/* shared/exclusive file lock */
+
+	/*
+	 * For directories: one-block cache of directory contents, so
+	 * iterating or searching reads a block at a time instead of
+	 * an entry at a time. Allocated lazily; protected, like the
+	 * rest of the vnode, by vfs_biglock. (See sfs_dir.c.)
+	 */
+	char *sv_dirbuf;		/* cached directory block, or NULL */
+	uint32_t sv_dirvnblock;		/* which block of the dir it is */
+	bool sv_dirvalid;		/* true if sv_dirbuf holds data */
+
+	/*
+	 * For directories: hash index of the names in the directory,
+	 * built on first lookup and kept in step by link/unlink, so
+	 * name searches are O(1) expected rather than a scan of every
+	 * slot. NULL until built, or if building it failed; also
+	 * protected by vfs_biglock. (See sfs_dir.c.)
+	 */
+	struct sfs_dirhash *sv_dirhash;	/* name index, or NULL */
+
+	/*
+	 * Block allocation state: a run of contiguous disk blocks
+	 * reserved for this file (already marked in the freemap but
+	 * not yet attached to the inode), plus a hint of where the
+	 * file's last block landed so the next reservation is placed
+	 * after it. Keeps sequentially written files contiguous on
+	 * disk. (See sfs_balloc.c.)
+	 */
+	daddr_t sv_extnext;		/* next reserved block to use */
+	uint32_t sv_extcount;		/* reserved blocks remaining */
+	daddr_t sv_alloc_hint;		/* last block allocated, or 0 */
+
+	/*
+	 * Delayed allocation state: a run of file blocks that have been
+	 * written (their data sits in the buffer cache under placeholder
+	 * addresses) but that have no disk blocks yet. The flusher binds
+	 * the whole range to one contiguous disk run at writeback time.
+	 * Protected by vfs_biglock. (See sfs_balloc.c.)
+	 */
+	uint32_t sv_dlstart;		/* first file block of pending range */
+	uint32_t sv_dlcount;		/* pending delayed blocks (0: none) */
+
+	/*
+	 * Cache of resolved block mappings, stored as extents since
+	 * the allocator now makes files contiguous. Lets sequential
+	 * and repeated I/O skip the indirect-block traversal in
+	 * sfs_bmap. Invalidated by truncate; protected by
+	 * vfs_biglock. (See sfs_bmap.c.)
+	 */
+	struct sfs_bmapextent sv_bmapcache[SFS_BMAPCACHE_SIZE];
+	unsigned sv_bmapnext;		/* round-robin victim index */
+
+	/*
+	 * Readahead state: where the last read ended (so we can tell
+	 * when reads form a sequential run) and the highest file
+	 * block a prefetch has been issued for (so the same blocks
+	 * aren't queued twice). Protected by vfs_biglock. (See
+	 * sfs_io.c.)
+	 */
+	off_t sv_raend;			/* end offset of last read */
+	uint32_t sv_ranext;		/* next file block to prefetch */
+
+	/* Link in the per-volume inode hash table (sfs_inode.c). */
+	struct hashlink sv_hashlink;
 };
 
+/* Initial buckets in the hash table of loaded vnodes. */
+#define SFS_VNHASH_SIZE		64
+
 /*
  * In-memory info for a whole fs volume
  */
@@ -67,8 +173,22 @@ struct sfs_fs {
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct hashtable *sfs_vnhash;   /* same, keyed by inode number */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	unsigned char *sfs_freemapdirtymap; /* which freemap blocks, exactly */
+	unsigned char *sfs_freemaploaded; /* which freemap blocks are in core */
+	uint16_t *sfs_regionfree;       /* free blocks under each freemap block */
+	bool sfs_regionvalid;           /* sfs_regionfree covers unloaded blocks */
+	bool sfs_summaryclean;          /* on-disk summary matches the freemap */
+	uint32_t sfs_nfreeblocks;       /* free blocks in the freemap */
+	uint32_t sfs_ndelayed;          /* blocks promised to delayed ranges */
+	bool sfs_dlbinding;             /* binding in progress; don't recurse */
+	uint32_t sfs_jnlsequence;       /* journal header sequence number */
+	struct sfs_bufcache *sfs_cache; /* block buffer cache */
+	struct sfs_vnode *sfs_dirtyinodes; /* vnodes with sv_i dirty */
+	struct sfs_fs *sfs_wbnext;      /* writeback queue link */
+	bool sfs_wbqueued;              /* true if on the writeback queue */
 };
 
 /*
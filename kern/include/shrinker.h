@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SHRINKER_H_
+#define _SHRINKER_H_
+
+/*
+ * Cache shrinker registry.
+ *
+ * Kernel caches (allocator magazines, the page cache, and whatever
+ * comes next) hold memory back from the free pool to make their fast
+ * paths fast. Unchecked, they starve user pages and force eviction
+ * I/O that a cache trim would have avoided. Each cache registers a
+ * shrinker; when free frames run low, the pagedaemon runs the
+ * registered callbacks - asking for the current deficit, less
+ * whatever earlier callbacks already gave back - before it starts
+ * evicting user pages to swap.
+ *
+ * The callback should try to release about NPAGES pages to the free
+ * pool and return how many it actually released (an estimate is
+ * fine; zero if it can't help). Callbacks run in thread context and
+ * may sleep, but must not allocate more than they free. Shrinkers
+ * are never unregistered, so the structure must live forever (static
+ * storage, typically).
+ */
+
+struct shrinker {
+	const char *sh_name;	/* for diagnostics */
+	unsigned (*sh_shrink)(unsigned npages, void *data);
+	void *sh_data;		/* argument for the callback */
+	struct shrinker *sh_next; /* registry link (internal) */
+};
+
+/* Add SH to the registry. */
+void shrinker_register(struct shrinker *sh);
+
+/* Ask the registered caches for NPAGES pages; returns pages freed. */
+unsigned shrinker_run(unsigned npages);
+
+#endif /* _SHRINKER_H_ */
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SOFTIRQ_H_
+#define _SOFTIRQ_H_
+
+/*
+ * Interrupt-time deferral ("bottom halves").
+ *
+ * A device interrupt handler should do no more with interrupts off
+ * than the few register accesses needed to quiet its hardware; the
+ * completion work (semaphore Vs, console wakeups, and such) can be
+ * pushed here instead. softirq_raise marks a handler pending on the
+ * current cpu; once the hardware-interrupt dispatch in
+ * mainbus_interrupt is done, softirq_dispatch runs the pending
+ * handlers with interrupts re-enabled, so the timer and other
+ * devices are no longer held off behind, say, disk completions.
+ *
+ * Softirq handlers still run in interrupt context, on the cpu that
+ * raised them: they may not sleep, and anything they share with
+ * thread context needs a spinlock as usual. A handler raised again
+ * while pending runs once; raised from within itself (or a nested
+ * interrupt), it runs again.
+ *
+ * A softirq can be steered to a designated cpu with
+ * softirq_setaffinity: raising it then marks it pending on that cpu
+ * (and IPIs it), so the completion work runs there no matter which
+ * cpu the bus delivered the hardware interrupt to. This keeps device
+ * bottom halves off the cpus running pinned latency-sensitive work
+ * (see thread_set_affinity); the hardware handler itself still runs
+ * wherever the bus routes it, but it only quiets the device. The
+ * "intsteer" menu command lists the slots and sets the steering.
+ */
+
+/* Max number of establishable softirqs (bits in a cpu's pending word). */
+#define SOFTIRQ_MAX 32
+
+/*
+ * Allocate a softirq slot; FUNC(ARG) will run when it is raised.
+ * NAME (a string constant) labels the slot for the menu listing.
+ * Done once, at device attach time; there is no disestablish.
+ */
+unsigned softirq_establish(const char *name,
+			   void (*func)(void *), void *arg);
+
+/*
+ * Mark softirq NUM pending on this cpu - or, if it has been steered,
+ * on its designated cpu. Call with interrupts off.
+ */
+void softirq_raise(unsigned num);
+
+/* Run pending softirqs; called from the interrupt path. */
+void softirq_dispatch(void);
+
+/*
+ * Steer softirq NUM to the cpu numbered CPUNUM, or back to
+ * wherever-the-interrupt-lands with SOFTIRQ_AFFINITY_ANY. Returns
+ * EINVAL for a nonexistent cpu or slot.
+ */
+#define SOFTIRQ_AFFINITY_ANY ((unsigned)-1)
+int softirq_setaffinity(unsigned num, unsigned cpunum);
+
+/* Print the slot table (number, name, steering) on the console. */
+void softirq_printsteering(void);
+
+#endif /* _SOFTIRQ_H_ */
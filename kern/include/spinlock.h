@@ -38,6 +38,8 @@
 #include <cdefs.h>
 #include <hangman.h>
 
+struct lockstat; /* from lockstat.h */
+
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
 #define SPINLOCK_INLINE INLINE
@@ -58,6 +60,7 @@
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+	struct lockstat *splk_stat;	    /* Contention profile, if any. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
 };
 
@@ -65,10 +68,10 @@ struct spinlock {
  * Initializer for cases where a spinlock needs to be static or global.
  */
 #ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, NULL, \
 				  HANGMAN_LOCKABLE_INITIALIZER }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, NULL }
 #endif
 
 /*
@@ -92,4 +95,44 @@ void spinlock_release(struct spinlock *lk);
 bool spinlock_do_i_hold(struct spinlock *lk);
 
 
+/*
+ * Queued spinlock, for known-hot locks.
+ *
+ * Same semantics and interrupt behavior as the basic spinlock, but
+ * contending cpus line up in an MCS-style queue and each spins on its
+ * own cpu-local waiter node instead of everyone hammering the shared
+ * lock word, which avoids cacheline ping-pong under heavy contention.
+ * Handoff is queue order, so it's also fair. The uncontended cost is
+ * one test-and-set, same as the basic spinlock; opt in only where
+ * contention is actually measured, since the queue machinery buys
+ * nothing on cold locks.
+ */
+struct qspinlock {
+	volatile spinlock_data_t qsl_lock;  /* Word the queue head spins on */
+	volatile spinlock_data_t qsl_tail;  /* Address of last queued waiter */
+	struct cpu *qsl_holder;		    /* CPU holding this lock. */
+	HANGMAN_LOCKABLE(qsl_hangman);	    /* Deadlock detector hook. */
+};
+
+/*
+ * Initializer for cases where a qspinlock needs to be static or global.
+ */
+#ifdef OPT_HANGMAN
+#define QSPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, \
+				  HANGMAN_LOCKABLE_INITIALIZER }
+#else
+#define QSPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL }
+#endif
+
+void qspinlock_init(struct qspinlock *qsl);
+void qspinlock_cleanup(struct qspinlock *qsl);
+
+void qspinlock_acquire(struct qspinlock *qsl);
+void qspinlock_release(struct qspinlock *qsl);
+
+bool qspinlock_do_i_hold(struct qspinlock *qsl);
+
+
 #endif /* _SPINLOCK_H_ */
@@ -43,12 +43,20 @@
  *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
+ *
+ * The count is updated with the atomic operations (atomic.h), so the
+ * common case of P with a nonzero count or V with no waiters never
+ * takes the spinlock; the spinlock protects the wchan and the waiter
+ * count for the sleeping path. The fields P and V actually touch come
+ * first so they share a cacheline with each other, not with the name
+ * and wchan pointers, which never change after creation.
  */
 struct semaphore {
-	char *sem_name;
-	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
-	volatile unsigned sem_count;
+	volatile uint32_t sem_count;
+	volatile uint32_t sem_waiters;	/* Threads in or entering sleep */
+	struct wchan *sem_wchan;
+	char *sem_name;
 };
 
 struct semaphore *sem_create(const char *name, unsigned initial_count);
@@ -72,13 +80,23 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Field order is hottest-first: the spinlock and the fields written
+ * under it on every acquire/release lead, so an uncontended
+ * acquire/release touches one cacheline; the name, deadlock-detector
+ * hook, and profile pointer are constant after creation and trail.
  */
 struct lock {
-        char *lk_name;
-        HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
-        struct thread *lk_holder;
         struct spinlock lk_spinlock;
+        struct thread *lk_holder;
+        struct lock *lk_nextheld;       /* Holder's held-locks chain. */
+        unsigned lk_donatedprio;        /* Best priority donated by the
+                                           waiters; SCHED_NUMPRIOS_MAX
+                                           when there are none. */
         struct wchan *lk_wchan;
+        struct lockstat *lk_stat;       /* Contention profile, if any. */
+        char *lk_name;
+        HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
 };
 
 struct lock *lock_create(const char *name);
@@ -127,8 +145,17 @@ void cv_destroy(struct cv *);
  * Operations:
  *    cv_wait      - Release the supplied lock, go to sleep, and, after
  *                   waking up again, re-acquire the lock.
+ *    cv_timedwait - Like cv_wait, but wake up by itself after TICKS
+ *                   hardclocks if not signaled first, returning
+ *                   ETIMEDOUT. As usual the caller should recheck
+ *                   its predicate either way; a signal and the
+ *                   deadline can race.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
- *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *    cv_broadcast - Wake up all threads sleeping on this CV. Only
+ *                   one is actually made runnable; the rest are
+ *                   requeued onto the lock's wait queue and wake as
+ *                   the lock is handed down, avoiding a thundering
+ *                   herd on the lock.
  *
  * For all three operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
@@ -137,6 +164,7 @@ void cv_destroy(struct cv *);
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, uint32_t ticks);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
@@ -150,13 +178,28 @@ void cv_broadcast(struct cv *cv, struct lock *lock);
  * (should be) made internally.
  */
 
+/*
+ * The lock state is a single packed word: the top bit is set while a
+ * writer holds the lock and the rest counts active readers, so
+ * admission and release are O(1). Readers and writers park on
+ * separate wait channels, and handoff is phase-fair: a releasing
+ * writer grants the lock to every reader that was waiting (tracked in
+ * rwlock_rgrant) before the next writer runs, and a read phase ends
+ * as soon as those grants drain, so neither side starves.
+ */
+#define RWLOCK_WRITER           0x80000000U
+#define RWLOCK_READERMASK       0x7fffffffU
+
 struct rwlock {
         char *rwlock_name;
-        struct lock *rwlock_lock;
-        struct cv *rwlock_cv;
-        struct threadarray *rwlock_active_readers;
-        volatile int rwlock_waiting_writers_count;
-        struct thread *rwlock_active_writer;
+        struct spinlock rwlock_splk;
+        struct wchan *rwlock_rwchan;    /* where readers wait */
+        struct wchan *rwlock_wwchan;    /* where writers wait */
+        volatile unsigned rwlock_state; /* RWLOCK_WRITER | reader count */
+        unsigned rwlock_waitreaders;    /* readers asleep on rwchan */
+        unsigned rwlock_waitwriters;    /* writers asleep on wwchan */
+        unsigned rwlock_rgrant;         /* admissions left in read phase */
+        struct thread *rwlock_writer;   /* current writer, for asserts */
 };
 
 struct rwlock * rwlock_create(const char *);
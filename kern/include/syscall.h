@@ -47,6 +47,9 @@ void syscall(struct trapframe *tf);
 /* Helper for fork(). */
 void enter_forked_process(void* data, unsigned long ndata);
 
+/* Helper for checkpoint restore (see proc/checkpoint.c). */
+__DEAD void enter_restored_process(struct trapframe *tf);
+
 /* Enter user mode. Does not return. */
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
@@ -61,23 +64,74 @@ int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
 
 int sys_open(userptr_t pathname, int flags, mode_t mode, int *retval);
+int sys_openat(int dirfd, userptr_t pathname, int flags, mode_t mode,
+	       int *retval);
+int sys_dup(int fd, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_pipe(userptr_t fds);
 int sys_close(int fd);
 int sys_read(int fd, userptr_t buf, size_t nbytes, int *retval);
 int sys_write(int fd, userptr_t buf, size_t nbytes, int *retval);
+int sys_readv(int fd, userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fd, userptr_t iov, int iovcnt, int *retval);
+int sys_pread(int fd, userptr_t buf, size_t nbytes, off_t offset,
+	      int *retval);
+int sys_pwrite(int fd, userptr_t buf, size_t nbytes, off_t offset,
+	       int *retval);
 int sys_lseek(int fd, off_t offset, int whence, int64_t *retval);
+int sys_fadvise(int fd, off_t offset, off_t len, int advice);
+int sys_fsync(int fd);
+int sys_poll(userptr_t ufds, unsigned nfds, int timeout, int *retval);
+int sys_getdirentry(int fd, userptr_t buf, size_t buflen, int *retval);
 int sys_remove(userptr_t pathname);
+int sys_mkdir(userptr_t pathname, mode_t mode);
+int sys_rmdir(userptr_t pathname);
 int sys_chdir(userptr_t pathname);
 int sys___getcwd(userptr_t buf, size_t buflen, int *retval);
+int sys_stat(userptr_t pathname, userptr_t statptr);
+int sys_fstat(int fd, userptr_t statptr);
+int sys_lstat(userptr_t pathname, userptr_t statptr);
 
 int sys_fork(struct trapframe *tf, pid_t *retval);
+int sys_checkpoint(struct trapframe *tf, userptr_t pathname, int *retval);
 int sys_execv(userptr_t progname, userptr_t args);
 int sys_kexecv(char *kprogname, char **kargs);
+int sys_spawn(userptr_t progname, userptr_t args, pid_t *retval);
 int sys__exit(int status);
 int sys_kwaitpid(pid_t pid, int options, int *statuscode);
 int sys_waitpid(pid_t pid, userptr_t statusptr, int options, int *retval);
 int sys_getpid(int *retval);
+int sys_getrusage(int who, userptr_t rusageptr);
 
 int sys_sbrk(intptr_t amount, int32_t *retval);
+int sys_mmap(vaddr_t addr, size_t len, int prot, int flags, int fd,
+	     off_t offset, int32_t *retval);
+int sys_munmap(vaddr_t addr, size_t len);
+int sys_madvise(vaddr_t addr, size_t len, int advice);
+int sys_mlock(vaddr_t addr, size_t len);
+int sys_munlock(vaddr_t addr, size_t len);
+
+int sys_shmget(unsigned key, size_t size, int32_t *retval);
+int sys_shmat(int shmid, int32_t *retval);
+
+int sys_futex(userptr_t uaddr, int op, unsigned val, int32_t *retval);
+
+int sys_tfork(userptr_t entry, userptr_t stack, unsigned arg, int32_t *retval);
+int sys_texit(userptr_t doneaddr);
+int sys_setaffinity(unsigned cpunum);
+int sys_settls(userptr_t base);
+int sys_gettls(int32_t *retval);
+
+int sys___kheapstats(userptr_t statsptr);
+
+int sys___vmstats(userptr_t statsptr);
+int sys___getvmstats(pid_t pid, userptr_t statsptr);
+
+int sys_socket(int domain, int type, int protocol, int *retval);
+int sys_bind(int fd, userptr_t uaddr, size_t addrlen);
+int sys_sendto(int fd, userptr_t ubuf, size_t len, int flags,
+	       userptr_t uaddr, size_t addrlen, int *retval);
+int sys_recvfrom(int fd, userptr_t ubuf, size_t len, int flags,
+		 userptr_t uaddr, userptr_t ualenp, int *retval);
 
 #endif /* _SYSCALL_H_ */
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SYSCALLSTAT_H_
+#define _SYSCALLSTAT_H_
+
+/*
+ * Per-syscall statistics.
+ *
+ * When enabled, the dispatcher stamps the cycle counter around each
+ * system call and records count, total cycles, and the worst single
+ * call, per call number. Sampling is off by default; when off the
+ * dispatcher pays one flag test per syscall and nothing else.
+ *
+ * The numbers are indicative, not exact: the cycle counter is
+ * per-cpu, so a syscall that blocks and resumes on another cpu gets a
+ * bogus delta, and the 32-bit counter wraps on long sleeps. Counters
+ * are updated without locking and may drop the odd update, like
+ * lockstat. This is a profiler, not an audit.
+ *
+ * The table can be read two ways: the "syscallstat" menu command
+ * (also takes on/off/reset), and the "syscallstat:" device, which
+ * yields the same report as text so userland tools can collect it.
+ */
+
+struct syscallstat {
+	uint64_t sc_count;	/* Number of calls */
+	uint64_t sc_cycles;	/* Total cycles across all calls */
+	uint32_t sc_maxcycles;	/* Worst single call */
+};
+
+/* Table size; covers all assigned call numbers. */
+#define SYSCALLSTAT_MAXCALLS 128
+
+/* Cheap enable test for the dispatcher. */
+extern bool syscallstat_on;
+
+/* Record one completed call; STARTCYCLES stamped before dispatch. */
+void syscallstat_record(int callno, uint32_t startcycles);
+
+/* Turn sampling on or off. */
+void syscallstat_enable(bool on);
+
+/* Print or rebaseline the table, for the menu command. */
+void syscallstat_dump(void);
+void syscallstat_reset(void);
+
+/* Create and attach the "syscallstat:" device; called from vfs_bootstrap. */
+void syscallstatdev_create(void);
+
+#endif /* _SYSCALLSTAT_H_ */
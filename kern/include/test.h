@@ -50,6 +50,7 @@
 /* data structure tests */
 int arraytest(int, char **);
 int arraytest2(int, char **);
+int arraytest3(int, char **);
 int bitmaptest(int, char **);
 int threadlisttest(int, char **);
 
@@ -68,6 +69,7 @@ int cvtest2(int, char **);
 int cvtest3(int, char **);
 int cvtest4(int, char **);
 int cvtest5(int, char **);
+int cvtest6(int, char **);
 int rwtest(int, char **);
 int rwtest2(int, char **);
 int rwtest3(int, char **);
@@ -100,6 +102,7 @@ int semu22(int, char **);
 
 /* filesystem tests */
 int fstest(int, char **);
+int fsbench(int, char **);
 int readstress(int, char **);
 int writestress(int, char **);
 int writestress2(int, char **);
@@ -118,6 +121,9 @@ int kmalloctest4(int, char **);
 int kmalloctest5(int, char **);
 int nettest(int, char **);
 
+/* Micro-benchmarks: kbench [switch|lock|kmalloc|copy|fault] */
+int kbench(int, char **);
+
 /* Routine for running a user-level program. */
 int runprogram(char *progname, char* args[]);
 
@@ -145,6 +151,15 @@ void inQuadrant(int, uint32_t);
 void leaveIntersection(uint32_t);
 int stoplight(int, char **);
 
+/*
+ * Benchmark mode (synchprobsbench.c): run the solutions flat out and
+ * report throughput and latency. While it's true the driver hooks
+ * above do nothing.
+ */
+extern bool synchprobs_bench;
+int whalemating_bench(int, char **);
+int stoplight_bench(int, char **);
+
 /*
  * Synchronization problem primitives.
  */
@@ -41,6 +41,8 @@
 #include <threadlist.h>
 
 struct cpu;
+struct lock; /* from synch.h */
+struct joinrec; /* from thread.c */
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -89,6 +91,9 @@ struct thread {
 	 */
 	struct thread_machdep t_machdep; /* Any machine-dependent goo */
 	struct threadlistnode t_listnode; /* Link for run/sleep/zombie lists */
+	const void *t_waitaddr;		/* Address slept on, if in the hashed
+					   wait table (see waitaddr_sleep) */
+	struct joinrec *t_joinrec;	/* Completion record, if joinable */
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
@@ -116,6 +121,87 @@ struct thread {
 	 * Public fields
 	 */
 
+	/*
+	 * Scheduler fields. t_priority is the run queue level this
+	 * thread is dispatched from (0 is highest); it is the better
+	 * of t_basepriority, which the MLFQ policy owns, and
+	 * t_donatedprio, the best priority donated by threads blocked
+	 * on sleep locks this thread holds (SCHED_NUMPRIOS_MAX when
+	 * there is none). t_sliceticks counts hardclocks charged
+	 * against the current timeslice. All are protected by the
+	 * runqueue lock of t_cpu, except that t_sliceticks is also
+	 * bumped from the timer interrupt on the cpu the thread is
+	 * running on (which is safe: a running thread is on no run
+	 * queue). See schedule() in thread.c for the policy.
+	 *
+	 * t_sleeplocks and t_waitlock belong to synch.c: the sleep
+	 * locks this thread holds (chained through lk_nextheld,
+	 * touched only by the thread itself) and the one it is
+	 * currently blocked on, for chained priority donation.
+	 */
+	unsigned t_priority;		/* Effective MLFQ level; 0 highest */
+	unsigned t_basepriority;	/* MLFQ level ignoring donation */
+	unsigned t_donatedprio;		/* Best donated level, or MAX */
+	unsigned t_sliceticks;		/* Hardclocks used this slice */
+	unsigned t_runnabletick;	/* c_hardclocks when made runnable */
+	bool t_nomigrate;		/* Pin to t_cpu; never migrate */
+	struct cpu *t_affinity;		/* Run only on this cpu; NULL=any */
+	bool t_priofixed;		/* Exempt from boost/demotion */
+	struct lock *t_sleeplocks;	/* Sleep locks held, for donation */
+	struct lock *t_waitlock;	/* Sleep lock blocked on, if any */
+
+	/*
+	 * I/O priority hint (IOPRI_ constants, see iopri.h), read by
+	 * disk drivers when this thread queues a request. Touched only
+	 * by the thread itself.
+	 */
+	unsigned t_iopri;		/* I/O priority hint */
+
+	/*
+	 * True while this thread is doing I/O on behalf of a file
+	 * opened O_DIRECT; filesystems that cache should bypass the
+	 * cache for the operation. Like t_iopri, this is a hint set
+	 * around the VOP call and touched only by the thread itself.
+	 */
+	bool t_iodirect;		/* current I/O bypasses fs caching */
+
+	/*
+	 * Access-pattern advice for the I/O this thread is currently
+	 * doing (FADV_ constants from kern/fcntl.h), set around the
+	 * VOP call from the file handle's fadvise state. Same rules
+	 * as t_iodirect.
+	 */
+	int t_ioadvice;			/* FADV_* hint for current I/O */
+
+	/*
+	 * True while this thread is writing on behalf of a file
+	 * opened O_APPEND; the filesystem should position the write
+	 * at the current end of file, atomically against its own
+	 * notion of the file size. Same rules as t_iodirect.
+	 */
+	bool t_ioappend;		/* current write appends at EOF */
+
+	/*
+	 * Userland TLS base, set with the settls system call and read
+	 * back with gettls. The kernel attaches no meaning to the
+	 * value; it's just preserved per thread (and inherited across
+	 * fork, cleared by exec) so libc can hang per-thread state
+	 * off it without scanning stacks under a lock.
+	 */
+	userptr_t t_usertls;		/* Userland TLS base, or NULL */
+
+	/*
+	 * CPU accounting, maintained by thread_switch with the cycle
+	 * clock: t_runstart is stamped when the thread is put on a
+	 * cpu and the elapsed cycles are added to t_runcycles when it
+	 * comes off. A thread stays on one cpu between those points,
+	 * so the per-cpu clock epochs don't matter. When the thread
+	 * exits, the total is folded into its process (see
+	 * proc_remthread).
+	 */
+	uint64_t t_runcycles;		/* Cycles on cpu, completed slices */
+	uint64_t t_runstart;		/* Cycle clock at last dispatch */
+
 	/* add more here as needed */
 };
 
@@ -141,6 +227,16 @@ void thread_panic(void);
 /* Call during system shutdown to offline other CPUs. */
 void thread_shutdown(void);
 
+/*
+ * Pin T to the cpu numbered CPUNUM (boot order, as in cpu->c_number),
+ * or release the pin with THREAD_AFFINITY_ANY. A pinned thread is
+ * passed over by work stealing and load balancing, and wakeups place
+ * it on its own cpu; a thread currently elsewhere moves home at its
+ * next wakeup. Returns EINVAL for a nonexistent cpu.
+ */
+#define THREAD_AFFINITY_ANY ((unsigned)-1)
+int thread_set_affinity(struct thread *t, unsigned cpunum);
+
 /*
  * Make a new thread, which will start executing at "func". The thread
  * will belong to the process "proc", or to the current thread's
@@ -155,6 +251,20 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * As thread_fork, but the new thread is joinable: a thread id is
+ * returned in *TID_RET, and thread_join(tid) blocks until the thread
+ * has exited and been fully cleaned up. Each tid must be joined
+ * exactly once, by one thread; until it is, a small completion
+ * record stays allocated. thread_join returns ESRCH for a tid that
+ * was never issued or is already joined.
+ */
+int thread_fork_joinable(const char *name, struct proc *proc,
+                void (*func)(void *, unsigned long),
+                void *data1, unsigned long data2,
+                unsigned *tid_ret);
+int thread_join(unsigned tid);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -173,6 +283,46 @@ void thread_yield(void);
  */
 void schedule(void);
 
+/*
+ * Charge the current hardclock tick against the running thread's
+ * timeslice. Called from the timer interrupt, before thread_yield().
+ */
+void sched_tick(void);
+
+/*
+ * Scheduler tuning knobs: number of priority levels in use (at most
+ * SCHED_NUMPRIOS_MAX) and the level-0 timeslice in hardclocks. Level
+ * P's timeslice is sched_basequantum << P. Settable from the menu
+ * ("sched" command); sched_setparams returns EINVAL for values out
+ * of range.
+ */
+extern unsigned sched_numprios;
+extern unsigned sched_basequantum;
+int sched_setparams(unsigned numprios, unsigned basequantum);
+void sched_dumpparams(void);
+
+/*
+ * Print or clear the per-cpu scheduler statistics (see struct
+ * schedstat in cpu.h). For the "schedstat" menu command; clearing
+ * gives a fresh baseline for A/B measurement runs.
+ */
+void schedstat_dump(void);
+void schedstat_reset(void);
+
+/*
+ * Priority donation, for the sleep-lock code in synch.c.
+ *
+ * thread_priodonate raises T's effective priority to PRIO if that is
+ * better, requeueing T if it is sitting on a run queue, and records
+ * the donation in t_donatedprio. thread_priorestore replaces the
+ * calling thread's outstanding-donation level (SCHED_NUMPRIOS_MAX
+ * for none) and recomputes its effective priority; callers compute
+ * the new level from the donations still attached to locks they
+ * hold.
+ */
+void thread_priodonate(struct thread *t, unsigned prio);
+void thread_priorestore(unsigned donatedprio);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
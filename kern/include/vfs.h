@@ -74,18 +74,34 @@ const char *vfs_getdevname(struct fs *fs);
  *                     goes to the correct filesystem.
  *    vfs_lookparent - Likewise, for VOP_LOOKPARENT.
  *
- * Both of these may destroy the path passed in.
+ *    vfs_lookup_at  - Like vfs_lookup, but resolves relative to an
+ *                     already-open directory vnode, skipping the
+ *                     device-prefix/cwd rules. For openat().
+ *    vfs_lookparent_at - Likewise, for VOP_LOOKPARENT.
+ *
+ *    vfs_namecache_purge - Throw away all cached lookup results.
+ *                     Must be called (under vfs_biglock) after any
+ *                     operation that changes the namespace, and
+ *                     before unmounting.
+ *
+ * Both of the lookup functions may destroy the path passed in.
  */
 
 int vfs_lookup(char *path, struct vnode **result);
 int vfs_lookparent(char *path, struct vnode **result,
 		   char *buf, size_t buflen);
+int vfs_lookup_at(struct vnode *startvn, char *path, struct vnode **result);
+int vfs_lookparent_at(struct vnode *startvn, char *path,
+		      struct vnode **result, char *buf, size_t buflen);
+void vfs_namecache_purge(void);
 
 /*
  * VFS layer high-level operations on pathnames
  * Because lookup may destroy pathnames, these all may too.
  *
  *    vfs_open         - Open or create a file. FLAGS/MODE per the syscall.
+ *    vfs_openat       - Likewise, but resolving relative to STARTDIR
+ *                       when it is not NULL. For openat().
  *    vfs_readlink     - Read contents of a symlink into a uio.
  *    vfs_symlink      - Create a symlink PATH containing contents CONTENTS.
  *    vfs_mkdir        - Create a directory. MODE per the syscall.
@@ -102,6 +118,8 @@ int vfs_lookparent(char *path, struct vnode **result,
  */
 
 int vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret);
+int vfs_openat(struct vnode *startdir, char *path, int openflags,
+	       mode_t mode, struct vnode **ret);
 void vfs_close(struct vnode *vn);
 int vfs_readlink(char *path, struct uio *data);
 int vfs_symlink(const char *contents, char *path);
@@ -45,7 +45,13 @@
 #define VM_FAULT_WRITE       1    /* A write was attempted */
 #define VM_FAULT_READONLY    2    /* A write to a readonly page was attempted*/
 
-#define KVADDR_TO_PADDR(vaddr) ((vaddr) - MIPS_KSEG0)
+#define KVADDR_TO_PADDR(vaddr) \
+	((vaddr) >= MIPS_KSEG2 ? \
+	 (vaddr) - MIPS_KSEG2 + MIPS_DIRECTMEM_SIZE : \
+	 (vaddr) - MIPS_KSEG0)
+
+/* Most CPUs the VM's per-CPU state supports (sys161's limit) */
+#define VM_MAXCPUS 32
 
 /* Coremap */
 
@@ -56,19 +62,57 @@ enum cm_state {
 	CM_EVICTING /* page is currently being evicted to swap */
 };
 
+/*
+ * One coremap entry per physical page. The eviction scan walks the
+ * whole array, so the entry is kept small (28 bytes) to fit more of
+ * it in cache: state and wired are single bytes (the enum values all
+ * fit) and the fields the scan tests come first.
+ */
 struct coremap_entry {
-	enum cm_state state; /* allocation state */
+	uint8_t state; /* allocation state (enum cm_state) */
+	uint8_t wired; /* mlocked; never an eviction victim (CM_USER) */
 	uint16_t chunk_len; /* run length if first page; else 0 */
+	uint16_t refcount; /* address spaces sharing this page (CM_USER) */
 	struct addrspace *as; /* owning address-space (CM_USER) */
 	uint32_t vpn; /* user virtual page number */
+
+	/*
+	 * Free-run index. For the head page of a free run these link
+	 * the run into its size bucket; head and tail pages both
+	 * record the head index so neighbouring runs can coalesce.
+	 * Meaningless for allocated pages.
+	 */
+	uint32_t run_next; /* next free run in bucket */
+	uint32_t run_prev; /* previous free run in bucket */
+	uint32_t run_head; /* head index of this free run */
 };
 
 /* Swap space management */
+
+/* How many swap disks we will probe for (lhd0raw:, lhd1raw:, ...) */
+#define SWAP_MAXDEVS 2
+
+/*
+ * One swap disk. Slot numbers handed out by the swap layer are global;
+ * each device owns the contiguous range [sd_base, sd_base + sd_size),
+ * so a slot run never straddles devices and a clustered write is
+ * always a single request to a single disk.
+ */
+struct swapdev {
+	struct bitmap *sd_bitmap; /* Tracks used/free slots, device-local */
+	struct vnode *sd_vnode; /* VNode for the device */
+	unsigned sd_base; /* First global slot number on this device */
+	unsigned sd_size; /* Number of slots on this device */
+	unsigned sd_hint; /* Next-fit hint, device-local */
+	unsigned sd_inflight; /* Swap I/Os outstanding on this device */
+};
+
 struct swapmap {
-	struct bitmap *swap_bitmap; /* Tracks used/free swap slots */
 	struct spinlock swap_lock; /* Lock for swap operations */
-	struct vnode *swap_vnode; /* VNode for the swap device */
-	unsigned swap_size; /* Total number of swap slots */
+	struct swapdev swap_devs[SWAP_MAXDEVS];
+	unsigned swap_ndevs; /* Devices actually present */
+	unsigned swap_size; /* Total slots across all devices */
+	unsigned swap_nextdev; /* Round-robin tiebreak for striping */
 };
 
 /* Initialization function */
@@ -81,12 +125,82 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Get one kernel page without ever blocking (for kmalloc's KM_NOSLEEP
+ * mode). Draws on the per-CPU emergency reserve when free memory is
+ * gone; returns 0 rather than wait. Free with free_kpages.
+ */
+vaddr_t alloc_kpage_nosleep(void);
+
 unsigned alloc_upage(struct addrspace *as, vaddr_t vaddr);
+unsigned alloc_upage_zeroed(struct addrspace *as, vaddr_t vaddr);
 void free_upage(unsigned idx);
 
+/* Free N user pages with one coremap lock hold; clobbers IDXS */
+void free_upage_bulk(unsigned *idxs, unsigned n);
+
+/*
+ * Zero or copy exactly one page through its (word-aligned) kernel
+ * mapping; unrolled, with none of the generic bzero/memcpy checks.
+ */
+void page_zero(void *page);
+void page_copy(void *dst, const void *src);
+
+/*
+ * Stock the pre-zeroed page pool; called from the idle loop. Returns
+ * true if it zeroed a page (so the caller should recheck its runqueue
+ * before calling again), false if there is nothing useful to do.
+ */
+bool vm_zero_idle(void);
+
+/*
+ * Copy-on-write sharing of user pages. A shared page's coremap entry
+ * tracks one of its sharers; pages whose recorded owner has departed
+ * (as == NULL) or that are shared are skipped by the eviction scan.
+ */
+void vm_page_incref(unsigned idx);
+void vm_page_decref(unsigned idx);
+unsigned vm_page_refcount(unsigned idx);
+void vm_page_claim(unsigned idx, struct addrspace *as, vaddr_t vaddr);
+
+/*
+ * Set/clear the wired (mlock) mark on a user page; wired pages are
+ * never eviction victims. EBUSY if the page is mid-eviction. The
+ * per-process wiring budget is MLOCK_MAXPAGES (see sys_mlock).
+ */
+int vm_page_setwired(unsigned idx, bool wired);
+#define MLOCK_MAXPAGES	256	/* 1 MiB; a runaway can't pin all of RAM */
+
+/*
+ * Wire the current process's page containing UADDR: fault it in (or
+ * back in from swap) if necessary and take an extra reference so the
+ * eviction scan passes it over. Returns the frame's coremap index;
+ * unwire with vm_page_decref. Used to give device I/O a stable
+ * physical frame to work on (sys_futex, zero-copy file writes).
+ */
+int vm_page_wire(userptr_t uaddr, unsigned *pfn_ret);
+
 /* Coremap dump for statistics */
 void coremap_dump(void);
 
+struct vmstats; /* from kern/vmstat.h */
+struct pvmstats; /* from kern/vmstat.h */
+
+/*
+ * Paging statistics: sum the per-cpu counters and snapshot coremap
+ * occupancy. vmstat_dump prints the same numbers, for the "vmstat"
+ * menu command (and boot).
+ */
+void vmstat_gather(struct vmstats *vs);
+void vmstat_dump(void);
+
+/*
+ * Per-address-space flavor: the counters the fault and eviction
+ * paths keep on the space itself, plus a coremap scan for its
+ * resident footprint. For __getvmstats and the ps menu command.
+ */
+void vmstat_gather_as(struct addrspace *as, struct pvmstats *pvs);
+
 /*
  * Return amount of memory (in bytes) used by allocated coremap pages.  If
  * there are ongoing allocations, this value could change after it is returned
@@ -97,9 +211,91 @@ unsigned int coremap_used_bytes(void);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
-/* Invalidate TLB entry for specific vaddr */
+/* True if AS may hold TLB entries on CPU CPUNUM (it has an ASID there) */
+bool vm_tlbshootdown_needed(struct addrspace *as, unsigned cpunum);
+
+/* Invalidate N pages of AS on every CPU with batched IPIs */
+void vm_tlbshootdown_batch(struct addrspace *as,
+			   const vaddr_t *vaddrs, unsigned n);
+
+/* Invalidate TLB entry for specific vaddr (in the live address space) */
 void tlb_invalidate(vaddr_t vaddr);
 
+/* Same, for a specific address space's ASID (NULL means the live one) */
+void tlb_invalidate_as(struct addrspace *as, vaddr_t vaddr);
+
+/*
+ * Address space IDs. as_activate assigns each address space an ASID
+ * per CPU and tags its TLB entries with it, so switching spaces only
+ * flushes when an ASID is recycled.
+ */
+unsigned vm_asid_activate(struct addrspace *as);
+void vm_asid_release(struct addrspace *as);
+void vm_tlb_restore_asid(void);
+
+/*
+ * Pinned TLB entries. A pin keeps one vaddr->paddr mapping resident
+ * in a wired TLB slot, where the random replacement used for refills
+ * never evicts it; use it for the handful of pages whose refills are
+ * pure overhead (the user clock page). AS selects one address space,
+ * NULL every address space. The mapping bypasses the page tables, so
+ * the caller owns the frame and must unpin before freeing it. Pin
+ * returns ENOSPC when all wired slots are taken; loadpins rewrites
+ * this CPU's wired slots for AS and is called from as_activate and
+ * after whole-TLB flushes, with interrupts off.
+ */
+int vm_tlb_pin(struct addrspace *as, vaddr_t vaddr, paddr_t paddr,
+	       bool writable);
+void vm_tlb_unpin(struct addrspace *as, vaddr_t vaddr);
+void vm_tlb_loadpins(struct addrspace *as);
+
+/* Periodic local-TLB scrub so referenced bits keep getting set */
+void vm_tlb_scrub(void);
+
+struct vnode; /* from vnode.h */
+
+/*
+ * The file page cache: page-granular frames of file contents keyed
+ * by (vnode, offset), shared between vm_fault (which maps them) and
+ * vnode_read (which copies out of them). get takes a page reference
+ * for the caller, dropped with free_upage or kept for a mapping;
+ * insert takes the cache's own reference on a frame the caller just
+ * filled. Entries are generation-checked against vnode_statgen, so
+ * writes to the file invalidate lazily.
+ */
+bool vm_pagecache_get(struct vnode *vn, off_t off, unsigned *pfn_ret);
+void vm_pagecache_insert(struct vnode *vn, off_t off, unsigned pfn);
+
+/* Queue a background read of N pages into the page cache (a hint;
+   best-effort). Used by madvise and MADV_SEQUENTIAL readahead. */
+void vm_pagecache_prefetch(struct vnode *vn, off_t off, unsigned npages);
+
+struct timespec; /* from kern/time.h */
+
+/*
+ * Shared clock page (see kern/userclock.h). The VM owns the page;
+ * userclock_tick is called from hardclock on the boot cpu and
+ * userclock_gettime serves sys___time without touching the clock
+ * device (returns false if the page isn't running yet).
+ */
+void userclock_bootstrap(void);
+void userclock_tick(void);
+bool userclock_gettime(struct timespec *ts);
+
+/*
+ * Commit accounting. Every page of user memory promised to a process
+ * (regions at exec, stack, sbrk growth, a forked child's whole
+ * image) is charged against RAM+swap scaled by the overcommit
+ * ratio, so running out surfaces as ENOMEM from sbrk/exec/fork
+ * instead of as an unhandleable swap_alloc failure deep in the
+ * fault path. Uncharged when the heap shrinks or the space dies.
+ */
+#define VM_OVERCOMMIT_PCT 150	/* default vm_overcommit_pct */
+extern unsigned vm_overcommit_pct;
+
+int vm_commit_charge(unsigned npages);
+void vm_commit_uncharge(unsigned npages);
+
 /* Swap initialization and operations */
 int swap_init(void);
 int swap_alloc(unsigned *idx);
@@ -115,6 +311,9 @@ int vm_find_eviction_victim(unsigned *idx_ret);
 /* Evict a page and free up physical memory */
 int vm_evict_page(unsigned *idx_ret);
 
+/* Evict up to MAXPAGES pages with one clustered swap write */
+int vm_evict_cluster(unsigned maxpages, unsigned *evicted_ret);
+
 // Convert page-frame index to physical address
 static
 inline
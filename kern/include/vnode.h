@@ -31,8 +31,8 @@
 #define _VNODE_H_
 
 #include <spinlock.h>
+#include <kern/stat.h>
 struct uio;
-struct stat;
 
 
 /*
@@ -49,14 +49,18 @@ struct stat;
  * Note: vn_fs may be null if the vnode refers to a device.
  */
 struct vnode {
-	int vn_refcount;                /* Reference count */
-	struct spinlock vn_countlock;   /* Lock for vn_refcount */
+	volatile uint32_t vn_refcount;	/* Reference count (see atomic.h) */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
 	void *vn_data;                  /* Filesystem-specific data */
 
 	const struct vnode_ops *vn_ops; /* Functions on this vnode */
+
+	struct spinlock vn_statlock;    /* Protects the attribute cache */
+	bool vn_statvalid;              /* vn_statcache is current */
+	unsigned vn_statgen;            /* Bumped on each invalidation */
+	struct stat vn_statcache;       /* Cached VOP_STAT result */
 };
 
 /*
@@ -117,6 +121,13 @@ struct vnode {
  *                      and directories are seekable, but some devices are
  *                      not.
  *
+ *    vop_poll        - Report which of the I/O events requested in
+ *                      EVENTS (an OR of the POLL* flags in kern/poll.h)
+ *                      would not block if attempted now, in REVENTS.
+ *                      Objects whose I/O never waits on an outside
+ *                      event, like regular files, can use
+ *                      vnode_poll_generic.
+ *
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
@@ -192,6 +203,7 @@ struct vnode_ops {
 	int (*vop_stat)(struct vnode *object, struct stat *statbuf);
 	int (*vop_gettype)(struct vnode *object, mode_t *result);
 	bool (*vop_isseekable)(struct vnode *object);
+	int (*vop_poll)(struct vnode *object, int events, int *revents);
 	int (*vop_fsync)(struct vnode *object);
 	int (*vop_mmap)(struct vnode *file /* add stuff */);
 	int (*vop_truncate)(struct vnode *file, off_t len);
@@ -228,26 +240,27 @@ struct vnode_ops {
 #define VOP_EACHOPEN(vn, flags)         (__VOP(vn, eachopen)(vn, flags))
 #define VOP_RECLAIM(vn)                 (__VOP(vn, reclaim)(vn))
 
-#define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
+#define VOP_READ(vn, uio)               (vnode_read(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
-#define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_WRITE(vn, uio)              (vnode_write(vn, uio))
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
-#define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
+#define VOP_STAT(vn, ptr) 	        (vnode_stat(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_ISSEEKABLE(vn)              (__VOP(vn, isseekable)(vn))
+#define VOP_POLL(vn, ev, rev)           (__VOP(vn, poll)(vn, ev, rev))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
-#define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_TRUNCATE(vn, pos)           (vnode_truncate(vn, pos))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
-#define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
-#define VOP_SYMLINK(vn, name, content)  (__VOP(vn, symlink)(vn, name, content))
-#define VOP_MKDIR(vn, name, mode)       (__VOP(vn, mkdir)(vn, name, mode))
-#define VOP_LINK(vn, name, vn2)         (__VOP(vn, link)(vn, name, vn2))
-#define VOP_REMOVE(vn, name)            (__VOP(vn, remove)(vn, name))
-#define VOP_RMDIR(vn, name)             (__VOP(vn, rmdir)(vn, name))
-#define VOP_RENAME(vn1,name1,vn2,name2)(__VOP(vn1,rename)(vn1,name1,vn2,name2))
+#define VOP_CREAT(vn,nm,excl,mode,res)  (vnode_creat(vn,nm,excl,mode,res))
+#define VOP_SYMLINK(vn, name, content)  (vnode_symlink(vn, name, content))
+#define VOP_MKDIR(vn, name, mode)       (vnode_mkdir(vn, name, mode))
+#define VOP_LINK(vn, name, vn2)         (vnode_link(vn, name, vn2))
+#define VOP_REMOVE(vn, name)            (vnode_remove(vn, name))
+#define VOP_RMDIR(vn, name)             (vnode_rmdir(vn, name))
+#define VOP_RENAME(vn1,name1,vn2,name2) (vnode_rename(vn1,name1,vn2,name2))
 
 #define VOP_LOOKUP(vn, name, res)       (__VOP(vn, lookup)(vn, name, res))
 #define VOP_LOOKPARENT(vn,nm,res,bf,ln) (__VOP(vn,lookparent)(vn,nm,res,bf,ln))
@@ -259,13 +272,84 @@ void vnode_check(struct vnode *, const char *op);
 
 /*
  * Reference count manipulation (handled above filesystem level)
+ *
+ * The reference count is maintained with lock-free atomic operations.
+ * vnode_tryreclaim is for use at the top of VOP_RECLAIM
+ * implementations: it returns true if the caller holds the last
+ * reference and should proceed to destroy the vnode; otherwise it
+ * consumes the reference VOP_DECREF passed in and the caller should
+ * return EBUSY. The caller must hold whatever lock protects the
+ * filesystem's vnode table, so that no new reference can materialize
+ * once the count has been seen at 1.
  */
 void vnode_incref(struct vnode *);
 void vnode_decref(struct vnode *);
+bool vnode_tryreclaim(struct vnode *);
 
 #define VOP_INCREF(vn) 			vnode_incref(vn)
 #define VOP_DECREF(vn) 			vnode_decref(vn)
 
+/*
+ * Attribute cache (handled above filesystem level)
+ *
+ * vnode_stat serves VOP_STAT from a per-vnode cache of the last stat
+ * block, filled on the first miss and dropped by the wrappers below
+ * for operations that change a file's attributes: write and truncate
+ * on the file itself, and the namespace operations on the directory
+ * (and, for link, the target file's link count). Reads are not
+ * tracked, so st_atime may be stale.
+ *
+ * vnode_statinvalidate is public for filesystem code whose files
+ * change without going through a VOP (e.g. device sizes); the
+ * wrappers call it themselves.
+ */
+int vnode_stat(struct vnode *vn, struct stat *statbuf);
+void vnode_statinvalidate(struct vnode *vn);
+
+/*
+ * The invalidation generation, for callers caching data derived from
+ * the file's contents: store it, and recheck before trusting the
+ * cached copy (writes and truncates bump it).
+ */
+unsigned vnode_statgen(struct vnode *vn);
+
+/*
+ * Page cache read-through (also handled above filesystem level)
+ *
+ * vnode_read serves reads of regular files from the file page cache
+ * in vm.c - the same frames vm_fault maps for demand-paged
+ * executables - calling into the filesystem only to fill missing
+ * pages. Everything else passes through to the filesystem untouched.
+ */
+int vnode_read(struct vnode *vn, struct uio *uio);
+
+int vnode_write(struct vnode *vn, struct uio *uio);
+int vnode_truncate(struct vnode *vn, off_t len);
+int vnode_creat(struct vnode *dir, const char *name, bool excl, mode_t mode,
+		struct vnode **result);
+int vnode_symlink(struct vnode *dir, const char *contents, const char *name);
+int vnode_mkdir(struct vnode *dir, const char *name, mode_t mode);
+int vnode_link(struct vnode *dir, const char *name, struct vnode *file);
+int vnode_remove(struct vnode *dir, const char *name);
+int vnode_rmdir(struct vnode *dir, const char *name);
+int vnode_rename(struct vnode *dir1, const char *name1,
+		 struct vnode *dir2, const char *name2);
+
+/*
+ * Polling support.
+ *
+ * vnode_poll_generic is a VOP_POLL implementation for objects that
+ * are always ready: it reports back whatever was asked for. Regular
+ * files and most devices use it.
+ *
+ * Any object whose VOP_POLL can go from "not ready" to "ready" must
+ * call pollnotify() (implemented with poll() in poll_syscalls.c) when
+ * that happens, or sleeping pollers won't hear about it. It is safe
+ * to call from interrupt context.
+ */
+int vnode_poll_generic(struct vnode *vn, int events, int *revents);
+void pollnotify(void);
+
 /*
  * Vnode initialization (intended for use by filesystem code)
  * The reference count is initialized to 1.
@@ -66,6 +66,17 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Timed variant of wchan_sleep: additionally wake up by ourselves
+ * after TICKS hardclocks (via the timer wheel) if nobody has called
+ * wakeup by then. Returns ETIMEDOUT if the deadline did the waking
+ * and 0 otherwise; as always, the caller should recheck whatever
+ * condition it was waiting for, since a wakeup and the deadline can
+ * race.
+ */
+int wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk,
+			uint32_t ticks);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
@@ -76,5 +87,37 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Move all threads sleeping on FROM onto TO without waking them.
+ * Both associated spinlocks must be locked; the caller is
+ * responsible for acquiring them in a consistent order. Used by
+ * cv_broadcast to park all-but-one waiter on the lock's channel
+ * instead of waking a herd.
+ */
+void wchan_requeue_all(struct wchan *from, struct spinlock *fromlk,
+		       struct wchan *to, struct spinlock *tolk);
+
+/*
+ * Address-keyed waiting (a kernel-internal futex). Sleepers hash by
+ * the address of a word they're watching into a fixed table of wait
+ * queues with per-bucket spinlocks, so ad-hoc waiting doesn't need a
+ * dedicated wchan object and lock.
+ *
+ * waitaddr_sleep checks *ADDR against EXPECTED under the bucket lock
+ * and goes to sleep only if they still match; otherwise it returns
+ * EAGAIN without sleeping. Callers should recheck their condition and
+ * retry on both EAGAIN and ordinary wakeup, since unrelated wakeups
+ * of the same address are possible. The update of *ADDR and the
+ * wakeup protocol are the caller's business; as long as the waker
+ * changes *ADDR before calling waitaddr_wake, no wakeup can be lost.
+ *
+ * waitaddr_wake wakes up to N threads sleeping on ADDR (pass
+ * WAITADDR_ALL for all of them) and returns the number woken.
+ */
+#define WAITADDR_ALL ((unsigned)-1)
+
+int waitaddr_sleep(const volatile unsigned *addr, unsigned expected);
+unsigned waitaddr_wake(const volatile unsigned *addr, unsigned n);
+
 
 #endif /* _WCHAN_H_ */
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+#include <clock.h> /* for struct timer */
+
+/*
+ * Shared kernel workqueue.
+ *
+ * Subsystems that want something done later - writeback, readahead,
+ * deferred teardown - used to each fork their own thread, each with
+ * its own stack and scheduling slot that sits idle most of the time.
+ * Instead, one small pool of worker threads (one per cpu, which is
+ * also the concurrency limit) runs submitted work items in thread
+ * context.
+ *
+ * Embed a struct work in your own structure and set it up with
+ * work_init; like struct timer, only wk_func and wk_data are yours
+ * to look at. Submitting an item that is already queued is a no-op,
+ * so a "kick" can be issued freely from hot paths. An item is
+ * dequeued before its handler runs: the handler may resubmit it, and
+ * may free it if nothing else can still submit it. Consequently a
+ * resubmit racing with a running handler can make the handler run
+ * again, possibly concurrently on another worker; handlers that must
+ * not run concurrently do their own serialization.
+ *
+ * init		  Prepare a work item. FUNC is called with the item
+ *		  and DATA when it runs.
+ * submit	  Queue the item to run as soon as a worker is free.
+ *		  Returns false if it was already queued. Safe from
+ *		  interrupt context. Before the workers are up (early
+ *		  boot), runs the handler inline instead.
+ * submit_delayed Arm the item's timer to submit it TICKS hardclocks
+ *		  from now (see clock.h). No-op if the item is
+ *		  already queued or its timer already armed.
+ * cancel	  Unqueue the item and disarm its timer. Returns true
+ *		  if the item will now not run; false if it already
+ *		  ran or is running. Does not wait for a running
+ *		  handler.
+ */
+
+struct work {
+	struct work *wk_next;	/* queue link (internal) */
+	void (*wk_func)(struct work *, void *); /* the work itself */
+	void *wk_data;		/* argument for the handler */
+	struct timer wk_timer;	/* for submit_delayed (internal) */
+	bool wk_queued;		/* on the queue (internal) */
+};
+
+void work_init(struct work *wk,
+	       void (*func)(struct work *, void *), void *data);
+bool work_submit(struct work *wk);
+void work_submit_delayed(struct work *wk, uint32_t ticks);
+bool work_cancel(struct work *wk);
+
+/* Fork the worker pool; called once from boot(). */
+void workqueue_bootstrap(void);
+
+#endif /* _WORKQUEUE_H_ */
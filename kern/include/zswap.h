@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ZSWAP_H_
+#define _ZSWAP_H_
+
+/*
+ * Compressed in-memory swap tier.
+ *
+ * A disk swap write costs milliseconds; most evicted pages (sparse
+ * heap data) compress to a fraction of a page. The swap layer offers
+ * each evicted page to this tier first: if the page compresses well
+ * it is kept in a bounded pool of kernel memory, keyed by the swap
+ * slot the page table already records, and a later fault gets it back
+ * at memory speed. When the pool fills, the oldest compressed pages
+ * are written to their (already reserved) disk slots, so the on-disk
+ * layout the allocator chose is preserved and the page tables never
+ * know which tier a slot lives in.
+ *
+ * All calls are thread context and may sleep (making room can mean a
+ * disk write). A slot's data is in exactly one tier at a time:
+ * zswap_store owns the slot until zswap_load or zswap_invalidate
+ * takes it back, or until spill moves it to disk.
+ */
+
+/* Set the pool budget in bytes; called once from swap_init. */
+void zswap_bootstrap(size_t maxbytes);
+
+/*
+ * Try to compress the page at SRC into the pool as SLOT's data.
+ * Returns true on success; on false the caller must write the page
+ * to disk itself.
+ */
+bool zswap_store(unsigned slot, const void *src);
+
+/*
+ * If SLOT's data is in the pool, decompress it into DST, drop the
+ * pool entry, and return true; false means the data is on disk.
+ */
+bool zswap_load(unsigned slot, void *dst);
+
+/* Drop SLOT's pool entry, if any; called when the slot is freed. */
+void zswap_invalidate(unsigned slot);
+
+#endif /* _ZSWAP_H_ */
@@ -133,3 +133,106 @@ array_remove(struct array *a, unsigned index)
         memmove(a->v + index, a->v + index+1, num_to_move*sizeof(void *));
         a->num--;
 }
+
+/*
+ * Inline-storage (by-value) arrays. These parallel the pointer array
+ * operations above, with the element size passed in so one set of
+ * functions serves all element types.
+ */
+
+struct valarray *
+valarray_create(void)
+{
+	struct valarray *a;
+
+	a = kmalloc(sizeof(*a));
+	if (a != NULL) {
+		valarray_init(a);
+	}
+	return a;
+}
+
+void
+valarray_destroy(struct valarray *a)
+{
+	valarray_cleanup(a);
+	kfree(a);
+}
+
+void
+valarray_init(struct valarray *a)
+{
+	a->num = a->max = 0;
+	a->v = NULL;
+}
+
+void
+valarray_cleanup(struct valarray *a)
+{
+	/*
+	 * Unlike the pointer array we don't require the array to be
+	 * empty first; the elements live in our storage, so freeing it
+	 * can't leak anything they own. (Elements holding pointers to
+	 * other allocations should be cleaned out by the caller, who
+	 * is the only one who knows what they mean.)
+	 */
+	kfree(a->v);
+#ifdef ARRAYS_CHECKED
+	a->v = NULL;
+#endif
+	a->num = a->max = 0;
+}
+
+int
+valarray_preallocate(struct valarray *a, size_t elemsize, unsigned num)
+{
+	void *newptr;
+	unsigned newmax;
+
+	if (num > a->max) {
+		/* Don't touch A until the allocation succeeds. */
+		newmax = a->max;
+		while (num > newmax) {
+			newmax = newmax ? newmax*2 : 4;
+		}
+
+		newptr = kmalloc(newmax*elemsize);
+		if (newptr == NULL) {
+			return ENOMEM;
+		}
+		memcpy(newptr, a->v, a->num*elemsize);
+		kfree(a->v);
+		a->v = newptr;
+		a->max = newmax;
+	}
+	return 0;
+}
+
+int
+valarray_setsize(struct valarray *a, size_t elemsize, unsigned num)
+{
+	int result;
+
+	result = valarray_preallocate(a, elemsize, num);
+	if (result) {
+		return result;
+	}
+	a->num = num;
+
+	return 0;
+}
+
+void
+valarray_remove(struct valarray *a, size_t elemsize, unsigned index)
+{
+	unsigned num_to_move;
+
+	ARRAYASSERT(a->num <= a->max);
+	ARRAYASSERT(index < a->num);
+
+	num_to_move = a->num - (index + 1);
+	memmove((char *)a->v + index*elemsize,
+		(char *)a->v + (index+1)*elemsize,
+		num_to_move*elemsize);
+	a->num--;
+}
@@ -49,6 +49,7 @@
 
 struct bitmap {
         unsigned nbits;
+        unsigned rotor;   /* where bitmap_findrun starts looking */
         WORD_TYPE *v;
 };
 
@@ -72,6 +73,7 @@ bitmap_create(unsigned nbits)
 
         bzero(b->v, words*sizeof(WORD_TYPE));
         b->nbits = nbits;
+        b->rotor = 0;
 
         /* Mark any leftover bits at the end in use */
         if (words > nbits / BITS_PER_WORD) {
@@ -120,6 +122,96 @@ bitmap_alloc(struct bitmap *b, unsigned *index)
         return ENOSPC;
 }
 
+/*
+ * Look for COUNT contiguous clear bits in the range [LO, HI). Words
+ * that are entirely set or entirely clear are skipped or consumed a
+ * word at a time; only partially used words go bit by bit.
+ */
+static
+int
+bitmap_findrun_range(struct bitmap *b, unsigned lo, unsigned hi,
+                     unsigned count, unsigned *index)
+{
+        unsigned pos = lo;
+        unsigned run = 0;
+
+        while (pos < hi) {
+                if (pos % BITS_PER_WORD == 0 && hi - pos >= BITS_PER_WORD) {
+                        WORD_TYPE word = b->v[pos / BITS_PER_WORD];
+
+                        if (word == WORD_ALLBITS) {
+                                run = 0;
+                                pos += BITS_PER_WORD;
+                                continue;
+                        }
+                        if (word == 0 && count - run > BITS_PER_WORD) {
+                                run += BITS_PER_WORD;
+                                pos += BITS_PER_WORD;
+                                continue;
+                        }
+                }
+                if (bitmap_isset(b, pos)) {
+                        run = 0;
+                }
+                else {
+                        run++;
+                        if (run == count) {
+                                *index = pos - (count - 1);
+                                return 0;
+                        }
+                }
+                pos++;
+        }
+        return ENOSPC;
+}
+
+int
+bitmap_findrun(struct bitmap *b, unsigned count, unsigned *index)
+{
+        unsigned hi;
+
+        KASSERT(count > 0);
+        if (count > b->nbits) {
+                return ENOSPC;
+        }
+
+        /*
+         * First fit starting from the rotor; then wrap. The second
+         * pass runs far enough past the rotor to catch runs that
+         * straddle it.
+         */
+        if (bitmap_findrun_range(b, b->rotor, b->nbits, count, index) == 0) {
+                return 0;
+        }
+        hi = b->rotor + count - 1;
+        if (hi > b->nbits) {
+                hi = b->nbits;
+        }
+        return bitmap_findrun_range(b, 0, hi, count, index);
+}
+
+int
+bitmap_allocrun(struct bitmap *b, unsigned count, unsigned *index)
+{
+        int result;
+
+        result = bitmap_findrun(b, count, index);
+        if (result) {
+                return result;
+        }
+        bitmap_markrange(b, *index, count);
+
+        /*
+         * Advance the rotor past the run so successive allocations
+         * march forward instead of piling up at the front.
+         */
+        b->rotor = *index + count;
+        if (b->rotor >= b->nbits) {
+                b->rotor = 0;
+        }
+        return 0;
+}
+
 static
 inline
 void
@@ -158,6 +250,92 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 }
 
 
+/*
+ * Set COUNT clear bits starting at INDEX. Ranges that span whole words
+ * are set a word at a time; only the partial words at the ends go bit
+ * by bit. All the bits must be clear, as with bitmap_mark.
+ */
+void
+bitmap_markrange(struct bitmap *b, unsigned index, unsigned count)
+{
+        unsigned ix;
+        WORD_TYPE mask;
+
+        KASSERT(count > 0);
+        KASSERT(index < b->nbits);
+        KASSERT(count <= b->nbits - index);
+
+        /* Leading partial word. */
+        while (count > 0 && index % BITS_PER_WORD != 0) {
+                bitmap_translate(index, &ix, &mask);
+                KASSERT((b->v[ix] & mask)==0);
+                b->v[ix] |= mask;
+                index++;
+                count--;
+        }
+
+        /* Whole words. */
+        while (count >= BITS_PER_WORD) {
+                ix = index / BITS_PER_WORD;
+                KASSERT(b->v[ix] == 0);
+                b->v[ix] = WORD_ALLBITS;
+                index += BITS_PER_WORD;
+                count -= BITS_PER_WORD;
+        }
+
+        /* Trailing partial word. */
+        while (count > 0) {
+                bitmap_translate(index, &ix, &mask);
+                KASSERT((b->v[ix] & mask)==0);
+                b->v[ix] |= mask;
+                index++;
+                count--;
+        }
+}
+
+/*
+ * Clear COUNT set bits starting at INDEX. Ranges that span whole words
+ * are cleared a word at a time; only the partial words at the ends go
+ * bit by bit. All the bits must be set, as with bitmap_unmark.
+ */
+void
+bitmap_unmarkrange(struct bitmap *b, unsigned index, unsigned count)
+{
+        unsigned ix;
+        WORD_TYPE mask;
+
+        KASSERT(count > 0);
+        KASSERT(index < b->nbits);
+        KASSERT(count <= b->nbits - index);
+
+        /* Leading partial word. */
+        while (count > 0 && index % BITS_PER_WORD != 0) {
+                bitmap_translate(index, &ix, &mask);
+                KASSERT((b->v[ix] & mask)!=0);
+                b->v[ix] &= ~mask;
+                index++;
+                count--;
+        }
+
+        /* Whole words. */
+        while (count >= BITS_PER_WORD) {
+                ix = index / BITS_PER_WORD;
+                KASSERT(b->v[ix] == WORD_ALLBITS);
+                b->v[ix] = 0;
+                index += BITS_PER_WORD;
+                count -= BITS_PER_WORD;
+        }
+
+        /* Trailing partial word. */
+        while (count > 0) {
+                bitmap_translate(index, &ix, &mask);
+                KASSERT((b->v[ix] & mask)!=0);
+                b->v[ix] &= ~mask;
+                index++;
+                count--;
+        }
+}
+
 int
 bitmap_isset(struct bitmap *b, unsigned index)
 {
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Generic chained hash table; see hashtable.h for the rules.
+ *
+ * Each bucket belongs to exactly one of the HASHTABLE_NUMLOCKS
+ * bucket locks: since the bucket count is a power of two no smaller
+ * than the lock count, (hash & ht_mask) % NUMLOCKS == hash %
+ * NUMLOCKS, so the lock can be picked from the hash alone, before
+ * the bucket array or mask is looked at. That matters for resize:
+ * setsize holds all the locks while it swaps in the new array, so
+ * any operation holding one lock sees a stable array and mask.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <atomic.h>
+#include <spinlock.h>
+#include <hashtable.h>
+
+/*
+ * The lock covering HASH's bucket.
+ */
+static
+struct spinlock *
+hashtable_lockfor(struct hashtable *ht, uint32_t hash)
+{
+	return &ht->ht_locks[hash % HASHTABLE_NUMLOCKS];
+}
+
+void
+hashlink_init(struct hashlink *hl, void *self)
+{
+	hl->hl_next = NULL;
+	hl->hl_hash = 0;
+	hl->hl_self = self;
+}
+
+void
+hashlink_cleanup(struct hashlink *hl)
+{
+	KASSERT(hl->hl_next == NULL);
+	hl->hl_self = NULL;
+}
+
+struct hashtable *
+hashtable_create(uint32_t numbuckets)
+{
+	struct hashtable *ht;
+	uint32_t i;
+
+	KASSERT(numbuckets >= HASHTABLE_NUMLOCKS);
+	KASSERT((numbuckets & (numbuckets - 1)) == 0);
+
+	ht = kmalloc(sizeof(*ht));
+	if (ht == NULL) {
+		return NULL;
+	}
+	ht->ht_buckets = kmalloc(numbuckets * sizeof(ht->ht_buckets[0]));
+	if (ht->ht_buckets == NULL) {
+		kfree(ht);
+		return NULL;
+	}
+	for (i = 0; i < numbuckets; i++) {
+		ht->ht_buckets[i] = NULL;
+	}
+	ht->ht_mask = numbuckets - 1;
+	ht->ht_count = 0;
+	for (i = 0; i < HASHTABLE_NUMLOCKS; i++) {
+		spinlock_init(&ht->ht_locks[i]);
+	}
+	return ht;
+}
+
+void
+hashtable_destroy(struct hashtable *ht)
+{
+	uint32_t i;
+
+	KASSERT(ht->ht_count == 0);
+
+	for (i = 0; i < HASHTABLE_NUMLOCKS; i++) {
+		spinlock_cleanup(&ht->ht_locks[i]);
+	}
+	kfree(ht->ht_buckets);
+	kfree(ht);
+}
+
+uint32_t
+hashtable_count(const struct hashtable *ht)
+{
+	return ht->ht_count;
+}
+
+void
+hashtable_add(struct hashtable *ht, struct hashlink *hl, uint32_t hash)
+{
+	struct spinlock *lk;
+	struct hashlink **bucket;
+
+	KASSERT(hl->hl_next == NULL);
+
+	hl->hl_hash = hash;
+
+	lk = hashtable_lockfor(ht, hash);
+	spinlock_acquire(lk);
+	bucket = &ht->ht_buckets[hash & ht->ht_mask];
+	hl->hl_next = *bucket;
+	*bucket = hl;
+	atomic_fetch_add(&ht->ht_count, 1);
+	spinlock_release(lk);
+}
+
+void
+hashtable_remove(struct hashtable *ht, struct hashlink *hl)
+{
+	struct spinlock *lk;
+	struct hashlink **p;
+
+	lk = hashtable_lockfor(ht, hl->hl_hash);
+	spinlock_acquire(lk);
+	for (p = &ht->ht_buckets[hl->hl_hash & ht->ht_mask];
+	     *p != NULL;
+	     p = &(*p)->hl_next) {
+		if (*p == hl) {
+			*p = hl->hl_next;
+			hl->hl_next = NULL;
+			atomic_fetch_add(&ht->ht_count, (uint32_t)-1);
+			spinlock_release(lk);
+			return;
+		}
+	}
+	panic("hashtable_remove: entry %p not in table %p\n", hl, ht);
+}
+
+struct hashlink *
+hashtable_find(struct hashtable *ht, uint32_t hash,
+	       bool (*match)(const struct hashlink *hl, const void *key),
+	       const void *key)
+{
+	struct spinlock *lk;
+	struct hashlink *hl;
+
+	lk = hashtable_lockfor(ht, hash);
+	spinlock_acquire(lk);
+	for (hl = ht->ht_buckets[hash & ht->ht_mask];
+	     hl != NULL;
+	     hl = hl->hl_next) {
+		if (hl->hl_hash == hash && match(hl, key)) {
+			break;
+		}
+	}
+	spinlock_release(lk);
+	return hl;
+}
+
+void
+hashtable_iterate(struct hashtable *ht,
+		  bool (*func)(struct hashlink *hl, void *ctx),
+		  void *ctx)
+{
+	struct spinlock *lk;
+	struct hashlink *hl;
+	uint32_t i;
+
+	for (i = 0; i <= ht->ht_mask; i++) {
+		lk = hashtable_lockfor(ht, i);
+		spinlock_acquire(lk);
+		for (hl = ht->ht_buckets[i]; hl != NULL; hl = hl->hl_next) {
+			if (!func(hl, ctx)) {
+				spinlock_release(lk);
+				return;
+			}
+		}
+		spinlock_release(lk);
+	}
+}
+
+int
+hashtable_setsize(struct hashtable *ht, uint32_t numbuckets)
+{
+	struct hashlink **newbuckets, **oldbuckets, *hl, *next;
+	uint32_t i, oldmask;
+
+	KASSERT(numbuckets >= HASHTABLE_NUMLOCKS);
+	KASSERT((numbuckets & (numbuckets - 1)) == 0);
+
+	newbuckets = kmalloc(numbuckets * sizeof(newbuckets[0]));
+	if (newbuckets == NULL) {
+		return ENOMEM;
+	}
+	for (i = 0; i < numbuckets; i++) {
+		newbuckets[i] = NULL;
+	}
+
+	/*
+	 * Taking the locks in index order is the lock order for the
+	 * whole table; nothing else ever holds two of them.
+	 */
+	for (i = 0; i < HASHTABLE_NUMLOCKS; i++) {
+		spinlock_acquire(&ht->ht_locks[i]);
+	}
+
+	oldbuckets = ht->ht_buckets;
+	oldmask = ht->ht_mask;
+	for (i = 0; i <= oldmask; i++) {
+		for (hl = oldbuckets[i]; hl != NULL; hl = next) {
+			next = hl->hl_next;
+			hl->hl_next = newbuckets[hl->hl_hash &
+						 (numbuckets - 1)];
+			newbuckets[hl->hl_hash & (numbuckets - 1)] = hl;
+		}
+	}
+	ht->ht_buckets = newbuckets;
+	ht->ht_mask = numbuckets - 1;
+
+	for (i = HASHTABLE_NUMLOCKS; i-- > 0; ) {
+		spinlock_release(&ht->ht_locks[i]);
+	}
+
+	kfree(oldbuckets);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Hash functions
+
+/*
+ * 32-bit FNV-1a. Not the fastest hash there is, but simple, decent,
+ * and one multiply per byte.
+ */
+uint32_t
+hash32_buf(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h = (h ^ p[i]) * 16777619U;
+	}
+	return h;
+}
+
+uint32_t
+hash32_str(const char *s)
+{
+	uint32_t h = 2166136261U;
+
+	while (*s != '\0') {
+		h = (h ^ (uint8_t)*s) * 16777619U;
+		s++;
+	}
+	return h;
+}
+
+/*
+ * Scatter an integer's entropy into its low bits (Knuth's
+ * multiplicative method). For keys that are already uniform in
+ * their low bits, like sequentially assigned IDs, the key itself
+ * works as well or better.
+ */
+uint32_t
+hash32_int(uint32_t val)
+{
+	return val * 2654435761U;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel log ring. See klog.h for the ground rules.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <klog.h>
+
+/*
+ * The ring. KLOG_TOTAL counts every byte ever logged; the bytes
+ * currently retained are the last min(total, KLOG_BUFSIZE) bytes of
+ * that stream, and stream offset N lives in the buffer at
+ * N % KLOG_BUFSIZE. Static storage so logging works from the first
+ * instruction of boot and never needs kmalloc.
+ */
+static char klog_buf[KLOG_BUFSIZE];
+static uint64_t klog_total;
+static struct spinlock klog_lock = SPINLOCK_INITIALIZER;
+
+/* Optional sink; set at most once, never cleared. */
+static void (*klog_drain)(void *ctx, const char *data, size_t len);
+static void *klog_drainctx;
+
+void
+klog_write(const char *data, size_t len)
+{
+	size_t i;
+
+	spinlock_acquire(&klog_lock);
+	for (i=0; i<len; i++) {
+		klog_buf[(klog_total + i) % KLOG_BUFSIZE] = data[i];
+	}
+	klog_total += len;
+	spinlock_release(&klog_lock);
+
+	/*
+	 * Drain outside the lock so the sink can take its own locks.
+	 * Callers are already serialized by the kprintf locks, so the
+	 * sink still sees whole messages in order.
+	 */
+	if (klog_drain != NULL) {
+		klog_drain(klog_drainctx, data, len);
+	}
+}
+
+void
+klog_setdrain(void (*drain)(void *ctx, const char *data, size_t len),
+	      void *ctx)
+{
+	KASSERT(klog_drain == NULL);
+
+	/* Publish the context before the function pointer. */
+	klog_drainctx = ctx;
+	membar_store_store();
+	klog_drain = drain;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * The "klog:" device: presents the log as a file whose offsets count
+ * bytes since boot. Reading at an offset that has already been
+ * overwritten skips forward to the oldest retained byte; reading at
+ * the current end produces EOF. So "cat klog:" dumps the window, and
+ * a scraper that remembers its offset and re-reads at the tail picks
+ * up exactly the new messages.
+ */
+
+static
+int
+klogdev_eachopen(struct device *dev, int openflags)
+{
+	(void)dev;
+	(void)openflags;
+
+	return 0;
+}
+
+static
+int
+klogdev_io(struct device *dev, struct uio *uio)
+{
+	char chunk[128];
+	uint64_t total, start, off;
+	size_t i, amt;
+	int result;
+
+	(void)dev;
+
+	if (uio->uio_rw != UIO_READ) {
+		return EIO;
+	}
+
+	while (uio->uio_resid > 0) {
+		spinlock_acquire(&klog_lock);
+		total = klog_total;
+		start = total > KLOG_BUFSIZE ? total - KLOG_BUFSIZE : 0;
+		off = (uint64_t)uio->uio_offset;
+		if (off < start) {
+			/* Overwritten while the reader slept. */
+			off = start;
+		}
+		if (off >= total) {
+			/* At (or past) the end: EOF. */
+			spinlock_release(&klog_lock);
+			break;
+		}
+		amt = sizeof(chunk);
+		if (amt > total - off) {
+			amt = total - off;
+		}
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+		for (i=0; i<amt; i++) {
+			chunk[i] = klog_buf[(off + i) % KLOG_BUFSIZE];
+		}
+		spinlock_release(&klog_lock);
+
+		/*
+		 * uiomove can block, so copy out with the lock
+		 * dropped; the chunk is a stable snapshot. Reset the
+		 * offset first in case we skipped overwritten bytes.
+		 */
+		uio->uio_offset = (off_t)off;
+		result = uiomove(chunk, amt, uio);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+static
+int
+klogdev_ioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+static const struct device_ops klog_devops = {
+	.devop_eachopen = klogdev_eachopen,
+	.devop_io = klogdev_io,
+	.devop_ioctl = klogdev_ioctl,
+	.devop_poll = dev_poll_always,
+};
+
+/*
+ * Function to create and attach klog:
+ */
+void
+klogdev_create(void)
+{
+	int result;
+	struct device *dev;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev==NULL) {
+		panic("Could not add klog device: out of memory\n");
+	}
+
+	dev->d_ops = &klog_devops;
+
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+
+	dev->d_data = NULL;
+
+	result = vfs_adddev("klog", dev, 0);
+	if (result) {
+		panic("Could not add klog device: %s\n",
+		      strerror(result));
+	}
+}
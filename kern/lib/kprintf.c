@@ -36,6 +36,7 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <klog.h>
 #include <mainbus.h>
 #include <vfs.h>          // for vfs_sync()
 #include <lamebus/ltrace.h> // for ltrace_stop()
@@ -77,6 +78,9 @@ kprintf_bootstrap(void)
 
 /*
  * Send characters to the console. Backend for __printf.
+ *
+ * Everything printed is also mirrored into the kernel log, so log
+ * scrapers can read klog: instead of demultiplexing the console.
  */
 static
 void
@@ -86,18 +90,32 @@ console_send(void *junk, const char *data, size_t len)
 
 	(void)junk;
 
+	klog_write(data, len);
 	for (i=0; i<len; i++) {
 		putch(data[i]);
 	}
 }
 
 /*
- * kprintf and tprintf helper function.
+ * Send characters to the kernel log only. Backend for klogprintf.
+ */
+static
+void
+klog_send(void *junk, const char *data, size_t len)
+{
+	(void)junk;
+
+	klog_write(data, len);
+}
+
+/*
+ * kprintf and klogprintf helper function.
  */
 static
 inline
 int
-__kprintf(const char *fmt, va_list ap)
+__kprintf(void (*sendfunc)(void *clientdata, const char *str, size_t len),
+	  const char *fmt, va_list ap)
 {
 	int chars;
 	bool dolock;
@@ -114,7 +132,7 @@ __kprintf(const char *fmt, va_list ap)
 		spinlock_acquire(&kprintf_spinlock);
 	}
 
-	chars = __vprintf(console_send, NULL, fmt, ap);
+	chars = __vprintf(sendfunc, NULL, fmt, ap);
 
 	if (dolock) {
 		lock_release(kprintf_lock);
@@ -136,7 +154,26 @@ kprintf(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	chars = __kprintf(fmt, ap);
+	chars = __kprintf(console_send, fmt, ap);
+	va_end(ap);
+
+	return chars;
+}
+
+/*
+ * Printf to the kernel log only, bypassing the console. This is what
+ * DEBUG() expands to, so a chatty debug build doesn't interleave with
+ * (or slow down) userland console I/O; read the messages back via the
+ * klog: device or the second console port.
+ */
+int
+klogprintf(const char *fmt, ...)
+{
+	int chars;
+	va_list ap;
+
+	va_start(ap, fmt);
+	chars = __kprintf(klog_send, fmt, ap);
 	va_end(ap);
 
 	return chars;
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Sampling kernel profiler. See kprof.h for the ground rules.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <ksyms.h>
+#include <kprof.h>
+
+bool kprof_on;
+
+/* Like QSL_MAXCPUS in spinlock.c: sys161's limit, kept MI here. */
+#define KPROF_MAXCPUS 32
+
+/* Probe at most this many slots before declaring the sample lost. */
+#define KPROF_MAXPROBE 8
+
+/*
+ * Per-cpu table, written only by its own cpu (from the timer
+ * interrupt, so with interrupts off - no lock needed).
+ */
+struct kprof_cpu {
+	struct kprof_bucket *kc_buckets;	/* KPROF_BUCKETS slots */
+	uint32_t kc_lost;			/* Samples with no slot */
+};
+
+static struct kprof_cpu kprof_cpus[KPROF_MAXCPUS];
+
+/*
+ * Fibonacci hash of the pc. Instructions are word aligned, so shift
+ * the dead bits out first or everything lands in a quarter of the
+ * table.
+ */
+static
+inline
+unsigned
+kprof_hash(uint32_t pc, unsigned logsize)
+{
+	return ((pc >> 2) * 2654435761U) >> (32 - logsize);
+}
+
+void
+kprof_sample(uint32_t pc)
+{
+	struct kprof_bucket *tab, *b;
+	unsigned idx, i;
+
+	if (!kprof_on) {
+		return;
+	}
+	tab = kprof_cpus[curcpu->c_number].kc_buckets;
+	if (tab == NULL) {
+		return;
+	}
+
+	idx = kprof_hash(pc, KPROF_LOGBUCKETS);
+	for (i = 0; i < KPROF_MAXPROBE; i++) {
+		b = &tab[(idx + i) & (KPROF_BUCKETS - 1)];
+		if (b->kp_count == 0) {
+			b->kp_pc = pc;
+			b->kp_count = 1;
+			return;
+		}
+		if (b->kp_pc == pc) {
+			b->kp_count++;
+			return;
+		}
+	}
+	kprof_cpus[curcpu->c_number].kc_lost++;
+}
+
+void
+kprof_enable(bool on)
+{
+	kprof_on = on;
+}
+
+void
+kprof_reset(void)
+{
+	unsigned i;
+
+	for (i = 0; i < KPROF_MAXCPUS; i++) {
+		if (kprof_cpus[i].kc_buckets != NULL) {
+			bzero(kprof_cpus[i].kc_buckets,
+			      KPROF_BUCKETS * sizeof(struct kprof_bucket));
+		}
+		kprof_cpus[i].kc_lost = 0;
+	}
+}
+
+void
+kprof_bootstrap(void)
+{
+	unsigned i;
+
+	KASSERT(num_cpus > 0);
+	KASSERT(num_cpus <= KPROF_MAXCPUS);
+
+	for (i = 0; i < num_cpus; i++) {
+		kprof_cpus[i].kc_buckets =
+			kmalloc(KPROF_BUCKETS *
+				sizeof(struct kprof_bucket));
+		if (kprof_cpus[i].kc_buckets == NULL) {
+			panic("kprof: out of memory\n");
+		}
+		bzero(kprof_cpus[i].kc_buckets,
+		      KPROF_BUCKETS * sizeof(struct kprof_bucket));
+	}
+}
+
+/*
+ * Merge table for the dump: the per-cpu tables hashed together, wider
+ * than one cpu's table since the cpus mostly sample the same hot pcs
+ * but need not.
+ */
+#define KPROF_MERGELOG		12
+#define KPROF_MERGEBUCKETS	(1 << KPROF_MERGELOG)
+
+static
+void
+kprof_merge_one(struct kprof_bucket *merge, const struct kprof_bucket *src,
+		uint32_t *overflow)
+{
+	struct kprof_bucket *b;
+	unsigned idx, i;
+
+	idx = kprof_hash(src->kp_pc, KPROF_MERGELOG);
+	for (i = 0; i < KPROF_MAXPROBE; i++) {
+		b = &merge[(idx + i) & (KPROF_MERGEBUCKETS - 1)];
+		if (b->kp_count == 0) {
+			*b = *src;
+			return;
+		}
+		if (b->kp_pc == src->kp_pc) {
+			b->kp_count += src->kp_count;
+			return;
+		}
+	}
+	*overflow += src->kp_count;
+}
+
+void
+kprof_dump(void)
+{
+	struct kprof_bucket *merge, tmp;
+	uint64_t total;
+	uint32_t lost, overflow;
+	unsigned cpu, i, j, n;
+	char sym[64];
+
+	merge = kmalloc(KPROF_MERGEBUCKETS * sizeof(struct kprof_bucket));
+	if (merge == NULL) {
+		kprintf("kprof: out of memory\n");
+		return;
+	}
+	bzero(merge, KPROF_MERGEBUCKETS * sizeof(struct kprof_bucket));
+
+	/*
+	 * Merge a racy snapshot of every cpu's table; sampling cpus
+	 * may add counts while we read, which skews nothing worse
+	 * than the sampling error already does.
+	 */
+	lost = 0;
+	overflow = 0;
+	for (cpu = 0; cpu < KPROF_MAXCPUS; cpu++) {
+		if (kprof_cpus[cpu].kc_buckets == NULL) {
+			continue;
+		}
+		lost += kprof_cpus[cpu].kc_lost;
+		for (i = 0; i < KPROF_BUCKETS; i++) {
+			if (kprof_cpus[cpu].kc_buckets[i].kp_count != 0) {
+				kprof_merge_one(merge,
+					&kprof_cpus[cpu].kc_buckets[i],
+					&overflow);
+			}
+		}
+	}
+
+	/* Compact the used slots to the front... */
+	n = 0;
+	total = 0;
+	for (i = 0; i < KPROF_MERGEBUCKETS; i++) {
+		if (merge[i].kp_count != 0) {
+			merge[n++] = merge[i];
+			total += merge[i].kp_count;
+		}
+	}
+
+	/* ...and insertion-sort them, hottest first. */
+	for (i = 1; i < n; i++) {
+		tmp = merge[i];
+		for (j = i; j > 0 && merge[j-1].kp_count < tmp.kp_count;
+		     j--) {
+			merge[j] = merge[j-1];
+		}
+		merge[j] = tmp;
+	}
+
+	kprintf("Kernel profile (sampling %s): "
+		"%llu samples, %lu pcs, %lu lost\n",
+		kprof_on ? "on" : "off",
+		(unsigned long long)total,
+		(unsigned long)n,
+		(unsigned long)(lost + overflow));
+	kprintf("%10s %10s %s\n", "samples", "pc", "function");
+	for (i = 0; i < n; i++) {
+		kprintf("%10lu 0x%08lx %s\n",
+			(unsigned long)merge[i].kp_count,
+			(unsigned long)merge[i].kp_pc,
+			ksyms_format(merge[i].kp_pc, sym, sizeof(sym)));
+	}
+
+	kfree(merge);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel symbol table lookup. See ksyms.h for how the table gets into
+ * the image.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <ksyms.h>
+
+/*
+ * The table only records where each function starts, not where the
+ * text ends, so a pc past the last function would otherwise resolve
+ * to it with an absurd offset. No kernel function is anywhere near
+ * this big; treat larger offsets as no match.
+ */
+#define KSYMS_MAXOFFSET 0x10000
+
+bool
+ksyms_lookup(vaddr_t pc, const char **name, vaddr_t *offset)
+{
+	unsigned lo, hi, mid;
+
+	if (ksyms_count == 0 || pc < ksyms_addrs[0]) {
+		return false;
+	}
+
+	/* Binary search for the largest address <= pc. */
+	lo = 0;
+	hi = ksyms_count;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (ksyms_addrs[mid] <= pc) {
+			lo = mid;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	if (pc - ksyms_addrs[lo] >= KSYMS_MAXOFFSET) {
+		return false;
+	}
+
+	*name = ksyms_names + ksyms_nameoffs[lo];
+	*offset = pc - ksyms_addrs[lo];
+	return true;
+}
+
+const char *
+ksyms_format(vaddr_t pc, char *buf, size_t maxlen)
+{
+	const char *name;
+	vaddr_t offset;
+
+	if (ksyms_lookup(pc, &name, &offset)) {
+		snprintf(buf, maxlen, "%s+0x%lx",
+			 name, (unsigned long)offset);
+	}
+	else {
+		snprintf(buf, maxlen, "0x%08lx", (unsigned long)pc);
+	}
+	return buf;
+}
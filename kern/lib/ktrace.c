@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel event tracer. See ktrace.h for the ground rules.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <lamebus/ltrace.h> // for ltrace_debug()
+#include <ktrace.h>
+
+bool ktrace_on;
+
+/* Also mirror records to the trace161 control device? */
+static bool ktrace_host;
+
+/*
+ * Per-cpu ring, written only by its own cpu. kt_head counts records
+ * ever written; a record lands in slot kt_head % KTRACE_PERCPU, so
+ * min(kt_head, KTRACE_PERCPU) slots hold valid records and the oldest
+ * is at kt_head - that count.
+ */
+struct ktrace_ring {
+	struct ktrace_record *kt_recs;	/* KTRACE_PERCPU records */
+	uint32_t kt_head;		/* Next sequence number */
+};
+
+/* Like QSL_MAXCPUS in spinlock.c: sys161's limit, kept MI here. */
+#define KTRACE_MAXCPUS 32
+
+static struct ktrace_ring ktrace_rings[KTRACE_MAXCPUS];
+
+/* Longest line ktrace_format_line can produce, with the NUL. */
+#define KTRACE_LINEMAX 80
+
+void
+ktrace_record(uint32_t id, uint32_t arg0, uint32_t arg1)
+{
+	struct ktrace_ring *kt;
+	struct ktrace_record *kr;
+	int spl;
+
+	/*
+	 * IPL_HIGH pins us to this cpu for the duration, and means
+	 * interrupt handlers can trace too; since only its own cpu
+	 * writes a ring, no lock is needed.
+	 */
+	spl = splhigh();
+	kt = &ktrace_rings[curcpu->c_number];
+	if (kt->kt_recs != NULL) {
+		kr = &kt->kt_recs[kt->kt_head % KTRACE_PERCPU];
+		kr->kr_id = id;
+		kr->kr_cycles = cpu_cyclecount();
+		kr->kr_arg0 = arg0;
+		kr->kr_arg1 = arg1;
+		kt->kt_head++;
+	}
+	if (ktrace_host) {
+		/*
+		 * One register write; sys161 timestamps it on the
+		 * host side. If there is no ltrace device this is a
+		 * no-op.
+		 */
+		ltrace_debug(KTRACE_HOSTCODE(id, arg0));
+	}
+	splx(spl);
+}
+
+void
+ktrace_enable(bool on)
+{
+	ktrace_on = on;
+}
+
+void
+ktrace_hostenable(bool on)
+{
+	ktrace_host = on;
+}
+
+void
+ktrace_reset(void)
+{
+	unsigned i;
+
+	for (i = 0; i < KTRACE_MAXCPUS; i++) {
+		if (ktrace_rings[i].kt_recs != NULL) {
+			bzero(ktrace_rings[i].kt_recs,
+			      KTRACE_PERCPU * sizeof(struct ktrace_record));
+			ktrace_rings[i].kt_head = 0;
+		}
+	}
+}
+
+void
+ktrace_bootstrap(void)
+{
+	unsigned i;
+
+	KASSERT(num_cpus > 0);
+	KASSERT(num_cpus <= KTRACE_MAXCPUS);
+
+	for (i = 0; i < num_cpus; i++) {
+		ktrace_rings[i].kt_recs =
+			kmalloc(KTRACE_PERCPU *
+				sizeof(struct ktrace_record));
+		if (ktrace_rings[i].kt_recs == NULL) {
+			panic("ktrace: out of memory\n");
+		}
+		bzero(ktrace_rings[i].kt_recs,
+		      KTRACE_PERCPU * sizeof(struct ktrace_record));
+	}
+}
+
+/*
+ * Names for the decoder. Anything unknown shows up by number.
+ */
+static
+const char *
+ktrace_name(uint32_t id)
+{
+	switch (id) {
+	    case KTR_VM_FAULT:		return "vm_fault";
+	    case KTR_THREAD_SWITCH:	return "thread_switch";
+	    case KTR_LHD_READ:		return "lhd_read";
+	    case KTR_LHD_WRITE:		return "lhd_write";
+	    default:			return NULL;
+	}
+}
+
+/*
+ * Decode one record into BUF. The menu command and the device share
+ * this so both produce the same text; records are decoded one line at
+ * a time instead of into one big report buffer, since a full report
+ * can run to many pages.
+ */
+static
+size_t
+ktrace_format_line(char *buf, size_t maxlen, uint32_t seq,
+		   const struct ktrace_record *kr)
+{
+	const char *name;
+
+	name = ktrace_name(kr->kr_id);
+	if (name != NULL) {
+		return snprintf(buf, maxlen,
+				" %8lu %10lu %-14s 0x%08lx 0x%08lx\n",
+				(unsigned long)seq,
+				(unsigned long)kr->kr_cycles,
+				name,
+				(unsigned long)kr->kr_arg0,
+				(unsigned long)kr->kr_arg1);
+	}
+	return snprintf(buf, maxlen,
+			" %8lu %10lu #%-13lu 0x%08lx 0x%08lx\n",
+			(unsigned long)seq,
+			(unsigned long)kr->kr_cycles,
+			(unsigned long)kr->kr_id,
+			(unsigned long)kr->kr_arg0,
+			(unsigned long)kr->kr_arg1);
+}
+
+/* How many of ring I's slots are valid, and the oldest sequence number. */
+static
+void
+ktrace_ring_span(unsigned i, uint32_t *start, uint32_t *end)
+{
+	uint32_t head, count;
+
+	head = ktrace_rings[i].kt_head;
+	count = head < KTRACE_PERCPU ? head : KTRACE_PERCPU;
+	*start = head - count;
+	*end = head;
+}
+
+void
+ktrace_dump(void)
+{
+	char line[KTRACE_LINEMAX];
+	uint32_t seq, start, end;
+	unsigned i;
+
+	kprintf("Kernel trace (tracing %s):\n", ktrace_on ? "on" : "off");
+	for (i = 0; i < KTRACE_MAXCPUS; i++) {
+		if (ktrace_rings[i].kt_recs == NULL) {
+			continue;
+		}
+		ktrace_ring_span(i, &start, &end);
+		kprintf("cpu %u: %lu records\n", i,
+			(unsigned long)(end - start));
+		for (seq = start; seq != end; seq++) {
+			ktrace_format_line(line, sizeof(line), seq,
+				&ktrace_rings[i].kt_recs
+					[seq % KTRACE_PERCPU]);
+			kprintf("%s", line);
+		}
+	}
+}
+
+/*
+ * The "ktrace:" device: reading it produces the same report as the
+ * menu command, regenerated on each read. Rather than rendering the
+ * whole report into memory, each line is formatted on the stack and
+ * the slice overlapping the read is copied out, with POS tracking how
+ * much of the report precedes the current line.
+ */
+
+static
+int
+ktracedev_emit(struct uio *uio, size_t *pos, const char *line, size_t len)
+{
+	size_t skip, amt;
+
+	if (*pos + len <= (size_t)uio->uio_offset) {
+		/* Entirely before the region being read. */
+		*pos += len;
+		return 0;
+	}
+
+	skip = 0;
+	if ((size_t)uio->uio_offset > *pos) {
+		skip = (size_t)uio->uio_offset - *pos;
+	}
+	amt = len - skip;
+	if (amt > uio->uio_resid) {
+		amt = uio->uio_resid;
+	}
+	*pos += len;
+	return uiomove((char *)line + skip, amt, uio);
+}
+
+static
+int
+ktracedev_eachopen(struct device *dev, int openflags)
+{
+	(void)dev;
+	(void)openflags;
+
+	return 0;
+}
+
+static
+int
+ktracedev_io(struct device *dev, struct uio *uio)
+{
+	char line[KTRACE_LINEMAX];
+	uint32_t seq, start, end;
+	unsigned i;
+	size_t pos, len;
+	int err;
+
+	(void)dev;
+
+	if (uio->uio_rw != UIO_READ) {
+		return EIO;
+	}
+
+	// Reads past the end of the report produce EOF
+	pos = 0;
+	for (i = 0; i < KTRACE_MAXCPUS && uio->uio_resid > 0; i++) {
+		if (ktrace_rings[i].kt_recs == NULL) {
+			continue;
+		}
+		ktrace_ring_span(i, &start, &end);
+		len = snprintf(line, sizeof(line), "cpu %u: %lu records\n",
+			       i, (unsigned long)(end - start));
+		err = ktracedev_emit(uio, &pos, line, len);
+		if (err) {
+			return err;
+		}
+		for (seq = start; seq != end && uio->uio_resid > 0; seq++) {
+			len = ktrace_format_line(line, sizeof(line), seq,
+				&ktrace_rings[i].kt_recs
+					[seq % KTRACE_PERCPU]);
+			err = ktracedev_emit(uio, &pos, line, len);
+			if (err) {
+				return err;
+			}
+		}
+	}
+	return 0;
+}
+
+static
+int
+ktracedev_ioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+static const struct device_ops ktrace_devops = {
+	.devop_eachopen = ktracedev_eachopen,
+	.devop_io = ktracedev_io,
+	.devop_ioctl = ktracedev_ioctl,
+	.devop_poll = dev_poll_always,
+};
+
+/*
+ * Function to create and attach ktrace:
+ */
+void
+ktracedev_create(void)
+{
+	int result;
+	struct device *dev;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev==NULL) {
+		panic("Could not add ktrace device: out of memory\n");
+	}
+
+	dev->d_ops = &ktrace_devops;
+
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+
+	dev->d_data = NULL;
+
+	result = vfs_adddev("ktrace", dev, 0);
+	if (result) {
+		panic("Could not add ktrace device: %s\n",
+		      strerror(result));
+	}
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock-free ring buffers; see ringbuf.h for the rules.
+ *
+ * Both flavors use free-running 32-bit indexes that are only masked
+ * when touching the backing store. The number of elements in the
+ * ring is always head - tail, which remains correct across index
+ * wraparound thanks to unsigned arithmetic, as long as the capacity
+ * is a power of two.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <atomic.h>
+#include <membar.h>
+#include <ringbuf.h>
+
+/*
+ * True if n is a power of 2; for asserting capacities.
+ */
+static
+bool
+ispow2(uint32_t n)
+{
+	return n != 0 && (n & (n - 1)) == 0;
+}
+
+////////////////////////////////////////////////////////////
+// SPSC byte ring
+
+void
+ringbuf_init(struct ringbuf *rb, void *buf, uint32_t size)
+{
+	KASSERT(rb != NULL);
+	KASSERT(buf != NULL);
+	KASSERT(ispow2(size));
+
+	rb->rb_data = buf;
+	rb->rb_mask = size - 1;
+	rb->rb_head = 0;
+	rb->rb_tailcache = 0;
+	rb->rb_tail = 0;
+	rb->rb_headcache = 0;
+}
+
+uint32_t
+ringbuf_produce(struct ringbuf *rb, const void *src, uint32_t len)
+{
+	uint32_t head, space, pos, first;
+
+	head = rb->rb_head;
+
+	/*
+	 * Compute the space against the cached tail; only if that
+	 * says we'd have to truncate is it worth paying for a read
+	 * of the consumer's index.
+	 */
+	space = (rb->rb_mask + 1) - (head - rb->rb_tailcache);
+	if (space < len) {
+		rb->rb_tailcache = atomic_load_acquire(&rb->rb_tail);
+		space = (rb->rb_mask + 1) - (head - rb->rb_tailcache);
+	}
+	if (space < len) {
+		len = space;
+	}
+	if (len == 0) {
+		return 0;
+	}
+
+	/* At most two segments: up to the end of the buffer, then wrap. */
+	pos = head & rb->rb_mask;
+	first = rb->rb_mask + 1 - pos;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(rb->rb_data + pos, src, first);
+	if (len > first) {
+		memcpy(rb->rb_data, (const uint8_t *)src + first,
+		       len - first);
+	}
+
+	/* Publish: the data must be visible before the new head is. */
+	atomic_store_release(&rb->rb_head, head + len);
+	return len;
+}
+
+uint32_t
+ringbuf_consume(struct ringbuf *rb, void *dst, uint32_t len)
+{
+	uint32_t tail, used, pos, first;
+
+	tail = rb->rb_tail;
+
+	used = rb->rb_headcache - tail;
+	if (used < len) {
+		rb->rb_headcache = atomic_load_acquire(&rb->rb_head);
+		used = rb->rb_headcache - tail;
+	}
+	if (used < len) {
+		len = used;
+	}
+	if (len == 0) {
+		return 0;
+	}
+
+	pos = tail & rb->rb_mask;
+	first = rb->rb_mask + 1 - pos;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(dst, rb->rb_data + pos, first);
+	if (len > first) {
+		memcpy((uint8_t *)dst + first, rb->rb_data, len - first);
+	}
+
+	/* Free the slots only after the data has been copied out. */
+	atomic_store_release(&rb->rb_tail, tail + len);
+	return len;
+}
+
+uint32_t
+ringbuf_used(const struct ringbuf *rb)
+{
+	return rb->rb_head - rb->rb_tail;
+}
+
+////////////////////////////////////////////////////////////
+// MPSC pointer ring
+
+void
+mpscring_init(struct mpscring *mr, void * volatile *slots, uint32_t size)
+{
+	uint32_t i;
+
+	KASSERT(mr != NULL);
+	KASSERT(slots != NULL);
+	KASSERT(ispow2(size));
+
+	for (i = 0; i < size; i++) {
+		slots[i] = NULL;
+	}
+	mr->mr_slots = slots;
+	mr->mr_mask = size - 1;
+	mr->mr_head = 0;
+	mr->mr_tail = 0;
+}
+
+bool
+mpscring_tryput(struct mpscring *mr, void *ptr)
+{
+	uint32_t head, tail;
+
+	KASSERT(ptr != NULL);
+
+	/* Claim a slot index. */
+	for (;;) {
+		head = atomic_load_acquire(&mr->mr_head);
+		tail = atomic_load_acquire(&mr->mr_tail);
+		if (head - tail > mr->mr_mask) {
+			return false;
+		}
+		if (atomic_cas(&mr->mr_head, head, head + 1) == head) {
+			break;
+		}
+	}
+
+	/*
+	 * The consumer nulled this slot before retiring it, and the
+	 * claim proves it has been retired, so it is empty and ours.
+	 * Publish with a release so whatever PTR points at is visible
+	 * to the consumer before the pointer is.
+	 */
+	KASSERT(mr->mr_slots[head & mr->mr_mask] == NULL);
+	membar_any_store();
+	mr->mr_slots[head & mr->mr_mask] = ptr;
+	return true;
+}
+
+void *
+mpscring_get(struct mpscring *mr)
+{
+	uint32_t tail;
+	void *ptr;
+
+	tail = mr->mr_tail;
+	ptr = mr->mr_slots[tail & mr->mr_mask];
+	if (ptr == NULL) {
+		/* Empty, or the oldest slot isn't published yet. */
+		return NULL;
+	}
+	membar_load_load();
+
+	/* Null the slot first; the release on mr_tail orders it. */
+	mr->mr_slots[tail & mr->mr_mask] = NULL;
+	atomic_store_release(&mr->mr_tail, tail + 1);
+	return ptr;
+}
@@ -42,17 +42,92 @@ int
 uiomove(void *ptr, size_t n, struct uio *uio)
 {
 	struct iovec *iov;
-	size_t size;
+	size_t size, seg;
 	int result;
 
 	if (uio->uio_rw != UIO_READ && uio->uio_rw != UIO_WRITE) {
 		panic("uiomove: Invalid uio_rw %d\n", (int) uio->uio_rw);
 	}
-	if (uio->uio_segflg==UIO_SYSSPACE) {
+
+	size = uio->uio_resid < n ? uio->uio_resid : n;
+
+	switch (uio->uio_segflg) {
+	    case UIO_SYSSPACE:
 		KASSERT(uio->uio_space == NULL);
-	}
-	else {
+
+		/*
+		 * Fast path for the overwhelmingly common kernel-to-
+		 * kernel case (file system metadata, swap I/O, buffer
+		 * cache): a single iovec covering the whole transfer.
+		 * The two buffers never overlap, so plain memcpy
+		 * applies.
+		 */
+		iov = uio->uio_iov;
+		if (uio->uio_iovcnt == 1 && iov->iov_len >= size) {
+			if (size > 0) {
+				if (uio->uio_rw == UIO_READ) {
+					memcpy(iov->iov_kbase, ptr, size);
+				}
+				else {
+					memcpy(ptr, iov->iov_kbase, size);
+				}
+				iov->iov_kbase = (char *)iov->iov_kbase+size;
+				iov->iov_len -= size;
+				uio->uio_resid -= size;
+				uio->uio_offset += size;
+			}
+			return 0;
+		}
+		/* Multiple kernel iovecs: general loop below. */
+		break;
+	    case UIO_USERSPACE:
+	    case UIO_USERISPACE:
 		KASSERT(uio->uio_space == proc_getas());
+
+		/*
+		 * User transfers go through copyinv/copyoutv, which
+		 * validate all the address ranges and set up fault
+		 * recovery once for the whole transfer rather than
+		 * once per segment. On EFAULT the uio isn't updated;
+		 * callers abandon the transfer entirely, the same as
+		 * they must for plain copyin/copyout.
+		 */
+		if (size == 0) {
+			return 0;
+		}
+		if (uio->uio_rw == UIO_READ) {
+			result = copyoutv(ptr, uio->uio_iov,
+					  uio->uio_iovcnt, size);
+		}
+		else {
+			result = copyinv(uio->uio_iov,
+					 uio->uio_iovcnt, ptr, size);
+		}
+		if (result) {
+			return result;
+		}
+
+		/* Now advance the uio past what was copied. */
+		uio->uio_resid -= size;
+		uio->uio_offset += size;
+		while (size > 0) {
+			iov = uio->uio_iov;
+			seg = iov->iov_len < size ? iov->iov_len : size;
+			if (seg == 0) {
+				/* exhausting iovecs would have asserted */
+				uio->uio_iov++;
+				uio->uio_iovcnt--;
+				KASSERT(uio->uio_iovcnt > 0);
+				continue;
+			}
+			iov->iov_ubase += seg;
+			iov->iov_len -= seg;
+			size -= seg;
+		}
+		return 0;
+	    default:
+		panic("uiomove: Invalid uio_segflg %d\n",
+		      (int)uio->uio_segflg);
 	}
 
 	while (n > 0 && uio->uio_resid > 0) {
@@ -80,33 +155,14 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 			continue;
 		}
 
-		switch (uio->uio_segflg) {
-		    case UIO_SYSSPACE:
-			    if (uio->uio_rw == UIO_READ) {
-				    memmove(iov->iov_kbase, ptr, size);
-			    }
-			    else {
-				    memmove(ptr, iov->iov_kbase, size);
-			    }
-			    iov->iov_kbase = ((char *)iov->iov_kbase+size);
-			    break;
-		    case UIO_USERSPACE:
-		    case UIO_USERISPACE:
-			    if (uio->uio_rw == UIO_READ) {
-				    result = copyout(ptr, iov->iov_ubase,size);
-			    }
-			    else {
-				    result = copyin(iov->iov_ubase, ptr, size);
-			    }
-			    if (result) {
-				    return result;
-			    }
-			    iov->iov_ubase += size;
-			    break;
-		    default:
-			    panic("uiomove: Invalid uio_segflg %d\n",
-				  (int)uio->uio_segflg);
+		/* memmove, not memcpy: multi-iovec callers might overlap */
+		if (uio->uio_rw == UIO_READ) {
+			memmove(iov->iov_kbase, ptr, size);
+		}
+		else {
+			memmove(ptr, iov->iov_kbase, size);
 		}
+		iov->iov_kbase = ((char *)iov->iov_kbase+size);
 
 		iov->iov_len -= size;
 		uio->uio_resid -= size;
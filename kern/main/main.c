@@ -48,6 +48,9 @@
 #include <device.h>
 #include <syscall.h>
 #include <test.h>
+#include <ktrace.h>
+#include <kprof.h>
+#include <workqueue.h>
 #include <kern/test161.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
@@ -109,6 +112,7 @@ boot(void)
 	/* Early initialization. */
 	ram_bootstrap();
 	vm_bootstrap();
+	kheap_shrinker_bootstrap();
 	pid_table_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
@@ -126,11 +130,18 @@ boot(void)
 	kprintf("\n");
 	kheap_nextgeneration();
 
+	/* The clock device exists now; start the shared clock page. */
+	userclock_bootstrap();
+
 	/* Late phase of initialization. */
 	coremap_dump();
 	swap_init();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	ktrace_bootstrap();
+	kprof_bootstrap();
+	workqueue_bootstrap();
+	asreaper_bootstrap();
 	test161_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
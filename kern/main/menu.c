@@ -31,6 +31,8 @@
 #include <kern/errno.h>
 #include <kern/reboot.h>
 #include <kern/unistd.h>
+#include <kern/wait.h>
+#include <kern/vmstat.h>
 #include <limits.h>
 #include <lib.h>
 #include <uio.h>
@@ -38,10 +40,19 @@
 #include <mainbus.h>
 #include <synch.h>
 #include <thread.h>
+#include <lockstat.h>
+#include <softirq.h>
+#include <iostat.h>
+#include <syscallstat.h>
+#include <trapstat.h>
+#include <ktrace.h>
+#include <kprof.h>
+#include <vm.h>
 #include <proc.h>
 #include <vfs.h>
 #include <sfs.h>
 #include <syscall.h>
+#include <checkpoint.h>
 #include <test.h>
 #include <prompt.h>
 #include "opt-sfs.h"
@@ -119,29 +130,140 @@ cmd_progthread(void *ptr, unsigned long nargs)
 	/* NOTREACHED: runprogram only returns on error. */
 }
 
+/*
+ * Background job table. Jobs are launched by "p program args &",
+ * listed by "jobs", and reaped by "wait". Only the menu thread
+ * touches the table, so no locking is needed. A slot is in use while
+ * its pid is nonzero; the process stays a zombie (and its pid stays
+ * valid) until we reap it with sys_kwaitpid.
+ */
+
+#define MAXJOBS 16
+
+static struct {
+	pid_t mj_pid;			/* 0 means slot free */
+	char mj_name[32];		/* program name, may be truncated */
+} jobtable[MAXJOBS];
+
+/*
+ * Print one job's exit status the way the shell would.
+ */
+static
+void
+job_printstatus(int jobnum, const char *name, int status)
+{
+	if (WIFSIGNALED(status)) {
+		kprintf("[%d] %s: signal %d\n", jobnum, name,
+			WTERMSIG(status));
+	}
+	else {
+		kprintf("[%d] %s: exit %d\n", jobnum, name,
+			WEXITSTATUS(status));
+	}
+}
+
+/*
+ * Reap one job slot (must be in use), blocking until the program
+ * exits if it hasn't yet.
+ */
+static
+void
+job_reap(int slot)
+{
+	int status, err;
+
+	err = sys_kwaitpid(jobtable[slot].mj_pid, 0, &status);
+	if (err) {
+		panic("menu: kwaitpid failed: %s\n", strerror(err));
+	}
+	job_printstatus(slot+1, jobtable[slot].mj_name, status);
+	jobtable[slot].mj_pid = 0;
+}
+
+/*
+ * Copy a menu argument vector into a single heap block, pointers
+ * first, then the strings. Background jobs need this because the
+ * menu's own args buffer is reused for the next command as soon as we
+ * return, while the job's thread is still reading it.
+ */
+static
+char **
+job_copyargs(int nargs, char **args)
+{
+	size_t len;
+	char **newargs;
+	char *buf;
+	int i;
+
+	len = (nargs+1) * sizeof(char *);
+	for (i=0; i<nargs; i++) {
+		len += strlen(args[i]) + 1;
+	}
+
+	newargs = kmalloc(len);
+	if (newargs == NULL) {
+		return NULL;
+	}
+
+	buf = (char *)&newargs[nargs+1];
+	for (i=0; i<nargs; i++) {
+		strcpy(buf, args[i]);
+		newargs[i] = buf;
+		buf += strlen(args[i]) + 1;
+	}
+	newargs[nargs] = NULL;
+
+	return newargs;
+}
+
 /*
  * Common code for cmd_prog and cmd_shell.
  *
- * Note that this does not wait for the subprogram to finish, but
- * returns immediately to the menu. This is usually not what you want,
- * so you should have it call your system-calls-assignment waitpid
- * code after forking.
- *
- * Also note that because the subprogram's thread uses the "args"
- * array and strings, until you do this a race condition exists
- * between that code and the menu input code.
+ * In the foreground case (the default) this waits for the subprogram
+ * to finish before returning to the menu. In the background case it
+ * returns to the prompt immediately, leaving a job table entry to be
+ * inspected with "jobs" and reaped with "wait".
  */
 static
 int
-common_prog(int nargs, char **args)
+common_prog(int nargs, char **args, bool background)
 {
 	struct proc *proc;
 	int result;
+	int slot = -1;
 	unsigned tc;
 
+	if (background) {
+		/* Claim a job slot first; don't launch unreapable jobs. */
+		for (slot=0; slot<MAXJOBS; slot++) {
+			if (jobtable[slot].mj_pid == 0) {
+				break;
+			}
+		}
+		if (slot == MAXJOBS) {
+			kprintf("Too many background jobs; "
+				"use wait to reap some\n");
+			return ENOMEM;
+		}
+
+		/*
+		 * Copy the args out of the menu's buffer. Like the
+		 * progname and kargs blocks in cmd_progthread, this
+		 * is never freed; runprogram doesn't return on
+		 * success and there's no one left to free it.
+		 */
+		args = job_copyargs(nargs, args);
+		if (args == NULL) {
+			return ENOMEM;
+		}
+	}
+
 	/* Create a process for the new program to run in. */
 	proc = proc_create_runprogram(args[0] /* name */);
 	if (proc == NULL) {
+		if (background) {
+			kfree(args);
+		}
 		return ENOMEM;
 	}
 
@@ -154,9 +276,21 @@ common_prog(int nargs, char **args)
 	if (result) {
 		kprintf("thread_fork failed: %s\n", strerror(result));
 		proc_destroy(proc);
+		if (background) {
+			kfree(args);
+		}
 		return result;
 	}
 
+	if (background) {
+		jobtable[slot].mj_pid = proc->p_pid;
+		snprintf(jobtable[slot].mj_name,
+			 sizeof(jobtable[slot].mj_name), "%s", args[0]);
+		kprintf("[%d] %s (pid %d)\n", slot+1, args[0],
+			(int)proc->p_pid);
+		return 0;
+	}
+
 	// Wait for the program to finish
 	int statuscode;
 	int err = sys_kwaitpid(proc->p_pid, 0, &statuscode);
@@ -172,6 +306,185 @@ common_prog(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Thread for ckrestore: rebuilds a checkpointed process around itself
+ * and enters user mode (see checkpoint_restore). Like cmd_progthread,
+ * the path block is never freed on success; there's no one left to
+ * free it.
+ */
+static
+void
+cmd_ckrestorethread(void *ptr, unsigned long nargs)
+{
+	char *path = ptr;
+	int result;
+
+	(void)nargs;
+
+	result = checkpoint_restore(path);
+	/* checkpoint_restore only returns on error */
+	kprintf("Restoring %s failed: %s\n", path, strerror(result));
+	sys__exit(result);
+}
+
+/*
+ * Command to rebuild a process from a checkpoint file and run it.
+ * Waits for it like a foreground program.
+ */
+static
+int
+cmd_ckrestore(int nargs, char **args)
+{
+	struct proc *proc;
+	char *path;
+	unsigned tc;
+	int result;
+
+	if (nargs != 2) {
+		kprintf("Usage: ckrestore checkpointfile\n");
+		return EINVAL;
+	}
+
+	/* Copied because checkpoint_restore hands it to vfs_open. */
+	path = kstrdup(args[1]);
+	if (path == NULL) {
+		return ENOMEM;
+	}
+
+	proc = proc_create_runprogram(args[1]);
+	if (proc == NULL) {
+		kfree(path);
+		return ENOMEM;
+	}
+
+	tc = thread_count;
+
+	result = thread_fork(args[1], proc, cmd_ckrestorethread, path, 0);
+	if (result) {
+		kprintf("thread_fork failed: %s\n", strerror(result));
+		proc_destroy(proc);
+		kfree(path);
+		return result;
+	}
+
+	// Wait for the restored program to finish
+	int statuscode;
+	result = sys_kwaitpid(proc->p_pid, 0, &statuscode);
+	if (result) {
+		panic("ckrestore: kwaitpid failed: %s\n", strerror(result));
+	}
+
+	thread_wait_for_count(tc);
+
+	return 0;
+}
+
+/*
+ * Command to list background jobs, without blocking on any of them.
+ */
+static
+int
+cmd_jobs(int nargs, char **args)
+{
+	struct proc *proc;
+	bool exited;
+	int i, njobs;
+
+	(void)nargs;
+	(void)args;
+
+	njobs = 0;
+	for (i=0; i<MAXJOBS; i++) {
+		if (jobtable[i].mj_pid == 0) {
+			continue;
+		}
+		njobs++;
+
+		proc = pid_table_lookup(jobtable[i].mj_pid);
+		KASSERT(proc != NULL);
+
+		lock_acquire(proc->p_cv_lock);
+		exited = proc->p_has_exited;
+		lock_release(proc->p_cv_lock);
+
+		kprintf("[%d] %s (pid %d): %s\n", i+1,
+			jobtable[i].mj_name, (int)jobtable[i].mj_pid,
+			exited ? "done" : "running");
+	}
+	if (njobs == 0) {
+		kprintf("No background jobs\n");
+	}
+	return 0;
+}
+
+/*
+ * Command to reap background jobs: "wait" reaps all of them, in job
+ * number order, blocking as needed; "wait N" reaps just job N.
+ */
+static
+int
+cmd_wait(int nargs, char **args)
+{
+	int i;
+
+	if (nargs > 2) {
+		kprintf("Usage: wait [jobnumber]\n");
+		return EINVAL;
+	}
+
+	if (nargs == 2) {
+		i = atoi(args[1]) - 1;
+		if (i < 0 || i >= MAXJOBS || jobtable[i].mj_pid == 0) {
+			kprintf("wait: no such job\n");
+			return EINVAL;
+		}
+		job_reap(i);
+		return 0;
+	}
+
+	for (i=0; i<MAXJOBS; i++) {
+		if (jobtable[i].mj_pid != 0) {
+			job_reap(i);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Command to list the process table with paging statistics, so one
+ * can see which process is thrashing (faults/swapins climbing) and
+ * how much memory each footprint actually needs.
+ */
+static
+int
+cmd_ps(int nargs, char **args)
+{
+	char name[32];
+	struct pvmstats pvs;
+	bool exited;
+	pid_t pid;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("  PID STATE    RSS   SWAP  FAULTS    COW SWAPIN NAME\n");
+	for (pid = 1; pid < PID_MAX; pid++) {
+		if (proc_getvmstats(pid, name, sizeof(name), &exited,
+				    &pvs) != 0) {
+			continue;
+		}
+		kprintf("%5d %-5s %6lu %6lu %7lu %6lu %6lu %s\n",
+			(int)pid, exited ? "zomb" : "run",
+			(unsigned long)pvs.pvs_resident,
+			(unsigned long)pvs.pvs_swapslots,
+			(unsigned long)pvs.pvs_faults,
+			(unsigned long)pvs.pvs_cowfaults,
+			(unsigned long)pvs.pvs_swapins,
+			name);
+	}
+	return 0;
+}
+
 /*
  * Command for running an arbitrary userlevel program.
  */
@@ -179,8 +492,10 @@ static
 int
 cmd_prog(int nargs, char **args)
 {
+	bool background = false;
+
 	if (nargs < 2) {
-		kprintf("Usage: p program [arguments]\n");
+		kprintf("Usage: p program [arguments] [&]\n");
 		return EINVAL;
 	}
 
@@ -188,7 +503,13 @@ cmd_prog(int nargs, char **args)
 	args++;
 	nargs--;
 
-	return common_prog(nargs, args);
+	/* a trailing & means run in the background */
+	if (nargs > 1 && !strcmp(args[nargs-1], "&")) {
+		background = true;
+		nargs--;
+	}
+
+	return common_prog(nargs, args, background);
 }
 
 /*
@@ -206,7 +527,7 @@ cmd_shell(int nargs, char **args)
 
 	args[0] = (char *)_PATH_SHELL;
 
-	return common_prog(nargs, args);
+	return common_prog(nargs, args, false);
 }
 
 /*
@@ -496,6 +817,18 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kheapclassstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kheap_printclassstats();
+
+	return 0;
+}
+
 static
 int
 cmd_kheapused(int nargs, char **args)
@@ -537,6 +870,222 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_schedparams(int nargs, char **args)
+{
+	if (nargs == 1) {
+		sched_dumpparams();
+		return 0;
+	}
+	if (nargs != 3) {
+		kprintf("Usage: sched [numqueues basequantum]\n");
+		return EINVAL;
+	}
+	return sched_setparams(atoi(args[1]), atoi(args[2]));
+}
+
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		schedstat_dump();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		schedstat_reset();
+		return 0;
+	}
+	kprintf("Usage: schedstat [reset]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for dumping or clearing the lock contention profile.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lockstat_dump();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+		return 0;
+	}
+	kprintf("Usage: lockstat [reset]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for the per-syscall statistics.
+ */
+static
+int
+cmd_syscallstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		syscallstat_dump();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		syscallstat_enable(true);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		syscallstat_enable(false);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		syscallstat_reset();
+		return 0;
+	}
+	kprintf("Usage: syscallstat [on|off|reset]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for interrupt (softirq) steering: with no arguments, list
+ * the slots; with a slot number and a cpu number, route that
+ * device's completion work to that cpu ("any" to unsteer).
+ */
+static
+int
+cmd_intsteer(int nargs, char **args)
+{
+	if (nargs == 1) {
+		softirq_printsteering();
+		return 0;
+	}
+	if (nargs == 3) {
+		unsigned cpunum;
+
+		if (!strcmp(args[2], "any")) {
+			cpunum = SOFTIRQ_AFFINITY_ANY;
+		}
+		else {
+			cpunum = atoi(args[2]);
+		}
+		return softirq_setaffinity(atoi(args[1]), cpunum);
+	}
+	kprintf("Usage: intsteer [softirq cpu|any]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for the per-device interrupt and I/O statistics.
+ */
+static
+int
+cmd_iostat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	mainbus_dumpirqstats();
+	kprintf("\n");
+	iostat_dump();
+	return 0;
+}
+
+/*
+ * Command for the kernel event tracer.
+ */
+static
+int
+cmd_ktrace(int nargs, char **args)
+{
+	if (nargs == 1) {
+		ktrace_dump();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		ktrace_enable(true);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		ktrace_enable(false);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		ktrace_reset();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "host")) {
+		ktrace_hostenable(true);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "nohost")) {
+		ktrace_hostenable(false);
+		return 0;
+	}
+	kprintf("Usage: ktrace [on|off|reset|host|nohost]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for the sampling kernel profiler.
+ */
+static
+int
+cmd_kprof(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kprof_dump();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		kprof_enable(true);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		kprof_enable(false);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		kprof_reset();
+		return 0;
+	}
+	kprintf("Usage: kprof [on|off|reset]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for the paging statistics.
+ */
+static
+int
+cmd_vmstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vmstat_dump();
+	return 0;
+}
+
+/*
+ * Command for the exception statistics.
+ */
+static
+int
+cmd_trapstat(int nargs, char **args)
+{
+	if (nargs == 1) {
+		trapstat_dump();
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		trapstat_reset();
+		return 0;
+	}
+	kprintf("Usage: trapstat [reset]\n");
+	return EINVAL;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -568,11 +1117,15 @@ showmenu(const char *name, const char *x[])
 
 static const char *opsmenu[] = {
 	"[s]       Shell                     ",
-	"[p]       Other program             ",
+	"[p]       Other program (& = bg)    ",
+	"[jobs]    List background jobs      ",
+	"[wait]    Reap background jobs      ",
+	"[ps]      Process list w/ VM stats  ",
 	"[mount]   Mount a filesystem        ",
 	"[unmount] Unmount a filesystem      ",
 	"[bootfs]  Set \"boot\" filesystem     ",
 	"[pf]      Print a file              ",
+	"[ckrestore] Restore a checkpoint    ",
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
@@ -597,6 +1150,7 @@ cmd_opsmenu(int n, char **a)
 static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[at2] Large array test              ",
+	"[at3] Valarray test                 ",
 	"[bt]  Bitmap test                   ",
 	"[tlt] Threadlist test               ",
 	"[km1] Kernel malloc test            ",
@@ -621,6 +1175,7 @@ static const char *testmenu[] = {
 	"[cvt3] CV test 3             (1*)   ",
 	"[cvt4] CV test 4             (1*)   ",
 	"[cvt5] CV test 5             (1)    ",
+	"[cvt6] CV test 6 (timed wait)(1)    ",
 	"[rwt1] RW lock test          (1)   ",
 	"[rwt2] RW lock test 2        (1*)   ",
 	"[rwt3] RW lock test 3        (1*)   ",
@@ -629,6 +1184,8 @@ static const char *testmenu[] = {
 #if OPT_SYNCHPROBS
 	"[sp1] Whalemating test       (1)    ",
 	"[sp2] Stoplight test         (1)    ",
+	"[sp1b] Whalemating benchmark (1)    ",
+	"[sp2b] Stoplight benchmark   (1)    ",
 #endif
 	"[semu1-22] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
@@ -637,7 +1194,9 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+	"[fs7] FS throughput benchmark       ",
 	"[hm1] HMAC unit test                ",
+	"[kbench] Kernel micro-benchmarks    ",
 	NULL
 };
 
@@ -685,9 +1244,20 @@ static const char *mainmenu[] = {
 	"[?o] Operations menu                ",
 	"[?t] Tests menu                     ",
 	"[kh] Kernel heap stats              ",
+	"[khstat] Kernel heap size classes   ",
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[sched] Scheduler parameters        ",
+	"[schedstat] Scheduler statistics    ",
+	"[lockstat]  Lock contention profile ",
+	"[syscallstat] Syscall statistics    ",
+	"[intsteer] Interrupt steering       ",
+	"[iostat] Device I/O statistics      ",
+	"[ktrace] Kernel event trace         ",
+	"[kprof] Sampling kernel profile     ",
+	"[vmstat] VM statistics              ",
+	"[trapstat] Exception statistics     ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -724,10 +1294,14 @@ static struct {
 	/* operations */
 	{ "s",		cmd_shell },
 	{ "p",		cmd_prog },
+	{ "jobs",	cmd_jobs },
+	{ "wait",	cmd_wait },
+	{ "ps",		cmd_ps },
 	{ "mount",	cmd_mount },
 	{ "unmount",	cmd_unmount },
 	{ "bootfs",	cmd_bootfs },
 	{ "pf",		printfile },
+	{ "ckrestore",	cmd_ckrestore },
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
@@ -740,13 +1314,25 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "khstat",     cmd_kheapclassstats },
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "sched",      cmd_schedparams },
+	{ "schedstat",  cmd_schedstats },
+	{ "lockstat",	cmd_lockstat },
+	{ "syscallstat", cmd_syscallstat },
+	{ "intsteer",   cmd_intsteer },
+	{ "iostat",	cmd_iostat },
+	{ "ktrace",	cmd_ktrace },
+	{ "kprof",	cmd_kprof },
+	{ "vmstat",	cmd_vmstat },
+	{ "trapstat",	cmd_trapstat },
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "at2",	arraytest2 },
+	{ "at3",	arraytest3 },
 	{ "bt",		bitmaptest },
 	{ "tlt",	threadlisttest },
 	{ "km1",	kmalloctest },
@@ -754,6 +1340,7 @@ static struct {
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
 	{ "km5",	kmalloctest5 },
+	{ "kbench",	kbench },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -773,6 +1360,7 @@ static struct {
 	{ "cvt3",	cvtest3 },
 	{ "cvt4",	cvtest4 },
 	{ "cvt5",	cvtest5 },
+	{ "cvt6",	cvtest6 },
 	{ "rwt1",	rwtest },
 	{ "rwt2",	rwtest2 },
 	{ "rwt3",	rwtest3 },
@@ -781,6 +1369,8 @@ static struct {
 #if OPT_SYNCHPROBS
 	{ "sp1",	whalemating },
 	{ "sp2",	stoplight },
+	{ "sp1b",	whalemating_bench },
+	{ "sp2b",	stoplight_bench },
 #endif
 
 	/* semaphore unit tests */
@@ -814,6 +1404,7 @@ static struct {
 	{ "fs4",	writestress2 },
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
+	{ "fs7",	fsbench },
 
 	/* HMAC unit tests */
 	{ "hm1",	hmacu1 },
@@ -0,0 +1,820 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Minimal UDP/IP network stack over the LAMEbus network card.
+ *
+ * Scope (see also kern/net.h): UDP datagrams over IPv4, one card,
+ * stations addressed 10.161.x.y where x.y is the card's 16-bit
+ * hardware address. No ARP (the mapping is the address), no routing,
+ * no fragmentation, no TCP. This is enough to stream data between
+ * instances at link speed, which is what the stack exists for.
+ *
+ * Sockets are anonymous vnodes, following vfs/pipe.c, so they sit in
+ * the ordinary file table. A received datagram stays in the driver's
+ * pool frame from the interrupt handler's copy off the card until
+ * recvfrom copies it to userland: the input thread parses headers in
+ * place and queues the frame itself on the socket, so there are no
+ * kernel-to-kernel copies on either path (transmit copies straight
+ * from the sender's buffer into the card).
+ *
+ * Locking: net_lock protects the socket list and port assignment;
+ * each socket's so_lock protects its queue. net_lock comes first
+ * where both are held.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/net.h>
+#include <kern/poll.h>
+#include <kern/stattypes.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <thread.h>
+#include <vnode.h>
+#include <net.h>
+#include <lamebus/lnet.h>
+
+#include "opt-netfs.h"
+
+#if OPT_NETFS
+#include <netfs.h>
+#endif
+
+/*
+ * Wire formats. The hardware is big-endian, so fields are already in
+ * network byte order and no swapping appears below.
+ */
+
+struct ip_header {
+	uint8_t ip_vhl;			/* version (4) and header words (5) */
+	uint8_t ip_tos;			/* type of service; unused */
+	uint16_t ip_len;		/* total length incl. this header */
+	uint16_t ip_id;			/* datagram id */
+	uint16_t ip_off;		/* fragment offset; we never fragment */
+	uint8_t ip_ttl;			/* time to live */
+	uint8_t ip_proto;		/* payload protocol (IPPROTO_UDP) */
+	uint16_t ip_sum;		/* header checksum */
+	uint32_t ip_src;		/* source address */
+	uint32_t ip_dst;		/* destination address */
+};
+
+struct udp_header {
+	uint16_t udp_src;		/* source port */
+	uint16_t udp_dst;		/* destination port */
+	uint16_t udp_len;		/* length incl. this header */
+	uint16_t udp_sum;		/* checksum; 0 = none (we send 0) */
+};
+
+#define IP_VHL_DEFAULT	0x45		/* IPv4, 20-byte header */
+#define IP_TTL_DEFAULT	16
+#define NET_HDRSIZE	(sizeof(struct ip_header) + sizeof(struct udp_header))
+#define NET_MAXPAYLOAD	(LNET_MTU - NET_HDRSIZE)
+
+/* Our network: 10.161.0.0/16, last 16 bits the station address. */
+#define NET_PREFIX	0x0aa10000
+#define NET_PREFIXMASK	0xffff0000
+
+/* First port handed out to unbound senders. */
+#define NET_EPHEMERAL_FIRST	49152
+
+/*
+ * One queued datagram: the driver frame it arrived in, plus what the
+ * input thread parsed out of it. The payload is never copied; DG_OFF
+ * points at it inside the frame.
+ */
+struct dgram {
+	struct dgram *dg_next;
+	struct lnet_frame *dg_frame;
+	uint32_t dg_srcaddr;		/* sender's address */
+	uint16_t dg_srcport;		/* sender's port */
+	uint16_t dg_len;		/* payload bytes */
+	unsigned dg_off;		/* payload offset in the frame */
+};
+
+/*
+ * A socket. Datagrams beyond SOCKET_QMAX queued are dropped, as UDP
+ * is entitled to do.
+ */
+#define SOCKET_QMAX	16
+
+struct socket {
+	struct socket *so_next;		/* list of all sockets */
+	uint16_t so_lport;		/* bound local port; 0 = unbound */
+	struct lock *so_lock;		/* protects the queue */
+	struct cv *so_cv;		/* receivers wait here */
+	struct dgram *so_qhead;		/* queued datagrams, oldest first */
+	struct dgram *so_qtail;
+	unsigned so_qcount;
+	struct vnode so_vnode;
+};
+
+static struct lnet_softc *net_card;	/* the card, or NULL */
+static uint32_t net_ipaddr;		/* our address */
+static struct lock *net_lock;		/* socket list, port assignment */
+static struct socket *net_sockets;	/* all sockets */
+static uint16_t net_nextport = NET_EPHEMERAL_FIRST;
+static uint16_t net_ipid;		/* ip_id counter; unlocked, cosmetic */
+
+/*
+ * The standard internet checksum: 16-bit ones' complement sum. LEN
+ * may be odd, although ours never is.
+ */
+static
+uint16_t
+net_cksum(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint32_t sum = 0;
+	size_t i;
+
+	for (i=0; i+1<len; i+=2) {
+		sum += ((uint32_t)p[i] << 8) | p[i+1];
+	}
+	if (i < len) {
+		sum += (uint32_t)p[i] << 8;
+	}
+	while (sum > 0xffff) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return (~sum) & 0xffff;
+}
+
+////////////////////////////////////////////////////////////
+// Input path
+
+/*
+ * Validate and demultiplex one received frame. Takes ownership of
+ * the frame: either it ends up queued on a socket or it goes back to
+ * the driver's pool.
+ */
+static
+void
+net_input(struct lnet_frame *lf)
+{
+	struct ip_header *ip;
+	struct udp_header *udp;
+	struct socket *so;
+	struct dgram *dg;
+	size_t paylen;
+
+	if (lf->lf_proto != LNET_PROTO_IP || lf->lf_len < NET_HDRSIZE) {
+		goto drop;
+	}
+
+	ip = (struct ip_header *)lf->lf_data;
+	if (ip->ip_vhl != IP_VHL_DEFAULT ||
+	    net_cksum(ip, sizeof(*ip)) != 0 ||
+	    ip->ip_len > lf->lf_len ||
+	    ip->ip_len < NET_HDRSIZE ||
+	    ip->ip_proto != IPPROTO_UDP) {
+		goto drop;
+	}
+	if (ip->ip_dst != net_ipaddr &&
+	    ip->ip_dst != INADDR_BROADCAST &&
+	    ip->ip_dst != (net_ipaddr | ~NET_PREFIXMASK)) {
+		goto drop;
+	}
+
+	udp = (struct udp_header *)(lf->lf_data + sizeof(*ip));
+	if (udp->udp_len < sizeof(*udp) ||
+	    udp->udp_len > ip->ip_len - sizeof(*ip)) {
+		goto drop;
+	}
+	paylen = udp->udp_len - sizeof(*udp);
+
+	dg = kmalloc(sizeof(*dg));
+	if (dg == NULL) {
+		goto drop;
+	}
+	dg->dg_next = NULL;
+	dg->dg_frame = lf;
+	dg->dg_srcaddr = ip->ip_src;
+	dg->dg_srcport = udp->udp_src;
+	dg->dg_len = paylen;
+	dg->dg_off = NET_HDRSIZE;
+
+	lock_acquire(net_lock);
+	for (so = net_sockets; so != NULL; so = so->so_next) {
+		if (so->so_lport == udp->udp_dst) {
+			break;
+		}
+	}
+	if (so == NULL) {
+		/* Nobody listening on that port. */
+		lock_release(net_lock);
+		kfree(dg);
+		goto drop;
+	}
+
+	lock_acquire(so->so_lock);
+	lock_release(net_lock);
+
+	if (so->so_qcount >= SOCKET_QMAX) {
+		lock_release(so->so_lock);
+		kfree(dg);
+		goto drop;
+	}
+	if (so->so_qtail != NULL) {
+		so->so_qtail->dg_next = dg;
+	}
+	else {
+		so->so_qhead = dg;
+	}
+	so->so_qtail = dg;
+	so->so_qcount++;
+	cv_signal(so->so_cv, so->so_lock);
+	pollnotify();
+	lock_release(so->so_lock);
+	return;
+
+ drop:
+	lnet_frame_free(net_card, lf);
+}
+
+/*
+ * The input thread: take frames from the driver as they arrive and
+ * push them up. All protocol processing happens here, in thread
+ * context, so it can take sleep locks and kmalloc.
+ */
+static
+void
+netd_thread(void *data, unsigned long num)
+{
+	(void)data;
+	(void)num;
+
+	for (;;) {
+		net_input(lnet_recv(net_card));
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Attachment
+
+/*
+ * Called by config_lnet. Adopt the (first) card, derive our address
+ * from its station address, and start the input thread.
+ */
+void
+net_attach(struct lnet_softc *ln)
+{
+	int result;
+
+	if (net_card != NULL) {
+		kprintf("lnet%d: extra card ignored\n", ln->ln_unit);
+		return;
+	}
+
+	net_lock = lock_create("net");
+	if (net_lock == NULL) {
+		panic("net_attach: out of memory\n");
+	}
+	net_sockets = NULL;
+
+	net_card = ln;
+	net_ipaddr = NET_PREFIX | ln->ln_hwaddr;
+
+	result = thread_fork("netd", NULL, netd_thread, NULL, 0);
+	if (result) {
+		panic("net_attach: cannot start netd: %s\n",
+		      strerror(result));
+	}
+
+	kprintf("lnet%d: address %u.%u.%u.%u\n", ln->ln_unit,
+		(net_ipaddr >> 24) & 0xff, (net_ipaddr >> 16) & 0xff,
+		(net_ipaddr >> 8) & 0xff, net_ipaddr & 0xff);
+
+#if OPT_NETFS
+	netfs_attach();
+#endif
+}
+
+/*
+ * Report our address, for nettest and anyone else who cares.
+ */
+int
+net_getaddr(uint32_t *addr_ret)
+{
+	if (net_card == NULL) {
+		return ENETDOWN;
+	}
+	*addr_ret = net_ipaddr;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Sockets
+
+/*
+ * VOP_EACHOPEN. Sockets never appear in a filesystem, but the vnode
+ * layer calls this from VOP_INCREF paths via open; accept.
+ */
+static
+int
+socket_eachopen(struct vnode *v, int openflags)
+{
+	(void)v;
+	(void)openflags;
+	return 0;
+}
+
+/*
+ * Common receive path: wait for a datagram, copy the payload out
+ * (truncating to the caller's buffer, as UDP does), report the
+ * sender if asked, and retire the datagram and its frame.
+ */
+static
+int
+socket_recvfrom(struct socket *so, struct uio *uio,
+		uint32_t *addr_ret, uint16_t *port_ret)
+{
+	struct dgram *dg;
+	size_t amt;
+	int result;
+
+	lock_acquire(so->so_lock);
+	while (so->so_qhead == NULL) {
+		cv_wait(so->so_cv, so->so_lock);
+	}
+	dg = so->so_qhead;
+	so->so_qhead = dg->dg_next;
+	if (so->so_qhead == NULL) {
+		so->so_qtail = NULL;
+	}
+	so->so_qcount--;
+	lock_release(so->so_lock);
+
+	amt = dg->dg_len;
+	if (amt > uio->uio_resid) {
+		amt = uio->uio_resid;
+	}
+	result = uiomove(dg->dg_frame->lf_data + dg->dg_off, amt, uio);
+
+	if (result == 0) {
+		if (addr_ret != NULL) {
+			*addr_ret = dg->dg_srcaddr;
+		}
+		if (port_ret != NULL) {
+			*port_ret = dg->dg_srcport;
+		}
+	}
+
+	lnet_frame_free(net_card, dg->dg_frame);
+	kfree(dg);
+	return result;
+}
+
+/*
+ * Bind SO to PORT, or, if PORT is 0, to the next free ephemeral
+ * port. Fails with EADDRINUSE if somebody else has it, or EINVAL if
+ * SO is already bound.
+ */
+static
+int
+socket_bind(struct socket *so, uint16_t port)
+{
+	struct socket *other;
+	unsigned tries;
+
+	lock_acquire(net_lock);
+	if (so->so_lport != 0) {
+		lock_release(net_lock);
+		return EINVAL;
+	}
+
+	if (port == 0) {
+		for (tries = 0; tries < 65536 - NET_EPHEMERAL_FIRST;
+		     tries++) {
+			if (net_nextport == 0) {
+				net_nextport = NET_EPHEMERAL_FIRST;
+			}
+			port = net_nextport++;
+			for (other = net_sockets; other != NULL;
+			     other = other->so_next) {
+				if (other->so_lport == port) {
+					break;
+				}
+			}
+			if (other == NULL) {
+				break;
+			}
+			port = 0;
+		}
+		if (port == 0) {
+			lock_release(net_lock);
+			return EADDRINUSE;
+		}
+	}
+	else {
+		for (other = net_sockets; other != NULL;
+		     other = other->so_next) {
+			if (other->so_lport == port) {
+				lock_release(net_lock);
+				return EADDRINUSE;
+			}
+		}
+	}
+
+	so->so_lport = port;
+	lock_release(net_lock);
+	return 0;
+}
+
+/*
+ * Common send path: prepend UDP/IP headers and hand the caller's uio
+ * to the driver, which copies it straight onto the card.
+ */
+static
+int
+socket_sendto(struct socket *so, struct uio *uio,
+	      uint32_t addr, uint16_t port)
+{
+	struct {
+		struct ip_header ip;
+		struct udp_header udp;
+	} hdr;
+	uint16_t station;
+	size_t paylen;
+	int result;
+
+	if (port == 0) {
+		return EADDRNOTAVAIL;
+	}
+	paylen = uio->uio_resid;
+	if (paylen > NET_MAXPAYLOAD) {
+		return EMSGSIZE;
+	}
+
+	/* Resolve the destination to a station address. */
+	if (addr == INADDR_BROADCAST ||
+	    addr == (net_ipaddr | ~NET_PREFIXMASK)) {
+		station = LNET_BROADCAST;
+		addr = INADDR_BROADCAST;
+	}
+	else if ((addr & NET_PREFIXMASK) == NET_PREFIX) {
+		station = addr & ~NET_PREFIXMASK;
+	}
+	else {
+		/* Not on our network and we have no routes. */
+		return EHOSTUNREACH;
+	}
+
+	/* Senders must have a port for replies to go to. */
+	if (so->so_lport == 0) {
+		result = socket_bind(so, 0);
+		if (result) {
+			return result;
+		}
+	}
+
+	hdr.ip.ip_vhl = IP_VHL_DEFAULT;
+	hdr.ip.ip_tos = 0;
+	hdr.ip.ip_len = NET_HDRSIZE + paylen;
+	hdr.ip.ip_id = net_ipid++;
+	hdr.ip.ip_off = 0;
+	hdr.ip.ip_ttl = IP_TTL_DEFAULT;
+	hdr.ip.ip_proto = IPPROTO_UDP;
+	hdr.ip.ip_sum = 0;
+	hdr.ip.ip_src = net_ipaddr;
+	hdr.ip.ip_dst = addr;
+	hdr.ip.ip_sum = net_cksum(&hdr.ip, sizeof(hdr.ip));
+
+	hdr.udp.udp_src = so->so_lport;
+	hdr.udp.udp_dst = port;
+	hdr.udp.udp_len = sizeof(hdr.udp) + paylen;
+	hdr.udp.udp_sum = 0;	/* optional in UDP over IPv4 */
+
+	return lnet_transmit(net_card, station, LNET_PROTO_IP,
+			     &hdr, sizeof(hdr), uio);
+}
+
+/*
+ * VOP_READ: receive one datagram, discarding the sender.
+ */
+static
+int
+socket_read(struct vnode *v, struct uio *uio)
+{
+	KASSERT(uio->uio_rw == UIO_READ);
+	return socket_recvfrom(v->vn_data, uio, NULL, NULL);
+}
+
+/*
+ * VOP_WRITE. Datagram sockets need a destination; there is no
+ * connect(), so plain write has nowhere to send.
+ */
+static
+int
+socket_write(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return ENOTCONN;
+}
+
+/*
+ * VOP_IOCTL. No ioctls on sockets.
+ */
+static
+int
+socket_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+/*
+ * VOP_GETTYPE.
+ */
+static
+int
+socket_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = _S_IFSOCK;
+	return 0;
+}
+
+/*
+ * VOP_STAT. Report the number of queued datagrams as the size.
+ */
+static
+int
+socket_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct socket *so = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+
+	lock_acquire(so->so_lock);
+	statbuf->st_size = so->so_qcount;
+	lock_release(so->so_lock);
+
+	statbuf->st_mode = _S_IFSOCK | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blocks = 0;
+	statbuf->st_dev = 0;
+	statbuf->st_rdev = 0;
+
+	return 0;
+}
+
+/*
+ * VOP_ISSEEKABLE. Sockets aren't.
+ */
+static
+bool
+socket_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+/*
+ * VOP_POLL. Readable when a datagram is queued; always writable,
+ * since sendto transmits (or drops) without waiting for the receiver.
+ */
+static
+int
+socket_poll(struct vnode *v, int events, int *revents)
+{
+	struct socket *so = v->vn_data;
+	int rev;
+
+	rev = events & POLLOUT;
+	lock_acquire(so->so_lock);
+	if ((events & POLLIN) && so->so_qhead != NULL) {
+		rev |= POLLIN;
+	}
+	lock_release(so->so_lock);
+
+	*revents = rev;
+	return 0;
+}
+
+/*
+ * VOP_FSYNC. Nothing to sync.
+ */
+static
+int
+socket_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+/*
+ * VOP_TRUNCATE. Meaningless on a socket.
+ */
+static
+int
+socket_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+/*
+ * VOP_NAMEFILE. Sockets have no names.
+ */
+static
+int
+socket_namefile(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+/*
+ * VOP_RECLAIM. Called when the last reference goes away: unhook from
+ * the socket list (after which the input thread can't find us), then
+ * retire anything still queued.
+ */
+static
+int
+socket_reclaim(struct vnode *v)
+{
+	struct socket *so = v->vn_data;
+	struct socket **p;
+	struct dgram *dg;
+
+	lock_acquire(net_lock);
+	lock_acquire(so->so_lock);
+
+	/*
+	 * Sockets live in no vnode table, so no new reference can
+	 * appear once the count falls to 1; but use the standard
+	 * helper to consume the reference uniformly.
+	 */
+	if (!vnode_tryreclaim(v)) {
+		lock_release(so->so_lock);
+		lock_release(net_lock);
+		return EBUSY;
+	}
+
+	for (p = &net_sockets; *p != so; p = &(*p)->so_next) {
+		KASSERT(*p != NULL);
+	}
+	*p = so->so_next;
+
+	vnode_cleanup(v);
+
+	lock_release(so->so_lock);
+	lock_release(net_lock);
+
+	while (so->so_qhead != NULL) {
+		dg = so->so_qhead;
+		so->so_qhead = dg->dg_next;
+		lnet_frame_free(net_card, dg->dg_frame);
+		kfree(dg);
+	}
+
+	cv_destroy(so->so_cv);
+	lock_destroy(so->so_lock);
+	kfree(so);
+
+	return 0;
+}
+
+static const struct vnode_ops socket_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = socket_eachopen,
+	.vop_reclaim = socket_reclaim,
+	.vop_read = socket_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_write = socket_write,
+	.vop_ioctl = socket_ioctl,
+	.vop_stat = socket_stat,
+	.vop_gettype = socket_gettype,
+	.vop_isseekable = socket_isseekable,
+	.vop_poll = socket_poll,
+	.vop_fsync = socket_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = socket_truncate,
+	.vop_namefile = socket_namefile,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+/*
+ * Create a socket, handing back a referenced vnode.
+ */
+int
+net_socket_create(struct vnode **vn_ret)
+{
+	struct socket *so;
+	int result;
+
+	if (net_card == NULL) {
+		return ENETDOWN;
+	}
+
+	so = kmalloc(sizeof(*so));
+	if (so == NULL) {
+		return ENOMEM;
+	}
+	so->so_lock = lock_create("socket");
+	if (so->so_lock == NULL) {
+		kfree(so);
+		return ENOMEM;
+	}
+	so->so_cv = cv_create("socket");
+	if (so->so_cv == NULL) {
+		lock_destroy(so->so_lock);
+		kfree(so);
+		return ENOMEM;
+	}
+	so->so_lport = 0;
+	so->so_qhead = NULL;
+	so->so_qtail = NULL;
+	so->so_qcount = 0;
+
+	result = vnode_init(&so->so_vnode, &socket_vnode_ops, NULL, so);
+	KASSERT(result == 0);
+
+	lock_acquire(net_lock);
+	so->so_next = net_sockets;
+	net_sockets = so;
+	lock_release(net_lock);
+
+	*vn_ret = &so->so_vnode;
+	return 0;
+}
+
+/*
+ * Socket test for descriptors the socket calls are handed.
+ */
+bool
+net_is_socket(struct vnode *vn)
+{
+	return vn->vn_ops == &socket_vnode_ops;
+}
+
+/*
+ * The vnode-level entry points the socket system calls use; these
+ * just unwrap the vnode.
+ */
+int
+net_socket_bind(struct vnode *vn, uint16_t port)
+{
+	if (port == 0) {
+		return EADDRNOTAVAIL;
+	}
+	return socket_bind(vn->vn_data, port);
+}
+
+int
+net_socket_sendto(struct vnode *vn, struct uio *uio,
+		  uint32_t addr, uint16_t port)
+{
+	return socket_sendto(vn->vn_data, uio, addr, port);
+}
+
+int
+net_socket_recvfrom(struct vnode *vn, struct uio *uio,
+		    uint32_t *addr_ret, uint16_t *port_ret)
+{
+	return socket_recvfrom(vn->vn_data, uio, addr_ret, port_ret);
+}
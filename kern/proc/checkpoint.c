@@ -0,0 +1,597 @@
+// Process checkpoint and restore. See checkpoint.h for the file
+// format and the ground rules (what survives a checkpoint and what
+// doesn't).
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <lib.h>
+#include <uio.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <mips/trapframe.h>
+#include <checkpoint.h>
+
+/* Sanity cap on segment records in a checkpoint file. */
+#define CKPT_MAXSEGS	1024
+
+/*
+ * Kernel-buffer file I/O at an explicit offset. Writes must transfer
+ * fully; reads may come up short at EOF (the data area's trailing
+ * holes), so they report how much arrived and the caller zero-fills.
+ */
+static
+int
+ckpt_write(struct vnode *vn, off_t pos, const void *buf, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, (void *)buf, len, pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+static
+int
+ckpt_read(struct vnode *vn, off_t pos, void *buf, size_t len, size_t *got)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, pos, UIO_READ);
+	result = VOP_READ(vn, &ku);
+	if (result) {
+		return result;
+	}
+	*got = len - ku.uio_resid;
+	return 0;
+}
+
+/* Like ckpt_read, but a short transfer is an error (metadata reads). */
+static
+int
+ckpt_readfull(struct vnode *vn, off_t pos, void *buf, size_t len)
+{
+	size_t got;
+	int result;
+
+	result = ckpt_read(vn, pos, buf, len, &got);
+	if (result) {
+		return result;
+	}
+	if (got != len) {
+		return EINVAL;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Checkpoint
+
+/*
+ * Decide whether the page at VA has content worth writing. Untouched
+ * and never-written (zero) pages don't - they're left as holes and
+ * read back as zeros - unless an untouched page would fault in from
+ * file backing: that content must follow the process into the
+ * checkpoint, or the restored copy would read zeros where the
+ * executable had text. Shared-memory pages can't be checkpointed at
+ * all; they belong to other processes too.
+ */
+static
+int
+ckpt_page_content(struct addrspace *as, vaddr_t va, bool *content)
+{
+	struct pte *pte;
+	struct vnode *vn;
+	off_t off;
+	size_t len;
+
+	pte = pt_get_pte(as, va, false);
+	if (pte != NULL) {
+		lock_acquire(pte->pte_lock);
+		if (pte->shm) {
+			lock_release(pte->pte_lock);
+			return EINVAL;
+		}
+		if (pte->state == PTE_STATE_RAM ||
+		    pte->state == PTE_STATE_SWAP) {
+			lock_release(pte->pte_lock);
+			*content = true;
+			return 0;
+		}
+		if (pte->state == PTE_STATE_ZERO) {
+			lock_release(pte->pte_lock);
+			*content = false;
+			return 0;
+		}
+		lock_release(pte->pte_lock);
+	}
+
+	/* Untouched: content only if the page faults in from a file. */
+	*content = as_page_backing(as, va, &vn, &off, &len);
+	return 0;
+}
+
+int
+checkpoint_save(char *path, struct trapframe *tf)
+{
+	struct proc *p = curproc;
+	struct addrspace *as;
+	struct ckpt_header hdr;
+	struct ckpt_seg *segs;
+	struct ckpt_fd *cf;
+	struct vnode *vn;
+	char *pagebuf;
+	unsigned nsegs, nfds, i, j;
+	off_t pos, next;
+	bool haveheap, content;
+	int fd, result;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+
+	/* Other threads' stacks and registers can't be captured. */
+	spinlock_acquire(&p->p_lock);
+	if (p->p_numthreads > 1) {
+		spinlock_release(&p->p_lock);
+		return EINVAL;
+	}
+	spinlock_release(&p->p_lock);
+
+	/*
+	 * One segment per region, plus one for the heap if it's
+	 * nonempty. (The heap isn't a region; see vm_fault.) We're the
+	 * process's only thread, so the layout can't shift underneath
+	 * this walk.
+	 */
+	haveheap = as->heap_end > as->heap_start;
+	nsegs = as->nregions + (haveheap ? 1 : 0);
+	if (nsegs == 0 || nsegs > CKPT_MAXSEGS) {
+		return EINVAL;
+	}
+
+	segs = kmalloc(nsegs * sizeof(*segs));
+	if (segs == NULL) {
+		return ENOMEM;
+	}
+	bzero(segs, nsegs * sizeof(*segs));
+
+	for (i = 0; i < as->nregions; i++) {
+		struct region *reg = &as->regions[i];
+
+		segs[i].cs_kind =
+			(as->as_stackbase != 0 &&
+			 reg->vbase == as->as_stackbase) ?
+			CKPT_SEG_STACK : CKPT_SEG_REGION;
+		segs[i].cs_vbase = reg->vbase;
+		segs[i].cs_npages = reg->npages;
+		segs[i].cs_readable = reg->readable ? 1 : 0;
+		segs[i].cs_writeable = reg->writeable ? 1 : 0;
+		segs[i].cs_executable = reg->executable ? 1 : 0;
+		segs[i].cs_advice = reg->advice;
+	}
+	if (haveheap) {
+		segs[i].cs_kind = CKPT_SEG_HEAP;
+		segs[i].cs_vbase = as->heap_start;
+		segs[i].cs_npages =
+			(ROUNDUP(as->heap_end, PAGE_SIZE) - as->heap_start) /
+			PAGE_SIZE;
+		segs[i].cs_readable = 1;
+		segs[i].cs_writeable = 1;
+	}
+
+	/* Count the restorable descriptors (those with a path). */
+	nfds = 0;
+	for (fd = 0; fd < p->p_fdtable_size; fd++) {
+		if (p->p_fdtable[fd].fd_file != NULL &&
+		    p->p_fdtable[fd].fd_file->fh_path != NULL) {
+			nfds++;
+		}
+	}
+
+	/*
+	 * Lay the file out: metadata up front, then a page-aligned
+	 * data area with each segment's pages contiguous.
+	 */
+	pos = sizeof(hdr) + nsegs * sizeof(*segs) +
+		nfds * sizeof(struct ckpt_fd) + sizeof(*tf);
+	next = ROUNDUP(pos, PAGE_SIZE);
+
+	bzero(&hdr, sizeof(hdr));
+	hdr.ch_magic = CKPT_MAGIC;
+	hdr.ch_version = CKPT_VERSION;
+	hdr.ch_nsegs = nsegs;
+	hdr.ch_nfds = nfds;
+	hdr.ch_tfsize = sizeof(*tf);
+	hdr.ch_dataoff = next;
+	hdr.ch_heapstart = as->heap_start;
+	hdr.ch_heapend = as->heap_end;
+	hdr.ch_stackbase = as->as_stackbase;
+	hdr.ch_usertls = (vaddr_t)curthread->t_usertls;
+	snprintf(hdr.ch_name, sizeof(hdr.ch_name), "%s", p->p_name);
+
+	for (i = 0; i < nsegs; i++) {
+		segs[i].cs_dataoff = next;
+		next += (off_t)segs[i].cs_npages * PAGE_SIZE;
+	}
+
+	result = vfs_open(path, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	if (result) {
+		kfree(segs);
+		return result;
+	}
+
+	cf = kmalloc(sizeof(*cf));
+	pagebuf = kmalloc(PAGE_SIZE);
+	if (cf == NULL || pagebuf == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+
+	result = ckpt_write(vn, 0, &hdr, sizeof(hdr));
+	if (result) {
+		goto out;
+	}
+	pos = sizeof(hdr);
+
+	result = ckpt_write(vn, pos, segs, nsegs * sizeof(*segs));
+	if (result) {
+		goto out;
+	}
+	pos += nsegs * sizeof(*segs);
+
+	for (fd = 0; fd < p->p_fdtable_size; fd++) {
+		struct file_handle *fh = p->p_fdtable[fd].fd_file;
+
+		if (fh == NULL || fh->fh_path == NULL) {
+			continue;
+		}
+		bzero(cf, sizeof(*cf));
+		cf->cf_fd = fd;
+		cf->cf_flags = fh->fh_flags;
+		cf->cf_fdflags = p->p_fdtable[fd].fd_flags;
+		cf->cf_advice = fh->fh_advice;
+		lock_acquire(fh->fh_lock);
+		cf->cf_offset = fh->fh_offset;
+		lock_release(fh->fh_lock);
+		strcpy(cf->cf_path, fh->fh_path);
+
+		result = ckpt_write(vn, pos, cf, sizeof(*cf));
+		if (result) {
+			goto out;
+		}
+		pos += sizeof(*cf);
+	}
+
+	result = ckpt_write(vn, pos, tf, sizeof(*tf));
+	if (result) {
+		goto out;
+	}
+
+	/*
+	 * Dump the pages. copyin does the heavy lifting: a resident
+	 * page copies straight out of RAM, a swapped page faults back
+	 * in, and an untouched file-backed page fills from its
+	 * backing - we only have to skip the pages with no content.
+	 */
+	for (i = 0; i < nsegs; i++) {
+		for (j = 0; j < segs[i].cs_npages; j++) {
+			vaddr_t va = segs[i].cs_vbase + (vaddr_t)j * PAGE_SIZE;
+
+			result = ckpt_page_content(as, va, &content);
+			if (result) {
+				goto out;
+			}
+			if (!content) {
+				continue;
+			}
+			result = copyin((const_userptr_t)va, pagebuf,
+					PAGE_SIZE);
+			if (result) {
+				goto out;
+			}
+			result = ckpt_write(vn,
+					    segs[i].cs_dataoff +
+					    (off_t)j * PAGE_SIZE,
+					    pagebuf, PAGE_SIZE);
+			if (result) {
+				goto out;
+			}
+		}
+	}
+
+	/*
+	 * Pin the file size to the full data area, so lazily backed
+	 * pages past the last written byte read back as zeros rather
+	 * than hitting EOF in the fault path.
+	 */
+	result = VOP_TRUNCATE(vn, next);
+
+ out:
+	if (pagebuf != NULL) {
+		kfree(pagebuf);
+	}
+	if (cf != NULL) {
+		kfree(cf);
+	}
+	kfree(segs);
+	vfs_close(vn);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Restore
+
+/* True if BUF contains only zero bytes (a hole read back). */
+static
+bool
+ckpt_allzero(const char *buf, size_t len)
+{
+	const uint32_t *words = (const uint32_t *)buf;
+	size_t i;
+
+	for (i = 0; i < len / sizeof(uint32_t); i++) {
+		if (words[i] != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Reopen one saved descriptor and install it, replacing whatever
+ * proc_create_runprogram put in the slot (the console fds come back
+ * through their own "con:" records).
+ */
+static
+int
+ckpt_restore_fd(struct proc *p, struct ckpt_fd *cf)
+{
+	struct file_handle *fh, *old;
+	struct vnode *vn;
+	char *pathcopy;
+	int flags, result;
+
+	if (cf->cf_fd < 0 || cf->cf_fd >= p->p_fdtable_size) {
+		return EINVAL;
+	}
+	cf->cf_path[PATH_MAX - 1] = 0;
+
+	/* Reopening must not re-create or re-truncate the file. */
+	flags = cf->cf_flags & ~(O_CREAT|O_EXCL|O_TRUNC);
+
+	/* Copied because vfs_open destroys the path it's given. */
+	pathcopy = kstrdup(cf->cf_path);
+	if (pathcopy == NULL) {
+		return ENOMEM;
+	}
+	result = vfs_open(pathcopy, flags, 0, &vn);
+	kfree(pathcopy);
+	if (result) {
+		return result;
+	}
+
+	result = fh_create(vn, flags, &fh);
+	if (result) {
+		vfs_close(vn);
+		return result;
+	}
+	fh->fh_offset = cf->cf_offset;
+	fh->fh_advice = cf->cf_advice;
+	fh->fh_path = kstrdup(cf->cf_path);
+
+	lock_acquire(p->p_fdtable_lock);
+	old = p->p_fdtable[cf->cf_fd].fd_file;
+	p->p_fdtable[cf->cf_fd].fd_file = fh;
+	p->p_fdtable[cf->cf_fd].fd_flags = cf->cf_fdflags;
+	if (!bitmap_isset(p->p_fdmap, cf->cf_fd)) {
+		bitmap_mark(p->p_fdmap, cf->cf_fd);
+	}
+	lock_release(p->p_fdtable_lock);
+
+	if (old != NULL) {
+		fh_release(old);
+	}
+	return 0;
+}
+
+int
+checkpoint_restore(char *path)
+{
+	struct ckpt_header hdr;
+	struct ckpt_seg *segs;
+	struct ckpt_fd *cf;
+	struct trapframe tf;
+	struct addrspace *as;
+	struct region *reg;
+	struct vnode *vn;
+	char *pagebuf;
+	unsigned i, j;
+	off_t pos;
+	size_t got;
+	int result;
+
+	result = vfs_open(path, O_RDONLY, 0, &vn);
+	if (result) {
+		return result;
+	}
+
+	result = ckpt_readfull(vn, 0, &hdr, sizeof(hdr));
+	if (result) {
+		vfs_close(vn);
+		return result;
+	}
+	if (hdr.ch_magic != CKPT_MAGIC || hdr.ch_version != CKPT_VERSION ||
+	    hdr.ch_tfsize != sizeof(tf) ||
+	    hdr.ch_nsegs == 0 || hdr.ch_nsegs > CKPT_MAXSEGS ||
+	    hdr.ch_nfds > (unsigned)OPEN_MAX) {
+		vfs_close(vn);
+		return EINVAL;
+	}
+
+	segs = kmalloc(hdr.ch_nsegs * sizeof(*segs));
+	cf = kmalloc(sizeof(*cf));
+	pagebuf = kmalloc(PAGE_SIZE);
+	if (segs == NULL || cf == NULL || pagebuf == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+
+	pos = sizeof(hdr);
+	result = ckpt_readfull(vn, pos, segs, hdr.ch_nsegs * sizeof(*segs));
+	if (result) {
+		goto out;
+	}
+	pos += hdr.ch_nsegs * sizeof(*segs) + hdr.ch_nfds * sizeof(*cf);
+
+	result = ckpt_readfull(vn, pos, &tf, sizeof(tf));
+	if (result) {
+		goto out;
+	}
+
+	/*
+	 * Rebuild the address space. Ordinary segments get the
+	 * checkpoint file itself as their backing, so their pages
+	 * fault in lazily on first touch; the file stays referenced
+	 * by the regions (as_set_region_backing takes its own
+	 * references) after we close our handle below.
+	 */
+	as = as_create();
+	if (as == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+	proc_setas(as);
+	as_activate();
+
+	for (i = 0; i < hdr.ch_nsegs; i++) {
+		struct ckpt_seg *cs = &segs[i];
+
+		if (cs->cs_kind == CKPT_SEG_HEAP) {
+			continue;
+		}
+		result = as_define_region(as, cs->cs_vbase,
+					  (size_t)cs->cs_npages * PAGE_SIZE,
+					  cs->cs_readable, cs->cs_writeable,
+					  cs->cs_executable);
+		if (result) {
+			goto out;
+		}
+		reg = as_find_region(as, cs->cs_vbase);
+		KASSERT(reg != NULL);
+		reg->advice = cs->cs_advice;
+
+		if (cs->cs_kind == CKPT_SEG_STACK) {
+			as->as_stackbase = cs->cs_vbase;
+		}
+		else {
+			result = as_set_region_backing(as, cs->cs_vbase, vn,
+						       cs->cs_dataoff,
+						       (size_t)cs->cs_npages *
+						       PAGE_SIZE);
+			if (result) {
+				goto out;
+			}
+		}
+	}
+
+	/* as_define_region moved heap_start; the header has the truth. */
+	as->heap_start = hdr.ch_heapstart;
+	as->heap_end = hdr.ch_heapend;
+
+	/*
+	 * Copy the stack and heap pages in eagerly (see checkpoint.h
+	 * for why they can't be lazily backed). Holes read back as
+	 * zeros, and an all-zero page needn't be copied out at all:
+	 * the first touch zero-fills it anyway.
+	 */
+	for (i = 0; i < hdr.ch_nsegs; i++) {
+		struct ckpt_seg *cs = &segs[i];
+
+		if (cs->cs_kind == CKPT_SEG_REGION) {
+			continue;
+		}
+		for (j = 0; j < cs->cs_npages; j++) {
+			vaddr_t va = cs->cs_vbase + (vaddr_t)j * PAGE_SIZE;
+
+			result = ckpt_read(vn,
+					   cs->cs_dataoff +
+					   (off_t)j * PAGE_SIZE,
+					   pagebuf, PAGE_SIZE, &got);
+			if (result) {
+				goto out;
+			}
+			bzero(pagebuf + got, PAGE_SIZE - got);
+			if (ckpt_allzero(pagebuf, PAGE_SIZE)) {
+				continue;
+			}
+			result = copyout(pagebuf, (userptr_t)va, PAGE_SIZE);
+			if (result) {
+				goto out;
+			}
+		}
+	}
+
+	/* Reopen the saved descriptors. */
+	pos = sizeof(hdr) + hdr.ch_nsegs * sizeof(*segs);
+	for (i = 0; i < hdr.ch_nfds; i++) {
+		result = ckpt_readfull(vn, pos, cf, sizeof(*cf));
+		if (result) {
+			goto out;
+		}
+		pos += sizeof(*cf);
+
+		result = ckpt_restore_fd(curproc, cf);
+		if (result) {
+			goto out;
+		}
+	}
+
+	curthread->t_usertls = (userptr_t)hdr.ch_usertls;
+
+	kfree(pagebuf);
+	kfree(cf);
+	kfree(segs);
+	vfs_close(vn);
+
+	/* Resume where checkpoint() was called; it returns 1 there. */
+	enter_restored_process(&tf);
+	/* NOTREACHED */
+	return 0;
+
+ out:
+	if (pagebuf != NULL) {
+		kfree(pagebuf);
+	}
+	if (cf != NULL) {
+		kfree(cf);
+	}
+	if (segs != NULL) {
+		kfree(segs);
+	}
+	vfs_close(vn);
+	/* The caller exits; proc teardown cleans up whatever we built. */
+	return result;
+}
@@ -1,4 +1,5 @@
 #include <types.h>
+#include <lib.h>
 #include <proc.h>
 #include <vnode.h>
 #include <limits.h>
@@ -6,29 +7,105 @@
 #include <vfs.h>
 #include <kern/fcntl.h>
 #include <kern/unistd.h>
+#include <bitmap.h>
+#include <spinlock.h>
 #include <synch.h>
+#include <workqueue.h>
+
+/*
+ * File handle memory is type-stable: a destroyed handle goes onto
+ * this free list (keeping its fh_lock) rather than back to the
+ * general pool, and fh_create reuses it. This is what makes the
+ * lock-free fdtable_get safe: a lookup racing with a close may read
+ * the refcount of a handle that was just destroyed, which is harmless
+ * as long as that memory is still some file handle. The list grows to
+ * the high-water mark of simultaneously open handles, which is
+ * bounded by OPEN_MAX per process anyway.
+ *
+ * The refcount itself is maintained lock-free with compare-and-swap;
+ * fh_lock only protects fh_offset.
+ */
+static struct file_handle *fh_freelist;
+static struct spinlock fh_freelist_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Handles whose last reference was dropped by fdtable_closeall, still
+ * carrying the vnode they need to close. The vfs_close can trigger a
+ * full vnode reclaim (for SFS: truncate plus inode sync, all I/O), so
+ * an exiting process hands it to the workqueue instead of doing it
+ * in line; the exit and the parent's waitpid don't wait on the disk.
+ * The handles go back on the free list once their vnodes are closed.
+ */
+static struct file_handle *fh_deferred;
+static struct work fh_deferred_work;
+static bool fh_deferred_inited;
+
+static
+void
+fh_deferred_close(struct work *wk, void *data)
+{
+	struct file_handle *fh, *list;
+
+	(void)wk;
+	(void)data;
+
+	spinlock_acquire(&fh_freelist_lock);
+	list = fh_deferred;
+	fh_deferred = NULL;
+	spinlock_release(&fh_freelist_lock);
+
+	while (list != NULL) {
+		fh = list;
+		list = fh->fh_next;
+
+		vfs_close(fh->fh_vnode);
+		fh->fh_vnode = NULL;
+
+		if (fh->fh_path != NULL) {
+			kfree(fh->fh_path);
+			fh->fh_path = NULL;
+		}
+
+		spinlock_acquire(&fh_freelist_lock);
+		fh->fh_next = fh_freelist;
+		fh_freelist = fh;
+		spinlock_release(&fh_freelist_lock);
+	}
+}
 
 int
 fh_create(struct vnode *vn, int flags, struct file_handle **retfh)
 {
 	struct file_handle *fh;
 
-	fh = kmalloc(sizeof(*fh));
+	spinlock_acquire(&fh_freelist_lock);
+	fh = fh_freelist;
+	if (fh != NULL) {
+		fh_freelist = fh->fh_next;
+	}
+	spinlock_release(&fh_freelist_lock);
+
 	if (fh == NULL) {
-		return ENOMEM;
+		fh = kmalloc(sizeof(*fh));
+		if (fh == NULL) {
+			return ENOMEM;
+		}
+
+		fh->fh_lock = lock_create("file_handle");
+		if (fh->fh_lock == NULL) {
+			kfree(fh);
+			vfs_close(vn);
+			return ENOMEM;
+		}
 	}
 
 	fh->fh_vnode = vn;
 	fh->fh_offset = 0;
 	fh->fh_flags = flags;
-	fh->fh_refcount = 1;
-
-	fh->fh_lock = lock_create("file_handle");
-	if (fh->fh_lock == NULL) {
-		kfree(fh);
-		vfs_close(vn);
-		return ENOMEM;
-	}
+	fh->fh_advice = FADV_NORMAL;
+	fh->fh_path = NULL;
+	fh->fh_next = NULL;
+	spinlock_data_set(&fh->fh_refcount, 1);
 
 	*retfh = fh;
 	return 0;
@@ -37,35 +114,34 @@ fh_create(struct vnode *vn, int flags, struct file_handle **retfh)
 void
 fh_acquire(struct file_handle *fh)
 {
-	KASSERT(fh != NULL);
-
-	lock_acquire(fh->fh_lock);
+	spinlock_data_t count;
 
-	fh->fh_refcount++;
+	KASSERT(fh != NULL);
 
-	lock_release(fh->fh_lock);
+	do {
+		count = spinlock_data_get(&fh->fh_refcount);
+		KASSERT(count > 0);
+	} while (spinlock_data_cas(&fh->fh_refcount, count, count+1)
+		 != count);
 }
 
 void
 fh_release(struct file_handle *fh)
 {
-	bool do_destroy = false;
+	spinlock_data_t count;
 
 	KASSERT(fh != NULL);
 
-	lock_acquire(fh->fh_lock);
-
-	KASSERT(fh->fh_refcount > 0);
-
-	fh->fh_refcount--;
-
-	if (fh->fh_refcount == 0) {
-		do_destroy = true;
+	for (;;) {
+		count = spinlock_data_get(&fh->fh_refcount);
+		KASSERT(count > 0);
+		if (spinlock_data_cas(&fh->fh_refcount, count, count-1)
+		    == count) {
+			break;
+		}
 	}
 
-	lock_release(fh->fh_lock);
-
-	if (do_destroy) {
+	if (count == 1) {
 		fh_destroy(fh);
 	}
 }
@@ -77,8 +153,18 @@ fh_destroy(struct file_handle *fh)
 	KASSERT(fh->fh_refcount == 0);
 
 	vfs_close(fh->fh_vnode);
-	lock_destroy(fh->fh_lock);
-	kfree(fh);
+	fh->fh_vnode = NULL;
+
+	if (fh->fh_path != NULL) {
+		kfree(fh->fh_path);
+		fh->fh_path = NULL;
+	}
+
+	// Back onto the type-stable free list, keeping fh_lock alive
+	spinlock_acquire(&fh_freelist_lock);
+	fh->fh_next = fh_freelist;
+	fh_freelist = fh;
+	spinlock_release(&fh_freelist_lock);
 }
 
 static
@@ -94,9 +180,14 @@ open_console(int openflags, struct file_handle **fh_out)
 	err = fh_create(vn, openflags, fh_out);
 	if (err) {
 		vfs_close(vn);
+		return err;
 	}
 
-	return err;
+	// Recorded for checkpoint; NULL on kstrdup failure just means
+	// the fd won't survive a checkpoint
+	(*fh_out)->fh_path = kstrdup("con:");
+
+	return 0;
 }
 
 int
@@ -113,6 +204,14 @@ fdtable_init(struct proc *p)
 		return ENOMEM;
 	}
 
+	p->p_fdmap = bitmap_create(OPEN_MAX);
+	if (!p->p_fdmap)
+	{
+		kfree(p->p_fdtable);
+		lock_destroy(p->p_fdtable_lock);
+		return ENOMEM;
+	}
+
 	lock_acquire(p->p_fdtable_lock);
 	for (int i = 0; i < p->p_fdtable_size; i++) {
 		p->p_fdtable[i].fd_file = NULL;
@@ -138,6 +237,7 @@ fdtable_init_console(struct proc *p)
 				fh_release(fh[j]);
 			}
 			lock_destroy(p->p_fdtable_lock);
+			bitmap_destroy(p->p_fdmap);
 			kfree(p->p_fdtable);
 			return err;
 		}
@@ -148,6 +248,7 @@ fdtable_init_console(struct proc *p)
 	for (int i = 0; i < 3; i++) {
 		p->p_fdtable[i].fd_file  = fh[i];
 		p->p_fdtable[i].fd_flags = 0;
+		bitmap_mark(p->p_fdmap, i);
 	}
 
 	lock_release(p->p_fdtable_lock);
@@ -164,6 +265,9 @@ fdtable_destroy(struct proc *p)
 	p->p_fdtable = NULL;
 	p->p_fdtable_size = 0;
 
+	bitmap_destroy(p->p_fdmap);
+	p->p_fdmap = NULL;
+
 	lock_destroy(p->p_fdtable_lock);
 	p->p_fdtable_lock = NULL;
 
@@ -172,26 +276,27 @@ fdtable_destroy(struct proc *p)
 
 int fdtable_alloc(struct proc *p, struct file_handle *fh, int *retfd)
 {
-	int i;
+	unsigned i;
+	int err;
 
 	lock_acquire(p->p_fdtable_lock);
 
-	for (i = 0; i < p->p_fdtable_size; i++) {
-		if (p->p_fdtable[i].fd_file == NULL) {
-			p->p_fdtable[i].fd_file = fh;
-			p->p_fdtable[i].fd_flags = 0;
-
-			lock_release(p->p_fdtable_lock);
-
-			*retfd = i;
-
-			return 0;
-		}
+	// The bitmap finds the lowest free fd without scanning the table
+	err = bitmap_alloc(p->p_fdmap, &i);
+	if (err) {
+		lock_release(p->p_fdtable_lock);
+		return EMFILE;
 	}
 
+	KASSERT(p->p_fdtable[i].fd_file == NULL);
+	p->p_fdtable[i].fd_file = fh;
+	p->p_fdtable[i].fd_flags = 0;
+
 	lock_release(p->p_fdtable_lock);
 
-	return EMFILE;
+	*retfd = i;
+
+	return 0;
 }
 
 int
@@ -212,6 +317,7 @@ fdtable_free(struct proc *p, int fd)
 	struct file_handle *fh = p->p_fdtable[fd].fd_file;
 	p->p_fdtable[fd].fd_file = NULL;
 	p->p_fdtable[fd].fd_flags = 0;
+	bitmap_unmark(p->p_fdmap, fd);
 
 	lock_release(p->p_fdtable_lock);
 
@@ -225,29 +331,50 @@ struct file_handle *
 fdtable_get(struct proc *p, int fd, int *err)
 {
 	struct file_handle *fh;
+	spinlock_data_t count;
 
 	if (fd < 0 || fd >= p->p_fdtable_size) {
 		*err = EBADF;
 		return NULL;
 	}
 
-	lock_acquire(p->p_fdtable_lock);
+	/*
+	* Lock-free lookup for the stable common case. While a slot
+	* points at a handle, the table itself holds a reference, so the
+	* refcount is nonzero; we take our reference with CAS and then
+	* re-check that the slot still maps to the same handle. If a
+	* concurrent close got in, either the refcount reads as zero
+	* (the close already destroyed the handle - its memory is still
+	* a file handle, see the free list above) or the re-check fails;
+	* in both cases we just retry against the slot's new contents.
+	*/
+	for (;;) {
+		fh = p->p_fdtable[fd].fd_file;
+		if (fh == NULL) {
+			*err = EBADF;
+			return NULL;
+		}
 
-	fh = p->p_fdtable[fd].fd_file;
-	if (fh) {
-		// Bump so it cannot vanish under us
-		fh_acquire(fh);
-	}
+		count = spinlock_data_get(&fh->fh_refcount);
+		if (count == 0) {
+			// Concurrently closed; the slot has changed
+			continue;
+		}
+		if (spinlock_data_cas(&fh->fh_refcount, count, count+1)
+		    != count) {
+			continue;
+		}
 
-	lock_release(p->p_fdtable_lock);
+		// We hold a reference; make sure we referenced the
+		// handle this fd still designates
+		if (p->p_fdtable[fd].fd_file != fh) {
+			fh_release(fh);
+			continue;
+		}
 
-	if (!fh) {
-		*err = EBADF;
-		return NULL;
+		*err = 0;
+		return fh;
 	}
-
-	*err = 0;
-	return fh;
 }
 
 int
@@ -293,6 +420,9 @@ fdtable_dup(struct proc *p, int oldfd, int newfd)
 	fh_acquire(oldfh);
 	p->p_fdtable[newfd].fd_file  = oldfh;
 	p->p_fdtable[newfd].fd_flags = flags;
+	if (!bitmap_isset(p->p_fdmap, newfd)) {
+		bitmap_mark(p->p_fdmap, newfd);
+	}
 
 	lock_release(p->p_fdtable_lock);
 
@@ -325,50 +455,88 @@ fdtable_setflags(struct proc *p, int fd, int flags)
 	return 0;
 }
 
+/*
+ * Like fh_release, but when the last reference goes, the vnode close
+ * is handed to the workqueue (see fh_deferred_close above) instead of
+ * being done in line. Only used by fdtable_closeall.
+ */
+static
 void
-fdtable_closeall(struct proc *p)
+fh_release_deferred(struct file_handle *fh)
 {
-	int i, n = p->p_fdtable_size;
-	struct file_handle **to_close;
+	spinlock_data_t count;
 
-	// Allocate temporary array to stash handles
-	to_close = kmalloc(sizeof(*to_close) * n);
-
-	// When no spare memory to use, close in‑place under lock (less ideal)
-	if (to_close == NULL) {
-		lock_acquire(p->p_fdtable_lock);
+	KASSERT(fh != NULL);
 
-		for (i = 0; i < n; i++) {
-			if (p->p_fdtable[i].fd_file) {
-				fh_release(p->p_fdtable[i].fd_file);
-				p->p_fdtable[i].fd_file = NULL;
-				p->p_fdtable[i].fd_flags = 0;
-			}
+	for (;;) {
+		count = spinlock_data_get(&fh->fh_refcount);
+		KASSERT(count > 0);
+		if (spinlock_data_cas(&fh->fh_refcount, count, count-1)
+		    == count) {
+			break;
 		}
-
-		lock_release(p->p_fdtable_lock);
-
+	}
+	if (count > 1) {
 		return;
 	}
 
-	// Pluck them out under lock
-	lock_acquire(p->p_fdtable_lock);
+	// Last reference; queue the vnode close
+	spinlock_acquire(&fh_freelist_lock);
+	if (!fh_deferred_inited) {
+		work_init(&fh_deferred_work, fh_deferred_close, NULL);
+		fh_deferred_inited = true;
+	}
+	fh->fh_next = fh_deferred;
+	fh_deferred = fh;
+	spinlock_release(&fh_freelist_lock);
+
+	work_submit(&fh_deferred_work);
+}
+
+void
+fdtable_closeall(struct proc *p)
+{
+	struct file_handle *head, *fh, *next;
+	int i, n = p->p_fdtable_size;
 
-	int m = 0;
+	/*
+	 * Snapshot the table under one lock hold, without allocating:
+	 * dying handles are chained through fh_next, which is NULL on
+	 * any live handle (its only other use is the free list). The
+	 * chain's last entry links to itself, so a non-NULL fh_next
+	 * also identifies a handle already chained via a dup'd
+	 * descriptor; the duplicate reference is dropped right here,
+	 * which is safe under the lock because the chain's own
+	 * reference keeps the count above zero - no vfs_close can
+	 * happen until the chain is walked.
+	 */
+	head = NULL;
+	lock_acquire(p->p_fdtable_lock);
 	for (i = 0; i < n; i++) {
-		if (p->p_fdtable[i].fd_file) {
-			to_close[m++] = p->p_fdtable[i].fd_file;
-			p->p_fdtable[i].fd_file = NULL;
-			p->p_fdtable[i].fd_flags = 0;
+		fh = p->p_fdtable[i].fd_file;
+		if (fh == NULL) {
+			continue;
 		}
-	}
+		p->p_fdtable[i].fd_file = NULL;
+		p->p_fdtable[i].fd_flags = 0;
+		bitmap_unmark(p->p_fdmap, i);
 
+		if (fh->fh_next != NULL) {
+			// Already chained (dup'd slot)
+			fh_release(fh);
+			continue;
+		}
+		fh->fh_next = (head != NULL) ? head : fh;
+		head = fh;
+	}
 	lock_release(p->p_fdtable_lock);
 
-	// Drop references outside the table lock
-	for (i = 0; i < m; i++) {
-		fh_release(to_close[i]);
+	// Drop the chained references outside the table lock
+	fh = head;
+	while (fh != NULL) {
+		next = (fh->fh_next == fh) ? NULL : fh->fh_next;
+		fh->fh_next = NULL;
+		fh_release_deferred(fh);
+		fh = next;
 	}
-
-	kfree(to_close);
 }
@@ -43,25 +43,48 @@
  */
 
 #include <types.h>
+#include <kern/vmstat.h>
+#include <lib.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
+#include <vm.h>
 #include <vnode.h>
 #include <synch.h>
 #include <limits.h>
 #include <kern/errno.h>
 #include <spinlock.h>
+#include <thread.h>
+#include <wchan.h>
 #include <array.h>
+#include <kmemcache.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/*
+ * Cache of proc structures in constructed state: the locks, the CV,
+ * and the (empty) children array stay initialized across
+ * destroy/create, so fork pops a ready-made proc instead of building
+ * one from five allocations.
+ */
+static struct kmem_cache *proc_cache;
+
 static struct proc *pid_table[PID_MAX];
 static struct spinlock pid_table_lock;
-static pid_t next_pid = PID_MIN;
+
+/*
+ * Stack of free pids, so allocation is a pop instead of a scan over
+ * pid_table. Only pids in [PID_MIN, PID_MAX) ever appear on it; the
+ * reserved system pids below PID_MIN are installed directly by
+ * proc_create_sys. The table itself stays direct-indexed, so lookup
+ * by pid is a single array access.
+ */
+static pid_t pid_freestack[PID_MAX];
+static int pid_freetop;
 
 #ifndef ITEMINLINE
 #define ITEMINLINE INLINE
@@ -81,6 +104,64 @@ procarray_removefirst(struct procarray *a, struct proc *val) {
 	return false;
 }
 
+/*
+ * Constructor and destructor for the proc cache. The constructor
+ * builds everything that is expensive to build and whose state an
+ * unused proc doesn't care about; proc_destroy is responsible for
+ * returning these fields to constructed state (in particular, for
+ * emptying p_children) before freeing.
+ */
+static
+int
+proc_ctor(void *vproc)
+{
+	struct proc *proc = vproc;
+
+	spinlock_init(&proc->p_lock);
+	proc->p_cv_lock = lock_create("proc_cv_lock");
+	if (proc->p_cv_lock == NULL) {
+		goto fail_lock;
+	}
+	proc->p_cv = cv_create("proc_cv");
+	if (proc->p_cv == NULL) {
+		goto fail_cvlock;
+	}
+	proc->p_children = procarray_create();
+	if (proc->p_children == NULL) {
+		goto fail_cv;
+	}
+	proc->p_children_lock = lock_create("proc_children_lock");
+	if (proc->p_children_lock == NULL) {
+		goto fail_children;
+	}
+	return 0;
+
+fail_children:
+	procarray_destroy(proc->p_children);
+fail_cv:
+	cv_destroy(proc->p_cv);
+fail_cvlock:
+	lock_destroy(proc->p_cv_lock);
+fail_lock:
+	spinlock_cleanup(&proc->p_lock);
+	return ENOMEM;
+}
+
+static
+void
+proc_dtor(void *vproc)
+{
+	struct proc *proc = vproc;
+
+	KASSERT(procarray_num(proc->p_children) == 0);
+
+	lock_destroy(proc->p_children_lock);
+	procarray_destroy(proc->p_children);
+	cv_destroy(proc->p_cv);
+	lock_destroy(proc->p_cv_lock);
+	spinlock_cleanup(&proc->p_lock);
+}
+
 /*
  * Create a proc structure.
  */
@@ -89,26 +170,25 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	/*
+	 * The cache hands back a constructed proc: locks, CV, and an
+	 * empty children array already built. Only the plain fields
+	 * need (re)setting here.
+	 */
+	proc = kmem_cache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
 
 	proc->p_numthreads = 0;
-	spinlock_init(&proc->p_lock);
-	proc->p_cv_lock = lock_create("proc_cv_lock");
-	if (!proc->p_cv_lock)
-	{
-		spinlock_cleanup(&proc->p_lock);
-		kfree(proc->p_name);
-		kfree(proc);
-		return NULL;
-	}
+	proc->p_runcycles = 0;
+	proc->p_childcycles = 0;
+	KASSERT(procarray_num(proc->p_children) == 0);
 
 	pid_t pid;
 	int err = pid_alloc(proc, &pid);
@@ -120,42 +200,8 @@ proc_create(const char *name)
 	proc->p_pid = pid;
 	proc->p_retval = 0;
 	proc->p_has_exited = false;
-	proc->p_cv = cv_create("proc_cv");
-	if (!proc->p_cv)
-	{
-		pid_free(pid);
-		lock_destroy(proc->p_cv_lock);
-		spinlock_cleanup(&proc->p_lock);
-		kfree(proc->p_name);
-		kfree(proc);
-		return NULL;
-	}
-
+	proc->p_oomkill = false;
 	proc->p_parent = NULL;
-	proc->p_children = procarray_create();
-	if (!proc->p_children)
-	{
-		cv_destroy(proc->p_cv);
-		pid_free(pid);
-		lock_destroy(proc->p_cv_lock);
-		spinlock_cleanup(&proc->p_lock);
-		kfree(proc->p_name);
-		kfree(proc);
-		return NULL;
-	}
-
-	proc->p_children_lock = lock_create("proc_children_lock");
-	if (!proc->p_children_lock)
-	{
-		procarray_destroy(proc->p_children);
-		cv_destroy(proc->p_cv);
-		pid_free(pid);
-		lock_destroy(proc->p_cv_lock);
-		spinlock_cleanup(&proc->p_lock);
-		kfree(proc->p_name);
-		kfree(proc);
-		return NULL;
-	}
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
@@ -176,11 +222,10 @@ struct proc *
 proc_create_sys(const char *name, pid_t pid) {
 	KASSERT(pid >= 0 && pid < PID_MIN);
 
-	pid_t old_next_pid = next_pid;
-
 	struct proc *proc = proc_create(name);
 	KASSERT(proc);
 
+	// Return the pid proc_create allocated to the free stack
 	pid_free(proc->p_pid);
 
 	// Manually register the process
@@ -190,11 +235,6 @@ proc_create_sys(const char *name, pid_t pid) {
 	pid_table[pid] = proc;
 	spinlock_release(&pid_table_lock);
 
-	// Technically by the time we get here, the next_pid could have changed
-	// but it doesn't matter much because we will still get to the good pid
-	// albeit with more iterations
-	next_pid = old_next_pid;
-
 	return proc;
 }
 
@@ -231,9 +271,9 @@ proc_destroy(struct proc *proc)
 	}
 
 	pid_free(proc->p_pid);
-	lock_destroy(proc->p_children_lock);
-	procarray_destroy(proc->p_children);
-	cv_destroy(proc->p_cv);
+
+	/* Back to constructed (empty) state for the cache. */
+	procarray_setsize(proc->p_children, 0);
 
 	/* VFS fields */
 	if (proc->p_cwd) {
@@ -290,8 +330,6 @@ proc_destroy(struct proc *proc)
 	}
 
 	KASSERT(proc->p_numthreads == 0);
-	spinlock_cleanup(&proc->p_lock);
-	lock_destroy(proc->p_cv_lock);
 
 	/* Destroy the file descriptor table */
 	if (proc->p_fdtable) {
@@ -299,7 +337,8 @@ proc_destroy(struct proc *proc)
 	}
 
 	kfree(proc->p_name);
-	kfree(proc);
+	proc->p_name = NULL;
+	kmem_cache_free(proc_cache, proc);
 }
 
 /*
@@ -308,6 +347,12 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc),
+				       proc_ctor, proc_dtor);
+	if (proc_cache == NULL) {
+		panic("proc_bootstrap: can't create proc cache\n");
+	}
+
 	kproc = proc_create_sys("[kernel]", 0);
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
@@ -409,6 +454,12 @@ proc_remthread(struct thread *t)
 	spinlock_acquire(&proc->p_lock);
 	KASSERT(proc->p_numthreads > 0);
 	proc->p_numthreads--;
+	/*
+	 * Fold the thread's cpu time into the process. The sliver the
+	 * thread runs between here and its final switch goes
+	 * unaccounted, which is cheaper than chasing it.
+	 */
+	proc->p_runcycles += t->t_runcycles;
 	spinlock_release(&proc->p_lock);
 
 	spl = splhigh();
@@ -472,7 +523,11 @@ pid_table_bootstrap(void)
         pid_table[i] = NULL;
     }
 
-    next_pid = PID_MIN;
+    // Push pids in descending order so the lowest come off first
+    pid_freetop = 0;
+    for (pid_t pid = PID_MAX-1; pid >= PID_MIN; pid--) {
+        pid_freestack[pid_freetop++] = pid;
+    }
 
     spinlock_release(&pid_table_lock);
 }
@@ -507,30 +562,75 @@ pid_alloc(struct proc *proc, pid_t *pid)
 
     spinlock_acquire(&pid_table_lock);
 
-    for (int i = 0; i < PID_MAX-1; i++) {
+    if (pid_freetop == 0) {
+        spinlock_release(&pid_table_lock);
+
+        return ENPROC;
+    }
+
+    pid_t candidate = pid_freestack[--pid_freetop];
+
+    KASSERT(pid_table[candidate] == NULL);
+    pid_table[candidate] = proc;
 
-        pid_t candidate = (next_pid + i) % PID_MAX;
+    *pid = candidate;
 
-        if (candidate < PID_MIN) {
-            continue;
-        }
+    spinlock_release(&pid_table_lock);
+
+    return 0;
+}
+
+/*
+ * Snapshot PID's name, exit state, and paging statistics, for the ps
+ * menu command and sys___getvmstats. Done entirely under the pid
+ * table lock: proc_destroy pulls the pid out of the table before it
+ * tears the process down, and exit detaches the address space under
+ * p_lock before queueing it for the reaper, so whatever we see here
+ * stays alive for the duration of the copy. A process with no
+ * address space (exited, or kernel-only) reports zero pages.
+ *
+ * NAMEBUF and EXITED_RET may be NULL if the caller doesn't care.
+ * Returns ESRCH if the pid is unused.
+ */
+int
+proc_getvmstats(pid_t pid, char *namebuf, size_t bufmax, bool *exited_ret,
+		struct pvmstats *pvs)
+{
+    struct proc *p;
+    struct addrspace *as;
 
-        if (pid_table[candidate] == NULL) {
-            pid_table[candidate] = proc;
+    if (pid < 1 || pid >= PID_MAX) {
+        return ESRCH;
+    }
 
-            next_pid = (candidate + 1) % PID_MAX;
+    spinlock_acquire(&pid_table_lock);
 
-            *pid = candidate;
+    p = pid_table[pid];
+    if (p == NULL) {
+        spinlock_release(&pid_table_lock);
+        return ESRCH;
+    }
 
-            spinlock_release(&pid_table_lock);
+    if (namebuf != NULL) {
+        snprintf(namebuf, bufmax, "%s", p->p_name);
+    }
+    if (exited_ret != NULL) {
+        *exited_ret = p->p_has_exited;
+    }
 
-            return 0;
-        }
+    spinlock_acquire(&p->p_lock);
+    as = p->p_addrspace;
+    if (as != NULL) {
+        vmstat_gather_as(as, pvs);
+    }
+    else {
+        bzero(pvs, sizeof(*pvs));
     }
+    spinlock_release(&p->p_lock);
 
     spinlock_release(&pid_table_lock);
 
-    return ENPROC;
+    return 0;
 }
 
 int
@@ -550,7 +650,103 @@ pid_free(pid_t pid)
 
     pid_table[pid] = NULL;
 
+    KASSERT(pid_freetop < PID_MAX);
+    pid_freestack[pid_freetop++] = pid;
+
     spinlock_release(&pid_table_lock);
 
     return 0;
 }
+
+/* ADDRESS SPACE REAPER */
+
+/*
+ * Deferred address-space teardown. Destroying an address space frees
+ * every resident page and swap slot, which is the bulk of the work in
+ * process exit; sys__exit just detaches the address space and queues
+ * it here, so exit latency and the parent's waitpid wakeup don't wait
+ * for it. The reaper thread drains the queue in batches, keeping the
+ * page-freeing traffic in one place. The queue is linked through
+ * as_reapnext; the address space is already detached and deactivated
+ * by the time it's queued, so nothing else refers to it.
+ */
+static struct addrspace *asreaper_list;
+static struct spinlock asreaper_lock = SPINLOCK_INITIALIZER;
+static struct wchan *asreaper_wchan;
+static bool asreaper_running;
+
+static
+void
+asreaper_thread(void *junk, unsigned long junk2)
+{
+	struct addrspace *as, *list;
+
+	(void)junk;
+	(void)junk2;
+
+	spinlock_acquire(&asreaper_lock);
+	asreaper_running = true;
+	for (;;) {
+		while (asreaper_list == NULL) {
+			wchan_sleep(asreaper_wchan, &asreaper_lock);
+		}
+
+		// Take the whole batch at once
+		list = asreaper_list;
+		asreaper_list = NULL;
+		spinlock_release(&asreaper_lock);
+
+		while (list != NULL) {
+			as = list;
+			list = as->as_reapnext;
+			as_destroy(as);
+		}
+
+		spinlock_acquire(&asreaper_lock);
+	}
+}
+
+/*
+ * Queue a detached address space for destruction. Before the reaper
+ * is up (early boot), destroy inline.
+ */
+void
+asreaper_enqueue(struct addrspace *as)
+{
+	KASSERT(as != NULL);
+
+	spinlock_acquire(&asreaper_lock);
+
+	if (!asreaper_running) {
+		spinlock_release(&asreaper_lock);
+		as_destroy(as);
+		return;
+	}
+
+	as->as_reapnext = asreaper_list;
+	asreaper_list = as;
+	wchan_wakeone(asreaper_wchan, &asreaper_lock);
+
+	spinlock_release(&asreaper_lock);
+}
+
+/*
+ * Fork the reaper thread. Called once from boot(), after the thread
+ * system is fully up.
+ */
+void
+asreaper_bootstrap(void)
+{
+	int result;
+
+	asreaper_wchan = wchan_create("asreaper");
+	if (asreaper_wchan == NULL) {
+		panic("asreaper_bootstrap: wchan_create failed\n");
+	}
+
+	result = thread_fork("asreaper", NULL, asreaper_thread, NULL, 0);
+	if (result) {
+		panic("asreaper_bootstrap: thread_fork: %s\n",
+		      strerror(result));
+	}
+}
@@ -1,10 +1,13 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/poll.h>
 #include <kern/stat.h>
+#include <kern/stattypes.h>
 #include <limits.h>
 #include <lib.h>
 #include <uio.h>
+#include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
@@ -13,6 +16,7 @@
 #include <copyinout.h>
 #include <syscall.h>
 #include <kern/seek.h>
+#include <pipe.h>
 
 int
 sys_open(userptr_t user_path, int flags, mode_t mode, int *retval)
@@ -27,9 +31,17 @@ sys_open(userptr_t user_path, int flags, mode_t mode, int *retval)
 		return err;
 	}
 
+	// Remembered on the handle for checkpoint; vfs_open destroys
+	// the buffer copy. NULL on failure just makes the fd
+	// unrestorable.
+	char *path = kstrdup(pathbuf);
+
 	struct vnode *vn;
 	err = vfs_open(pathbuf, flags, mode, &vn);
 	if (err) {
+		if (path) {
+			kfree(path);
+		}
 		return err;
 	}
 
@@ -38,8 +50,12 @@ sys_open(userptr_t user_path, int flags, mode_t mode, int *retval)
 	err = fh_create(vn, flags, &fh);
 	if (err) {
 		vfs_close(vn);
+		if (path) {
+			kfree(path);
+		}
 		return err;
 	}
+	fh->fh_path = path;
 
 	int fd;
 	err = fdtable_alloc(curproc, fh, &fd);
@@ -52,6 +68,121 @@ sys_open(userptr_t user_path, int flags, mode_t mode, int *retval)
 	return 0;
 }
 
+int
+sys_openat(int dirfd, userptr_t user_path, int flags, mode_t mode,
+	   int *retval)
+{
+	char pathbuf[PATH_MAX];
+	size_t actual;
+	struct vnode *vn;
+	char *path = NULL;
+	bool relative;
+	int i, err;
+
+	err = copyinstr(user_path, pathbuf, sizeof(pathbuf), &actual);
+	if (err) {
+		return err;
+	}
+
+	// Absolute and device-prefixed paths ignore dirfd, as with
+	// AT_FDCWD-style openat elsewhere. A path is relative when
+	// nothing before its first slash is a device name.
+	relative = pathbuf[0] != '/' && pathbuf[0] != ':';
+	for (i = 0; relative && pathbuf[i]; i++) {
+		if (pathbuf[i] == '/') {
+			break;
+		}
+		if (pathbuf[i] == ':') {
+			relative = false;
+		}
+	}
+
+	if (!relative) {
+		// Only absolute paths are remembered for checkpoint; a
+		// relative one is meaningless without its dirfd
+		path = kstrdup(pathbuf);
+
+		err = vfs_open(pathbuf, flags, mode, &vn);
+		if (err) {
+			if (path) {
+				kfree(path);
+			}
+			return err;
+		}
+	}
+	else {
+		struct file_handle *dirfh;
+		mode_t type;
+
+		dirfh = fdtable_get(curproc, dirfd, &err);
+		if (dirfh == NULL) {
+			return err;
+		}
+
+		err = VOP_GETTYPE(dirfh->fh_vnode, &type);
+		if (err == 0 && (type & _S_IFMT) != _S_IFDIR) {
+			err = ENOTDIR;
+		}
+		if (err) {
+			fh_release(dirfh);
+			return err;
+		}
+
+		// Resolves straight from the directory vnode; the
+		// shared prefix that named it is never re-walked.
+		err = vfs_openat(dirfh->fh_vnode, pathbuf, flags, mode, &vn);
+		fh_release(dirfh);
+		if (err) {
+			return err;
+		}
+	}
+
+	// With refcount == 1
+	struct file_handle *fh;
+	err = fh_create(vn, flags, &fh);
+	if (err) {
+		vfs_close(vn);
+		if (path) {
+			kfree(path);
+		}
+		return err;
+	}
+	fh->fh_path = path;
+
+	int fd;
+	err = fdtable_alloc(curproc, fh, &fd);
+	if (err) {
+		fh_release(fh);
+		return err;
+	}
+
+	*retval = fd;
+	return 0;
+}
+
+int
+sys_dup(int fd, int *retval)
+{
+	struct file_handle *fh;
+	int err, newfd;
+
+	// Takes a reference on the handle for us
+	fh = fdtable_get(curproc, fd, &err);
+	if (fh == NULL) {
+		return err;
+	}
+
+	// Hand that reference over to the new slot
+	err = fdtable_alloc(curproc, fh, &newfd);
+	if (err) {
+		fh_release(fh);
+		return err;
+	}
+
+	*retval = newfd;
+	return 0;
+}
+
 int
 sys_dup2(int oldfd, int newfd, int *retval)
 {
@@ -64,6 +195,58 @@ sys_dup2(int oldfd, int newfd, int *retval)
 	return 0;
 }
 
+int
+sys_pipe(userptr_t user_fds)
+{
+	struct vnode *readvn, *writevn;
+	struct file_handle *rfh, *wfh;
+	int fds[2];
+	int err;
+
+	err = pipe_create(&readvn, &writevn);
+	if (err) {
+		return err;
+	}
+
+	// Each end gets its own file handle, with refcount == 1
+	err = fh_create(readvn, O_RDONLY, &rfh);
+	if (err) {
+		vfs_close(writevn);
+		vfs_close(readvn);
+		return err;
+	}
+
+	err = fh_create(writevn, O_WRONLY, &wfh);
+	if (err) {
+		vfs_close(writevn);
+		fh_release(rfh);
+		return err;
+	}
+
+	err = fdtable_alloc(curproc, rfh, &fds[0]);
+	if (err) {
+		fh_release(wfh);
+		fh_release(rfh);
+		return err;
+	}
+
+	err = fdtable_alloc(curproc, wfh, &fds[1]);
+	if (err) {
+		fdtable_free(curproc, fds[0]);
+		fh_release(wfh);
+		return err;
+	}
+
+	err = copyout(fds, user_fds, sizeof(fds));
+	if (err) {
+		fdtable_free(curproc, fds[1]);
+		fdtable_free(curproc, fds[0]);
+		return err;
+	}
+
+	return 0;
+}
+
 int
 sys_close(int fd)
 {
@@ -91,6 +274,27 @@ sys_read(int fd, userptr_t user_buf, size_t buflen, int *retval)
 		return EBADF;
 	}
 
+	/*
+	* O_NONBLOCK: rather than threading a flag through every VOP_READ
+	* implementation, ask the object whether reading would block and
+	* bail out with EAGAIN if it would. With a competing reader on the
+	* same object this is advisory - the data could be gone again by
+	* the time we read - but an fd one process polls and another
+	* drains is already a broken arrangement.
+	*/
+	if (fh->fh_flags & O_NONBLOCK) {
+		int rev = 0;
+
+		err = VOP_POLL(fh->fh_vnode, POLLIN, &rev);
+		if (err == 0 && rev == 0) {
+			err = EAGAIN;
+		}
+		if (err) {
+			fh_release(fh);
+			return err;
+		}
+	}
+
 	/*
 	* To achieve maximum concurrency, we reserve the offset for the duration of the read.
 	* This way, we don't have to lock the file handle for the duration of the read.
@@ -108,8 +312,18 @@ sys_read(int fd, userptr_t user_buf, size_t buflen, int *retval)
 	struct uio ku;
 	uio_uinit(&iov, &ku, user_buf, buflen, offset, UIO_READ);
 
+	/*
+	* O_DIRECT: as with O_NONBLOCK, rather than threading a flag
+	* through every VOP_READ implementation, hint via a per-thread
+	* field that filesystems with a cache check during the operation.
+	*/
+	curthread->t_iodirect = (fh->fh_flags & O_DIRECT) != 0;
+	curthread->t_ioadvice = fh->fh_advice;
+
 	// Perform the read
 	err = VOP_READ(fh->fh_vnode, &ku);
+	curthread->t_iodirect = false;
+	curthread->t_ioadvice = FADV_NORMAL;
 	if (err) {
 		lock_acquire(fh->fh_lock);
 		got = buflen - ku.uio_resid;
@@ -157,16 +371,40 @@ sys_write(int fd, userptr_t user_buf, size_t nbytes, int *retval)
 		return EBADF;
 	}
 
+	// O_NONBLOCK, advisory as in sys_read
+	if (fh->fh_flags & O_NONBLOCK) {
+		int rev = 0;
+
+		err = VOP_POLL(fh->fh_vnode, POLLOUT, &rev);
+		if (err == 0 && rev == 0) {
+			err = EAGAIN;
+		}
+		if (err) {
+			fh_release(fh);
+			return err;
+		}
+	}
+
 	/*
 	* To achieve maximum concurrency, we reserve the offset for the duration of the write.
 	* This way, we don't have to lock the file handle for the duration of the write.
 	* This is safe because any short transfer is rolled back in the compensation step.
 	* VOP_WRITE() can sleep, so we need to release the lock before calling it.
+	*
+	* For O_APPEND there is nothing to reserve: the filesystem
+	* positions the write at EOF itself (hinted per-thread below),
+	* and fh_offset is just bookkeeping updated after the fact.
+	* This way concurrent appenders don't serialize on fh_lock
+	* across the disk I/O.
 	*/
 
+	bool append = (fh->fh_flags & O_APPEND) != 0;
+
 	lock_acquire(fh->fh_lock);
 	off_t offset = fh->fh_offset;
-	fh->fh_offset = offset + nbytes;
+	if (!append) {
+		fh->fh_offset = offset + nbytes;
+	}
 	lock_release(fh->fh_lock);
 
 	// Set up uio for the write
@@ -174,13 +412,26 @@ sys_write(int fd, userptr_t user_buf, size_t nbytes, int *retval)
 	struct uio ku;
 	uio_uinit(&iov, &ku, user_buf, nbytes, offset, UIO_WRITE);
 
+	// O_DIRECT, hinted per-thread as in sys_read
+	curthread->t_iodirect = (fh->fh_flags & O_DIRECT) != 0;
+	curthread->t_ioadvice = fh->fh_advice;
+	curthread->t_ioappend = append;
+
 	// Perform the write
 	err = VOP_WRITE(fh->fh_vnode, &ku);
+	curthread->t_iodirect = false;
+	curthread->t_ioadvice = FADV_NORMAL;
+	curthread->t_ioappend = false;
 	if (err) {
 		lock_acquire(fh->fh_lock);
-		wrote = nbytes - ku.uio_resid;
-		delta = nbytes - wrote;
-		fh->fh_offset -= delta;
+		if (append) {
+			fh->fh_offset = ku.uio_offset;
+		}
+		else {
+			wrote = nbytes - ku.uio_resid;
+			delta = nbytes - wrote;
+			fh->fh_offset -= delta;
+		}
 		lock_release(fh->fh_lock);
 
 		fh_release(fh);
@@ -191,19 +442,329 @@ sys_write(int fd, userptr_t user_buf, size_t nbytes, int *retval)
 	wrote = nbytes - ku.uio_resid;
 	delta = nbytes - wrote;
 
-	// Compensating for non-full output
+	if (append) {
+		// The filesystem chose the position; record where it ended
+		lock_acquire(fh->fh_lock);
+		fh->fh_offset = ku.uio_offset;
+		lock_release(fh->fh_lock);
+	}
+	else if (delta > 0) {
+		// Compensating for non-full output
+		lock_acquire(fh->fh_lock);
+		fh->fh_offset -= delta;
+		lock_release(fh->fh_lock);
+	}
+
+	fh_release(fh);
+
+	*retval = (int)wrote;
+	return 0;
+}
+
+/*
+ * Common code for readv/writev: copy the user's iovec array in and
+ * total up the transfer size. The userland struct iovec has the same
+ * layout as the kernel one (see kern/iovec.h), so the copyin lands
+ * the user buffer pointers in iov_ubase. Returns the array through
+ * *kiov_ret (caller frees) and the total through *len_ret.
+ */
+static
+int
+copyin_iovec(userptr_t user_iov, int iovcnt, struct iovec **kiov_ret,
+	     size_t *len_ret)
+{
+	struct iovec *kiov;
+	size_t len;
+	int i, err;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+		return EINVAL;
+	}
+
+	kiov = kmalloc(sizeof(*kiov) * iovcnt);
+	if (kiov == NULL) {
+		return ENOMEM;
+	}
+
+	err = copyin(user_iov, kiov, sizeof(*kiov) * iovcnt);
+	if (err) {
+		kfree(kiov);
+		return err;
+	}
+
+	len = 0;
+	for (i = 0; i < iovcnt; i++) {
+		len += kiov[i].iov_len;
+		if (len < kiov[i].iov_len || len > (size_t)0x7fffffff) {
+			// Total doesn't fit in the ssize_t return value
+			kfree(kiov);
+			return EINVAL;
+		}
+	}
+
+	*kiov_ret = kiov;
+	*len_ret = len;
+	return 0;
+}
+
+int
+sys_readv(int fd, userptr_t user_iov, int iovcnt, int *retval)
+{
+	struct iovec *kiov;
+	size_t len, got, delta;
+	int err;
+
+	// Increases refcount
+	struct file_handle *fh = fdtable_get(curproc, fd, &err);
+	if (fh == NULL) {
+		return err;
+	}
+
+	// Check that it was opened for reading
+	if ((fh->fh_flags & O_ACCMODE) == O_WRONLY) {
+		fh_release(fh);
+		return EBADF;
+	}
+
+	err = copyin_iovec(user_iov, iovcnt, &kiov, &len);
+	if (err) {
+		fh_release(fh);
+		return err;
+	}
+
+	// Reserve the offset range, as in sys_read
+	lock_acquire(fh->fh_lock);
+	off_t offset = fh->fh_offset;
+	fh->fh_offset = offset + len;
+	lock_release(fh->fh_lock);
+
+	// Build the multi-block uio; uio_uinit only handles one block
+	struct uio ku;
+	ku.uio_iov = kiov;
+	ku.uio_iovcnt = iovcnt;
+	ku.uio_offset = offset;
+	ku.uio_resid = len;
+	ku.uio_segflg = UIO_USERSPACE;
+	ku.uio_rw = UIO_READ;
+	ku.uio_space = curproc->p_addrspace;
+
+	// O_DIRECT, hinted per-thread as in sys_read
+	curthread->t_iodirect = (fh->fh_flags & O_DIRECT) != 0;
+	curthread->t_ioadvice = fh->fh_advice;
+
+	err = VOP_READ(fh->fh_vnode, &ku);
+	curthread->t_iodirect = false;
+	curthread->t_ioadvice = FADV_NORMAL;
+
+	// Compensate for a short (or failed) transfer
+	got = len - ku.uio_resid;
+	delta = len - got;
 	if (delta > 0) {
 		lock_acquire(fh->fh_lock);
 		fh->fh_offset -= delta;
 		lock_release(fh->fh_lock);
 	}
 
+	kfree(kiov);
 	fh_release(fh);
+	if (err) {
+		return err;
+	}
+
+	*retval = (int)got;
+	return 0;
+}
+
+int
+sys_writev(int fd, userptr_t user_iov, int iovcnt, int *retval)
+{
+	struct iovec *kiov;
+	size_t len, wrote, delta;
+	int err;
+
+	// Increases refcount
+	struct file_handle *fh = fdtable_get(curproc, fd, &err);
+	if (fh == NULL) {
+		return err;
+	}
+
+	// Check that it was opened for writing
+	if ((fh->fh_flags & O_ACCMODE) == O_RDONLY) {
+		fh_release(fh);
+		return EBADF;
+	}
+
+	err = copyin_iovec(user_iov, iovcnt, &kiov, &len);
+	if (err) {
+		fh_release(fh);
+		return err;
+	}
+
+	// Reserve the offset range, as in sys_write; O_APPEND skips the
+	// reservation since the filesystem positions the write at EOF
+	bool append = (fh->fh_flags & O_APPEND) != 0;
+
+	lock_acquire(fh->fh_lock);
+	off_t offset = fh->fh_offset;
+	if (!append) {
+		fh->fh_offset = offset + len;
+	}
+	lock_release(fh->fh_lock);
+
+	// Build the multi-block uio; uio_uinit only handles one block
+	struct uio ku;
+	ku.uio_iov = kiov;
+	ku.uio_iovcnt = iovcnt;
+	ku.uio_offset = offset;
+	ku.uio_resid = len;
+	ku.uio_segflg = UIO_USERSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = curproc->p_addrspace;
+
+	// O_DIRECT, hinted per-thread as in sys_read
+	curthread->t_iodirect = (fh->fh_flags & O_DIRECT) != 0;
+	curthread->t_ioadvice = fh->fh_advice;
+	curthread->t_ioappend = append;
+
+	err = VOP_WRITE(fh->fh_vnode, &ku);
+	curthread->t_iodirect = false;
+	curthread->t_ioadvice = FADV_NORMAL;
+	curthread->t_ioappend = false;
+
+	wrote = len - ku.uio_resid;
+	delta = len - wrote;
+	if (append) {
+		// The filesystem chose the position; record where it ended
+		lock_acquire(fh->fh_lock);
+		fh->fh_offset = ku.uio_offset;
+		lock_release(fh->fh_lock);
+	}
+	else if (delta > 0) {
+		// Compensate for a short (or failed) transfer
+		lock_acquire(fh->fh_lock);
+		fh->fh_offset -= delta;
+		lock_release(fh->fh_lock);
+	}
+
+	kfree(kiov);
+	fh_release(fh);
+	if (err) {
+		return err;
+	}
 
 	*retval = (int)wrote;
 	return 0;
 }
 
+int
+sys_pread(int fd, userptr_t user_buf, size_t buflen, off_t offset,
+	  int *retval)
+{
+	int err;
+
+	// Increases refcount
+	struct file_handle *fh = fdtable_get(curproc, fd, &err);
+	if (fh == NULL) {
+		return err;
+	}
+
+	// Check that it was opened for reading
+	if ((fh->fh_flags & O_ACCMODE) == O_WRONLY) {
+		fh_release(fh);
+		return EBADF;
+	}
+
+	// Positional I/O only makes sense on seekable objects
+	if (!VOP_ISSEEKABLE(fh->fh_vnode)) {
+		fh_release(fh);
+		return ESPIPE;
+	}
+
+	if (offset < 0) {
+		fh_release(fh);
+		return EINVAL;
+	}
+
+	/*
+	* The offset is the caller's, not the file handle's, so there is
+	* no shared offset state to reserve or roll back and fh_lock is
+	* never taken. Concurrent preads on one fd proceed in parallel.
+	*/
+
+	struct iovec iov;
+	struct uio ku;
+	uio_uinit(&iov, &ku, user_buf, buflen, offset, UIO_READ);
+
+	// O_DIRECT, hinted per-thread as in sys_read
+	curthread->t_iodirect = (fh->fh_flags & O_DIRECT) != 0;
+	curthread->t_ioadvice = fh->fh_advice;
+
+	err = VOP_READ(fh->fh_vnode, &ku);
+	curthread->t_iodirect = false;
+	curthread->t_ioadvice = FADV_NORMAL;
+	fh_release(fh);
+	if (err) {
+		return err;
+	}
+
+	*retval = (int)(buflen - ku.uio_resid);
+	return 0;
+}
+
+int
+sys_pwrite(int fd, userptr_t user_buf, size_t nbytes, off_t offset,
+	   int *retval)
+{
+	int err;
+
+	// Increases refcount
+	struct file_handle *fh = fdtable_get(curproc, fd, &err);
+	if (fh == NULL) {
+		return err;
+	}
+
+	// Check that it was opened for writing
+	if ((fh->fh_flags & O_ACCMODE) == O_RDONLY) {
+		fh_release(fh);
+		return EBADF;
+	}
+
+	// Positional I/O only makes sense on seekable objects
+	if (!VOP_ISSEEKABLE(fh->fh_vnode)) {
+		fh_release(fh);
+		return ESPIPE;
+	}
+
+	if (offset < 0) {
+		fh_release(fh);
+		return EINVAL;
+	}
+
+	/*
+	* As with pread: the offset is supplied by the caller, so the
+	* file handle's offset (and fh_lock) are not touched at all.
+	*/
+
+	struct iovec iov;
+	struct uio ku;
+	uio_uinit(&iov, &ku, user_buf, nbytes, offset, UIO_WRITE);
+
+	// O_DIRECT, hinted per-thread as in sys_read
+	curthread->t_iodirect = (fh->fh_flags & O_DIRECT) != 0;
+	curthread->t_ioadvice = fh->fh_advice;
+
+	err = VOP_WRITE(fh->fh_vnode, &ku);
+	curthread->t_iodirect = false;
+	curthread->t_ioadvice = FADV_NORMAL;
+	fh_release(fh);
+	if (err) {
+		return err;
+	}
+
+	*retval = (int)(nbytes - ku.uio_resid);
+	return 0;
+}
+
 int
 sys_lseek(int fd, off_t offset, int whence, int64_t *retval)
 {
@@ -271,6 +832,43 @@ sys_lseek(int fd, off_t offset, int whence, int64_t *retval)
 	return 0;
 }
 
+int
+sys_fadvise(int fd, off_t offset, off_t len, int advice)
+{
+	int err;
+
+	struct file_handle *fh = fdtable_get(curproc, fd, &err);
+	if (fh == NULL) {
+		return err;
+	}
+
+	if (offset < 0 || len < 0) {
+		fh_release(fh);
+		return EINVAL;
+	}
+
+	switch (advice) {
+		case FADV_NORMAL:
+		case FADV_RANDOM:
+		case FADV_SEQUENTIAL:
+		case FADV_NOREUSE:
+			break;
+		default:
+			fh_release(fh);
+			return EINVAL;
+	}
+
+	/*
+	* The hint applies to the whole handle; the offset/len range is
+	* accepted for interface compatibility but not remembered. A
+	* plain int store, advisory the same way fh_flags is.
+	*/
+	fh->fh_advice = advice;
+
+	fh_release(fh);
+	return 0;
+}
+
 int
 sys_remove(userptr_t pathname)
 {
@@ -291,6 +889,79 @@ sys_remove(userptr_t pathname)
 	return 0;
 }
 
+int
+sys_mkdir(userptr_t pathname, mode_t mode)
+{
+	char pathbuf[PATH_MAX];
+	size_t actual;
+	int err;
+
+	err = copyinstr(pathname, pathbuf, sizeof(pathbuf), &actual);
+	if (err) {
+		return err;
+	}
+
+	return vfs_mkdir(pathbuf, mode);
+}
+
+int
+sys_rmdir(userptr_t pathname)
+{
+	char pathbuf[PATH_MAX];
+	size_t actual;
+	int err;
+
+	err = copyinstr(pathname, pathbuf, sizeof(pathbuf), &actual);
+	if (err) {
+		return err;
+	}
+
+	return vfs_rmdir(pathbuf);
+}
+
+int
+sys_getdirentry(int fd, userptr_t buf, size_t buflen, int *retval)
+{
+	int err;
+
+	// Increases refcount
+	struct file_handle *fh = fdtable_get(curproc, fd, &err);
+	if (fh == NULL) {
+		return err;
+	}
+
+	// Check that it was opened for reading
+	if ((fh->fh_flags & O_ACCMODE) == O_WRONLY) {
+		fh_release(fh);
+		return EBADF;
+	}
+
+	struct iovec iov;
+	struct uio ku;
+
+	/*
+	* The directory cursor in fh_offset is replaced by the fs (it's a
+	* cookie, not a byte count), so hold the lock across the call
+	* instead of reserving an offset range the way read/write do.
+	*/
+	lock_acquire(fh->fh_lock);
+	uio_uinit(&iov, &ku, buf, buflen, fh->fh_offset, UIO_READ);
+
+	err = VOP_GETDIRENTRY(fh->fh_vnode, &ku);
+	if (err == 0) {
+		fh->fh_offset = ku.uio_offset;
+	}
+	lock_release(fh->fh_lock);
+	fh_release(fh);
+	if (err) {
+		return err;
+	}
+
+	// Length of the name copied out; 0 means end of directory
+	*retval = (int)(buflen - ku.uio_resid);
+	return 0;
+}
+
 int
 sys_chdir(userptr_t path)
 {
@@ -329,3 +1000,89 @@ sys___getcwd(userptr_t buf, size_t buflen, int *retval)
 	*retval = (int)(buflen - ku.uio_resid);
 	return 0;
 }
+
+int
+sys_fstat(int fd, userptr_t statptr)
+{
+	struct stat st;
+	int err;
+
+	// Increases refcount
+	struct file_handle *fh = fdtable_get(curproc, fd, &err);
+	if (fh == NULL) {
+		return err;
+	}
+
+	// Served from the vnode attribute cache when it's warm
+	err = VOP_STAT(fh->fh_vnode, &st);
+	fh_release(fh);
+	if (err) {
+		return err;
+	}
+
+	return copyout(&st, statptr, sizeof(st));
+}
+
+int
+sys_stat(userptr_t path, userptr_t statptr)
+{
+	char *kpath;
+	struct vnode *vn;
+	struct stat st;
+	int err;
+
+	kpath = kmalloc(PATH_MAX);
+	if (kpath == NULL) return ENOMEM;
+
+	err = copyinstr(path, kpath, PATH_MAX, NULL);
+	if (err) {
+		kfree(kpath);
+		return err;
+	}
+
+	err = vfs_lookup(kpath, &vn);
+	kfree(kpath);
+	if (err) {
+		return err;
+	}
+
+	err = VOP_STAT(vn, &st);
+	VOP_DECREF(vn);
+	if (err) {
+		return err;
+	}
+
+	return copyout(&st, statptr, sizeof(st));
+}
+
+int
+sys_lstat(userptr_t path, userptr_t statptr)
+{
+	/*
+	 * lstat differs from stat only when the last path component
+	 * names a symbolic link. None of our filesystems implement
+	 * symlinks, so vfs_lookup never follows one and the two calls
+	 * are the same.
+	 */
+	return sys_stat(path, statptr);
+}
+
+int
+sys_fsync(int fd)
+{
+	int err;
+
+	// Increases refcount
+	struct file_handle *fh = fdtable_get(curproc, fd, &err);
+	if (fh == NULL) {
+		return err;
+	}
+
+	/*
+	 * Flush just this file's dirty buffers and inode; on sfs this
+	 * goes out through the journal without syncing the volume.
+	 */
+	err = VOP_FSYNC(fh->fh_vnode);
+	fh_release(fh);
+	return err;
+}
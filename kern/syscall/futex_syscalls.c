@@ -0,0 +1,101 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <wchan.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <proc.h>
+#include <current.h>
+#include <syscall.h>
+
+/*
+ * The futex system call: block on and wake by a word of user memory,
+ * so userland mutexes and condition variables only enter the kernel
+ * when they actually contend.
+ *
+ * The user address is translated through the page table to its
+ * physical frame and the wait is keyed on the frame's kernel (KSEG0)
+ * alias using the hashed wait-queue in thread.c. Keying by physical
+ * address makes futexes work across processes on shared-memory pages
+ * (shmat), which never go copy-on-write, as well as within a single
+ * process. A futex in plain private memory that is copy-on-write
+ * shared with a forked child is not reliable: the first write splits
+ * the page and waiter and waker end up watching different frames.
+ * Use a shared segment for cross-process synchronization.
+ *
+ * The frame is pinned for the duration of the wait (vm_page_incref),
+ * which both keeps it resident and keeps the physical key stable;
+ * the eviction scan already skips shared frames.
+ *
+ * FUTEX_WAIT sleeps only while the word still holds VAL; the check
+ * happens under the wait-queue bucket lock, so a waker that stores
+ * to the word before calling FUTEX_WAKE can never lose the wakeup.
+ * Returns 0 when woken, EAGAIN if the word had already changed.
+ * Spurious wakeups are possible; callers must recheck the word.
+ *
+ * FUTEX_WAKE wakes up to VAL waiters and returns how many it woke.
+ */
+
+/*
+ * Translate UADDR to its physical frame and pin it (vm_page_wire). On
+ * success the caller owns a reference (drop with vm_page_decref) and
+ * *kaddr_ret is the frame's KSEG0 alias of the word.
+ */
+static
+int
+futex_pin(userptr_t uaddr, unsigned *pfn_ret, volatile unsigned **kaddr_ret)
+{
+	vaddr_t va = (vaddr_t)uaddr;
+	unsigned pfn;
+	int result;
+
+	if (va % sizeof(unsigned) != 0) {
+		return EINVAL;
+	}
+
+	result = vm_page_wire(uaddr, &pfn);
+	if (result) {
+		return result;
+	}
+
+	*pfn_ret = pfn;
+	*kaddr_ret = (volatile unsigned *)
+		(PADDR_TO_KVADDR(idx_to_pa(pfn)) +
+		 (va & ~(vaddr_t)PAGE_FRAME));
+	return 0;
+}
+
+int
+sys_futex(userptr_t uaddr, int op, unsigned val, int32_t *retval)
+{
+	volatile unsigned *kaddr;
+	unsigned pfn;
+	int result;
+
+	switch (op) {
+	    case FUTEX_WAIT:
+		result = futex_pin(uaddr, &pfn, &kaddr);
+		if (result) {
+			return result;
+		}
+		result = waitaddr_sleep(kaddr, val);
+		vm_page_decref(pfn);
+		*retval = 0;
+		return result;
+
+	    case FUTEX_WAKE:
+		result = futex_pin(uaddr, &pfn, &kaddr);
+		if (result) {
+			return result;
+		}
+		*retval = (int32_t)waitaddr_wake(kaddr, val);
+		vm_page_decref(pfn);
+		return 0;
+
+	    default:
+		return EINVAL;
+	}
+}
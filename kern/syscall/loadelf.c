@@ -53,6 +53,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <uio.h>
 #include <proc.h>
 #include <current.h>
@@ -61,88 +62,150 @@
 #include <elf.h>
 
 /*
- * Load a segment at virtual address VADDR. The segment in memory
- * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
- * segment on disk is located at file offset OFFSET and has length
- * FILESIZE.
- *
- * FILESIZE may be less than MEMSIZE; if so the remaining portion of
- * the in-memory segment should be zero-filled.
- *
- * Note that uiomove will catch it if someone tries to load an
- * executable whose load address is in kernel space. If you should
- * change this code to not use uiomove, be sure to check for this case
- * explicitly.
+ * Cache of parsed executables. Workloads that exec the same few
+ * binaries thousands of times were re-reading and re-validating the
+ * ELF and program headers every time; instead remember the fields
+ * load_elf actually uses, keyed by vnode and stat generation, so a
+ * repeat exec defines its regions without touching the file. (The
+ * clean text cache in vm.c does the same for the segment contents,
+ * so together a warm exec does no disk I/O at all.) A stale
+ * generation - the binary was rewritten - just drops the entry.
+ */
+
+#define EXECCACHE_SLOTS		16
+#define EXECCACHE_MAXSEGS	4	/* text, rodata, data, spare */
+
+struct execcache_seg {
+	vaddr_t ecs_vaddr;
+	size_t ecs_memsz;
+	size_t ecs_filesz;	/* 0: no file backing */
+	off_t ecs_offset;
+	int ecs_readable;
+	int ecs_writeable;
+	int ecs_executable;
+};
+
+struct execcache_entry {
+	struct vnode *ece_vn;	/* counted reference; NULL marks a free slot */
+	unsigned ece_gen;	/* vnode_statgen when parsed */
+	vaddr_t ece_entrypoint;
+	unsigned ece_nsegs;
+	struct execcache_seg ece_segs[EXECCACHE_MAXSEGS];
+};
+
+static struct execcache_entry execcache[EXECCACHE_SLOTS];
+static unsigned execcache_hand;	/* round-robin replacement */
+static struct spinlock execcache_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Look V up; on a hit copy the entry to ENT (the slot can be
+ * replaced the moment the lock drops). A stale entry is freed here.
  */
 static
-int
-load_segment(struct addrspace *as, struct vnode *v,
-	     off_t offset, vaddr_t vaddr,
-	     size_t memsize, size_t filesize,
-	     int is_executable)
+bool
+execcache_get(struct vnode *v, struct execcache_entry *ent)
 {
-	struct iovec iov;
-	struct uio u;
-	int result;
+	unsigned gen = vnode_statgen(v);
+	unsigned i;
 
-	if (filesize > memsize) {
-		kprintf("ELF: warning: segment filesize > segment memsize\n");
-		filesize = memsize;
+	spinlock_acquire(&execcache_lock);
+	for (i=0; i<EXECCACHE_SLOTS; i++) {
+		if (execcache[i].ece_vn != v) {
+			continue;
+		}
+		if (execcache[i].ece_gen != gen) {
+			execcache[i].ece_vn = NULL;
+			spinlock_release(&execcache_lock);
+			/* DECREF can sleep; do it outside the lock */
+			VOP_DECREF(v);
+			return false;
+		}
+		*ent = execcache[i];
+		spinlock_release(&execcache_lock);
+		return true;
 	}
+	spinlock_release(&execcache_lock);
+	return false;
+}
 
-	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n",
-	      (unsigned long) filesize, (unsigned long) vaddr);
+static
+void
+execcache_insert(struct vnode *v, const struct execcache_entry *ent)
+{
+	struct vnode *old;
+	unsigned i, slot;
 
-	iov.iov_ubase = (userptr_t)vaddr;
-	iov.iov_len = memsize;		 // length of the memory space
-	u.uio_iov = &iov;
-	u.uio_iovcnt = 1;
-	u.uio_resid = filesize;          // amount to read from the file
-	u.uio_offset = offset;
-	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
-	u.uio_rw = UIO_READ;
-	u.uio_space = as;
+	spinlock_acquire(&execcache_lock);
 
-	result = VOP_READ(v, &u);
-	if (result) {
-		return result;
+	/* Reuse V's slot or a free one; else round-robin. */
+	slot = EXECCACHE_SLOTS;
+	for (i=0; i<EXECCACHE_SLOTS; i++) {
+		if (execcache[i].ece_vn == v) {
+			slot = i;
+			break;
+		}
+		if (execcache[i].ece_vn == NULL && slot == EXECCACHE_SLOTS) {
+			slot = i;
+		}
+	}
+	if (slot == EXECCACHE_SLOTS) {
+		slot = execcache_hand++ % EXECCACHE_SLOTS;
 	}
 
-	if (u.uio_resid != 0) {
-		/* short read; problem with executable? */
-		kprintf("ELF: short read on segment - file truncated?\n");
-		return ENOEXEC;
+	old = execcache[slot].ece_vn;
+	execcache[slot] = *ent;
+	execcache[slot].ece_vn = v;
+	VOP_INCREF(v);
+
+	spinlock_release(&execcache_lock);
+
+	if (old != NULL) {
+		VOP_DECREF(old);
 	}
+}
 
-	/*
-	 * If memsize > filesize, the remaining space should be
-	 * zero-filled. There is no need to do this explicitly,
-	 * because the VM system should provide pages that do not
-	 * contain other processes' data, i.e., are already zeroed.
-	 *
-	 * During development of your VM system, it may have bugs that
-	 * cause it to (maybe only sometimes) not provide zero-filled
-	 * pages, which can cause user programs to fail in strange
-	 * ways. Explicitly zeroing program BSS may help identify such
-	 * bugs, so the following disabled code is provided as a
-	 * diagnostic tool. Note that it must be disabled again before
-	 * you submit your code for grading.
-	 */
-#if 0
-	{
-		size_t fillamt;
-
-		fillamt = memsize - filesize;
-		if (fillamt > 0) {
-			DEBUG(DB_EXEC, "ELF: Zero-filling %lu more bytes\n",
-			      (unsigned long) fillamt);
-			u.uio_resid += fillamt;
-			result = uiomovezeros(fillamt, &u);
+/*
+ * Replay a cached parse: same address space calls the code below
+ * makes, minus all the reads.
+ */
+static
+int
+load_elf_cached(struct addrspace *as, struct vnode *v,
+		const struct execcache_entry *ent, vaddr_t *entrypoint)
+{
+	int result;
+	unsigned i;
+
+	for (i=0; i<ent->ece_nsegs; i++) {
+		const struct execcache_seg *s = &ent->ece_segs[i];
+
+		result = as_define_region(as, s->ecs_vaddr, s->ecs_memsz,
+					  s->ecs_readable, s->ecs_writeable,
+					  s->ecs_executable);
+		if (result) {
+			return result;
+		}
+		if (s->ecs_filesz > 0) {
+			result = as_set_region_backing(as, s->ecs_vaddr, v,
+						       s->ecs_offset,
+						       s->ecs_filesz);
+			if (result) {
+				return result;
+			}
 		}
 	}
-#endif
 
-	return result;
+	result = as_prepare_load(as);
+	if (result) {
+		return result;
+	}
+	result = as_complete_load(as);
+	if (result) {
+		return result;
+	}
+
+	*entrypoint = ent->ece_entrypoint;
+	return 0;
 }
 
 /*
@@ -159,9 +222,26 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	struct iovec iov;
 	struct uio ku;
 	struct addrspace *as;
+	struct execcache_entry ent;
+	bool cacheable = true;
 
 	as = proc_getas();
 
+	/*
+	 * Seen this binary before? Then skip the parse entirely.
+	 */
+	if (execcache_get(v, &ent)) {
+		return load_elf_cached(as, v, &ent, entrypoint);
+	}
+
+	/*
+	 * Capture the generation before the first read, so a write
+	 * racing with the parse makes the entry stale rather than
+	 * silently wrong.
+	 */
+	ent.ece_gen = vnode_statgen(v);
+	ent.ece_nsegs = 0;
+
 	/*
 	 * Read the executable header from offset 0 in the file.
 	 */
@@ -251,6 +331,50 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		if (result) {
 			return result;
 		}
+
+		/*
+		 * Instead of reading the segment in now, record where
+		 * its bytes live so vm_fault can page them in from
+		 * the executable on first touch. Exec latency then no
+		 * longer scales with binary size.
+		 */
+		size_t filesz = 0;
+		if (ph.p_filesz > 0) {
+			filesz = ph.p_filesz;
+
+			if (filesz > ph.p_memsz) {
+				kprintf("ELF: warning: segment filesize > "
+					"segment memsize\n");
+				filesz = ph.p_memsz;
+			}
+
+			DEBUG(DB_EXEC, "ELF: mapping %lu bytes at 0x%lx\n",
+			      (unsigned long) filesz,
+			      (unsigned long) ph.p_vaddr);
+
+			result = as_set_region_backing(as, ph.p_vaddr, v,
+						       ph.p_offset, filesz);
+			if (result) {
+				return result;
+			}
+		}
+
+		if (ent.ece_nsegs < EXECCACHE_MAXSEGS) {
+			struct execcache_seg *s =
+				&ent.ece_segs[ent.ece_nsegs++];
+
+			s->ecs_vaddr = ph.p_vaddr;
+			s->ecs_memsz = ph.p_memsz;
+			s->ecs_filesz = filesz;
+			s->ecs_offset = ph.p_offset;
+			s->ecs_readable = ph.p_flags & PF_R;
+			s->ecs_writeable = ph.p_flags & PF_W;
+			s->ecs_executable = ph.p_flags & PF_X;
+		}
+		else {
+			/* Too many segments to remember; odd binary. */
+			cacheable = false;
+		}
 	}
 
 	result = as_prepare_load(as);
@@ -259,43 +383,10 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Now actually load each segment.
+	 * Nothing to load eagerly; all segment pages fault in on
+	 * demand from the executable vnode.
 	 */
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
-
-		result = VOP_READ(v, &ku);
-		if (result) {
-			return result;
-		}
-
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
-
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n",
-				ph.p_type);
-			return ENOEXEC;
-		}
-
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
-		if (result) {
-			return result;
-		}
-	}
-
 	result = as_complete_load(as);
 	if (result) {
 		return result;
@@ -303,5 +394,10 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 
 	*entrypoint = eh.e_entry;
 
+	if (cacheable) {
+		ent.ece_entrypoint = eh.e_entry;
+		execcache_insert(v, &ent);
+	}
+
 	return 0;
 }
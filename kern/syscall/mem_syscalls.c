@@ -1,13 +1,44 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/kheapstats.h>
+#include <kern/mman.h>
+#include <kern/stat.h>
+#include <kern/userclock.h>
+#include <kern/vmstat.h>
 #include <lib.h>
+#include <copyinout.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <vnode.h>
 #include <proc.h>
 #include <current.h>
 #include <syscall.h>
 #include <spinlock.h>
 
+/*
+ * Whether [vaddr, vaddr+sz) overlaps no existing region. The array
+ * is sorted by vbase, so the scan can stop at the first region past
+ * the end of the range. Used for mmap placement and to keep the
+ * break from growing into a mapping.
+ */
+static
+bool
+mmap_range_free(struct addrspace *as, vaddr_t vaddr, size_t sz)
+{
+	for (unsigned r = 0; r < as->nregions; r++) {
+		struct region *reg = &as->regions[r];
+
+		if (reg->vbase >= vaddr + sz) {
+			break;
+		}
+		if (reg->vbase + reg->npages * PAGE_SIZE > vaddr) {
+			return false;
+		}
+	}
+	return true;
+}
+
 /*
  * System call to extend or shrink the heap (program break)
  */
@@ -34,13 +65,48 @@ sys_sbrk(intptr_t amount, int32_t *retval)
 
 	if (amount > 0) {
 		new_break = old_break + amount;
-		vaddr_t heap_limit = USERSTACK - STACKPAGES * PAGE_SIZE;
+		/* Stop below the stack's growth cap plus its guard gap */
+		vaddr_t heap_limit = USERSTACK -
+			(STACKPAGES_MAX + STACKGUARDPAGES) * PAGE_SIZE;
 
 		if (new_break > heap_limit) {
 			spinlock_release(&as->pt_lock);
 			return ENOMEM;
 		}
 
+		/*
+		 * Charge any newly spanned heap pages against the
+		 * commit limit, so exhausting RAM+swap shows up as
+		 * ENOMEM here rather than as a swap_alloc failure
+		 * deep in the fault path later.
+		 */
+		size_t oldpages = (ROUNDUP(old_break, PAGE_SIZE) -
+				   as->heap_start) / PAGE_SIZE;
+		size_t newpages = (ROUNDUP(new_break, PAGE_SIZE) -
+				   as->heap_start) / PAGE_SIZE;
+		if (newpages > oldpages) {
+			/*
+			 * The newly spanned pages must not run into a
+			 * mapping placed above the heap (mmap or
+			 * shmat); regions take precedence over the
+			 * heap in the fault path, so overlapping them
+			 * would silently change the pages' meaning.
+			 */
+			if (!mmap_range_free(as,
+					     as->heap_start +
+					     oldpages * PAGE_SIZE,
+					     (newpages - oldpages) *
+					     PAGE_SIZE)) {
+				spinlock_release(&as->pt_lock);
+				return ENOMEM;
+			}
+			if (vm_commit_charge(newpages - oldpages)) {
+				spinlock_release(&as->pt_lock);
+				return ENOMEM;
+			}
+			as->as_commit += newpages - oldpages;
+		}
+
 		as->heap_end = new_break;
 		spinlock_release(&as->pt_lock);
 		*retval = (int32_t)old_break;
@@ -75,34 +141,478 @@ sys_sbrk(intptr_t amount, int32_t *retval)
 			return 0;
 		}
 
-		/* Now free pages with individual PTE locks */
-		for (vaddr_t va = free_start; va < free_end; va += PAGE_SIZE) {
+		/* Return the freed pages' commitment */
+		vm_commit_uncharge((free_end - free_start) / PAGE_SIZE);
+		as->as_commit -= (free_end - free_start) / PAGE_SIZE;
+
+		/*
+		 * Release the vacated pages' frames and swap slots.
+		 * as_drop_pages batches the frame frees (one coremap
+		 * lock hold per batch) and the TLB shootdowns, so a
+		 * large shrink doesn't pay a lock acquisition and an
+		 * IPI round per page.
+		 */
+		as_drop_pages(as, free_start,
+			      (free_end - free_start) / PAGE_SIZE);
+
+		/* Don't need to reacquire the spinlock since we've already updated heap_end */
+		*retval = (int32_t)old_break;
+		return 0;
+	}
+}
+
+/*
+ * mmap/munmap.
+ *
+ * A mapping is an ordinary region: anonymous mappings zero-fill on
+ * first touch through the existing fault path, and file mappings
+ * reuse the demand-paging machinery built for ELF segments (region
+ * file backing plus the read-only page cache), so pages come in
+ * lazily and clean read-only pages are shared across processes.
+ * Only MAP_PRIVATE is supported; writes stay in the process, which
+ * is exactly what the fault path already does for ELF data segments.
+ * MAP_SHARED would need write-back (and, for anonymous memory, is
+ * what shmget/shmat provide), so it's rejected.
+ */
+
+/* First address tried for mappings: above any plausible heap, below
+   the shared-memory attach area (see shm_syscalls.c) */
+#define MMAP_BASE	((vaddr_t)0x40000000)
+
+int
+sys_mmap(vaddr_t addr, size_t len, int prot, int flags, int fd,
+	 off_t offset, int32_t *retval)
+{
+	struct addrspace *as;
+	struct file_handle *fh = NULL;
+	size_t sz, filebytes = 0;
+	vaddr_t mapva;
+	int result;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	if ((flags & ~(MAP_SHARED | MAP_PRIVATE | MAP_FIXED | MAP_ANON))
+	    != 0) {
+		return EINVAL;
+	}
+	if (flags & MAP_SHARED) {
+		return ENOSYS;
+	}
+	if ((flags & MAP_PRIVATE) == 0) {
+		return EINVAL;
+	}
+	if ((prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0) {
+		return EINVAL;
+	}
+
+	if (len == 0) {
+		return EINVAL;
+	}
+	sz = ROUNDUP(len, PAGE_SIZE);
+	if (sz < len) {
+		return EINVAL; // Overflow
+	}
+	if (sz > (size_t)USERCLOCK_ADDR) {
+		/* Can't fit below the clock page; also keeps the
+		   placement arithmetic below from wrapping. */
+		return ENOMEM;
+	}
+
+	if ((flags & MAP_ANON) == 0) {
+		struct stat st;
+
+		if (offset < 0 || (offset & ~(off_t)PAGE_FRAME) != 0) {
+			return EINVAL;
+		}
+
+		int err;
+		fh = fdtable_get(curproc, fd, &err);
+		if (fh == NULL) {
+			return err;
+		}
+		if ((fh->fh_flags & O_ACCMODE) == O_WRONLY) {
+			fh_release(fh);
+			return EACCES;
+		}
+
+		/*
+		 * Clamp the backing to the file's current size so
+		 * pages past EOF zero-fill instead of making the
+		 * fault path report a short read.
+		 */
+		result = VOP_STAT(fh->fh_vnode, &st);
+		if (result) {
+			fh_release(fh);
+			return result;
+		}
+		if (offset < st.st_size) {
+			filebytes = st.st_size - offset;
+			if (filebytes > sz) {
+				filebytes = sz;
+			}
+		}
+	}
+
+	/*
+	 * Pick the address. An aligned, free hint is honored;
+	 * otherwise MAP_FIXED fails and plain mappings fall back to
+	 * the first fitting gap at or above MMAP_BASE, the same scan
+	 * sys_shmat uses.
+	 */
+	mapva = 0;
+	if (addr != 0 && (addr & PAGE_FRAME) == addr &&
+	    addr + sz > addr && addr + sz <= USERCLOCK_ADDR &&
+	    mmap_range_free(as, addr, sz)) {
+		mapva = addr;
+	}
+	else if (flags & MAP_FIXED) {
+		if (fh != NULL) {
+			fh_release(fh);
+		}
+		return ENOMEM;
+	}
+	if (mapva == 0) {
+		mapva = MMAP_BASE;
+		for (unsigned r = 0; r < as->nregions; r++) {
+			struct region *reg = &as->regions[r];
+			vaddr_t regend = reg->vbase +
+				reg->npages * PAGE_SIZE;
+
+			if (regend <= mapva) {
+				continue;
+			}
+			if (reg->vbase >= mapva + sz) {
+				break;
+			}
+			mapva = regend;
+		}
+		if (mapva + sz > USERCLOCK_ADDR) {
+			if (fh != NULL) {
+				fh_release(fh);
+			}
+			return ENOMEM;
+		}
+	}
+
+	/*
+	 * Define the region, preserving the break as sys_shmat does;
+	 * a high mapping must not move the heap.
+	 */
+	vaddr_t old_hstart = as->heap_start;
+	vaddr_t old_hend = as->heap_end;
+
+	result = as_define_region(as, mapva, sz,
+				  (prot & PROT_READ) != 0,
+				  (prot & PROT_WRITE) != 0,
+				  (prot & PROT_EXEC) != 0);
+	if (result) {
+		if (fh != NULL) {
+			fh_release(fh);
+		}
+		return result;
+	}
+
+	as->heap_start = old_hstart;
+	as->heap_end = old_hend;
+
+	if (fh != NULL) {
+		if (filebytes > 0) {
+			/* Takes its own reference on the vnode */
+			result = as_set_region_backing(as, mapva,
+						       fh->fh_vnode,
+						       offset, filebytes);
+			if (result) {
+				as_undefine_region(as, mapva, sz);
+				fh_release(fh);
+				return result;
+			}
+		}
+		fh_release(fh);
+	}
+
+	*retval = (int32_t)mapva;
+	return 0;
+}
+
+int
+sys_munmap(vaddr_t addr, size_t len)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	if (addr == 0 || (addr & PAGE_FRAME) != addr || len == 0) {
+		return EINVAL;
+	}
+
+	/*
+	 * Whole mappings only: the range must match a region
+	 * exactly. Punching holes in a mapping would need region
+	 * splitting, which nothing else wants yet.
+	 */
+	return as_undefine_region(as, addr, len);
+}
+
+/*
+ * Advise the kernel about the access pattern of an address range.
+ * Hints are free to be ignored; only the range check can fail.
+ *
+ * NORMAL/RANDOM/SEQUENTIAL set the readahead policy on the regions
+ * the range touches (the fault path prefetches ahead of sequential
+ * regions). WILLNEED starts a background prefetch of the range's
+ * file-backed read-only pages into the page cache right away.
+ * DONTNEED drops the range's frames and swap slots with no eviction
+ * I/O; anonymous pages read back as zeros and file-backed pages
+ * refill from the file, so this is how a batch job tells the
+ * pagedaemon not to bother writing out data it's done with.
+ */
+int
+sys_madvise(vaddr_t addr, size_t len, int advice)
+{
+	struct addrspace *as;
+	size_t sz;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	if ((addr & PAGE_FRAME) != addr || len == 0) {
+		return EINVAL;
+	}
+	sz = ROUNDUP(len, PAGE_SIZE);
+	if (sz < len || addr + sz < addr || addr + sz > USERSTACK) {
+		return EINVAL;
+	}
+
+	switch (advice) {
+	    case MADV_NORMAL:
+	    case MADV_RANDOM:
+	    case MADV_SEQUENTIAL:
+		for (unsigned r = 0; r < as->nregions; r++) {
+			struct region *reg = &as->regions[r];
+
+			if (reg->vbase >= addr + sz) {
+				break;
+			}
+			if (reg->vbase + reg->npages * PAGE_SIZE <= addr) {
+				continue;
+			}
+			/* RANDOM just means no readahead, like NORMAL */
+			reg->advice = (advice == MADV_SEQUENTIAL) ?
+				MADV_SEQUENTIAL : MADV_NORMAL;
+		}
+		return 0;
+
+	    case MADV_WILLNEED:
+		for (unsigned r = 0; r < as->nregions; r++) {
+			struct region *reg = &as->regions[r];
+			vaddr_t start, end;
+
+			if (reg->vbase >= addr + sz) {
+				break;
+			}
+			if (reg->backing_vn == NULL || reg->writeable) {
+				/* Nothing cacheable to prefetch */
+				continue;
+			}
+
+			/* Clip the range to the region's backed pages */
+			start = (addr > reg->vbase) ? addr : reg->vbase;
+			end = reg->vbase +
+				ROUNDUP(reg->backing_filesize, PAGE_SIZE);
+			if (addr + sz < end) {
+				end = addr + sz;
+			}
+			if (start >= end) {
+				continue;
+			}
+
+			vm_pagecache_prefetch(reg->backing_vn,
+					      reg->backing_offset +
+					      (start - reg->vbase),
+					      (end - start) / PAGE_SIZE);
+		}
+		return 0;
+
+	    case MADV_DONTNEED:
+		as_drop_pages(as, addr, sz / PAGE_SIZE);
+		return 0;
+	}
+
+	return EINVAL;
+}
+
+/*
+ * Wire an address range: fault every page in and mark it (PTE and
+ * coremap entry) so the eviction scan passes it over, letting
+ * latency-critical code opt out of multi-millisecond page-in stalls.
+ * Charged against a per-process budget (MLOCK_MAXPAGES) so a runaway
+ * can't pin all of RAM. Wirings don't survive fork and are dropped
+ * with the pages (munmap, MADV_DONTNEED, exit).
+ */
+int
+sys_mlock(vaddr_t addr, size_t len)
+{
+	struct addrspace *as;
+	size_t sz;
+	int result;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	if ((addr & PAGE_FRAME) != addr || len == 0) {
+		return EINVAL;
+	}
+	sz = ROUNDUP(len, PAGE_SIZE);
+	if (sz < len || addr + sz < addr || addr + sz > USERSTACK) {
+		return EINVAL;
+	}
+
+	for (vaddr_t va = addr; va < addr + sz; va += PAGE_SIZE) {
+		for (;;) {
 			struct pte *pte = pt_get_pte(as, va, false);
 
 			if (pte != NULL) {
-				/* Acquire the lock for this specific PTE */
 				lock_acquire(pte->pte_lock);
-
 				if (pte->state == PTE_STATE_RAM) {
-					free_upage(pte->pfn);
-					pte->state = PTE_STATE_UNALLOC;
-					tlb_invalidate(va);
-				}
-				else if (pte->state == PTE_STATE_SWAP) {
-					swap_free(pte->swap_slot);
-					pte->swap_slot = 0;
-					pte->state = PTE_STATE_UNALLOC;
-				}
-				else if (pte->state == PTE_STATE_ZERO) {
-					pte->state = PTE_STATE_UNALLOC;
+					if (pte->wired) {
+						/* Already wired; fine */
+						lock_release(pte->pte_lock);
+						break;
+					}
+					if (as->as_wiredpages >=
+					    MLOCK_MAXPAGES) {
+						lock_release(pte->pte_lock);
+						return ENOMEM;
+					}
+					if (vm_page_setwired(pte->pfn,
+							     true) == 0) {
+						pte->wired = 1;
+						as->as_wiredpages++;
+						lock_release(pte->pte_lock);
+						break;
+					}
+					/*
+					 * Mid-eviction; fall through
+					 * and fault it back in.
+					 */
 				}
-
 				lock_release(pte->pte_lock);
 			}
+
+			/*
+			 * Not resident (or being evicted out from
+			 * under us): pull it in through the normal
+			 * fault path and try again. Unmapped
+			 * addresses fail here with EFAULT.
+			 */
+			result = vm_fault(VM_FAULT_READ, va);
+			if (result) {
+				return result;
+			}
 		}
+	}
 
-		/* Don't need to reacquire the spinlock since we've already updated heap_end */
-		*retval = (int32_t)old_break;
-		return 0;
+	return 0;
+}
+
+/*
+ * Unwire a range wired by mlock. Pages that aren't wired (or aren't
+ * resident) are skipped, so unlocking more than was locked is fine.
+ */
+int
+sys_munlock(vaddr_t addr, size_t len)
+{
+	struct addrspace *as;
+	size_t sz;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	if ((addr & PAGE_FRAME) != addr || len == 0) {
+		return EINVAL;
+	}
+	sz = ROUNDUP(len, PAGE_SIZE);
+	if (sz < len || addr + sz < addr || addr + sz > USERSTACK) {
+		return EINVAL;
+	}
+
+	for (vaddr_t va = addr; va < addr + sz; va += PAGE_SIZE) {
+		struct pte *pte = pt_get_pte(as, va, false);
+
+		if (pte == NULL) {
+			continue;
+		}
+		lock_acquire(pte->pte_lock);
+		if (pte->wired) {
+			if (pte->state == PTE_STATE_RAM) {
+				vm_page_setwired(pte->pfn, false);
+			}
+			pte->wired = 0;
+			as->as_wiredpages--;
+		}
+		lock_release(pte->pte_lock);
+	}
+
+	return 0;
+}
+
+/*
+ * System call to fetch the kernel heap telemetry (see
+ * kern/kheapstats.h), so allocator health can be watched from
+ * userland monitoring instead of the kernel menu.
+ */
+int
+sys___kheapstats(userptr_t statsptr)
+{
+	struct kheapstats ks;
+
+	kheap_getstats(&ks);
+
+	return copyout(&ks, statsptr, sizeof(ks));
+}
+
+/*
+ * Same idea for the paging statistics (see kern/vmstat.h): one cheap
+ * call, so a monitor can poll and diff the counters for fault and
+ * swap rates.
+ */
+int
+sys___vmstats(userptr_t statsptr)
+{
+	struct vmstats vs;
+
+	vmstat_gather(&vs);
+
+	return copyout(&vs, statsptr, sizeof(vs));
+}
+
+/*
+ * Per-process flavor, keyed by pid: resident and swap footprint plus
+ * fault counters for one address space, so a monitor can tell which
+ * process is thrashing and size memory accordingly.
+ */
+int
+sys___getvmstats(pid_t pid, userptr_t statsptr)
+{
+	struct pvmstats pvs;
+	int result;
+
+	result = proc_getvmstats(pid, NULL, 0, NULL, &pvs);
+	if (result) {
+		return result;
 	}
+
+	return copyout(&pvs, statsptr, sizeof(pvs));
 }
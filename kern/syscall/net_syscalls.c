@@ -0,0 +1,207 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/net.h>
+#include <lib.h>
+#include <uio.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <net.h>
+#include <syscall.h>
+
+/*
+ * Socket system calls: the minimal datagram set (see kern/net.h).
+ * Sockets are vnodes (net/net.c), so they go through the ordinary
+ * file handle and descriptor machinery and close() needs nothing
+ * special. No MSG_* flags are supported; callers must pass 0.
+ */
+
+/*
+ * Fetch the socket vnode for FD, bumping the file handle refcount.
+ * The handle is returned so the caller can release it when done.
+ */
+static
+int
+getsocket(int fd, struct file_handle **fh_ret, struct vnode **vn_ret)
+{
+	struct file_handle *fh;
+	int err;
+
+	fh = fdtable_get(curproc, fd, &err);
+	if (fh == NULL) {
+		return err;
+	}
+	if (!net_is_socket(fh->fh_vnode)) {
+		fh_release(fh);
+		return ENOTSOCK;
+	}
+	*fh_ret = fh;
+	*vn_ret = fh->fh_vnode;
+	return 0;
+}
+
+int
+sys_socket(int domain, int type, int protocol, int *retval)
+{
+	struct vnode *vn;
+	struct file_handle *fh;
+	int fd;
+	int err;
+
+	if (domain != AF_INET) {
+		return EAFNOSUPPORT;
+	}
+	if (type != SOCK_DGRAM ||
+	    (protocol != 0 && protocol != IPPROTO_UDP)) {
+		return EPROTONOSUPPORT;
+	}
+
+	err = net_socket_create(&vn);
+	if (err) {
+		return err;
+	}
+
+	err = fh_create(vn, O_RDWR, &fh);
+	if (err) {
+		vfs_close(vn);
+		return err;
+	}
+
+	err = fdtable_alloc(curproc, fh, &fd);
+	if (err) {
+		fh_release(fh);
+		return err;
+	}
+
+	*retval = fd;
+	return 0;
+}
+
+int
+sys_bind(int fd, userptr_t uaddr, size_t addrlen)
+{
+	struct netaddr na;
+	struct file_handle *fh;
+	struct vnode *vn;
+	int err;
+
+	if (addrlen < sizeof(na)) {
+		return EINVAL;
+	}
+	err = copyin(uaddr, &na, sizeof(na));
+	if (err) {
+		return err;
+	}
+
+	err = getsocket(fd, &fh, &vn);
+	if (err) {
+		return err;
+	}
+
+	/* We have one address; binding to any other makes no sense. */
+	err = net_socket_bind(vn, na.na_port);
+
+	fh_release(fh);
+	return err;
+}
+
+int
+sys_sendto(int fd, userptr_t ubuf, size_t len, int flags,
+	   userptr_t uaddr, size_t addrlen, int *retval)
+{
+	struct netaddr na;
+	struct file_handle *fh;
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	int err;
+
+	if (flags != 0) {
+		return EINVAL;
+	}
+	if (addrlen < sizeof(na)) {
+		return EINVAL;
+	}
+	err = copyin(uaddr, &na, sizeof(na));
+	if (err) {
+		return err;
+	}
+
+	err = getsocket(fd, &fh, &vn);
+	if (err) {
+		return err;
+	}
+
+	uio_uinit(&iov, &ku, ubuf, len, 0, UIO_WRITE);
+	err = net_socket_sendto(vn, &ku, na.na_addr, na.na_port);
+
+	fh_release(fh);
+	if (err) {
+		return err;
+	}
+
+	/* Datagrams go whole or not at all. */
+	*retval = (int)len;
+	return 0;
+}
+
+int
+sys_recvfrom(int fd, userptr_t ubuf, size_t len, int flags,
+	     userptr_t uaddr, userptr_t ualenp, int *retval)
+{
+	struct netaddr na;
+	struct file_handle *fh;
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	size_t alen;
+	int err;
+
+	if (flags != 0) {
+		return EINVAL;
+	}
+	if (uaddr != NULL) {
+		if (ualenp == NULL) {
+			return EINVAL;
+		}
+		err = copyin(ualenp, &alen, sizeof(alen));
+		if (err) {
+			return err;
+		}
+		if (alen < sizeof(na)) {
+			return EINVAL;
+		}
+	}
+
+	err = getsocket(fd, &fh, &vn);
+	if (err) {
+		return err;
+	}
+
+	uio_uinit(&iov, &ku, ubuf, len, 0, UIO_READ);
+	bzero(&na, sizeof(na));
+	err = net_socket_recvfrom(vn, &ku, &na.na_addr, &na.na_port);
+
+	fh_release(fh);
+	if (err) {
+		return err;
+	}
+
+	if (uaddr != NULL) {
+		err = copyout(&na, uaddr, sizeof(na));
+		if (err) {
+			return err;
+		}
+		alen = sizeof(na);
+		err = copyout(&alen, ualenp, sizeof(alen));
+		if (err) {
+			return err;
+		}
+	}
+
+	*retval = (int)(len - ku.uio_resid);
+	return 0;
+}
@@ -0,0 +1,179 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/poll.h>
+#include <limits.h>
+#include <lib.h>
+#include <clock.h>
+#include <wchan.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <copyinout.h>
+#include <syscall.h>
+
+/*
+ * The poll system call: wait for any of several file descriptors to
+ * become ready for I/O, so a single process can run an event loop
+ * over the console, pipes, and sockets instead of parking one process
+ * per stream.
+ *
+ * Readiness is asked of each object with VOP_POLL, which never
+ * blocks. Waiting uses a single generation counter: every object
+ * that can become ready bumps it and wakes its address-keyed wait
+ * queue (pollnotify), and a poller that found nothing ready sleeps
+ * with waitaddr_sleep against the generation it scanned under. Since
+ * notifiers bump the counter before waking and waitaddr_sleep
+ * rechecks it under the bucket lock, a readiness change between the
+ * scan and the sleep just makes the sleep return immediately; no
+ * wakeup can be lost. One global counter means every poller rescans
+ * on any I/O event, but pollers are few and scans are cheap.
+ *
+ * Timeouts ride the timer wheel: the callback is simply pollnotify,
+ * which forces the sleeper around its loop, where it notices the
+ * deadline has passed.
+ */
+
+static volatile unsigned poll_generation;
+
+/*
+ * Announce that some pollable object may have become ready. Called
+ * from thread and interrupt context.
+ */
+void
+pollnotify(void)
+{
+	poll_generation++;
+	waitaddr_wake(&poll_generation, WAITADDR_ALL);
+}
+
+/*
+ * Timer callback for poll timeouts.
+ */
+static
+void
+poll_timeout(struct timer *tm, void *data)
+{
+	(void)tm;
+	(void)data;
+	pollnotify();
+}
+
+/*
+ * Scan the fd array once, filling in revents. Returns the number of
+ * entries with nonzero revents via NREADY_RET; errors only for
+ * faults in VOP_POLL itself, which are reported as POLLERR rather
+ * than failing the whole call.
+ */
+static
+int
+poll_scan(struct pollfd *fds, unsigned nfds, unsigned *nready_ret)
+{
+	struct file_handle *fh;
+	unsigned i, nready;
+	int rev, err;
+
+	nready = 0;
+	for (i=0; i<nfds; i++) {
+		if (fds[i].fd < 0) {
+			/* Negative fds are ignored, per POSIX. */
+			fds[i].revents = 0;
+			continue;
+		}
+
+		/* Increases refcount */
+		fh = fdtable_get(curproc, fds[i].fd, &err);
+		if (fh == NULL) {
+			fds[i].revents = POLLNVAL;
+			nready++;
+			continue;
+		}
+
+		rev = 0;
+		err = VOP_POLL(fh->fh_vnode, fds[i].events, &rev);
+		fh_release(fh);
+		if (err) {
+			rev = POLLERR;
+		}
+		fds[i].revents = rev;
+		if (rev != 0) {
+			nready++;
+		}
+	}
+
+	*nready_ret = nready;
+	return 0;
+}
+
+int
+sys_poll(userptr_t ufds, unsigned nfds, int timeout, int *retval)
+{
+	struct pollfd *fds;
+	struct timer tm;
+	uint64_t deadline, now;
+	unsigned gen, nready;
+	uint32_t ticks;
+	int err;
+
+	if (nfds == 0 || nfds > OPEN_MAX) {
+		return EINVAL;
+	}
+
+	fds = kmalloc(nfds * sizeof(fds[0]));
+	if (fds == NULL) {
+		return ENOMEM;
+	}
+
+	err = copyin(ufds, fds, nfds * sizeof(fds[0]));
+	if (err) {
+		kfree(fds);
+		return err;
+	}
+
+	deadline = 0;
+	if (timeout > 0) {
+		/* Milliseconds to hardclock ticks, rounding up. */
+		ticks = ((uint64_t)timeout * HZ + 999) / 1000;
+		if (ticks == 0) {
+			ticks = 1;
+		}
+		deadline = timer_now() + ticks;
+		timer_init(&tm, poll_timeout, NULL);
+	}
+
+	for (;;) {
+		gen = poll_generation;
+
+		err = poll_scan(fds, nfds, &nready);
+		if (err) {
+			kfree(fds);
+			return err;
+		}
+		if (nready > 0 || timeout == 0) {
+			break;
+		}
+
+		if (timeout > 0) {
+			now = timer_now();
+			if (now >= deadline) {
+				/* Timed out; nready is 0. */
+				break;
+			}
+			timer_arm(&tm, (uint32_t)(deadline - now));
+			waitaddr_sleep(&poll_generation, gen);
+			timer_cancel(&tm);
+		}
+		else {
+			/* Negative timeout: wait forever. */
+			waitaddr_sleep(&poll_generation, gen);
+		}
+	}
+
+	err = copyout(fds, ufds, nfds * sizeof(fds[0]));
+	kfree(fds);
+	if (err) {
+		return err;
+	}
+
+	*retval = nready;
+	return 0;
+}
@@ -6,13 +6,19 @@
 #include <addrspace.h>
 #include <kern/wait.h>
 #include <kern/errno.h>
+#include <kern/resource.h>
 #include <copyinout.h>
+#include <bitmap.h>
 #include <mips/trapframe.h>
 #include <kern/fcntl.h>
 #include <limits.h>
 #include <lib.h>
 #include <vfs.h>
 #include <signal.h>
+#include <spl.h>
+#include <clock.h>
+#include <mainbus.h>
+#include <checkpoint.h>
 
 int
 sys_fork(struct trapframe *tf, pid_t *retval)
@@ -63,6 +69,7 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 			fh_acquire(fh);
 			child->p_fdtable[i].fd_file = fh;
 			child->p_fdtable[i].fd_flags = flags;
+			bitmap_mark(child->p_fdmap, i);
 		}
 	}
 
@@ -74,12 +81,14 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	}
 	*child_tf = *tf;	// Copy all registers
 
-	// Fork a thread in the child process
+	// Fork a thread in the child process. The second data word
+	// carries our TLS base: the child's thread continues the same
+	// user thread, so it inherits the pointer.
 	err = thread_fork(curthread->t_name,
 					  child,
 					  enter_forked_process,
 					  (void*)child_tf,	// Child's trapframe as a parameter
-					  1);		// nargs
+					  (unsigned long)(vaddr_t)curthread->t_usertls);
 	if (err) {
 		kprintf("sys_fork: thread_fork failed\n");
 		kfree(child_tf);
@@ -92,16 +101,59 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	return 0;
 }
 
+/*
+ * Freeze the calling process into a checkpoint file. Like fork, this
+ * needs the raw trapframe: a restored process resumes from it, seeing
+ * checkpoint() return 1 where the original got 0. The heavy lifting
+ * is in proc/checkpoint.c.
+ */
+int
+sys_checkpoint(struct trapframe *tf, userptr_t user_path, int *retval)
+{
+	char *kpath;
+	size_t actual;
+	int err;
+
+	kpath = kmalloc(PATH_MAX);
+	if (kpath == NULL) {
+		return ENOMEM;
+	}
+
+	err = copyinstr(user_path, kpath, PATH_MAX, &actual);
+	if (err) {
+		kfree(kpath);
+		return err;
+	}
+
+	err = checkpoint_save(kpath, tf);
+	kfree(kpath);
+	if (err) {
+		return err;
+	}
+
+	*retval = 0;
+	return 0;
+}
+
+/*
+ * Load a new program image over the current process.
+ *
+ * "image" is the argv block in its final layout: an array of argc+1
+ * pointer slots followed by the packed, 4-aligned argument strings.
+ * The pointer slots hold offsets from the start of the image; they
+ * are converted to user addresses once the stack location is known,
+ * and then the whole block goes out with a single copyout.
+ */
 static
 int
-execv_core(char *kprogname, int argc, char **kargs, size_t stringspace)
+execv_core(char *kprogname, int argc, char *image, size_t imagesize)
 {
 	struct vnode *v;
 	struct addrspace *oldas;
 	struct addrspace *newas;
 	vaddr_t entrypoint, stackptr;
+	userptr_t *ptrs;
 	size_t i;
-	size_t ptrspace;
 	int err;
 
 	// Open the executable
@@ -139,42 +191,28 @@ execv_core(char *kprogname, int argc, char **kargs, size_t stringspace)
 		return err;
 	}
 
-	// Compute pointer space
-	ptrspace = (argc + 1) * sizeof(userptr_t);
-
-	// Reserve stack space for strings and argv[]
-	stackptr -= stringspace;
-	stackptr -= ptrspace;
+	// Reserve stack space for the argv image
+	stackptr -= imagesize;
 	stackptr = ROUNDDOWN(stackptr, 4);
 
-	// Copy argument strings to user stack and record addresses
-	{
-		vaddr_t dest = stackptr + ptrspace;
-
-		for (i = 0; i < (size_t)argc; i++) {
-			size_t len = strlen(kargs[i]) + 1;
-
-			err = copyout(kargs[i], (userptr_t)dest, len);
-			if (err) {
-				return err;
-			}
-
-			kargs[i] = (char *)dest;
-			dest += ROUNDUP(len, 4);
-		}
-
-		kargs[argc] = NULL;
+	// Turn the recorded offsets into user stack addresses
+	ptrs = (userptr_t *)image;
+	for (i = 0; i < (size_t)argc; i++) {
+		ptrs[i] = (userptr_t)(stackptr + (vaddr_t)ptrs[i]);
 	}
 
-	// Copy argv pointer array
-	err = copyout(kargs, (userptr_t)stackptr, ptrspace);
+	// Flush pointers and strings together in one go
+	err = copyout(image, (userptr_t)stackptr, imagesize);
 	if (err) {
 		return err;
 	}
 
-	kfree(kargs);
+	kfree(image);
 	kfree(kprogname);
 
+	// The old image's TLS block is gone with its address space
+	curthread->t_usertls = NULL;
+
 	// Does not return
 	enter_new_process(argc, (userptr_t)stackptr, NULL, stackptr, entrypoint);
 
@@ -183,14 +221,27 @@ execv_core(char *kprogname, int argc, char **kargs, size_t stringspace)
 	return EINVAL;
 }
 
+/*
+ * Copy the program name and argument block into kernel buffers.
+ *
+ * The arguments are marshaled in a single pass: a cheap first pass
+ * walks only the argv pointer array to learn argc, then each string
+ * is copied exactly once, straight into its final position in the
+ * image (pointer slots first, then the packed strings), with its
+ * offset recorded in the corresponding slot. On success the caller
+ * owns *kprogname_ret and *image_ret; on error everything is already
+ * freed.
+ */
+static
 int
-sys_execv(userptr_t progname, userptr_t args)
+copyin_args(userptr_t progname, userptr_t args, char **kprogname_ret,
+	    int *argc_ret, char **image_ret, size_t *imagesize_ret)
 {
 	char *kprogname = NULL;
-	char **kargs = NULL;
-	char *arg_buf = NULL;
-	char *tmparg = NULL;
-	size_t stringspace = 0;
+	char *image = NULL;
+	userptr_t *ptrs;
+	size_t ptrspace;
+	size_t pos;
 	int argc = 0;
 	int err;
 	size_t got;
@@ -208,19 +259,11 @@ sys_execv(userptr_t progname, userptr_t args)
 		return err;
 	}
 
-	// Temporary buffer for measuring args
-	tmparg = kmalloc(ARG_MAX + 1);
-	if (!tmparg) {
-		kfree(kprogname);
-		return ENOMEM;
-	}
-
-	// Count args and measure total padded size
+	// Count the argv pointers; no string data is touched yet
 	while (true) {
 		err = copyin((userptr_t)&((userptr_t*)args)[argc], &arg_addr, sizeof(arg_addr));
 		if (err) {
 			kfree(kprogname);
-			kfree(tmparg);
 			return err;
 		}
 
@@ -228,66 +271,87 @@ sys_execv(userptr_t progname, userptr_t args)
 			break;
 		}
 
-		err = copyinstr(arg_addr, tmparg, ARG_MAX + 1, &got);
-		if (err) {
-			kfree(kprogname);
-			kfree(tmparg);
-			return err;
-		}
-
-		size_t padded = ROUNDUP(got, 4);
+		argc++;
 
-		if (stringspace + padded < stringspace || stringspace + padded > ARG_MAX) {
+		if ((size_t)(argc + 1) * sizeof(userptr_t) > ARG_MAX) {
 			kfree(kprogname);
-			kfree(tmparg);
 			return E2BIG;
 		}
-
-		stringspace += padded;
-		argc++;
 	}
 
-	kfree(tmparg);
+	ptrspace = (argc + 1) * sizeof(userptr_t);
 
-	arg_buf = kmalloc(stringspace);
-	if (!arg_buf) {
-		err = ENOMEM;
-		goto err;
+	// The strings themselves are bounded by ARG_MAX
+	image = kmalloc(ptrspace + ARG_MAX);
+	if (!image) {
+		kfree(kprogname);
+		return ENOMEM;
 	}
 
-	kargs = kmalloc((argc + 1) * sizeof(char *));
-	if (!kargs) {
-		err = ENOMEM;
-		goto err;
-	}
+	ptrs = (userptr_t *)image;
+	pos = ptrspace;
 
-	// Copy each user arg into arg_buf and record in kargs[]
-	{
-		char *bufpos = arg_buf;
-		for (int i = 0; i < argc; i++) {
-			err = copyin((userptr_t)&((userptr_t*)args)[i], &arg_addr, sizeof(arg_addr));
-			if (err) {
-				goto err;
-			}
+	// One scan: each string lands directly in the image
+	for (int i = 0; i < argc; i++) {
+		err = copyin((userptr_t)&((userptr_t*)args)[i], &arg_addr, sizeof(arg_addr));
+		if (err) {
+			goto err;
+		}
 
-			err = copyinstr(arg_addr, bufpos, stringspace - (bufpos - arg_buf), &got);
-			if (err) {
-				goto err;
+		err = copyinstr(arg_addr, image + pos,
+				ptrspace + ARG_MAX - pos, &got);
+		if (err) {
+			if (err == ENAMETOOLONG) {
+				err = E2BIG;
 			}
+			goto err;
+		}
+
+		ptrs[i] = (userptr_t)pos;
 
-			kargs[i] = bufpos;
-			bufpos += ROUNDUP(got, 4);
+		// Zero the pad bytes; the image is copied out wholesale
+		while (got % 4 != 0) {
+			image[pos + got] = 0;
+			got++;
 		}
-		kargs[argc] = NULL;
+		pos += got;
 	}
+	ptrs[argc] = NULL;
 
-	// Should not return
-	err = execv_core(kprogname, argc, kargs, stringspace);
+	*kprogname_ret = kprogname;
+	*argc_ret = argc;
+	*image_ret = image;
+	*imagesize_ret = pos;
+
+	return 0;
 
 err:
-	if (arg_buf) kfree(arg_buf);
-	if (kargs) kfree(kargs);
-	if (kprogname) kfree(kprogname);
+	kfree(image);
+	kfree(kprogname);
+
+	return err;
+}
+
+int
+sys_execv(userptr_t progname, userptr_t args)
+{
+	char *kprogname;
+	char *image;
+	size_t imagesize;
+	int argc;
+	int err;
+
+	err = copyin_args(progname, args, &kprogname, &argc, &image,
+			  &imagesize);
+	if (err) {
+		return err;
+	}
+
+	// Should not return
+	err = execv_core(kprogname, argc, image, imagesize);
+
+	kfree(image);
+	kfree(kprogname);
 
 	return err;
 }
@@ -295,8 +359,12 @@ err:
 int
 sys_kexecv(char *kprogname, char **kargs)
 {
-	int argc = 0;
+	char *image;
+	userptr_t *ptrs;
+	size_t ptrspace, pos;
 	size_t stringspace = 0;
+	int argc = 0;
+	int err;
 
 	while (kargs[argc] != NULL) {
 		size_t len = strlen(kargs[argc]) + 1;
@@ -304,8 +372,155 @@ sys_kexecv(char *kprogname, char **kargs)
 		argc++;
 	}
 
+	ptrspace = (argc + 1) * sizeof(userptr_t);
+
+	// Build the same image layout copyin_args produces
+	image = kmalloc(ptrspace + stringspace);
+	if (!image) {
+		return ENOMEM;
+	}
+
+	ptrs = (userptr_t *)image;
+	pos = ptrspace;
+
+	for (int i = 0; i < argc; i++) {
+		size_t len = strlen(kargs[i]) + 1;
+
+		memcpy(image + pos, kargs[i], len);
+		ptrs[i] = (userptr_t)pos;
+
+		while (len % 4 != 0) {
+			image[pos + len] = 0;
+			len++;
+		}
+		pos += len;
+	}
+	ptrs[argc] = NULL;
+
+	// The strings are copied now; drop the caller's array, as the
+	// old interface did
+	kfree(kargs);
+
 	// Should not return
-	return execv_core(kprogname, argc, kargs, stringspace);
+	err = execv_core(kprogname, argc, image, pos);
+
+	kfree(image);
+
+	return err;
+}
+
+/*
+ * Kernel-side baggage for spawn(): the already-copied-in program name
+ * and arguments, handed to the child's first thread.
+ */
+struct spawn_args {
+	char *sa_progname;
+	char *sa_image;
+	int sa_argc;
+	size_t sa_imagesize;
+};
+
+static
+void
+spawn_entry(void *data, unsigned long ndata)
+{
+	struct spawn_args *sa = data;
+
+	KASSERT(ndata == 0);
+
+	// Does not return on success
+	execv_core(sa->sa_progname, sa->sa_argc, sa->sa_image,
+		   sa->sa_imagesize);
+
+	/*
+	 * The program could not be loaded. spawn() already returned in
+	 * the parent, so there is nobody to hand the error to; exit
+	 * with status 127 as posix_spawn implementations do.
+	 */
+	kfree(sa->sa_image);
+	kfree(sa->sa_progname);
+	kfree(sa);
+
+	sys__exit(127);
+}
+
+int
+sys_spawn(userptr_t progname, userptr_t args, pid_t *retval)
+{
+	struct proc *child;
+	struct spawn_args *sa;
+	int err, i;
+
+	sa = kmalloc(sizeof(*sa));
+	if (sa == NULL) {
+		return ENOMEM;
+	}
+
+	err = copyin_args(progname, args, &sa->sa_progname, &sa->sa_argc,
+			  &sa->sa_image, &sa->sa_imagesize);
+	if (err) {
+		kfree(sa);
+		return err;
+	}
+
+	// Create the child. Unlike fork, no address space is copied;
+	// the child's first thread loads the ELF into a fresh one.
+	child = proc_create(sa->sa_progname);
+	if (child == NULL) {
+		err = ENPROC;
+		goto err;
+	}
+
+	// Record parent/child relationship
+	child->p_parent = curproc;
+	lock_acquire(curproc->p_children_lock);
+	procarray_add(curproc->p_children, child, NULL);
+	lock_release(curproc->p_children_lock);
+
+	// Inherit current working directory
+	if (curproc->p_cwd) {
+		VOP_INCREF(curproc->p_cwd);
+		child->p_cwd = curproc->p_cwd;
+	}
+
+	// Share the open files, the same way fork does
+	err = fdtable_init(child);
+	if (err) {
+		proc_destroy(child);
+		goto err;
+	}
+	for (i = 0; i < curproc->p_fdtable_size; i++) {
+		struct file_handle *fh = curproc->p_fdtable[i].fd_file;
+		int flags = curproc->p_fdtable[i].fd_flags;
+		if (fh) {
+			fh_acquire(fh);
+			child->p_fdtable[i].fd_file = fh;
+			child->p_fdtable[i].fd_flags = flags;
+			bitmap_mark(child->p_fdmap, i);
+		}
+	}
+
+	// Record the pid before the child can run (and possibly exit)
+	*retval = child->p_pid;
+
+	err = thread_fork(curthread->t_name,
+					  child,
+					  spawn_entry,
+					  sa,
+					  0);
+	if (err) {
+		proc_destroy(child);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	kfree(sa->sa_image);
+	kfree(sa->sa_progname);
+	kfree(sa);
+
+	return err;
 }
 
 int
@@ -325,11 +540,12 @@ sys__exit(int exitcode)
 		p->p_cwd = NULL;
 	}
 
-	// Tear down address space
+	// Detach the address space; the reaper destroys it in the
+	// background so exit doesn't wait for every page to be freed
 	as = proc_setas(NULL);
 	as_deactivate();
 	if (as) {
-		as_destroy(as);
+		asreaper_enqueue(as);
 	}
 
 	// Record exit status and wake up any waiters
@@ -434,6 +650,13 @@ sys_waitpid(pid_t pid, userptr_t statusptr, int options, int *retval)
 
 	lock_release(child->p_cv_lock);
 
+	// Fold the child's cpu usage (its own plus its reaped
+	// children's) into ours, for getrusage(RUSAGE_CHILDREN).
+	// Both totals are stable now that the child has exited.
+	spinlock_acquire(&curproc->p_lock);
+	curproc->p_childcycles += child->p_runcycles + child->p_childcycles;
+	spinlock_release(&curproc->p_lock);
+
 	proc_destroy(child);
 
 	// Copy the exit status out to userspace
@@ -454,3 +677,45 @@ sys_getpid(int *retval)
 	*retval = curproc->p_pid;
 	return 0;
 }
+
+int
+sys_getrusage(int who, userptr_t rusageptr)
+{
+	struct rusage ru;
+	uint64_t total, ns;
+	int spl;
+
+	switch (who) {
+	    case RUSAGE_SELF:
+		// Cycles banked by threads that already exited...
+		spinlock_acquire(&curproc->p_lock);
+		total = curproc->p_runcycles;
+		spinlock_release(&curproc->p_lock);
+		// ...plus this thread's, including the running slice.
+		// Interrupts off so a preemption can't move cycles
+		// between t_runcycles and the slice mid-read. Other
+		// still-live threads of the process aren't counted
+		// until they exit.
+		spl = splhigh();
+		total += curthread->t_runcycles +
+			(cycles() - curthread->t_runstart);
+		splx(spl);
+		break;
+	    case RUSAGE_CHILDREN:
+		spinlock_acquire(&curproc->p_lock);
+		total = curproc->p_childcycles;
+		spinlock_release(&curproc->p_lock);
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	// We don't separate user from system time, so the whole total
+	// is reported as user time; the remaining fields stay zero
+	bzero(&ru, sizeof(ru));
+	ns = mainbus_cycles_to_ns(total);
+	ru.ru_utime.tv_sec = ns / 1000000000;
+	ru.ru_utime.tv_usec = (ns % 1000000000) / 1000;
+
+	return copyout(&ru, rusageptr, sizeof(ru));
+}
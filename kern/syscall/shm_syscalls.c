@@ -0,0 +1,276 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/userclock.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <proc.h>
+#include <current.h>
+#include <syscall.h>
+
+/*
+ * Shared memory segments (shmget/shmat).
+ *
+ * A segment is a named set of physical frames that several address
+ * spaces map at once, so cooperating processes can exchange data at
+ * memory speed instead of through the filesystem. The frames are
+ * ordinary CM_USER coremap pages sharing the existing copy-on-write
+ * refcount machinery: the segment itself holds one reference per
+ * frame and each attachment holds another, taken with vm_page_incref
+ * and dropped by the attacher's as_destroy through free_upage. Since
+ * the frames have no single owning address space (coremap as ==
+ * NULL), the eviction scanner never touches them; shared segments
+ * are pinned in RAM.
+ *
+ * Attachments are regions like any other: shmat defines a read-write
+ * region in a free address range and installs resident PTEs with the
+ * shm bit set, so the fault path just fills the TLB and as_copy
+ * shares the pages outright instead of marking them copy-on-write.
+ *
+ * As in System V without IPC_RMID, segments persist until reboot;
+ * there is no detach or destroy call. Attachments go away with the
+ * address space.
+ */
+
+/* Per-segment cap, 1 MiB; keeps a runaway shmget from pinning all of RAM */
+#define SHM_MAXPAGES	256
+
+/* First address tried for attachments: above any plausible heap,
+   below the stack and the shared clock page */
+#define SHM_ATTACH_BASE	((vaddr_t)0x60000000)
+
+struct shmseg {
+	int shm_id;		/* segment id returned by shmget */
+	unsigned shm_key;	/* user-chosen name */
+	unsigned shm_npages;
+	unsigned *shm_frames;	/* coremap index of each page */
+	struct shmseg *shm_next;
+};
+
+static struct shmseg *shm_list;
+static int shm_nextid = 1;
+static struct spinlock shm_lock = SPINLOCK_INITIALIZER;
+
+/* Find a segment by key; call with shm_lock held. */
+static
+struct shmseg *
+shm_find_key(unsigned key)
+{
+	for (struct shmseg *seg = shm_list; seg != NULL; seg = seg->shm_next) {
+		if (seg->shm_key == key) {
+			return seg;
+		}
+	}
+	return NULL;
+}
+
+/* Find a segment by id; call with shm_lock held. */
+static
+struct shmseg *
+shm_find_id(int shmid)
+{
+	for (struct shmseg *seg = shm_list; seg != NULL; seg = seg->shm_next) {
+		if (seg->shm_id == shmid) {
+			return seg;
+		}
+	}
+	return NULL;
+}
+
+/* Free a segment that was never published, dropping its frame refs. */
+static
+void
+shm_destroy(struct shmseg *seg, unsigned nframes)
+{
+	for (unsigned i = 0; i < nframes; i++) {
+		free_upage(seg->shm_frames[i]);
+	}
+	kfree(seg->shm_frames);
+	kfree(seg);
+}
+
+/*
+ * Get (find or create) the shared segment named KEY, at least SIZE
+ * bytes long. Returns the segment id for shmat.
+ */
+int
+sys_shmget(unsigned key, size_t size, int32_t *retval)
+{
+	struct shmseg *seg, *existing;
+	unsigned npages;
+
+	npages = ROUNDUP(size, PAGE_SIZE) / PAGE_SIZE;
+	if (npages == 0 || npages > SHM_MAXPAGES) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&shm_lock);
+	existing = shm_find_key(key);
+	if (existing != NULL) {
+		if (npages > existing->shm_npages) {
+			spinlock_release(&shm_lock);
+			return EINVAL;
+		}
+		*retval = existing->shm_id;
+		spinlock_release(&shm_lock);
+		return 0;
+	}
+	spinlock_release(&shm_lock);
+
+	/*
+	 * Build the whole segment before publishing it; frame
+	 * allocation can sleep, so it can't happen under shm_lock.
+	 */
+	seg = kmalloc(sizeof(struct shmseg));
+	if (seg == NULL) {
+		return ENOMEM;
+	}
+	seg->shm_key = key;
+	seg->shm_npages = npages;
+	seg->shm_next = NULL;
+	seg->shm_frames = kmalloc(npages * sizeof(unsigned));
+	if (seg->shm_frames == NULL) {
+		kfree(seg);
+		return ENOMEM;
+	}
+
+	for (unsigned i = 0; i < npages; i++) {
+		/*
+		 * No owning address space and no meaningful vaddr;
+		 * the NULL owner is what keeps the frame off the
+		 * eviction scan.
+		 */
+		seg->shm_frames[i] = alloc_upage_zeroed(NULL, 0);
+		if (seg->shm_frames[i] == 0) {
+			shm_destroy(seg, i);
+			return ENOMEM;
+		}
+	}
+
+	spinlock_acquire(&shm_lock);
+	existing = shm_find_key(key);
+	if (existing != NULL) {
+		/* Somebody else created it while we were allocating. */
+		spinlock_release(&shm_lock);
+		shm_destroy(seg, npages);
+		if (npages > existing->shm_npages) {
+			return EINVAL;
+		}
+		*retval = existing->shm_id;
+		return 0;
+	}
+	seg->shm_id = shm_nextid++;
+	seg->shm_next = shm_list;
+	shm_list = seg;
+	*retval = seg->shm_id;
+	spinlock_release(&shm_lock);
+
+	return 0;
+}
+
+/*
+ * Map the segment SHMID into the calling process, returning the
+ * attach address. The kernel picks the address: the first free
+ * region-sized gap at or above SHM_ATTACH_BASE.
+ */
+int
+sys_shmat(int shmid, int32_t *retval)
+{
+	struct addrspace *as;
+	struct shmseg *seg;
+	vaddr_t attachva;
+	size_t sz;
+	int result;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	spinlock_acquire(&shm_lock);
+	seg = shm_find_id(shmid);
+	spinlock_release(&shm_lock);
+	if (seg == NULL) {
+		return EINVAL;
+	}
+	/* Segments are never destroyed, so SEG stays valid from here. */
+
+	sz = seg->shm_npages * PAGE_SIZE;
+
+	/*
+	 * Pick the attach address. Regions are sorted by vbase, so a
+	 * single pass finds the first gap that fits; the stack is a
+	 * region too and gets skipped like any other.
+	 */
+	attachva = SHM_ATTACH_BASE;
+	for (unsigned r = 0; r < as->nregions; r++) {
+		struct region *reg = &as->regions[r];
+		vaddr_t regend = reg->vbase + reg->npages * PAGE_SIZE;
+
+		if (regend <= attachva) {
+			continue;
+		}
+		if (reg->vbase >= attachva + sz) {
+			break;
+		}
+		attachva = regend;
+	}
+	if (attachva + sz > USERCLOCK_ADDR) {
+		return ENOMEM;
+	}
+
+	/*
+	 * Define the region, preserving the break as as_define_stack
+	 * does; a high attachment must not move the heap.
+	 */
+	vaddr_t old_hstart = as->heap_start;
+	vaddr_t old_hend = as->heap_end;
+
+	result = as_define_region(as, attachva, sz,
+				  1 /* readable */,
+				  1 /* writeable */,
+				  0 /* not executable */);
+	if (result) {
+		return result;
+	}
+
+	as->heap_start = old_hstart;
+	as->heap_end = old_hend;
+
+	/*
+	 * Install resident PTEs for the segment's frames. The shm bit
+	 * keeps as_copy from marking them copy-on-write; as_destroy
+	 * releases the references through free_upage as usual.
+	 */
+	for (unsigned i = 0; i < seg->shm_npages; i++) {
+		vaddr_t va = attachva + i * PAGE_SIZE;
+		struct pte *pte = pt_get_pte(as, va, true);
+
+		if (pte == NULL) {
+			/*
+			 * Out of memory partway through. Undefining
+			 * the region backs out the pages installed so
+			 * far (dropping their segment references) and
+			 * the commit charge in one go.
+			 */
+			as_undefine_region(as, attachva, sz);
+			return ENOMEM;
+		}
+
+		lock_acquire(pte->pte_lock);
+		KASSERT(pte->state == PTE_STATE_UNALLOC);
+		vm_page_incref(seg->shm_frames[i]);
+		pte->pfn = seg->shm_frames[i];
+		pte->readonly = 0;
+		pte->cow = 0;
+		pte->shm = 1;
+		pte->state = PTE_STATE_RAM;
+		pte_sync_fast(pte);
+		lock_release(pte->pte_lock);
+	}
+
+	*retval = (int32_t)attachva;
+	return 0;
+}
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-syscall statistics. See syscallstat.h for the ground rules.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/syscall.h>
+#include <lib.h>
+#include <cpu.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <syscallstat.h>
+
+bool syscallstat_on;
+
+static struct syscallstat syscallstat_table[SYSCALLSTAT_MAXCALLS];
+
+/*
+ * Names for the dump. Only calls this kernel implements are listed;
+ * anything else shows up by number.
+ */
+static
+const char *
+syscallstat_name(int callno)
+{
+	switch (callno) {
+	    case SYS_fork:		return "fork";
+	    case SYS_execv:		return "execv";
+	    case SYS__exit:		return "_exit";
+	    case SYS_waitpid:		return "waitpid";
+	    case SYS_getpid:		return "getpid";
+	    case SYS_sbrk:		return "sbrk";
+	    case SYS_open:		return "open";
+	    case SYS_pipe:		return "pipe";
+	    case SYS_dup:		return "dup";
+	    case SYS_dup2:		return "dup2";
+	    case SYS_close:		return "close";
+	    case SYS_read:		return "read";
+	    case SYS_pread:		return "pread";
+	    case SYS_readv:		return "readv";
+	    case SYS_getdirentry:	return "getdirentry";
+	    case SYS_write:		return "write";
+	    case SYS_pwrite:		return "pwrite";
+	    case SYS_writev:		return "writev";
+	    case SYS_lseek:		return "lseek";
+	    case SYS_remove:		return "remove";
+	    case SYS_chdir:		return "chdir";
+	    case SYS___getcwd:		return "__getcwd";
+	    case SYS___time:		return "__time";
+	    case SYS_reboot:		return "reboot";
+	    case SYS___kheapstats:	return "__kheapstats";
+	    case SYS_spawn:		return "spawn";
+	    default:			return NULL;
+	}
+}
+
+void
+syscallstat_record(int callno, uint32_t startcycles)
+{
+	struct syscallstat *sc;
+	uint32_t delta;
+
+	if (callno < 0 || callno >= SYSCALLSTAT_MAXCALLS) {
+		return;
+	}
+
+	delta = cpu_cyclecount() - startcycles;
+	sc = &syscallstat_table[callno];
+
+	sc->sc_count++;
+	sc->sc_cycles += delta;
+	if (delta > sc->sc_maxcycles) {
+		sc->sc_maxcycles = delta;
+	}
+}
+
+void
+syscallstat_enable(bool on)
+{
+	syscallstat_on = on;
+}
+
+void
+syscallstat_reset(void)
+{
+	int i;
+
+	for (i = 0; i < SYSCALLSTAT_MAXCALLS; i++) {
+		syscallstat_table[i].sc_count = 0;
+		syscallstat_table[i].sc_cycles = 0;
+		syscallstat_table[i].sc_maxcycles = 0;
+	}
+}
+
+/*
+ * Render the report as text into BUF. Shared by the menu command and
+ * the device; one line per call number that has been seen.
+ */
+static
+size_t
+syscallstat_format(char *buf, size_t maxlen)
+{
+	struct syscallstat *sc;
+	const char *name;
+	size_t pos;
+	int i;
+
+	pos = snprintf(buf, maxlen, "%-14s %12s %16s %12s %12s\n",
+		       "syscall", "count", "cycles", "avg", "max");
+
+	for (i = 0; i < SYSCALLSTAT_MAXCALLS; i++) {
+		sc = &syscallstat_table[i];
+		if (sc->sc_count == 0) {
+			continue;
+		}
+
+		name = syscallstat_name(i);
+		if (pos >= maxlen) {
+			break;
+		}
+		if (name != NULL) {
+			pos += snprintf(buf + pos, maxlen - pos,
+				"%-14s %12llu %16llu %12llu %12lu\n",
+				name,
+				(unsigned long long)sc->sc_count,
+				(unsigned long long)sc->sc_cycles,
+				(unsigned long long)
+					(sc->sc_cycles / sc->sc_count),
+				(unsigned long)sc->sc_maxcycles);
+		}
+		else {
+			pos += snprintf(buf + pos, maxlen - pos,
+				"#%-13d %12llu %16llu %12llu %12lu\n",
+				i,
+				(unsigned long long)sc->sc_count,
+				(unsigned long long)sc->sc_cycles,
+				(unsigned long long)
+					(sc->sc_cycles / sc->sc_count),
+				(unsigned long)sc->sc_maxcycles);
+		}
+	}
+
+	if (pos > maxlen) {
+		pos = maxlen;
+	}
+	return pos;
+}
+
+/* Generous bound: one line per possible call number. */
+#define SYSCALLSTAT_BUFSIZE (SYSCALLSTAT_MAXCALLS * 80)
+
+void
+syscallstat_dump(void)
+{
+	char *buf;
+
+	buf = kmalloc(SYSCALLSTAT_BUFSIZE);
+	if (buf == NULL) {
+		kprintf("syscallstat: out of memory\n");
+		return;
+	}
+
+	syscallstat_format(buf, SYSCALLSTAT_BUFSIZE);
+	kprintf("Syscall statistics (sampling %s):\n",
+		syscallstat_on ? "on" : "off");
+	kprintf("%s", buf);
+
+	kfree(buf);
+}
+
+/*
+ * The "syscallstat:" device: reading it produces the same report as
+ * the menu command, regenerated on each read, so userland tools can
+ * collect the numbers.
+ */
+
+static
+int
+syscallstatdev_eachopen(struct device *dev, int openflags)
+{
+	(void)dev;
+	(void)openflags;
+
+	return 0;
+}
+
+static
+int
+syscallstatdev_io(struct device *dev, struct uio *uio)
+{
+	char *buf;
+	size_t len;
+	int err;
+
+	(void)dev;
+
+	if (uio->uio_rw != UIO_READ) {
+		return EIO;
+	}
+
+	buf = kmalloc(SYSCALLSTAT_BUFSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	len = syscallstat_format(buf, SYSCALLSTAT_BUFSIZE);
+
+	// Reads past the end of the report produce EOF
+	err = 0;
+	if ((size_t)uio->uio_offset < len) {
+		err = uiomove(buf + uio->uio_offset,
+			      len - uio->uio_offset, uio);
+	}
+
+	kfree(buf);
+	return err;
+}
+
+static
+int
+syscallstatdev_ioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+static const struct device_ops syscallstat_devops = {
+	.devop_eachopen = syscallstatdev_eachopen,
+	.devop_io = syscallstatdev_io,
+	.devop_ioctl = syscallstatdev_ioctl,
+	.devop_poll = dev_poll_always,
+};
+
+/*
+ * Function to create and attach syscallstat:
+ */
+void
+syscallstatdev_create(void)
+{
+	int result;
+	struct device *dev;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev==NULL) {
+		panic("Could not add syscallstat device: out of memory\n");
+	}
+
+	dev->d_ops = &syscallstat_devops;
+
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+
+	dev->d_data = NULL;
+
+	result = vfs_adddev("syscallstat", dev, 0);
+	if (result) {
+		panic("Could not add syscallstat device: %s\n",
+		      strerror(result));
+	}
+}
@@ -0,0 +1,161 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <syscall.h>
+
+/*
+ * tfork/texit: extra kernel threads within one process, so userland
+ * threading (lib/libpthread) can use the other CPUs.
+ *
+ * tfork starts another thread in the calling process. The new thread
+ * enters user mode at ENTRY with the supplied stack pointer and ARG
+ * in the first argument register. Nothing else is touched: the
+ * address space and file table are the process's own and are shared
+ * with every other thread in it, and the caller is responsible for
+ * providing a usable stack (the threading library carves one out of
+ * the heap).
+ *
+ * texit ends only the calling thread. Before detaching, the kernel
+ * stores 1 to DONEADDR and wakes any futex waiters on that word.
+ * Doing the store in the kernel, after the thread's last user-mode
+ * instruction, means that once a joiner observes it the dead thread
+ * can no longer touch its user stack, so the joiner may free the
+ * stack. (A userland store before the texit call would leave a
+ * window where the exiting thread is still running on that stack.)
+ *
+ * The process as a whole still exits via _exit, which tears down the
+ * file table and address space immediately; the threading library is
+ * expected to join all of its threads first.
+ */
+
+struct tfork_args {
+	vaddr_t ta_entry;
+	vaddr_t ta_stack;
+	unsigned ta_arg;
+};
+
+/*
+ * Thread entry point: enter user mode at the requested pc and sp
+ * with a0 = arg. (enter_new_process's argc slot is the a0 register.)
+ */
+static
+void
+enter_tforked_thread(void *data, unsigned long ndata)
+{
+	struct tfork_args args = *(struct tfork_args *)data;
+
+	KASSERT(ndata == 1);
+	kfree(data);
+
+	as_activate();
+	enter_new_process((int)args.ta_arg, NULL, NULL,
+			  args.ta_stack, args.ta_entry);
+}
+
+int
+sys_tfork(userptr_t entry, userptr_t stack, unsigned arg, int32_t *retval)
+{
+	struct tfork_args *args;
+	int err;
+
+	/*
+	 * Only sanity-check the alignment; a thread started on a
+	 * bogus pc or sp just faults in the usual way and that's the
+	 * caller's own lookout.
+	 */
+	if (entry == NULL || (vaddr_t)entry % 4 != 0 ||
+	    stack == NULL || (vaddr_t)stack % 8 != 0) {
+		return EINVAL;
+	}
+
+	args = kmalloc(sizeof(*args));
+	if (args == NULL) {
+		return ENOMEM;
+	}
+	args->ta_entry = (vaddr_t)entry;
+	args->ta_stack = (vaddr_t)stack;
+	args->ta_arg = arg;
+
+	err = thread_fork(curthread->t_name, curproc,
+			  enter_tforked_thread, args, 1);
+	if (err) {
+		kfree(args);
+		return err;
+	}
+
+	*retval = 0;
+	return 0;
+}
+
+int
+sys_texit(userptr_t doneaddr)
+{
+	unsigned one = 1;
+	int32_t unused;
+
+	/*
+	 * Publish the exit while we still have the address space.
+	 * Errors are ignored: a thread that hands in a bad done
+	 * address exits without notifying its joiner, which is its
+	 * own fault.
+	 */
+	if (doneaddr != NULL) {
+		if (copyout(&one, doneaddr, sizeof(one)) == 0) {
+			sys_futex(doneaddr, FUTEX_WAKE, 0xffffffff, &unused);
+		}
+	}
+
+	// Detach just this thread; the process lives on
+	proc_remthread(curthread);
+
+	// Does not return
+	thread_exit();
+
+	panic("sys_texit: thread_exit returned\n");
+	return 0;
+}
+
+/*
+ * Per-thread userland TLS base. The kernel only stores the pointer;
+ * libc points it at a per-thread block (errno and friends, see the
+ * userland <tls.h>) so that per-thread state can be found in O(1)
+ * instead of by scanning thread stacks under a lock. gettls returns
+ * NULL until settls has been called on the thread; fork copies the
+ * value to the child's initial thread, and exec clears it.
+ */
+int
+sys_settls(userptr_t base)
+{
+	curthread->t_usertls = base;
+	return 0;
+}
+
+int
+sys_gettls(int32_t *retval)
+{
+	*retval = (int32_t)(vaddr_t)curthread->t_usertls;
+	return 0;
+}
+
+/*
+ * Pin the calling thread to cpu CPUNUM, or release the pin by
+ * passing (unsigned)-1. For a single-threaded process this pins the
+ * process; a threaded one (tfork) has each thread set its own, since
+ * placing the threads is the threading library's business anyway.
+ * The pin takes full effect at the thread's next wakeup (see
+ * thread_set_affinity), which for a thread that just made a system
+ * call is never far off.
+ */
+int
+sys_setaffinity(unsigned cpunum)
+{
+	return thread_set_affinity(curthread,
+				   cpunum == (unsigned)-1 ?
+				   THREAD_AFFINITY_ANY : cpunum);
+}
@@ -218,3 +218,100 @@ arraytest2(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Test for the inline-storage (by-value) arrays. Uses an element
+ * bigger than a pointer so the by-value copies are exercised for real.
+ */
+
+struct vtelem {
+	int ve_key;
+	int ve_pad[3];
+};
+
+DECLVALARRAY(vtelem, static __UNUSED inline);
+DEFVALARRAY(vtelem, static __UNUSED inline);
+
+int
+arraytest3(int nargs, char **args)
+{
+	struct vtelemvalarray *a;
+	struct vtelem e, *p;
+	unsigned i, x;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	/* Silence warning with gcc 4.8 -Og (but not -O2) */
+	x = 0;
+
+	kprintf("Beginning valarray test...\n");
+	a = vtelemvalarray_create();
+	KASSERT(a != NULL);
+
+	/* 1. Fill it one at a time, from a reused stack element. */
+	for (i=0; i<TESTSIZE; i++) {
+		e.ve_key = i;
+		e.ve_pad[0] = e.ve_pad[1] = e.ve_pad[2] = ~(int)i;
+		result = vtelemvalarray_add(a, &e, &x);
+		KASSERT(result == 0);
+		KASSERT(x == i);
+	}
+	KASSERT(vtelemvalarray_num(a) == TESTSIZE);
+
+	/* 2. Check the contents (copies, not the stack element) */
+	for (i=0; i<TESTSIZE; i++) {
+		p = vtelemvalarray_get(a, i);
+		KASSERT(p->ve_key == (int)i);
+		KASSERT(p->ve_pad[2] == ~(int)i);
+	}
+
+	/* 3. Overwrite in place via set */
+	for (i=0; i<TESTSIZE; i++) {
+		e.ve_key = TESTSIZE-i-1;
+		vtelemvalarray_set(a, i, &e);
+	}
+	for (i=0; i<TESTSIZE; i++) {
+		p = vtelemvalarray_get(a, i);
+		KASSERT(p->ve_key == (int)(TESTSIZE-i-1));
+	}
+
+	/* 4. Zot an entry; the rest should slide down */
+	vtelemvalarray_remove(a, 1);
+	KASSERT(vtelemvalarray_num(a) == TESTSIZE-1);
+	p = vtelemvalarray_get(a, 0);
+	KASSERT(p->ve_key == TESTSIZE-1);
+	for (i=1; i<TESTSIZE-1; i++) {
+		p = vtelemvalarray_get(a, i);
+		KASSERT(p->ve_key == (int)(TESTSIZE-i-2));
+	}
+
+	/* 5. Grow well past the next realloc; old contents must move over */
+	result = vtelemvalarray_setsize(a, BIGTESTSIZE);
+	KASSERT(result == 0);
+	p = vtelemvalarray_get(a, 0);
+	KASSERT(p->ve_key == TESTSIZE-1);
+	for (i=1; i<TESTSIZE-1; i++) {
+		p = vtelemvalarray_get(a, i);
+		KASSERT(p->ve_key == (int)(TESTSIZE-i-2));
+	}
+
+	/* 6. Fill the new space and spot-check it */
+	for (i=TESTSIZE-1; i<BIGTESTSIZE; i++) {
+		e.ve_key = i;
+		vtelemvalarray_set(a, i, &e);
+	}
+	for (i=0; i<TESTSIZE*4; i++) {
+		x = TESTSIZE-1 + random()%(BIGTESTSIZE-(TESTSIZE-1));
+		p = vtelemvalarray_get(a, x);
+		KASSERT(p->ve_key == (int)x);
+	}
+
+	/* done; no need to empty it first */
+	vtelemvalarray_destroy(a);
+
+	kprintf("Valarray test complete\n");
+
+	return 0;
+}
@@ -101,6 +101,40 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	bitmap_destroy(b);
+
+	/*
+	 * Now the run operations. Marking every 19th bit leaves runs
+	 * of exactly 18 clear bits between the marks.
+	 */
+	b = bitmap_create(TESTSIZE);
+	KASSERT(b != NULL);
+
+	for (i=0; i<TESTSIZE; i+=19) {
+		bitmap_mark(b, i);
+	}
+
+	KASSERT(bitmap_findrun(b, 19, &x) != 0);
+
+	for (i=0; i+19<=TESTSIZE; i+=19) {
+		KASSERT(bitmap_allocrun(b, 18, &x) == 0);
+		KASSERT(x == (uint32_t)i+1);
+	}
+	KASSERT(bitmap_allocrun(b, 18, &x) != 0);
+
+	/* Free one run in the middle; the search must wrap to find it. */
+	bitmap_unmarkrange(b, 20, 18);
+	KASSERT(bitmap_allocrun(b, 18, &x) == 0);
+	KASSERT(x == 20);
+
+	/* Whole-word clear and set. */
+	bitmap_unmarkrange(b, 0, TESTSIZE);
+	KASSERT(bitmap_findrun(b, TESTSIZE, &x) == 0);
+	KASSERT(x == 0);
+	bitmap_markrange(b, 0, TESTSIZE);
+
+	bitmap_destroy(b);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
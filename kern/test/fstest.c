@@ -41,8 +41,11 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/time.h>
 #include <lib.h>
 #include <uio.h>
+#include <cpu.h>
+#include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <vfs.h>
@@ -672,6 +675,294 @@ docreatestress(const char *filesys)
 	kprintf("*** fs create stress test done\n");
 }
 
+////////////////////////////////////////////////////////////
+// throughput benchmark (fs7)
+
+/*
+ * Unlike the tests above, this reports numbers instead of pass/fail:
+ * sequential and random read/write phases over a scratch file, then a
+ * create/remove metadata storm. Throughput (KB/s, ops/s) comes from
+ * the wall clock around each phase; per-op latency percentiles come
+ * from the cycle counter around each VOP, so one slow op (a buffer
+ * cache miss, a long seek) shows up in p99 instead of vanishing into
+ * an average. File and record size are arguments, so the same run
+ * can be aimed below or above the buffer cache's capacity.
+ */
+
+#define BENCH_FILENAME	"fsbench.tmp"
+#define BENCH_MAXSAMPLES 4096		/* latency samples kept per phase */
+#define BENCH_DEFAULT_KB 384		/* default file size, in KB */
+#define BENCH_DEFAULT_REC 4096		/* default record size, in bytes */
+#define BENCH_NMETA	128		/* files in the metadata storm */
+
+static
+void
+fsbench_stats(const char *phase, uint32_t *s, unsigned n,
+	      uint64_t bytes, uint64_t ns)
+{
+	uint64_t kbps, opsps;
+	uint32_t tmp;
+	unsigned i, j;
+
+	KASSERT(n > 0);
+
+	/* Insertion sort; not the timed part. */
+	for (i = 1; i < n; i++) {
+		tmp = s[i];
+		for (j = i; j > 0 && s[j-1] > tmp; j--) {
+			s[j] = s[j-1];
+		}
+		s[j] = tmp;
+	}
+
+	if (ns == 0) {
+		ns = 1;
+	}
+	kbps = bytes * 1000000000ULL / ns / 1024;
+	opsps = (uint64_t)n * 1000000000ULL / ns;
+
+	if (bytes > 0) {
+		kprintf("%-13s %5u ops  %6llu KB  %7llu KB/s  %6llu ops/s\n",
+			phase, n,
+			(unsigned long long)(bytes / 1024),
+			(unsigned long long)kbps,
+			(unsigned long long)opsps);
+	}
+	else {
+		kprintf("%-13s %5u ops  %9s  %14s %6llu ops/s\n",
+			phase, n, "", "",
+			(unsigned long long)opsps);
+	}
+	kprintf("    cycles/op: min %lu  median %lu  p99 %lu  max %lu\n",
+		(unsigned long)s[0],
+		(unsigned long)s[n/2],
+		(unsigned long)s[(n/100)*99],
+		(unsigned long)s[n-1]);
+}
+
+static
+uint64_t
+fsbench_elapsed(const struct timespec *t0, const struct timespec *t1)
+{
+	return (uint64_t)(t1->tv_sec - t0->tv_sec) * 1000000000ULL
+		+ (int64_t)t1->tv_nsec - t0->tv_nsec;
+}
+
+/*
+ * One I/O phase: NRECS records of RECSIZE bytes, sequential or in a
+ * pseudo-random (but repeatable) order.
+ */
+static
+int
+fsbench_phase(struct vnode *vn, char *buf, unsigned recsize,
+	      unsigned nrecs, bool iswrite, bool randomorder,
+	      uint32_t *samples, uint64_t *ns_ret)
+{
+	struct timespec t0, t1;
+	struct iovec iov;
+	struct uio ku;
+	uint32_t start, seed;
+	unsigned i, rec;
+	int err;
+
+	seed = 24601;
+	gettime(&t0);
+	for (i = 0; i < nrecs; i++) {
+		if (randomorder) {
+			seed = seed * 1103515245 + 12345;
+			rec = (seed >> 8) % nrecs;
+		}
+		else {
+			rec = i;
+		}
+		uio_kinit(&iov, &ku, buf, recsize, (off_t)rec * recsize,
+			  iswrite ? UIO_WRITE : UIO_READ);
+		start = cpu_cyclecount();
+		err = iswrite ? VOP_WRITE(vn, &ku) : VOP_READ(vn, &ku);
+		if (i < BENCH_MAXSAMPLES) {
+			samples[i] = cpu_cyclecount() - start;
+		}
+		if (err) {
+			kprintf("fsbench: %s error: %s\n",
+				iswrite ? "write" : "read", strerror(err));
+			return err;
+		}
+		if (ku.uio_resid > 0) {
+			kprintf("fsbench: short %s\n",
+				iswrite ? "write" : "read");
+			return EIO;
+		}
+	}
+	gettime(&t1);
+	*ns_ret = fsbench_elapsed(&t0, &t1);
+	return 0;
+}
+
+/*
+ * Create/remove storm: BENCH_NMETA empty files made and then
+ * unlinked, each op timed. All directory and inode traffic, no data.
+ */
+static
+int
+fsbench_meta(const char *fs, uint32_t *samples)
+{
+	struct timespec t0, t1;
+	struct vnode *vn;
+	uint64_t ns;
+	uint32_t start;
+	char name[32];
+	char buf[32];
+	unsigned i;
+	int err;
+
+	gettime(&t0);
+	for (i = 0; i < BENCH_NMETA; i++) {
+		snprintf(name, sizeof(name), "%s:%s.%u",
+			 fs, BENCH_FILENAME, i);
+		strcpy(buf, name);
+		start = cpu_cyclecount();
+		err = vfs_open(buf, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+		if (err == 0) {
+			vfs_close(vn);
+		}
+		samples[i] = cpu_cyclecount() - start;
+		if (err) {
+			kprintf("fsbench: create %s: %s\n",
+				name, strerror(err));
+			return err;
+		}
+	}
+	gettime(&t1);
+	ns = fsbench_elapsed(&t0, &t1);
+	fsbench_stats("create", samples, BENCH_NMETA, 0, ns);
+
+	gettime(&t0);
+	for (i = 0; i < BENCH_NMETA; i++) {
+		snprintf(name, sizeof(name), "%s:%s.%u",
+			 fs, BENCH_FILENAME, i);
+		start = cpu_cyclecount();
+		err = vfs_remove(name);
+		samples[i] = cpu_cyclecount() - start;
+		if (err) {
+			kprintf("fsbench: remove %s: %s\n",
+				name, strerror(err));
+			return err;
+		}
+	}
+	gettime(&t1);
+	ns = fsbench_elapsed(&t0, &t1);
+	fsbench_stats("remove", samples, BENCH_NMETA, 0, ns);
+
+	return 0;
+}
+
+int
+fsbench(int nargs, char **args)
+{
+	struct vnode *vn;
+	uint32_t *samples;
+	uint64_t ns;
+	char name[32];
+	char buf[32];
+	char *device;
+	unsigned filekb, recsize, nrecs, nsamples;
+	int err;
+
+	if (nargs < 2 || nargs > 4) {
+		kprintf("Usage: fs7 filesystem: [file-KB [record-bytes]]\n");
+		return EINVAL;
+	}
+
+	device = args[1];
+	if (device[strlen(device)-1]==':') {
+		device[strlen(device)-1] = 0;
+	}
+
+	filekb = (nargs >= 3) ? (unsigned)atoi(args[2]) : BENCH_DEFAULT_KB;
+	recsize = (nargs >= 4) ? (unsigned)atoi(args[3]) : BENCH_DEFAULT_REC;
+	if (filekb == 0 || recsize == 0 || recsize > filekb * 1024) {
+		kprintf("fsbench: bad file/record size\n");
+		return EINVAL;
+	}
+	nrecs = filekb * 1024 / recsize;
+	nsamples = nrecs < BENCH_MAXSAMPLES ? nrecs : BENCH_MAXSAMPLES;
+
+	samples = kmalloc(BENCH_MAXSAMPLES * sizeof(uint32_t));
+	if (samples == NULL) {
+		return ENOMEM;
+	}
+
+	char *iobuf = kmalloc(recsize);
+	if (iobuf == NULL) {
+		kfree(samples);
+		return ENOMEM;
+	}
+	for (unsigned i = 0; i < recsize; i++) {
+		iobuf[i] = 'a' + i % 26;
+	}
+
+	kprintf("*** Starting fs benchmark on %s: %u KB file, "
+		"%u byte records\n", device, filekb, recsize);
+
+	snprintf(name, sizeof(name), "%s:%s", device, BENCH_FILENAME);
+	strcpy(buf, name);
+	err = vfs_open(buf, O_RDWR|O_CREAT|O_TRUNC, 0664, &vn);
+	if (err) {
+		kprintf("fsbench: could not open %s: %s\n",
+			name, strerror(err));
+		goto out;
+	}
+
+	err = fsbench_phase(vn, iobuf, recsize, nrecs, true, false,
+			    samples, &ns);
+	if (err) {
+		goto closeout;
+	}
+	fsbench_stats("seq write", samples, nsamples,
+		      (uint64_t)nrecs * recsize, ns);
+
+	err = fsbench_phase(vn, iobuf, recsize, nrecs, false, false,
+			    samples, &ns);
+	if (err) {
+		goto closeout;
+	}
+	fsbench_stats("seq read", samples, nsamples,
+		      (uint64_t)nrecs * recsize, ns);
+
+	err = fsbench_phase(vn, iobuf, recsize, nrecs, false, true,
+			    samples, &ns);
+	if (err) {
+		goto closeout;
+	}
+	fsbench_stats("random read", samples, nsamples,
+		      (uint64_t)nrecs * recsize, ns);
+
+	err = fsbench_phase(vn, iobuf, recsize, nrecs, true, true,
+			    samples, &ns);
+	if (err) {
+		goto closeout;
+	}
+	fsbench_stats("random write", samples, nsamples,
+		      (uint64_t)nrecs * recsize, ns);
+
+ closeout:
+	vfs_close(vn);
+	vfs_remove(name);
+
+	if (err == 0) {
+		err = fsbench_meta(device, samples);
+	}
+
+	if (err == 0) {
+		kprintf("*** fs benchmark done\n");
+	}
+
+ out:
+	kfree(iobuf);
+	kfree(samples);
+	return err;
+}
+
 ////////////////////////////////////////////////////////////
 
 static
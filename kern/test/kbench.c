@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel micro-benchmarks.
+ *
+ * Timed loops for the operations performance work keeps touching:
+ * context switches, lock acquire/release, kmalloc/kfree, user
+ * copies, page faults. Each loop stamps the cycle counter around one
+ * operation and reports min/median/p99/max cycles per op, so a
+ * change is judged by its effect on the distribution rather than a
+ * mean that one timer interrupt can wreck. Interrupts stay on, as in
+ * real use; ticks land in the tail percentiles where they belong.
+ *
+ * Deltas come from the per-cpu cycle counter and assume the
+ * measuring thread stays put; a sample taken across a migration is
+ * garbage, which the percentiles shrug off.
+ *
+ * "kbench check" runs every loop and compares each median against
+ * the budget table below; the test161 perf target keys off the
+ * verdict line it prints.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <test.h>
+#include <kern/test161.h>
+
+/* Samples per distribution. */
+#define KBENCH_SAMPLES	1024
+
+/* User window for the copy and fault loops. */
+#define KBENCH_UBASE	((vaddr_t)0x2000000)
+#define KBENCH_UPAGES	64
+
+/*
+ * Median cycle budgets for check mode ("kbench check"), used by the
+ * test161 perf target. Each is roughly twice what current kernels
+ * measure under sys161's default clock, so exceeding one means a real
+ * regression rather than scheduling noise. Recalibrate when the
+ * machine model or clock changes.
+ */
+static const struct {
+	const char *kb_name;
+	uint32_t kb_maxmedian;
+} kbench_budgets[] = {
+	{ "pingpong",	    20000 },
+	{ "lock",	      600 },
+	{ "spinlock",	      300 },
+	{ "kmalloc 16",	     2000 },
+	{ "kmalloc 64",	     2000 },
+	{ "kmalloc 256",     2000 },
+	{ "kmalloc 1024",    3000 },
+	{ "kmalloc 4096",    6000 },
+	{ "copyout 4k",	    30000 },
+	{ "copyin 4k",	    30000 },
+	{ "zerofill fault", 50000 },
+};
+
+/* Check mode state: set by the driver, consulted by kbench_report. */
+static bool kbench_checking;
+static bool kbench_exceeded;
+
+////////////////////////////////////////////////////////////
+// reporting
+
+static
+void
+kbench_report(const char *name, uint32_t *s, unsigned n)
+{
+	uint32_t tmp;
+	unsigned i, j;
+
+	KASSERT(n > 0);
+
+	/* Insertion sort; n is small and this is not the timed part. */
+	for (i = 1; i < n; i++) {
+		tmp = s[i];
+		for (j = i; j > 0 && s[j-1] > tmp; j--) {
+			s[j] = s[j-1];
+		}
+		s[j] = tmp;
+	}
+
+	kprintf("%-16s %6u ops: min %6lu  median %6lu  "
+		"p99 %6lu  max %8lu\n",
+		name, n,
+		(unsigned long)s[0],
+		(unsigned long)s[n/2],
+		(unsigned long)s[(n/100)*99],
+		(unsigned long)s[n-1]);
+
+	metric_percentiles(name, n, s[n/2], s[(n/100)*90], s[(n/100)*99],
+			   "cycles");
+
+	if (kbench_checking) {
+		for (i = 0; i < sizeof(kbench_budgets) /
+			     sizeof(kbench_budgets[0]); i++) {
+			if (strcmp(name, kbench_budgets[i].kb_name) != 0) {
+				continue;
+			}
+			if (s[n/2] > kbench_budgets[i].kb_maxmedian) {
+				kprintf("kbench: %s median %lu exceeds "
+					"budget %lu\n",
+					name,
+					(unsigned long)s[n/2],
+					(unsigned long)
+					kbench_budgets[i].kb_maxmedian);
+				kbench_exceeded = true;
+			}
+			break;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// context switch
+
+static struct semaphore *kbench_ping;
+static struct semaphore *kbench_pong;
+static struct semaphore *kbench_done;
+
+static
+void
+kbench_partner(void *p, unsigned long rounds)
+{
+	unsigned long i;
+
+	(void)p;
+
+	for (i = 0; i < rounds; i++) {
+		P(kbench_ping);
+		V(kbench_pong);
+	}
+	V(kbench_done);
+}
+
+/*
+ * One sample is a semaphore round trip: wake the partner, sleep
+ * until it wakes us. On one cpu that is two full context switches;
+ * on SMP the partner may run elsewhere and the number becomes
+ * cross-cpu wakeup latency instead, which is worth knowing too.
+ */
+static
+int
+kbench_switch(uint32_t *samples)
+{
+	uint32_t start;
+	unsigned i;
+	int result;
+
+	kbench_ping = sem_create("kbench_ping", 0);
+	kbench_pong = sem_create("kbench_pong", 0);
+	kbench_done = sem_create("kbench_done", 0);
+	if (kbench_ping == NULL || kbench_pong == NULL ||
+	    kbench_done == NULL) {
+		goto nomem;
+	}
+
+	result = thread_fork("kbench_partner", NULL, kbench_partner,
+			     NULL, KBENCH_SAMPLES);
+	if (result) {
+		goto nomem;
+	}
+
+	for (i = 0; i < KBENCH_SAMPLES; i++) {
+		start = cpu_cyclecount();
+		V(kbench_ping);
+		P(kbench_pong);
+		samples[i] = cpu_cyclecount() - start;
+	}
+	P(kbench_done);
+
+	sem_destroy(kbench_ping);
+	sem_destroy(kbench_pong);
+	sem_destroy(kbench_done);
+
+	kbench_report("pingpong", samples, KBENCH_SAMPLES);
+	return 0;
+
+ nomem:
+	if (kbench_ping != NULL) {
+		sem_destroy(kbench_ping);
+	}
+	if (kbench_pong != NULL) {
+		sem_destroy(kbench_pong);
+	}
+	if (kbench_done != NULL) {
+		sem_destroy(kbench_done);
+	}
+	return ENOMEM;
+}
+
+////////////////////////////////////////////////////////////
+// locks
+
+static
+int
+kbench_lock(uint32_t *samples)
+{
+	struct lock *lk;
+	struct spinlock slk;
+	uint32_t start;
+	unsigned i;
+
+	lk = lock_create("kbench_lock");
+	if (lk == NULL) {
+		return ENOMEM;
+	}
+	for (i = 0; i < KBENCH_SAMPLES; i++) {
+		start = cpu_cyclecount();
+		lock_acquire(lk);
+		lock_release(lk);
+		samples[i] = cpu_cyclecount() - start;
+	}
+	lock_destroy(lk);
+	kbench_report("lock", samples, KBENCH_SAMPLES);
+
+	spinlock_init(&slk);
+	for (i = 0; i < KBENCH_SAMPLES; i++) {
+		start = cpu_cyclecount();
+		spinlock_acquire(&slk);
+		spinlock_release(&slk);
+		samples[i] = cpu_cyclecount() - start;
+	}
+	spinlock_cleanup(&slk);
+	kbench_report("spinlock", samples, KBENCH_SAMPLES);
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// kmalloc/kfree
+
+/* One size per subpage class, plus a whole-page allocation. */
+static const size_t kbench_sizes[] = { 16, 64, 256, 1024, 4096 };
+
+static
+int
+kbench_kmalloc(uint32_t *samples)
+{
+	char name[16];
+	uint32_t start;
+	unsigned i, sz;
+	void *p;
+
+	for (sz = 0; sz < sizeof(kbench_sizes)/sizeof(kbench_sizes[0]);
+	     sz++) {
+		for (i = 0; i < KBENCH_SAMPLES; i++) {
+			start = cpu_cyclecount();
+			p = kmalloc(kbench_sizes[sz]);
+			if (p == NULL) {
+				return ENOMEM;
+			}
+			kfree(p);
+			samples[i] = cpu_cyclecount() - start;
+		}
+		snprintf(name, sizeof(name), "kmalloc %zu",
+			 kbench_sizes[sz]);
+		kbench_report(name, samples, KBENCH_SAMPLES);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// user copies and page faults
+
+/*
+ * Both loops need user memory to copy into, and the menu thread has
+ * none; borrow an address space for the duration. Setting it on the
+ * menu thread's process is safe because only the faulting thread's
+ * own address space matters to vm_fault, and it is restored before
+ * returning.
+ */
+static
+struct addrspace *
+kbench_asbegin(void)
+{
+	struct addrspace *as;
+	int result;
+
+	as = as_create();
+	if (as == NULL) {
+		return NULL;
+	}
+	result = as_define_region(as, KBENCH_UBASE,
+				  KBENCH_UPAGES * PAGE_SIZE, 1, 1, 0);
+	if (result) {
+		as_destroy(as);
+		return NULL;
+	}
+
+	/* The menu thread has no address space to save. */
+	KASSERT(proc_getas() == NULL);
+	proc_setas(as);
+	as_activate();
+	return as;
+}
+
+static
+void
+kbench_asend(struct addrspace *as)
+{
+	proc_setas(NULL);
+	as_activate();
+	as_destroy(as);
+}
+
+static
+int
+kbench_copy(uint32_t *samples)
+{
+	struct addrspace *as;
+	userptr_t ubuf;
+	uint32_t start;
+	unsigned i;
+	char *kbuf;
+	int result;
+
+	kbuf = kmalloc(PAGE_SIZE);
+	if (kbuf == NULL) {
+		return ENOMEM;
+	}
+	bzero(kbuf, PAGE_SIZE);
+
+	as = kbench_asbegin();
+	if (as == NULL) {
+		kfree(kbuf);
+		return ENOMEM;
+	}
+	ubuf = (userptr_t)KBENCH_UBASE;
+
+	/* Fault the page in so the loops measure copying, not faults. */
+	result = copyout(kbuf, ubuf, PAGE_SIZE);
+	if (result) {
+		kbench_asend(as);
+		kfree(kbuf);
+		return result;
+	}
+
+	for (i = 0; i < KBENCH_SAMPLES; i++) {
+		start = cpu_cyclecount();
+		copyout(kbuf, ubuf, PAGE_SIZE);
+		samples[i] = cpu_cyclecount() - start;
+	}
+	kbench_report("copyout 4k", samples, KBENCH_SAMPLES);
+
+	for (i = 0; i < KBENCH_SAMPLES; i++) {
+		start = cpu_cyclecount();
+		copyin(ubuf, kbuf, PAGE_SIZE);
+		samples[i] = cpu_cyclecount() - start;
+	}
+	kbench_report("copyin 4k", samples, KBENCH_SAMPLES);
+
+	kbench_asend(as);
+	kfree(kbuf);
+	return 0;
+}
+
+/*
+ * One sample is the first touch of an untouched page: TLB miss,
+ * vm_fault, zero-fill. The window is recycled by tearing the address
+ * space down and starting over once all its pages are materialized.
+ */
+static
+int
+kbench_fault(uint32_t *samples)
+{
+	struct addrspace *as;
+	uint32_t start, word;
+	unsigned i;
+	int result;
+
+	word = 0;
+	as = NULL;
+	for (i = 0; i < KBENCH_SAMPLES; i++) {
+		if (i % KBENCH_UPAGES == 0) {
+			if (as != NULL) {
+				kbench_asend(as);
+			}
+			as = kbench_asbegin();
+			if (as == NULL) {
+				return ENOMEM;
+			}
+		}
+		start = cpu_cyclecount();
+		result = copyout(&word, (userptr_t)(KBENCH_UBASE +
+				(i % KBENCH_UPAGES) * PAGE_SIZE),
+				sizeof(word));
+		samples[i] = cpu_cyclecount() - start;
+		if (result) {
+			kbench_asend(as);
+			return result;
+		}
+	}
+	kbench_asend(as);
+
+	kbench_report("zerofill fault", samples, KBENCH_SAMPLES);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// driver
+
+int
+kbench(int nargs, char **args)
+{
+	uint32_t *samples;
+	bool all;
+	int result;
+
+	all = (nargs < 2);
+	kbench_checking = (nargs >= 2 && !strcmp(args[1], "check"));
+	if (kbench_checking) {
+		all = true;
+		kbench_exceeded = false;
+	}
+
+	samples = kmalloc(KBENCH_SAMPLES * sizeof(uint32_t));
+	if (samples == NULL) {
+		return ENOMEM;
+	}
+
+	kprintf("kbench: %u samples per loop, cycles per op\n",
+		KBENCH_SAMPLES);
+
+	result = 0;
+	if (all || !strcmp(args[1], "switch")) {
+		result = kbench_switch(samples);
+	}
+	if (result == 0 && (all || !strcmp(args[1], "lock"))) {
+		result = kbench_lock(samples);
+	}
+	if (result == 0 && (all || !strcmp(args[1], "kmalloc"))) {
+		result = kbench_kmalloc(samples);
+	}
+	if (result == 0 && (all || !strcmp(args[1], "copy"))) {
+		result = kbench_copy(samples);
+	}
+	if (result == 0 && (all || !strcmp(args[1], "fault"))) {
+		result = kbench_fault(samples);
+	}
+
+	/*
+	 * The success line is what the test161 perf tests match; a
+	 * regression is reported by its absence (plus the per-loop
+	 * exceeds lines above).
+	 */
+	if (result == 0 && kbench_checking) {
+		if (kbench_exceeded) {
+			kprintf("kbench: cycle budgets exceeded\n");
+		}
+		else {
+			kprintf("kbench: all medians within budget\n");
+		}
+	}
+
+	kfree(samples);
+	if (result) {
+		kprintf("kbench: failed: %s\n", strerror(result));
+	}
+	return result;
+}
@@ -51,7 +51,7 @@ static
 void
 count_max_readers() {
 	spinlock_acquire(&status_lock);
-	unsigned cur_readers = threadarray_num(testrwlock->rwlock_active_readers);
+	unsigned cur_readers = (testrwlock->rwlock_state & RWLOCK_READERMASK);
 	if (cur_readers > max_readers) {
 		max_readers = cur_readers;
 	}
@@ -85,48 +85,48 @@ readertestthread(void *junk, unsigned long num) {
 		unsigned long local3 = testval3;
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == NULL);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) > 0);
+		KASSERT(testrwlock->rwlock_writer == NULL);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) > 0);
 
 		if (local1 != testval1) {
 			goto fail;
 		}
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == NULL);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) > 0);
+		KASSERT(testrwlock->rwlock_writer == NULL);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) > 0);
 
 		if (local2 != testval2) {
 			goto fail;
 		}
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == NULL);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) > 0);
+		KASSERT(testrwlock->rwlock_writer == NULL);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) > 0);
 
 		if (local2 != testval1 * testval1) {
 			goto fail;
 		}
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == NULL);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) > 0);
+		KASSERT(testrwlock->rwlock_writer == NULL);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) > 0);
 		
 		if (local3 != testval3) {
 			goto fail;
 		}
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == NULL);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) > 0);
+		KASSERT(testrwlock->rwlock_writer == NULL);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) > 0);
 		
 		if (local3 != testval1 % 3) {
 			goto fail;
 		}
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == NULL);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) > 0);
+		KASSERT(testrwlock->rwlock_writer == NULL);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) > 0);
 
 		count_max_readers();
 		kprintf("read (%lu-%d)\n", num, i);
@@ -175,56 +175,56 @@ writertestthread(void *junk, unsigned long num) {
 		unsigned long local3 = testval3;
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == curthread);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) == 0);
+		KASSERT(testrwlock->rwlock_writer == curthread);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) == 0);
 
 		if (local1 != testval1) {
 			goto fail;
 		}
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == curthread);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) == 0);
+		KASSERT(testrwlock->rwlock_writer == curthread);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) == 0);
 
 		if (local1 != num) {
 			goto fail;
 		}
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == curthread);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) == 0);
+		KASSERT(testrwlock->rwlock_writer == curthread);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) == 0);
 
 		if (local2 != testval2) {
 			goto fail;
 		}
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == curthread);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) == 0);
+		KASSERT(testrwlock->rwlock_writer == curthread);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) == 0);
 
 		if (local2 != num * num) {
 			goto fail;
 		}
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == curthread);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) == 0);
+		KASSERT(testrwlock->rwlock_writer == curthread);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) == 0);
 		
 		if (local3 != testval3) {
 			goto fail;
 		}
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == curthread);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) == 0);
+		KASSERT(testrwlock->rwlock_writer == curthread);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) == 0);
 		
 		if (local3 != num % 3) {
 			goto fail;
 		}
 
 		random_yielder(4);
-		KASSERT(testrwlock->rwlock_active_writer == curthread);
-		KASSERT(threadarray_num(testrwlock->rwlock_active_readers) == 0);
+		KASSERT(testrwlock->rwlock_writer == curthread);
+		KASSERT((testrwlock->rwlock_state & RWLOCK_READERMASK) == 0);
 
 		kprintf("!!! wrote (%lu)\n", num);
 		rwlock_release_write(testrwlock);
@@ -114,6 +114,9 @@ male_wrapper(void * unused1, unsigned long index) {
 void
 male_start(uint32_t index) {
 	(void)index;
+	if (synchprobs_bench) {
+		return;
+	}
 	lock_acquire(testlock);
 	check_thread(whale_threads, index);
 	check_role(index, MALE);
@@ -128,6 +131,9 @@ male_start(uint32_t index) {
 void
 male_end(uint32_t index) {
 	(void)index;
+	if (synchprobs_bench) {
+		return;
+	}
 	lock_acquire(testlock);
 	check_thread(whale_threads, index);
 	check_role(index, MALE);
@@ -157,6 +163,9 @@ female_wrapper(void * unused1, unsigned long index) {
 void
 female_start(uint32_t index) {
 	(void) index;
+	if (synchprobs_bench) {
+		return;
+	}
 	lock_acquire(testlock);
 	check_thread(whale_threads, index);
 	check_role(index, FEMALE);
@@ -171,6 +180,9 @@ female_start(uint32_t index) {
 void
 female_end(uint32_t index) {
 	(void) index;
+	if (synchprobs_bench) {
+		return;
+	}
 	lock_acquire(testlock);
 	check_thread(whale_threads, index);
 	check_role(index, FEMALE);
@@ -200,6 +212,9 @@ matchmaker_wrapper(void * unused1, unsigned long index) {
 void
 matchmaker_start(uint32_t index) {
 	(void)index;
+	if (synchprobs_bench) {
+		return;
+	}
 	P(matcher_sem);
 	lock_acquire(testlock);
 	check_thread(whale_threads, index);
@@ -219,6 +234,9 @@ matchmaker_start(uint32_t index) {
 void
 matchmaker_end(uint32_t index) {
 	(void)index;
+	if (synchprobs_bench) {
+		return;
+	}
 	lock_acquire(testlock);
 	check_thread(whale_threads, index);
 	check_role(index, MATCHMAKER);
@@ -527,6 +545,9 @@ turnleft_wrapper(void *index, unsigned long direction)
 
 void
 inQuadrant(int quadrant, uint32_t index) {
+	if (synchprobs_bench) {
+		return;
+	}
 	random_yielder(PROBLEMS_MAX_YIELDER);
 	random_spinner(PROBLEMS_MAX_SPINNER);
 	lock_acquire(testlock);
@@ -565,6 +586,9 @@ inQuadrant(int quadrant, uint32_t index) {
 
 void
 leaveIntersection(uint32_t index) {
+	if (synchprobs_bench) {
+		return;
+	}
 	random_yielder(PROBLEMS_MAX_YIELDER);
 	random_spinner(PROBLEMS_MAX_SPINNER);
 	lock_acquire(testlock);
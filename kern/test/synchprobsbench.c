@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Throughput benchmark mode for the synchprobs.
+ *
+ * sp1 and sp2 validate correctness with a small fixed population and
+ * deliberate random yields and spins in the driver hooks, so they say
+ * nothing about performance. sp1b and sp2b run the same solutions
+ * flat out instead: waves of threads for a fixed number of seconds,
+ * with the checking hooks reduced to nothing. Because the solutions
+ * hammer a handful of locks, semaphores, and CVs from many threads at
+ * once, this makes a repeatable standardized workload for judging
+ * scheduler and lock changes under contention.
+ *
+ * Each thread stamps the cycle counter around its one operation (a
+ * whale finding its mate, a car crossing the intersection), and the
+ * report gives ops/s plus min/median/p99/max latency in cycles, as
+ * in kbench. The usual cycle-counter caveat applies: a sample taken
+ * across a cpu migration is garbage, which the percentiles absorb.
+ *
+ * While a benchmark runs, synchprobs_bench is true and the driver
+ * hooks in synchprobs.c (male_start, inQuadrant, etc.) return
+ * immediately, so the measurement covers the solution's own
+ * synchronization and not the test scaffolding.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <test.h>
+
+/* Latency samples kept; throughput keeps counting past the cap. */
+#define SPBENCH_MAXSAMPLES	4096
+
+/* Defaults, overridable from the menu command line. */
+#define SPBENCH_GROUPS		8	/* whale triples / cars per wave */
+#define SPBENCH_NCARS		32
+#define SPBENCH_SECONDS		5
+
+/* True while a benchmark runs; checked by the hooks in synchprobs.c. */
+bool synchprobs_bench;
+
+static struct semaphore *spbench_donesem;
+static struct spinlock spbench_samplelock;
+static uint32_t *spbench_samples;
+static unsigned spbench_nsamples;
+static unsigned spbench_ops;
+
+static
+void
+spbench_record(uint32_t cycles)
+{
+	spinlock_acquire(&spbench_samplelock);
+	spbench_ops++;
+	if (spbench_nsamples < SPBENCH_MAXSAMPLES) {
+		spbench_samples[spbench_nsamples++] = cycles;
+	}
+	spinlock_release(&spbench_samplelock);
+}
+
+/*
+ * Common setup/teardown and the report. ELAPSED is the measured wall
+ * time; waves always run to completion, so it may overshoot the
+ * requested duration slightly.
+ */
+static
+int
+spbench_setup(void)
+{
+	spbench_samples = kmalloc(SPBENCH_MAXSAMPLES * sizeof(uint32_t));
+	if (spbench_samples == NULL) {
+		return ENOMEM;
+	}
+	spbench_donesem = sem_create("spbench_done", 0);
+	if (spbench_donesem == NULL) {
+		kfree(spbench_samples);
+		spbench_samples = NULL;
+		return ENOMEM;
+	}
+	spinlock_init(&spbench_samplelock);
+	spbench_nsamples = 0;
+	spbench_ops = 0;
+	return 0;
+}
+
+static
+void
+spbench_report(const char *name, const struct timespec *elapsed)
+{
+	uint32_t *s = spbench_samples;
+	unsigned n = spbench_nsamples;
+	uint64_t ms;
+	uint32_t tmp;
+	unsigned i, j;
+
+	ms = (uint64_t)elapsed->tv_sec * 1000 + elapsed->tv_nsec / 1000000;
+	if (ms == 0) {
+		ms = 1;
+	}
+
+	kprintf("%s: %u ops in %llu.%03llus: %llu ops/s\n",
+		name, spbench_ops,
+		(unsigned long long)(ms / 1000),
+		(unsigned long long)(ms % 1000),
+		(unsigned long long)(spbench_ops * (uint64_t)1000 / ms));
+
+	if (n > 0) {
+		/* Insertion sort; not the timed part. */
+		for (i = 1; i < n; i++) {
+			tmp = s[i];
+			for (j = i; j > 0 && s[j-1] > tmp; j--) {
+				s[j] = s[j-1];
+			}
+			s[j] = tmp;
+		}
+		kprintf("%s: latency (cycles): min %6lu  median %6lu  "
+			"p99 %6lu  max %8lu\n",
+			name,
+			(unsigned long)s[0],
+			(unsigned long)s[n/2],
+			(unsigned long)s[(n/100)*99],
+			(unsigned long)s[n-1]);
+	}
+
+	sem_destroy(spbench_donesem);
+	spbench_donesem = NULL;
+	spinlock_cleanup(&spbench_samplelock);
+	kfree(spbench_samples);
+	spbench_samples = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// whalemating (sp1b)
+
+static
+void
+spbench_whale(void *unused, unsigned long role)
+{
+	uint32_t start;
+
+	(void)unused;
+
+	start = cpu_cyclecount();
+	switch (role % 3) {
+	    case 0:
+		male(0);
+		break;
+	    case 1:
+		female(0);
+		break;
+	    default:
+		matchmaker(0);
+		break;
+	}
+	spbench_record(cpu_cyclecount() - start);
+	V(spbench_donesem);
+}
+
+int
+whalemating_bench(int nargs, char **args)
+{
+	struct timespec starttime, now, elapsed;
+	unsigned groups = SPBENCH_GROUPS;
+	unsigned seconds = SPBENCH_SECONDS;
+	unsigned i;
+	int err;
+
+	if (nargs > 1) {
+		groups = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		seconds = atoi(args[2]);
+	}
+	if (groups == 0 || seconds == 0) {
+		kprintf("Usage: sp1b [groups] [seconds]\n");
+		return EINVAL;
+	}
+
+	err = spbench_setup();
+	if (err) {
+		return err;
+	}
+
+	kprintf("sp1b: %u males/females/matchmakers per wave, "
+		"%u seconds...\n", groups, seconds);
+
+	synchprobs_bench = true;
+	whalemating_init();
+
+	gettime(&starttime);
+	do {
+		/*
+		 * Equal numbers of each role, so every whale in the
+		 * wave eventually mates and the wave drains.
+		 */
+		for (i = 0; i < 3 * groups; i++) {
+			err = thread_fork("spbench_whale", NULL,
+					  spbench_whale, NULL, i);
+			if (err) {
+				panic("sp1b: thread_fork failed: (%s)\n",
+				      strerror(err));
+			}
+		}
+		for (i = 0; i < 3 * groups; i++) {
+			P(spbench_donesem);
+		}
+		gettime(&now);
+		timespec_sub(&now, &starttime, &elapsed);
+	} while (elapsed.tv_sec < (time_t)seconds);
+
+	whalemating_cleanup();
+	synchprobs_bench = false;
+
+	spbench_report("sp1b", &elapsed);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// stoplight (sp2b)
+
+static
+void
+spbench_car(void *unused, unsigned long seed)
+{
+	uint32_t direction = seed % 4;
+	uint32_t start;
+
+	(void)unused;
+
+	start = cpu_cyclecount();
+	switch ((seed / 4) % 3) {
+	    case 0:
+		gostraight(direction, 0);
+		break;
+	    case 1:
+		turnleft(direction, 0);
+		break;
+	    default:
+		turnright(direction, 0);
+		break;
+	}
+	spbench_record(cpu_cyclecount() - start);
+	V(spbench_donesem);
+}
+
+int
+stoplight_bench(int nargs, char **args)
+{
+	struct timespec starttime, now, elapsed;
+	unsigned ncars = SPBENCH_NCARS;
+	unsigned seconds = SPBENCH_SECONDS;
+	unsigned i;
+	int err;
+
+	if (nargs > 1) {
+		ncars = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		seconds = atoi(args[2]);
+	}
+	if (ncars == 0 || seconds == 0) {
+		kprintf("Usage: sp2b [cars] [seconds]\n");
+		return EINVAL;
+	}
+
+	err = spbench_setup();
+	if (err) {
+		return err;
+	}
+
+	kprintf("sp2b: %u cars per wave, %u seconds...\n", ncars, seconds);
+
+	synchprobs_bench = true;
+	stoplight_init();
+
+	gettime(&starttime);
+	do {
+		for (i = 0; i < ncars; i++) {
+			err = thread_fork("spbench_car", NULL,
+					  spbench_car, NULL, random());
+			if (err) {
+				panic("sp2b: thread_fork failed: (%s)\n",
+				      strerror(err));
+			}
+		}
+		for (i = 0; i < ncars; i++) {
+			P(spbench_donesem);
+		}
+		gettime(&now);
+		timespec_sub(&now, &starttime, &elapsed);
+	} while (elapsed.tv_sec < (time_t)seconds);
+
+	stoplight_cleanup();
+	synchprobs_bench = false;
+
+	spbench_report("sp2b", &elapsed);
+	return 0;
+}
@@ -40,6 +40,7 @@
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
+#include <kern/errno.h>
 #include <kern/test161.h>
 #include <spinlock.h>
 
@@ -889,3 +890,70 @@ cvtest5(int nargs, char **args) {
 
 	return 0;
 }
+
+static
+void
+timedwakerthread(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	random_yielder(4);
+	lock_acquire(testlock);
+	cv_signal(testcv, testlock);
+	lock_release(testlock);
+	V(exitsem);
+}
+
+int
+cvtest6(int nargs, char **args) {
+	(void)nargs;
+	(void)args;
+
+	int result;
+
+	kprintf_n("Starting cvt6...\n");
+
+	testlock = lock_create("testlock");
+	if (testlock == NULL) {
+		panic("cvt6: lock_create failed\n");
+	}
+	testcv = cv_create("testcv");
+	if (testcv == NULL) {
+		panic("cvt6: cv_create failed\n");
+	}
+	exitsem = sem_create("exitsem", 0);
+	if (exitsem == NULL) {
+		panic("cvt6: sem_create failed\n");
+	}
+	spinlock_init(&status_lock);
+	test_status = TEST161_SUCCESS;
+
+	/* Nobody signals: the wait must time out. */
+	lock_acquire(testlock);
+	result = cv_timedwait(testcv, testlock, 5);
+	failif((result != ETIMEDOUT));
+
+	/* Somebody signals: the wait must not time out. */
+	result = thread_fork("cvt6", NULL, timedwakerthread, NULL, 0);
+	if (result) {
+		panic("cvt6: thread_fork failed\n");
+	}
+	result = cv_timedwait(testcv, testlock, 10 * HZ);
+	failif((result != 0));
+	lock_release(testlock);
+
+	P(exitsem);
+
+	sem_destroy(exitsem);
+	cv_destroy(testcv);
+	lock_destroy(testlock);
+
+	success(test_status, SECRET, "cvt6");
+
+	exitsem = NULL;
+	testcv = NULL;
+	testlock = NULL;
+
+	return 0;
+}
@@ -30,17 +30,18 @@
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
+#include <mainbus.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <vm.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Callbacks can be scheduled for points in the future, with hardclock
+ * (1/HZ second) resolution, via the timer wheel below.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -52,13 +53,33 @@
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define VM_SCRUB_HARDCLOCKS	64	/* Scrub the TLB every 64 hardclocks. */
 
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * Precise sleepers (clocksleep) also park here and are told apart by
+ * per-sleeper flags.
  */
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
 
+/*
+ * The timer wheel. Armed timers hash into a bucket by their absolute
+ * expiry tick; each tick we advance one bucket and fire the timers in
+ * it whose time has come (ones hashed there for a later rotation stay
+ * put). The wheel is global and driven from hardclock() on the boot
+ * CPU only, so ticks advance at HZ regardless of how many CPUs exist.
+ */
+#define TIMER_WHEEL_SIZE	64	/* Buckets; must be a power of 2. */
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SIZE - 1)
+
+static struct timer *timer_wheel[TIMER_WHEEL_SIZE];
+static uint64_t timer_ticks;
+static struct spinlock timer_lock;
+
+/* The cpu that drives the wheel, for waking it when deadlines move. */
+static struct cpu *timer_bootcpu;
+
 /*
  * Setup.
  */
@@ -70,8 +91,249 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	spinlock_init(&timer_lock);
+	/* The wheel buckets are in BSS and thus already empty. */
+
+	/* We're booting, so this is the cpu that will drive the wheel. */
+	KASSERT(curcpu->c_number == 0);
+	timer_bootcpu = curcpu->c_self;
+}
+
+////////////////////////////////////////////////////////////
+// timer wheel
+
+/*
+ * Prepare a timer for use. The timer is not armed.
+ */
+void
+timer_init(struct timer *tm, void (*func)(struct timer *, void *), void *data)
+{
+	tm->tm_next = NULL;
+	tm->tm_prev = NULL;
+	tm->tm_expiry = 0;
+	tm->tm_func = func;
+	tm->tm_data = data;
+	tm->tm_armed = false;
+}
+
+/*
+ * Unlink a timer from its wheel bucket. The timer lock must be held
+ * and the timer must be armed.
+ */
+static
+void
+timer_unlink(struct timer *tm)
+{
+	KASSERT(spinlock_do_i_hold(&timer_lock));
+	KASSERT(tm->tm_armed);
+
+	if (tm->tm_prev != NULL) {
+		tm->tm_prev->tm_next = tm->tm_next;
+	}
+	else {
+		timer_wheel[tm->tm_expiry & TIMER_WHEEL_MASK] = tm->tm_next;
+	}
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_prev = tm->tm_prev;
+	}
+	tm->tm_next = NULL;
+	tm->tm_prev = NULL;
+	tm->tm_armed = false;
+}
+
+/*
+ * Schedule TM to fire TICKS hardclocks from now. A timer can only be
+ * armed once at a time; rearming from its own callback is fine.
+ */
+void
+timer_arm(struct timer *tm, uint32_t ticks)
+{
+	unsigned bucket;
+
+	if (ticks == 0) {
+		/* This rotation already passed our bucket; round up. */
+		ticks = 1;
+	}
+
+	spinlock_acquire(&timer_lock);
+	KASSERT(!tm->tm_armed);
+	tm->tm_expiry = timer_ticks + ticks;
+	bucket = tm->tm_expiry & TIMER_WHEEL_MASK;
+	tm->tm_prev = NULL;
+	tm->tm_next = timer_wheel[bucket];
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_prev = tm;
+	}
+	timer_wheel[bucket] = tm;
+	tm->tm_armed = true;
+	spinlock_release(&timer_lock);
+
+	/*
+	 * If the boot cpu has gone tickless, it chose its wakeup from
+	 * the deadlines armed at the time; this one may be earlier,
+	 * so poke it to re-evaluate. The unlocked c_isidle read can
+	 * only misfire by a spurious or missing poke; a missed one is
+	 * bounded by the cap in timer_idleticks.
+	 */
+	if (CURCPU_EXISTS() && curcpu->c_self != timer_bootcpu &&
+	    timer_bootcpu != NULL && timer_bootcpu->c_isidle) {
+		ipi_send(timer_bootcpu, IPI_UNIDLE);
+	}
+}
+
+/*
+ * Unschedule TM. Returns true if it was armed, in which case the
+ * callback is now guaranteed not to run; returns false if it already
+ * fired (or was never armed). Does not wait out a callback that is
+ * already running.
+ */
+bool
+timer_cancel(struct timer *tm)
+{
+	bool wasarmed;
+
+	spinlock_acquire(&timer_lock);
+	wasarmed = tm->tm_armed;
+	if (wasarmed) {
+		timer_unlink(tm);
+	}
+	spinlock_release(&timer_lock);
+	return wasarmed;
+}
+
+/*
+ * Return the number of wheel ticks since boot. (64-bit reads aren't
+ * atomic on all platforms, hence the lock.)
+ */
+uint64_t
+timer_now(void)
+{
+	uint64_t now;
+
+	spinlock_acquire(&timer_lock);
+	now = timer_ticks;
+	spinlock_release(&timer_lock);
+	return now;
+}
+
+/*
+ * Monotonic high-resolution time; see clock.h. The machine-dependent
+ * code keeps the cycle clock running (on System/161 the timer
+ * interrupt path banks the cycles of each timer interval as it
+ * reprograms the counter), so these are thin wrappers.
+ */
+uint64_t
+cycles(void)
+{
+	return mainbus_cycles();
+}
+
+void
+nanotime(struct timespec *ret)
+{
+	uint64_t ns;
+
+	ns = mainbus_cycles_to_ns(mainbus_cycles());
+	ret->tv_sec = ns / 1000000000;
+	ret->tv_nsec = ns % 1000000000;
+}
+
+/*
+ * Advance the wheel one tick and fire whatever is due. Called at
+ * interrupt level from hardclock() on the boot CPU.
+ *
+ * Due timers are first moved to a private list so the callbacks can
+ * run without the timer lock held; that way a callback may rearm its
+ * own timer, arm others, or take other spinlocks. The next pointer is
+ * fetched before each callback because the callback owns the timer
+ * once it runs.
+ */
+static
+void
+timerwheel_tick(void)
+{
+	struct timer *tm, *next, *expired;
+
+	expired = NULL;
+	spinlock_acquire(&timer_lock);
+	timer_ticks++;
+	tm = timer_wheel[timer_ticks & TIMER_WHEEL_MASK];
+	while (tm != NULL) {
+		next = tm->tm_next;
+		if (tm->tm_expiry <= timer_ticks) {
+			timer_unlink(tm);
+			tm->tm_next = expired;
+			expired = tm;
+		}
+		tm = next;
+	}
+	spinlock_release(&timer_lock);
+
+	while (expired != NULL) {
+		tm = expired;
+		expired = tm->tm_next;
+		tm->tm_next = NULL;
+		tm->tm_func(tm, tm->tm_data);
+	}
 }
 
+/*
+ * How many whole hardclocks this cpu may sleep through while idle.
+ * Only the boot cpu has wheel deadlines to meet; everyone else can
+ * skip the maximum, since anything that makes work for an idle cpu
+ * (a wakeup, a shootdown) arrives with an interrupt of its own.
+ * Capped at one second so lost pokes and clock drift stay bounded.
+ */
+uint32_t
+timer_idleticks(void)
+{
+	struct timer *tm;
+	uint64_t now, best;
+	unsigned i;
+
+	if (curcpu->c_self != timer_bootcpu) {
+		return HZ;
+	}
+
+	spinlock_acquire(&timer_lock);
+	now = timer_ticks;
+	best = now + HZ;
+	for (i=0; i<TIMER_WHEEL_SIZE; i++) {
+		for (tm = timer_wheel[i]; tm != NULL; tm = tm->tm_next) {
+			if (tm->tm_expiry < best) {
+				best = tm->tm_expiry;
+			}
+		}
+	}
+	spinlock_release(&timer_lock);
+
+	if (best <= now + 1) {
+		return 1;
+	}
+	return (uint32_t)(best - now);
+}
+
+/*
+ * Credit NTICKS hardclocks that were skipped while idle: advance this
+ * cpu's tick count and, on the boot cpu, run the wheel forward so the
+ * timers those ticks covered fire (at worst a moment late, never
+ * early or not at all). The scheduler work of the skipped ticks is
+ * deliberately not replayed; the cpu was idle.
+ */
+void
+hardclock_catchup(uint32_t nticks)
+{
+	curcpu->c_hardclocks += nticks;
+	if (curcpu->c_self == timer_bootcpu) {
+		while (nticks-- > 0) {
+			timerwheel_tick();
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// clock interrupts and sleeping
+
 /*
  * This is called once per second, on one processor, by the timer
  * code.
@@ -97,25 +359,84 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	if (curcpu->c_number == 0) {
+		/* The boot CPU drives the timer wheel for everyone. */
+		timerwheel_tick();
+		/* ...and refreshes the shared clock page. */
+		userclock_tick();
+	}
+
+	/*
+	 * If this tick interrupted a softirq handler (they run with
+	 * interrupts on), don't preempt: switching threads out from
+	 * under softirq_dispatch would strand its c_insoftirq flag
+	 * if the thread later resumed on another cpu. Time still
+	 * advances above; one tick of scheduling work is skipped.
+	 */
+	if (curcpu->c_insoftirq) {
+		return;
+	}
+
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
+	if ((curcpu->c_hardclocks % VM_SCRUB_HARDCLOCKS) == 0) {
+		/* Let the VM refresh its page-referenced information. */
+		vm_tlb_scrub();
+	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
+	/*
+	 * Charge this tick to the running thread; if that used up its
+	 * timeslice, the requeue in thread_yield demotes it a level.
+	 */
+	sched_tick();
 	thread_yield();
 }
 
 /*
- * Suspend execution for n seconds.
+ * Timer callback for clocksleep: flag the sleeper done and wake up
+ * lbolt. The wakeup is a broadcast because the sleepers share lbolt;
+ * the ones whose flags aren't set yet just go back to sleep.
+ */
+static
+void
+clocksleep_expire(struct timer *tm, void *data)
+{
+	volatile bool *done = data;
+
+	(void)tm;
+
+	spinlock_acquire(&lbolt_lock);
+	*done = true;
+	wchan_wakeall(lbolt, &lbolt_lock);
+	spinlock_release(&lbolt_lock);
+}
+
+/*
+ * Suspend execution for n seconds. The timer wheel gives this tick
+ * granularity: we sleep for exactly n*HZ hardclocks instead of
+ * counting up to n once-a-second lbolt broadcasts, the first of which
+ * could come almost immediately.
  */
 void
 clocksleep(int num_secs)
 {
+	struct timer tm;
+	volatile bool done;
+
+	if (num_secs <= 0) {
+		return;
+	}
+
+	done = false;
+	timer_init(&tm, clocksleep_expire, (void *)&done);
+	timer_arm(&tm, (uint32_t)num_secs * HZ);
+
 	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
+	while (!done) {
 		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
 	}
 	spinlock_release(&lbolt_lock);
 }
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention profiler. See lockstat.h for the design notes.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <current.h>
+#include <lockstat.h>
+
+/*
+ * The table. Static so locks created before the VM is up (the boot
+ * cpu's runqueue lock, for one) can register too. Protected by
+ * lockstat_lock for registration only; the counters themselves are
+ * updated lock-free as described in lockstat.h.
+ */
+static struct lockstat lockstats[LOCKSTAT_MAXLOCKS];
+static struct spinlock lockstat_lock = SPINLOCK_INITIALIZER;
+
+struct lockstat *
+lockstat_register(const char *name)
+{
+	struct lockstat *ls;
+	unsigned i;
+
+	spinlock_acquire(&lockstat_lock);
+	for (i=0; i<LOCKSTAT_MAXLOCKS; i++) {
+		if (!lockstats[i].ls_inuse) {
+			break;
+		}
+	}
+	if (i == LOCKSTAT_MAXLOCKS) {
+		spinlock_release(&lockstat_lock);
+		return NULL;
+	}
+	ls = &lockstats[i];
+	ls->ls_inuse = true;
+	spinlock_release(&lockstat_lock);
+
+	strncpy(ls->ls_name, name, sizeof(ls->ls_name) - 1);
+	ls->ls_name[sizeof(ls->ls_name) - 1] = 0;
+	return ls;
+}
+
+////////////////////////////////////////////////////////////
+// Update hooks.
+
+void
+lockstat_spin_acquired(struct lockstat *ls, uint32_t startcycles,
+		       bool contended)
+{
+	uint32_t now;
+
+	/*
+	 * Interrupts have been off since before STARTCYCLES was
+	 * read, so the cycle counter has not been reloaded by the
+	 * timer interrupt and the delta is meaningful.
+	 */
+	now = cpu_cyclecount();
+	ls->ls_acquires++;
+	if (contended) {
+		ls->ls_contended++;
+		ls->ls_spincycles += now - startcycles;
+	}
+	ls->ls_cyclestamp = now;
+}
+
+void
+lockstat_spin_releasing(struct lockstat *ls)
+{
+	ls->ls_holdcycles += cpu_cyclecount() - ls->ls_cyclestamp;
+}
+
+void
+lockstat_sleep_acquired(struct lockstat *ls, unsigned startticks,
+			bool contended)
+{
+	unsigned now, delta;
+
+	/*
+	 * We may have gone to sleep on one cpu and been woken on
+	 * another whose tick count lags the first; clamp apparently
+	 * negative waits to zero rather than crediting a wrapped
+	 * delta.
+	 */
+	now = curcpu->c_hardclocks;
+	ls->ls_acquires++;
+	if (contended) {
+		delta = now - startticks;
+		ls->ls_contended++;
+		if (delta <= 0x7fffffff) {
+			ls->ls_waitticks += delta;
+		}
+	}
+	ls->ls_tickstamp = now;
+}
+
+void
+lockstat_sleep_releasing(struct lockstat *ls)
+{
+	unsigned delta;
+
+	delta = curcpu->c_hardclocks - ls->ls_tickstamp;
+	if (delta <= 0x7fffffff) {
+		ls->ls_holdticks += delta;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Reporting.
+
+/*
+ * Ordering for the dump: worst total wait first. Sleep-lock waits
+ * are in ticks and spin waits in cycles, so they aren't directly
+ * addable; but a single tick of sleeping dwarfs any plausible amount
+ * of spinning, so compare wait ticks first and break ties (notably
+ * between pure spinlocks, which have none) on spin cycles.
+ */
+static
+bool
+lockstat_waitedmore(const struct lockstat *a, const struct lockstat *b)
+{
+	if (a->ls_waitticks != b->ls_waitticks) {
+		return a->ls_waitticks > b->ls_waitticks;
+	}
+	return a->ls_spincycles > b->ls_spincycles;
+}
+
+void
+lockstat_dump(void)
+{
+	unsigned order[LOCKSTAT_MAXLOCKS];
+	unsigned num, i, j, best, tmp;
+	const struct lockstat *ls;
+
+	/* Collect the live slots and selection-sort them by wait. */
+	num = 0;
+	for (i=0; i<LOCKSTAT_MAXLOCKS; i++) {
+		if (lockstats[i].ls_inuse) {
+			order[num++] = i;
+		}
+	}
+	for (i=0; i<num; i++) {
+		best = i;
+		for (j=i+1; j<num; j++) {
+			if (lockstat_waitedmore(&lockstats[order[j]],
+						&lockstats[order[best]])) {
+				best = j;
+			}
+		}
+		tmp = order[i];
+		order[i] = order[best];
+		order[best] = tmp;
+	}
+
+	kprintf("%-16s %10s %9s %11s %11s %9s %9s\n",
+		"lock", "acquires", "contended",
+		"spincycles", "holdcycles", "waitticks", "holdticks");
+	for (i=0; i<num; i++) {
+		ls = &lockstats[order[i]];
+		kprintf("%-16s %10llu %9llu %11llu %11llu %9llu %9llu\n",
+			ls->ls_name,
+			(unsigned long long)ls->ls_acquires,
+			(unsigned long long)ls->ls_contended,
+			(unsigned long long)ls->ls_spincycles,
+			(unsigned long long)ls->ls_holdcycles,
+			(unsigned long long)ls->ls_waitticks,
+			(unsigned long long)ls->ls_holdticks);
+	}
+	if (num == 0) {
+		kprintf("No locks are registered with lockstat.\n");
+	}
+}
+
+/*
+ * Zero the accumulators for a fresh baseline. The hold stamps are
+ * left alone so a lock held across the reset still records a sane
+ * hold time at its next release.
+ */
+void
+lockstat_reset(void)
+{
+	struct lockstat *ls;
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_MAXLOCKS; i++) {
+		ls = &lockstats[i];
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_spincycles = 0;
+		ls->ls_holdcycles = 0;
+		ls->ls_waitticks = 0;
+		ls->ls_holdticks = 0;
+	}
+}
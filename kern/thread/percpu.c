@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-cpu data allocator. See percpu.h for the interface notes.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <percpu.h>
+
+/*
+ * The bump pointer: offsets below percpu_nextoff are handed out.
+ * Offsets are global, not per-area, so a chunk allocated before a
+ * secondary cpu comes up is valid in that cpu's area too; all areas
+ * are the same size and start out zeroed.
+ */
+static size_t percpu_nextoff;
+static struct spinlock percpu_lock = SPINLOCK_INITIALIZER;
+
+size_t
+percpu_alloc(size_t size)
+{
+	size_t offset;
+
+	KASSERT(size > 0);
+	size = ROUNDUP(size, PERCPU_CACHELINE);
+
+	spinlock_acquire(&percpu_lock);
+	offset = percpu_nextoff;
+	if (size > PERCPU_AREASIZE - offset) {
+		panic("percpu_alloc: out of per-cpu space "
+		      "(%zu bytes wanted, %zu left)\n",
+		      size, PERCPU_AREASIZE - offset);
+	}
+	percpu_nextoff = offset + size;
+	spinlock_release(&percpu_lock);
+
+	return offset;
+}
+
+void *
+percpu_get(size_t offset)
+{
+	return percpu_getcpu(offset, curcpu->c_self);
+}
+
+void *
+percpu_getcpu(size_t offset, struct cpu *c)
+{
+	KASSERT(offset < PERCPU_AREASIZE);
+	KASSERT(c->c_percpu != NULL);
+
+	return (char *)c->c_percpu + offset;
+}
+
+/*
+ * Set up C's area: one cacheline-aligned, zeroed block. kmalloc
+ * guarantees less than cacheline alignment, so overallocate and
+ * round the base up; cpus are never destroyed, so the raw pointer
+ * need not be kept.
+ */
+void
+percpu_area_init(struct cpu *c)
+{
+	void *block;
+
+	block = kmalloc(PERCPU_AREASIZE + PERCPU_CACHELINE - 1);
+	if (block == NULL) {
+		panic("percpu_area_init: Out of memory\n");
+	}
+	c->c_percpu = (void *)ROUNDUP((uintptr_t)block, PERCPU_CACHELINE);
+	bzero(c->c_percpu, PERCPU_AREASIZE);
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Softirq (bottom-half) dispatch. See softirq.h for the interface
+ * notes.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <atomic.h>
+#include <softirq.h>
+
+/*
+ * The handler table. Slots are assigned once at attach time and
+ * never reused, so softirq_raise and softirq_dispatch can read the
+ * table without the lock. si_cpu is the steering target, or NULL to
+ * run on whichever cpu the hardware interrupt lands on; a stale read
+ * of it only sends one dispatch to the old cpu.
+ */
+struct softirq {
+	const char *si_name;
+	void (*si_func)(void *);
+	void *si_arg;
+	struct cpu *si_cpu;
+};
+
+static struct softirq softirqs[SOFTIRQ_MAX];
+static unsigned numsoftirqs;
+static struct spinlock softirq_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Set BIT in C's pending word. Once softirqs can be steered, remote
+ * cpus set bits in our word, so every update must be atomic - having
+ * interrupts off no longer suffices.
+ */
+static
+void
+softirq_mark(struct cpu *c, uint32_t bit)
+{
+	uint32_t old;
+
+	do {
+		old = atomic_load_acquire(&c->c_softirq_pending);
+	} while (atomic_cas(&c->c_softirq_pending, old, old | bit) != old);
+}
+
+unsigned
+softirq_establish(const char *name, void (*func)(void *), void *arg)
+{
+	unsigned num;
+
+	KASSERT(func != NULL);
+
+	spinlock_acquire(&softirq_lock);
+	KASSERT(numsoftirqs < SOFTIRQ_MAX);
+	num = numsoftirqs++;
+	softirqs[num].si_name = name;
+	softirqs[num].si_func = func;
+	softirqs[num].si_arg = arg;
+	softirqs[num].si_cpu = NULL;
+	spinlock_release(&softirq_lock);
+
+	return num;
+}
+
+void
+softirq_raise(unsigned num)
+{
+	struct cpu *target;
+
+	KASSERT(num < numsoftirqs);
+	KASSERT(curthread->t_curspl > 0);
+
+	target = softirqs[num].si_cpu;
+	if (target != NULL && CURCPU_EXISTS() &&
+	    target != curcpu->c_self) {
+		/*
+		 * Steered elsewhere: mark it pending over there and
+		 * IPI; the target's mainbus_interrupt runs
+		 * softirq_dispatch on its way out.
+		 */
+		softirq_mark(target, (uint32_t)1 << num);
+		ipi_send(target, IPI_SOFTIRQ);
+		return;
+	}
+
+	softirq_mark(curcpu->c_self, (uint32_t)1 << num);
+}
+
+/*
+ * Run this cpu's pending softirqs, reenabling interrupts around each
+ * handler (unless the interrupted context itself held them off, in
+ * which case the spl bookkeeping keeps them off). A nested interrupt
+ * taken from inside a handler just sets pending bits and returns;
+ * the loop here picks them up. hardclock() declines to preempt while
+ * c_insoftirq is set, so the dispatching thread cannot be switched
+ * out (and possibly migrated) from under the flag.
+ */
+void
+softirq_dispatch(void)
+{
+	struct cpu *c;
+	uint32_t pending;
+	unsigned num;
+
+	if (!CURCPU_EXISTS()) {
+		return;
+	}
+	c = curcpu->c_self;
+	if (c->c_insoftirq) {
+		/* Nested interrupt; the outer dispatch will finish up. */
+		return;
+	}
+	c->c_insoftirq = true;
+
+	while ((pending = atomic_load_acquire(&c->c_softirq_pending)) != 0) {
+		uint32_t bit;
+
+		num = 0;
+		while ((pending & ((uint32_t)1 << num)) == 0) {
+			num++;
+		}
+		/* Remote steerers may be setting other bits; CAS ours off. */
+		bit = (uint32_t)1 << num;
+		while (atomic_cas(&c->c_softirq_pending, pending,
+				  pending & ~bit) != pending) {
+			pending = atomic_load_acquire(&c->c_softirq_pending);
+		}
+
+		spllower(IPL_HIGH, IPL_NONE);
+		softirqs[num].si_func(softirqs[num].si_arg);
+		splraise(IPL_NONE, IPL_HIGH);
+	}
+
+	c->c_insoftirq = false;
+}
+
+/*
+ * Steer softirq NUM to the cpu numbered CPUNUM; see softirq.h. Bits
+ * already pending on another cpu when the steering changes just run
+ * there one last time.
+ */
+int
+softirq_setaffinity(unsigned num, unsigned cpunum)
+{
+	struct cpu *c;
+
+	if (num >= numsoftirqs) {
+		return EINVAL;
+	}
+	if (cpunum == SOFTIRQ_AFFINITY_ANY) {
+		c = NULL;
+	}
+	else {
+		c = cpu_getbynumber(cpunum);
+		if (c == NULL) {
+			return EINVAL;
+		}
+	}
+
+	spinlock_acquire(&softirq_lock);
+	softirqs[num].si_cpu = c;
+	spinlock_release(&softirq_lock);
+	return 0;
+}
+
+/*
+ * Print the slot table for the menu.
+ */
+void
+softirq_printsteering(void)
+{
+	unsigned i;
+
+	kprintf("Num  Name      Cpu\n");
+	for (i=0; i<numsoftirqs; i++) {
+		kprintf("%-4u %-9s ", i, softirqs[i].si_name);
+		if (softirqs[i].si_cpu == NULL) {
+			kprintf("any\n");
+		}
+		else {
+			kprintf("%u\n", softirqs[i].si_cpu->c_number);
+		}
+	}
+}
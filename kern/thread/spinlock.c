@@ -30,6 +30,7 @@
 /* Make sure to build out-of-line versions of inline functions */
 #define SPINLOCK_INLINE   /* empty */
 #define MEMBAR_INLINE     /* empty */
+#define ATOMIC_INLINE     /* empty */
 
 #include <types.h>
 #include <lib.h>
@@ -37,12 +38,39 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <membar.h>
+#include <atomic.h>
 #include <current.h>	/* for curcpu */
+#include <lockstat.h>
 
 /*
  * Spinlocks.
  */
 
+/*
+ * Bounds for the exponential backoff on contended locks: how many
+ * delay-loop iterations to wait after the first failed attempt, and
+ * the cap on the doubling. The numbers aren't critical; the point is
+ * that cpus losing the race back off the shared cacheline instead of
+ * hammering it with atomic operations.
+ */
+#define SPINLOCK_BACKOFF_MIN	4
+#define SPINLOCK_BACKOFF_MAX	1024
+
+/*
+ * Waste roughly N iterations' worth of time off the bus. The loop
+ * counter is volatile so the compiler can't optimize the loop away.
+ */
+static
+void
+spinlock_backoff(unsigned n)
+{
+	volatile unsigned i;
+
+	for (i=0; i<n; i++) {
+		/* nothing */
+	}
+}
+
 
 /*
  * Initialize spinlock.
@@ -52,6 +80,7 @@ spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
 	splk->splk_holder = NULL;
+	splk->splk_stat = NULL;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
 }
 
@@ -93,6 +122,19 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
+	unsigned backoff = SPINLOCK_BACKOFF_MIN;
+	uint32_t startcycles = 0;
+	bool contended = false;
+
+	/*
+	 * If this lock is being profiled, timestamp the attempt.
+	 * Interrupts are already off, so the cycle counter will not
+	 * be reloaded under us (see lockstat.h).
+	 */
+	if (splk->splk_stat != NULL) {
+		startcycles = cpu_cyclecount();
+	}
+
 	while (1) {
 		/*
 		 * Do test-test-and-set, that is, read first before
@@ -103,19 +145,30 @@ spinlock_acquire(struct spinlock *splk)
 		 * previous value. If that value was 0, the lock was
 		 * previously unheld and we now own it. If it was 1,
 		 * we don't.
+		 *
+		 * After each failed attempt, back off for a bounded,
+		 * exponentially growing interval, so losing cpus
+		 * stop ping-ponging the lock's cacheline.
 		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
+		if (spinlock_data_get(&splk->splk_lock) == 0 &&
+		    spinlock_data_testandset(&splk->splk_lock) == 0) {
+			break;
 		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
+		contended = true;
+		spinlock_backoff(backoff);
+		if (backoff < SPINLOCK_BACKOFF_MAX) {
+			backoff <<= 1;
 		}
-		break;
 	}
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
 
+	if (splk->splk_stat != NULL) {
+		lockstat_spin_acquired(splk->splk_stat, startcycles,
+				       contended);
+	}
+
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
@@ -135,6 +188,10 @@ spinlock_release(struct spinlock *splk)
 		HANGMAN_RELEASE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
 
+	if (splk->splk_stat != NULL) {
+		lockstat_spin_releasing(splk->splk_stat);
+	}
+
 	splk->splk_holder = NULL;
 	membar_any_store();
 	spinlock_data_set(&splk->splk_lock, 0);
@@ -154,3 +211,176 @@ spinlock_do_i_hold(struct spinlock *splk)
 	/* Assume we can read splk_holder atomically enough for this to work */
 	return (splk->splk_holder == curcpu->c_self);
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Queued spinlocks.
+ *
+ * Contending cpus line up in an MCS-style list: each appends its own
+ * waiter node to the lock's tail pointer and then spins on a flag in
+ * that node, which no other waiter touches, so waiting generates no
+ * traffic on the shared lock word. When a waiter reaches the head of
+ * the queue it takes the lock word itself, unlinks its node, and
+ * later hands the head role to its successor.
+ *
+ * One static node per cpu suffices: interrupts are off for the whole
+ * of qspinlock_acquire, so a cpu is waiting on at most one queued
+ * lock at any moment, and the node is given up before acquire
+ * returns (unlike classic MCS, where it stays in use until release).
+ */
+
+#define QSL_MAXCPUS 32
+
+struct qsl_waiter {
+	volatile spinlock_data_t qw_next;   /* address of successor node */
+	volatile spinlock_data_t qw_locked; /* 1 while we must wait */
+};
+
+static struct qsl_waiter qsl_waiters[QSL_MAXCPUS];
+
+void
+qspinlock_init(struct qspinlock *qsl)
+{
+	spinlock_data_set(&qsl->qsl_lock, 0);
+	spinlock_data_set(&qsl->qsl_tail, 0);
+	qsl->qsl_holder = NULL;
+	HANGMAN_LOCKABLEINIT(&qsl->qsl_hangman, "qspinlock");
+}
+
+void
+qspinlock_cleanup(struct qspinlock *qsl)
+{
+	KASSERT(qsl->qsl_holder == NULL);
+	KASSERT(spinlock_data_get(&qsl->qsl_lock) == 0);
+	KASSERT(spinlock_data_get(&qsl->qsl_tail) == 0);
+}
+
+/*
+ * Join the waiter queue and spin until we hold the lock word. Only
+ * called once the fast path has failed.
+ */
+static
+void
+qspinlock_wait(struct qspinlock *qsl, struct cpu *mycpu)
+{
+	struct qsl_waiter *me;
+	spinlock_data_t meaddr, prevaddr, nextaddr;
+
+	if (mycpu == NULL) {
+		/*
+		 * Before curcpu initialization there's only one cpu;
+		 * contention can't happen, but be safe and just spin.
+		 */
+		while (spinlock_data_testandset(&qsl->qsl_lock) != 0) {
+			/* nothing */
+		}
+		return;
+	}
+
+	KASSERT(mycpu->c_number < QSL_MAXCPUS);
+	me = &qsl_waiters[mycpu->c_number];
+	me->qw_next = 0;
+	me->qw_locked = 1;
+	meaddr = (spinlock_data_t)(uintptr_t)me;
+
+	/* Publish the node before linking it into the queue. */
+	membar_store_store();
+	prevaddr = spinlock_data_xchg(&qsl->qsl_tail, meaddr);
+	if (prevaddr != 0) {
+		struct qsl_waiter *prev;
+
+		prev = (struct qsl_waiter *)(uintptr_t)prevaddr;
+		prev->qw_next = meaddr;
+		/* Spin on our own node, not on the shared lock word. */
+		while (me->qw_locked != 0) {
+			/* nothing */
+		}
+	}
+
+	/* We are the queue head; only we contend for the lock word. */
+	while (spinlock_data_testandset(&qsl->qsl_lock) != 0) {
+		while (spinlock_data_get(&qsl->qsl_lock) != 0) {
+			/* nothing */
+		}
+	}
+
+	/*
+	 * Unlink our node before returning so it can be reused. If
+	 * we're still the tail, swing the tail back to empty; a
+	 * failed swap means a successor is linking in, so wait for
+	 * the link and pass it the head role.
+	 */
+	if (spinlock_data_cas(&qsl->qsl_tail, meaddr, 0) != meaddr) {
+		while ((nextaddr = spinlock_data_get(&me->qw_next)) == 0) {
+			/* nothing */
+		}
+		((struct qsl_waiter *)(uintptr_t)nextaddr)->qw_locked = 0;
+	}
+}
+
+void
+qspinlock_acquire(struct qspinlock *qsl)
+{
+	struct cpu *mycpu;
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		if (qsl->qsl_holder == mycpu) {
+			panic("Deadlock on qspinlock %p\n", qsl);
+		}
+		mycpu->c_spinlocks++;
+
+		HANGMAN_WAIT(&curcpu->c_hangman, &qsl->qsl_hangman);
+	}
+	else {
+		mycpu = NULL;
+	}
+
+	/*
+	 * Fast path: empty queue and a successful test-and-set, the
+	 * same cost as a basic spinlock. Otherwise queue up.
+	 */
+	if (spinlock_data_get(&qsl->qsl_tail) != 0 ||
+	    spinlock_data_testandset(&qsl->qsl_lock) != 0) {
+		qspinlock_wait(qsl, mycpu);
+	}
+
+	membar_store_any();
+	qsl->qsl_holder = mycpu;
+
+	if (CURCPU_EXISTS()) {
+		HANGMAN_ACQUIRE(&curcpu->c_hangman, &qsl->qsl_hangman);
+	}
+}
+
+void
+qspinlock_release(struct qspinlock *qsl)
+{
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		KASSERT(qsl->qsl_holder == curcpu->c_self);
+		KASSERT(curcpu->c_spinlocks > 0);
+		curcpu->c_spinlocks--;
+		HANGMAN_RELEASE(&curcpu->c_hangman, &qsl->qsl_hangman);
+	}
+
+	qsl->qsl_holder = NULL;
+	membar_any_store();
+	spinlock_data_set(&qsl->qsl_lock, 0);
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+bool
+qspinlock_do_i_hold(struct qspinlock *qsl)
+{
+	if (!CURCPU_EXISTS()) {
+		return true;
+	}
+
+	/* Assume we can read qsl_holder atomically enough for this to work */
+	return (qsl->qsl_holder == curcpu->c_self);
+}
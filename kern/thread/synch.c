@@ -34,11 +34,35 @@
 
 #include <types.h>
 #include <lib.h>
+#include <atomic.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
+#include <cpu.h>
 #include <current.h>
 #include <synch.h>
+#include <lockstat.h>
+
+/*
+ * How long lock_acquire spins on a held lock before blocking, when
+ * the holder is running on another cpu. Most of our critical
+ * sections are a few hundred cycles, so this should comfortably
+ * cover the common case without burning real time on the rest.
+ */
+#define LOCK_SPIN_MAX	1024
+
+/*
+ * "No donation" value for lk_donatedprio/t_donatedprio: worse than
+ * every real priority level, so min() comparisons ignore it.
+ */
+#define LOCK_NODONATION	SCHED_NUMPRIOS_MAX
+
+/*
+ * How far to follow a chain of donations (thread blocked on a lock
+ * whose holder is blocked on another lock, and so on) before giving
+ * up. Chains deeper than a few locks don't occur in practice.
+ */
+#define LOCK_DONATE_MAXDEPTH	8
 
 ////////////////////////////////////////////////////////////
 //
@@ -69,6 +93,7 @@ sem_create(const char *name, unsigned initial_count)
 
 	spinlock_init(&sem->sem_lock);
 	sem->sem_count = initial_count;
+	sem->sem_waiters = 0;
 
 	return sem;
 }
@@ -88,6 +113,8 @@ sem_destroy(struct semaphore *sem)
 void
 P(struct semaphore *sem)
 {
+	uint32_t count;
+
 	KASSERT(sem != NULL);
 
 	/*
@@ -98,40 +125,81 @@ P(struct semaphore *sem)
 	 */
 	KASSERT(curthread->t_in_interrupt == false);
 
-	/* Use the semaphore spinlock to protect the wchan as well. */
+	/*
+	 * Fast path: grab a unit with a bare compare-and-swap. When
+	 * the count is nonzero this finishes without ever touching
+	 * the spinlock, so P on an uncontended semaphore costs one
+	 * atomic operation.
+	 */
+	for (;;) {
+		count = atomic_load_acquire(&sem->sem_count);
+		if (count == 0) {
+			break;
+		}
+		if (atomic_cas(&sem->sem_count, count, count - 1)
+		    == count) {
+			return;
+		}
+	}
+
+	/*
+	 * Slow path: sleep. The spinlock protects the wchan and the
+	 * waiter count; we advertise ourselves in sem_waiters before
+	 * re-checking the count, so V (which increments the count and
+	 * then looks at sem_waiters, both with full barriers) either
+	 * sees us and wakes us, or we see its count and don't sleep.
+	 *
+	 * Note that we don't maintain strict FIFO ordering of
+	 * threads going through the semaphore; that is, we
+	 * might "get" it on the first try even if other
+	 * threads are waiting. Apparently according to some
+	 * textbooks semaphores must for some reason have
+	 * strict ordering. Too bad. :-)
+	 *
+	 * Exercise: how would you implement strict FIFO
+	 * ordering?
+	 */
 	spinlock_acquire(&sem->sem_lock);
-	while (sem->sem_count == 0) {
-		/*
-		 *
-		 * Note that we don't maintain strict FIFO ordering of
-		 * threads going through the semaphore; that is, we
-		 * might "get" it on the first try even if other
-		 * threads are waiting. Apparently according to some
-		 * textbooks semaphores must for some reason have
-		 * strict ordering. Too bad. :-)
-		 *
-		 * Exercise: how would you implement strict FIFO
-		 * ordering?
-		 */
-		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+	atomic_fetch_add(&sem->sem_waiters, 1);
+	for (;;) {
+		count = atomic_load_acquire(&sem->sem_count);
+		if (count == 0) {
+			wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+			continue;
+		}
+		if (atomic_cas(&sem->sem_count, count, count - 1)
+		    == count) {
+			break;
+		}
 	}
-	KASSERT(sem->sem_count > 0);
-	sem->sem_count--;
+	atomic_fetch_add(&sem->sem_waiters, (uint32_t)-1);
 	spinlock_release(&sem->sem_lock);
 }
 
 void
 V(struct semaphore *sem)
 {
-	KASSERT(sem != NULL);
+	uint32_t count;
 
-	spinlock_acquire(&sem->sem_lock);
+	KASSERT(sem != NULL);
 
-	sem->sem_count++;
-	KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+	count = atomic_fetch_add(&sem->sem_count, 1);
+	KASSERT(count + 1 != 0);
 
-	spinlock_release(&sem->sem_lock);
+	/*
+	 * Only bother with the spinlock and the wchan if someone is
+	 * asleep, or between advertising in sem_waiters and sleeping;
+	 * in the latter case the spinlock serializes us behind their
+	 * wchan_sleep so the wakeup isn't lost. If we read a zero
+	 * waiter count, the full barrier in the fetch_add above
+	 * guarantees the not-yet-advertised waiter will see our
+	 * count and not sleep.
+	 */
+	if (atomic_load_acquire(&sem->sem_waiters) > 0) {
+		spinlock_acquire(&sem->sem_lock);
+		wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+		spinlock_release(&sem->sem_lock);
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -163,12 +231,52 @@ lock_create(const char *name)
 
 	spinlock_init(&lock->lk_spinlock);
 	lock->lk_holder = NULL;
+	lock->lk_nextheld = NULL;
+	lock->lk_donatedprio = LOCK_NODONATION;
+	lock->lk_stat = NULL;
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
 
 	return lock;
 }
 
+/*
+ * Donate priority PRIO through LOCK: record it on the lock so the
+ * holder (current and future, until the waiters drain) can inherit
+ * it, boost the holder, and if the holder is itself blocked on
+ * another lock, push the donation down that chain too.
+ *
+ * Called with LOCK's spinlock held. The reads that walk the chain
+ * (lk_holder of inner locks, t_waitlock) are made without the inner
+ * locks' spinlocks, to keep the lock ordering trivial; a stale value
+ * can only misdirect or cut short a donation, leaving some thread
+ * less boosted than ideal, never corrupt anything. The actual
+ * priority updates go through thread_priodonate, which takes the
+ * proper runqueue lock.
+ */
+static
+void
+lock_donate(struct lock *lock, unsigned prio)
+{
+	struct thread *holder;
+	unsigned depth;
+
+	for (depth = 0; lock != NULL && depth < LOCK_DONATE_MAXDEPTH;
+	     depth++) {
+		if (prio >= lock->lk_donatedprio) {
+			/* Someone at least as urgent already did this. */
+			break;
+		}
+		lock->lk_donatedprio = prio;
+		holder = *(struct thread * volatile *)&lock->lk_holder;
+		if (holder == NULL) {
+			break;
+		}
+		thread_priodonate(holder, prio);
+		lock = *(struct lock * volatile *)&holder->t_waitlock;
+	}
+}
+
 void
 lock_destroy(struct lock *lock)
 {
@@ -184,31 +292,94 @@ lock_destroy(struct lock *lock)
 void
 lock_acquire(struct lock *lock)
 {
+	unsigned startticks = 0;
+	bool waited = false;
+
 	KASSERT(lock != NULL);
 
 	KASSERT(curthread->t_in_interrupt == false);
 
+	/*
+	 * Adaptive spin: while the holder is actually running on
+	 * another cpu, it will likely release within a few hundred
+	 * cycles, so spinning is cheaper than the two context
+	 * switches of sleeping and being woken. Once the holder
+	 * blocks (or we give up), fall through to the normal sleep
+	 * path. The unlocked reads here are racy, but a stale value
+	 * only ends the spin early or late; correctness comes from
+	 * the locked check below. On a uniprocessor never spin: the
+	 * holder can't run while we do.
+	 */
+	if (num_cpus > 1) {
+		unsigned spins;
+
+		for (spins = 0; spins < LOCK_SPIN_MAX; spins++) {
+			struct thread *holder;
+
+			holder = *(struct thread * volatile *)
+				&lock->lk_holder;
+			if (holder == NULL || holder == curthread ||
+			    holder->t_state != S_RUN) {
+				break;
+			}
+		}
+	}
+
 	spinlock_acquire(&lock->lk_spinlock);
 
 	/* Call this (atomically) before waiting for a lock */
 	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
 
+	if (lock->lk_stat != NULL) {
+		startticks = curcpu->c_hardclocks;
+	}
+
 	while (lock->lk_holder != NULL) {
+		waited = true;
+		/*
+		 * Lend the holder our priority so it can't be starved
+		 * out from under us by middle-priority threads while
+		 * we sleep. Redone on every pass: the holder may have
+		 * changed while we slept.
+		 */
+		lock_donate(lock, curthread->t_priority);
+		curthread->t_waitlock = lock;
 		wchan_sleep(lock->lk_wchan, &lock->lk_spinlock);
+		curthread->t_waitlock = NULL;
 	}
 
 	lock->lk_holder = curthread;
 	KASSERT(lock->lk_holder == curthread);
-	
+
+	/* Track the lock for donation accounting (see lock_release). */
+	lock->lk_nextheld = curthread->t_sleeplocks;
+	curthread->t_sleeplocks = lock;
+
+	/*
+	 * Inherit whatever the threads still waiting behind us have
+	 * donated; otherwise a high-priority sleeper's donation would
+	 * evaporate whenever the lock changed hands.
+	 */
+	if (lock->lk_donatedprio != LOCK_NODONATION) {
+		thread_priodonate(curthread, lock->lk_donatedprio);
+	}
+
+	if (lock->lk_stat != NULL) {
+		lockstat_sleep_acquired(lock->lk_stat, startticks, waited);
+	}
+
 	/* Call this (atomically) once the lock is acquired */
 	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
-	
+
 	spinlock_release(&lock->lk_spinlock);
 }
 
 void
 lock_release(struct lock *lock)
 {
+	struct lock **lp, *l;
+	unsigned donated;
+
 	KASSERT(lock != NULL);
 
 	spinlock_acquire(&lock->lk_spinlock);
@@ -216,9 +387,43 @@ lock_release(struct lock *lock)
 	KASSERT(lock->lk_holder != NULL);
 	KASSERT(lock_do_i_hold(lock));
 
+	/* Unlink from our held-locks chain (nobody else touches it). */
+	for (lp = &curthread->t_sleeplocks; *lp != lock;
+	     lp = &(*lp)->lk_nextheld) {
+		KASSERT(*lp != NULL);
+	}
+	*lp = lock->lk_nextheld;
+	lock->lk_nextheld = NULL;
+
+	/*
+	 * If nobody is left waiting, the donations through this lock
+	 * lapse. (While waiters remain, the recorded level may
+	 * overstate what the remaining waiters would donate; that
+	 * only over-boosts the next holder briefly.)
+	 */
+	if (wchan_isempty(lock->lk_wchan, &lock->lk_spinlock)) {
+		lock->lk_donatedprio = LOCK_NODONATION;
+	}
+
+	/*
+	 * Give back this lock's donation, keeping whatever our other
+	 * held locks still confer.
+	 */
+	donated = LOCK_NODONATION;
+	for (l = curthread->t_sleeplocks; l != NULL; l = l->lk_nextheld) {
+		if (l->lk_donatedprio < donated) {
+			donated = l->lk_donatedprio;
+		}
+	}
+	thread_priorestore(donated);
+
+	if (lock->lk_stat != NULL) {
+		lockstat_sleep_releasing(lock->lk_stat);
+	}
+
 	lock->lk_holder = NULL;
 	KASSERT(lock->lk_holder == NULL);
-	
+
 	wchan_wakeone(lock->lk_wchan, &lock->lk_spinlock);
 
 	/* Call this (atomically) when the lock is released */
@@ -293,6 +498,30 @@ cv_wait(struct cv *cv, struct lock *lock)
 	lock_acquire(lock);
 }
 
+/*
+ * Timed cv_wait: additionally give up and return ETIMEDOUT after
+ * TICKS hardclocks if nobody signals first. A thread absorbed by
+ * cv_broadcast's requeueing counts as signaled even if the deadline
+ * passes while it waits its turn for the lock.
+ */
+int
+cv_timedwait(struct cv *cv, struct lock *lock, uint32_t ticks)
+{
+	int result;
+
+	spinlock_acquire(&cv->cv_spinlock);
+
+	lock_release(lock);
+
+	result = wchan_sleep_timeout(cv->cv_wchan, &cv->cv_spinlock, ticks);
+
+	spinlock_release(&cv->cv_spinlock);
+
+	lock_acquire(lock);
+
+	return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
@@ -312,7 +541,29 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 
 	KASSERT(lock_do_i_hold(lock));
 
-	wchan_wakeall(cv->cv_wchan, &cv->cv_spinlock);
+	/*
+	 * Waking every waiter just makes them all pile into
+	 * lock_acquire, where all but the winner go straight back to
+	 * sleep. Instead wake one, and requeue the rest directly
+	 * onto the lock's wait channel without waking them: each
+	 * subsequent lock_release hands the lock to one of them in
+	 * turn, so the broadcast produces exactly one runnable
+	 * thread at a time.
+	 *
+	 * The spinlock order (cv's, then the lock's) is the one
+	 * cv_wait already uses when it releases the lock. Requeued
+	 * threads haven't donated priority to the lock holder the
+	 * way a thread sleeping in lock_acquire would have; they
+	 * donate normally if they have to sleep again after waking.
+	 */
+	wchan_wakeone(cv->cv_wchan, &cv->cv_spinlock);
+
+	if (!wchan_isempty(cv->cv_wchan, &cv->cv_spinlock)) {
+		spinlock_acquire(&lock->lk_spinlock);
+		wchan_requeue_all(cv->cv_wchan, &cv->cv_spinlock,
+				  lock->lk_wchan, &lock->lk_spinlock);
+		spinlock_release(&lock->lk_spinlock);
+	}
 
 	spinlock_release(&cv->cv_spinlock);
 }
@@ -353,32 +604,27 @@ rwlock_create(const char *name) {
 		return NULL;
 	}
 
-	rwlock->rwlock_lock = lock_create("rwlock_lock");
-	if (rwlock->rwlock_lock == NULL) {
-		kfree(rwlock->rwlock_name);
-		kfree(rwlock);
-		return NULL;
-	}
-
-	rwlock->rwlock_cv = cv_create("rwlock_cv");
-	if (rwlock->rwlock_cv == NULL) {
-		lock_destroy(rwlock->rwlock_lock);
+	rwlock->rwlock_rwchan = wchan_create(rwlock->rwlock_name);
+	if (rwlock->rwlock_rwchan == NULL) {
 		kfree(rwlock->rwlock_name);
 		kfree(rwlock);
 		return NULL;
 	}
 
-	rwlock->rwlock_active_readers = threadarray_create();
-	if (rwlock->rwlock_active_readers == NULL) {
-		cv_destroy(rwlock->rwlock_cv);
-		lock_destroy(rwlock->rwlock_lock);
+	rwlock->rwlock_wwchan = wchan_create(rwlock->rwlock_name);
+	if (rwlock->rwlock_wwchan == NULL) {
+		wchan_destroy(rwlock->rwlock_rwchan);
 		kfree(rwlock->rwlock_name);
 		kfree(rwlock);
 		return NULL;
 	}
 
-	rwlock->rwlock_waiting_writers_count = 0;
-	rwlock->rwlock_active_writer = NULL;
+	spinlock_init(&rwlock->rwlock_splk);
+	rwlock->rwlock_state = 0;
+	rwlock->rwlock_waitreaders = 0;
+	rwlock->rwlock_waitwriters = 0;
+	rwlock->rwlock_rgrant = 0;
+	rwlock->rwlock_writer = NULL;
 
 	return rwlock;
 }
@@ -386,13 +632,15 @@ rwlock_create(const char *name) {
 void
 rwlock_destroy(struct rwlock *rwlock) {
 	KASSERT(rwlock != NULL);
-	KASSERT(threadarray_num(rwlock->rwlock_active_readers) == 0);
-	KASSERT(rwlock->rwlock_waiting_writers_count == 0);
-	KASSERT(rwlock->rwlock_active_writer == NULL);
-
-	threadarray_destroy(rwlock->rwlock_active_readers);
-	cv_destroy(rwlock->rwlock_cv);
-	lock_destroy(rwlock->rwlock_lock);
+	KASSERT(rwlock->rwlock_state == 0);
+	KASSERT(rwlock->rwlock_waitreaders == 0);
+	KASSERT(rwlock->rwlock_waitwriters == 0);
+	KASSERT(rwlock->rwlock_rgrant == 0);
+	KASSERT(rwlock->rwlock_writer == NULL);
+
+	spinlock_cleanup(&rwlock->rwlock_splk);
+	wchan_destroy(rwlock->rwlock_wwchan);
+	wchan_destroy(rwlock->rwlock_rwchan);
 	kfree(rwlock->rwlock_name);
 	kfree(rwlock);
 }
@@ -400,66 +648,106 @@ rwlock_destroy(struct rwlock *rwlock) {
 void
 rwlock_acquire_read(struct rwlock *rwlock) {
 	KASSERT(rwlock != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
 
-	lock_acquire(rwlock->rwlock_lock);
+	spinlock_acquire(&rwlock->rwlock_splk);
 
-	while (rwlock->rwlock_waiting_writers_count > 0 || rwlock->rwlock_active_writer != NULL) {
-		cv_wait(rwlock->rwlock_cv, rwlock->rwlock_lock);
+	/*
+	 * Wait while a writer holds the lock, or while writers are
+	 * queued and we hold no admission grant from the current
+	 * read phase (see rwlock_release_write). The grant check is
+	 * what makes the handoff phase-fair: readers woken at the
+	 * start of a read phase get in ahead of the queued writers,
+	 * but a reader arriving after the grants are consumed waits
+	 * for the next phase.
+	 */
+	while ((rwlock->rwlock_state & RWLOCK_WRITER) != 0 ||
+	       (rwlock->rwlock_waitwriters > 0 &&
+		rwlock->rwlock_rgrant == 0)) {
+		rwlock->rwlock_waitreaders++;
+		wchan_sleep(rwlock->rwlock_rwchan, &rwlock->rwlock_splk);
+		rwlock->rwlock_waitreaders--;
 	}
 
-	unsigned out_index;
-	threadarray_add(rwlock->rwlock_active_readers, curthread, &out_index);
+	if (rwlock->rwlock_rgrant > 0) {
+		rwlock->rwlock_rgrant--;
+	}
+	KASSERT((rwlock->rwlock_state & RWLOCK_READERMASK)
+		!= RWLOCK_READERMASK);
+	rwlock->rwlock_state++;
 
-	lock_release(rwlock->rwlock_lock);
+	spinlock_release(&rwlock->rwlock_splk);
 }
 
 void
 rwlock_release_read(struct rwlock *rwlock) {
 	KASSERT(rwlock != NULL);
 
-	lock_acquire(rwlock->rwlock_lock);
+	spinlock_acquire(&rwlock->rwlock_splk);
 
-	KASSERT(threadarray_removefirst(rwlock->rwlock_active_readers, curthread));
-	KASSERT(rwlock->rwlock_waiting_writers_count >= 0);
+	KASSERT((rwlock->rwlock_state & RWLOCK_WRITER) == 0);
+	KASSERT((rwlock->rwlock_state & RWLOCK_READERMASK) > 0);
+	rwlock->rwlock_state--;
 
-	if (threadarray_num(rwlock->rwlock_active_readers) == 0) {
-		cv_broadcast(rwlock->rwlock_cv, rwlock->rwlock_lock);
+	/*
+	 * The read phase ends when the last reader leaves and no
+	 * granted reader is still on its way in; then it's the
+	 * writers' turn.
+	 */
+	if (rwlock->rwlock_state == 0 && rwlock->rwlock_rgrant == 0 &&
+	    rwlock->rwlock_waitwriters > 0) {
+		wchan_wakeone(rwlock->rwlock_wwchan, &rwlock->rwlock_splk);
 	}
 
-	lock_release(rwlock->rwlock_lock);
+	spinlock_release(&rwlock->rwlock_splk);
 }
 
 void
 rwlock_acquire_write(struct rwlock *rwlock) {
 	KASSERT(rwlock != NULL);
-	
-	lock_acquire(rwlock->rwlock_lock);
+	KASSERT(curthread->t_in_interrupt == false);
 
-	rwlock->rwlock_waiting_writers_count++;
+	spinlock_acquire(&rwlock->rwlock_splk);
 
-	while (threadarray_num(rwlock->rwlock_active_readers) > 0 || rwlock->rwlock_active_writer != NULL) {
-		cv_wait(rwlock->rwlock_cv, rwlock->rwlock_lock);
+	rwlock->rwlock_waitwriters++;
+	while (rwlock->rwlock_state != 0 || rwlock->rwlock_rgrant > 0) {
+		wchan_sleep(rwlock->rwlock_wwchan, &rwlock->rwlock_splk);
 	}
+	rwlock->rwlock_waitwriters--;
 
-	KASSERT(threadarray_num(rwlock->rwlock_active_readers) == 0);
+	rwlock->rwlock_state = RWLOCK_WRITER;
+	rwlock->rwlock_writer = curthread;
 
-	rwlock->rwlock_waiting_writers_count--;
-	KASSERT(rwlock->rwlock_waiting_writers_count >= 0);
-	rwlock->rwlock_active_writer = curthread;
-
-	lock_release(rwlock->rwlock_lock);
+	spinlock_release(&rwlock->rwlock_splk);
 }
 
 void
 rwlock_release_write(struct rwlock *rwlock) {
 	KASSERT(rwlock != NULL);
-	KASSERT(rwlock->rwlock_active_writer == curthread);
 
-	lock_acquire(rwlock->rwlock_lock);
+	spinlock_acquire(&rwlock->rwlock_splk);
 
-	rwlock->rwlock_active_writer = NULL;
+	KASSERT(rwlock->rwlock_writer == curthread);
+	KASSERT(rwlock->rwlock_state == RWLOCK_WRITER);
+	rwlock->rwlock_writer = NULL;
+	rwlock->rwlock_state = 0;
 
-	cv_broadcast(rwlock->rwlock_cv, rwlock->rwlock_lock);
+	/*
+	 * Phase-fair handoff: if readers queued up behind us, open a
+	 * read phase and admit every one of them before the next
+	 * writer, even though writers may be waiting too. Each woken
+	 * reader consumes one grant on its way in, so the phase
+	 * can't be held open indefinitely by new arrivals once the
+	 * grants are gone. If no readers are waiting, pass the lock
+	 * to the next writer.
+	 */
+	if (rwlock->rwlock_waitreaders > 0) {
+		rwlock->rwlock_rgrant = rwlock->rwlock_waitreaders;
+		wchan_wakeall(rwlock->rwlock_rwchan, &rwlock->rwlock_splk);
+	}
+	else if (rwlock->rwlock_waitwriters > 0) {
+		wchan_wakeone(rwlock->rwlock_wwchan, &rwlock->rwlock_splk);
+	}
 
-	lock_release(rwlock->rwlock_lock);
+	spinlock_release(&rwlock->rwlock_splk);
 }
@@ -40,7 +40,9 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <membar.h>
 #include <wchan.h>
+#include <iopri.h>
 #include <thread.h>
 #include <threadlist.h>
 #include <threadprivate.h>
@@ -50,6 +52,10 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <lockstat.h>
+#include <ktrace.h>
+#include <percpu.h>
+#include <clock.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -61,6 +67,20 @@ struct wchan {
 	struct threadlist wc_threads;	/* list of waiting threads */
 };
 
+/*
+ * Hashed wait-queue table for address-keyed sleeps (waitaddr_sleep /
+ * waitaddr_wake). Sleepers hash into a bucket by the address they
+ * wait on; each bucket is an ordinary wchan with its own spinlock,
+ * shared by all addresses that hash there, and sleepers are told
+ * apart at wakeup by t_waitaddr. Must be a power of 2.
+ */
+#define WAITADDR_NUMBUCKETS 64
+
+static struct waitaddr_bucket {
+	struct spinlock wab_lock;
+	struct wchan wab_wchan;
+} waitaddr_buckets[WAITADDR_NUMBUCKETS];
+
 /* Master array of CPUs. */
 DECLARRAY(cpu, static __UNUSED inline);
 DEFARRAY(cpu, static __UNUSED inline);
@@ -75,8 +95,127 @@ unsigned thread_count = 0;
 static struct spinlock thread_count_lock = SPINLOCK_INITIALIZER;
 static struct wchan *thread_count_wchan;
 
+/*
+ * Scheduler tuning knobs (see schedule() below). Read unlocked from
+ * the timer interrupt; both are single words, so the worst a racing
+ * update can do is mis-schedule one tick.
+ */
+unsigned sched_numprios = 4;	/* priority levels in use */
+unsigned sched_basequantum = 4;	/* level-0 timeslice, in hardclocks */
+
+/*
+ * Boost all queued threads back to the top level this often to
+ * prevent starvation of the bottom queues. Must be a multiple of
+ * SCHEDULE_HARDCLOCKS in clock.c, as schedule() only runs then.
+ */
+#define SCHED_BOOST_HARDCLOCKS	64
+
+/*
+ * Per-cpu cache of retired thread structures with their stacks still
+ * attached, so thread_fork can reuse a whole pair without touching
+ * the allocator; with thread-per-request patterns, stack allocation
+ * is a major source of page-allocator lock traffic. Bounded, so it
+ * reaches a steady state rather than growing; drained from
+ * thread_wait_for_count so heap-usage checks stay stable. The cache
+ * is per-cpu for locality, but spinlocked (rather than cpu-private
+ * like c_zombies) so the drain can reach every cpu's cache.
+ */
+
+static
+struct thread *
+threadcache_get(void)
+{
+	struct cpu *c;
+	struct thread *thread;
+
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+	c = curcpu->c_self;
+
+	thread = NULL;
+	spinlock_acquire(&c->c_threadcache_lock);
+	if (c->c_nthreadcache > 0) {
+		thread = c->c_threadcache[--c->c_nthreadcache];
+	}
+	spinlock_release(&c->c_threadcache_lock);
+	return thread;
+}
+
+static
+bool
+threadcache_put(struct thread *thread)
+{
+	struct cpu *c;
+	bool cached;
+
+	if (!CURCPU_EXISTS()) {
+		return false;
+	}
+	c = curcpu->c_self;
+
+	cached = false;
+	spinlock_acquire(&c->c_threadcache_lock);
+	if (c->c_nthreadcache < THREADCACHE_MAX) {
+		c->c_threadcache[c->c_nthreadcache++] = thread;
+		cached = true;
+	}
+	spinlock_release(&c->c_threadcache_lock);
+	return cached;
+}
+
+static
+void
+threadcache_drainall(void)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+	struct thread *thread;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		for (;;) {
+			thread = NULL;
+			spinlock_acquire(&c->c_threadcache_lock);
+			if (c->c_nthreadcache > 0) {
+				thread = c->c_threadcache
+					[--c->c_nthreadcache];
+			}
+			spinlock_release(&c->c_threadcache_lock);
+			if (thread == NULL) {
+				break;
+			}
+			kfree(thread->t_stack);
+			kfree(thread);
+		}
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
+/*
+ * Thread joining.
+ *
+ * A joinable thread (made with thread_fork_joinable) gets a small
+ * completion record, kept on a global list keyed by thread id. The
+ * record outlives the thread: thread_destroy marks it done and wakes
+ * the joiner through the address-keyed wait table, so the joiner's
+ * sleep needs no per-operation synch objects and return from
+ * thread_join means the thread is fully cleaned up, not merely a
+ * zombie. The record is freed by thread_join; a joinable thread that
+ * is never joined leaks its record, same as an unjoined pthread.
+ */
+struct joinrec {
+	unsigned jr_tid;		/* thread id handed to the forker */
+	volatile unsigned jr_done;	/* completion word; 0 until done */
+	struct joinrec *jr_next;	/* next on the joinrecs list */
+};
+
+static struct joinrec *joinrecs;
+static unsigned joinrec_nexttid = 1;
+static struct spinlock joinrec_lock = SPINLOCK_INITIALIZER;
+
 /*
  * Stick a magic number on the bottom end of the stack. This will
  * (sometimes) catch kernel stack overflows. Use thread_checkstack()
@@ -123,15 +262,28 @@ struct thread *
 thread_create(const char *name)
 {
 	struct thread *thread;
+	void *stack;
 
 	DEBUGASSERT(name != NULL);
 	if (strlen(name) > MAX_NAME_LENGTH) {
 		return NULL;
 	}
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	/*
+	 * Reuse a retired thread/stack pair if the cache has one;
+	 * the stack (if any) comes along for the ride and replaces
+	 * the fresh allocation in thread_fork.
+	 */
+	stack = NULL;
+	thread = threadcache_get();
+	if (thread != NULL) {
+		stack = thread->t_stack;
+	}
+	else {
+		thread = kmalloc(sizeof(*thread));
+		if (thread == NULL) {
+			return NULL;
+		}
 	}
 
 	strcpy(thread->t_name, name);
@@ -141,7 +293,9 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
+	thread->t_stack = stack;
+	thread->t_waitaddr = NULL;
+	thread->t_joinrec = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
@@ -152,6 +306,25 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Scheduler fields; new threads start at the top priority */
+	thread->t_priority = 0;
+	thread->t_basepriority = 0;
+	thread->t_donatedprio = SCHED_NUMPRIOS_MAX;
+	thread->t_sliceticks = 0;
+	thread->t_runnabletick = 0;
+	thread->t_nomigrate = false;
+	thread->t_affinity = NULL;
+	thread->t_priofixed = false;
+	thread->t_sleeplocks = NULL;
+	thread->t_waitlock = NULL;
+	thread->t_iopri = IOPRI_NORMAL;
+	thread->t_iodirect = false;
+	thread->t_ioadvice = 0;		/* FADV_NORMAL */
+	thread->t_ioappend = false;
+	thread->t_usertls = NULL;
+	thread->t_runcycles = 0;
+	thread->t_runstart = 0;
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -170,6 +343,7 @@ cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
 	int result;
+	unsigned i;
 	char namebuf[16];
 
 	c = kmalloc(sizeof(*c));
@@ -184,20 +358,48 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	bzero(&c->c_schedstat, sizeof(c->c_schedstat));
+
+	c->c_reapwchan = wchan_create("reaper");
+	if (c->c_reapwchan == NULL) {
+		panic("cpu_create: wchan_create failed\n");
+	}
+	spinlock_init(&c->c_reaplock);
+	c->c_hasreaper = false;
+
+	c->c_nthreadcache = 0;
+	spinlock_init(&c->c_threadcache_lock);
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<SCHED_NUMPRIOS_MAX; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
 	spinlock_init(&c->c_runqueue_lock);
 
+	for (i=0; i<WAKEUPRING_SIZE; i++) {
+		c->c_wakeups[i] = NULL;
+	}
+	c->c_wakeup_head = 0;
+	c->c_wakeup_tail = 0;
+
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
 
+	c->c_softirq_pending = 0;
+	c->c_insoftirq = false;
+
+	percpu_area_init(c);
+
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
 
+	/* Profile the runqueue lock; it's a perennial contention suspect. */
+	snprintf(namebuf, sizeof(namebuf), "runqueue%u", c->c_number);
+	c->c_runqueue_lock.splk_stat = lockstat_register(namebuf);
+
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
 	if (c->c_curthread == NULL) {
@@ -215,9 +417,12 @@ cpu_create(unsigned hardware_number)
 		/*c->c_curthread->t_stack = ... */
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		/* thread_create may have supplied a recycled stack */
 		if (c->c_curthread->t_stack == NULL) {
-			panic("cpu_create: couldn't allocate stack");
+			c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+			if (c->c_curthread->t_stack == NULL) {
+				panic("cpu_create: couldn't allocate stack");
+			}
 		}
 		thread_checkstack_init(c->c_curthread);
 	}
@@ -257,6 +462,20 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Look up a cpu by its software number; NULL if out of range. Used
+ * by thread_set_affinity and softirq_setaffinity, which take cpu
+ * numbers from callers that have no business with struct cpu.
+ */
+struct cpu *
+cpu_getbynumber(unsigned cpunum)
+{
+	if (cpunum >= cpuarray_num(&allcpus)) {
+		return NULL;
+	}
+	return cpuarray_get(&allcpus, cpunum);
+}
+
 /*
  * Destroy a thread.
  *
@@ -272,16 +491,41 @@ static
 void
 thread_destroy(struct thread *thread)
 {
+	struct joinrec *jr;
+
 	KASSERT(thread != curthread);
 	KASSERT(thread->t_state != S_RUN);
 
+	/*
+	 * If someone can join on this thread, mark its completion
+	 * record done and wake them. This goes first, before the
+	 * thread structure can be recycled through the cache; the
+	 * record itself stays around until thread_join frees it.
+	 */
+	if (thread->t_joinrec != NULL) {
+		jr = thread->t_joinrec;
+		thread->t_joinrec = NULL;
+		jr->jr_done = 1;
+		waitaddr_wake(&jr->jr_done, WAITADDR_ALL);
+	}
+
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
+	threadlistnode_cleanup(&thread->t_listnode);
+	thread_machdep_cleanup(&thread->t_machdep);
+
+	/*
+	 * Recycle the thread and its stack as a pair for the next
+	 * fork if there's room in this cpu's cache; stackless
+	 * threads (the boot thread) aren't worth caching.
+	 */
 	if (thread->t_stack != NULL) {
+		thread->t_wchan_name = "CACHED";
+		if (threadcache_put(thread)) {
+			return;
+		}
 		kfree(thread->t_stack);
 	}
-	threadlistnode_cleanup(&thread->t_listnode);
-	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
@@ -300,14 +544,107 @@ void
 exorcise(void)
 {
 	struct thread *z;
+	int spl;
 
-	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
+	/*
+	 * This used to run only with interrupts off, from the tail of
+	 * thread_switch; now that the reaper thread (and
+	 * thread_wait_for_count) call it preemptibly, each pop must
+	 * be atomic on this cpu, since c_zombies has no lock. The
+	 * destroy itself can run with interrupts on; the zombie is
+	 * already off the list.
+	 */
+	for (;;) {
+		spl = splhigh();
+		z = threadlist_remhead(&curcpu->c_zombies);
+		splx(spl);
+		if (z == NULL) {
+			break;
+		}
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
 		thread_destroy(z);
 	}
 }
 
+/*
+ * Per-cpu reaper thread. Sits at the bottom priority level, pinned
+ * to its cpu, and destroys that cpu's zombies in batches when poked
+ * from the context switch path. This keeps the kfree traffic of
+ * fork/exit storms out of thread_switch, where it used to run
+ * inline.
+ */
+static
+void
+thread_reaper(void *junk, unsigned long junk2)
+{
+	(void)junk;
+	(void)junk2;
+
+	/*
+	 * Reap at the lowest priority, exempt from the wakeup boost,
+	 * and never migrate: c_zombies belongs to this cpu alone.
+	 */
+	curthread->t_nomigrate = true;
+	curthread->t_priofixed = true;
+	curthread->t_priority = sched_numprios - 1;
+	curthread->t_basepriority = sched_numprios - 1;
+
+	spinlock_acquire(&curcpu->c_reaplock);
+	curcpu->c_hasreaper = true;
+	for (;;) {
+		while (threadlist_isempty(&curcpu->c_zombies)) {
+			wchan_sleep(curcpu->c_reapwchan,
+				    &curcpu->c_reaplock);
+		}
+		spinlock_release(&curcpu->c_reaplock);
+		exorcise();
+		spinlock_acquire(&curcpu->c_reaplock);
+	}
+}
+
+/*
+ * Hand the zombie list to the reaper. Called from the tail of
+ * thread_switch (and thread_startup) with interrupts off, so this
+ * must stay cheap: a list peek, and a wakeup only when there is
+ * something to reap. Until the reaper has been forked (early boot),
+ * reap inline as before.
+ */
+static
+void
+reaper_poke(void)
+{
+	if (!curcpu->c_hasreaper) {
+		exorcise();
+		return;
+	}
+	if (!threadlist_isempty(&curcpu->c_zombies)) {
+		spinlock_acquire(&curcpu->c_reaplock);
+		wchan_wakeone(curcpu->c_reapwchan, &curcpu->c_reaplock);
+		spinlock_release(&curcpu->c_reaplock);
+	}
+}
+
+/*
+ * Fork the calling cpu's reaper thread. Called once per cpu during
+ * startup, from thread_start_cpus on the boot cpu and cpu_hatch on
+ * the others.
+ */
+static
+void
+cpu_startreaper(void)
+{
+	char name[16];
+	int result;
+
+	snprintf(name, sizeof(name), "reaper/%u", curcpu->c_number);
+	result = thread_fork(name, NULL, thread_reaper, NULL, 0);
+	if (result) {
+		panic("cpu%u: forking reaper: %s\n",
+		      curcpu->c_number, strerror(result));
+	}
+}
+
 /*
  * On panic, stop the thread system (as much as is reasonably
  * possible) to make sure we don't end up letting any other threads
@@ -330,9 +667,13 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (unsigned i=0; i<SCHED_NUMPRIOS_MAX; i++) {
+		struct threadlist *tl = &curcpu->c_runqueue[i];
+
+		tl->tl_count = 0;
+		tl->tl_head.tln_next = &tl->tl_tail;
+		tl->tl_tail.tln_prev = &tl->tl_head;
+	}
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -373,8 +714,17 @@ thread_shutdown(void)
 void
 thread_bootstrap(void)
 {
+	unsigned i;
+
 	cpuarray_init(&allcpus);
 
+	/* Set up the hashed wait-queue table. */
+	for (i=0; i<WAITADDR_NUMBUCKETS; i++) {
+		spinlock_init(&waitaddr_buckets[i].wab_lock);
+		waitaddr_buckets[i].wab_wchan.wc_name = "waitaddr";
+		threadlist_init(&waitaddr_buckets[i].wab_wchan.wc_threads);
+	}
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -416,6 +766,8 @@ cpu_hatch(unsigned software_number)
 	spl0();
 	cpu_identify(buf, sizeof(buf));
 
+	cpu_startreaper();
+
 	V(cpu_startup_sem);
 	thread_exit();
 }
@@ -453,96 +805,512 @@ thread_start_cpus(void)
 	// is the cpu0 boot thread (menu), which is the only thread that hasn't
 	// exited yet.
 	thread_count = 1;
+
+	/*
+	 * The secondary cpus forked their reapers from cpu_hatch;
+	 * now that the count baseline is settled, fork ours. (The
+	 * reaper never exits, so it permanently raises the count
+	 * by one; that happens before anyone samples it.)
+	 */
+	cpu_startreaper();
 }
 
 /*
- * Make a thread runnable.
+ * Scheduler helpers.
  *
- * targetcpu might be curcpu; it might not be, too.
+ * Each cpu's run queue is an array of threadlists, one per priority
+ * level, all protected by the one c_runqueue_lock; the caller of
+ * each helper below must hold the relevant cpu's lock.
+ */
+
+/*
+ * The queue a thread belongs on: its priority, clamped in case
+ * sched_numprios has been lowered since the thread last ran.
  */
 static
-void
-thread_make_runnable(struct thread *target, bool already_have_lock)
+unsigned
+sched_prioof(struct thread *t)
 {
-	struct cpu *targetcpu;
+	return t->t_priority < sched_numprios ?
+		t->t_priority : sched_numprios - 1;
+}
 
-	/* Lock the run queue of the target thread's cpu. */
-	targetcpu = target->t_cpu;
+/* Timeslice, in hardclocks, at priority level PRIO. */
+static
+unsigned
+sched_quantum(unsigned prio)
+{
+	return sched_basequantum << prio;
+}
 
-	if (already_have_lock) {
-		/* The target thread's cpu should be already locked. */
-		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
-	}
-	else {
-		spinlock_acquire(&targetcpu->c_runqueue_lock);
-	}
+/* Put T on C's run queue according to its priority. */
+static
+void
+sched_enqueue(struct cpu *c, struct thread *t)
+{
+	threadlist_addtail(&c->c_runqueue[sched_prioof(t)], t);
+}
 
-	/* Target thread is now ready to run; put it on the run queue. */
-	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+/* Total number of threads queued on C. */
+static
+unsigned
+sched_qcount(struct cpu *c)
+{
+	unsigned i, count;
 
-	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
+	count = 0;
+	for (i=0; i<SCHED_NUMPRIOS_MAX; i++) {
+		count += c->c_runqueue[i].tl_count;
 	}
+	return count;
+}
 
-	if (!already_have_lock) {
-		spinlock_release(&targetcpu->c_runqueue_lock);
+/*
+ * Take the next thread to run off C: the head of the highest-
+ * priority nonempty queue. Scan all compiled-in levels, not just the
+ * active ones, so nothing is stranded if sched_numprios is lowered
+ * at runtime. Returns NULL if all the queues are empty.
+ */
+static
+struct thread *
+sched_pickthread(struct cpu *c)
+{
+	unsigned i;
+	struct thread *t;
+
+	for (i=0; i<SCHED_NUMPRIOS_MAX; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			return t;
+		}
 	}
+	return NULL;
 }
 
 /*
- * Create a new thread based on an existing one.
- *
- * The new thread has name NAME, and starts executing in function
- * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
- *
- * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * Take a migration victim off C: the tail of the lowest-priority
+ * nonempty queue. The cache-affinity loss of moving a thread matters
+ * least for the threads we would run last anyway.
  */
-int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+static
+struct thread *
+sched_stealthread(struct cpu *c)
 {
-	struct thread *newthread;
-	int result;
+	unsigned i;
+	struct thread *t;
 
-	newthread = thread_create(name);
-	if (newthread == NULL) {
-		return ENOMEM;
+	for (i=SCHED_NUMPRIOS_MAX; i-- > 0; ) {
+		t = threadlist_remtail(&c->c_runqueue[i]);
+		if (t != NULL) {
+			return t;
+		}
 	}
+	return NULL;
+}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
-	}
-	thread_checkstack_init(newthread);
+/*
+ * Steal a ready thread from another cpu's run queue. Called from the
+ * idle loop in thread_switch, *without* the local runqueue lock held,
+ * so we only ever hold one runqueue lock at a time (the same ordering
+ * discipline thread_consider_migration uses). Returns NULL if no
+ * sibling has work to give.
+ */
+static
+struct thread *
+sched_steal_remote(void)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+	struct thread *t;
 
-	/*
-	 * Now we clone various fields from the parent thread.
-	 */
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
 
-	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+		/*
+		 * Peek at the queue depths without the lock; this is
+		 * racy but only a heuristic for whether locking is
+		 * worth it. The actual steal below holds the lock.
+		 */
+		if (sched_qcount(c) == 0) {
+			continue;
+		}
 
-	/* Attach the new thread to its process */
-	if (proc == NULL) {
-		proc = curthread->t_proc;
-	}
-	result = proc_addthread(proc, newthread);
-	if (result) {
-		/* thread_destroy will clean up the stack */
-		thread_destroy(newthread);
-		return result;
-	}
+		spinlock_acquire(&c->c_runqueue_lock);
+		t = sched_stealthread(c);
+		if (t != NULL && (t == c->c_curthread || t->t_nomigrate ||
+				  t->t_affinity != NULL)) {
+			/*
+			 * The victim's curthread can be on its run
+			 * queue if that cpu hasn't fully unidled after
+			 * a wakeup; migrating it would be disastrous
+			 * (see the long comment in
+			 * thread_consider_migration). Pinned threads
+			 * and threads with an affinity must stay home
+			 * too. Put it back and try the next cpu.
+			 */
+			sched_enqueue(c, t);
+			t = NULL;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+
+		if (t != NULL) {
+			/*
+			 * T is off every queue and not running, so
+			 * nobody else can touch it; safe to claim it
+			 * without further locking.
+			 */
+			t->t_cpu = curcpu->c_self;
+			/*
+			 * Restart the wait clock; t_runnabletick was
+			 * set from the victim cpu's c_hardclocks.
+			 */
+			t->t_runnabletick = curcpu->c_hardclocks;
+			curcpu->c_schedstat.ss_steals++;
+			DEBUG(DB_THREADS,
+			      "Stole thread %s: cpu %u -> %u",
+			      t->t_name, c->c_number, curcpu->c_number);
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Publish TARGET in TARGETCPU's wakeup ring, so that cpu can move it
+ * onto its own run queue without us touching the remote runqueue
+ * lock. Returns false if the ring is full; the caller then falls
+ * back to locking.
+ */
+static
+bool
+sched_wakeup_enqueue(struct cpu *targetcpu, struct thread *target)
+{
+	spinlock_data_t head, tail;
+	unsigned idx;
+	int spl;
+
+	/*
+	 * Keep interrupts off between claiming a slot and filling it:
+	 * the target spins (briefly) on a claimed-but-empty slot
+	 * while holding its runqueue lock, so we must not wander off
+	 * into an interrupt handler in the middle.
+	 */
+	spl = splhigh();
+	for (;;) {
+		head = targetcpu->c_wakeup_head;
+		tail = targetcpu->c_wakeup_tail;
+		if (head - tail >= WAKEUPRING_SIZE) {
+			splx(spl);
+			return false;
+		}
+		if (spinlock_data_cas(&targetcpu->c_wakeup_head,
+				      head, head + 1) == head) {
+			break;
+		}
+		/* Lost the race to another waker; reload and retry. */
+	}
+	idx = head & (WAKEUPRING_SIZE - 1);
+
+	/* Order our earlier stores to the thread before publishing it. */
+	membar_store_store();
+	targetcpu->c_wakeups[idx] = target;
+
+	/*
+	 * Flag/flag handshake with the target's pre-sleep ring check
+	 * (see the idle loop in thread_switch): full barrier between
+	 * our publish and our read of c_isidle, so at least one side
+	 * always notices the other and a wakeup can't be slept
+	 * through. The read itself is unlocked and may be stale; the
+	 * worst case is one spurious IPI.
+	 */
+	membar_any_any();
+	if (targetcpu->c_isidle) {
+		ipi_send(targetcpu, IPI_UNIDLE);
+	}
+	splx(spl);
+	return true;
+}
+
+/*
+ * Quick unlocked check whether our own wakeup ring has entries, for
+ * deciding against going idle. The barrier pairs with the one in
+ * sched_wakeup_enqueue.
+ */
+static
+bool
+sched_wakeups_pending(void)
+{
+	struct cpu *c;
+
+	c = curcpu->c_self;
+	membar_any_any();
+	return c->c_wakeup_head != c->c_wakeup_tail;
+}
+
+/*
+ * Apply the wakeup scheduling policy to TARGET and put it on
+ * TARGETCPU's run queue, whose lock the caller holds. Shared by
+ * thread_make_runnable and the bulk path below.
+ */
+static
+void
+sched_makerunnable_locked(struct cpu *targetcpu, struct thread *target)
+{
+	KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+
+	/*
+	 * Apply the MLFQ policy (see schedule() below). A thread
+	 * waking from a wait channel gave up the cpu voluntarily;
+	 * treat it as interactive and boost it to the top level. A
+	 * thread being requeued after using up its timeslice gets
+	 * demoted one level. (Preempted threads with slice left over
+	 * keep both their level and the remainder of their slice, so
+	 * yielding just before expiry doesn't dodge demotion.)
+	 * Threads with a fixed priority (the reapers) get neither.
+	 */
+	if (target->t_priofixed) {
+		target->t_sliceticks = 0;
+	}
+	else if (target->t_state == S_SLEEP) {
+		target->t_basepriority = 0;
+		target->t_sliceticks = 0;
+	}
+	else if (target->t_sliceticks >= sched_quantum(sched_prioof(target))) {
+		if (target->t_basepriority < sched_numprios - 1) {
+			target->t_basepriority++;
+		}
+		target->t_sliceticks = 0;
+	}
+
+	/*
+	 * The effective priority is the base unless a lock waiter has
+	 * donated something better (see thread_priodonate).
+	 */
+	if (!target->t_priofixed) {
+		target->t_priority =
+			target->t_basepriority < target->t_donatedprio ?
+			target->t_basepriority : target->t_donatedprio;
+	}
+
+	/* Target thread is now ready to run; put it on the run queue. */
+	target->t_state = S_READY;
+	target->t_runnabletick = targetcpu->c_hardclocks;
+	sched_enqueue(targetcpu, target);
+}
+
+/*
+ * Make a thread runnable.
+ *
+ * targetcpu might be curcpu; it might not be, too.
+ */
+static
+void
+thread_make_runnable(struct thread *target, bool already_have_lock)
+{
+	struct cpu *targetcpu;
+
+	/*
+	 * Wakeup placement honors affinity: a thread being made
+	 * runnable is off every queue and not running, so this is the
+	 * one cheap moment to move it home. When the caller already
+	 * holds a runqueue lock it is requeueing on that specific
+	 * cpu; leave the thread put and let the next wakeup move it.
+	 */
+	if (!already_have_lock && target->t_affinity != NULL &&
+	    target->t_cpu != target->t_affinity) {
+		target->t_cpu = target->t_affinity;
+	}
+
+	/* Lock the run queue of the target thread's cpu. */
+	targetcpu = target->t_cpu;
+
+	/*
+	 * Remote wakeup: rather than bouncing the other cpu's
+	 * runqueue lock around, hand the thread over through its
+	 * wakeup ring and let it do its own enqueueing (including
+	 * the priority policy below, under its own lock). Only if
+	 * the ring is full do we take the lock ourselves.
+	 */
+	if (!already_have_lock && CURCPU_EXISTS() &&
+	    targetcpu != curcpu->c_self &&
+	    sched_wakeup_enqueue(targetcpu, target)) {
+		return;
+	}
+
+	if (already_have_lock) {
+		/* The target thread's cpu should be already locked. */
+		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+	}
+	else {
+		spinlock_acquire(&targetcpu->c_runqueue_lock);
+	}
+
+	sched_makerunnable_locked(targetcpu, target);
+
+	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
+		/*
+		 * Other processor is idle; send interrupt to make
+		 * sure it unidles.
+		 */
+		ipi_send(targetcpu, IPI_UNIDLE);
+	}
+
+	if (!already_have_lock) {
+		spinlock_release(&targetcpu->c_runqueue_lock);
+	}
+}
+
+/*
+ * Make every thread on LIST runnable. The threads must be off their
+ * wait channels already and belong to the caller (as after the
+ * collection phase of wchan_wakeall); LIST is left empty.
+ *
+ * Waking N threads one at a time costs N runqueue lock acquisitions,
+ * possibly all remote. Instead, partition the list by target cpu and
+ * enqueue each partition under a single hold of that cpu's lock,
+ * with at most one unidle IPI per cpu. The wakeup ring is deliberately
+ * not used here: it exists to make a single remote wakeup cheap, and
+ * a mass wakeup would overflow it back onto the lock anyway.
+ */
+static
+void
+thread_make_runnable_all(struct threadlist *list)
+{
+	struct threadlist batch;
+	struct thread *t, *next;
+	struct cpu *targetcpu;
+
+	threadlist_init(&batch);
+
+	while ((t = threadlist_remhead(list)) != NULL) {
+		/*
+		 * Wakeup placement honors affinity, as in
+		 * thread_make_runnable.
+		 */
+		if (t->t_affinity != NULL && t->t_cpu != t->t_affinity) {
+			t->t_cpu = t->t_affinity;
+		}
+		targetcpu = t->t_cpu;
+		threadlist_addtail(&batch, t);
+
+		/* Collect everything else headed for the same cpu. */
+		t = list->tl_head.tln_next->tln_self;
+		while (t != NULL) {
+			next = t->t_listnode.tln_next->tln_self;
+			if (t->t_affinity != NULL &&
+			    t->t_cpu != t->t_affinity) {
+				t->t_cpu = t->t_affinity;
+			}
+			if (t->t_cpu == targetcpu) {
+				threadlist_remove(list, t);
+				threadlist_addtail(&batch, t);
+			}
+			t = next;
+		}
+
+		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		while ((t = threadlist_remhead(&batch)) != NULL) {
+			sched_makerunnable_locked(targetcpu, t);
+		}
+		if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
+			ipi_send(targetcpu, IPI_UNIDLE);
+		}
+		spinlock_release(&targetcpu->c_runqueue_lock);
+	}
+
+	threadlist_cleanup(&batch);
+}
+
+/*
+ * Move everything other cpus have put in our wakeup ring onto our
+ * run queue. Called with our own runqueue lock held (the only
+ * runqueue lock this path ever touches).
+ */
+static
+void
+sched_drain_wakeups(void)
+{
+	struct cpu *c;
+	struct thread *t;
+	spinlock_data_t tail;
+	unsigned idx;
+
+	c = curcpu->c_self;
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (tail = c->c_wakeup_tail; tail != c->c_wakeup_head; tail++) {
+		idx = tail & (WAKEUPRING_SIZE - 1);
+		/*
+		 * A producer bumps the head before filling the slot;
+		 * it does so with interrupts off, so the wait here is
+		 * a few instructions at worst.
+		 */
+		while ((t = c->c_wakeups[idx]) == NULL) {
+			/* nothing */
+		}
+		c->c_wakeups[idx] = NULL;
+		/* Empty the slot before handing it back via the tail. */
+		membar_store_store();
+		c->c_wakeup_tail = tail + 1;
+
+		KASSERT(t->t_cpu == c);
+		thread_make_runnable(t, true /*have lock*/);
+	}
+}
+
+/*
+ * Create a new thread based on an existing one; guts of thread_fork
+ * and thread_fork_joinable. JR is the completion record for a
+ * joinable thread, or NULL; it is attached only once the fork can no
+ * longer fail, so error paths never see it.
+ */
+static
+int
+thread_fork_common(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2,
+	    struct joinrec *jr)
+{
+	struct thread *newthread;
+	int result;
+
+	newthread = thread_create(name);
+	if (newthread == NULL) {
+		return ENOMEM;
+	}
+
+	/* Allocate a stack unless thread_create recycled one */
+	if (newthread->t_stack == NULL) {
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+	}
+	thread_checkstack_init(newthread);
+
+	/*
+	 * Now we clone various fields from the parent thread.
+	 */
+
+	/* Thread subsystem fields */
+	newthread->t_cpu = curthread->t_cpu;
+
+	/* Attach the new thread to its process */
+	if (proc == NULL) {
+		proc = curthread->t_proc;
+	}
+	result = proc_addthread(proc, newthread);
+	if (result) {
+		/* thread_destroy will clean up the stack */
+		thread_destroy(newthread);
+		return result;
+	}
 
 	/*
 	 * Because new threads come out holding the cpu runqueue lock
@@ -559,12 +1327,126 @@ thread_fork(const char *name,
 	/* Set up the switchframe so entrypoint() gets called */
 	switchframe_init(newthread, entrypoint, data1, data2);
 
+	/* Past the last failure point; attach the join record, if any */
+	newthread->t_joinrec = jr;
+
 	/* Lock the current cpu's run queue and make the new thread runnable */
 	thread_make_runnable(newthread, false);
 
 	return 0;
 }
 
+/*
+ * Create a new thread based on an existing one.
+ *
+ * The new thread has name NAME, and starts executing in function
+ * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
+ *
+ * The new thread is created in the process P. If P is null, the
+ * process is inherited from the caller. It will start on the same CPU
+ * as the caller, unless the scheduler intervenes first.
+ */
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_fork_common(name, proc, entrypoint, data1, data2, NULL);
+}
+
+/*
+ * As thread_fork, but the new thread can be waited for with
+ * thread_join; its thread id is returned in *TID_RET.
+ */
+int
+thread_fork_joinable(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2,
+	    unsigned *tid_ret)
+{
+	struct joinrec *jr;
+	int result;
+
+	KASSERT(tid_ret != NULL);
+
+	jr = kmalloc(sizeof(*jr));
+	if (jr == NULL) {
+		return ENOMEM;
+	}
+	jr->jr_done = 0;
+
+	spinlock_acquire(&joinrec_lock);
+	jr->jr_tid = joinrec_nexttid++;
+	jr->jr_next = joinrecs;
+	joinrecs = jr;
+	spinlock_release(&joinrec_lock);
+
+	result = thread_fork_common(name, proc, entrypoint, data1, data2, jr);
+	if (result) {
+		struct joinrec **jrp;
+
+		spinlock_acquire(&joinrec_lock);
+		for (jrp = &joinrecs; *jrp != jr; jrp = &(*jrp)->jr_next) {
+			KASSERT(*jrp != NULL);
+		}
+		*jrp = jr->jr_next;
+		spinlock_release(&joinrec_lock);
+		kfree(jr);
+		return result;
+	}
+
+	*tid_ret = jr->jr_tid;
+	return 0;
+}
+
+/*
+ * Wait for the joinable thread TID to exit and be fully cleaned up,
+ * then retire its thread id. Each tid may be joined by one thread,
+ * once; returns ESRCH if TID was never issued or is already joined.
+ */
+int
+thread_join(unsigned tid)
+{
+	struct joinrec *jr, **jrp;
+
+	/*
+	 * Look the record up once; it cannot go away under us, since
+	 * only the (single) joiner frees it, below.
+	 */
+	spinlock_acquire(&joinrec_lock);
+	for (jr = joinrecs; jr != NULL; jr = jr->jr_next) {
+		if (jr->jr_tid == tid) {
+			break;
+		}
+	}
+	spinlock_release(&joinrec_lock);
+	if (jr == NULL) {
+		return ESRCH;
+	}
+
+	/*
+	 * Wait on the completion word. thread_destroy sets it before
+	 * waking, and waitaddr_sleep rechecks it under the bucket
+	 * lock, so the wakeup cannot be lost; spurious wakeups just
+	 * go around the loop.
+	 */
+	while (jr->jr_done == 0) {
+		waitaddr_sleep(&jr->jr_done, 0);
+	}
+
+	spinlock_acquire(&joinrec_lock);
+	for (jrp = &joinrecs; *jrp != jr; jrp = &(*jrp)->jr_next) {
+		KASSERT(*jrp != NULL);
+	}
+	*jrp = jr->jr_next;
+	spinlock_release(&joinrec_lock);
+	kfree(jr);
+
+	return 0;
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -605,8 +1487,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
+	/* Accept threads other cpus have woken for us. */
+	sched_drain_wakeups();
+
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && sched_qcount(curcpu->c_self) == 0) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -639,6 +1524,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	}
 	cur->t_state = newstate;
 
+	/*
+	 * Charge the outgoing thread for its time on the cpu. The
+	 * timestamp is taken before the idle loop below so that time
+	 * the cpu spends idle isn't charged to anyone. Both this and
+	 * the dispatch stamp read the same cpu's cycle clock, so the
+	 * charge doesn't depend on the per-cpu clock epochs.
+	 */
+	cur->t_runcycles += cycles() - cur->t_runstart;
+
 	/*
 	 * Get the next thread. While there isn't one, call cpu_idle().
 	 * curcpu->c_isidle must be true when cpu_idle is
@@ -659,15 +1553,50 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = sched_pickthread(curcpu->c_self);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/*
+			 * Rather than going to sleep with work queued
+			 * elsewhere, try to steal a thread from a
+			 * busier cpu. Failing that, spend the time
+			 * stocking the VM system's pool of pre-zeroed
+			 * frames. If either did useful work, recheck
+			 * the runqueue rather than waiting; only
+			 * sleep when there's truly nothing to do.
+			 */
+			next = sched_steal_remote();
+			if (next == NULL && !sched_wakeups_pending() &&
+			    !vm_zero_idle()) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
+			sched_drain_wakeups();
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	KTRACE(KTR_THREAD_SWITCH, (uint32_t)(vaddr_t)cur,
+	       (uint32_t)(vaddr_t)next);
+
+	/*
+	 * Bookkeeping for the schedstat command. Nearly all S_READY
+	 * entries come from the preemption yield in hardclock(), so
+	 * count them as involuntary. The wait time is in hardclocks,
+	 * so most dispatches land in the same tick and count zero;
+	 * the total only becomes visible under queuing delay, which
+	 * is exactly when it's interesting.
+	 */
+	curcpu->c_schedstat.ss_switches++;
+	if (newstate == S_READY) {
+		curcpu->c_schedstat.ss_preempts++;
+	}
+	curcpu->c_schedstat.ss_waitticks +=
+		curcpu->c_hardclocks - next->t_runnabletick;
+
+	/* Stamp the incoming thread's dispatch time. */
+	next->t_runstart = cycles();
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -738,8 +1667,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Activate our address space in the MMU. */
 	as_activate();
 
-	/* Clean up dead threads. */
-	exorcise();
+	/* Hand dead threads to the reaper. */
+	reaper_poke();
 
 	/* Turn interrupts back on. */
 	splx(spl);
@@ -771,92 +1700,329 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Activate our address space in the MMU. */
 	as_activate();
 
-	/* Clean up dead threads. */
-	exorcise();
+	/* Hand dead threads to the reaper. */
+	reaper_poke();
+
+	/* Enable interrupts. */
+	spl0();
+
+	/* Call the function. */
+	entrypoint(data1, data2);
+
+	/* Done. */
+	thread_exit();
+}
+
+/*
+ * Cause the current thread to exit.
+ *
+ * The parts of the thread structure we don't actually need to run
+ * should be cleaned up right away. The rest has to wait until
+ * thread_destroy is called from exorcise().
+ *
+ * Note that any dynamically-allocated structures that can vary in size from
+ * thread to thread should be cleaned up here, not in thread_destroy. This is
+ * because the last thread left on each core runs the idle loop and does not
+ * get cleaned up until new threads are created. Differences in the amount of
+ * memory used by different threads after thread_exit will make it look like
+ * your kernel in leaking memory and cause some of the test161 checks to fail.
+ *
+ * Does not return.
+ */
+void
+thread_exit(void)
+{
+	struct thread *cur;
+
+	cur = curthread;
+
+	/* In case we're not detached */
+	if (cur->t_proc != NULL) {
+		proc_remthread(curthread);
+	}
+
+	/* Make sure we *are* detached (move this only if you're sure!) */
+	KASSERT(cur->t_proc == NULL);
+
+	/* Check the stack guard band. */
+	thread_checkstack(cur);
+
+	// Decrement the thread count and notify anyone interested.
+	if (thread_count) {
+		spinlock_acquire(&thread_count_lock);
+		--thread_count;
+		wchan_wakeall(thread_count_wchan, &thread_count_lock);
+		spinlock_release(&thread_count_lock);
+	}
+
+	/* Interrupts off on this processor */
+	splhigh();
+	thread_switch(S_ZOMBIE, NULL, NULL);
+	panic("braaaaaaaiiiiiiiiiiinssssss\n");
+}
+
+/*
+ * Yield the cpu to another process, but stay runnable.
+ */
+void
+thread_yield(void)
+{
+	thread_switch(S_READY, NULL, NULL);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Scheduler.
+ *
+ * This is called periodically from hardclock(). It should reshuffle
+ * the current CPU's run queue by job priority.
+ *
+ * The policy is a multi-level feedback queue. Threads are dispatched
+ * from the highest-priority nonempty queue (sched_pickthread) and
+ * round-robin within a level. A thread that runs through its whole
+ * timeslice gets demoted a level; a thread that sleeps on a wait
+ * channel is boosted back to the top when it wakes (both in
+ * thread_make_runnable). That sorts interactive threads, which
+ * mostly sit in wchan_sleep, above cpu-bound ones, which chew
+ * through their slices. The only job left for this function is
+ * starvation control: periodically reset everything queued on this
+ * cpu to the top level, so a cpu-bound thread demoted to the bottom
+ * still runs now and then.
+ */
+
+void
+schedule(void)
+{
+	struct thread *t;
+	unsigned i;
+
+	if (sched_numprios == 1) {
+		/* Single queue: plain round-robin, nothing to do. */
+		return;
+	}
+	if (curcpu->c_hardclocks % SCHED_BOOST_HARDCLOCKS != 0) {
+		return;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<SCHED_NUMPRIOS_MAX; i++) {
+		struct threadlist stay;
+
+		threadlist_init(&stay);
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i]))
+		       != NULL) {
+			if (t->t_priofixed) {
+				/* Fixed-priority threads stay put */
+				threadlist_addtail(&stay, t);
+				continue;
+			}
+			t->t_priority = 0;
+			t->t_basepriority = 0;
+			t->t_sliceticks = 0;
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
+		}
+		while ((t = threadlist_remhead(&stay)) != NULL) {
+			threadlist_addtail(&curcpu->c_runqueue[i], t);
+		}
+		threadlist_cleanup(&stay);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+/*
+ * Timeslice accounting, called once per hardclock just before the
+ * preemption yield. A cpu sitting in the idle loop has no running
+ * thread to charge.
+ */
+void
+sched_tick(void)
+{
+	unsigned depth;
+
+	if (!curcpu->c_isidle) {
+		curthread->t_sliceticks++;
+	}
+
+	/*
+	 * Sample our run-queue depth for the schedstat histogram. The
+	 * unlocked read can race with enqueues from other cpus, but a
+	 * sample being off by one now and then doesn't matter.
+	 */
+	depth = sched_qcount(curcpu->c_self);
+	if (depth >= SCHEDSTAT_NUMDEPTHS) {
+		depth = SCHEDSTAT_NUMDEPTHS - 1;
+	}
+	curcpu->c_schedstat.ss_depths[depth]++;
+}
+
+/*
+ * Set the scheduler knobs: the number of priority levels in use and
+ * the level-0 timeslice in hardclocks. Plain stores are fine; the
+ * consumers reread the values every tick and sched_prioof clamps
+ * stale priorities.
+ */
+int
+sched_setparams(unsigned numprios, unsigned basequantum)
+{
+	if (numprios < 1 || numprios > SCHED_NUMPRIOS_MAX) {
+		return EINVAL;
+	}
+	if (basequantum < 1 ||
+	    basequantum > 0xffffffffU >> SCHED_NUMPRIOS_MAX) {
+		return EINVAL;
+	}
+	sched_numprios = numprios;
+	sched_basequantum = basequantum;
+	return 0;
+}
+
+/*
+ * Print the scheduler configuration, for the menu.
+ */
+void
+sched_dumpparams(void)
+{
+	unsigned i;
+
+	kprintf("Scheduler: %u of %u priority levels in use\n",
+		sched_numprios, SCHED_NUMPRIOS_MAX);
+	for (i=0; i<sched_numprios; i++) {
+		kprintf("   level %u: quantum %u hardclocks\n",
+			i, sched_quantum(i));
+	}
+	kprintf("Starvation boost every %u hardclocks\n",
+		SCHED_BOOST_HARDCLOCKS);
+}
 
-	/* Enable interrupts. */
-	spl0();
+/*
+ * Find which run queue level of C (if any) T is sitting on; -1 if it
+ * isn't queued. The runqueue lock must be held. Membership has to be
+ * established by searching: a thread can be S_READY yet briefly off
+ * every queue while migration or stealing carries it in a private
+ * list.
+ */
+static
+int
+sched_findqueued(struct cpu *c, struct thread *t)
+{
+	unsigned i;
+	struct thread *q;
 
-	/* Call the function. */
-	entrypoint(data1, data2);
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
 
-	/* Done. */
-	thread_exit();
+	for (i=0; i<SCHED_NUMPRIOS_MAX; i++) {
+		THREADLIST_FORALL(q, c->c_runqueue[i]) {
+			if (q == t) {
+				return (int)i;
+			}
+		}
+	}
+	return -1;
 }
 
 /*
- * Cause the current thread to exit.
- *
- * The parts of the thread structure we don't actually need to run
- * should be cleaned up right away. The rest has to wait until
- * thread_destroy is called from exorcise().
- *
- * Note that any dynamically-allocated structures that can vary in size from
- * thread to thread should be cleaned up here, not in thread_destroy. This is
- * because the last thread left on each core runs the idle loop and does not
- * get cleaned up until new threads are created. Differences in the amount of
- * memory used by different threads after thread_exit will make it look like
- * your kernel in leaking memory and cause some of the test161 checks to fail.
- *
- * Does not return.
+ * Donate priority PRIO to T: if PRIO is better than T's effective
+ * priority, adopt it, and if T is waiting on a run queue move it up
+ * so the donation takes effect this dispatch round rather than the
+ * next. Called by the sleep-lock code when a higher-priority thread
+ * blocks on a lock T holds; see lock_acquire in synch.c.
  */
 void
-thread_exit(void)
+thread_priodonate(struct thread *t, unsigned prio)
 {
-	struct thread *cur;
-
-	cur = curthread;
+	struct cpu *c;
+	int level;
 
-	/* In case we're not detached */
-	if (cur->t_proc != NULL) {
-		proc_remthread(curthread);
+	/* T can be stolen to another cpu while we chase its lock. */
+	for (;;) {
+		c = t->t_cpu;
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (t->t_cpu == c) {
+			break;
+		}
+		spinlock_release(&c->c_runqueue_lock);
 	}
 
-	/* Make sure we *are* detached (move this only if you're sure!) */
-	KASSERT(cur->t_proc == NULL);
+	if (prio < t->t_donatedprio) {
+		t->t_donatedprio = prio;
+	}
+	if (!t->t_priofixed && prio < t->t_priority) {
+		level = sched_findqueued(c, t);
+		t->t_priority = prio;
+		if (level >= 0) {
+			threadlist_remove(&c->c_runqueue[level], t);
+			sched_enqueue(c, t);
+		}
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
 
-	/* Check the stack guard band. */
-	thread_checkstack(cur);
+/*
+ * Replace the calling thread's outstanding-donation level, after it
+ * releases a lock, and recompute its effective priority. The caller
+ * is running, so there is no queue position to fix up.
+ */
+void
+thread_priorestore(unsigned donatedprio)
+{
+	struct thread *t;
 
-	// Decrement the thread count and notify anyone interested.
-	if (thread_count) {
-		spinlock_acquire(&thread_count_lock);
-		--thread_count;
-		wchan_wakeall(thread_count_wchan, &thread_count_lock);
-		spinlock_release(&thread_count_lock);
+	t = curthread;
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	t->t_donatedprio = donatedprio;
+	if (!t->t_priofixed) {
+		t->t_priority = t->t_basepriority < donatedprio ?
+			t->t_basepriority : donatedprio;
 	}
-
-	/* Interrupts off on this processor */
-	splhigh();
-	thread_switch(S_ZOMBIE, NULL, NULL);
-	panic("braaaaaaaiiiiiiiiiiinssssss\n");
+	spinlock_release(&curcpu->c_runqueue_lock);
 }
 
 /*
- * Yield the cpu to another process, but stay runnable.
+ * Print the per-cpu scheduler statistics. The counters belong to
+ * their cpus and are read unlocked, so a line is a snapshot that may
+ * be slightly torn; good enough for eyeballing behavior.
  */
 void
-thread_yield(void)
+schedstat_dump(void)
 {
-	thread_switch(S_READY, NULL, NULL);
-}
+	unsigned i, j, numcpus;
+	struct cpu *c;
+	struct schedstat *ss;
 
-////////////////////////////////////////////////////////////
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		ss = &c->c_schedstat;
+		kprintf("cpu %u: %u switches (%u preempts, %u steals), "
+			"%u wait ticks over %u dispatches\n",
+			c->c_number, ss->ss_switches, ss->ss_preempts,
+			ss->ss_steals, ss->ss_waitticks, ss->ss_switches);
+		kprintf("   queue depth:");
+		for (j=0; j<SCHEDSTAT_NUMDEPTHS; j++) {
+			kprintf(" %u:%u", j, ss->ss_depths[j]);
+		}
+		kprintf(" (samples per depth; last is %u+)\n",
+			SCHEDSTAT_NUMDEPTHS - 1);
+	}
+}
 
 /*
- * Scheduler.
- *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * Zero the statistics on every cpu, for a fresh measurement run.
+ * Clearing another cpu's counters races with that cpu incrementing
+ * them; at worst a tick's worth of events lands astride the reset.
  */
-
 void
-schedule(void)
+schedstat_reset(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		bzero(&c->c_schedstat, sizeof(c->c_schedstat));
+	}
 }
 
 /*
@@ -890,9 +2056,9 @@ thread_consider_migration(void)
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += sched_qcount(c);
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = sched_qcount(c);
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
@@ -906,7 +2072,9 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		t = sched_stealthread(curcpu->c_self);
+		/* Can't fail: others may only add to our run queue. */
+		KASSERT(t != NULL);
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -917,7 +2085,7 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		while (sched_qcount(c) < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -941,14 +2109,15 @@ thread_consider_migration(void)
 			 * skip it. Then it goes back on our own run
 			 * queue below.
 			 */
-			if (t == curthread) {
+			if (t == curthread || t->t_nomigrate ||
+			    t->t_affinity != NULL) {
 				threadlist_addtail(&victims, t);
 				to_send--;
 				continue;
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			sched_enqueue(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -972,7 +2141,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			sched_enqueue(curcpu->c_self, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -981,6 +2150,34 @@ thread_consider_migration(void)
 	threadlist_cleanup(&victims);
 }
 
+/*
+ * Pin T to the cpu numbered CPUNUM, or release the pin with
+ * THREAD_AFFINITY_ANY. See thread.h for the contract: stealing and
+ * load balancing pass pinned threads over, and wakeup placement in
+ * thread_make_runnable re-homes a thread that is elsewhere, so the
+ * pin takes full effect no later than T's next wakeup. That suits
+ * the intended users - background daemons and latency-sensitive
+ * workers - which sleep and wake constantly; moving a running thread
+ * out from under itself would mean switching stacks, which nothing
+ * needs.
+ */
+int
+thread_set_affinity(struct thread *t, unsigned cpunum)
+{
+	struct cpu *c;
+
+	if (cpunum == THREAD_AFFINITY_ANY) {
+		t->t_affinity = NULL;
+		return 0;
+	}
+	c = cpu_getbynumber(cpunum);
+	if (c == NULL) {
+		return EINVAL;
+	}
+	t->t_affinity = c;
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -1044,6 +2241,120 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(lk);
 }
 
+/*
+ * State shared between wchan_sleep_timeout and its timer callback.
+ * Lives on the sleeper's stack; every access is made under the
+ * wchan's spinlock, and the callback touches nothing after setting
+ * wto_fired, so the sleeper may not pop the frame until it has seen
+ * that flag (or cancelled the timer before it could fire).
+ */
+struct wchan_timeout {
+	struct wchan *wto_wc;		/* channel we're sleeping on */
+	struct spinlock *wto_lk;	/* its spinlock */
+	struct thread *wto_thread;	/* the sleeper */
+	volatile bool wto_fired;	/* callback ran */
+	volatile bool wto_timedout;	/* ...and found us still asleep */
+};
+
+/*
+ * Timer callback for wchan_sleep_timeout: a targeted wchan_wakeone.
+ * Runs in interrupt context on the boot cpu; taking the wchan's
+ * spinlock here is safe because spinlock holders run with interrupts
+ * off, so we can never be interrupting a holder on our own cpu.
+ *
+ * The sleeper may have been woken normally already - or moved to
+ * another channel entirely, as cv_broadcast's requeueing does - in
+ * which case it is not on the channel it went to sleep on and is
+ * left alone; being woken and timing out resolve in favor of woken.
+ */
+static
+void
+wchan_timeout_expire(struct timer *tm, void *data)
+{
+	struct wchan_timeout *wto = data;
+	struct thread *t, *target;
+
+	(void)tm;
+
+	spinlock_acquire(wto->wto_lk);
+
+	target = NULL;
+	THREADLIST_FORALL(t, wto->wto_wc->wc_threads) {
+		if (t == wto->wto_thread) {
+			target = t;
+			break;
+		}
+	}
+	if (target != NULL) {
+		threadlist_remove(&wto->wto_wc->wc_threads, target);
+		wto->wto_timedout = true;
+	}
+
+	/* Last touch of *wto; after this the sleeper may return. */
+	wto->wto_fired = true;
+
+	if (target != NULL) {
+		thread_make_runnable(target, false);
+	}
+	spinlock_release(wto->wto_lk);
+}
+
+/*
+ * Timed variant of wchan_sleep: give up and wake ourselves after
+ * TICKS hardclocks if nobody else has woken us first. Returns
+ * ETIMEDOUT if the deadline did the waking and 0 otherwise. Same
+ * locking contract as wchan_sleep.
+ */
+int
+wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk, uint32_t ticks)
+{
+	struct wchan_timeout wto;
+	struct timer tm;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!curthread->t_in_interrupt);
+
+	/* must hold the spinlock */
+	KASSERT(spinlock_do_i_hold(lk));
+
+	/* must not hold other spinlocks */
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	KASSERT(ticks > 0);
+
+	wto.wto_wc = wc;
+	wto.wto_lk = lk;
+	wto.wto_thread = curthread;
+	wto.wto_fired = false;
+	wto.wto_timedout = false;
+
+	timer_init(&tm, wchan_timeout_expire, &wto);
+	timer_arm(&tm, ticks);
+
+	thread_switch(S_SLEEP, wc, lk);
+	spinlock_acquire(lk);
+
+	if (timer_cancel(&tm)) {
+		/* Beat the deadline; the callback will never run. */
+		return 0;
+	}
+
+	/*
+	 * The callback has fired, or has been dequeued and is about
+	 * to. It sets wto_fired under LK as its last touch of our
+	 * state, so we can only observe the flag set once it is
+	 * completely done with *wto; spin until then. (The window is
+	 * the length of the callback, and only exists when a wakeup
+	 * and the deadline race.)
+	 */
+	while (!wto.wto_fired) {
+		spinlock_release(lk);
+		spinlock_acquire(lk);
+	}
+
+	return wto.wto_timedout ? ETIMEDOUT : 0;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1095,17 +2406,40 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	}
 
 	/*
-	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
+	 * Enqueue the whole list at once, one runqueue lock hold and
+	 * at most one IPI per target cpu, instead of a lock round
+	 * trip per thread.
 	 */
-	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
-	}
+	thread_make_runnable_all(&list);
 
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move every thread sleeping on FROM onto TO without waking any of
+ * them; they sleep on as if they had gone to sleep on TO in the
+ * first place. Both channels' spinlocks must be held, which makes
+ * the callers responsible for ordering them consistently (cv_wait
+ * already orders the cv spinlock before the lock's). A moved thread
+ * still returns through its original wchan_sleep call, briefly
+ * reacquiring FROM's spinlock, which is why FROM must outlive the
+ * sleepers as usual.
+ */
+void
+wchan_requeue_all(struct wchan *from, struct spinlock *fromlk,
+		  struct wchan *to, struct spinlock *tolk)
+{
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	while ((t = threadlist_remhead(&from->wc_threads)) != NULL) {
+		t->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, t);
+	}
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1123,12 +2457,109 @@ wchan_isempty(struct wchan *wc, struct spinlock *lk)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Address-keyed waiting (see wchan.h for the interface contract).
+ */
+
+/*
+ * Hash an address to its bucket. The watched words are at least
+ * 4-aligned, so shift the dead bits off; fold some higher bits back
+ * in so words packed in the same structure still spread out.
+ */
+static
+struct waitaddr_bucket *
+waitaddr_bucketfor(const volatile unsigned *addr)
+{
+	uintptr_t x;
+
+	x = (uintptr_t)addr >> 2;
+	x ^= x >> 6;
+	return &waitaddr_buckets[x & (WAITADDR_NUMBUCKETS - 1)];
+}
+
+/*
+ * Sleep until someone calls waitaddr_wake on ADDR, provided the word
+ * at ADDR still holds EXPECTED; return EAGAIN without sleeping if it
+ * doesn't. The comparison and the enqueue happen under the bucket
+ * lock, so a waker that changes *ADDR before waking cannot slip
+ * between them.
+ */
+int
+waitaddr_sleep(const volatile unsigned *addr, unsigned expected)
+{
+	struct waitaddr_bucket *b;
+
+	b = waitaddr_bucketfor(addr);
+	spinlock_acquire(&b->wab_lock);
+	if (*addr != expected) {
+		spinlock_release(&b->wab_lock);
+		return EAGAIN;
+	}
+	curthread->t_waitaddr = addr;
+	wchan_sleep(&b->wab_wchan, &b->wab_lock);
+	/* Whoever woke us is supposed to have cleared this. */
+	KASSERT(curthread->t_waitaddr == NULL);
+	spinlock_release(&b->wab_lock);
+	return 0;
+}
+
+/*
+ * Wake up to N threads sleeping on ADDR; returns how many were woken.
+ * Other addresses sharing the bucket are left asleep, which is why
+ * this walks the bucket's list rather than using wchan_wakeone.
+ */
+unsigned
+waitaddr_wake(const volatile unsigned *addr, unsigned n)
+{
+	struct waitaddr_bucket *b;
+	struct thread *t, *next;
+	struct threadlist list;
+	unsigned woken;
+
+	woken = 0;
+	threadlist_init(&list);
+
+	b = waitaddr_bucketfor(addr);
+	spinlock_acquire(&b->wab_lock);
+	t = b->wab_wchan.wc_threads.tl_head.tln_next->tln_self;
+	while (t != NULL && woken < n) {
+		next = t->t_listnode.tln_next->tln_self;
+		if (t->t_waitaddr == (const void *)addr) {
+			threadlist_remove(&b->wab_wchan.wc_threads, t);
+			t->t_waitaddr = NULL;
+			threadlist_addtail(&list, t);
+			woken++;
+		}
+		t = next;
+	}
+	spinlock_release(&b->wab_lock);
+
+	/*
+	 * The collected threads are in S_SLEEP and on our private
+	 * list, so nobody else can touch them; make them runnable
+	 * without holding the bucket lock, batched by target cpu.
+	 */
+	thread_make_runnable_all(&list);
+
+	threadlist_cleanup(&list);
+	return woken;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Machine-independent IPI handling
  */
 
 /*
  * Send an IPI (inter-processor interrupt) to the specified CPU.
+ *
+ * The pending word is a mailbox: commands posted while an interrupt
+ * is already on its way to the target are drained by that same
+ * interrupt, so only the transition from an empty mailbox raises the
+ * hardware line. The receiver acks the line before draining (see
+ * mainbus_interrupt), so a command posted after its bits were
+ * collected re-raises the line rather than getting lost.
  */
 void
 ipi_send(struct cpu *target, int code)
@@ -1136,8 +2567,10 @@ ipi_send(struct cpu *target, int code)
 	KASSERT(code >= 0 && code < 32);
 
 	spinlock_acquire(&target->c_ipi_lock);
+	if (target->c_ipi_pending == 0) {
+		mainbus_send_ipi(target);
+	}
 	target->c_ipi_pending |= (uint32_t)1 << code;
-	mainbus_send_ipi(target);
 	spinlock_release(&target->c_ipi_lock);
 }
 
@@ -1159,39 +2592,99 @@ ipi_broadcast(int code)
 }
 
 /*
- * Send a TLB shootdown IPI to the specified CPU.
+ * Send a TLB shootdown IPI to the specified CPU, carrying a batch of
+ * mappings. The whole batch is queued under one acquisition of the
+ * target's IPI lock and generates a single interrupt, rather than an
+ * IPI round-trip per page.
+ *
+ * If the batch doesn't fit in the target's queue, the queue collapses
+ * to a single "flush everything" request (ts_as == NULL); that costs
+ * the target some refills but never loses an invalidation.
  */
 void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+ipi_tlbshootdown_batch(struct cpu *target,
+		       const struct tlbshootdown *mappings, unsigned n)
 {
-	unsigned n;
+	unsigned have;
+
+	KASSERT(n > 0);
 
 	spinlock_acquire(&target->c_ipi_lock);
 
-	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		/*
-		 * If you have problems with this panic going off,
-		 * consider: (1) increasing the maximum, (2) putting
-		 * logic here to sleep until space appears (may
-		 * interact awkwardly with VM system locking), (3)
-		 * putting logic here to coalesce requests together,
-		 * and/or (4) improving VM system state tracking to
-		 * reduce the number of unnecessary shootdowns.
-		 */
-		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
+	have = target->c_numshootdown;
+	if (have + n > TLBSHOOTDOWN_MAX) {
+		target->c_shootdown[0].ts_as = NULL;
+		target->c_shootdown[0].ts_vaddr = 0;
+		target->c_numshootdown = 1;
 	}
 	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+		for (unsigned i = 0; i < n; i++) {
+			target->c_shootdown[have + i] = mappings[i];
+		}
+		target->c_numshootdown = have + n;
 	}
 
+	/* As in ipi_send: only an empty mailbox needs a new interrupt. */
+	if (target->c_ipi_pending == 0) {
+		mainbus_send_ipi(target);
+	}
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
-	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown IPI to the specified CPU.
+ */
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	ipi_tlbshootdown_batch(target, mapping, 1);
+}
+
+/*
+ * Send one batched shootdown IPI to every other CPU that might hold
+ * TLB entries for any of the affected address spaces, then wait for
+ * the targets to drain their queues. CPUs where none of the spaces
+ * have ever been activated (no ASID assigned) are skipped entirely.
+ */
+void
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mappings, unsigned n)
+{
+	unsigned i, j;
+	struct cpu *c;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		for (j=0; j<n; j++) {
+			if (vm_tlbshootdown_needed(mappings[j].ts_as,
+						   c->c_number)) {
+				ipi_tlbshootdown_batch(c, mappings, n);
+				break;
+			}
+		}
+	}
+
+	/*
+	 * Wait for every target to process its queue, so the caller
+	 * can safely reuse the frames behind these mappings. Targets
+	 * drain in interrupt context; we hold no spinlocks here, so
+	 * this cannot deadlock.
+	 */
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		while (*(volatile unsigned *)&c->c_numshootdown > 0) {
+			/* spin; the target drains at interrupt time */
+		}
+	}
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -1226,6 +2719,14 @@ interprocessor_interrupt(void)
 		 * interrupt; don't need to do anything else.
 		 */
 	}
+	if (bits & (1U << IPI_SOFTIRQ)) {
+		/*
+		 * Nothing to do here: the steerer already set our
+		 * pending bit, and mainbus_interrupt runs
+		 * softirq_dispatch on the way out of every interrupt,
+		 * this one included.
+		 */
+	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		/*
 		 * Note: depending on your VM system locking you might
@@ -1252,4 +2753,14 @@ void thread_wait_for_count(unsigned tc)
 		wchan_sleep(thread_count_wchan, &thread_count_lock);
 	}
 	spinlock_release(&thread_count_lock);
+
+	/*
+	 * Callers use this to get the system quiesced before
+	 * checking heap usage. The reaper may not have run yet and
+	 * the thread caches hold recycled thread/stack pairs, both
+	 * of which would read as leaks, so clean up both here rather
+	 * than leaving it to chance.
+	 */
+	exorcise();
+	threadcache_drainall();
 }
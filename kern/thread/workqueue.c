@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Shared kernel workqueue. See workqueue.h for the interface notes.
+ *
+ * One FIFO of work items feeds a pool of worker threads, one per
+ * cpu. All state is guarded by wq_lock; handlers run with no locks
+ * held.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <clock.h>
+#include <workqueue.h>
+
+static void work_timer(struct timer *tm, void *data);
+
+static struct work *wq_head;	/* oldest item */
+static struct work *wq_tail;	/* newest item */
+static struct spinlock wq_lock = SPINLOCK_INITIALIZER;
+static struct wchan *wq_wchan;
+static bool wq_running;
+
+static
+void
+workqueue_thread(void *junk, unsigned long junk2)
+{
+	struct work *wk;
+
+	(void)junk;
+	(void)junk2;
+
+	spinlock_acquire(&wq_lock);
+	for (;;) {
+		while (wq_head == NULL) {
+			wchan_sleep(wq_wchan, &wq_lock);
+		}
+
+		wk = wq_head;
+		wq_head = wk->wk_next;
+		if (wq_head == NULL) {
+			wq_tail = NULL;
+		}
+		/*
+		 * Mark it not-queued before running, so the handler
+		 * can resubmit it, or free it if nothing else can
+		 * still submit it. We must not touch WK afterwards.
+		 */
+		wk->wk_queued = false;
+		spinlock_release(&wq_lock);
+
+		wk->wk_func(wk, wk->wk_data);
+
+		spinlock_acquire(&wq_lock);
+	}
+}
+
+void
+work_init(struct work *wk, void (*func)(struct work *, void *), void *data)
+{
+	KASSERT(func != NULL);
+
+	wk->wk_next = NULL;
+	wk->wk_func = func;
+	wk->wk_data = data;
+	wk->wk_queued = false;
+	timer_init(&wk->wk_timer, work_timer, wk);
+}
+
+bool
+work_submit(struct work *wk)
+{
+	spinlock_acquire(&wq_lock);
+
+	if (wk->wk_queued) {
+		spinlock_release(&wq_lock);
+		return false;
+	}
+
+	if (!wq_running) {
+		/* Early boot; no workers yet. */
+		spinlock_release(&wq_lock);
+		wk->wk_func(wk, wk->wk_data);
+		return true;
+	}
+
+	wk->wk_queued = true;
+	wk->wk_next = NULL;
+	if (wq_tail != NULL) {
+		wq_tail->wk_next = wk;
+	}
+	else {
+		wq_head = wk;
+	}
+	wq_tail = wk;
+
+	wchan_wakeone(wq_wchan, &wq_lock);
+	spinlock_release(&wq_lock);
+	return true;
+}
+
+/*
+ * Timer callback: hand the item to the workers. Runs at interrupt
+ * level, which work_submit tolerates.
+ */
+static
+void
+work_timer(struct timer *tm, void *data)
+{
+	(void)tm;
+	work_submit(data);
+}
+
+void
+work_submit_delayed(struct work *wk, uint32_t ticks)
+{
+	spinlock_acquire(&wq_lock);
+	if (wk->wk_queued || wk->wk_timer.tm_armed) {
+		spinlock_release(&wq_lock);
+		return;
+	}
+	spinlock_release(&wq_lock);
+
+	timer_arm(&wk->wk_timer, ticks);
+}
+
+bool
+work_cancel(struct work *wk)
+{
+	struct work **p;
+	bool cancelled;
+
+	/* Disarm the timer first so it can't requeue behind us. */
+	cancelled = timer_cancel(&wk->wk_timer);
+
+	spinlock_acquire(&wq_lock);
+	if (wk->wk_queued) {
+		for (p = &wq_head; *p != wk; p = &(*p)->wk_next) {
+			KASSERT(*p != NULL);
+		}
+		*p = wk->wk_next;
+		if (wq_tail == wk) {
+			/* Walk again for the new tail; queues are short. */
+			wq_tail = NULL;
+			for (p = &wq_head; *p != NULL; p = &(*p)->wk_next) {
+				wq_tail = *p;
+			}
+		}
+		wk->wk_queued = false;
+		cancelled = true;
+	}
+	spinlock_release(&wq_lock);
+
+	return cancelled;
+}
+
+/*
+ * Fork the worker pool: one thread per cpu, which bounds how many
+ * handlers run at once. Called once from boot(), after the thread
+ * system is fully up.
+ */
+void
+workqueue_bootstrap(void)
+{
+	char name[16];
+	unsigned i;
+	int result;
+
+	wq_wchan = wchan_create("workqueue");
+	if (wq_wchan == NULL) {
+		panic("workqueue_bootstrap: wchan_create failed\n");
+	}
+
+	KASSERT(num_cpus > 0);
+	for (i = 0; i < num_cpus; i++) {
+		snprintf(name, sizeof(name), "worker/%u", i);
+		result = thread_fork(name, NULL, workqueue_thread, NULL, 0);
+		if (result) {
+			panic("workqueue_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+
+	spinlock_acquire(&wq_lock);
+	wq_running = true;
+	spinlock_release(&wq_lock);
+}
@@ -36,6 +36,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/poll.h>
 #include <stat.h>
 #include <lib.h>
 #include <uio.h>
@@ -225,6 +226,30 @@ dev_isseekable(struct vnode *v)
 	return true;
 }
 
+/*
+ * Called for poll(); the device decides what's ready.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, int *revents)
+{
+	struct device *d = v->vn_data;
+	return DEVOP_POLL(d, events, revents);
+}
+
+/*
+ * devop_poll for the many devices whose I/O never waits on an
+ * outside event: everything asked for is ready now.
+ */
+int
+dev_poll_always(struct device *dev, int events, int *revents)
+{
+	(void)dev;
+
+	*revents = events & (POLLIN | POLLOUT);
+	return 0;
+}
+
 /*
  * For fsync() - meaningless, do nothing.
  */
@@ -335,6 +360,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_stat = dev_stat,
 	.vop_gettype = dev_gettype,
 	.vop_isseekable = dev_isseekable,
+	.vop_poll = dev_poll,
 	.vop_fsync = null_fsync,
 	.vop_mmap = dev_mmap,
 	.vop_truncate = dev_truncate,
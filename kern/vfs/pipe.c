@@ -0,0 +1,514 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipes.
+ *
+ * A pipe is a kernel ring buffer with a vnode for each end, so pipes
+ * plug into the ordinary file handle machinery and read/write/close
+ * just work. Both vnodes point at the same struct pipe; which end a
+ * vnode is is determined by its address within the pipe.
+ *
+ * The buffer is protected by a sleep lock so it can be held across
+ * uiomove (which touches user memory and so can fault). Blocking uses
+ * condition variables, with wakeups batched: a reader drains as much
+ * as it can and wakes writers once, and a writer fills as much as it
+ * can and wakes readers once (or once per time it fills the buffer),
+ * rather than signalling per byte or per chunk. This keeps a
+ * producer/consumer pair streaming instead of ping-ponging on
+ * wakeups.
+ *
+ * As the pipe man page promises, writes of up to PIPE_BUF bytes are
+ * atomic: a small write waits until the whole thing fits before
+ * copying any of it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/poll.h>
+#include <kern/stattypes.h>
+#include <limits.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
+#include <pipe.h>
+
+/*
+ * Ring buffer size. A power of two, and at least PIPE_BUF so that
+ * PIPE_BUF-sized atomic writes can always eventually proceed.
+ */
+#define PIPE_BUFSIZE	4096
+
+struct pipe {
+	struct lock *p_lock;		/* protects everything below */
+	struct cv *p_readcv;		/* readers wait here for data */
+	struct cv *p_writecv;		/* writers wait here for space */
+	size_t p_start;			/* index of oldest byte */
+	size_t p_len;			/* number of bytes buffered */
+	bool p_readopen;		/* read end not yet reclaimed */
+	bool p_writeopen;		/* write end not yet reclaimed */
+	struct vnode p_rvnode;		/* the read end */
+	struct vnode p_wvnode;		/* the write end */
+	char p_buf[PIPE_BUFSIZE];	/* the data */
+};
+
+/*
+ * VOP_EACHOPEN. Nothing to check; the file handle layer polices the
+ * access mode.
+ */
+static
+int
+pipe_eachopen(struct vnode *v, int openflags)
+{
+	(void)v;
+	(void)openflags;
+	return 0;
+}
+
+/*
+ * VOP_READ on the read end.
+ *
+ * Block until there's data (or no writers remain, which is EOF), then
+ * hand back as much as is buffered, up to the caller's size. The
+ * offset in the uio is ignored.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t amt;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	result = 0;
+
+	lock_acquire(p->p_lock);
+
+	while (p->p_len == 0) {
+		if (!p->p_writeopen) {
+			/* EOF */
+			lock_release(p->p_lock);
+			return 0;
+		}
+		cv_wait(p->p_readcv, p->p_lock);
+	}
+
+	/*
+	 * Drain what we can, then wake writers once at the end
+	 * rather than once per chunk.
+	 */
+	while (uio->uio_resid > 0 && p->p_len > 0) {
+		/* no more than is buffered... */
+		amt = p->p_len;
+		/* ...or than is contiguous before the buffer wraps... */
+		if (amt > PIPE_BUFSIZE - p->p_start) {
+			amt = PIPE_BUFSIZE - p->p_start;
+		}
+		/* ...or than the caller wants. */
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+
+		result = uiomove(p->p_buf + p->p_start, amt, uio);
+		if (result) {
+			break;
+		}
+
+		p->p_start = (p->p_start + amt) % PIPE_BUFSIZE;
+		p->p_len -= amt;
+	}
+
+	if (p->p_len < PIPE_BUFSIZE) {
+		cv_broadcast(p->p_writecv, p->p_lock);
+		pollnotify();
+	}
+
+	lock_release(p->p_lock);
+	return result;
+}
+
+/*
+ * VOP_WRITE on the write end.
+ *
+ * Copy into the ring, blocking when it's full, until everything is
+ * written or the read end goes away (EPIPE). Writes no larger than
+ * PIPE_BUF wait for enough space to land in one piece. The offset in
+ * the uio is ignored.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t amt, end, want;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	result = 0;
+
+	/* For a small write, insist on space for the whole thing. */
+	want = uio->uio_resid <= PIPE_BUF ? uio->uio_resid : 1;
+
+	lock_acquire(p->p_lock);
+
+	while (uio->uio_resid > 0) {
+		if (!p->p_readopen) {
+			result = EPIPE;
+			break;
+		}
+		if (PIPE_BUFSIZE - p->p_len < want) {
+			/*
+			 * Wake readers for everything written so far
+			 * (one batched wakeup), then wait for space.
+			 */
+			if (p->p_len > 0) {
+				cv_broadcast(p->p_readcv, p->p_lock);
+				pollnotify();
+			}
+			cv_wait(p->p_writecv, p->p_lock);
+			continue;
+		}
+
+		end = (p->p_start + p->p_len) % PIPE_BUFSIZE;
+
+		/* no more than the free space... */
+		amt = PIPE_BUFSIZE - p->p_len;
+		/* ...or than is contiguous before the buffer wraps... */
+		if (amt > PIPE_BUFSIZE - end) {
+			amt = PIPE_BUFSIZE - end;
+		}
+		/* ...or than remains to write. */
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+
+		result = uiomove(p->p_buf + end, amt, uio);
+		if (result) {
+			break;
+		}
+
+		p->p_len += amt;
+	}
+
+	if (p->p_len > 0) {
+		cv_broadcast(p->p_readcv, p->p_lock);
+		pollnotify();
+	}
+
+	lock_release(p->p_lock);
+	return result;
+}
+
+/*
+ * VOP_POLL. Which end this vnode is determines which events make
+ * sense; asking about the other direction just never reports ready.
+ * The read end is also "readable" at EOF (the read returns 0 rather
+ * than blocking) and reports POLLHUP once the writers are gone.
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, int *revents)
+{
+	struct pipe *p = v->vn_data;
+	int rev;
+
+	rev = 0;
+	lock_acquire(p->p_lock);
+	if (v == &p->p_rvnode) {
+		if ((events & POLLIN) &&
+		    (p->p_len > 0 || !p->p_writeopen)) {
+			rev |= POLLIN;
+		}
+		if (!p->p_writeopen) {
+			rev |= POLLHUP;
+		}
+	}
+	else {
+		if ((events & POLLOUT) && p->p_len < PIPE_BUFSIZE) {
+			rev |= POLLOUT;
+		}
+		if (!p->p_readopen) {
+			/* writes will fail with EPIPE */
+			rev |= POLLERR;
+		}
+	}
+	lock_release(p->p_lock);
+
+	*revents = rev;
+	return 0;
+}
+
+/*
+ * VOP_IOCTL. No ioctls on pipes.
+ */
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+/*
+ * VOP_GETTYPE.
+ */
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = _S_IFIFO;
+	return 0;
+}
+
+/*
+ * VOP_STAT. Report the amount currently buffered as the size.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+
+	lock_acquire(p->p_lock);
+	statbuf->st_size = p->p_len;
+	lock_release(p->p_lock);
+
+	statbuf->st_mode = _S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blocks = 0;
+	statbuf->st_dev = 0;
+	statbuf->st_rdev = 0;
+
+	return 0;
+}
+
+/*
+ * VOP_ISSEEKABLE. Pipes aren't; this is what makes lseek (and
+ * pread/pwrite) return ESPIPE.
+ */
+static
+bool
+pipe_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+/*
+ * VOP_FSYNC. Nothing to sync.
+ */
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+/*
+ * VOP_TRUNCATE. Meaningless on a pipe.
+ */
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+/*
+ * VOP_NAMEFILE. Pipes have no names.
+ */
+static
+int
+pipe_namefile(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+/*
+ * Destroy the whole pipe; called once both ends are gone.
+ */
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	cv_destroy(p->p_writecv);
+	cv_destroy(p->p_readcv);
+	lock_destroy(p->p_lock);
+	kfree(p);
+}
+
+/*
+ * VOP_RECLAIM. Called when the last reference to one end goes away.
+ * Mark that end closed and wake the other end's sleepers so they see
+ * EOF or EPIPE; when both ends are closed, tear the pipe down.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	bool lastend;
+
+	lock_acquire(p->p_lock);
+
+	/*
+	 * Pipes live in no table, so no new reference can appear once
+	 * the count falls to 1; but use the standard helper to consume
+	 * the reference uniformly.
+	 */
+	if (!vnode_tryreclaim(v)) {
+		lock_release(p->p_lock);
+		return EBUSY;
+	}
+
+	if (v == &p->p_rvnode) {
+		KASSERT(p->p_readopen);
+		p->p_readopen = false;
+		/* wake writers so they fail with EPIPE */
+		cv_broadcast(p->p_writecv, p->p_lock);
+		pollnotify();
+	}
+	else {
+		KASSERT(v == &p->p_wvnode);
+		KASSERT(p->p_writeopen);
+		p->p_writeopen = false;
+		/* wake readers so they see EOF */
+		cv_broadcast(p->p_readcv, p->p_lock);
+		pollnotify();
+	}
+	lastend = !p->p_readopen && !p->p_writeopen;
+
+	vnode_cleanup(v);
+
+	lock_release(p->p_lock);
+
+	if (lastend) {
+		pipe_destroy(p);
+	}
+
+	return 0;
+}
+
+/*
+ * One ops table serves both ends; the file handle layer keeps reads
+ * off the write end and vice versa via the open flags.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+	.vop_read = pipe_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_write = pipe_write,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_poll = pipe_poll,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = pipe_namefile,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+/*
+ * Create a pipe, handing back a referenced vnode for each end.
+ */
+int
+pipe_create(struct vnode **readvn_ret, struct vnode **writevn_ret)
+{
+	struct pipe *p;
+	int result;
+
+	p = kmalloc(sizeof(*p));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+
+	p->p_lock = lock_create("pipe");
+	if (p->p_lock == NULL) {
+		kfree(p);
+		return ENOMEM;
+	}
+
+	p->p_readcv = cv_create("piperead");
+	if (p->p_readcv == NULL) {
+		lock_destroy(p->p_lock);
+		kfree(p);
+		return ENOMEM;
+	}
+
+	p->p_writecv = cv_create("pipewrite");
+	if (p->p_writecv == NULL) {
+		cv_destroy(p->p_readcv);
+		lock_destroy(p->p_lock);
+		kfree(p);
+		return ENOMEM;
+	}
+
+	p->p_start = 0;
+	p->p_len = 0;
+	p->p_readopen = true;
+	p->p_writeopen = true;
+
+	result = vnode_init(&p->p_rvnode, &pipe_vnode_ops, NULL, p);
+	KASSERT(result == 0);
+	result = vnode_init(&p->p_wvnode, &pipe_vnode_ops, NULL, p);
+	KASSERT(result == 0);
+
+	*readvn_ret = &p->p_rvnode;
+	*writevn_ret = &p->p_wvnode;
+	return 0;
+}
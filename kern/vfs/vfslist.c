@@ -43,6 +43,9 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <syscallstat.h>
+#include <ktrace.h>
+#include <klog.h>
 
 /*
  * Structure for a single named device.
@@ -85,10 +88,19 @@ struct knowndev {
 /* A placeholder for kd_fs for devices used as swap */
 #define SWAP_FS	((struct fs *)-1)
 
-DECLARRAY(knowndev, static __UNUSED inline);
-DEFARRAY(knowndev, static __UNUSED inline);
+/*
+ * The device table holds the knowndev records by value: they are small,
+ * only ever looked up by scanning, and nothing outside this file holds
+ * pointers to them, so there's no reason to pay a pointer indirection
+ * per entry on every path resolution. Note that records move when the
+ * table grows, so pointers into it are only good until the next
+ * vfs_doadd; their indexes, however, are stable, since devices are
+ * never removed.
+ */
+DECLVALARRAY(knowndev, static __UNUSED inline);
+DEFVALARRAY(knowndev, static __UNUSED inline);
 
-static struct knowndevarray *knowndevs;
+static struct knowndevvalarray *knowndevs;
 
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
@@ -101,7 +113,7 @@ static unsigned vfs_biglock_depth;
 void
 vfs_bootstrap(void)
 {
-	knowndevs = knowndevarray_create();
+	knowndevs = knowndevvalarray_create();
 	if (knowndevs==NULL) {
 		panic("vfs: Could not create knowndevs array\n");
 	}
@@ -113,6 +125,9 @@ vfs_bootstrap(void)
 	vfs_biglock_depth = 0;
 
 	devnull_create();
+	syscallstatdev_create();
+	ktracedev_create();
+	klogdev_create();
 	semfs_bootstrap();
 }
 
@@ -177,9 +192,9 @@ vfs_sync(void)
 
 	vfs_biglock_acquire();
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevvalarray_num(knowndevs);
 	for (i=0; i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
+		dev = knowndevvalarray_get(knowndevs, i);
 		if (dev->kd_fs != NULL && dev->kd_fs != SWAP_FS) {
 			/*result =*/ FSOP_SYNC(dev->kd_fs);
 		}
@@ -190,6 +205,91 @@ vfs_sync(void)
 	return 0;
 }
 
+/*
+ * Most recently resolved device. Every absolute path resolution comes
+ * through vfs_getroot, and it's nearly always for the same one or two
+ * devices, so remember the last match to skip the table scan.
+ *
+ * This is only a hint and needs no invalidation: the full match logic
+ * reruns against the remembered device on every hit, device names are
+ * unique (badnames() enforces this at add time), and devices are never
+ * removed, so a stale hint just misses and we rescan. We remember the
+ * index rather than a pointer because records move when the table
+ * grows.
+ */
+#define NO_MRU ((unsigned)-1)
+static unsigned getroot_mru = NO_MRU;
+
+/*
+ * Check whether DEVNAME names KD in any of its roles; if so, fill in
+ * *RESULT (and *RET on success) and return true.
+ */
+static
+bool
+getroot_trydev(struct knowndev *kd, const char *devname,
+	       struct vnode **ret, int *result)
+{
+	/*
+	 * If this device has a mounted filesystem, and
+	 * DEVNAME names either the filesystem or the device,
+	 * return the root of the filesystem.
+	 *
+	 * If it has no mounted filesystem, it's mountable,
+	 * and DEVNAME names the device, return ENXIO.
+	 */
+
+	if (kd->kd_fs != NULL && kd->kd_fs != SWAP_FS) {
+		const char *volname;
+		volname = FSOP_GETVOLNAME(kd->kd_fs);
+
+		if (!strcmp(kd->kd_name, devname) ||
+		    (volname!=NULL && !strcmp(volname, devname))) {
+			*result = FSOP_GETROOT(kd->kd_fs, ret);
+			return true;
+		}
+	}
+	else {
+		if (kd->kd_rawname!=NULL &&
+		    !strcmp(kd->kd_name, devname)) {
+			*result = ENXIO;
+			return true;
+		}
+	}
+
+	/*
+	 * If DEVNAME names the device, and we get here, it
+	 * must have no fs and not be mountable. In this case,
+	 * we return the device itself.
+	 */
+	if (!strcmp(kd->kd_name, devname)) {
+		KASSERT(kd->kd_fs==NULL);
+		KASSERT(kd->kd_rawname==NULL);
+		KASSERT(kd->kd_device != NULL);
+		VOP_INCREF(kd->kd_vnode);
+		*ret = kd->kd_vnode;
+		*result = 0;
+		return true;
+	}
+
+	/*
+	 * If the device has a rawname and DEVNAME names that,
+	 * return the device itself.
+	 */
+	if (kd->kd_rawname!=NULL && !strcmp(kd->kd_rawname, devname)) {
+		KASSERT(kd->kd_device != NULL);
+		VOP_INCREF(kd->kd_vnode);
+		*ret = kd->kd_vnode;
+		*result = 0;
+		return true;
+	}
+
+	/*
+	 * If none of the above tests matched, we didn't name
+	 * any of the names of this device.
+	 */
+	return false;
+}
+
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
  * back an appropriate vnode.
@@ -199,68 +299,25 @@ vfs_getroot(const char *devname, struct vnode **ret)
 {
 	struct knowndev *kd;
 	unsigned i, num;
+	int result;
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
-	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
-
-		/*
-		 * If this device has a mounted filesystem, and
-		 * DEVNAME names either the filesystem or the device,
-		 * return the root of the filesystem.
-		 *
-		 * If it has no mounted filesystem, it's mountable,
-		 * and DEVNAME names the device, return ENXIO.
-		 */
-
-		if (kd->kd_fs != NULL && kd->kd_fs != SWAP_FS) {
-			const char *volname;
-			volname = FSOP_GETVOLNAME(kd->kd_fs);
+	num = knowndevvalarray_num(knowndevs);
 
-			if (!strcmp(kd->kd_name, devname) ||
-			    (volname!=NULL && !strcmp(volname, devname))) {
-				return FSOP_GETROOT(kd->kd_fs, ret);
-			}
-		}
-		else {
-			if (kd->kd_rawname!=NULL &&
-			    !strcmp(kd->kd_name, devname)) {
-				return ENXIO;
-			}
-		}
+	if (getroot_mru != NO_MRU && getroot_mru < num &&
+	    getroot_trydev(knowndevvalarray_get(knowndevs, getroot_mru),
+			   devname, ret, &result)) {
+		return result;
+	}
 
-		/*
-		 * If DEVNAME names the device, and we get here, it
-		 * must have no fs and not be mountable. In this case,
-		 * we return the device itself.
-		 */
-		if (!strcmp(kd->kd_name, devname)) {
-			KASSERT(kd->kd_fs==NULL);
-			KASSERT(kd->kd_rawname==NULL);
-			KASSERT(kd->kd_device != NULL);
-			VOP_INCREF(kd->kd_vnode);
-			*ret = kd->kd_vnode;
-			return 0;
-		}
+	for (i=0; i<num; i++) {
+		kd = knowndevvalarray_get(knowndevs, i);
 
-		/*
-		 * If the device has a rawname and DEVNAME names that,
-		 * return the device itself.
-		 */
-		if (kd->kd_rawname!=NULL && !strcmp(kd->kd_rawname, devname)) {
-			KASSERT(kd->kd_device != NULL);
-			VOP_INCREF(kd->kd_vnode);
-			*ret = kd->kd_vnode;
-			return 0;
+		if (getroot_trydev(kd, devname, ret, &result)) {
+			getroot_mru = i;
+			return result;
 		}
-
-		/*
-		 * If none of the above tests matched, we didn't name
-		 * any of the names of this device, so go on to the
-		 * next one.
-		 */
 	}
 
 	/*
@@ -283,9 +340,9 @@ vfs_getdevname(struct fs *fs)
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevvalarray_num(knowndevs);
 	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
+		kd = knowndevvalarray_get(knowndevs, i);
 
 		if (kd->kd_fs == fs) {
 			/*
@@ -360,9 +417,9 @@ badnames(const char *n1, const char *n2, const char *n3)
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevvalarray_num(knowndevs);
 	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
+		kd = knowndevvalarray_get(knowndevs, i);
 
 		if (kd->kd_fs != NULL && kd->kd_fs != SWAP_FS) {
 			volname = FSOP_GETVOLNAME(kd->kd_fs);
@@ -392,7 +449,7 @@ int
 vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 {
 	char *name=NULL, *rawname=NULL;
-	struct knowndev *kd=NULL;
+	struct knowndev kd;
 	struct vnode *vnode=NULL;
 	const char *volname=NULL;
 	unsigned index;
@@ -422,17 +479,11 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		goto fail;
 	}
 
-	kd = kmalloc(sizeof(struct knowndev));
-	if (kd==NULL) {
-		result = ENOMEM;
-		goto fail;
-	}
-
-	kd->kd_name = name;
-	kd->kd_rawname = rawname;
-	kd->kd_device = dev;
-	kd->kd_vnode = vnode;
-	kd->kd_fs = fs;
+	kd.kd_name = name;
+	kd.kd_rawname = rawname;
+	kd.kd_device = dev;
+	kd.kd_vnode = vnode;
+	kd.kd_fs = fs;
 
 	if (fs!=NULL) {
 		volname = FSOP_GETVOLNAME(fs);
@@ -443,7 +494,8 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		goto fail;
 	}
 
-	result = knowndevarray_add(knowndevs, kd, &index);
+	/* copies KD into the table */
+	result = knowndevvalarray_add(knowndevs, &kd, &index);
 	if (result) {
 		goto fail;
 	}
@@ -466,9 +518,6 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	if (vnode) {
 		dev_uncreate_vnode(vnode);
 	}
-	if (kd) {
-		kfree(kd);
-	}
 
 	vfs_biglock_release();
 	return result;
@@ -500,6 +549,10 @@ vfs_addfs(const char *devname, struct fs *fs)
 /*
  * Look for a mountable device named DEVNAME.
  * Should already hold knowndevs_lock.
+ *
+ * The pointer handed back points into the device table and is good
+ * only until the next vfs_doadd; callers use it within one biglock
+ * critical section, during which no devices are added.
  */
 static
 int
@@ -511,9 +564,9 @@ findmount(const char *devname, struct knowndev **result)
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
+	num = knowndevvalarray_num(knowndevs);
 	for (i=0; !found && i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
+		dev = knowndevvalarray_get(knowndevs, i);
 		if (dev->kd_rawname==NULL) {
 			/* not mountable/unmountable */
 			continue;
@@ -654,6 +707,9 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* drop cached lookups; they hold references to vnodes */
+	vfs_namecache_purge();
+
 	/* sync the fs */
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
@@ -726,9 +782,12 @@ vfs_unmountall(void)
 
 	vfs_biglock_acquire();
 
-	num = knowndevarray_num(knowndevs);
+	/* drop cached lookups; they hold references to vnodes */
+	vfs_namecache_purge();
+
+	num = knowndevvalarray_num(knowndevs);
 	for (i=0; i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
+		dev = knowndevvalarray_get(knowndevs, i);
 		if (dev->kd_rawname == NULL) {
 			/* not mountable/unmountable */
 			continue;
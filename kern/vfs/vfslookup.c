@@ -42,6 +42,146 @@
 
 static struct vnode *bootfs_vnode = NULL;
 
+/*
+ * Name lookup cache.
+ *
+ * Some paths get looked up constantly (the console device, the
+ * shell's binaries), and each lookup otherwise goes all the way into
+ * the filesystem via VOP_LOOKUP. We remember recent translations of
+ * (start vnode, remaining path) to the resulting vnode, including
+ * negative results, so repeated lookups skip the filesystem entirely.
+ *
+ * Component iteration lives inside each filesystem in this VFS, so
+ * the cache is keyed on the whole path relative to the start vnode
+ * rather than per component. Cached vnodes (and start vnodes) are
+ * referenced, so the cache is purged - wholesale; entries are few and
+ * mutations rare - whenever the namespace changes and before
+ * unmounting. Everything here runs under vfs_biglock.
+ */
+
+#define NAMECACHE_ENTRIES	32
+#define NAMECACHE_PATHMAX	64
+
+struct nc_entry {
+	struct vnode *nce_start;	/* start vnode, referenced; */
+					/*   NULL = entry unused */
+	struct vnode *nce_vn;		/* result, referenced; */
+					/*   NULL = negative entry */
+	unsigned nce_stamp;		/* LRU timestamp */
+	char nce_path[NAMECACHE_PATHMAX]; /* path relative to nce_start */
+};
+
+static struct nc_entry namecache[NAMECACHE_ENTRIES];
+static unsigned namecache_nextstamp;
+
+/*
+ * Look for a cached translation of PATH relative to STARTVN.
+ */
+static
+struct nc_entry *
+namecache_find(struct vnode *startvn, const char *path)
+{
+	struct nc_entry *nce;
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (i=0; i<NAMECACHE_ENTRIES; i++) {
+		nce = &namecache[i];
+		if (nce->nce_start == startvn &&
+		    !strcmp(nce->nce_path, path)) {
+			nce->nce_stamp = ++namecache_nextstamp;
+			return nce;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Drop an entry's references and mark it unused.
+ */
+static
+void
+namecache_evict(struct nc_entry *nce)
+{
+	KASSERT(nce->nce_start != NULL);
+
+	VOP_DECREF(nce->nce_start);
+	if (nce->nce_vn != NULL) {
+		VOP_DECREF(nce->nce_vn);
+	}
+	nce->nce_start = NULL;
+	nce->nce_vn = NULL;
+}
+
+/*
+ * Remember that PATH relative to STARTVN resolves to VN, or (if VN is
+ * NULL) doesn't resolve. Overlong paths just aren't cached.
+ */
+static
+void
+namecache_enter(struct vnode *startvn, const char *path, struct vnode *vn)
+{
+	struct nc_entry *nce, *victim;
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (strlen(path) >= NAMECACHE_PATHMAX) {
+		return;
+	}
+
+	victim = NULL;
+	for (i=0; i<NAMECACHE_ENTRIES; i++) {
+		nce = &namecache[i];
+		if (nce->nce_start == NULL) {
+			victim = nce;
+			break;
+		}
+		if (nce->nce_start == startvn &&
+		    !strcmp(nce->nce_path, path)) {
+			/* Same key; replace in place. */
+			namecache_evict(nce);
+			victim = nce;
+			break;
+		}
+		if (victim == NULL || nce->nce_stamp < victim->nce_stamp) {
+			victim = nce;
+		}
+	}
+	if (victim->nce_start != NULL) {
+		namecache_evict(victim);
+	}
+
+	VOP_INCREF(startvn);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	victim->nce_start = startvn;
+	victim->nce_vn = vn;
+	victim->nce_stamp = ++namecache_nextstamp;
+	strcpy(victim->nce_path, path);
+}
+
+/*
+ * Throw the whole cache away. Called whenever the namespace changes
+ * (create, remove, rename, ...) and before unmounting, since cached
+ * entries hold vnode references.
+ */
+void
+vfs_namecache_purge(void)
+{
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (i=0; i<NAMECACHE_ENTRIES; i++) {
+		if (namecache[i].nce_start != NULL) {
+			namecache_evict(&namecache[i]);
+		}
+	}
+}
+
 /*
  * Helper function for actually changing bootfs_vnode.
  */
@@ -276,6 +416,7 @@ int
 vfs_lookup(char *path, struct vnode **retval)
 {
 	struct vnode *startvn;
+	struct nc_entry *nce;
 	int result;
 
 	vfs_biglock_acquire();
@@ -292,9 +433,100 @@ vfs_lookup(char *path, struct vnode **retval)
 		return 0;
 	}
 
+	nce = namecache_find(startvn, path);
+	if (nce != NULL) {
+		if (nce->nce_vn == NULL) {
+			/* Cached negative result */
+			result = ENOENT;
+		}
+		else {
+			VOP_INCREF(nce->nce_vn);
+			*retval = nce->nce_vn;
+			result = 0;
+		}
+		VOP_DECREF(startvn);
+		vfs_biglock_release();
+		return result;
+	}
+
 	result = VOP_LOOKUP(startvn, path, retval);
+	if (result == 0) {
+		namecache_enter(startvn, path, *retval);
+	}
+	else if (result == ENOENT) {
+		namecache_enter(startvn, path, NULL);
+	}
 
 	VOP_DECREF(startvn);
 	vfs_biglock_release();
 	return result;
 }
+
+/*
+ * Like vfs_lookup, but resolve PATH relative to STARTVN, an
+ * already-open directory, instead of consuming a device prefix and
+ * starting from the cwd or a root. Used by openat(): a program
+ * opening many names under one directory skips re-walking the shared
+ * prefix every time. The caller keeps its reference to STARTVN.
+ */
+int
+vfs_lookup_at(struct vnode *startvn, char *path, struct vnode **retval)
+{
+	struct nc_entry *nce;
+	int result;
+
+	vfs_biglock_acquire();
+
+	if (strlen(path) == 0) {
+		vfs_biglock_release();
+		return EINVAL;
+	}
+
+	nce = namecache_find(startvn, path);
+	if (nce != NULL) {
+		if (nce->nce_vn == NULL) {
+			/* Cached negative result */
+			result = ENOENT;
+		}
+		else {
+			VOP_INCREF(nce->nce_vn);
+			*retval = nce->nce_vn;
+			result = 0;
+		}
+		vfs_biglock_release();
+		return result;
+	}
+
+	result = VOP_LOOKUP(startvn, path, retval);
+	if (result == 0) {
+		namecache_enter(startvn, path, *retval);
+	}
+	else if (result == ENOENT) {
+		namecache_enter(startvn, path, NULL);
+	}
+
+	vfs_biglock_release();
+	return result;
+}
+
+/*
+ * Likewise for vfs_lookparent.
+ */
+int
+vfs_lookparent_at(struct vnode *startvn, char *path, struct vnode **retval,
+		  char *buf, size_t buflen)
+{
+	int result;
+
+	vfs_biglock_acquire();
+
+	if (strlen(path) == 0) {
+		result = EINVAL;
+	}
+	else {
+		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
+	}
+
+	vfs_biglock_release();
+	return result;
+}
@@ -43,6 +43,19 @@
 /* Does most of the work for open(). */
 int
 vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
+{
+	return vfs_openat(NULL, path, openflags, mode, ret);
+}
+
+/*
+ * Like vfs_open, but when STARTDIR is not NULL, PATH is resolved
+ * relative to it (see vfs_lookup_at) instead of via the device prefix
+ * and current directory rules. Does most of the work for openat().
+ * STARTDIR's reference stays with the caller.
+ */
+int
+vfs_openat(struct vnode *startdir, char *path, int openflags, mode_t mode,
+	   struct vnode **ret)
 {
 	int how;
 	int result;
@@ -68,7 +81,10 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		struct vnode *dir;
 		int excl = (openflags & O_EXCL)!=0;
 
-		result = vfs_lookparent(path, &dir, name, sizeof(name));
+		result = startdir == NULL ?
+			vfs_lookparent(path, &dir, name, sizeof(name)) :
+			vfs_lookparent_at(startdir, path, &dir, name,
+					  sizeof(name));
 		if (result) {
 			return result;
 		}
@@ -76,9 +92,17 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
 
 		VOP_DECREF(dir);
+
+		if (result == 0) {
+			/* May have created a name; drop cached lookups. */
+			vfs_biglock_acquire();
+			vfs_namecache_purge();
+			vfs_biglock_release();
+		}
 	}
 	else {
-		result = vfs_lookup(path, &vn);
+		result = startdir == NULL ? vfs_lookup(path, &vn) :
+			vfs_lookup_at(startdir, path, &vn);
 	}
 
 	if (result) {
@@ -148,6 +172,12 @@ vfs_remove(char *path)
 	result = VOP_REMOVE(dir, name);
 	VOP_DECREF(dir);
 
+	if (result == 0) {
+		vfs_biglock_acquire();
+		vfs_namecache_purge();
+		vfs_biglock_release();
+	}
+
 	return result;
 }
 
@@ -183,6 +213,12 @@ vfs_rename(char *oldpath, char *newpath)
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
 
+	if (result == 0) {
+		vfs_biglock_acquire();
+		vfs_namecache_purge();
+		vfs_biglock_release();
+	}
+
 	return result;
 }
 
@@ -217,6 +253,12 @@ vfs_link(char *oldpath, char *newpath)
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
 
+	if (result == 0) {
+		vfs_biglock_acquire();
+		vfs_namecache_purge();
+		vfs_biglock_release();
+	}
+
 	return result;
 }
 
@@ -242,6 +284,12 @@ vfs_symlink(const char *contents, char *path)
 	result = VOP_SYMLINK(newdir, newname, contents);
 	VOP_DECREF(newdir);
 
+	if (result == 0) {
+		vfs_biglock_acquire();
+		vfs_namecache_purge();
+		vfs_biglock_release();
+	}
+
 	return result;
 }
 
@@ -289,6 +337,12 @@ vfs_mkdir(char *path, mode_t mode)
 
 	VOP_DECREF(parent);
 
+	if (result == 0) {
+		vfs_biglock_acquire();
+		vfs_namecache_purge();
+		vfs_biglock_release();
+	}
+
 	return result;
 }
 
@@ -311,6 +365,12 @@ vfs_rmdir(char *path)
 
 	VOP_DECREF(parent);
 
+	if (result == 0) {
+		vfs_biglock_acquire();
+		vfs_namecache_purge();
+		vfs_biglock_release();
+	}
+
 	return result;
 }
 
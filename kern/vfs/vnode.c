@@ -32,8 +32,13 @@
  */
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/poll.h>
+#include <kern/stattypes.h>
 #include <lib.h>
+#include <atomic.h>
+#include <uio.h>
 #include <synch.h>
+#include <vm.h>
 #include <vfs.h>
 #include <vnode.h>
 
@@ -49,9 +54,11 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 
 	vn->vn_ops = ops;
 	vn->vn_refcount = 1;
-	spinlock_init(&vn->vn_countlock);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
+	spinlock_init(&vn->vn_statlock);
+	vn->vn_statvalid = false;
+	vn->vn_statgen = 0;
 	return 0;
 }
 
@@ -63,15 +70,27 @@ vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
 
-	spinlock_cleanup(&vn->vn_countlock);
-
 	vn->vn_ops = NULL;
 	vn->vn_refcount = 0;
 	vn->vn_fs = NULL;
 	vn->vn_data = NULL;
+	spinlock_cleanup(&vn->vn_statlock);
 }
 
 
+/*
+ * The reference count is maintained lock-free with compare-and-swap,
+ * so refcount traffic on hot vnodes (the console, the root directory)
+ * doesn't bounce a spinlock cacheline between CPUs. The only subtle
+ * case is the transition away from 1: vnode_decref doesn't decrement
+ * then, but passes its reference to VOP_RECLAIM, whose implementation
+ * rechecks the count with vnode_tryreclaim below while holding the
+ * lock that protects the filesystem's vnode table. Any reference that
+ * appears out of thin air (rather than being copied from an existing
+ * one) comes from that table under that lock, so once vnode_tryreclaim
+ * sees a count of 1 it can't rise again.
+ */
+
 /*
  * Increment refcount.
  * Called by VOP_INCREF.
@@ -79,11 +98,12 @@ vnode_cleanup(struct vnode *vn)
 void
 vnode_incref(struct vnode *vn)
 {
+	uint32_t count;
+
 	KASSERT(vn != NULL);
 
-	spinlock_acquire(&vn->vn_countlock);
-	vn->vn_refcount++;
-	spinlock_release(&vn->vn_countlock);
+	count = atomic_fetch_add(&vn->vn_refcount, 1);
+	KASSERT(count > 0);
 }
 
 /*
@@ -94,30 +114,60 @@ vnode_incref(struct vnode *vn)
 void
 vnode_decref(struct vnode *vn)
 {
-	bool destroy;
+	uint32_t count;
 	int result;
 
 	KASSERT(vn != NULL);
 
-	spinlock_acquire(&vn->vn_countlock);
-
-	KASSERT(vn->vn_refcount > 0);
-	if (vn->vn_refcount > 1) {
-		vn->vn_refcount--;
-		destroy = false;
-	}
-	else {
-		/* Don't decrement; pass the reference to VOP_RECLAIM. */
-		destroy = true;
+	for (;;) {
+		count = atomic_load_acquire(&vn->vn_refcount);
+		KASSERT(count > 0);
+		if (count == 1) {
+			/*
+			 * Don't decrement; pass the reference to
+			 * VOP_RECLAIM, which rechecks under the
+			 * filesystem's table lock.
+			 */
+			result = VOP_RECLAIM(vn);
+			if (result != 0 && result != EBUSY) {
+				// XXX: lame.
+				kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
+					strerror(result));
+			}
+			return;
+		}
+		if (atomic_cas(&vn->vn_refcount, count, count-1)
+		    == count) {
+			return;
+		}
 	}
-	spinlock_release(&vn->vn_countlock);
+}
 
-	if (destroy) {
-		result = VOP_RECLAIM(vn);
-		if (result != 0 && result != EBUSY) {
-			// XXX: lame.
-			kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
-				strerror(result));
+/*
+ * Called at the top of VOP_RECLAIM implementations, with the lock
+ * protecting the filesystem's vnode table held. Returns true if the
+ * caller holds the last reference and should go ahead and destroy the
+ * vnode; otherwise someone picked the vnode up again since the
+ * decision to reclaim was made, so consume the reference VOP_DECREF
+ * passed in and return false (the caller should return EBUSY).
+ */
+bool
+vnode_tryreclaim(struct vnode *vn)
+{
+	uint32_t count;
+
+	KASSERT(vn != NULL);
+
+	for (;;) {
+		count = atomic_load_acquire(&vn->vn_refcount);
+		KASSERT(count > 0);
+		if (count == 1) {
+			/* Don't decrement; the caller destroys the vnode. */
+			return true;
+		}
+		if (atomic_cas(&vn->vn_refcount, count, count-1)
+		    == count) {
+			return false;
 		}
 	}
 }
@@ -159,20 +209,321 @@ vnode_check(struct vnode *v, const char *opstr)
 		panic("vnode_check: vop_%s: deadbeef fs pointer\n", opstr);
 	}
 
-	spinlock_acquire(&v->vn_countlock);
+	{
+		uint32_t count;
+
+		count = atomic_load_acquire(&v->vn_refcount);
+		if (count == 0) {
+			panic("vnode_check: vop_%s: zero refcount\n", opstr);
+		}
+		else if (count > 0x100000) {
+			kprintf("vnode_check: vop_%s: warning: "
+				"large refcount %u\n", opstr, count);
+		}
+	}
+	/*vfs_biglock_release();*/
+}
+
+/*
+ * Attribute cache.
+ *
+ * vnode_stat answers VOP_STAT from a per-vnode copy of the last stat
+ * block, so repeated stats of the same file (directory listings,
+ * file-size checks) cost a spinlock and a copy instead of a trip
+ * into the filesystem -- which for sfs can mean disk I/O and for
+ * netfs a round trip to the server.
+ *
+ * Invalidation is a generation bump. A filling vnode_stat records the
+ * generation before calling into the filesystem and only installs the
+ * result if the generation is unchanged, so a stat that raced with a
+ * write can't re-cache the pre-write attributes after the writer has
+ * invalidated. The operation wrappers below invalidate after the
+ * operation for the same reason.
+ */
 
-	if (v->vn_refcount < 0) {
-		panic("vnode_check: vop_%s: negative refcount %d\n", opstr,
-		      v->vn_refcount);
+int
+vnode_stat(struct vnode *vn, struct stat *statbuf)
+{
+	struct stat st;
+	unsigned gen;
+	int result;
+
+	spinlock_acquire(&vn->vn_statlock);
+	if (vn->vn_statvalid) {
+		*statbuf = vn->vn_statcache;
+		spinlock_release(&vn->vn_statlock);
+		return 0;
 	}
-	else if (v->vn_refcount == 0) {
-		panic("vnode_check: vop_%s: zero refcount\n", opstr);
+	gen = vn->vn_statgen;
+	spinlock_release(&vn->vn_statlock);
+
+	result = __VOP(vn, stat)(vn, &st);
+	if (result) {
+		return result;
 	}
-	else if (v->vn_refcount > 0x100000) {
-		kprintf("vnode_check: vop_%s: warning: large refcount %d\n",
-			opstr, v->vn_refcount);
+
+	spinlock_acquire(&vn->vn_statlock);
+	if (vn->vn_statgen == gen) {
+		vn->vn_statcache = st;
+		vn->vn_statvalid = true;
 	}
+	spinlock_release(&vn->vn_statlock);
 
-	spinlock_release(&v->vn_countlock);
-	/*vfs_biglock_release();*/
+	*statbuf = st;
+	return 0;
+}
+
+void
+vnode_statinvalidate(struct vnode *vn)
+{
+	spinlock_acquire(&vn->vn_statlock);
+	vn->vn_statvalid = false;
+	vn->vn_statgen++;
+	spinlock_release(&vn->vn_statlock);
+}
+
+/*
+ * Read the invalidation generation. Since every write and truncate
+ * invalidates, a caller that caches something derived from a file's
+ * contents can store the generation alongside and recheck it to tell
+ * whether its copy may be stale.
+ */
+unsigned
+vnode_statgen(struct vnode *vn)
+{
+	unsigned gen;
+
+	spinlock_acquire(&vn->vn_statlock);
+	gen = vn->vn_statgen;
+	spinlock_release(&vn->vn_statlock);
+
+	return gen;
+}
+
+/*
+ * Read through the file page cache (vm_pagecache_* in vm.c).
+ *
+ * Reads of regular files are served page by page out of the same
+ * frames vm_fault maps for demand-paged executables, so a block that
+ * is both read and mapped is cached once, and a re-read of cached
+ * data involves no filesystem call and no buffer-cache copy - just a
+ * uiomove straight from the frame, with no filesystem lock held.
+ *
+ * EOF comes from the stat cache, so the filesystem's own read path
+ * only runs to fill missing pages (whole pages, with kernel uios).
+ * Objects that aren't seekable regular files - devices, pipes,
+ * sockets, semaphores - are passed through untouched. Stale pages
+ * are caught by the generation check inside the page cache.
+ */
+
+/*
+ * Fill a fresh frame with the page of VN at PAGEOFF (clipped to
+ * SIZE) and enter it in the page cache. The caller inherits our page
+ * reference.
+ */
+static
+int
+vnode_read_fillpage(struct vnode *vn, off_t pageoff, off_t size,
+		    unsigned *pfn_ret)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t kva;
+	size_t len;
+	unsigned pfn;
+	int result;
+
+	pfn = alloc_upage_zeroed(NULL, 0);
+	if (pfn == 0) {
+		return ENOMEM;
+	}
+	kva = PADDR_TO_KVADDR(idx_to_pa(pfn));
+
+	len = PAGE_SIZE;
+	if ((off_t)len > size - pageoff) {
+		len = size - pageoff;
+	}
+
+	uio_kinit(&iov, &ku, (void *)kva, len, pageoff, UIO_READ);
+	result = __VOP(vn, read)(vn, &ku);
+	if (result) {
+		free_upage(pfn);
+		return result;
+	}
+	/*
+	 * A short read means the file shrank since we stat'd it; the
+	 * rest of the frame is zeros, and the caller's EOF clipping
+	 * keeps them from being handed out.
+	 */
+
+	vm_pagecache_insert(vn, pageoff, pfn);
+	*pfn_ret = pfn;
+	return 0;
+}
+
+int
+vnode_read(struct vnode *vn, struct uio *uio)
+{
+	struct stat st;
+	unsigned pfn;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	if (!VOP_ISSEEKABLE(vn)) {
+		return __VOP(vn, read)(vn, uio);
+	}
+	result = vnode_stat(vn, &st);
+	if (result || (st.st_mode & _S_IFMT) != _S_IFREG) {
+		return __VOP(vn, read)(vn, uio);
+	}
+
+	while (uio->uio_resid > 0 && uio->uio_offset < st.st_size) {
+		off_t pageoff = uio->uio_offset & ~(off_t)(PAGE_SIZE - 1);
+		size_t skip = uio->uio_offset - pageoff;
+		size_t len = PAGE_SIZE - skip;
+		vaddr_t kva;
+
+		if ((off_t)len > st.st_size - uio->uio_offset) {
+			len = st.st_size - uio->uio_offset;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+
+		if (!vm_pagecache_get(vn, pageoff, &pfn)) {
+			result = vnode_read_fillpage(vn, pageoff,
+						     st.st_size, &pfn);
+			if (result) {
+				return result;
+			}
+		}
+
+		kva = PADDR_TO_KVADDR(idx_to_pa(pfn));
+		result = uiomove((char *)kva + skip, len, uio);
+		free_upage(pfn);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* Whatever is left is past EOF; a short read says so. */
+	return 0;
+}
+
+/*
+ * Wrappers for the operations that change attributes. Each invalidates
+ * the cache of every vnode whose size, times, or link count the
+ * operation may have changed, even on error: a failed write may still
+ * have transferred some data.
+ */
+
+int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	int result;
+
+	result = __VOP(vn, write)(vn, uio);
+	vnode_statinvalidate(vn);
+	return result;
+}
+
+int
+vnode_truncate(struct vnode *vn, off_t len)
+{
+	int result;
+
+	result = __VOP(vn, truncate)(vn, len);
+	vnode_statinvalidate(vn);
+	return result;
+}
+
+int
+vnode_creat(struct vnode *dir, const char *name, bool excl, mode_t mode,
+	    struct vnode **result)
+{
+	int r;
+
+	r = __VOP(dir, creat)(dir, name, excl, mode, result);
+	vnode_statinvalidate(dir);
+	return r;
+}
+
+int
+vnode_symlink(struct vnode *dir, const char *contents, const char *name)
+{
+	int result;
+
+	result = __VOP(dir, symlink)(dir, contents, name);
+	vnode_statinvalidate(dir);
+	return result;
+}
+
+int
+vnode_mkdir(struct vnode *dir, const char *name, mode_t mode)
+{
+	int result;
+
+	result = __VOP(dir, mkdir)(dir, name, mode);
+	vnode_statinvalidate(dir);
+	return result;
+}
+
+int
+vnode_link(struct vnode *dir, const char *name, struct vnode *file)
+{
+	int result;
+
+	result = __VOP(dir, link)(dir, name, file);
+	vnode_statinvalidate(dir);
+	/* the target's link count changed too */
+	vnode_statinvalidate(file);
+	return result;
+}
+
+int
+vnode_remove(struct vnode *dir, const char *name)
+{
+	int result;
+
+	result = __VOP(dir, remove)(dir, name);
+	vnode_statinvalidate(dir);
+	return result;
+}
+
+int
+vnode_rmdir(struct vnode *dir, const char *name)
+{
+	int result;
+
+	result = __VOP(dir, rmdir)(dir, name);
+	vnode_statinvalidate(dir);
+	return result;
+}
+
+int
+vnode_rename(struct vnode *dir1, const char *name1,
+	     struct vnode *dir2, const char *name2)
+{
+	int result;
+
+	result = __VOP(dir1, rename)(dir1, name1, dir2, name2);
+	vnode_statinvalidate(dir1);
+	vnode_statinvalidate(dir2);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * VOP_POLL for objects that are always ready: regular files, and
+ * devices whose I/O completes without waiting for an outside event.
+ */
+int
+vnode_poll_generic(struct vnode *vn, int events, int *revents)
+{
+	(void)vn;
+
+	*revents = events & (POLLIN | POLLOUT);
+	return 0;
 }
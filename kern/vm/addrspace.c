@@ -32,21 +32,18 @@
 #include <lib.h>
 #include <spl.h>
 #include <cpu.h>
+#include <membar.h>
 #include <spinlock.h>
 #include <proc.h>
 #include <current.h>
 #include <mips/tlb.h>
+#include <mips/trapframe.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <mips/vm.h>
+#include <vnode.h>
 #include <syscall.h>
 
-/*
- * Note! If OPT_DUMBVM is set, as is the case until you start the VM
- * assignment, this file is not compiled or linked or in any way
- * used. The cheesy hack versions in dumbvm.c are used instead.
- */
-
 /*
  * Helper function to round up to the nearest page boundary
  */
@@ -57,13 +54,67 @@ page_align(vaddr_t addr)
 }
 
 /*
- * Allocate a second-level page table
+ * Find the region containing VADDR. The array is sorted by vbase, so
+ * this is a binary search; the one-entry last-hit cache in front
+ * makes the common case (faults clustering in one region) a single
+ * compare. Returns NULL if no region contains VADDR.
+ */
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *reg;
+	unsigned lo, hi, idx;
+
+	KASSERT(as != NULL);
+
+	if (as->nregions == 0) {
+		return NULL;
+	}
+
+	idx = as->as_lastreg;
+	if (idx < as->nregions) {
+		reg = &as->regions[idx];
+		if (vaddr >= reg->vbase &&
+		    vaddr < reg->vbase + reg->npages * PAGE_SIZE) {
+			return reg;
+		}
+	}
+
+	lo = 0;
+	hi = as->nregions;
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+
+		reg = &as->regions[mid];
+		if (vaddr < reg->vbase) {
+			hi = mid;
+		}
+		else if (vaddr >= reg->vbase + reg->npages * PAGE_SIZE) {
+			lo = mid + 1;
+		}
+		else {
+			as->as_lastreg = mid;
+			return reg;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Allocate a second-level page table.
+ *
+ * The PTE array comes from the address space's page-table arena:
+ * page-aligned, physically contiguous, and freed wholesale at
+ * as_destroy. One lock serves all 1024 entries of the node; the
+ * alternative, a lock per PTE, cost 1024 kmalloc'd locks per node
+ * on every fault that extended the table.
  */
 int
 pt_alloc_l2(struct addrspace *as, int l1_index)
 {
 	struct pte *alloc;
-	char lock_name[] = "pte_lock";
+	struct lock *l2lock;
 
 	KASSERT(as != NULL);
 	KASSERT(as->pt_l1 != NULL);
@@ -74,31 +125,32 @@ pt_alloc_l2(struct addrspace *as, int l1_index)
 		return 0; /* Already allocated */
 	}
 
-	/* Allocate memory for the L2 page table without holding the lock */
-	alloc = kmalloc(PT_L2_SIZE * sizeof(struct pte));
+	/* Allocate the node and its lock without holding the lock */
+	alloc = ptarena_alloc(as, PT_L2_SIZE * sizeof(struct pte));
 	if (alloc == NULL) {
 		return ENOMEM;
 	}
 
+	l2lock = lock_create("pte_lock");
+	if (l2lock == NULL) {
+		/* The node stays in the arena until as_destroy */
+		return ENOMEM;
+	}
+
+	/* Arena memory is not zeroed; initialize every field */
 	for (int i = 0; i < PT_L2_SIZE; i++) {
+		alloc[i].pte_fast = 0;
 		alloc[i].state = PTE_STATE_UNALLOC;
 		alloc[i].pfn = 0;
 		alloc[i].swap_slot = 0;
 		alloc[i].dirty = 0;
 		alloc[i].readonly = 0;
 		alloc[i].referenced = 0;
-
-		/* Create a lock for each page table entry */
-		//snprintf(lock_name, sizeof(lock_name), "pte_lock_%d_%d", l1_index, i);
-		alloc[i].pte_lock = lock_create(lock_name);
-		if (alloc[i].pte_lock == NULL) {
-			/* Clean up already allocated locks */
-			for (int j = 0; j < i; j++) {
-				lock_destroy(alloc[j].pte_lock);
-			}
-			kfree(alloc);
-			return ENOMEM;
-		}
+		alloc[i].cow = 0;
+		alloc[i].shm = 0;
+		alloc[i].wired = 0;
+		alloc[i].busy = 0;
+		alloc[i].pte_lock = l2lock;
 	}
 
 	/* Acquire lock and check if another thread beat us */
@@ -108,15 +160,18 @@ pt_alloc_l2(struct addrspace *as, int l1_index)
 		/* Another thread allocated this L2 table first */
 		spinlock_release(&as->pt_lock);
 
-		/* Clean up all locks and free the allocated memory */
-		for (int i = 0; i < PT_L2_SIZE; i++) {
-			lock_destroy(alloc[i].pte_lock);
-		}
-		kfree(alloc);
+		/* Give back the lock; the node retires in the arena */
+		lock_destroy(l2lock);
 
 		return 0;
 	}
 
+	/*
+	 * Publish the fully-initialized node. The barrier orders the
+	 * initialization above before the pointer store, so lock-free
+	 * readers in pt_get_pte never see a half-built node.
+	 */
+	membar_store_store();
 	as->pt_l1[l1_index] = alloc;
 
 	spinlock_release(&as->pt_lock);
@@ -146,8 +201,8 @@ pt_get_pte(struct addrspace *as, vaddr_t vaddr, bool create)
 			return NULL;
 		}
 
-		/* Allocate L1 table - don't hold lock */
-		l1ptr = kmalloc(PT_L1_SIZE * sizeof(struct pte *));
+		/* Allocate L1 table from the arena - don't hold lock */
+		l1ptr = ptarena_alloc(as, PT_L1_SIZE * sizeof(struct pte *));
 		if (l1ptr == NULL) {
 			return NULL;
 		}
@@ -160,14 +215,18 @@ pt_get_pte(struct addrspace *as, vaddr_t vaddr, bool create)
 		spinlock_acquire(&as->pt_lock);
 
 		if (as->pt_l1 != NULL) {
-			/* Another thread created the L1 table first */
+			/*
+			 * Another thread created the L1 table first;
+			 * ours retires in the arena.
+			 */
 			spinlock_release(&as->pt_lock);
-			kfree(l1ptr);
 
 			/* Try again with the new L1 table */
 			return pt_get_pte(as, vaddr, create);
 		}
 
+		/* Publish only after the NULL-fill above (see pt_alloc_l2) */
+		membar_store_store();
 		as->pt_l1 = l1ptr;
 
 		spinlock_release(&as->pt_lock);
@@ -186,28 +245,23 @@ pt_get_pte(struct addrspace *as, vaddr_t vaddr, bool create)
 	}
 
 	/*
-	 * We still need to use the spinlock to safely access the L1 table,
-	 * but afterwards we can use the individual PTE lock for the specific entry
+	 * Lock-free lookup. An L2 pointer, once published, never
+	 * changes until as_destroy tears the whole table down, and the
+	 * publishers above issue a store barrier before the pointer
+	 * store, so reading it and dereferencing (a dependent load)
+	 * is safe without as->pt_lock. This keeps resident-page
+	 * faults - the overwhelming majority in steady state - off
+	 * every shared lock except the node's own PTE lock, which the
+	 * caller takes to modify the entry.
 	 */
-	spinlock_acquire(&as->pt_lock);
+	struct pte *l2 = as->pt_l1[l1_index];
 
-	/* Double check that the L2 table exists after acquiring the lock */
-	if (as->pt_l1[l1_index] == NULL) {
+	if (l2 == NULL) {
 		/* Something went wrong - the L2 table should exist by now */
-		spinlock_release(&as->pt_lock);
 		return NULL;
 	}
 
-	struct pte *pte = &as->pt_l1[l1_index][l2_index];
-
-	/* Note that we don't acquire the PTE lock here
-	 * This function only returns the PTE, it doesn't modify it
-	 * The caller should acquire the PTE lock if it needs to modify the PTE
-	 */
-
-	spinlock_release(&as->pt_lock);
-
-	return pte;
+	return &l2[l2_index];
 }
 
 /*
@@ -225,9 +279,22 @@ as_create(void)
 
 	as->pt_l1 = NULL;
 	as->regions = NULL;
+	as->nregions = 0;
+	as->regionsmax = 0;
+	as->as_lastreg = 0;
 	as->heap_start = 0;
 	as->heap_end = 0;
+	as->as_stackbase = 0;
 	spinlock_init(&as->pt_lock);
+	bzero(as->as_asid, sizeof(as->as_asid));
+	as->as_ptchunks = NULL;
+	as->as_faults = 0;
+	as->as_cowfaults = 0;
+	as->as_swapins = 0;
+	as->as_evictions = 0;
+	as->as_swapslots = 0;
+	as->as_commit = 0;
+	as->as_wiredpages = 0;
 
 	return as;
 }
@@ -239,7 +306,6 @@ int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *new;
-	struct region *old_region, *new_region, *prev_region;
 
 	new = as_create();
 	if (new == NULL) {
@@ -248,37 +314,42 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 
 	new->heap_start = old->heap_start;
 	new->heap_end = old->heap_end;
+	new->as_stackbase = old->as_stackbase;
 
-	/* Copy regions */
-	prev_region = NULL;
-	for (old_region = old->regions; old_region != NULL; old_region = old_region->next) {
-		new_region = kmalloc(sizeof(struct region));
+	/*
+	 * Charge the child's whole image against the commit limit up
+	 * front, so an overcommitted fork fails here with ENOMEM
+	 * rather than dying in the fault path after the COW split.
+	 */
+	if (vm_commit_charge(old->as_commit)) {
+		as_destroy(new);
+		return ENOMEM;
+	}
+	new->as_commit = old->as_commit;
 
-		if (new_region == NULL) {
+	/* Copy the region array wholesale; it's already sorted */
+	if (old->nregions > 0) {
+		new->regions = kmalloc(old->nregions * sizeof(struct region));
+		if (new->regions == NULL) {
 			as_destroy(new);
 			return ENOMEM;
 		}
-
-		new_region->vbase = old_region->vbase;
-		new_region->npages = old_region->npages;
-		new_region->readable = old_region->readable;
-		new_region->writeable = old_region->writeable;
-		new_region->executable = old_region->executable;
-		new_region->next = NULL;
-
-		if (prev_region == NULL) {
-			new->regions = new_region;
-		} else {
-			prev_region->next = new_region;
+		memcpy(new->regions, old->regions,
+		       old->nregions * sizeof(struct region));
+		new->nregions = old->nregions;
+		new->regionsmax = old->nregions;
+
+		for (unsigned r = 0; r < new->nregions; r++) {
+			if (new->regions[r].backing_vn != NULL) {
+				VOP_INCREF(new->regions[r].backing_vn);
+			}
 		}
-
-		prev_region = new_region;
 	}
 
 	/* Copy page tables */
 	if (old->pt_l1 != NULL) {
 		/* Allocate L1 page table */
-		new->pt_l1 = kmalloc(PT_L1_SIZE * sizeof(struct pte *));
+		new->pt_l1 = ptarena_alloc(new, PT_L1_SIZE * sizeof(struct pte *));
 		if (new->pt_l1 == NULL) {
 			as_destroy(new);
 			return ENOMEM;
@@ -298,49 +369,73 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 					return result;
 				}
 
+				/*
+				 * One lock covers each whole L2 node;
+				 * take both once for the node rather
+				 * than per entry.
+				 */
+				struct lock *oldlock =
+					old->pt_l1[i][0].pte_lock;
+				struct lock *newlock =
+					new->pt_l1[i][0].pte_lock;
+
+				lock_acquire(oldlock);
+				lock_acquire(newlock);
+
 				/* Copy page table entries */
 				for (int j = 0; j < PT_L2_SIZE; j++) {
 					struct pte *old_pte = &old->pt_l1[i][j];
 					struct pte *new_pte = &new->pt_l1[i][j];
 
-					/* Lock both old and new PTEs while copying */
-					lock_acquire(old_pte->pte_lock);
-					lock_acquire(new_pte->pte_lock);
-
 					KASSERT(new_pte->state == PTE_STATE_UNALLOC);
 
 					if (old_pte->state == PTE_STATE_RAM) {
-						unsigned idx = alloc_upage(new, i * PT_L2_SIZE * PAGE_SIZE + j * PAGE_SIZE);
-						if (idx == 0) {
-							/* Release locks before destroying the address space */
-							lock_release(new_pte->pte_lock);
-							lock_release(old_pte->pte_lock);
-							as_destroy(new);
-							return ENOMEM;
-						}
-
-						new_pte->state = old_pte->state;
+						/*
+						 * Share the frame copy-on-write
+						 * instead of duplicating it.
+						 * Writable pages get the cow
+						 * bit in both spaces so the
+						 * next write fault copies;
+						 * read-only pages are shared
+						 * outright. Shared-memory
+						 * pages stay writable and
+						 * shared in both spaces.
+						 */
+						vm_page_incref(old_pte->pfn);
+
+						new_pte->state = PTE_STATE_RAM;
+						new_pte->pfn = old_pte->pfn;
 						new_pte->readonly = old_pte->readonly;
 						new_pte->referenced = old_pte->referenced;
-
-						paddr_t pa_old = old_pte->pfn * PAGE_SIZE;
-						vaddr_t kv_old = PADDR_TO_KVADDR(pa_old);
-
-						paddr_t pa_new = idx_to_pa(idx);
-						vaddr_t kv_new = PADDR_TO_KVADDR(pa_new);
-
-						memmove((void*)kv_new, (void*)kv_old, PAGE_SIZE);
-
-						new_pte->pfn = idx;
 						new_pte->dirty = old_pte->dirty;
+						new_pte->shm = old_pte->shm;
+
+						if (!old_pte->readonly &&
+						    !old_pte->shm) {
+							old_pte->cow = 1;
+							new_pte->cow = 1;
+						}
+						pte_sync_fast(old_pte);
+						pte_sync_fast(new_pte);
 					}
 					else if (old_pte->state == PTE_STATE_SWAP) {
+						/*
+						 * The entry may be mid
+						 * page-in on another
+						 * thread (old_pte->busy);
+						 * that's fine: the slot
+						 * can't be freed while we
+						 * hold the node's lock,
+						 * and reading it races
+						 * nothing.
+						 */
+
 						/* Allocate a new swap slot for the page */
 						unsigned new_swap_idx;
 						int result = swap_alloc(&new_swap_idx);
 						if (result) {
-							lock_release(new_pte->pte_lock);
-							lock_release(old_pte->pte_lock);
+							lock_release(newlock);
+							lock_release(oldlock);
 							as_destroy(new);
 							return ENOMEM;
 						}
@@ -349,8 +444,8 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 						unsigned idx = alloc_upage(new, i * PT_L2_SIZE * PAGE_SIZE + j * PAGE_SIZE);
 						if (idx == 0) {
 							swap_free(new_swap_idx);
-							lock_release(new_pte->pte_lock);
-							lock_release(old_pte->pte_lock);
+							lock_release(newlock);
+							lock_release(oldlock);
 							as_destroy(new);
 							return ENOMEM;
 						}
@@ -360,8 +455,8 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 						if (result) {
 							free_upage(idx);
 							swap_free(new_swap_idx);
-							lock_release(new_pte->pte_lock);
-							lock_release(old_pte->pte_lock);
+							lock_release(newlock);
+							lock_release(oldlock);
 							as_destroy(new);
 							return result;
 						}
@@ -370,8 +465,8 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 						if (result) {
 							free_upage(idx);
 							swap_free(new_swap_idx);
-							lock_release(new_pte->pte_lock);
-							lock_release(old_pte->pte_lock);
+							lock_release(newlock);
+							lock_release(oldlock);
 							as_destroy(new);
 							return result;
 						}
@@ -383,20 +478,33 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 						new_pte->readonly = old_pte->readonly;
 						new_pte->swap_slot = new_swap_idx;
 						new_pte->referenced = 0;
+						new->as_swapslots++;
 					}
 					else if (old_pte->state == PTE_STATE_ZERO) {
 						new_pte->state = PTE_STATE_ZERO;
 						new_pte->readonly = old_pte->readonly;
 					}
 
-					/* Release the locks */
-					lock_release(new_pte->pte_lock);
-					lock_release(old_pte->pte_lock);
 				}
+
+				lock_release(newlock);
+				lock_release(oldlock);
 			}
 		}
 	}
 
+	/*
+	 * The parent may have writable TLB entries for pages that
+	 * just became copy-on-write; flush so its next write faults
+	 * and copies.
+	 */
+	int spl = splhigh();
+	for (int i = 0; i < NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	vm_tlb_restore_asid();
+	splx(spl);
+
 	*ret = new;
 
 	return 0;
@@ -408,50 +516,79 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
-	struct region *reg, *next;
-
 	KASSERT(as != NULL);
 
 	/* Clean up the regions */
-	for (reg = as->regions; reg != NULL; reg = next) {
-		next = reg->next;
-		kfree(reg);
+	for (unsigned r = 0; r < as->nregions; r++) {
+		if (as->regions[r].backing_vn != NULL) {
+			VOP_DECREF(as->regions[r].backing_vn);
+		}
+	}
+	if (as->regions != NULL) {
+		kfree(as->regions);
 	}
 
-	/* Clean up page tables, freeing memory when needed */
+	/*
+	 * Release the per-page resources (frames and swap slots),
+	 * taking each L2 node's lock once for the whole node. The
+	 * frames are handed back in batches so the coremap lock is
+	 * taken once per batch rather than once per page; the batch
+	 * buffer is sized to keep the stack footprint small.
+	 */
 	if (as->pt_l1 != NULL) {
+		unsigned batch[64];
+		unsigned nbatch = 0;
+
 		for (int i = 0; i < PT_L1_SIZE; i++) {
-			if (as->pt_l1[i] != NULL) {
-				for (int j = 0; j < PT_L2_SIZE; j++) {
-					struct pte *pte = &as->pt_l1[i][j];
+			struct pte *l2 = as->pt_l1[i];
+			struct lock *l2lock;
 
-					if (pte->pte_lock != NULL) {
-						lock_acquire(pte->pte_lock);
-					}
+			if (l2 == NULL) {
+				continue;
+			}
+			l2lock = l2[0].pte_lock;
 
-					/* Free physical memory for pages in RAM */
-					if (pte->state == PTE_STATE_RAM) {
-						free_upage(pte->pfn);
-					}
-					/* Free swap slots for pages in swap */
-					else if (pte->state == PTE_STATE_SWAP) {
-						swap_free(pte->swap_slot);
-					}
+			lock_acquire(l2lock);
+			for (int j = 0; j < PT_L2_SIZE; j++) {
+				struct pte *pte = &l2[j];
 
-					/* Free the PTE lock */
-					if (pte->pte_lock != NULL) {
-						lock_release(pte->pte_lock);
-						lock_destroy(pte->pte_lock);
+				/* Free physical memory for pages in RAM */
+				if (pte->state == PTE_STATE_RAM) {
+					if (nbatch == ARRAYCOUNT(batch)) {
+						free_upage_bulk(batch, nbatch);
+						nbatch = 0;
 					}
+					batch[nbatch++] = pte->pfn;
+				}
+				/* Free swap slots for pages in swap */
+				else if (pte->state == PTE_STATE_SWAP) {
+					swap_free(pte->swap_slot);
 				}
-				kfree(as->pt_l1[i]);
 			}
+			lock_release(l2lock);
+			lock_destroy(l2lock);
+		}
+		if (nbatch > 0) {
+			free_upage_bulk(batch, nbatch);
 		}
-		kfree(as->pt_l1);
 	}
 
+	/*
+	 * The L1 table and all L2 nodes live in the arena; give the
+	 * memory back by the chunk instead of by the node.
+	 */
+	ptarena_destroy(as);
+
+	vm_commit_uncharge(as->as_commit);
+
 	spinlock_cleanup(&as->pt_lock);
 
+	/*
+	 * Give back any ASIDs; TLB entries tagged with them get
+	 * flushed lazily when the IDs are next recycled.
+	 */
+	vm_asid_release(as);
+
 	kfree(as);
 }
 
@@ -476,14 +613,19 @@ as_activate(void)
 	int spl = splhigh();
 
 	/*
-	 * We don't track individual pages here, so we simply invalidate
-	 * every TLB slot. That guarantees no stale entries remain from
-	 * the previous address space. A more efficient design would
-	 * only evict entries for pages we're actually changing.
+	 * TLB entries are tagged with a per-CPU address space ID, so
+	 * switching spaces only changes which entries match; nothing
+	 * needs flushing unless vm_asid_activate had to recycle an ID
+	 * (it flushes the recycled ID's entries itself).
 	 */
-	for (int i = 0; i < NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-	}
+	unsigned asid = vm_asid_activate(as);
+	tlb_setasid(asid << TLBHI_PID_SHIFT);
+
+	/* Refresh the wired slots (no-op when nothing is pinned) */
+	vm_tlb_loadpins(as);
+
+	/* Point the assembly TLB refill handler at our page table */
+	cpuptbases[curcpu->c_number] = (vaddr_t)as->pt_l1;
 
 	/* Restore interrupts */
 	splx(spl);
@@ -495,7 +637,14 @@ as_activate(void)
 void
 as_deactivate(void)
 {
-	/* Nothing to do - we invalidate TLB in as_activate */
+	/*
+	 * TLB entries are ASID-tagged and get flushed lazily when
+	 * their ASID is recycled; just close the assembly refill
+	 * path so it can't walk a page table being torn down.
+	 */
+	int spl = splhigh();
+	cpuptbases[curcpu->c_number] = 0;
+	splx(spl);
 }
 
 /*
@@ -515,20 +664,56 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 	size_t npages = sz / PAGE_SIZE;
 
-	reg = kmalloc(sizeof(struct region));
-	if (reg == NULL) {
+	/*
+	 * Charge the region against the commit limit now, so running
+	 * out of backing store fails the exec/attach here instead of
+	 * failing swap_alloc inside vm_fault later.
+	 */
+	if (vm_commit_charge(npages)) {
 		return ENOMEM;
 	}
+	as->as_commit += npages;
+
+	/* Grow the array if it's full */
+	if (as->nregions == as->regionsmax) {
+		unsigned newmax = (as->regionsmax == 0) ?
+			8 : as->regionsmax * 2;
+		struct region *newarr;
+
+		newarr = kmalloc(newmax * sizeof(struct region));
+		if (newarr == NULL) {
+			as->as_commit -= npages;
+			vm_commit_uncharge(npages);
+			return ENOMEM;
+		}
+		if (as->regions != NULL) {
+			memcpy(newarr, as->regions,
+			       as->nregions * sizeof(struct region));
+			kfree(as->regions);
+		}
+		as->regions = newarr;
+		as->regionsmax = newmax;
+	}
 
+	/* Insert sorted by vbase, shifting larger entries up */
+	unsigned pos = as->nregions;
+	while (pos > 0 && as->regions[pos - 1].vbase > vaddr) {
+		as->regions[pos] = as->regions[pos - 1];
+		pos--;
+	}
+
+	reg = &as->regions[pos];
 	reg->vbase = vaddr;
 	reg->npages = npages;
 	reg->readable = readable;
 	reg->writeable = writeable;
 	reg->executable = executable;
+	reg->backing_vn = NULL;
+	reg->backing_offset = 0;
+	reg->backing_filesize = 0;
+	reg->advice = 0;	/* MADV_NORMAL */
 
-	/* Add to region list */
-	reg->next = as->regions;
-	as->regions = reg;
+	as->nregions++;
 
 	/* Update heap_start if not set yet */
 	if (as->heap_start == 0) {
@@ -546,6 +731,203 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	return 0;
 }
 
+/*
+ * Release the frames and swap slots behind NPAGES pages starting at
+ * VADDR, returning their PTEs to UNALLOC so the next touch
+ * zero-fills (or refills from file backing). Nothing is written out
+ * and the commit charge is untouched; the pages still belong to
+ * whatever region or heap they were in. The frames are freed in
+ * batches and their translations are knocked out of all TLBs with
+ * one batched shootdown per batch, so dropping a large range doesn't
+ * take the coremap lock or raise an IPI per page. Shared frames
+ * (copy-on-write, shm, page cache) just lose this space's reference.
+ *
+ * Invalidate the batched translations everywhere *before* freeing
+ * the frames, so no CPU can still reach a frame once it's back in
+ * the free pool.
+ */
+void
+as_drop_pages(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	vaddr_t vabatch[64];
+	unsigned pfnbatch[64];
+	unsigned nbatch = 0;
+
+	KASSERT(as != NULL);
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	for (size_t i = 0; i < npages; i++) {
+		vaddr_t va = vaddr + i * PAGE_SIZE;
+		struct pte *pte = pt_get_pte(as, va, false);
+
+		if (pte == NULL) {
+			continue;
+		}
+
+		lock_acquire(pte->pte_lock);
+
+		/*
+		 * If a sibling thread is paging the entry in with the
+		 * PTE lock dropped, wait for its I/O: freeing the swap
+		 * slot under an in-flight read, with the faulter
+		 * freeing it again afterwards, would corrupt the swap
+		 * map. (Usually the wait ends with the page in RAM
+		 * state and it gets dropped below like any other.)
+		 */
+		pte_pagein_wait(pte);
+
+		if (pte->state == PTE_STATE_RAM) {
+			if (nbatch == ARRAYCOUNT(pfnbatch)) {
+				vm_tlbshootdown_batch(as, vabatch, nbatch);
+				free_upage_bulk(pfnbatch, nbatch);
+				nbatch = 0;
+			}
+			vabatch[nbatch] = va;
+			pfnbatch[nbatch] = pte->pfn;
+			nbatch++;
+		}
+		else if (pte->state == PTE_STATE_SWAP) {
+			swap_free(pte->swap_slot);
+			as->as_swapslots--;
+			pte->swap_slot = 0;
+		}
+		if (pte->wired) {
+			/* Dropping the page drops its wiring */
+			pte->wired = 0;
+			as->as_wiredpages--;
+		}
+		pte->state = PTE_STATE_UNALLOC;
+		pte->pfn = 0;
+		pte->cow = 0;
+		pte->shm = 0;
+		pte_sync_fast(pte);
+		lock_release(pte->pte_lock);
+	}
+	if (nbatch > 0) {
+		vm_tlbshootdown_batch(as, vabatch, nbatch);
+		free_upage_bulk(pfnbatch, nbatch);
+	}
+}
+
+/*
+ * Remove the region at VADDR (which must match a region's base and
+ * size exactly), releasing its frames, swap slots, and commit charge
+ * and dropping any file backing.
+ *
+ * Like as_define_region at runtime (see sys_shmat), this mutates the
+ * region array without a lock; unmapping pages another thread is
+ * concurrently touching is the program's race, as elsewhere in the
+ * VM.
+ */
+int
+as_undefine_region(struct addrspace *as, vaddr_t vaddr, size_t sz)
+{
+	struct region *reg;
+	unsigned idx;
+	size_t npages;
+
+	KASSERT(as != NULL);
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	npages = page_align(sz) / PAGE_SIZE;
+
+	reg = as_find_region(as, vaddr);
+	if (reg == NULL || reg->vbase != vaddr || reg->npages != npages) {
+		return EINVAL;
+	}
+
+	as_drop_pages(as, vaddr, npages);
+
+	if (reg->backing_vn != NULL) {
+		VOP_DECREF(reg->backing_vn);
+	}
+
+	vm_commit_uncharge(npages);
+	as->as_commit -= npages;
+
+	/* Close the gap in the sorted array */
+	idx = reg - as->regions;
+	if (idx + 1 < as->nregions) {
+		memmove(&as->regions[idx], &as->regions[idx + 1],
+			(as->nregions - idx - 1) * sizeof(struct region));
+	}
+	as->nregions--;
+	as->as_lastreg = 0;
+
+	return 0;
+}
+
+/*
+ * Attach file backing to the region containing VADDR. Called by
+ * load_elf once per PT_LOAD segment; pages of the region then fault
+ * in from the executable on first touch instead of being read at
+ * exec time.
+ */
+int
+as_set_region_backing(struct addrspace *as, vaddr_t vaddr,
+		      struct vnode *vn, off_t offset, size_t filesize)
+{
+	struct region *reg;
+
+	KASSERT(as != NULL);
+	KASSERT(vn != NULL);
+
+	reg = as_find_region(as, vaddr);
+	if (reg == NULL) {
+		return EINVAL;
+	}
+
+	/*
+	 * The region base was aligned down from the segment's vaddr;
+	 * rebase the file offset and size so they're relative to
+	 * vbase. ELF guarantees vaddr and offset are congruent mod
+	 * page size, so the rebased offset stays non-negative.
+	 */
+	KASSERT(offset >= (off_t)(vaddr - reg->vbase));
+
+	reg->backing_vn = vn;
+	reg->backing_offset = offset - (vaddr - reg->vbase);
+	reg->backing_filesize = filesize + (vaddr - reg->vbase);
+	VOP_INCREF(vn);
+
+	return 0;
+}
+
+/*
+ * Look up file backing for the page containing VADDR: which vnode,
+ * which file offset, and how many bytes of that page actually come
+ * from the file. Pure bss/anonymous pages return false.
+ */
+bool
+as_page_backing(struct addrspace *as, vaddr_t vaddr,
+		struct vnode **vn, off_t *offset, size_t *len)
+{
+	struct region *reg;
+	size_t pageoff;
+
+	KASSERT(as != NULL);
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	reg = as_find_region(as, vaddr);
+	if (reg == NULL || reg->backing_vn == NULL) {
+		return false;
+	}
+
+	pageoff = vaddr - reg->vbase;
+	if (pageoff >= reg->backing_filesize) {
+		/* Entirely past the file data; pure bss */
+		return false;
+	}
+
+	*vn = reg->backing_vn;
+	*offset = reg->backing_offset + pageoff;
+	*len = reg->backing_filesize - pageoff;
+	if (*len > PAGE_SIZE) {
+		*len = PAGE_SIZE;
+	}
+	return true;
+}
+
 /*
  * Prepare an address space for loading
  */
@@ -565,7 +947,8 @@ as_prepare_load(struct addrspace *as)
 	size_t i;
 	struct pte *pte;
 
-	for (reg = as->regions; reg != NULL; reg = reg->next) {
+	for (unsigned r = 0; r < as->nregions; r++) {
+		reg = &as->regions[r];
 		vaddr = reg->vbase;
 
 		for (i = 0; i < reg->npages; i++, vaddr += PAGE_SIZE) {
@@ -609,7 +992,8 @@ as_complete_load(struct addrspace *as)
 	size_t i;
 	struct pte *pte;
 
-	for (reg = as->regions; reg != NULL; reg = reg->next) {
+	for (unsigned r = 0; r < as->nregions; r++) {
+		reg = &as->regions[r];
 		vaddr = reg->vbase;
 
 		for (i = 0; i < reg->npages; i++, vaddr += PAGE_SIZE) {
@@ -625,6 +1009,7 @@ as_complete_load(struct addrspace *as)
 			KASSERT(pte->state == PTE_STATE_ZERO || pte->state == PTE_STATE_RAM);
 
 			pte->readonly = !reg->writeable;
+			pte_sync_fast(pte);
 
 			lock_release(pte->pte_lock);
 		}
@@ -634,7 +1019,10 @@ as_complete_load(struct addrspace *as)
 }
 
 /*
- * Set up the stack region in the address space
+ * Set up the stack region in the address space. Only the initial
+ * STACKPAGES window is defined (and commit-charged) here; the region
+ * then grows down on demand in as_grow_stack, so processes that
+ * never recurse deeply never pay for more than this.
  */
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
@@ -657,8 +1045,65 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
     as->heap_start = old_hstart;
     as->heap_end = old_hend;
 
+	as->as_stackbase = USERSTACK - STACKPAGES * PAGE_SIZE;
+
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
 
 	return 0;
 }
+
+/*
+ * Grow the stack region down to cover FAULTADDRESS (already
+ * page-aligned). Called from vm_fault for faults that landed below
+ * the mapped stack: anything between the cap and the current base is
+ * stack growth, anything below the cap is a genuine fault, so the
+ * STACKGUARDPAGES gap under the cap can never become stack. Only the
+ * region bounds and the commit charge change here; frames stay as
+ * lazy as for any other region.
+ *
+ * pt_lock serializes concurrent growers - threads of one process can
+ * fault below the base at the same time. The commit lock nests
+ * inside it; both are spinlocks.
+ */
+int
+as_grow_stack(struct addrspace *as, vaddr_t faultaddress)
+{
+	struct region *reg;
+	size_t npages;
+
+	KASSERT(as != NULL);
+	KASSERT((faultaddress & PAGE_FRAME) == faultaddress);
+
+	if (as->as_stackbase == 0 ||
+	    faultaddress < USERSTACK - STACKPAGES_MAX * PAGE_SIZE) {
+		/* no stack, or past the cap: not stack growth */
+		return EFAULT;
+	}
+
+	spinlock_acquire(&as->pt_lock);
+
+	if (faultaddress >= as->as_stackbase) {
+		/* another thread already grew past us */
+		spinlock_release(&as->pt_lock);
+		return 0;
+	}
+
+	npages = (as->as_stackbase - faultaddress) / PAGE_SIZE;
+	if (vm_commit_charge(npages)) {
+		spinlock_release(&as->pt_lock);
+		return ENOMEM;
+	}
+	as->as_commit += npages;
+
+	reg = as_find_region(as, as->as_stackbase);
+	KASSERT(reg != NULL);
+	KASSERT(reg->vbase == as->as_stackbase);
+
+	reg->vbase = faultaddress;
+	reg->npages += npages;
+	as->as_stackbase = faultaddress;
+
+	spinlock_release(&as->pt_lock);
+	return 0;
+}
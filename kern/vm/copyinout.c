@@ -29,6 +29,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/iovec.h>
 #include <lib.h>
 #include <setjmp.h>
 #include <thread.h>
@@ -142,12 +143,70 @@ copycheck(const_userptr_t userptr, size_t len, size_t *stoplen)
 	return 0;
 }
 
+/*
+ * Block copy helper for copyin/copyout.
+ *
+ * memcpy only takes its word-at-a-time path when both pointers and
+ * the length are word-multiples, which large syscall buffers rarely
+ * are. Whenever the two pointers are mutually aligned (same offset
+ * within a word) we can do better: copy leading bytes up to a word
+ * boundary, then unrolled four-word blocks, then whatever is left.
+ * Truly misaligned pairs still copy by bytes; MIPS won't do unaligned
+ * word loads and the shift-and-merge dance isn't worth it here.
+ *
+ * Runs under the tm_badfaultfunc/copyfail protection set up by the
+ * callers, so user-side faults are recovered exactly as before.
+ */
+static
+void
+copyblock(void *dst, const void *src, size_t len)
+{
+	char *d = dst;
+	const char *s = src;
+
+	if ((uintptr_t)d % sizeof(uint32_t) ==
+	    (uintptr_t)s % sizeof(uint32_t)) {
+		/* Head: bytes up to the next word boundary. */
+		while (len > 0 && (uintptr_t)d % sizeof(uint32_t) != 0) {
+			*d++ = *s++;
+			len--;
+		}
+
+		uint32_t *dw = (uint32_t *)d;
+		const uint32_t *sw = (const uint32_t *)s;
+
+		/* Body: unrolled 16-byte blocks, then single words. */
+		while (len >= 4 * sizeof(uint32_t)) {
+			dw[0] = sw[0];
+			dw[1] = sw[1];
+			dw[2] = sw[2];
+			dw[3] = sw[3];
+			dw += 4;
+			sw += 4;
+			len -= 4 * sizeof(uint32_t);
+		}
+		while (len >= sizeof(uint32_t)) {
+			*dw++ = *sw++;
+			len -= sizeof(uint32_t);
+		}
+
+		d = (char *)dw;
+		s = (const char *)sw;
+	}
+
+	/* Tail (or entire misaligned copy): bytes. */
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
+	}
+}
+
 /*
  * copyin
  *
  * Copy a block of memory of length LEN from user-level address USERSRC
- * to kernel address DEST. We can use memcpy because it's protected by
- * the tm_badfaultfunc/copyfail logic.
+ * to kernel address DEST. We can use copyblock because it's protected
+ * by the tm_badfaultfunc/copyfail logic.
  */
 int
 copyin(const_userptr_t usersrc, void *dest, size_t len)
@@ -172,7 +231,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy(dest, (const void *)usersrc, len);
+	copyblock(dest, (const void *)usersrc, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -182,7 +241,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
  * copyout
  *
  * Copy a block of memory of length LEN from kernel address SRC to
- * user-level address USERDEST. We can use memcpy because it's
+ * user-level address USERDEST. We can use copyblock because it's
  * protected by the tm_badfaultfunc/copyfail logic.
  */
 int
@@ -208,7 +267,120 @@ copyout(const void *src, userptr_t userdest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy((void *)userdest, src, len);
+	copyblock((void *)userdest, src, len);
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return 0;
+}
+
+/*
+ * Range check for the vector copies: run copycheck over each segment
+ * that the transfer will touch, before any data moves. LEN caps the
+ * total; the last segment used may be checked (and later copied) only
+ * partially. Running out of segments with LEN still unconsumed is a
+ * kernel bug (the same condition uiomove treats as fatal).
+ */
+static
+int
+copycheckv(const struct iovec *iov, unsigned iovcnt, size_t len)
+{
+	size_t seg, stoplen;
+	int result;
+
+	while (len > 0) {
+		KASSERT(iovcnt > 0);
+		seg = iov->iov_len < len ? iov->iov_len : len;
+		if (seg > 0) {
+			result = copycheck(iov->iov_ubase, seg, &stoplen);
+			if (result) {
+				return result;
+			}
+			if (stoplen != seg) {
+				/* Can't legally truncate it. */
+				return EFAULT;
+			}
+			len -= seg;
+		}
+		iov++;
+		iovcnt--;
+	}
+	return 0;
+}
+
+/*
+ * copyinv
+ *
+ * Gather version of copyin; see copyinout.h. All the segments are
+ * checked up front by copycheckv, so one tm_badfaultfunc/setjmp setup
+ * protects the whole transfer.
+ */
+int
+copyinv(const struct iovec *iov, unsigned iovcnt, void *dest, size_t len)
+{
+	size_t seg;
+	int result;
+
+	result = copycheckv(iov, iovcnt, len);
+	if (result) {
+		return result;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	while (len > 0) {
+		seg = iov->iov_len < len ? iov->iov_len : len;
+		if (seg > 0) {
+			copyblock(dest, (const void *)iov->iov_ubase, seg);
+			dest = (char *)dest + seg;
+			len -= seg;
+		}
+		iov++;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return 0;
+}
+
+/*
+ * copyoutv
+ *
+ * Scatter version of copyout; see copyinout.h and copyinv above.
+ */
+int
+copyoutv(const void *src, const struct iovec *iov, unsigned iovcnt,
+	 size_t len)
+{
+	size_t seg;
+	int result;
+
+	result = copycheckv(iov, iovcnt, len);
+	if (result) {
+		return result;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	while (len > 0) {
+		seg = iov->iov_len < len ? iov->iov_len : len;
+		if (seg > 0) {
+			copyblock((void *)iov->iov_ubase, src, seg);
+			src = (const char *)src + seg;
+			len -= seg;
+		}
+		iov++;
+	}
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -235,9 +407,46 @@ int
 copystr(char *dest, const char *src, size_t maxlen, size_t stoplen,
 	size_t *gotlen)
 {
-	size_t i;
+	size_t i, limit;
+
+	limit = maxlen < stoplen ? maxlen : stoplen;
+	i = 0;
+
+	/*
+	 * Fast path: when source and destination are mutually word-
+	 * aligned, scan and copy a word at a time, using the usual
+	 * bit trick to test whether a word contains a zero byte:
+	 * (w - 0x01010101) turns on the top bit of every byte that
+	 * was zero (or borrowed), and masking with ~w & 0x80808080
+	 * keeps only the genuinely-zero ones. Words are only read
+	 * when they lie entirely below the limit, so we never touch
+	 * memory the byte loop wouldn't have.
+	 */
+	if ((uintptr_t)src % sizeof(uint32_t) ==
+	    (uintptr_t)dest % sizeof(uint32_t)) {
+		while (i < limit && (uintptr_t)(src + i) % sizeof(uint32_t) != 0) {
+			dest[i] = src[i];
+			if (src[i] == 0) {
+				if (gotlen != NULL) {
+					*gotlen = i+1;
+				}
+				return 0;
+			}
+			i++;
+		}
+		while (i + sizeof(uint32_t) <= limit) {
+			uint32_t w = *(const uint32_t *)(src + i);
+
+			if ((w - 0x01010101) & ~w & 0x80808080) {
+				/* NUL in this word; finish by bytes */
+				break;
+			}
+			*(uint32_t *)(dest + i) = w;
+			i += sizeof(uint32_t);
+		}
+	}
 
-	for (i=0; i<maxlen && i<stoplen; i++) {
+	for (; i<limit; i++) {
 		dest[i] = src[i];
 		if (src[i] == 0) {
 			if (gotlen != NULL) {
@@ -29,9 +29,13 @@
 
 #include <types.h>
 #include <lib.h>
+#include <cpu.h>
+#include <current.h>
 #include <spinlock.h>
 #include <vm.h>
+#include <kern/kheapstats.h>
 #include <kern/test161.h>
+#include <shrinker.h>
 #include <test.h>
 
 /*
@@ -172,6 +176,376 @@ static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
 ////////////////////////////////////////
 
+/*
+ * Permanent allocator telemetry.
+ *
+ * Unlike the kmstats/dump machinery further down, which hides behind
+ * the debug switches, these counters are always maintained, so a
+ * long-running instance can be watched for slow leaks (a class's
+ * live count that only grows) and fragmentation (many pages held,
+ * few blocks live). They're exported by kheap_getstats, which the
+ * khstat menu command and the __kheapstats syscall sit on top of.
+ */
+
+#define KM_MAXCPUS 32	/* sys161's CPU limit */
+
+/*
+ * Monotonic alloc/free counts per CPU per size class. A CPU only
+ * writes its own slot, and always does so holding a spinlock (its
+ * magazine's, or the global one), so the updates can't be torn by an
+ * interrupt; readers sum the slots unlocked and tolerate slightly
+ * stale totals.
+ */
+struct km_cpucounts {
+	unsigned long kc_allocs[NSIZES];
+	unsigned long kc_frees[NSIZES];
+};
+static struct km_cpucounts km_counts[KM_MAXCPUS];
+
+/* Pages owned per class, with high-water marks; kmalloc_spinlock. */
+static unsigned km_pages[NSIZES];
+static unsigned km_maxpages[NSIZES];
+
+/* Whole-page (alloc_kpages fallback) counters; kmalloc_spinlock. */
+static unsigned km_bigallocs;
+static unsigned km_bigfrees;
+static unsigned km_bigpages;
+
+/*
+ * The CPU we're running on. Early in boot there's no curcpu yet;
+ * everything is CPU 0 then.
+ */
+static
+unsigned
+km_mycpu(void)
+{
+	unsigned num = CURCPU_EXISTS() ? curcpu->c_number : 0;
+
+	KASSERT(num < KM_MAXCPUS);
+	return num;
+}
+
+////////////////////////////////////////
+
+/*
+ * Per-CPU magazine caches.
+ *
+ * Every kmalloc/kfree otherwise takes kmalloc_spinlock and walks the
+ * sizebase/allbase page lists, which contends badly on SMP for
+ * allocation-heavy paths. Each CPU keeps a small magazine (stack of
+ * free objects) per size class in front of the page machinery; the
+ * common alloc is a pop and the common free a push on the local
+ * magazine, whose lock is only ever contended by a drain from
+ * another CPU. Full magazines return a batch of objects to the
+ * shared depot (the ordinary freelists) via subpage_kfree.
+ *
+ * kfree() doesn't know the size class of the pointer it's given, so
+ * to classify frees without the global lock we keep a byte of page
+ * type per physical page: blktype+1 for pages owned by the subpage
+ * allocator, 0 for everything else. Like the pageref table, it's
+ * statically sized for System/161's 16M RAM limit. The entry for a
+ * page is only written (under kmalloc_spinlock) when the page enters
+ * or leaves the subpage allocator, which can't happen while one of
+ * its blocks is still allocated, so reading it unlocked in kfree is
+ * safe. As a bonus, frees of whole-page allocations no longer scan
+ * the allbase list just to learn the pointer isn't a subpage one.
+ *
+ * Objects sitting in a magazine keep their page's nfree count low,
+ * so a page with cached objects won't be released; the drain path
+ * returns objects often enough that this doesn't pin much.
+ *
+ * The debugging modes rewrite block headers at alloc/free time
+ * (guard bands, labels), so the magazine layer is disabled when
+ * they're in use. Lock order: mg_lock before kmalloc_spinlock,
+ * never the other way.
+ */
+
+#if defined(__mips__) && !defined(GUARDS) && !defined(LABELS)
+#define MAGAZINES
+#endif
+
+#ifdef MAGAZINES
+
+#define KM_MAGSIZE 8	/* objects cached per CPU per size class */
+#define KM_MAGBATCH 4	/* objects sent to the depot per drain */
+
+/* Page type table; 16M of RAM / 4K pages = 4096 entries. */
+#define KMPAGE_MAX ((16*1024*1024) / PAGE_SIZE)
+static uint8_t kmpage_type[KMPAGE_MAX];
+
+struct km_magazine {
+	struct spinlock mg_lock;
+	unsigned mg_count;
+	void *mg_objs[KM_MAGSIZE];
+};
+
+/*
+ * There's no convenient bootstrap hook before the first kmalloc, but
+ * zeroed BSS matches SPINLOCK_INITIALIZER, so the locks are born
+ * initialized.
+ */
+static struct km_magazine km_mags[KM_MAXCPUS][NSIZES];
+
+/* Defined below; the drain path feeds the depot through it. */
+static int subpage_kfree(void *ptr);
+
+/*
+ * The magazine for size class BLKTYPE on the CPU we're running on.
+ */
+static
+struct km_magazine *
+km_mag_mine(int blktype)
+{
+	return &km_mags[km_mycpu()][blktype];
+}
+
+/*
+ * Pop an object from the local magazine; NULL if it's empty.
+ */
+static
+void *
+km_mag_get(int blktype)
+{
+	struct km_magazine *mg = km_mag_mine(blktype);
+	void *ptr = NULL;
+
+	spinlock_acquire(&mg->mg_lock);
+	if (mg->mg_count > 0) {
+		ptr = mg->mg_objs[--mg->mg_count];
+		km_counts[km_mycpu()].kc_allocs[blktype]++;
+	}
+	spinlock_release(&mg->mg_lock);
+
+	return ptr;
+}
+
+/*
+ * Cache a freed subpage block (of class BLKTYPE, as the caller
+ * determined from the page type table) in the local magazine. A full
+ * magazine first drains a batch back to the depot; the drain feeds
+ * subpage_kfree directly, so there's no way back into the magazine.
+ */
+static
+void
+km_mag_put(void *ptr, int blktype)
+{
+	struct km_magazine *mg;
+	unsigned i;
+
+	/*
+	 * Keep the dangling-pointer detection the freelists provide:
+	 * cached objects are deadbeefed too.
+	 */
+	fill_deadbeef(ptr, sizes[blktype]);
+
+	mg = km_mag_mine(blktype);
+	spinlock_acquire(&mg->mg_lock);
+	if (mg->mg_count == KM_MAGSIZE) {
+		for (i = 0; i < KM_MAGBATCH; i++) {
+			void *victim = mg->mg_objs[--mg->mg_count];
+
+			if (subpage_kfree(victim)) {
+				panic("kmalloc: magazine held non-subpage "
+				      "ptr %p\n", victim);
+			}
+		}
+	}
+	mg->mg_objs[mg->mg_count++] = ptr;
+	km_counts[km_mycpu()].kc_frees[blktype]++;
+	spinlock_release(&mg->mg_lock);
+}
+
+/*
+ * Empty every magazine back into the depot, so the page lists again
+ * account for every free object. Used before computing heap usage;
+ * without this, cached objects show up as leaks.
+ */
+static
+void
+km_mag_drainall(void)
+{
+	struct km_magazine *mg;
+	unsigned cpu;
+	int blktype;
+
+	for (cpu = 0; cpu < KM_MAXCPUS; cpu++) {
+		for (blktype = 0; blktype < NSIZES; blktype++) {
+			mg = &km_mags[cpu][blktype];
+
+			spinlock_acquire(&mg->mg_lock);
+			while (mg->mg_count > 0) {
+				void *victim = mg->mg_objs[--mg->mg_count];
+
+				if (subpage_kfree(victim)) {
+					panic("kmalloc: magazine held "
+					      "non-subpage ptr %p\n", victim);
+				}
+			}
+			spinlock_release(&mg->mg_lock);
+		}
+	}
+}
+
+/*
+ * Record or clear the size class of a page owned by the subpage
+ * allocator. Called with kmalloc_spinlock held.
+ */
+static
+void
+kmpage_settype(vaddr_t prpage, int blktype)
+{
+	unsigned idx;
+
+	KASSERT(prpage >= MIPS_KSEG0);
+	idx = (prpage - MIPS_KSEG0) / PAGE_SIZE;
+	KASSERT(idx < KMPAGE_MAX);
+	kmpage_type[idx] = blktype < 0 ? 0 : blktype + 1;
+}
+
+////////////////////////////////////////
+
+/*
+ * Quantum caches for whole-page allocations.
+ *
+ * Anything too big for the subpage allocator goes to alloc_kpages,
+ * which takes the coremap lock and searches for a contiguous run -
+ * both ways, on every call. Medium allocations (pipe buffers, trace
+ * buffers, page table chunks) do this constantly for the same few
+ * sizes. So each run length from 1 to KM_QCLASSES pages keeps a
+ * small cache of retained runs, linked through their first word; a
+ * hit is a spinlock and a pointer pop, with no coremap traffic.
+ *
+ * kfree() learns the run length from a byte per page recorded at
+ * allocation time, like the page type table above. The entry for a
+ * run's first page is rewritten by every whole-page allocation that
+ * starts there, so a stale value cannot outlive the run it
+ * described. Cached runs are not scrubbed (free_kpages doesn't
+ * scrub either), keeping the free constant-time; only the first
+ * word is clobbered, by the list link.
+ *
+ * Worst-case retention is KM_QMAXRUNS runs of each length, well
+ * under 1% of the 16M machine limit. The kheap accounting paths
+ * drain the caches first, as with the magazines, so retained runs
+ * don't show up as in-use memory.
+ */
+
+#define KM_QCLASSES 8	/* largest run length cached, in pages */
+#define KM_QMAXRUNS 4	/* runs retained per length */
+
+/* Run length of the whole-page allocation starting at each page. */
+static uint8_t kmpage_runlen[KMPAGE_MAX];
+
+struct km_qrun {
+	struct km_qrun *kq_next;
+};
+
+static struct km_qrun *km_qruns[KM_QCLASSES];
+static unsigned km_qcount[KM_QCLASSES];
+static struct spinlock km_qlock = SPINLOCK_INITIALIZER;
+
+/*
+ * Record the run length of the whole-page allocation at ADDRESS.
+ * Runs too long to cache get 0, which also wipes anything stale.
+ * Called with kmalloc_spinlock held.
+ */
+static
+void
+kmpage_setrunlen(vaddr_t address, unsigned long npages)
+{
+	unsigned idx;
+
+	KASSERT(address >= MIPS_KSEG0);
+	idx = (address - MIPS_KSEG0) / PAGE_SIZE;
+	KASSERT(idx < KMPAGE_MAX);
+	kmpage_runlen[idx] = npages <= KM_QCLASSES ? npages : 0;
+}
+
+/*
+ * Fetch a cached run of NPAGES pages; 0 on a miss or a length we
+ * don't cache.
+ */
+static
+vaddr_t
+km_qcache_get(unsigned long npages)
+{
+	struct km_qrun *run;
+
+	if (npages == 0 || npages > KM_QCLASSES) {
+		return 0;
+	}
+
+	spinlock_acquire(&km_qlock);
+	run = km_qruns[npages - 1];
+	if (run != NULL) {
+		km_qruns[npages - 1] = run->kq_next;
+		km_qcount[npages - 1]--;
+	}
+	spinlock_release(&km_qlock);
+
+	return (vaddr_t)run;
+}
+
+/*
+ * Retain the freed run at VA. Returns false if its length class is
+ * full; the caller then still owns the run and hands it to
+ * free_kpages as before.
+ */
+static
+bool
+km_qcache_put(vaddr_t va, unsigned runlen)
+{
+	struct km_qrun *run;
+
+	KASSERT(runlen >= 1 && runlen <= KM_QCLASSES);
+
+	spinlock_acquire(&km_qlock);
+	if (km_qcount[runlen - 1] == KM_QMAXRUNS) {
+		spinlock_release(&km_qlock);
+		return false;
+	}
+	run = (struct km_qrun *)va;
+	run->kq_next = km_qruns[runlen - 1];
+	km_qruns[runlen - 1] = run;
+	km_qcount[runlen - 1]++;
+	spinlock_release(&km_qlock);
+
+	return true;
+}
+
+/*
+ * Give every retained run back to the coremap, so coremap-based
+ * accounting doesn't count cached free memory as in use. Returns the
+ * number of pages released, for the shrinker.
+ */
+static
+unsigned
+km_qcache_drainall(void)
+{
+	struct km_qrun *run;
+	unsigned i, npages;
+
+	npages = 0;
+	spinlock_acquire(&km_qlock);
+	for (i = 0; i < KM_QCLASSES; i++) {
+		while ((run = km_qruns[i]) != NULL) {
+			km_qruns[i] = run->kq_next;
+			km_qcount[i]--;
+			npages += i + 1;
+			/* free_kpages takes the coremap lock; drop ours */
+			spinlock_release(&km_qlock);
+			free_kpages((vaddr_t)run);
+			spinlock_acquire(&km_qlock);
+		}
+	}
+	spinlock_release(&km_qlock);
+
+	return npages;
+}
+
+#endif /* MAGAZINES */
+
+////////////////////////////////////////
+
 /*
  * We can only allocate whole pages of pageref structure at a time.
  * This is a struct type for such a page.
@@ -219,7 +593,7 @@ static struct kheap_root kheaproots[NUM_PAGEREFPAGES];
  */
 static
 void
-allocpagerefpage(struct kheap_root *root)
+allocpagerefpage(struct kheap_root *root, bool nosleep)
 {
 	vaddr_t va;
 
@@ -231,7 +605,7 @@ allocpagerefpage(struct kheap_root *root)
 	 * Note that this means things can change behind our back...
 	 */
 	spinlock_release(&kmalloc_spinlock);
-	va = alloc_kpages(1);
+	va = nosleep ? alloc_kpage_nosleep() : alloc_kpages(1);
 	spinlock_acquire(&kmalloc_spinlock);
 	if (va == 0) {
 		kprintf("kmalloc: Couldn't get a pageref page\n");
@@ -257,7 +631,7 @@ allocpagerefpage(struct kheap_root *root)
  */
 static
 struct pageref *
-allocpageref(void)
+allocpageref(bool nosleep)
 {
 	unsigned i,j;
 	uint32_t k;
@@ -283,7 +657,8 @@ allocpageref(void)
 					root->pagerefs_inuse[i] |= k;
 					root->numinuse++;
 					if (root->page == NULL) {
-						allocpagerefpage(root);
+						allocpagerefpage(root,
+								 nosleep);
 					}
 					if (root->page == NULL) {
 						return NULL;
@@ -820,6 +1195,45 @@ kheap_printstats(void)
 }
 
 
+/*
+ * Shrinker hook: under memory pressure, hand the magazines' cached
+ * objects back to the depot and the quantum caches' retained runs
+ * back to the coremap. Only the runs are whole pages we can count;
+ * draining the magazines frees pages as a side effect when subpage
+ * pages empty, which the next pagedaemon pass observes in cm_nfree.
+ */
+static
+unsigned
+kheap_shrink(unsigned npages, void *data)
+{
+	(void)npages;	/* all-or-nothing; caches refill on demand */
+	(void)data;
+
+#ifdef MAGAZINES
+	km_mag_drainall();
+	return km_qcache_drainall();
+#else
+	return 0;
+#endif
+}
+
+static struct shrinker kheap_shrinker = {
+	.sh_name = "kheap",
+	.sh_shrink = kheap_shrink,
+	.sh_data = NULL,
+	.sh_next = NULL,
+};
+
+/*
+ * Put the allocator's caches under the pagedaemon's control; called
+ * once from boot.
+ */
+void
+kheap_shrinker_bootstrap(void)
+{
+	shrinker_register(&kheap_shrinker);
+}
+
 /*
  * Return the number of used bytes.
  */
@@ -830,6 +1244,12 @@ kheap_getused(void) {
 	unsigned long total = 0;
 	unsigned int num_pages = 0, coremap_bytes = 0;
 
+#ifdef MAGAZINES
+	/* Cached objects and runs would otherwise be counted as leaks. */
+	km_mag_drainall();
+	km_qcache_drainall();
+#endif
+
 	/* compute with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
@@ -850,6 +1270,86 @@ kheap_getused(void) {
 	return total;
 }
 
+/*
+ * Fill in the permanent telemetry counters for the caller (the
+ * khstat menu command or the __kheapstats syscall).
+ */
+void
+kheap_getstats(struct kheapstats *ks)
+{
+	struct pageref *pr;
+	unsigned long allocs, frees;
+	unsigned long pagebytes = 0, freebytes = 0;
+	unsigned cpu;
+	int i;
+
+	KASSERT(NSIZES == KHEAP_NCLASSES);
+
+#ifdef MAGAZINES
+	/* Cached objects and runs would otherwise show as live. */
+	km_mag_drainall();
+	km_qcache_drainall();
+#endif
+
+	bzero(ks, sizeof(*ks));
+
+	for (i=0; i<NSIZES; i++) {
+		allocs = frees = 0;
+		for (cpu = 0; cpu < KM_MAXCPUS; cpu++) {
+			allocs += km_counts[cpu].kc_allocs[i];
+			frees += km_counts[cpu].kc_frees[i];
+		}
+		ks->kh_classes[i].ks_size = sizes[i];
+		ks->kh_classes[i].ks_live = allocs - frees;
+	}
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<NSIZES; i++) {
+		ks->kh_classes[i].ks_pages = km_pages[i];
+		ks->kh_classes[i].ks_maxpages = km_maxpages[i];
+		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
+			ks->kh_classes[i].ks_freeblocks += pr->nfree;
+			freebytes += (unsigned long)pr->nfree * sizes[i];
+		}
+		pagebytes += (unsigned long)km_pages[i] * PAGE_SIZE;
+	}
+	ks->kh_bigallocs = km_bigallocs;
+	ks->kh_bigfrees = km_bigfrees;
+	ks->kh_bigpages = km_bigpages;
+	spinlock_release(&kmalloc_spinlock);
+
+	ks->kh_fragpct = pagebytes > 0 ?
+		(uint32_t)(freebytes * 100 / pagebytes) : 0;
+}
+
+/*
+ * Print the size-class table and fragmentation summary.
+ */
+void
+kheap_printclassstats(void)
+{
+	struct kheapstats ks;
+	int i;
+
+	kheap_getstats(&ks);
+
+	kprintf("Subpage allocator size classes:\n");
+	kprintf("%8s %8s %8s %8s %10s\n",
+		"size", "live", "free", "pages", "maxpages");
+	for (i=0; i<NSIZES; i++) {
+		kprintf("%8u %8u %8u %8u %10u\n",
+			ks.kh_classes[i].ks_size,
+			ks.kh_classes[i].ks_live,
+			ks.kh_classes[i].ks_freeblocks,
+			ks.kh_classes[i].ks_pages,
+			ks.kh_classes[i].ks_maxpages);
+	}
+	kprintf("big allocations: %u (%u freed), %u pages handed out\n",
+		ks.kh_bigallocs, ks.kh_bigfrees, ks.kh_bigpages);
+	kprintf("fragmentation: %u%% of subpage heap bytes are free\n",
+		ks.kh_fragpct);
+}
+
 /*
  * Print number of used bytes.
  */
@@ -920,7 +1420,7 @@ int blocktype(size_t clientsz)
  */
 static
 void *
-subpage_kmalloc(size_t sz
+subpage_kmalloc(size_t sz, bool nosleep
 #ifdef LABELS
 		, vaddr_t label
 #endif
@@ -955,6 +1455,14 @@ subpage_kmalloc(size_t sz
 	sz = sizes[blktype];
 #endif
 
+#ifdef MAGAZINES
+	/* Fast path: pop from the local magazine. */
+	retptr = km_mag_get(blktype);
+	if (retptr != NULL) {
+		return retptr;
+	}
+#endif
+
 	spinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
@@ -995,6 +1503,8 @@ subpage_kmalloc(size_t sz
 			retptr = establishlabel(retptr, label);
 #endif
 
+			km_counts[km_mycpu()].kc_allocs[blktype]++;
+
 			checksubpages();
 
 			spinlock_release(&kmalloc_spinlock);
@@ -1012,7 +1522,7 @@ subpage_kmalloc(size_t sz
 	 */
 
 	spinlock_release(&kmalloc_spinlock);
-	prpage = alloc_kpages(1);
+	prpage = nosleep ? alloc_kpage_nosleep() : alloc_kpages(1);
 	if (prpage==0) {
 		/* Out of memory. */
 		silent("kmalloc: Subpage allocator couldn't get a page\n");
@@ -1025,7 +1535,7 @@ subpage_kmalloc(size_t sz
 #endif
 	spinlock_acquire(&kmalloc_spinlock);
 
-	pr = allocpageref();
+	pr = allocpageref(nosleep);
 	if (pr==NULL) {
 		/* Couldn't allocate accounting space for the new page. */
 		spinlock_release(&kmalloc_spinlock);
@@ -1061,6 +1571,15 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
+	km_pages[blktype]++;
+	if (km_pages[blktype] > km_maxpages[blktype]) {
+		km_maxpages[blktype] = km_pages[blktype];
+	}
+
+#ifdef MAGAZINES
+	kmpage_settype(prpage, blktype);
+#endif
+
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
@@ -1185,11 +1704,25 @@ subpage_kfree(void *ptr)
 	pr->freelist_offset = offset;
 	pr->nfree++;
 
+#ifndef MAGAZINES
+	/*
+	 * With magazines, client frees are counted in km_mag_put and
+	 * calls here are magazine drains; without them, this is the
+	 * client free path.
+	 */
+	km_counts[km_mycpu()].kc_frees[blktype]++;
+#endif
+
 	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
 		freepageref(pr);
+		KASSERT(km_pages[blktype] > 0);
+		km_pages[blktype]--;
+#ifdef MAGAZINES
+		kmpage_settype(prpage, -1);
+#endif
 		/* Call free_kpages without kmalloc_spinlock. */
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
@@ -1212,23 +1745,17 @@ subpage_kfree(void *ptr)
 
 /*
  * Allocate a block of size SZ. Redirect either to subpage_kmalloc or
- * alloc_kpages depending on how big SZ is.
+ * the page allocator depending on how big SZ is.
  */
+static
 void *
-kmalloc(size_t sz)
-{
-	size_t checksz;
+kmalloc_common(size_t sz, bool nosleep
 #ifdef LABELS
-	vaddr_t label;
+	       , vaddr_t label
 #endif
-
-#ifdef LABELS
-#ifdef __GNUC__
-	label = (vaddr_t)__builtin_return_address(0);
-#else
-#error "Don't know how to get return address with this compiler"
-#endif /* __GNUC__ */
-#endif /* LABELS */
+	)
+{
+	size_t checksz;
 
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
 	if (checksz >= LARGEST_SUBPAGE_SIZE) {
@@ -1237,19 +1764,87 @@ kmalloc(size_t sz)
 
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
+#ifdef MAGAZINES
+		address = km_qcache_get(npages);
+#else
+		address = 0;
+#endif
+		if (address == 0) {
+			if (nosleep) {
+				/*
+				 * The emergency reserve holds single
+				 * pages only; a multi-page atomic
+				 * allocation fails fast rather than
+				 * searching the coremap for a run.
+				 */
+				address = npages == 1 ?
+					alloc_kpage_nosleep() : 0;
+			}
+			else {
+				address = alloc_kpages(npages);
+			}
+		}
 		if (address==0) {
 			return NULL;
 		}
 		KASSERT(address % PAGE_SIZE == 0);
 
+		spinlock_acquire(&kmalloc_spinlock);
+		km_bigallocs++;
+		km_bigpages += npages;
+#ifdef MAGAZINES
+		kmpage_setrunlen(address, npages);
+#endif
+		spinlock_release(&kmalloc_spinlock);
+
 		return (void *)address;
 	}
 
 #ifdef LABELS
-	return subpage_kmalloc(sz, label);
+	return subpage_kmalloc(sz, nosleep, label);
+#else
+	return subpage_kmalloc(sz, nosleep);
+#endif
+}
+
+/*
+ * With LABELS, each entry point takes its own return address so the
+ * recorded allocation site is the caller, not the wrapper.
+ */
+#ifdef LABELS
+#ifdef __GNUC__
+#define KMALLOC_LABEL() ((vaddr_t)__builtin_return_address(0))
+#else
+#error "Don't know how to get return address with this compiler"
+#endif /* __GNUC__ */
+#endif /* LABELS */
+
+void *
+kmalloc(size_t sz)
+{
+#ifdef LABELS
+	return kmalloc_common(sz, false, KMALLOC_LABEL());
+#else
+	return kmalloc_common(sz, false);
+#endif
+}
+
+/*
+ * Flags-taking entry point; see KM_* in <lib.h>. KM_NOSLEEP is for
+ * atomic context (interrupt handlers, softirq callbacks, spinlock
+ * holders): it never blocks, drawing fresh pages from the emergency
+ * reserve the pagedaemon maintains, and returns NULL rather than
+ * wait when nothing is available.
+ */
+void *
+kmalloc_flags(size_t sz, int flags)
+{
+	bool nosleep = (flags & KM_NOSLEEP) != 0;
+
+#ifdef LABELS
+	return kmalloc_common(sz, nosleep, KMALLOC_LABEL());
 #else
-	return subpage_kmalloc(sz);
+	return kmalloc_common(sz, nosleep);
 #endif
 }
 
@@ -1264,9 +1859,108 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+
+#ifdef MAGAZINES
+	/*
+	 * The page type table classifies the pointer without taking
+	 * the global lock: subpage blocks go to the local magazine,
+	 * anything else must be a whole-page allocation. Pointers
+	 * outside the table's range fall through to the old path.
+	 */
+	vaddr_t va = (vaddr_t)ptr;
+
+	if (va >= MIPS_KSEG0 &&
+	    (va - MIPS_KSEG0) / PAGE_SIZE < KMPAGE_MAX) {
+		uint8_t type = kmpage_type[(va - MIPS_KSEG0) / PAGE_SIZE];
+
+		if (type == 0) {
+			unsigned runlen;
+
+			KASSERT(va % PAGE_SIZE == 0);
+			spinlock_acquire(&kmalloc_spinlock);
+			km_bigfrees++;
+			spinlock_release(&kmalloc_spinlock);
+
+			runlen = kmpage_runlen[(va - MIPS_KSEG0) / PAGE_SIZE];
+			if (runlen == 0 || !km_qcache_put(va, runlen)) {
+				free_kpages(va);
+			}
+		}
+		else {
+			km_mag_put(ptr, type - 1);
+		}
+		return;
+	}
+#endif
+
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+		spinlock_acquire(&kmalloc_spinlock);
+		km_bigfrees++;
+		spinlock_release(&kmalloc_spinlock);
 		free_kpages((vaddr_t)ptr);
 	}
 }
 
+/*
+ * Free N blocks at once. Teardown paths (process exit, address space
+ * destruction) free many objects back to back; this keeps the
+ * bookkeeping under one lock hold instead of one per block. NULL
+ * entries are permitted and skipped, as with kfree.
+ */
+void
+kfree_bulk(void **ptrs, unsigned n)
+{
+	unsigned i;
+	unsigned bigfrees = 0;
+
+	for (i = 0; i < n; i++) {
+		void *ptr = ptrs[i];
+
+		if (ptr == NULL) {
+			continue;
+		}
+
+#ifdef MAGAZINES
+		/* Classify without the global lock, as in kfree. */
+		vaddr_t va = (vaddr_t)ptr;
+
+		if (va >= MIPS_KSEG0 &&
+		    (va - MIPS_KSEG0) / PAGE_SIZE < KMPAGE_MAX) {
+			uint8_t type = kmpage_type[(va - MIPS_KSEG0) / PAGE_SIZE];
+
+			if (type == 0) {
+				unsigned runlen;
+
+				KASSERT(va % PAGE_SIZE == 0);
+				bigfrees++;
+
+				runlen = kmpage_runlen[(va - MIPS_KSEG0)
+						       / PAGE_SIZE];
+				if (runlen == 0 ||
+				    !km_qcache_put(va, runlen)) {
+					free_kpages(va);
+				}
+			}
+			else {
+				km_mag_put(ptr, type - 1);
+			}
+			continue;
+		}
+#endif
+
+		if (subpage_kfree(ptr)) {
+			KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+			bigfrees++;
+			free_kpages((vaddr_t)ptr);
+		}
+	}
+
+	if (bigfrees > 0) {
+		spinlock_acquire(&kmalloc_spinlock);
+		km_bigfrees += bigfrees;
+		spinlock_release(&kmalloc_spinlock);
+	}
+}
+
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Object caches over kmalloc; see kmemcache.h for the contract.
+ *
+ * The freelist is a stack of pointers rather than links threaded
+ * through the objects themselves: a free object keeps its
+ * constructed state, so its memory is not ours to scribble a link
+ * into. The stack array grows by doubling, outside the cache lock;
+ * if that allocation fails the object is simply destructed and
+ * returned to the heap, which is where it would have gone anyway.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <shrinker.h>
+#include <kmemcache.h>
+
+/* Initial capacity of the freelist stack. */
+#define KMEM_CACHE_MINSLOTS 16
+
+struct kmem_cache {
+	const char *kc_name;		/* for diagnostics */
+	size_t kc_size;			/* object size */
+	int (*kc_ctor)(void *);
+	void (*kc_dtor)(void *);
+
+	struct spinlock kc_lock;	/* protects the freelist stack */
+	void **kc_objs;			/* stack of constructed objects */
+	unsigned kc_nobjs;		/* objects on the stack */
+	unsigned kc_slots;		/* capacity of kc_objs */
+
+	struct shrinker kc_shrinker;	/* empties the stack on pressure */
+};
+
+/*
+ * Shrinker callback: destruct cached objects until roughly NPAGES
+ * pages' worth of memory has gone back to the heap, or the cache is
+ * empty. The kheap shrinker runs too, so subpage space we free here
+ * has a path back to the free page pool.
+ */
+static
+unsigned
+kmem_cache_shrink(unsigned npages, void *data)
+{
+	struct kmem_cache *kc = data;
+	size_t goal, freed;
+	void *obj;
+
+	goal = (size_t)npages * PAGE_SIZE;
+	freed = 0;
+	while (freed < goal) {
+		spinlock_acquire(&kc->kc_lock);
+		if (kc->kc_nobjs == 0) {
+			spinlock_release(&kc->kc_lock);
+			break;
+		}
+		obj = kc->kc_objs[--kc->kc_nobjs];
+		spinlock_release(&kc->kc_lock);
+
+		if (kc->kc_dtor != NULL) {
+			kc->kc_dtor(obj);
+		}
+		kfree(obj);
+		freed += kc->kc_size;
+	}
+	return freed / PAGE_SIZE;
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *), void (*dtor)(void *))
+{
+	struct kmem_cache *kc;
+
+	KASSERT(size > 0);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_objs = NULL;
+	kc->kc_nobjs = 0;
+	kc->kc_slots = 0;
+
+	/*
+	 * The registry keeps this shrinker forever, which is why
+	 * there is no kmem_cache_destroy.
+	 */
+	kc->kc_shrinker.sh_name = name;
+	kc->kc_shrinker.sh_shrink = kmem_cache_shrink;
+	kc->kc_shrinker.sh_data = kc;
+	shrinker_register(&kc->kc_shrinker);
+
+	return kc;
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	void *obj;
+	int result;
+
+	spinlock_acquire(&kc->kc_lock);
+	if (kc->kc_nobjs > 0) {
+		obj = kc->kc_objs[--kc->kc_nobjs];
+		spinlock_release(&kc->kc_lock);
+		return obj;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	/* Cache empty; build a fresh object. */
+	obj = kmalloc(kc->kc_size);
+	if (obj == NULL) {
+		return NULL;
+	}
+	if (kc->kc_ctor != NULL) {
+		result = kc->kc_ctor(obj);
+		if (result != 0) {
+			kfree(obj);
+			return NULL;
+		}
+	}
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	void **newobjs, **oldobjs;
+	unsigned newslots;
+
+	KASSERT(obj != NULL);
+
+	spinlock_acquire(&kc->kc_lock);
+	if (kc->kc_nobjs < kc->kc_slots) {
+		kc->kc_objs[kc->kc_nobjs++] = obj;
+		spinlock_release(&kc->kc_lock);
+		return;
+	}
+	newslots = kc->kc_slots == 0 ?
+		KMEM_CACHE_MINSLOTS : kc->kc_slots * 2;
+	spinlock_release(&kc->kc_lock);
+
+	/* Stack full; grow it outside the lock. */
+	newobjs = kmalloc(newslots * sizeof(newobjs[0]));
+	if (newobjs == NULL) {
+		/* Can't cache it; give it back to the heap. */
+		if (kc->kc_dtor != NULL) {
+			kc->kc_dtor(obj);
+		}
+		kfree(obj);
+		return;
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	if (kc->kc_slots >= newslots) {
+		/* Someone else grew it meanwhile; ours is too small. */
+		oldobjs = newobjs;
+	}
+	else {
+		if (kc->kc_nobjs > 0) {
+			memcpy(newobjs, kc->kc_objs,
+			       kc->kc_nobjs * sizeof(newobjs[0]));
+		}
+		oldobjs = kc->kc_objs;
+		kc->kc_objs = newobjs;
+		kc->kc_slots = newslots;
+	}
+	if (kc->kc_nobjs < kc->kc_slots) {
+		kc->kc_objs[kc->kc_nobjs++] = obj;
+		obj = NULL;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (oldobjs != NULL) {
+		kfree(oldobjs);
+	}
+	if (obj != NULL) {
+		/* Still no room (the shrinker can race us); punt. */
+		if (kc->kc_dtor != NULL) {
+			kc->kc_dtor(obj);
+		}
+		kfree(obj);
+	}
+}
@@ -0,0 +1,127 @@
+/*
+ * Arena allocator for page-table structures.
+ *
+ * Page-table nodes (the L1 pointer array and the L2 PTE arrays) are
+ * page-granular objects that live exactly as long as their address
+ * space, so there is no point in kmalloc'ing each one: that hammers
+ * the subpage allocator on every fault that extends the table and
+ * scatters the nodes across the heap. Instead each address space
+ * bump-allocates its nodes out of big page chunks it owns. Nodes
+ * come back page-aligned and physically contiguous, and as_destroy
+ * returns all table memory by freeing whole chunks, in O(chunks)
+ * rather than O(nodes).
+ *
+ * There is deliberately no per-node free: a node lost to an
+ * allocation race in pt_alloc_l2 just sits in its chunk until the
+ * address space dies.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <addrspace.h>
+#include <vm.h>
+
+/*
+ * Chunk size in pages, header page included. Big enough that a
+ * typical address space (a handful of L2 arrays plus the L1 table)
+ * needs only a few chunks.
+ */
+#define PTARENA_PAGES 16
+
+/*
+ * Chunk header. It occupies the chunk's first page so that the
+ * allocations after it stay page-aligned.
+ */
+struct ptarena {
+	struct ptarena *pa_next; /* next chunk owned by this space */
+	size_t pa_size; /* usable bytes after the header page */
+	size_t pa_used; /* bytes already handed out */
+};
+
+/*
+ * Allocate SZ bytes (rounded up to whole pages) of page-table memory
+ * for AS. Returns NULL on failure. The memory is not zeroed; callers
+ * initialize every field themselves.
+ *
+ * The bump pointer is protected by the space's pt_lock; new chunks
+ * are taken with the lock dropped, since the page allocator may need
+ * to sleep.
+ */
+void *
+ptarena_alloc(struct addrspace *as, size_t sz)
+{
+	struct ptarena *pa;
+	unsigned npages;
+	void *p = NULL;
+
+	KASSERT(as != NULL);
+	KASSERT(sz > 0);
+
+	sz = ROUNDUP(sz, PAGE_SIZE);
+
+	/* Fast path: bump the newest chunk. */
+	spinlock_acquire(&as->pt_lock);
+	pa = as->as_ptchunks;
+	if (pa != NULL && pa->pa_used + sz <= pa->pa_size) {
+		p = (char *)pa + PAGE_SIZE + pa->pa_used;
+		pa->pa_used += sz;
+	}
+	spinlock_release(&as->pt_lock);
+
+	if (p != NULL) {
+		return p;
+	}
+
+	/* Need a fresh chunk. */
+	npages = sz / PAGE_SIZE + 1;
+	if (npages < PTARENA_PAGES) {
+		npages = PTARENA_PAGES;
+	}
+
+	pa = (struct ptarena *)alloc_kpages(npages);
+	if (pa == NULL && npages > sz / PAGE_SIZE + 1) {
+		/*
+		 * No contiguous run that big; settle for an
+		 * exactly-sized chunk.
+		 */
+		npages = sz / PAGE_SIZE + 1;
+		pa = (struct ptarena *)alloc_kpages(npages);
+	}
+	if (pa == NULL) {
+		return NULL;
+	}
+
+	pa->pa_size = (size_t)(npages - 1) * PAGE_SIZE;
+	pa->pa_used = sz;
+
+	/*
+	 * Newest chunk first; an older chunk with a little space left
+	 * simply retires. If another thread added a chunk meanwhile,
+	 * both get linked in and both get freed at destroy time.
+	 */
+	spinlock_acquire(&as->pt_lock);
+	pa->pa_next = as->as_ptchunks;
+	as->as_ptchunks = pa;
+	spinlock_release(&as->pt_lock);
+
+	return (char *)pa + PAGE_SIZE;
+}
+
+/*
+ * Free every chunk AS owns, and with them all its page-table nodes.
+ * Called from as_destroy after the per-page resources (frames, swap
+ * slots, locks) have been released; nothing may touch the tables
+ * afterwards.
+ */
+void
+ptarena_destroy(struct addrspace *as)
+{
+	struct ptarena *pa, *next;
+
+	for (pa = as->as_ptchunks; pa != NULL; pa = next) {
+		next = pa->pa_next;
+		free_kpages((vaddr_t)pa);
+	}
+	as->as_ptchunks = NULL;
+}
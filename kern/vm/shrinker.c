@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <membar.h>
+#include <spinlock.h>
+#include <shrinker.h>
+
+/*
+ * Cache shrinker registry; see shrinker.h for the contract.
+ *
+ * The list only ever grows, and entries are published with a store
+ * barrier before the head pointer moves, so the run path walks it
+ * without the lock (the same publish pattern as the page tables).
+ * The lock only serializes concurrent registrations.
+ */
+
+static struct shrinker *shrinker_list;
+static struct spinlock shrinker_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Add SH to the registry. SH must never go away.
+ */
+void
+shrinker_register(struct shrinker *sh)
+{
+	KASSERT(sh != NULL);
+	KASSERT(sh->sh_shrink != NULL);
+
+	spinlock_acquire(&shrinker_lock);
+	sh->sh_next = shrinker_list;
+	/* Publish only fully linked; the run path walks lock-free */
+	membar_store_store();
+	shrinker_list = sh;
+	spinlock_release(&shrinker_lock);
+}
+
+/*
+ * Ask the registered caches for NPAGES pages, stopping early once
+ * they've given enough back. Each cache is asked for the part of the
+ * deficit still outstanding, so the burden spreads across the caches
+ * in proportion to what they can actually release instead of hitting
+ * the first one for everything every time. Returns the total pages
+ * the caches report freeing. Runs in thread context (the pagedaemon);
+ * callbacks may sleep.
+ */
+unsigned
+shrinker_run(unsigned npages)
+{
+	struct shrinker *sh;
+	unsigned total;
+
+	total = 0;
+	for (sh = shrinker_list; sh != NULL && total < npages;
+	     sh = sh->sh_next) {
+		total += sh->sh_shrink(npages - total, sh->sh_data);
+	}
+	return total;
+}
@@ -1,13 +1,20 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <limits.h>
 #include <lib.h>
 #include <spl.h>
 #include <cpu.h>
+#include <membar.h>
 #include <spinlock.h>
+#include <iopri.h>
+#include <thread.h>
+#include <wchan.h>
+#include <clock.h>
 #include <proc.h>
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
+#include <copyinout.h>
 #include <vm.h>
 #include <mips/vm.h>
 #include <current.h>
@@ -17,6 +24,14 @@
 #include <kern/fcntl.h>
 #include <kern/stat.h>
 #include <bitmap.h>
+#include <lockstat.h>
+#include <ktrace.h>
+#include <workqueue.h>
+#include <shrinker.h>
+#include <zswap.h>
+#include <kern/mman.h>
+#include <kern/userclock.h>
+#include <kern/vmstat.h>
 
 static struct coremap_entry *coremap = NULL; /* KSEG0 pointer */
 static unsigned coremap_pages = 0; /* total entries */
@@ -25,384 +40,2726 @@ static bool vm_ready = false;
 
 static struct swapmap swap_info;
 
+/* Frame backing all never-written pages, mapped read-only */
+static unsigned vm_zero_pfn;
+
 /*
- * Initialize the swap system
- * This should be called late in the boot process
+ * Memory zones. Low memory is direct-mapped through kseg0 and is the
+ * only memory the kernel's own allocations may use: exception entry
+ * pushes the trapframe onto the kernel stack before any TLB refill
+ * could be taken, so kernel data must never depend on the window. High
+ * memory - everything above MIPS_DIRECTMEM_SIZE, present only on big
+ * RAM configs - is reached through the kseg2 window and serves user
+ * pages, keeping low memory free for the kernel.
  */
-int
-swap_init(void)
-{
-	if (swap_info.swap_bitmap != NULL) {
-		return 0;
-	}
+#define CM_ZONE_LOW  0
+#define CM_ZONE_HIGH 1
+#define CM_NZONES    2
+
+static unsigned cm_lowpages; /* frames below MIPS_DIRECTMEM_SIZE */
+
+/* File-local helpers used before their definitions */
+static unsigned cm_run_alloc(unsigned npages);
+static unsigned cm_run_alloc_color(unsigned zone, unsigned color);
+static unsigned cm_color(unsigned idx);
+static unsigned cm_zone(unsigned idx);
+static bool cm_have_high(void);
+static void cm_run_free(unsigned idx, unsigned len);
+static void vm_compact(unsigned want);
+static void vm_thrash_check(bool desperate);
+static void pagedaemon(void *p, unsigned long n);
+static uint32_t vm_tlb_asidfield(struct addrspace *as);
+static struct shrinker tc_shrinker;
 
-	spinlock_init(&swap_info.swap_lock);
+/*
+ * Page-out daemon state. The daemon keeps a reserve of free frames
+ * by evicting ahead of demand, so page faults almost never eat the
+ * full swap-write latency themselves. cm_nfree counts CM_FREE pages
+ * and is maintained under cm_lock; the daemon sleeps on pd_wchan and
+ * is kicked by the allocator when the count drops below the low
+ * watermark.
+ */
+/*
+ * Paging statistics, so eviction quality (hit/re-fault rates) is
+ * visible. Counted per cpu - indexed by c_number like the ASID state
+ * - so the fault path never bounces a shared counter between cpus;
+ * vmstat_gather sums the cpus for readers. Updated without locking;
+ * they're diagnostics, and the occasional lost increment doesn't
+ * matter.
+ */
+static struct {
+	uint32_t vs_faults;	/* vm_fault entries */
+	uint32_t vs_zerofills;	/* pages materialized (zero or file) */
+	uint32_t vs_prezeroed;	/* of those, served from the zero pool */
+	uint32_t vs_cowfaults;	/* copy-on-write breaks */
+	uint32_t vs_rofaults;	/* write faults on read-only TLB entries */
+	uint32_t vs_swapins;	/* re-faults: pages brought back from swap */
+	uint32_t vs_swapouts;	/* pages written to swap */
+	uint32_t vs_evictions;	/* pages evicted to swap */
+	uint32_t vs_zswapouts;	/* of the evictions, kept compressed in RAM */
+	uint32_t vs_zswapins;	/* of the swapins, served from zswap */
+	uint32_t vs_pdruns;	/* pagedaemon wakeups */
+	uint32_t vs_migrations;	/* pages moved by compaction */
+	uint32_t vs_scrubs;	/* periodic TLB scrubs */
+} vm_stats_pcpu[VM_MAXCPUS];
+
+#define VMSTAT_INC(field) (vm_stats_pcpu[curcpu->c_number].field++)
 
-	char swap_dev[] = "lhd0raw:";
-	int result = vfs_open(swap_dev, O_RDWR, 0, &swap_info.swap_vnode);
-	if (result) {
-		panic("swap_init: cannot open swap device %s: %s\n",
-			swap_dev, strerror(result));
-		return result;
-	}
+/*
+ * Commit accounting (see vm.h). The limit is recomputed on each
+ * charge rather than cached: swap comes up after the coremap, and
+ * the ratio is meant to be tunable at run time.
+ */
+unsigned vm_overcommit_pct = VM_OVERCOMMIT_PCT;
+static unsigned vm_committed_pages;
+static struct spinlock vm_commit_lock = SPINLOCK_INITIALIZER;
 
-	/* Get the size of the swap device (in bytes) */
-	struct stat swap_stat;
-	result = VOP_STAT(swap_info.swap_vnode, &swap_stat);
-	if (result) {
-		panic("swap_init: cannot stat swap device: %s\n", strerror(result));
-		vfs_close(swap_info.swap_vnode);
-		swap_info.swap_vnode = NULL;
-		return result;
-	}
+static
+uint64_t
+vm_commit_limit(void)
+{
+	return ((uint64_t)coremap_pages + swap_info.swap_size)
+		* vm_overcommit_pct / 100;
+}
 
-	/* Calculate the number of pages we can swap */
-	swap_info.swap_size = swap_stat.st_size / PAGE_SIZE;
-	kprintf("swap: %u pages (%lld KB)\n",
-		swap_info.swap_size, swap_stat.st_size / 1024);
+int
+vm_commit_charge(unsigned npages)
+{
+	spinlock_acquire(&vm_commit_lock);
 
-	/* Create the bitmap */
-	swap_info.swap_bitmap = bitmap_create(swap_info.swap_size);
-	if (swap_info.swap_bitmap == NULL) {
-		panic("swap_init: cannot create swap bitmap\n");
-		vfs_close(swap_info.swap_vnode);
-		swap_info.swap_vnode = NULL;
+	if ((uint64_t)vm_committed_pages + npages > vm_commit_limit()) {
+		spinlock_release(&vm_commit_lock);
 		return ENOMEM;
 	}
+	vm_committed_pages += npages;
 
+	spinlock_release(&vm_commit_lock);
 	return 0;
 }
 
-/* Must be callable with interrupts on; panics if caller is in an IRQ
- * or already holding a spinlock. Same semantics as dumbvm_can_sleep. */
-static
-void
-vm_can_sleep(void)
-{
-	if (CURCPU_EXISTS()) {
-		KASSERT(curcpu->c_spinlocks == 0);
-		KASSERT(curthread->t_in_interrupt == 0);
-	}
-}
-
 void
-coremap_dump(void)
+vm_commit_uncharge(unsigned npages)
 {
-	unsigned free = 0, fixed = 0, user = 0, evicting = 0;
+	spinlock_acquire(&vm_commit_lock);
 
-	for (unsigned i = 0; i < coremap_pages; i++) {
-		switch (coremap[i].state) {
-		case CM_FREE:
-			free++;
-			break;
-		case CM_FIXED:
-			fixed++;
-			break;
-		case CM_USER:
-			user++;
-			break;
-		case CM_EVICTING:
-			evicting++;
-			break;
-		}
-	}
+	KASSERT(vm_committed_pages >= npages);
+	vm_committed_pages -= npages;
 
-	kprintf("coremap: %u pages total | %u free  %u kernel  %u user  %u evicting\n",
-		coremap_pages, free, fixed, user, evicting);
+	spinlock_release(&vm_commit_lock);
 }
 
-void
-vm_bootstrap(void)
-{
-	/* Physical memory layout
-	 * [0 ..... kernel_end)  : kernel+ELF sections
-	 * [kernel_end ..... ?)  : UNUSED at boot
-	 */
-
-	paddr_t ram_top = ram_getsize(); // Bytes (exclusive)
-	paddr_t first_free = ram_getfirstfree(); // Bytes (inclusive)
+static unsigned cm_nfree; /* CM_FREE pages (cm_lock) */
+static unsigned pd_lowfree; /* wake the daemon below this */
+static unsigned pd_highfree; /* daemon evicts until this */
+static struct wchan *pd_wchan; /* NULL until swap_init */
 
-	// How many total physical pages exist?
-	coremap_pages = ram_top / PAGE_SIZE;
+/*
+ * Where faulters wait for a page-in in flight on another thread (the
+ * busy bit in struct pte; see the swap-in path in vm_fault). One
+ * global channel serves every page: the PTE itself can't grow a
+ * channel of its own (its layout is hardcoded in the assembly refill
+ * handler), collisions need two simultaneous disk waits plus a
+ * duplicate faulter, and a wakeup for somebody else's page just
+ * rechecks the busy bit and goes back to sleep.
+ */
+static struct spinlock pagein_splk = SPINLOCK_INITIALIZER;
+static struct wchan *pagein_wchan; /* NULL until swap_init */
 
-	// Bytes required for coremap[] and round up to full pages.
-	size_t cm_bytes = coremap_pages * sizeof(struct coremap_entry);
-	cm_bytes = ROUNDUP(cm_bytes, PAGE_SIZE);
+/*
+ * Compaction trigger. A multi-page allocation that finds no run
+ * leaves a note here (under cm_lock) and kicks the daemon, which
+ * responds by migrating pages to consolidate free runs (see the
+ * compaction section at the bottom of this file).
+ */
+static unsigned cm_runfail_count; /* failed run allocations since last pass */
+static unsigned cm_runfail_want; /* longest run size that failed */
 
-	// Place coremap immediately after the kernel.
-	paddr_t cm_paddr = first_free;
-	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(cm_paddr);
+/*
+ * How many pages an eviction pass will gather into one swap write.
+ * The victims get contiguous swap slots, so pages evicted together
+ * also come back with sequential disk reads when they re-fault.
+ */
+#define SWAP_CLUSTER 4
 
-	// Physical address that will become the first truly free page.
-	paddr_t free_base = cm_paddr + cm_bytes;
+/*
+ * Per-CPU caches of free single pages.
+ *
+ * Single-page allocation and free are by far the common case (user
+ * pages, kernel stacks via kmalloc's page allocator), and funneling
+ * them all through cm_lock makes the lock dominate fault-heavy
+ * workloads on multi-CPU configs. Each CPU keeps a small stack of
+ * free page frames and refills/drains it from the global coremap in
+ * batches, so most single-page operations only touch the local cache.
+ *
+ * Pages sitting in a cache are marked CM_FIXED with chunk_len 1 in
+ * the coremap, i.e. they look allocated to everyone else; only the
+ * owning cache may hand them out or give them back.
+ *
+ * Each CPU keeps one cache per zone, so a kernel allocation (low only)
+ * never has to pick its way around cached high frames.
+ *
+ * Lock order: pc_lock before cm_lock, never the other way.
+ */
+#define CM_PCPU_MAXCPUS   32	/* sys161's CPU limit */
+#define CM_PCPU_CACHESIZE 16	/* pages kept per CPU, at most */
+#define CM_PCPU_BATCH      8	/* pages moved per refill/drain */
 
-	// Initialise every entry
-	for (unsigned i = 0; i < coremap_pages; i++) {
-		paddr_t page_addr = idx_to_pa(i);
+struct cm_pcpu_cache {
+	struct spinlock pc_lock;
+	unsigned pc_count;
+	unsigned pc_pages[CM_PCPU_CACHESIZE];
+};
 
-		coremap[i].chunk_len = 0;
-		coremap[i].as = NULL;
-		coremap[i].vpn = 0;
+static struct cm_pcpu_cache cm_pcpu[CM_NZONES][CM_PCPU_MAXCPUS];
 
-		if (page_addr < free_base) {
-			coremap[i].state = CM_FIXED; /* kernel or coremap itself */
-		} else {
-			coremap[i].state = CM_FREE;
-		}
-	}
+/*
+ * Rotor for allocations with no color preference (kernel pages, the
+ * zero pool), so they drain the color lists evenly. Updated without
+ * locking; an occasional repeat costs nothing.
+ */
+static unsigned cm_colorrotor;
 
-	vm_ready = true;
+/*
+ * The cache belonging to the CPU we're running on. Early in boot
+ * there's no curcpu yet; everything belongs to cache 0 then.
+ */
+static
+struct cm_pcpu_cache *
+cm_pcpu_mine(unsigned zone)
+{
+	unsigned num = CURCPU_EXISTS() ? curcpu->c_number : 0;
 
-	unsigned free_pages = (ram_top - free_base) / PAGE_SIZE;
-	unsigned mib = (free_pages * PAGE_SIZE) / 1024;
-	kprintf("VM: %u / %u pages free (%u KiB)\n", free_pages, coremap_pages, mib);
+	KASSERT(num < CM_PCPU_MAXCPUS);
+	return &cm_pcpu[zone][num];
 }
 
-// Returns first index of a run of npages CM_FREE pages, or coremap_pages.
+/*
+ * Refill a cache from the global coremap, taking up to CM_PCPU_BATCH
+ * free pages. The first page fetched prefers COLOR - the one the
+ * triggering allocation wants - and the rest cycle through the other
+ * colors so the cache stays color-diverse. Called with pc_lock held.
+ * Returns the number of pages obtained, which is 0 if the coremap is
+ * out of free pages.
+ */
 static
 unsigned
-cm_find_run(unsigned npages)
+cm_pcpu_refill(struct cm_pcpu_cache *pc, unsigned zone, unsigned color)
 {
-	for (unsigned i = 0; i + npages <= coremap_pages; i++) {
-		if (coremap[i].state != CM_FREE) {
-			continue;
-		}
-
-		bool ok = true;
+	unsigned i, added = 0;
 
-		for (unsigned j = 1; j < npages; j++) {
-			if (coremap[i + j].state != CM_FREE) {
-				ok = false;
-				i += j; // Skip past the allocated slice
-				break;
-			}
+	spinlock_acquire(&cm_lock);
+	while (added < CM_PCPU_BATCH) {
+		i = cm_run_alloc_color(zone, (color + added) % VM_NCOLORS);
+		if (i == coremap_pages) {
+			break;
 		}
+		coremap[i].state = CM_FIXED;
+		coremap[i].chunk_len = 1;
+		pc->pc_pages[pc->pc_count++] = i;
+		added++;
+	}
 
-		if (ok) {
-			return i;
-		}
+	/* Running low? Kick the page-out daemon. */
+	if (pd_wchan != NULL && cm_nfree < pd_lowfree) {
+		wchan_wakeone(pd_wchan, &cm_lock);
 	}
 
-	return coremap_pages;
+	spinlock_release(&cm_lock);
+
+	return added;
 }
 
-vaddr_t
-alloc_kpages(unsigned npages)
+/*
+ * Give a batch of cached pages back to the global coremap so other
+ * CPUs can have them. Called with pc_lock held, on a full cache.
+ */
+static
+void
+cm_pcpu_drain(struct cm_pcpu_cache *pc)
 {
-	if (npages == 0) {
-		return 0;
-	}
-
-	KASSERT(vm_ready); // We initialize VM before everything else (see main.c)
-	// Before vm_bootstrap we fall back to ram_stealmem().
-	// if (!vm_ready) {
-	// 	paddr_t pa = ram_stealmem(npages);
-	// 	return (pa == 0) ? 0 : PADDR_TO_KVADDR(pa);
-	// }
-
-	vm_can_sleep();
+	unsigned idx;
 
 	spinlock_acquire(&cm_lock);
+	while (pc->pc_count > CM_PCPU_CACHESIZE - CM_PCPU_BATCH) {
+		idx = pc->pc_pages[--pc->pc_count];
+		KASSERT(coremap[idx].state == CM_FIXED);
+		coremap[idx].as = NULL;
+		coremap[idx].vpn = 0;
+		cm_run_free(idx, 1);
+	}
+	spinlock_release(&cm_lock);
+}
 
-	unsigned idx = cm_find_run(npages);
-	if (idx == coremap_pages) {
-		spinlock_release(&cm_lock);
+/*
+ * Take one page from the local cache, refilling it if necessary,
+ * preferring a frame of cache color COLOR. The cache is small, so a
+ * linear scan for the color is cheap; if no cached frame matches, any
+ * frame will do. Returns false only if the whole coremap is out of
+ * free pages. The page comes back marked CM_FIXED with chunk_len 1.
+ */
+static
+bool
+cm_pcpu_getpage(unsigned zone, unsigned color, unsigned *idx_ret)
+{
+	struct cm_pcpu_cache *pc = cm_pcpu_mine(zone);
+	bool ok = true;
+	unsigned j, tmp;
 
-		/* Only try eviction for single-page allocations */
-		if (npages == 1) {
-			unsigned evict_idx;
-			int result = vm_evict_page(&evict_idx);
-			if (result == 0) {
-				spinlock_acquire(&cm_lock);
-				idx = evict_idx;
-			} else {
-				return 0;
+	spinlock_acquire(&pc->pc_lock);
+	if (pc->pc_count == 0 && cm_pcpu_refill(pc, zone, color) == 0) {
+		ok = false;
+	}
+	else {
+		for (j = pc->pc_count; j-- > 0; ) {
+			if (cm_color(pc->pc_pages[j]) == color) {
+				tmp = pc->pc_pages[j];
+				pc->pc_pages[j] =
+					pc->pc_pages[pc->pc_count - 1];
+				pc->pc_pages[pc->pc_count - 1] = tmp;
+				break;
 			}
-		} else {
-			/* Multi-page allocations can't be satisfied through eviction */
-			return 0;
 		}
+		*idx_ret = pc->pc_pages[--pc->pc_count];
 	}
+	spinlock_release(&pc->pc_lock);
 
-	/* Mark allocation */
-	coremap[idx].state = CM_FIXED;
-	coremap[idx].chunk_len = npages;
-	for (unsigned j = 1; j < npages; j++) {
-		coremap[idx + j].state = CM_FIXED;
-		coremap[idx + j].chunk_len = 0;
-	}
-
-	spinlock_release(&cm_lock);
-
-	paddr_t pa = idx_to_pa(idx);
-	return PADDR_TO_KVADDR(pa);
+	return ok;
 }
 
+/*
+ * Put one page into the local cache, draining a batch back to the
+ * coremap first if the cache is full. The caller must have left the
+ * coremap entry marked CM_FIXED with chunk_len 1.
+ */
+static
 void
-free_kpages(vaddr_t kvaddr)
+cm_pcpu_putpage(unsigned idx)
 {
-	KASSERT(vm_ready); // We initialize VM before everything else (see main.c)
-	// if (!vm_ready) {
-	// 	return;
-	// }
+	struct cm_pcpu_cache *pc = cm_pcpu_mine(cm_zone(idx));
 
-	paddr_t pa = KVADDR_TO_PADDR(kvaddr);
-	unsigned idx = pa_to_idx(pa);
+	KASSERT(coremap[idx].state == CM_FIXED);
+	KASSERT(coremap[idx].chunk_len == 1);
 
-	KASSERT(idx < coremap_pages);
+	spinlock_acquire(&pc->pc_lock);
+	if (pc->pc_count == CM_PCPU_CACHESIZE) {
+		cm_pcpu_drain(pc);
+	}
+	pc->pc_pages[pc->pc_count++] = idx;
+	spinlock_release(&pc->pc_lock);
+}
 
-	spinlock_acquire(&cm_lock);
+////////////////////////////////////////////////////////////
+//
+// Whole-page zero and copy.
+//
+// The generic bzero/memcpy have to check alignment and handle odd
+// lengths. A page through its kernel mapping is always word-aligned
+// and always PAGE_SIZE, so these run a straight-line 8-word loop
+// with no checks at all. They back the hottest bulk-data paths in
+// the VM: zero-fill faults, the pre-zero pool, and copy-on-write
+// breaks.
 
-	if (coremap[idx].state != CM_FIXED || coremap[idx].chunk_len == 0) {
-		spinlock_release(&cm_lock);
-		panic("free_kpages: bad or non-head page @%u\n", idx);
+void
+page_zero(void *page)
+{
+	uint32_t *p = page;
+	uint32_t *end = p + PAGE_SIZE / sizeof(uint32_t);
+
+	KASSERT((vaddr_t)page % sizeof(uint32_t) == 0);
+
+	while (p < end) {
+		p[0] = 0;
+		p[1] = 0;
+		p[2] = 0;
+		p[3] = 0;
+		p[4] = 0;
+		p[5] = 0;
+		p[6] = 0;
+		p[7] = 0;
+		p += 8;
 	}
+}
 
-	unsigned run = coremap[idx].chunk_len;
-	for (unsigned j = 0; j < run; j++) {
-		KASSERT(coremap[idx + j].state == CM_FIXED);
-		coremap[idx + j].state = CM_FREE;
-		coremap[idx + j].chunk_len = 0;
-		coremap[idx + j].as = NULL;
-		coremap[idx + j].vpn = 0;
+void
+page_copy(void *dst, const void *src)
+{
+	uint32_t *d = dst;
+	const uint32_t *s = src;
+	const uint32_t *end = s + PAGE_SIZE / sizeof(uint32_t);
+
+	KASSERT((vaddr_t)dst % sizeof(uint32_t) == 0);
+	KASSERT((vaddr_t)src % sizeof(uint32_t) == 0);
+
+	while (s < end) {
+		uint32_t w0 = s[0];
+		uint32_t w1 = s[1];
+		uint32_t w2 = s[2];
+		uint32_t w3 = s[3];
+		uint32_t w4 = s[4];
+		uint32_t w5 = s[5];
+		uint32_t w6 = s[6];
+		uint32_t w7 = s[7];
+		d[0] = w0;
+		d[1] = w1;
+		d[2] = w2;
+		d[3] = w3;
+		d[4] = w4;
+		d[5] = w5;
+		d[6] = w6;
+		d[7] = w7;
+		s += 8;
+		d += 8;
 	}
-
-	spinlock_release(&cm_lock);
 }
 
+////////////////////////////////////////////////////////////
+//
+// Pre-zeroed page pool.
+//
+// Zero-fill faults otherwise pay a full PAGE_SIZE bzero with the PTE
+// lock held. The idle loop calls vm_zero_idle to stock this pool with
+// already-cleared frames, so on a machine with any idle time the
+// common zero-fill fault just maps a frame that is zero already.
+//
+// Frames in the pool are marked CM_FIXED with chunk_len 1, exactly
+// like frames sitting in a per-CPU cache: allocated as far as the
+// rest of the VM system is concerned, owned by the pool.
+
+#define VM_ZPOOL_SIZE 32 /* frames kept pre-zeroed, at most */
+
+static unsigned vm_zpool[VM_ZPOOL_SIZE];
+static unsigned vm_zpool_count;
+static struct spinlock vm_zpool_lock = SPINLOCK_INITIALIZER;
+
 /*
- * Allocate a physical page for user space
- * The page will be mapped to the virtual address vaddr in the address space as
- * Returns the physical frame number, or 0 if allocation fails
+ * Take one pre-zeroed frame, still CM_FIXED, preferring cache color
+ * COLOR (any frame if no color matches). Returns false if the pool is
+ * empty.
  */
-unsigned
-alloc_upage(struct addrspace *as, vaddr_t vaddr)
+static
+bool
+vm_zpool_get(unsigned color, unsigned *idx_ret)
 {
-	vm_can_sleep();
-
-	spinlock_acquire(&cm_lock);
-
-	unsigned idx = cm_find_run(1);
-	if (idx == coremap_pages) {
-		spinlock_release(&cm_lock);
-
-		int result = vm_evict_page(&idx);
-		if (result) {
-			return 0;
+	bool ok = false;
+	unsigned j, tmp;
+
+	spinlock_acquire(&vm_zpool_lock);
+	if (vm_zpool_count > 0) {
+		for (j = vm_zpool_count; j-- > 0; ) {
+			if (cm_color(vm_zpool[j]) == color) {
+				tmp = vm_zpool[j];
+				vm_zpool[j] =
+					vm_zpool[vm_zpool_count - 1];
+				vm_zpool[vm_zpool_count - 1] = tmp;
+				break;
+			}
 		}
-
-		spinlock_acquire(&cm_lock);
+		*idx_ret = vm_zpool[--vm_zpool_count];
+		ok = true;
 	}
+	spinlock_release(&vm_zpool_lock);
 
-	/* Mark as user page */
-	coremap[idx].state = CM_USER;
-	coremap[idx].chunk_len = 1;
-	coremap[idx].as = as;
-	coremap[idx].vpn = VPN(vaddr);
-
-	spinlock_release(&cm_lock);
-
-	return idx;
+	return ok;
 }
 
 /*
- * Free a physical page for user space
- * The page will be unmapped from the virtual address vaddr in the address space
+ * Zero one frame for the pool. Called from the idle loop in
+ * thread_switch, at splhigh with no locks held; everything here is
+ * spinlock-only, so that's fine. Returns true if it did useful work,
+ * in which case the idle loop rechecks its runqueue before calling
+ * again, and false when there's nothing (more) worth doing, in which
+ * case the CPU really idles.
+ *
+ * We only take frames when memory is comfortably above the page-out
+ * daemon's high watermark; a pool refill should never be what pushes
+ * the system into eviction.
  */
-void
-free_upage(unsigned idx)
+bool
+vm_zero_idle(void)
 {
-	KASSERT(vm_ready);
-	KASSERT(idx < coremap_pages);
-
-	spinlock_acquire(&cm_lock);
+	unsigned idx, color;
 
-	/* Check if the page is being evicted */
-	if (coremap[idx].state == CM_EVICTING) {
-		/* Page is being evicted, don't free it now */
-		spinlock_release(&cm_lock);
-		return;
+	if (!vm_ready) {
+		return false;
+	}
+	/* Unlocked peeks; worst case we take the lock and back out. */
+	if (vm_zpool_count >= VM_ZPOOL_SIZE ||
+	    cm_nfree < pd_highfree + VM_ZPOOL_SIZE) {
+		return false;
 	}
 
-	/* We expect exactly one–page allocations for user pages */
-	KASSERT(coremap[idx].state == CM_USER);
-	KASSERT(coremap[idx].chunk_len == 1);
+	/* The pool feeds user faults; prefer high frames, as they do. */
+	color = cm_colorrotor++ % VM_NCOLORS;
+	if ((!cm_have_high() ||
+	     !cm_pcpu_getpage(CM_ZONE_HIGH, color, &idx)) &&
+	    !cm_pcpu_getpage(CM_ZONE_LOW, color, &idx)) {
+		return false;
+	}
+	page_zero((void *)PADDR_TO_KVADDR(idx_to_pa(idx)));
 
-	coremap[idx].state = CM_FREE;
-	coremap[idx].chunk_len = 0;
-	coremap[idx].as = NULL;
-	coremap[idx].vpn = 0;
+	spinlock_acquire(&vm_zpool_lock);
+	if (vm_zpool_count < VM_ZPOOL_SIZE) {
+		vm_zpool[vm_zpool_count++] = idx;
+		spinlock_release(&vm_zpool_lock);
+		return true;
+	}
+	spinlock_release(&vm_zpool_lock);
 
-	spinlock_release(&cm_lock);
+	/* Raced with another idle CPU filling the pool; put it back. */
+	cm_pcpu_putpage(idx);
+	return false;
 }
 
-// Returns total bytes not in CM_FREE state
-unsigned
-coremap_used_bytes(void)
+////////////////////////////////////////////////////////////
+//
+// Emergency page reserve for atomic-context allocation.
+//
+// kmalloc's KM_NOSLEEP mode needs whole pages without ever blocking:
+// disk-completion and softirq code allocates at interrupt level or
+// under spinlocks, where alloc_kpages is off limits (it asserts the
+// caller can sleep, and under pressure it evicts, which means swap
+// I/O). The per-CPU page caches above are spinlock-only end to end,
+// so the fast path just draws from them; the reserve here is the
+// backstop for when they and the coremap are both empty. The
+// pagedaemon tops the reserves back up on every pass - replenishment
+// is the one place this memory does come from eviction, and it runs
+// in thread context where sleeping is fine - and a reserve falling to
+// half empty wakes it.
+
+#define VM_RESERVE_SIZE 8	/* frames per CPU */
+
+static struct vm_reserve {
+	struct spinlock rv_lock;
+	unsigned rv_count;
+	unsigned rv_pages[VM_RESERVE_SIZE];
+} vm_reserve[CM_PCPU_MAXCPUS];
+
+static volatile bool vm_reserve_wanted;
+
+/*
+ * Get one page without blocking; 0 if nothing can be had. Safe at
+ * interrupt level and under spinlocks. Pages obtained here are
+ * ordinary CM_FIXED single pages and go back through free_kpages.
+ */
+vaddr_t
+alloc_kpage_nosleep(void)
 {
+	struct vm_reserve *rv;
+	unsigned num, idx;
+	bool kick;
+
 	if (!vm_ready) {
 		return 0;
 	}
 
-	spinlock_acquire(&cm_lock);
+	/* The common case: free memory exists and the cache path works. */
+	if (cm_pcpu_getpage(CM_ZONE_LOW, cm_colorrotor++ % VM_NCOLORS,
+			    &idx)) {
+		return PADDR_TO_KVADDR(idx_to_pa(idx));
+	}
 
-	unsigned used = 0;
-	for (unsigned i = 0; i < coremap_pages; i++) {
-		if (coremap[i].state != CM_FREE) {
-			used += PAGE_SIZE;
+	num = CURCPU_EXISTS() ? curcpu->c_number : 0;
+	KASSERT(num < CM_PCPU_MAXCPUS);
+	rv = &vm_reserve[num];
+
+	spinlock_acquire(&rv->rv_lock);
+	if (rv->rv_count == 0) {
+		spinlock_release(&rv->rv_lock);
+		return 0;
+	}
+	idx = rv->rv_pages[--rv->rv_count];
+	kick = rv->rv_count <= VM_RESERVE_SIZE / 2;
+	spinlock_release(&rv->rv_lock);
+
+	if (kick) {
+		vm_reserve_wanted = true;
+		if (pd_wchan != NULL) {
+			spinlock_acquire(&cm_lock);
+			wchan_wakeone(pd_wchan, &cm_lock);
+			spinlock_release(&cm_lock);
 		}
 	}
 
-	spinlock_release(&cm_lock);
-	return used;
+	return PADDR_TO_KVADDR(idx_to_pa(idx));
 }
 
-void
-vm_tlbshootdown(const struct tlbshootdown *ts)
-{
-	(void)ts;
-	panic("vm_tlbshootdown: not yet implemented\n");
-}
+/*
+ * Top every CPU's reserve back up. Pagedaemon context, so sleeping
+ * is fine and alloc_kpages may evict to find the frames. Filling
+ * another CPU's reserve is safe; each has its own lock.
+ */
+static
+void
+vm_reserve_fill(void)
+{
+	struct vm_reserve *rv;
+	unsigned cpu, ncpus;
+	vaddr_t va;
+
+	vm_reserve_wanted = false;
+
+	ncpus = num_cpus > 0 ? num_cpus : 1;
+	KASSERT(ncpus <= CM_PCPU_MAXCPUS);
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		rv = &vm_reserve[cpu];
+		for (;;) {
+			spinlock_acquire(&rv->rv_lock);
+			if (rv->rv_count == VM_RESERVE_SIZE) {
+				spinlock_release(&rv->rv_lock);
+				break;
+			}
+			spinlock_release(&rv->rv_lock);
+
+			va = alloc_kpages(1);
+			if (va == 0) {
+				return;
+			}
+
+			spinlock_acquire(&rv->rv_lock);
+			if (rv->rv_count < VM_RESERVE_SIZE) {
+				rv->rv_pages[rv->rv_count++] =
+					pa_to_idx(KVADDR_TO_PADDR(va));
+				spinlock_release(&rv->rv_lock);
+			}
+			else {
+				/* Raced with another filler. */
+				spinlock_release(&rv->rv_lock);
+				free_kpages(va);
+			}
+		}
+	}
+}
+
+/*
+ * Initialize the swap system
+ * This should be called late in the boot process
+ */
+int
+swap_init(void)
+{
+	int result;
+
+	if (swap_info.swap_ndevs != 0) {
+		return 0;
+	}
+
+	spinlock_init(&swap_info.swap_lock);
+
+	/*
+	 * Open every swap disk present. lhd0 is required; further disks
+	 * (sys161 configs may provide lhd1) are used when they exist, so
+	 * paging bandwidth adds up across spindles instead of all swap
+	 * traffic queueing behind filesystem I/O on one disk.
+	 */
+	for (unsigned i = 0; i < SWAP_MAXDEVS; i++) {
+		struct swapdev *sd = &swap_info.swap_devs[i];
+		char swap_dev[] = "lhd0raw:";
+		struct stat swap_stat;
+
+		swap_dev[3] = '0' + i;
+		result = vfs_open(swap_dev, O_RDWR, 0, &sd->sd_vnode);
+		if (result) {
+			if (i == 0) {
+				panic("swap_init: cannot open swap device "
+				      "%s: %s\n", swap_dev, strerror(result));
+				return result;
+			}
+			/* No more disks; what we have will do. */
+			break;
+		}
+
+		/* Get the size of the swap device (in bytes) */
+		result = VOP_STAT(sd->sd_vnode, &swap_stat);
+		if (result) {
+			panic("swap_init: cannot stat swap device %s: %s\n",
+			      swap_dev, strerror(result));
+			vfs_close(sd->sd_vnode);
+			sd->sd_vnode = NULL;
+			return result;
+		}
+
+		/* This device's slots follow the previous device's */
+		sd->sd_size = swap_stat.st_size / PAGE_SIZE;
+		sd->sd_base = swap_info.swap_size;
+		sd->sd_hint = 0;
+		sd->sd_inflight = 0;
+
+		sd->sd_bitmap = bitmap_create(sd->sd_size);
+		if (sd->sd_bitmap == NULL) {
+			panic("swap_init: cannot create swap bitmap\n");
+			vfs_close(sd->sd_vnode);
+			sd->sd_vnode = NULL;
+			return ENOMEM;
+		}
+
+		kprintf("swap: %s: %u pages (%lld KB)\n", swap_dev,
+			sd->sd_size, swap_stat.st_size / 1024);
+
+		swap_info.swap_size += sd->sd_size;
+		swap_info.swap_ndevs++;
+	}
+
+	/*
+	 * Compressed tier in front of the disks: a sixteenth of RAM
+	 * holds several times that in well-compressing evicted pages,
+	 * and a fault served from it is a memory-speed operation
+	 * instead of a disk read.
+	 */
+	zswap_bootstrap((size_t)(coremap_pages / 16) * PAGE_SIZE);
+	kprintf("swap: zswap pool %lu KB\n",
+		(unsigned long)(coremap_pages / 16) * (PAGE_SIZE / 1024));
+
+	/*
+	 * Start the page-out daemon, now that there's somewhere to
+	 * page out to. Watermarks scale with memory size: wake the
+	 * daemon when less than ~3% of frames are free, refill to
+	 * twice that.
+	 */
+	pd_lowfree = coremap_pages / 32;
+	if (pd_lowfree < 8) {
+		pd_lowfree = 8;
+	}
+	pd_highfree = pd_lowfree * 2;
+
+	pd_wchan = wchan_create("pagedaemon");
+	if (pd_wchan == NULL) {
+		panic("swap_init: cannot create pagedaemon wchan\n");
+		return ENOMEM;
+	}
+
+	/* Pages can only become busy once there's swap to read from. */
+	pagein_wchan = wchan_create("pagein");
+	if (pagein_wchan == NULL) {
+		panic("swap_init: cannot create pagein wchan\n");
+		return ENOMEM;
+	}
+
+	result = thread_fork("pagedaemon", NULL, pagedaemon, NULL, 0);
+	if (result) {
+		panic("swap_init: cannot start pagedaemon: %s\n",
+		      strerror(result));
+		return result;
+	}
+
+	return 0;
+}
+
+/*
+ * The page-out daemon. Sleeps until the free-frame count drops below
+ * the low watermark, then evicts pages in the background until the
+ * high watermark is restored, so faulting threads find free frames in
+ * the per-CPU caches instead of doing the swap write themselves.
+ */
+static
+void
+pagedaemon(void *p, unsigned long n)
+{
+	unsigned nevicted;
+	int result;
+
+	(void)p;
+	(void)n;
+
+	/* Eviction writes are background; don't delay faulting threads. */
+	curthread->t_iopri = IOPRI_ASYNC;
+
+	/* Stock the atomic-allocation reserves before anyone needs them. */
+	vm_reserve_fill();
+
+	for (;;) {
+		bool swapstuck = false;
+
+		spinlock_acquire(&cm_lock);
+		while (cm_nfree >= pd_lowfree && !vm_reserve_wanted &&
+		       cm_runfail_count == 0) {
+			wchan_sleep(pd_wchan, &cm_lock);
+		}
+		spinlock_release(&cm_lock);
+
+		VMSTAT_INC(vs_pdruns);
+
+		/*
+		 * First ask the registered caches (allocator
+		 * magazines, the page cache, ...) to give memory
+		 * back. A cache trim is free; eviction costs swap
+		 * I/O and somebody else's later fault, so it's the
+		 * last resort, not the first.
+		 */
+		spinlock_acquire(&cm_lock);
+		unsigned deficit = (cm_nfree < pd_highfree) ?
+			pd_highfree - cm_nfree : 0;
+		spinlock_release(&cm_lock);
+		if (deficit > 0) {
+			shrinker_run(deficit);
+		}
+
+		while (1) {
+			spinlock_acquire(&cm_lock);
+			bool enough = cm_nfree >= pd_highfree;
+			spinlock_release(&cm_lock);
+			if (enough) {
+				break;
+			}
+
+			result = vm_evict_cluster(SWAP_CLUSTER, &nevicted);
+			if (result) {
+				/*
+				 * Nothing evictable right now (all
+				 * pages shared/wired, or swap full).
+				 * Back off instead of spinning. If
+				 * free memory is still below the low
+				 * watermark, eviction can no longer
+				 * help; let the thrash check know.
+				 */
+				spinlock_acquire(&cm_lock);
+				swapstuck = cm_nfree < pd_lowfree;
+				spinlock_release(&cm_lock);
+				clocksleep(1);
+				break;
+			}
+		}
+
+		/*
+		 * If run allocations have been failing, free memory is
+		 * fragmented rather than merely scarce; consolidate it.
+		 */
+		spinlock_acquire(&cm_lock);
+		unsigned want = cm_runfail_want;
+		cm_runfail_count = 0;
+		cm_runfail_want = 0;
+		spinlock_release(&cm_lock);
+		if (want > 0) {
+			vm_compact(want);
+		}
+
+		/* Is the system making progress, or just churning? */
+		vm_thrash_check(swapstuck);
+
+		/* Replace anything the atomic reserves handed out. */
+		vm_reserve_fill();
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Thrash detection and the OOM responder.
+//
+// When the working set outgrows RAM, or swap fills, eviction stops
+// helping: pages written out are faulted straight back in and every
+// process crawls, indefinitely. The pagedaemon samples the global
+// paging counters between runs; a high fault rate with a large share
+// of the evicted pages coming straight back - or eviction failing
+// outright with the free list still empty - means thrashing, and the
+// process with the largest footprint (resident plus swap, from the
+// per-addrspace stats) is condemned. The victim exits with SIGKILL
+// through its next trap from user mode (see mips_trap), which for a
+// thrashing process is imminent. One large process dying beats the
+// whole machine being unusable for minutes.
+
+/* Ticks between thrash checks. */
+#define VM_THRASH_INTERVAL	(2 * HZ)
+
+/* Fault rate, per second, below which it's never called thrashing. */
+#define VM_THRASH_FAULTRATE	200
+
+/* Swapins as a percentage of evictions that counts as churning. */
+#define VM_THRASH_REFAULTPCT	50
+
+/* Minimum ticks between kills, to let the last one take effect. */
+#define VM_OOM_HOLDOFF		(5 * HZ)
+
+static uint64_t vm_oom_lastkill;
+
+/*
+ * Pick and condemn the process with the largest memory footprint.
+ * Runs in the pagedaemon, so it mustn't touch the victim's address
+ * space; it only sets the flag the victim's own trap path checks.
+ */
+static
+void
+vm_oom_kill(void)
+{
+	char name[32], vname[32];
+	struct pvmstats pvs;
+	struct proc *p;
+	bool exited;
+	pid_t pid, victim;
+	unsigned long footprint, worst;
+
+	victim = 0;
+	worst = 0;
+	vname[0] = 0;
+	for (pid = PID_MIN; pid < PID_MAX; pid++) {
+		if (proc_getvmstats(pid, name, sizeof(name), &exited,
+				    &pvs) != 0) {
+			continue;
+		}
+		if (exited) {
+			continue;
+		}
+		footprint = (unsigned long)pvs.pvs_resident +
+			pvs.pvs_swapslots;
+		if (footprint > worst) {
+			worst = footprint;
+			victim = pid;
+			strcpy(vname, name);
+		}
+	}
+
+	if (victim == 0) {
+		kprintf("vm: thrashing, but no process to kill\n");
+		return;
+	}
+
+	p = pid_table_lookup(victim);
+	if (p == NULL) {
+		/* Exited between the scan and now; that helps too. */
+		return;
+	}
+	p->p_oomkill = true;
+	vm_oom_lastkill = timer_now();
+	kprintf("vm: thrashing: killing pid %d (%s), footprint %lu pages\n",
+		(int)victim, vname, worst);
+}
+
+/*
+ * Called from the pagedaemon after each run. DESPERATE means an
+ * eviction pass just failed outright with free memory still below
+ * the low watermark - out of swap, or everything wired - which is
+ * the livelock case no matter what the rates say.
+ */
+static
+void
+vm_thrash_check(bool desperate)
+{
+	static struct vmstats last;
+	static uint64_t lastcheck;
+	struct vmstats now;
+	uint64_t t, interval;
+	uint32_t faults, swapins, evictions;
+	bool thrashing;
+
+	t = timer_now();
+	if (lastcheck == 0) {
+		/* First run: just set the baseline. */
+		vmstat_gather(&last);
+		lastcheck = t;
+		return;
+	}
+	if (!desperate && t - lastcheck < VM_THRASH_INTERVAL) {
+		return;
+	}
+
+	vmstat_gather(&now);
+	interval = t - lastcheck;
+	if (interval == 0) {
+		interval = 1;
+	}
+	faults = now.vms_faults - last.vms_faults;
+	swapins = now.vms_swapins - last.vms_swapins;
+	evictions = now.vms_evictions - last.vms_evictions;
+	last = now;
+	lastcheck = t;
+
+	/*
+	 * Thrashing: faulting hard, and a large share of what
+	 * eviction frees is being faulted straight back in.
+	 */
+	thrashing =
+		(uint64_t)faults * HZ > VM_THRASH_FAULTRATE * interval &&
+		evictions > 0 &&
+		(uint64_t)swapins * 100 >
+			(uint64_t)evictions * VM_THRASH_REFAULTPCT;
+
+	if (!thrashing && !desperate) {
+		return;
+	}
+
+	/* Give the last victim time to die before picking another. */
+	if (vm_oom_lastkill != 0 && t - vm_oom_lastkill < VM_OOM_HOLDOFF) {
+		return;
+	}
+
+	vm_oom_kill();
+}
+
+/* Must be callable with interrupts on; panics if caller is in an IRQ
+ * or already holding a spinlock. */
+static
+void
+vm_can_sleep(void)
+{
+	if (CURCPU_EXISTS()) {
+		KASSERT(curcpu->c_spinlocks == 0);
+		KASSERT(curthread->t_in_interrupt == 0);
+	}
+}
+
+/*
+ * Fill in a vmstats block: the per-cpu event counters summed, plus a
+ * coremap occupancy snapshot. Both halves are racy reads - counters
+ * may tick and pages change state while we scan - which is fine for
+ * statistics.
+ */
+void
+vmstat_gather(struct vmstats *vs)
+{
+	unsigned i;
+
+	bzero(vs, sizeof(*vs));
+
+	for (i = 0; i < VM_MAXCPUS; i++) {
+		vs->vms_faults += vm_stats_pcpu[i].vs_faults;
+		vs->vms_zerofills += vm_stats_pcpu[i].vs_zerofills;
+		vs->vms_prezeroed += vm_stats_pcpu[i].vs_prezeroed;
+		vs->vms_cowfaults += vm_stats_pcpu[i].vs_cowfaults;
+		vs->vms_rofaults += vm_stats_pcpu[i].vs_rofaults;
+		vs->vms_swapins += vm_stats_pcpu[i].vs_swapins;
+		vs->vms_swapouts += vm_stats_pcpu[i].vs_swapouts;
+		vs->vms_evictions += vm_stats_pcpu[i].vs_evictions;
+		vs->vms_zswapouts += vm_stats_pcpu[i].vs_zswapouts;
+		vs->vms_zswapins += vm_stats_pcpu[i].vs_zswapins;
+		vs->vms_pdruns += vm_stats_pcpu[i].vs_pdruns;
+		vs->vms_migrations += vm_stats_pcpu[i].vs_migrations;
+		vs->vms_scrubs += vm_stats_pcpu[i].vs_scrubs;
+	}
+
+	vs->vms_commit = vm_committed_pages;
+	vs->vms_commit_limit = (uint32_t)vm_commit_limit();
+
+	vs->vms_pages_total = coremap_pages;
+	for (i = 0; i < coremap_pages; i++) {
+		switch (coremap[i].state) {
+		case CM_FREE:
+			vs->vms_pages_free++;
+			break;
+		case CM_FIXED:
+			vs->vms_pages_kernel++;
+			break;
+		case CM_USER:
+			vs->vms_pages_user++;
+			break;
+		case CM_EVICTING:
+			vs->vms_pages_evicting++;
+			break;
+		}
+	}
+}
+
+/*
+ * Per-address-space version: copy out the counters the fault and
+ * eviction paths keep on the space, and scan the coremap for the
+ * frames it owns. Same racy-read rules as above. Frames that are
+ * mid-eviction still belong to the space, so they count as resident;
+ * a COW-shared frame counts only toward its recorded owner, since
+ * the coremap tracks just one sharer.
+ */
+void
+vmstat_gather_as(struct addrspace *as, struct pvmstats *pvs)
+{
+	unsigned i;
+
+	bzero(pvs, sizeof(*pvs));
+
+	pvs->pvs_faults = as->as_faults;
+	pvs->pvs_cowfaults = as->as_cowfaults;
+	pvs->pvs_swapins = as->as_swapins;
+	pvs->pvs_evictions = as->as_evictions;
+	pvs->pvs_swapslots = as->as_swapslots;
+
+	for (i = 0; i < coremap_pages; i++) {
+		if ((coremap[i].state == CM_USER ||
+		     coremap[i].state == CM_EVICTING) &&
+		    coremap[i].as == as) {
+			pvs->pvs_resident++;
+		}
+	}
+}
+
+void
+vmstat_dump(void)
+{
+	struct vmstats vs;
+
+	vmstat_gather(&vs);
+
+	kprintf("coremap: %lu pages total | %lu free  %lu kernel  "
+		"%lu user  %lu evicting\n",
+		(unsigned long)vs.vms_pages_total,
+		(unsigned long)vs.vms_pages_free,
+		(unsigned long)vs.vms_pages_kernel,
+		(unsigned long)vs.vms_pages_user,
+		(unsigned long)vs.vms_pages_evicting);
+	kprintf("vm: %lu faults  %lu fills (%lu prezeroed)  %lu cow  "
+		"%lu rofaults  %lu swapins\n",
+		(unsigned long)vs.vms_faults,
+		(unsigned long)vs.vms_zerofills,
+		(unsigned long)vs.vms_prezeroed,
+		(unsigned long)vs.vms_cowfaults,
+		(unsigned long)vs.vms_rofaults,
+		(unsigned long)vs.vms_swapins);
+	kprintf("vm: %lu swapouts  %lu evictions  %lu migrations  "
+		"%lu pagedaemon runs  %lu scrubs\n",
+		(unsigned long)vs.vms_swapouts,
+		(unsigned long)vs.vms_evictions,
+		(unsigned long)vs.vms_migrations,
+		(unsigned long)vs.vms_pdruns,
+		(unsigned long)vs.vms_scrubs);
+	kprintf("vm: zswap %lu stores  %lu loads\n",
+		(unsigned long)vs.vms_zswapouts,
+		(unsigned long)vs.vms_zswapins);
+	kprintf("vm: %lu/%lu pages committed (overcommit %u%%)\n",
+		(unsigned long)vs.vms_commit,
+		(unsigned long)vs.vms_commit_limit,
+		vm_overcommit_pct);
+}
+
+void
+coremap_dump(void)
+{
+	vmstat_dump();
+}
+
+/*
+ * Periodic TLB scrub, called from hardclock. Invalidating the local
+ * TLB forces the next touch of each page through vm_fault, which sets
+ * the PTE referenced bit; without this, a process that never context
+ * switches keeps its TLB entries forever and its hot pages look cold
+ * to the eviction clock hand.
+ */
+void
+vm_tlb_scrub(void)
+{
+	if (!vm_ready) {
+		return;
+	}
+
+	int spl = splhigh();
+	for (int i = 0; i < NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	vm_tlb_restore_asid();
+	vm_tlb_loadpins(proc_getas());
+	splx(spl);
+
+	VMSTAT_INC(vs_scrubs);
+}
+
+/*
+ * The shared clock page (see kern/userclock.h for the layout and the
+ * reader protocol). The VM owns the page because it has to map it:
+ * vm_fault special-cases USERCLOCK_ADDR and installs a read-only
+ * mapping of this one frame in whatever address space faults on it.
+ * The page belongs to no region and no page table, so address space
+ * teardown never touches it.
+ */
+static struct userclock *userclock_page;
+static paddr_t userclock_pa;
+
+/*
+ * Allocate and zero the page. Called from boot() after the clock
+ * device has been configured; until then userclock_tick does nothing
+ * and userclock_gettime reports failure.
+ */
+void
+userclock_bootstrap(void)
+{
+	vaddr_t va;
+
+	va = alloc_kpages(1);
+	if (va == 0) {
+		panic("userclock_bootstrap: out of memory\n");
+	}
+	page_zero((void *)va);
+
+	userclock_pa = va - MIPS_KSEG0;
+	userclock_page = (struct userclock *)va;
+
+	/*
+	 * Pin the page into a wired TLB slot in every address space;
+	 * the vm_fault path below stays as the fallback in case the
+	 * wired slots are ever all taken.
+	 */
+	(void)vm_tlb_pin(NULL, USERCLOCK_ADDR, userclock_pa, false);
+}
+
+/*
+ * Refresh the page from the clock device. Called from hardclock on
+ * the boot cpu, so there is exactly one writer; the version counter
+ * is odd while the fields are inconsistent.
+ */
+void
+userclock_tick(void)
+{
+	struct timespec ts;
+
+	if (userclock_page == NULL) {
+		return;
+	}
+
+	gettime(&ts);
+
+	userclock_page->uc_version++;
+	membar_store_store();
+	userclock_page->uc_secs = ts.tv_sec;
+	userclock_page->uc_nsecs = ts.tv_nsec;
+	membar_store_store();
+	userclock_page->uc_version++;
+}
+
+/*
+ * Kernel-side read of the snapshot, for sys___time. Returns false if
+ * the clock page isn't running yet and the caller should go to the
+ * device instead.
+ */
+bool
+userclock_gettime(struct timespec *ts)
+{
+	uint32_t v1, v2;
+
+	if (userclock_page == NULL) {
+		return false;
+	}
+
+	do {
+		v1 = userclock_page->uc_version;
+		if (v1 == 0) {
+			/* never updated yet */
+			return false;
+		}
+		if (v1 & 1) {
+			/* update in progress on another cpu */
+			continue;
+		}
+		ts->tv_sec = userclock_page->uc_secs;
+		ts->tv_nsec = userclock_page->uc_nsecs;
+		v2 = userclock_page->uc_version;
+	} while (v1 != v2);
+
+	return true;
+}
+
+void
+vm_bootstrap(void)
+{
+	/* Physical memory layout
+	 * [0 ..... kernel_end)  : kernel+ELF sections
+	 * [kernel_end ..... ?)  : UNUSED at boot
+	 */
+
+	paddr_t ram_top = ram_getsize(); // Bytes (exclusive)
+
+	// How many total physical pages exist?
+	coremap_pages = ram_top / PAGE_SIZE;
+
+	// Frames past the direct-mapped limit form the high zone.
+	cm_lowpages = coremap_pages;
+	if (ram_top > MIPS_DIRECTMEM_SIZE) {
+		cm_lowpages = MIPS_DIRECTMEM_SIZE / PAGE_SIZE;
+	}
+
+	// Carve the coremap itself from the boot memory after the
+	// kernel, cache-aligned. The carve is byte-granular, so any
+	// further early carves share the coremap's last partial page
+	// instead of each rounding up to whole pages.
+	paddr_t cm_paddr = ram_carve(coremap_pages *
+				     sizeof(struct coremap_entry),
+				     VM_CACHELINE);
+	if (cm_paddr == 0) {
+		panic("vm_bootstrap: out of memory carving the coremap\n");
+	}
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(cm_paddr);
+
+	// Physical address of the first truly free page.
+	paddr_t free_base = ram_getfirstfree(); // Bytes (inclusive)
+
+	// Initialise every entry
+	for (unsigned i = 0; i < coremap_pages; i++) {
+		paddr_t page_addr = idx_to_pa(i);
+
+		coremap[i].chunk_len = 0;
+		coremap[i].as = NULL;
+		coremap[i].vpn = 0;
+		coremap[i].wired = 0;
+		coremap[i].run_next = CM_NOIDX;
+		coremap[i].run_prev = CM_NOIDX;
+		coremap[i].run_head = CM_NOIDX;
+
+		if (page_addr < free_base) {
+			coremap[i].state = CM_FIXED; /* kernel or coremap itself */
+		} else {
+			coremap[i].state = CM_FREE;
+		}
+	}
+
+	// Free memory is one contiguous run per zone at boot
+	for (unsigned z = 0; z < CM_NZONES; z++) {
+		for (unsigned b = 0; b < CM_NBUCKETS; b++) {
+			cm_buckets[z][b] = CM_NOIDX;
+		}
+		for (unsigned c = 0; c < VM_NCOLORS; c++) {
+			cm_colorlists[z][c] = CM_NOIDX;
+		}
+	}
+	if (free_base < ram_top) {
+		unsigned first = pa_to_idx(free_base);
+
+		if (first < cm_lowpages && cm_lowpages < coremap_pages) {
+			/* Runs never span the zone boundary. */
+			cm_run_insert(first, cm_lowpages - first);
+			cm_run_insert(cm_lowpages,
+				      coremap_pages - cm_lowpages);
+		}
+		else {
+			cm_run_insert(first,
+				      (ram_top - free_base) / PAGE_SIZE);
+		}
+	}
+	cm_nfree = (ram_top - free_base) / PAGE_SIZE;
+
+	// Per-CPU free page caches start out empty
+	for (unsigned z = 0; z < CM_NZONES; z++) {
+		for (unsigned i = 0; i < CM_PCPU_MAXCPUS; i++) {
+			spinlock_init(&cm_pcpu[z][i].pc_lock);
+			cm_pcpu[z][i].pc_count = 0;
+		}
+	}
+
+	vm_ready = true;
+
+	/* Profile the coremap lock (see the "lockstat" menu command). */
+	cm_lock.splk_stat = lockstat_register("coremap");
+
+	/*
+	 * The shared zero page. Read faults on never-written pages
+	 * map this frame read-only instead of committing a frame;
+	 * the first write breaks the mapping and allocates for real.
+	 * It lives in a CM_FIXED page so it can never be evicted.
+	 */
+	vaddr_t zva = alloc_kpages(1);
+	if (zva == 0) {
+		panic("vm_bootstrap: cannot allocate the zero page\n");
+	}
+	page_zero((void *)zva);
+	vm_zero_pfn = pa_to_idx(KVADDR_TO_PADDR(zva));
+
+	/* Let the pagedaemon trim the page cache under pressure. */
+	shrinker_register(&tc_shrinker);
+
+	unsigned free_pages = (ram_top - free_base) / PAGE_SIZE;
+	unsigned mib = (free_pages * PAGE_SIZE) / 1024;
+	kprintf("VM: %u / %u pages free (%u KiB)\n", free_pages, coremap_pages, mib);
+	if (coremap_pages > cm_lowpages) {
+		kprintf("VM: %u pages of high memory via the kseg2 window\n",
+			coremap_pages - cm_lowpages);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Segregated free-run index.
+//
+// Free pages are kept as maximal runs of contiguous pages, linked
+// into size buckets (bucket k holds runs of length [2^k, 2^(k+1)),
+// the last bucket everything larger). Allocation takes the first
+// sufficiently large run and splits it; freeing coalesces with
+// adjacent free runs via the run_head back-pointers. This replaces
+// the O(physical pages) scan the allocator used to do for every
+// multi-page allocation.
+//
+// Single free pages - bucket 0's runs - are segregated further by
+// cache color (frame index modulo VM_NCOLORS, from the direct-mapped
+// cache geometry), so single-page allocation can hand out a frame
+// whose color matches the virtual page it will back. Without this,
+// virtually-contiguous user pages land on whatever colors the free
+// list happens to produce and striding workloads see run-to-run
+// cache-miss variance.
+//
+// All of this runs under cm_lock.
+
+#define CM_NBUCKETS 16
+#define CM_NOIDX ((uint32_t)-1)
+
+/* Both indexed by zone; a free run never spans the zone boundary. */
+static uint32_t cm_buckets[CM_NZONES][CM_NBUCKETS]; /* bucket 0 unused */
+static uint32_t cm_colorlists[CM_NZONES][VM_NCOLORS]; /* singles, by color */
+
+// Cache color of a physical frame.
+static
+unsigned
+cm_color(unsigned idx)
+{
+	return idx % VM_NCOLORS;
+}
+
+// Memory zone of a physical frame (see the zone definitions up top).
+static
+unsigned
+cm_zone(unsigned idx)
+{
+	return idx < cm_lowpages ? CM_ZONE_LOW : CM_ZONE_HIGH;
+}
+
+// Whether this config has a high zone at all. Callers that prefer
+// high frames check this first so that small configs don't pay a
+// cm_lock round trip scanning empty high lists on every allocation.
+static
+bool
+cm_have_high(void)
+{
+	return coremap_pages > cm_lowpages;
+}
+
+// Which bucket a run of LEN pages lives in.
+static
+unsigned
+cm_bucket(unsigned len)
+{
+	unsigned b = 0;
+
+	KASSERT(len > 0);
+	while (b < CM_NBUCKETS - 1 && len >= (2u << b)) {
+		b++;
+	}
+	return b;
+}
+
+// The list head a free run of LEN pages headed at IDX belongs on.
+static
+uint32_t *
+cm_listhead(unsigned idx, unsigned len)
+{
+	if (len == 1) {
+		return &cm_colorlists[cm_zone(idx)][cm_color(idx)];
+	}
+	return &cm_buckets[cm_zone(idx)][cm_bucket(len)];
+}
+
+// Insert a free run [idx, idx+len) into its bucket or color list.
+static
+void
+cm_run_insert(unsigned idx, unsigned len)
+{
+	uint32_t *head = cm_listhead(idx, len);
+
+	KASSERT(coremap[idx].state == CM_FREE);
+
+	coremap[idx].chunk_len = len;
+	coremap[idx].run_head = idx;
+	coremap[idx + len - 1].run_head = idx;
+
+	coremap[idx].run_prev = CM_NOIDX;
+	coremap[idx].run_next = *head;
+	if (*head != CM_NOIDX) {
+		coremap[*head].run_prev = idx;
+	}
+	*head = idx;
+}
+
+// Unlink the free run headed at IDX from its bucket or color list.
+static
+void
+cm_run_remove(unsigned idx)
+{
+	uint32_t *head = cm_listhead(idx, coremap[idx].chunk_len);
+
+	if (coremap[idx].run_prev != CM_NOIDX) {
+		coremap[coremap[idx].run_prev].run_next =
+			coremap[idx].run_next;
+	}
+	else {
+		KASSERT(*head == idx);
+		*head = coremap[idx].run_next;
+	}
+	if (coremap[idx].run_next != CM_NOIDX) {
+		coremap[coremap[idx].run_next].run_prev =
+			coremap[idx].run_prev;
+	}
+	coremap[idx].run_next = CM_NOIDX;
+	coremap[idx].run_prev = CM_NOIDX;
+}
+
+/*
+ * Find and claim a run of NPAGES free pages. Called with cm_lock
+ * held. The pages come back still marked CM_FREE but removed from
+ * the index; the caller sets their final state. Returns
+ * coremap_pages if there is no run big enough.
+ *
+ * Multi-page allocations are kernel allocations, so this searches the
+ * low zone only (see the zone definitions up top).
+ */
+static
+unsigned
+cm_run_alloc(unsigned npages)
+{
+	unsigned b, idx, len;
+
+	KASSERT(spinlock_do_i_hold(&cm_lock));
+
+	if (npages == 1) {
+		/* Singles live on the color lists; no preference here. */
+		return cm_run_alloc_color(CM_ZONE_LOW, 0);
+	}
+
+	for (b = cm_bucket(npages); b < CM_NBUCKETS; b++) {
+		for (idx = cm_buckets[CM_ZONE_LOW][b]; idx != CM_NOIDX;
+		     idx = coremap[idx].run_next) {
+			/*
+			 * Within npages's own bucket, runs may still
+			 * be too small; higher buckets always fit.
+			 */
+			if (coremap[idx].chunk_len >= npages) {
+				goto found;
+			}
+		}
+	}
+	return coremap_pages;
+
+ found:
+	len = coremap[idx].chunk_len;
+	cm_run_remove(idx);
+	cm_nfree -= npages;
+
+	if (len > npages) {
+		/* Split: give back the tail of the run. */
+		coremap[idx + npages].state = CM_FREE;
+		cm_run_insert(idx + npages, len - npages);
+	}
+
+	return idx;
+}
+
+/*
+ * Find and claim one free page, preferring cache color COLOR: the
+ * matching color list first, then the other colors, then a page
+ * carved out of a larger run - picking the right-colored page from
+ * inside the run, since any run of VM_NCOLORS pages or more contains
+ * every color. Same contract as cm_run_alloc otherwise. Color is a
+ * preference, not a guarantee; allocation never fails over color.
+ */
+static
+unsigned
+cm_run_alloc_color(unsigned zone, unsigned color)
+{
+	unsigned c, b, idx, len, off, take;
+
+	KASSERT(spinlock_do_i_hold(&cm_lock));
+	KASSERT(zone < CM_NZONES);
+	KASSERT(color < VM_NCOLORS);
+
+	for (c = 0; c < VM_NCOLORS; c++) {
+		idx = cm_colorlists[zone][(color + c) % VM_NCOLORS];
+		if (idx != CM_NOIDX) {
+			cm_run_remove(idx);
+			cm_nfree -= 1;
+			return idx;
+		}
+	}
+
+	for (b = 1; b < CM_NBUCKETS; b++) {
+		idx = cm_buckets[zone][b];
+		if (idx == CM_NOIDX) {
+			continue;
+		}
+		len = coremap[idx].chunk_len;
+		cm_run_remove(idx);
+		cm_nfree -= 1;
+
+		off = (color + VM_NCOLORS - cm_color(idx)) % VM_NCOLORS;
+		if (off >= len) {
+			off = 0;
+		}
+		take = idx + off;
+
+		/* Give back the pieces on either side of the page. */
+		if (off > 0) {
+			cm_run_insert(idx, off);
+		}
+		if (take + 1 < idx + len) {
+			coremap[take + 1].state = CM_FREE;
+			cm_run_insert(take + 1, len - off - 1);
+		}
+		return take;
+	}
+
+	return coremap_pages;
+}
+
+/*
+ * Return the run [idx, idx+len) to the free index, coalescing with
+ * free neighbours. Called with cm_lock held; the caller must already
+ * have reset the entries' owner fields.
+ */
+static
+void
+cm_run_free(unsigned idx, unsigned len)
+{
+	unsigned nbr;
+
+	KASSERT(spinlock_do_i_hold(&cm_lock));
+
+	cm_nfree += len;
+
+	/*
+	 * Coalesce with a free run ending just below us - but never
+	 * across the zone boundary, so a run always belongs wholly to
+	 * one zone's lists.
+	 */
+	if (idx > 0 && idx != cm_lowpages &&
+	    coremap[idx - 1].state == CM_FREE) {
+		nbr = coremap[idx - 1].run_head;
+		KASSERT(nbr + coremap[nbr].chunk_len == idx);
+		cm_run_remove(nbr);
+		len += idx - nbr;
+		idx = nbr;
+	}
+
+	/* Coalesce with a free run starting just above us; same rule. */
+	if (idx + len < coremap_pages && idx + len != cm_lowpages &&
+	    coremap[idx + len].state == CM_FREE) {
+		nbr = idx + len;
+		KASSERT(coremap[nbr].run_head == nbr);
+		cm_run_remove(nbr);
+		len += coremap[nbr].chunk_len;
+	}
+
+	for (unsigned j = 0; j < len; j++) {
+		coremap[idx + j].state = CM_FREE;
+		coremap[idx + j].chunk_len = 0;
+	}
+	cm_run_insert(idx, len);
+}
+
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	if (npages == 0) {
+		return 0;
+	}
+
+	KASSERT(vm_ready); // We initialize VM before everything else (see main.c)
+
+	vm_can_sleep();
+
+	/*
+	 * Single pages come from the per-CPU cache and don't touch
+	 * cm_lock in the common case. If memory is full, evict a
+	 * page and retry the cache; the refill will pick up whatever
+	 * eviction freed.
+	 */
+	if (npages == 1) {
+		unsigned cidx, tries;
+
+		for (tries = 0; tries < 3; tries++) {
+			if (cm_pcpu_getpage(CM_ZONE_LOW,
+					    cm_colorrotor++ % VM_NCOLORS,
+					    &cidx)) {
+				return PADDR_TO_KVADDR(idx_to_pa(cidx));
+			}
+			if (vm_evict_page(&cidx)) {
+				return 0;
+			}
+		}
+		return 0;
+	}
+
+	spinlock_acquire(&cm_lock);
+
+	unsigned idx = cm_run_alloc(npages);
+	if (idx == coremap_pages) {
+		/*
+		 * Multi-page allocations can't be satisfied through
+		 * eviction, so the caller sees the failure either way;
+		 * but note it for the pagedaemon, whose compaction pass
+		 * can make a later retry succeed.
+		 */
+		cm_runfail_count++;
+		if (npages > cm_runfail_want) {
+			cm_runfail_want = npages;
+		}
+		if (pd_wchan != NULL) {
+			wchan_wakeone(pd_wchan, &cm_lock);
+		}
+		spinlock_release(&cm_lock);
+		return 0;
+	}
+
+	/* Mark allocation */
+	coremap[idx].state = CM_FIXED;
+	coremap[idx].chunk_len = npages;
+	for (unsigned j = 1; j < npages; j++) {
+		coremap[idx + j].state = CM_FIXED;
+		coremap[idx + j].chunk_len = 0;
+	}
+
+	spinlock_release(&cm_lock);
+
+	paddr_t pa = idx_to_pa(idx);
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t kvaddr)
+{
+	KASSERT(vm_ready); // We initialize VM before everything else (see main.c)
+	// if (!vm_ready) {
+	// 	return;
+	// }
+
+	paddr_t pa = KVADDR_TO_PADDR(kvaddr);
+	unsigned idx = pa_to_idx(pa);
+
+	KASSERT(idx < coremap_pages);
+
+	/*
+	 * Single pages go back to the per-CPU cache without touching
+	 * cm_lock. We own the allocation, so reading the entry
+	 * unlocked is safe.
+	 */
+	if (coremap[idx].state == CM_FIXED && coremap[idx].chunk_len == 1) {
+		coremap[idx].as = NULL;
+		coremap[idx].vpn = 0;
+		cm_pcpu_putpage(idx);
+		return;
+	}
+
+	spinlock_acquire(&cm_lock);
+
+	if (coremap[idx].state != CM_FIXED || coremap[idx].chunk_len == 0) {
+		spinlock_release(&cm_lock);
+		panic("free_kpages: bad or non-head page @%u\n", idx);
+	}
+
+	unsigned run = coremap[idx].chunk_len;
+	for (unsigned j = 0; j < run; j++) {
+		KASSERT(coremap[idx + j].state == CM_FIXED);
+		coremap[idx + j].as = NULL;
+		coremap[idx + j].vpn = 0;
+	}
+	cm_run_free(idx, run);
+
+	spinlock_release(&cm_lock);
+}
+
+/*
+ * Allocate a physical page for user space
+ * The page will be mapped to the virtual address vaddr in the address space as
+ * Returns the physical frame number, or 0 if allocation fails
+ */
+unsigned
+alloc_upage(struct addrspace *as, vaddr_t vaddr)
+{
+	vm_can_sleep();
+
+	unsigned idx, tries, color;
+
+	/*
+	 * Match the frame's cache color to the virtual page, so
+	 * virtually-contiguous pages get distinct, repeatable colors.
+	 * Owner-less pages (shm segments, cache prefetch) have no
+	 * meaningful vaddr; rotate those.
+	 */
+	color = (as != NULL) ? VPN(vaddr) % VM_NCOLORS
+		: cm_colorrotor++ % VM_NCOLORS;
+
+	for (tries = 0; tries < 3; tries++) {
+		/*
+		 * High memory first, to keep direct-mapped low memory
+		 * for the kernel.
+		 */
+		if ((cm_have_high() &&
+		     cm_pcpu_getpage(CM_ZONE_HIGH, color, &idx)) ||
+		    cm_pcpu_getpage(CM_ZONE_LOW, color, &idx)) {
+			/*
+			 * The entry is ours (CM_FIXED, chunk_len 1);
+			 * convert it to a user page. Fill in the
+			 * owner before publishing the state so that
+			 * the eviction scanner, which keys off
+			 * CM_USER, never sees a stale owner.
+			 */
+			coremap[idx].as = as;
+			coremap[idx].vpn = VPN(vaddr);
+			coremap[idx].refcount = 1;
+			coremap[idx].wired = 0;
+			membar_store_store();
+			coremap[idx].state = CM_USER;
+
+			return idx;
+		}
+
+		/* Out of memory; evict somebody and retry the cache. */
+		if (vm_evict_page(&idx)) {
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Like alloc_upage, but the frame comes back already zeroed. Pulls
+ * from the pre-zeroed pool when it can, skipping the bzero entirely;
+ * otherwise allocates normally and clears the page here.
+ */
+unsigned
+alloc_upage_zeroed(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned idx, color;
+
+	/* Same color preference as alloc_upage. */
+	color = (as != NULL) ? VPN(vaddr) % VM_NCOLORS
+		: cm_colorrotor++ % VM_NCOLORS;
+
+	if (vm_zpool_get(color, &idx)) {
+		/* Convert to a user page, as in alloc_upage. */
+		coremap[idx].as = as;
+		coremap[idx].vpn = VPN(vaddr);
+		coremap[idx].refcount = 1;
+		coremap[idx].wired = 0;
+		membar_store_store();
+		coremap[idx].state = CM_USER;
+
+		VMSTAT_INC(vs_prezeroed);
+		return idx;
+	}
+
+	idx = alloc_upage(as, vaddr);
+	if (idx != 0) {
+		page_zero((void *)PADDR_TO_KVADDR(idx_to_pa(idx)));
+	}
+	return idx;
+}
+
+/*
+ * Free a physical page for user space
+ * The page will be unmapped from the virtual address vaddr in the address space
+ */
+void
+free_upage(unsigned idx)
+{
+	KASSERT(vm_ready);
+	KASSERT(idx < coremap_pages);
+
+	spinlock_acquire(&cm_lock);
+
+	/* Check if the page is being evicted */
+	if (coremap[idx].state == CM_EVICTING) {
+		/* Page is being evicted, don't free it now */
+		spinlock_release(&cm_lock);
+		return;
+	}
+
+	/* We expect exactly one–page allocations for user pages */
+	KASSERT(coremap[idx].state == CM_USER);
+	KASSERT(coremap[idx].chunk_len == 1);
+	KASSERT(coremap[idx].refcount > 0);
+
+	/*
+	 * Shared (copy-on-write) page: just drop our reference. We
+	 * don't know whether the departing sharer is the recorded
+	 * owner, so conservatively clear the owner; the page becomes
+	 * unevictable until a surviving sharer reclaims it on its
+	 * next write fault.
+	 */
+	if (--coremap[idx].refcount > 0) {
+		coremap[idx].as = NULL;
+		coremap[idx].vpn = 0;
+		spinlock_release(&cm_lock);
+		return;
+	}
+
+	/*
+	 * Reclaim the page into the per-CPU cache rather than the
+	 * global free pool. We still need cm_lock for the state
+	 * check above (it synchronizes with the eviction marker),
+	 * but we skip the global free list churn.
+	 */
+	coremap[idx].state = CM_FIXED;
+	coremap[idx].as = NULL;
+	coremap[idx].vpn = 0;
+	coremap[idx].wired = 0;
+
+	spinlock_release(&cm_lock);
+
+	cm_pcpu_putpage(idx);
+}
+
+/*
+ * Free a batch of user pages under one cm_lock acquisition. Address
+ * space teardown frees pages by the thousand; taking and releasing
+ * the coremap lock once per page makes process exit a lock storm.
+ *
+ * Semantics per page are identical to free_upage. IDXS is clobbered:
+ * we compact into it the pages whose last reference dropped, since
+ * those must go to the per-CPU cache after cm_lock is released.
+ */
+void
+free_upage_bulk(unsigned *idxs, unsigned n)
+{
+	unsigned i, nfreed;
+
+	KASSERT(vm_ready);
+
+	nfreed = 0;
+
+	spinlock_acquire(&cm_lock);
+	for (i = 0; i < n; i++) {
+		unsigned idx = idxs[i];
+
+		KASSERT(idx < coremap_pages);
+
+		/* Page is being evicted; the evictor owns it now. */
+		if (coremap[idx].state == CM_EVICTING) {
+			continue;
+		}
+
+		KASSERT(coremap[idx].state == CM_USER);
+		KASSERT(coremap[idx].chunk_len == 1);
+		KASSERT(coremap[idx].refcount > 0);
+
+		/* Shared page: drop our reference (see free_upage) */
+		if (--coremap[idx].refcount > 0) {
+			coremap[idx].as = NULL;
+			coremap[idx].vpn = 0;
+			continue;
+		}
+
+		coremap[idx].state = CM_FIXED;
+		coremap[idx].as = NULL;
+		coremap[idx].vpn = 0;
+		coremap[idx].wired = 0;
+		idxs[nfreed++] = idx;
+	}
+	spinlock_release(&cm_lock);
+
+	for (i = 0; i < nfreed; i++) {
+		cm_pcpu_putpage(idxs[i]);
+	}
+}
+
+/*
+ * Set or clear the wired (mlock) mark on a user page; wired pages
+ * are passed over by the eviction scan. Returns EBUSY when trying
+ * to wire a page that's mid-eviction: the caller should wait for
+ * the eviction to finish (by faulting the page back in) and retry.
+ */
+int
+vm_page_setwired(unsigned idx, bool wired)
+{
+	KASSERT(vm_ready);
+	KASSERT(idx < coremap_pages);
+
+	spinlock_acquire(&cm_lock);
+	if (wired && coremap[idx].state == CM_EVICTING) {
+		spinlock_release(&cm_lock);
+		return EBUSY;
+	}
+	KASSERT(coremap[idx].state == CM_USER);
+	coremap[idx].wired = wired;
+	spinlock_release(&cm_lock);
+	return 0;
+}
+
+/*
+ * Take an extra reference on a user page; used when fork shares a
+ * resident page copy-on-write instead of duplicating it.
+ */
+void
+vm_page_incref(unsigned idx)
+{
+	KASSERT(vm_ready);
+	KASSERT(idx < coremap_pages);
+
+	spinlock_acquire(&cm_lock);
+	KASSERT(coremap[idx].state == CM_USER);
+	KASSERT(coremap[idx].refcount > 0);
+	coremap[idx].refcount++;
+	spinlock_release(&cm_lock);
+}
+
+/*
+ * Drop a reference taken with vm_page_incref without disturbing the
+ * recorded owner, for callers that pinned a page (sys_futex) rather
+ * than shared it. Must not be the last reference: the pinner's own
+ * address space still maps the page, so its reference is outstanding.
+ */
+void
+vm_page_decref(unsigned idx)
+{
+	KASSERT(vm_ready);
+	KASSERT(idx < coremap_pages);
+
+	spinlock_acquire(&cm_lock);
+	KASSERT(coremap[idx].state == CM_USER);
+	KASSERT(coremap[idx].refcount > 1);
+	coremap[idx].refcount--;
+	spinlock_release(&cm_lock);
+}
+
+/*
+ * Snapshot of a user page's reference count. A caller holding its
+ * own PTE lock that sees 1 is the sole owner: the count can only
+ * decrease under it, and it can only increase through that caller's
+ * own fork.
+ */
+unsigned
+vm_page_refcount(unsigned idx)
+{
+	unsigned ret;
+
+	KASSERT(vm_ready);
+	KASSERT(idx < coremap_pages);
+
+	spinlock_acquire(&cm_lock);
+	KASSERT(coremap[idx].state == CM_USER);
+	ret = coremap[idx].refcount;
+	spinlock_release(&cm_lock);
+
+	return ret;
+}
+
+/*
+ * Translate the user page containing UADDR to its physical frame and
+ * wire it: fault it in if need be and take an extra reference so the
+ * eviction scan passes it over (shared frames are never evicted).
+ * The caller unwires with vm_page_decref.
+ */
+int
+vm_page_wire(userptr_t uaddr, unsigned *pfn_ret)
+{
+	struct addrspace *as;
+	struct pte *pte;
+	unsigned pfn;
+	char junk;
+	int result;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	for (;;) {
+		/*
+		 * Touch the page from the kernel first. This both
+		 * validates the address and faults the page in (or
+		 * back in from swap) before we look at the PTE.
+		 */
+		result = copyin(uaddr, &junk, sizeof(junk));
+		if (result) {
+			return result;
+		}
+
+		pte = pt_get_pte(as, (vaddr_t)uaddr, false);
+		if (pte == NULL) {
+			return EFAULT;
+		}
+
+		lock_acquire(pte->pte_lock);
+		if (pte->state != PTE_STATE_RAM) {
+			/* Evicted between the copyin and here; redo. */
+			lock_release(pte->pte_lock);
+			continue;
+		}
+		pfn = pte->pfn;
+		vm_page_incref(pfn);
+		lock_release(pte->pte_lock);
+
+		*pfn_ret = pfn;
+		return 0;
+	}
+}
+
+/*
+ * Record AS as the owner of a user page, e.g. after a sole surviving
+ * sharer breaks copy-on-write in place. Makes the page evictable
+ * again.
+ */
+void
+vm_page_claim(unsigned idx, struct addrspace *as, vaddr_t vaddr)
+{
+	KASSERT(vm_ready);
+	KASSERT(idx < coremap_pages);
+
+	spinlock_acquire(&cm_lock);
+	KASSERT(coremap[idx].state == CM_USER);
+	KASSERT(coremap[idx].refcount == 1);
+	coremap[idx].as = as;
+	coremap[idx].vpn = VPN(vaddr);
+	spinlock_release(&cm_lock);
+}
+
+// Returns total bytes not in CM_FREE state
+unsigned
+coremap_used_bytes(void)
+{
+	if (!vm_ready) {
+		return 0;
+	}
+
+	spinlock_acquire(&cm_lock);
+
+	unsigned used = 0;
+	for (unsigned i = 0; i < coremap_pages; i++) {
+		if (coremap[i].state != CM_FREE) {
+			used += PAGE_SIZE;
+		}
+	}
+
+	spinlock_release(&cm_lock);
+	return used;
+}
+
+////////////////////////////////////////////////////////////
+//
+// The file page cache.
+//
+// One page-granular cache of file contents keyed by (vnode, file
+// offset), shared by the two consumers that used to each keep their
+// own copy: vm_fault maps cached frames of read-only file-backed
+// pages (text and rodata) straight into address spaces, and
+// vnode_read serves ordinary reads of regular files out of the same
+// frames (vnode.c). The cache holds one page reference of its own,
+// so a frame outlives the address spaces and readers using it: a
+// repeat exec or a re-read does no I/O and no buffer-cache copy at
+// all. Sharing read-only frames across address spaces needs no
+// copy-on-write bookkeeping - writes to such pages are protection
+// violations anyway.
+//
+// The cache is capped; above the cap the oldest entry is dropped
+// (its frame is freed once the last mapper goes away, via the usual
+// refcount). Cached frames are never chosen by the eviction scan -
+// mapped ones because they're shared, idle ones because their owner
+// slot is cleared - so the cap is also a bound on memory the cache
+// can pin.
+//
+// Entries carry the vnode's stat generation (bumped by every write
+// and truncate); a lookup that finds a stale generation discards the
+// entry, so rewriting an executable in place doesn't serve old text.
+
+#define TEXTCACHE_BUCKETS	64
+#define TEXTCACHE_MAXPAGES	256
+
+struct tc_entry {
+	struct tc_entry *tc_next;	/* hash chain */
+	struct tc_entry *tc_qnext;	/* FIFO, for the cap */
+	struct tc_entry *tc_qprev;
+	struct vnode *tc_vn;		/* counted reference */
+	off_t tc_off;
+	unsigned tc_gen;		/* vnode_statgen at fill time */
+	unsigned tc_pfn;
+};
+
+static struct tc_entry *tc_hash[TEXTCACHE_BUCKETS];
+static struct tc_entry *tc_qhead;	/* oldest */
+static struct tc_entry *tc_qtail;	/* newest */
+static unsigned tc_npages;
+static struct spinlock tc_lock = SPINLOCK_INITIALIZER;
+
+static
+unsigned
+tc_bucket(struct vnode *vn, off_t off)
+{
+	uintptr_t n = (uintptr_t)vn ^ (uintptr_t)(off >> 12);
+
+	return (n ^ (n >> 6)) % TEXTCACHE_BUCKETS;
+}
+
+static
+void
+tc_unlink(struct tc_entry *tc)
+{
+	struct tc_entry **p;
+
+	for (p = &tc_hash[tc_bucket(tc->tc_vn, tc->tc_off)];
+	     *p != tc; p = &(*p)->tc_next) {
+		KASSERT(*p != NULL);
+	}
+	*p = tc->tc_next;
+
+	if (tc->tc_qprev != NULL) {
+		tc->tc_qprev->tc_qnext = tc->tc_qnext;
+	}
+	else {
+		tc_qhead = tc->tc_qnext;
+	}
+	if (tc->tc_qnext != NULL) {
+		tc->tc_qnext->tc_qprev = tc->tc_qprev;
+	}
+	else {
+		tc_qtail = tc->tc_qprev;
+	}
+	tc_npages--;
+}
+
+/*
+ * Look up the frame caching (VN, OFF). On a hit, take a page
+ * reference for the caller and return true; the caller drops it
+ * with free_upage when done (or keeps it, for a mapping).
+ */
+bool
+vm_pagecache_get(struct vnode *vn, off_t off, unsigned *pfn_ret)
+{
+	struct tc_entry *tc;
+	unsigned gen;
+
+	gen = vnode_statgen(vn);
+
+	spinlock_acquire(&tc_lock);
+	for (tc = tc_hash[tc_bucket(vn, off)]; tc != NULL; tc = tc->tc_next) {
+		if (tc->tc_vn != vn || tc->tc_off != off) {
+			continue;
+		}
+		if (tc->tc_gen != gen) {
+			/* File was written since; drop the entry. */
+			tc_unlink(tc);
+			spinlock_release(&tc_lock);
+			free_upage(tc->tc_pfn);
+			VOP_DECREF(tc->tc_vn);
+			kfree(tc);
+			return false;
+		}
+		vm_page_incref(tc->tc_pfn);
+		*pfn_ret = tc->tc_pfn;
+		spinlock_release(&tc_lock);
+		return true;
+	}
+	spinlock_release(&tc_lock);
+	return false;
+}
+
+/*
+ * Enter the frame PFN, which the caller just filled from (VN, OFF),
+ * into the cache. Takes the cache's own page reference. May sleep;
+ * callable from the fault path with the PTE lock held.
+ */
+void
+vm_pagecache_insert(struct vnode *vn, off_t off, unsigned pfn)
+{
+	struct tc_entry *tc, *old, *scan;
+	unsigned b;
+
+	tc = kmalloc(sizeof(*tc));
+	if (tc == NULL) {
+		/* No harm done; the page just isn't cached. */
+		return;
+	}
+
+	spinlock_acquire(&tc_lock);
+
+	/* Lost a race with another fault on the same page? */
+	b = tc_bucket(vn, off);
+	for (scan = tc_hash[b]; scan != NULL; scan = scan->tc_next) {
+		if (scan->tc_vn == vn && scan->tc_off == off) {
+			spinlock_release(&tc_lock);
+			kfree(tc);
+			return;
+		}
+	}
+
+	tc->tc_vn = vn;
+	tc->tc_off = off;
+	tc->tc_gen = vnode_statgen(vn);
+	tc->tc_pfn = pfn;
+	VOP_INCREF(vn);
+	vm_page_incref(pfn);
+
+	tc->tc_next = tc_hash[b];
+	tc_hash[b] = tc;
+	tc->tc_qprev = tc_qtail;
+	tc->tc_qnext = NULL;
+	if (tc_qtail != NULL) {
+		tc_qtail->tc_qnext = tc;
+	}
+	else {
+		tc_qhead = tc;
+	}
+	tc_qtail = tc;
+	tc_npages++;
+
+	/* Over the cap: push out the oldest entry. */
+	old = NULL;
+	if (tc_npages > TEXTCACHE_MAXPAGES) {
+		old = tc_qhead;
+		tc_unlink(old);
+	}
+
+	spinlock_release(&tc_lock);
+
+	if (old != NULL) {
+		/* VOP_DECREF can sleep (reclaim), hence outside tc_lock. */
+		free_upage(old->tc_pfn);
+		VOP_DECREF(old->tc_vn);
+		kfree(old);
+	}
+}
+
+/*
+ * Shrinker hook: under memory pressure, push out the cache's oldest
+ * entries, oldest first, until NPAGES are gone or the cache is
+ * empty. An entry whose frame is still mapped somewhere only loses
+ * the cache's reference, so the count reported is an upper bound;
+ * the pagedaemon rechecks cm_nfree before resorting to eviction
+ * anyway.
+ */
+static
+unsigned
+vm_pagecache_shrink(unsigned npages, void *data)
+{
+	struct tc_entry *old;
+	unsigned freed;
+
+	(void)data;
+
+	for (freed = 0; freed < npages; freed++) {
+		spinlock_acquire(&tc_lock);
+		old = tc_qhead;
+		if (old == NULL) {
+			spinlock_release(&tc_lock);
+			break;
+		}
+		tc_unlink(old);
+		spinlock_release(&tc_lock);
+
+		/* VOP_DECREF can sleep (reclaim), hence outside tc_lock. */
+		free_upage(old->tc_pfn);
+		VOP_DECREF(old->tc_vn);
+		kfree(old);
+	}
+
+	return freed;
+}
+
+static struct shrinker tc_shrinker = {
+	.sh_name = "pagecache",
+	.sh_shrink = vm_pagecache_shrink,
+	.sh_data = NULL,
+	.sh_next = NULL,
+};
+
+/*
+ * Background prefetch into the page cache, for madvise(MADV_WILLNEED)
+ * and the MADV_SEQUENTIAL readahead kicked off by the fault path. A
+ * small job runs on the shared workqueue and reads the pages that
+ * aren't cached yet into fresh frames, so the later faults find them
+ * with a memory copy instead of disk I/O. Only read-only file-backed
+ * pages ever come from the cache, so that's all that's worth
+ * prefetching.
+ */
+
+/* Cap per prefetch job, so one hint can't churn the whole cache */
+#define TC_PREFETCH_MAX		(TEXTCACHE_MAXPAGES / 4)
+
+/* Readahead window for MADV_SEQUENTIAL regions, in pages */
+#define VM_READAHEAD		8
+
+struct tc_prefetch {
+	struct work pf_work;
+	struct vnode *pf_vn;	/* counted reference */
+	off_t pf_off;
+	unsigned pf_npages;
+};
+
+static
+void
+tc_prefetch_worker(struct work *wk, void *data)
+{
+	struct tc_prefetch *pf = data;
+	struct iovec iov;
+	struct uio ku;
+	unsigned pfn;
+
+	(void)wk;
+
+	for (unsigned i = 0; i < pf->pf_npages; i++) {
+		off_t off = pf->pf_off + (off_t)i * PAGE_SIZE;
+
+		if (vm_pagecache_get(pf->pf_vn, off, &pfn)) {
+			/* Already cached; drop the lookup reference. */
+			free_upage(pfn);
+			continue;
+		}
+
+		/*
+		 * No owning address space: the frame belongs to the
+		 * cache alone until a fault maps it, and the NULL
+		 * owner keeps it off the eviction scan meanwhile.
+		 */
+		pfn = alloc_upage_zeroed(NULL, 0);
+		if (pfn == 0) {
+			/* Memory is tight; prefetching would hurt. */
+			break;
+		}
+
+		vaddr_t kva = PADDR_TO_KVADDR(idx_to_pa(pfn));
+		uio_kinit(&iov, &ku, (void *)kva, PAGE_SIZE, off, UIO_READ);
+		if (__VOP(pf->pf_vn, read)(pf->pf_vn, &ku) != 0 ||
+		    ku.uio_resid == PAGE_SIZE) {
+			/* Error or wholly past EOF; nothing to cache. */
+			free_upage(pfn);
+			break;
+		}
+
+		vm_pagecache_insert(pf->pf_vn, off, pfn);
+		/* The cache holds its own reference now. */
+		free_upage(pfn);
+	}
+
+	VOP_DECREF(pf->pf_vn);
+	kfree(pf);
+}
+
+/*
+ * Queue a background read of NPAGES pages of VN starting at OFF into
+ * the page cache. Best-effort: it's a hint, so allocation failure
+ * just drops it. Safe to call from the fault path.
+ */
+void
+vm_pagecache_prefetch(struct vnode *vn, off_t off, unsigned npages)
+{
+	struct tc_prefetch *pf;
+
+	if (npages == 0) {
+		return;
+	}
+	if (npages > TC_PREFETCH_MAX) {
+		npages = TC_PREFETCH_MAX;
+	}
+
+	pf = kmalloc(sizeof(*pf));
+	if (pf == NULL) {
+		return;
+	}
+	work_init(&pf->pf_work, tc_prefetch_worker, pf);
+	pf->pf_vn = vn;
+	VOP_INCREF(vn);
+	pf->pf_off = off;
+	pf->pf_npages = npages;
+	work_submit(&pf->pf_work);
+}
+
+/*
+ * Fill a freshly zeroed frame (mapped at KVA) with any file content
+ * backing the user page at VA, for demand-paged executables. Pages
+ * without backing are left as zeros. Called with the PTE lock held;
+ * may sleep in the filesystem.
+ */
+static
+int
+vm_fill_from_file(struct addrspace *as, vaddr_t va, vaddr_t kva)
+{
+	struct vnode *vn;
+	off_t off;
+	size_t len;
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	if (!as_page_backing(as, va, &vn, &off, &len)) {
+		return 0;
+	}
+
+	uio_kinit(&iov, &ku, (void *)kva, len, off, UIO_READ);
+	/*
+	 * Straight to the filesystem: the fault path does its own
+	 * page-cache lookup and insert, so going through vnode_read's
+	 * read-through here would just fill a second frame.
+	 */
+	result = __VOP(vn, read)(vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		/* short read; executable truncated? */
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+/*
+ * Process one shootdown request, in interrupt context. ts_as == NULL
+ * is the queue-overflow marker and means flush everything.
+ */
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	if (ts->ts_as == NULL) {
+		int spl = splhigh();
+		for (int i = 0; i < NUM_TLB; i++) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+		vm_tlb_restore_asid();
+		vm_tlb_loadpins(proc_getas());
+		splx(spl);
+		return;
+	}
+
+	tlb_invalidate_as(ts->ts_as, ts->ts_vaddr);
+}
+
+/*
+ * TLB refill for the kseg2 window onto high physical memory (see
+ * PADDR_TO_KVADDR). The translation is linear and the entries are
+ * written global, so they match under every ASID and survive address
+ * space switches; a whole-TLB flush just costs a refault here. Nothing
+ * is locked and nothing sleeps, so this is safe from any kernel
+ * context - including under spinlocks, which is where page_zero and
+ * friends touch high frames.
+ */
+static
+int
+vm_kseg2_fault(vaddr_t faultaddress)
+{
+	paddr_t pa;
+	uint32_t ehi, elo;
+
+	pa = faultaddress - MIPS_KSEG2 + MIPS_DIRECTMEM_SIZE;
+	if (pa_to_idx(pa) >= coremap_pages) {
+		/* Off the end of RAM; a wild kernel pointer. */
+		return EFAULT;
+	}
+
+	ehi = faultaddress & TLBHI_VPAGE;
+	elo = (pa & TLBLO_PPAGE) | TLBLO_VALID | TLBLO_DIRTY | TLBLO_GLOBAL;
+
+	int spl = splhigh();
+	tlb_random(ehi, elo);
+	/* tlb_random left a PID of 0 live in c0_entryhi; put the ASID back */
+	vm_tlb_restore_asid();
+	splx(spl);
+
+	return 0;
+}
+
+/*
+ * Wait for a page-in in flight on PTE to finish. The PTE lock is held
+ * on entry and on return but dropped while sleeping, so recheck
+ * anything derived from the entry afterwards. The busy-holder can't
+ * clear the bit without the PTE lock, which we hold until we're on
+ * the channel, so the wakeup can't be missed.
+ */
+void
+pte_pagein_wait(struct pte *pte)
+{
+	KASSERT(lock_do_i_hold(pte->pte_lock));
+
+	while (pte->busy) {
+		KASSERT(pagein_wchan != NULL);
+		spinlock_acquire(&pagein_splk);
+		lock_release(pte->pte_lock);
+		wchan_sleep(pagein_wchan, &pagein_splk);
+		spinlock_release(&pagein_splk);
+		lock_acquire(pte->pte_lock);
+	}
+}
+
+/*
+ * End a page-in: clear the busy bit and wake the waiters. Called with
+ * the PTE lock held. Wakes everyone; each waiter rechecks its own
+ * PTE's busy bit, and waiters for this page go on to find whatever
+ * state the I/O left behind.
+ */
+static
+void
+pte_pagein_done(struct pte *pte)
+{
+	KASSERT(lock_do_i_hold(pte->pte_lock));
+	KASSERT(pte->busy);
+
+	pte->busy = 0;
+
+	spinlock_acquire(&pagein_splk);
+	wchan_wakeall(pagein_wchan, &pagein_splk);
+	spinlock_release(&pagein_splk);
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct pte *pte;
+	struct region *reg;
+	uint32_t ehi, elo;
+	unsigned pfn;
+	bool need_zero = false;
+	bool readonly = false;
+	bool in_any = false;
+
+	faultaddress &= PAGE_FRAME;
+	if (faultaddress >= MIPS_KSEG2) {
+		if (faulttype == VM_FAULT_READONLY) {
+			/* Window entries are always writable. */
+			return EFAULT;
+		}
+		return vm_kseg2_fault(faultaddress);
+	}
+	if (faultaddress >= MIPS_KSEG0) {
+		return EFAULT;
+	}
+
+	VMSTAT_INC(vs_faults);
+	KTRACE(KTR_VM_FAULT, faultaddress, faulttype);
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	as->as_faults++;
+
+	if (faultaddress == USERCLOCK_ADDR && userclock_pa != 0) {
+		/*
+		 * The shared clock page. Read-only by definition;
+		 * writes are protection violations. It lives outside
+		 * the region and page table machinery, so just drop
+		 * a mapping of the one shared frame into the TLB.
+		 */
+		if (faulttype != VM_FAULT_READ) {
+			return EFAULT;
+		}
+
+		ehi = faultaddress | vm_tlb_asidfield(as);
+		elo = userclock_pa | TLBLO_VALID;
+
+		int spl = splhigh();
+		tlb_random(ehi, elo);
+		splx(spl);
+
+		return 0;
+	}
+
+	if (faulttype == VM_FAULT_READONLY) {
+		/*
+		 * A write hit a TLB entry without the dirty bit. For
+		 * copy-on-write pages this is where the copy happens;
+		 * anything else really is a protection violation.
+		 */
+		VMSTAT_INC(vs_rofaults);
+		pte = pt_get_pte(as, faultaddress, false);
+		if (pte == NULL) {
+			return EFAULT;
+		}
+
+		lock_acquire(pte->pte_lock);
+		pte_pagein_wait(pte);
+
+		if ((pte->state == PTE_STATE_ZERO ||
+		     pte->state == PTE_STATE_UNALLOC) && !pte->readonly) {
+			/*
+			 * First write to a page backed by the shared
+			 * zero page: commit a real frame now.
+			 */
+			pfn = alloc_upage_zeroed(as, faultaddress);
+			if (pfn == 0) {
+				lock_release(pte->pte_lock);
+				return ENOMEM;
+			}
+
+			int fresult = vm_fill_from_file(as, faultaddress,
+					PADDR_TO_KVADDR(idx_to_pa(pfn)));
+			if (fresult) {
+				free_upage(pfn);
+				lock_release(pte->pte_lock);
+				return fresult;
+			}
+
+			pte->state = PTE_STATE_RAM;
+			pte->pfn = pfn;
+			pte->referenced = 1;
+			pte->dirty = 1;
+			pte_sync_fast(pte);
+
+			ehi = faultaddress | vm_tlb_asidfield(as);
+			elo = (pfn << 12) | TLBLO_VALID | TLBLO_DIRTY;
+
+			lock_release(pte->pte_lock);
+
+			/* Replace the read-only zero-page TLB entry */
+			tlb_invalidate(faultaddress);
+
+			int spl = splhigh();
+			tlb_random(ehi, elo);
+			splx(spl);
+
+			return 0;
+		}
+
+		if (pte->state != PTE_STATE_RAM || !pte->cow) {
+			lock_release(pte->pte_lock);
+			return EFAULT;
+		}
+
+		unsigned oldpfn = pte->pfn;
+
+		VMSTAT_INC(vs_cowfaults);
+		as->as_cowfaults++;
+
+		if (vm_page_refcount(oldpfn) == 1) {
+			/*
+			 * We're the last sharer; take the page back
+			 * in place and make it evictable again.
+			 */
+			pte->cow = 0;
+			vm_page_claim(oldpfn, as, faultaddress);
+			/* Frame keeps (only) this mapping's wiring */
+			vm_page_setwired(oldpfn, pte->wired);
+			pfn = oldpfn;
+		}
+		else {
+			/* Still shared; copy to a private page. */
+			pfn = alloc_upage(as, faultaddress);
+			if (pfn == 0) {
+				lock_release(pte->pte_lock);
+				return ENOMEM;
+			}
+
+			page_copy((void *)PADDR_TO_KVADDR(idx_to_pa(pfn)),
+				  (void *)PADDR_TO_KVADDR(idx_to_pa(oldpfn)));
+
+			pte->pfn = pfn;
+			pte->cow = 0;
+
+			/*
+			 * The wiring follows the mapping to the new
+			 * frame; the old frame's mark clears when its
+			 * last sharer frees it.
+			 */
+			if (pte->wired) {
+				vm_page_setwired(pfn, true);
+			}
+
+			/* Drop our reference; frees the frame if last */
+			free_upage(oldpfn);
+		}
+
+		pte->referenced = 1;
+		pte->dirty = 1;
+		pte_sync_fast(pte);
+
+		KASSERT(!pte->readonly);
 
-int
-vm_fault(int faulttype, vaddr_t faultaddress)
-{
-	struct addrspace *as;
-	struct pte *pte;
-	struct region *reg;
-	uint32_t ehi, elo;
-	unsigned pfn;
-	bool need_zero = false;
-	bool readonly = false;
-	bool in_any = false;
+		ehi = faultaddress | vm_tlb_asidfield(as);
+		elo = (pfn << 12) | TLBLO_VALID | TLBLO_DIRTY;
 
-	faultaddress &= PAGE_FRAME;
-	if (faultaddress >= MIPS_KSEG0) {
-		return EFAULT;
-	}
+		lock_release(pte->pte_lock);
 
-	as = proc_getas();
-	if (as == NULL) {
-		return EFAULT;
-	}
+		/* Replace the old read-only TLB entry */
+		tlb_invalidate(faultaddress);
 
-	if (faulttype == VM_FAULT_READONLY) {
-		return EFAULT;
+		int spl = splhigh();
+		tlb_random(ehi, elo);
+		splx(spl);
+
+		return 0;
 	}
 
 	/*
-	 * Scan the region list to see if this vaddr is in one of
-	 * the text/data/stack regions. If so, note whether it's
-	 * supposed to be writeable or not.
+	 * See if this vaddr is in one of the text/data/stack regions
+	 * (binary search plus last-hit cache). If so, note whether
+	 * it's supposed to be writeable or not.
 	 */
-	for (reg = as->regions; reg != NULL; reg = reg->next) {
-		vaddr_t start = reg->vbase;
-		vaddr_t end = start + reg->npages * PAGE_SIZE;
-		if (faultaddress >= start && faultaddress < end) {
-			in_any = true;
-			readonly = !reg->writeable;
-			break;
-		}
+	reg = as_find_region(as, faultaddress);
+	if (reg != NULL) {
+		in_any = true;
+		readonly = !reg->writeable;
 	}
 	/*
 	 * If it wasn't in any region, check the heap.
@@ -416,6 +2773,22 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		readonly = false;
 	}
 
+	/*
+	 * Not in any region or the heap: a fault below the mapped
+	 * stack may be the stack growing down. as_grow_stack extends
+	 * the region (up to its cap) and rejects anything past it,
+	 * so wild accesses below the guard gap still fault.
+	 */
+	if (!in_any && as->as_stackbase != 0 &&
+	    faultaddress < as->as_stackbase) {
+		int gerr = as_grow_stack(as, faultaddress);
+		if (gerr) {
+			return gerr;
+		}
+		in_any = true;
+		readonly = false;
+	}
+
 	if (!in_any) {
 		return EFAULT;
 	}
@@ -442,6 +2815,15 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	} else {
 		lock_acquire(pte->pte_lock);
 
+		/*
+		 * Another thread may be paging this entry in with the
+		 * PTE lock dropped (see PTE_STATE_SWAP below). Wait
+		 * out its I/O and dispatch on the state it leaves
+		 * behind - normally PTE_STATE_RAM, which makes this
+		 * fault a plain TLB install.
+		 */
+		pte_pagein_wait(pte);
+
 		/* Allow override because of as_prepare_load/as_complete_load */
 		readonly = pte->readonly;
 	}
@@ -461,26 +2843,69 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 			/* Allocate a physical page */
 			pfn = alloc_upage(as, faultaddress);
 			if (pfn == 0) {
+				lock_release(pte->pte_lock);
 				return ENOMEM;
 			}
 
 			paddr_t paddr = idx_to_pa(pfn);
 
+			/*
+			 * Drop the PTE lock across the disk wait, so
+			 * faults on other pages of this L2 node (which
+			 * share the lock) can proceed, and their own
+			 * page-ins run in parallel with ours. The busy
+			 * bit keeps everyone who cares about this
+			 * entry's state - duplicate faulters, the
+			 * eviction scan, as_drop_pages - waiting or
+			 * away until the I/O lands; the entry itself
+			 * stays PTE_STATE_SWAP and its slot can't be
+			 * freed meanwhile, and our new frame can't be
+			 * chosen for eviction because its PTE isn't
+			 * PTE_STATE_RAM.
+			 */
+			/*
+			 * Also keep the fresh frame off the eviction
+			 * scan for the duration: its referenced bit is
+			 * still clear, so the clock hand would happily
+			 * pick it and swap the page straight back out.
+			 * EBUSY means the compactor claimed the frame
+			 * in the instant since allocation; its own
+			 * recheck under the PTE lock gives it back, so
+			 * just proceed unwired.
+			 */
+			bool fwired = (vm_page_setwired(pfn, true) == 0);
+
+			pte->busy = 1;
+			lock_release(pte->pte_lock);
+
 			int result = swap_in(paddr, swap_idx);
+
+			lock_acquire(pte->pte_lock);
+			pte_pagein_done(pte);
+			if (fwired) {
+				vm_page_setwired(pfn, false);
+			}
+
 			if (result) {
 				free_upage(pfn);
+				lock_release(pte->pte_lock);
 				return result;
 			}
 
 			swap_free(swap_idx);
 
+			VMSTAT_INC(vs_swapins);
+			as->as_swapins++;
+			as->as_swapslots--;
+
 			pte->state = PTE_STATE_RAM;
 			pte->pfn = pfn;
 			pte->swap_slot = 0;
 			pte->referenced = 1;
+			pte_sync_fast(pte);
 
 			/* Install in TLB */
-			ehi = faultaddress;
+			ehi = faultaddress | vm_tlb_asidfield(as);
 			elo = (pfn << 12) | TLBLO_VALID;
 
 			if (!readonly) {
@@ -507,10 +2932,11 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	 * If we already have RAM, just install the TLB entry.
 	 */
 	if (!need_zero) {
-		ehi = faultaddress;
+		ehi = faultaddress | vm_tlb_asidfield(as);
 		elo = (pte->pfn << 12) | TLBLO_VALID;
 
-		if (!pte->readonly) {
+		/* Copy-on-write pages go in read-only so writes fault */
+		if (!pte->readonly && !pte->cow) {
 			elo |= TLBLO_DIRTY;
 		}
 
@@ -528,16 +2954,105 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	}
 
 	/*
-	 * Otherwise allocate, zero, and fill in.
+	 * A read of a never-written page doesn't need a frame of its
+	 * own: map the shared zero page read-only and leave the PTE
+	 * in ZERO state. The first write takes a modify fault and
+	 * commits a real frame then. File-backed pages have real
+	 * content and must fall through to the load below.
 	 */
+	if (faulttype == VM_FAULT_READ) {
+		struct vnode *bvn;
+		off_t boff;
+		size_t blen;
 
-	pfn = alloc_upage(as, faultaddress);
-	if (pfn == 0) {
-		return ENOMEM;
+		if (as_page_backing(as, faultaddress, &bvn, &boff, &blen)) {
+			goto materialize;
+		}
+		pte->referenced = 1;
+
+		ehi = faultaddress | vm_tlb_asidfield(as);
+		elo = (vm_zero_pfn << 12) | TLBLO_VALID;
+
+		lock_release(pte->pte_lock);
+
+		int spl = splhigh();
+		tlb_random(ehi, elo);
+		splx(spl);
+
+		return 0;
 	}
 
-	vaddr_t kva = PADDR_TO_KVADDR(idx_to_pa(pfn));
-	bzero((void *)kva, PAGE_SIZE);
+	/*
+	 * Otherwise allocate, zero, and fill in (from the backing
+	 * file, if the page has one).
+	 */
+ materialize:
+	{
+		struct vnode *bvn = NULL;
+		off_t boff = 0;
+		size_t blen = 0;
+		bool backed, cached = false;
+
+		/*
+		 * Read-only file-backed pages (text, rodata) are
+		 * identical in every space mapping the same binary;
+		 * share a frame from the clean text cache when one
+		 * is there, so repeat execs do no disk I/O.
+		 */
+		backed = as_page_backing(as, faultaddress,
+					 &bvn, &boff, &blen);
+		if (readonly && backed &&
+		    vm_pagecache_get(bvn, boff, &pfn)) {
+			cached = true;
+		}
+
+		if (!cached) {
+			pfn = alloc_upage_zeroed(as, faultaddress);
+			if (pfn == 0) {
+				lock_release(pte->pte_lock);
+				return ENOMEM;
+			}
+
+			vaddr_t kva = PADDR_TO_KVADDR(idx_to_pa(pfn));
+
+			int fresult = vm_fill_from_file(as, faultaddress,
+							kva);
+			if (fresult) {
+				free_upage(pfn);
+				lock_release(pte->pte_lock);
+				return fresult;
+			}
+
+			VMSTAT_INC(vs_zerofills);
+
+			if (readonly && backed) {
+				vm_pagecache_insert(bvn, boff, pfn);
+			}
+		}
+
+		/*
+		 * Under madvise(MADV_SEQUENTIAL), pull the next few
+		 * backed pages into the page cache in the background
+		 * so the faults that are about to happen find them
+		 * there. (Only read-only pages are served from the
+		 * cache, so anything else isn't worth reading.)
+		 */
+		if (readonly && backed && reg != NULL &&
+		    reg->advice == MADV_SEQUENTIAL) {
+			size_t remain = reg->backing_filesize -
+				(faultaddress - reg->vbase);
+			unsigned nahead = 0;
+
+			if (remain > PAGE_SIZE) {
+				nahead = ROUNDUP(remain - PAGE_SIZE,
+						 PAGE_SIZE) / PAGE_SIZE;
+			}
+			if (nahead > VM_READAHEAD) {
+				nahead = VM_READAHEAD;
+			}
+			vm_pagecache_prefetch(bvn, boff + PAGE_SIZE, nahead);
+		}
+	}
 
 	KASSERT(pte->state == PTE_STATE_UNALLOC || pte->state == PTE_STATE_ZERO);
 
@@ -545,9 +3060,10 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	pte->pfn = pfn;
 	/* Mark as referenced since we're loading it for the first time */
 	pte->referenced = 1;
+	pte_sync_fast(pte);
 
 	/* Install in TLB */
-	ehi = faultaddress;
+	ehi = faultaddress | vm_tlb_asidfield(as);
 	elo = (pfn << 12) | TLBLO_VALID;
 
 	if (!readonly) {
@@ -565,19 +3081,377 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	return 0;
 }
 
-void tlb_invalidate(vaddr_t vaddr)
+////////////////////////////////////////////////////////////
+//
+// Address space IDs.
+//
+// Each CPU hands out the 6-bit TLBHI_PID values independently (its
+// TLB is private), round-robin with ASID 0 reserved as "none". An
+// address space remembers its ID per CPU; as long as the ID hasn't
+// been recycled, reactivating the space is just a c0_entryhi write
+// and its TLB entries survive across context switches. Only when the
+// round-robin hand comes back around does the new owner flush the
+// recycled ID's entries.
+//
+// vm_asid_lock protects the tables; it's global rather than per-CPU
+// because vm_asid_release must clear a dying space's IDs on every
+// CPU.
+
+struct vm_asid_cpu {
+	struct addrspace *va_owner[NUM_ASIDS]; /* current holder, or NULL */
+	bool va_stale[NUM_ASIDS]; /* holder died; flush before reuse */
+	unsigned va_next; /* round-robin hand */
+	unsigned va_cur; /* ASID live in this CPU's c0_entryhi */
+};
+
+static struct vm_asid_cpu vm_asid[VM_MAXCPUS];
+static struct spinlock vm_asid_lock = SPINLOCK_INITIALIZER;
+
+static
+unsigned
+vm_asid_curcpu(void)
+{
+	unsigned num = CURCPU_EXISTS() ? curcpu->c_number : 0;
+
+	KASSERT(num < VM_MAXCPUS);
+	return num;
+}
+
+/*
+ * The TLBHI_PID field value for AS's entries on this CPU; NULL means
+ * whatever ASID is currently live.
+ */
+static
+uint32_t
+vm_tlb_asidfield(struct addrspace *as)
+{
+	unsigned c = vm_asid_curcpu();
+	unsigned asid = (as != NULL) ? as->as_asid[c] : vm_asid[c].va_cur;
+
+	return (uint32_t)asid << TLBHI_PID_SHIFT;
+}
+
+/*
+ * Invalidate every local TLB entry tagged with ASID. Interrupts must
+ * be off. tlb_read clobbers c0_entryhi, so the caller must restore
+ * the live ASID afterwards (vm_asid_activate does).
+ */
+static
+void
+vm_tlb_flush_asid(unsigned asid)
+{
+	uint32_t ehi, elo;
+
+	for (int i = 0; i < NUM_TLB; i++) {
+		tlb_read(&ehi, &elo, i);
+		if (((ehi & TLBHI_PID) >> TLBHI_PID_SHIFT) == asid) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+}
+
+/*
+ * Make AS's ASID on this CPU current, assigning one if it doesn't
+ * have one (or lost its old one to recycling). Called from
+ * as_activate with interrupts off; returns the ASID for the caller
+ * to load with tlb_setasid.
+ */
+unsigned
+vm_asid_activate(struct addrspace *as)
+{
+	unsigned c = vm_asid_curcpu();
+	struct vm_asid_cpu *vac = &vm_asid[c];
+	unsigned asid;
+	bool flush = false;
+
+	KASSERT(as != NULL);
+
+	spinlock_acquire(&vm_asid_lock);
+
+	asid = as->as_asid[c];
+	if (asid == 0 || vac->va_owner[asid] != as) {
+		/* Need a (new) ASID; recycle the oldest. */
+		vac->va_next++;
+		if (vac->va_next >= NUM_ASIDS) {
+			vac->va_next = 1;
+		}
+		asid = vac->va_next;
+
+		if (vac->va_owner[asid] != NULL) {
+			vac->va_owner[asid]->as_asid[c] = 0;
+			flush = true;
+		}
+		else if (vac->va_stale[asid]) {
+			flush = true;
+		}
+
+		vac->va_owner[asid] = as;
+		vac->va_stale[asid] = false;
+		as->as_asid[c] = asid;
+	}
+	vac->va_cur = asid;
+
+	spinlock_release(&vm_asid_lock);
+
+	if (flush) {
+		vm_tlb_flush_asid(asid);
+	}
+
+	return asid;
+}
+
+/*
+ * Disassociate a dying address space from its ASIDs. Its TLB entries
+ * on other CPUs stay put, marked stale, and are flushed by whoever
+ * next recycles the ID there.
+ */
+void
+vm_asid_release(struct addrspace *as)
+{
+	spinlock_acquire(&vm_asid_lock);
+
+	for (unsigned c = 0; c < VM_MAXCPUS; c++) {
+		unsigned asid = as->as_asid[c];
+
+		if (asid != 0 && vm_asid[c].va_owner[asid] == as) {
+			vm_asid[c].va_owner[asid] = NULL;
+			vm_asid[c].va_stale[asid] = true;
+		}
+		as->as_asid[c] = 0;
+	}
+
+	spinlock_release(&vm_asid_lock);
+}
+
+/*
+ * Reload the live ASID into c0_entryhi. Needed after TLB operations
+ * that clobber it (tlb_read, or writes of entries with a different
+ * PID). Interrupts must be off.
+ */
+void
+vm_tlb_restore_asid(void)
+{
+	tlb_setasid(vm_tlb_asidfield(NULL));
+}
+
+void
+tlb_invalidate_as(struct addrspace *as, vaddr_t vaddr)
 {
 	int idx = -1;
 
 	int spl = splhigh();
 
-	idx = tlb_probe(vaddr, 0);
+	idx = tlb_probe((vaddr & TLBHI_VPAGE) | vm_tlb_asidfield(as), 0);
 
 	if (idx >= 0) {
 		tlb_write(TLBHI_INVALID(idx), TLBLO_INVALID(), idx);
 	}
 
+	vm_tlb_restore_asid();
+
+	splx(spl);
+}
+
+void tlb_invalidate(vaddr_t vaddr)
+{
+	tlb_invalidate_as(NULL, vaddr);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Pinned TLB entries.
+//
+// The random register ranges over slots NUM_TLB_WIRED..NUM_TLB-1
+// only, so neither tlb_random nor the assembly refill handler ever
+// evicts the low slots. Pinning drops a mapping there and keeps it
+// there, for pages whose refaults are pure overhead: the user clock
+// page gets hit on every gettimeofday and is mapped identically in
+// every address space, yet without a pin it must take a fault per
+// space per eviction.
+//
+// Pins live in a small global table, one entry per wired slot, and
+// are pushed into the hardware by vm_tlb_loadpins when a CPU
+// activates an address space or recovers from a whole-TLB flush. A
+// new pin thus reaches other CPUs at their next activation, which is
+// fine for the intended use - pins are set up at boot or
+// configuration time, not in hot paths. The mapping bypasses the
+// page table machinery entirely: the pager never sees the frame, and
+// the caller must unpin before freeing it.
+
+struct tlbpin {
+	struct addrspace *tp_as;	/* NULL: every address space */
+	vaddr_t tp_vaddr;		/* page-aligned; 0 means free */
+	uint32_t tp_elo;		/* ready-made TLB low word */
+};
+
+static struct tlbpin vm_tlb_pins[NUM_TLB_WIRED];
+static unsigned vm_tlb_npins;
+static struct spinlock vm_tlb_pinlock = SPINLOCK_INITIALIZER;
+
+/*
+ * Rewrite this CPU's wired slots with the pins that apply to AS
+ * (NULL: global pins only, tagged with the live ASID). Interrupts
+ * must be off.
+ */
+void
+vm_tlb_loadpins(struct addrspace *as)
+{
+	uint32_t ehi;
+	int idx;
+
+	if (vm_tlb_npins == 0) {
+		/* Unlocked peek; pins change rarely. */
+		return;
+	}
+
+	spinlock_acquire(&vm_tlb_pinlock);
+	for (unsigned i = 0; i < NUM_TLB_WIRED; i++) {
+		struct tlbpin *tp = &vm_tlb_pins[i];
+
+		if (tp->tp_vaddr == 0 ||
+		    (tp->tp_as != NULL && tp->tp_as != as)) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+			continue;
+		}
+
+		ehi = tp->tp_vaddr | vm_tlb_asidfield(as);
+
+		/*
+		 * A random-slot entry for the same page may exist
+		 * (faulted in after a flush wiped the wired slots);
+		 * two entries for one vpage is fatal on real
+		 * hardware, so evict it first.
+		 */
+		idx = tlb_probe(ehi, 0);
+		if (idx >= 0 && idx != (int)i) {
+			tlb_write(TLBHI_INVALID(idx), TLBLO_INVALID(), idx);
+		}
+		tlb_write(ehi, tp->tp_elo, i);
+	}
+	spinlock_release(&vm_tlb_pinlock);
+
+	vm_tlb_restore_asid();
+}
+
+int
+vm_tlb_pin(struct addrspace *as, vaddr_t vaddr, paddr_t paddr, bool writable)
+{
+	struct tlbpin *tp = NULL;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	KASSERT(vaddr < MIPS_KSEG0);
+
+	spinlock_acquire(&vm_tlb_pinlock);
+	for (unsigned i = 0; i < NUM_TLB_WIRED; i++) {
+		if (vm_tlb_pins[i].tp_vaddr == 0) {
+			tp = &vm_tlb_pins[i];
+			break;
+		}
+	}
+	if (tp == NULL) {
+		spinlock_release(&vm_tlb_pinlock);
+		return ENOSPC;
+	}
+
+	tp->tp_as = as;
+	tp->tp_vaddr = vaddr;
+	tp->tp_elo = paddr | TLBLO_VALID | (writable ? TLBLO_DIRTY : 0);
+	vm_tlb_npins++;
+	spinlock_release(&vm_tlb_pinlock);
+
+	/* Install on this CPU now if the right space is live. */
+	int spl = splhigh();
+	if (as == NULL || as == proc_getas()) {
+		vm_tlb_loadpins(proc_getas());
+	}
 	splx(spl);
+
+	return 0;
+}
+
+void
+vm_tlb_unpin(struct addrspace *as, vaddr_t vaddr)
+{
+	bool found = false;
+
+	spinlock_acquire(&vm_tlb_pinlock);
+	for (unsigned i = 0; i < NUM_TLB_WIRED; i++) {
+		struct tlbpin *tp = &vm_tlb_pins[i];
+
+		if (tp->tp_as == as && tp->tp_vaddr == vaddr) {
+			tp->tp_as = NULL;
+			tp->tp_vaddr = 0;
+			tp->tp_elo = 0;
+			KASSERT(vm_tlb_npins > 0);
+			vm_tlb_npins--;
+			found = true;
+			break;
+		}
+	}
+	spinlock_release(&vm_tlb_pinlock);
+
+	if (!found) {
+		return;
+	}
+
+	/*
+	 * Drop the wired entry everywhere. For a global pin this
+	 * broadcasts the whole-TLB flush marker, which is heavy but
+	 * fine for something this rare.
+	 */
+	tlb_invalidate_as(as, vaddr);
+	vm_tlbshootdown_batch(as, &vaddr, 1);
+}
+
+/*
+ * Whether CPU CPUNUM might hold TLB entries for AS. Only possible if
+ * AS has an ASID assigned there; spaces that never ran on a CPU cost
+ * it nothing. NULL (the whole-TLB flush marker) always needs
+ * delivering.
+ */
+bool
+vm_tlbshootdown_needed(struct addrspace *as, unsigned cpunum)
+{
+	bool needed;
+
+	if (as == NULL) {
+		return true;
+	}
+
+	KASSERT(cpunum < VM_MAXCPUS);
+
+	spinlock_acquire(&vm_asid_lock);
+	needed = (as->as_asid[cpunum] != 0);
+	spinlock_release(&vm_asid_lock);
+
+	return needed;
+}
+
+/*
+ * Invalidate a batch of AS's pages everywhere: locally right away,
+ * remotely with one batched IPI per interested CPU. Returns once no
+ * CPU can translate any of the addresses, so the caller may reuse
+ * the frames behind them.
+ */
+void
+vm_tlbshootdown_batch(struct addrspace *as, const vaddr_t *vaddrs, unsigned n)
+{
+	struct tlbshootdown batch[TLBSHOOTDOWN_MAX];
+
+	while (n > 0) {
+		unsigned chunk = (n > TLBSHOOTDOWN_MAX) ? TLBSHOOTDOWN_MAX : n;
+
+		for (unsigned i = 0; i < chunk; i++) {
+			batch[i].ts_as = as;
+			batch[i].ts_vaddr = vaddrs[i];
+			tlb_invalidate_as(as, vaddrs[i]);
+		}
+		ipi_tlbshootdown_broadcast(batch, chunk);
+
+		vaddrs += chunk;
+		n -= chunk;
+	}
 }
 
 /*
@@ -601,6 +3475,18 @@ vm_mark_page_evicting(unsigned idx)
 		return EINVAL;
 	}
 
+	if (coremap[idx].refcount > 1 || coremap[idx].as == NULL) {
+		/* Shared or owner-unknown pages can't be evicted */
+		spinlock_release(&cm_lock);
+		return EINVAL;
+	}
+
+	if (coremap[idx].wired) {
+		/* mlocked; the owner opted out of paging */
+		spinlock_release(&cm_lock);
+		return EINVAL;
+	}
+
 	if (coremap[idx].state == CM_EVICTING) {
 		/* Page is already being evicted */
 		spinlock_release(&cm_lock);
@@ -629,11 +3515,30 @@ vm_eviction_finished(unsigned idx)
 	KASSERT(coremap[idx].state == CM_EVICTING);
 	KASSERT(coremap[idx].chunk_len == 1); /* User pages are always 1 page */
 
-	/* Reset the coremap entry */
-	coremap[idx].state = CM_FREE;
-	coremap[idx].chunk_len = 0;
+	/* Reset the coremap entry and return it to the free index */
 	coremap[idx].as = NULL;
 	coremap[idx].vpn = 0;
+	cm_run_free(idx, 1);
+
+	spinlock_release(&cm_lock);
+}
+
+/*
+ * Abort an eviction. The page keeps its contents and its mapping, so
+ * it goes back from CM_EVICTING to CM_USER rather than to the free
+ * index.
+ */
+static
+void
+vm_eviction_aborted(unsigned idx)
+{
+	KASSERT(vm_ready);
+	KASSERT(idx < coremap_pages);
+
+	spinlock_acquire(&cm_lock);
+
+	KASSERT(coremap[idx].state == CM_EVICTING);
+	coremap[idx].state = CM_USER;
 
 	spinlock_release(&cm_lock);
 }
@@ -676,6 +3581,17 @@ vm_find_eviction_victim(unsigned *idx_ret)
 			continue;
 		}
 
+		/*
+		 * Shared copy-on-write pages, pages whose recorded
+		 * owner has departed (we only track one mapping per
+		 * frame), and wired (mlocked) pages can't be evicted.
+		 */
+		if (coremap[idx].refcount > 1 || coremap[idx].as == NULL ||
+		    coremap[idx].wired) {
+			spinlock_release(&cm_lock);
+			continue;
+		}
+
 		as = coremap[idx].as;
 		vaddr = coremap[idx].vpn * PAGE_SIZE;
 
@@ -683,12 +3599,26 @@ vm_find_eviction_victim(unsigned *idx_ret)
 
 		pte = pt_get_pte(as, vaddr, false);
 
-		if (pte == NULL) {
+		if (pte == NULL) {
+			continue;
+		}
+
+		/*
+		 * PTE locks are per-L2-node; the cluster evictor may
+		 * already hold this one for an earlier victim.
+		 */
+		if (lock_do_i_hold(pte->pte_lock)) {
 			continue;
 		}
 
 		lock_acquire(pte->pte_lock);
 
+		if (pte->busy) {
+			/* A fault is filling the frame; not a candidate. */
+			lock_release(pte->pte_lock);
+			continue;
+		}
+
 		if (pte->referenced == 0) {
 			candidate_idx = idx;
 			found = true;
@@ -720,7 +3650,9 @@ vm_find_eviction_victim(unsigned *idx_ret)
 
 		idx = (start_pos + i) % coremap_pages;
 
-		if (coremap[idx].state == CM_USER) {
+		if (coremap[idx].state == CM_USER &&
+		    coremap[idx].refcount == 1 && coremap[idx].as != NULL &&
+		    !coremap[idx].wired) {
 			*idx_ret = idx;
 			victim_next = (idx + 1) % coremap_pages;
 			spinlock_release(&cm_lock);
@@ -735,23 +3667,143 @@ vm_find_eviction_victim(unsigned *idx_ret)
 }
 
 /*
- * Allocate a swap slot
+ * Map a global slot number to the device that holds it. The device
+ * table is immutable after swap_init, so no lock is needed.
+ */
+static
+struct swapdev *
+swap_slot_dev(unsigned idx)
+{
+	for (unsigned i = 0; i < swap_info.swap_ndevs; i++) {
+		struct swapdev *sd = &swap_info.swap_devs[i];
+
+		if (idx - sd->sd_base < sd->sd_size) {
+			return sd;
+		}
+	}
+	panic("swap: slot %u is on no device\n", idx);
+	return NULL;
+}
+
+/*
+ * Track I/Os outstanding per device, so allocation can steer new runs
+ * toward whichever disk is idle.
+ */
+static
+void
+swap_io_start(struct swapdev *sd)
+{
+	spinlock_acquire(&swap_info.swap_lock);
+	sd->sd_inflight++;
+	spinlock_release(&swap_info.swap_lock);
+}
+
+static
+void
+swap_io_end(struct swapdev *sd)
+{
+	spinlock_acquire(&swap_info.swap_lock);
+	KASSERT(sd->sd_inflight > 0);
+	sd->sd_inflight--;
+	spinlock_release(&swap_info.swap_lock);
+}
+
+/*
+ * Allocate NSLOTS contiguous swap slots.
+ *
+ * The run is striped onto one device: preferably the one with the
+ * least I/O in flight, round-robin on ties, so back-to-back eviction
+ * clusters alternate between disks and each lands on one that's idle.
+ * Within the device a next-fit hint makes successive allocations land
+ * near each other, so pages paged out around the same time also sit
+ * together on disk. Runs do not wrap around the end of a device or
+ * cross from one device to the next.
+ *
+ * Returns 0 with *start_ret set, or ENOSPC if no run is free.
  */
+static
 int
-swap_alloc(unsigned *idx)
+swap_alloc_run(unsigned nslots, unsigned *start_ret)
 {
-	int result;
+	unsigned d0, attempt;
 
-	KASSERT(swap_info.swap_bitmap != NULL);
-	KASSERT(idx != NULL);
+	KASSERT(swap_info.swap_ndevs > 0);
+	KASSERT(nslots > 0);
+	KASSERT(start_ret != NULL);
 
 	spinlock_acquire(&swap_info.swap_lock);
 
-	result = bitmap_alloc(swap_info.swap_bitmap, idx);
+	d0 = swap_info.swap_nextdev % swap_info.swap_ndevs;
+	for (unsigned d = 0; d < swap_info.swap_ndevs; d++) {
+		if (swap_info.swap_devs[d].sd_inflight <
+		    swap_info.swap_devs[d0].sd_inflight) {
+			d0 = d;
+		}
+	}
+
+	/* Fall back to the busier device(s) when the idle one is full. */
+	for (attempt = 0; attempt < swap_info.swap_ndevs; attempt++) {
+		unsigned devno = (d0 + attempt) % swap_info.swap_ndevs;
+		struct swapdev *sd = &swap_info.swap_devs[devno];
+		unsigned pos, run, scanned;
+
+		if (nslots > sd->sd_size) {
+			continue;
+		}
+
+		pos = sd->sd_hint % sd->sd_size;
+		run = 0;
+
+		/*
+		 * One full circle, plus a little extra so a run
+		 * straddling the starting position is still found.
+		 */
+		for (scanned = 0; scanned < sd->sd_size + nslots;
+		     scanned++) {
+			if (pos == sd->sd_size) {
+				pos = 0;
+				run = 0;
+			}
+			if (bitmap_isset(sd->sd_bitmap, pos)) {
+				run = 0;
+			}
+			else {
+				run++;
+				if (run == nslots) {
+					unsigned start = pos + 1 - nslots;
+
+					for (unsigned i = 0; i < nslots;
+					     i++) {
+						bitmap_mark(sd->sd_bitmap,
+							    start + i);
+					}
+					sd->sd_hint = pos + 1;
+					swap_info.swap_nextdev =
+						(devno + 1)
+						% swap_info.swap_ndevs;
+					spinlock_release(
+						&swap_info.swap_lock);
+					*start_ret = sd->sd_base + start;
+					return 0;
+				}
+			}
+			pos++;
+		}
+	}
 
 	spinlock_release(&swap_info.swap_lock);
+	return ENOSPC;
+}
+
+/*
+ * Allocate a swap slot
+ */
+int
+swap_alloc(unsigned *idx)
+{
+	KASSERT(idx != NULL);
 
-	return result ? ENOSPC : 0;
+	return swap_alloc_run(1, idx);
 }
 
 /*
@@ -760,12 +3812,19 @@ swap_alloc(unsigned *idx)
 void
 swap_free(unsigned idx)
 {
-	KASSERT(swap_info.swap_bitmap != NULL);
+	struct swapdev *sd;
+
+	KASSERT(swap_info.swap_ndevs > 0);
 	KASSERT(idx < swap_info.swap_size);
 
+	sd = swap_slot_dev(idx);
+
+	/* Drop any compressed copy before the slot can be reused. */
+	zswap_invalidate(idx);
+
 	spinlock_acquire(&swap_info.swap_lock);
 
-	bitmap_unmark(swap_info.swap_bitmap, idx);
+	bitmap_unmark(sd->sd_bitmap, idx - sd->sd_base);
 
 	spinlock_release(&swap_info.swap_lock);
 }
@@ -778,22 +3837,125 @@ swap_out(paddr_t paddr, unsigned idx)
 {
 	struct iovec iov;
 	struct uio ku;
+	struct swapdev *sd;
 	int result;
 
-	KASSERT(swap_info.swap_vnode != NULL);
+	KASSERT(swap_info.swap_ndevs > 0);
 	KASSERT(idx < swap_info.swap_size);
 
+	sd = swap_slot_dev(idx);
+
 	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
-		  idx * PAGE_SIZE, UIO_WRITE);
+		  (off_t)(idx - sd->sd_base) * PAGE_SIZE, UIO_WRITE);
 
-	result = VOP_WRITE(swap_info.swap_vnode, &ku);
+	swap_io_start(sd);
+	result = VOP_WRITE(sd->sd_vnode, &ku);
+	swap_io_end(sd);
 	if (result) {
 		kprintf("swap_out: write failed: %s\n", strerror(result));
 	}
+	else {
+		VMSTAT_INC(vs_swapouts);
+	}
 
 	return result;
 }
 
+/*
+ * Write NPAGES frames to the contiguous swap slots starting at SLOT
+ * as one request. The frames need not be physically contiguous; each
+ * gets its own iovec, and the device sees a single sequential write
+ * instead of NPAGES separate ones.
+ */
+static
+int
+swap_out_cluster(const unsigned frames[], unsigned npages, unsigned slot)
+{
+	struct iovec iov[SWAP_CLUSTER];
+	struct uio ku;
+	struct swapdev *sd;
+	int result;
+
+	KASSERT(swap_info.swap_ndevs > 0);
+	KASSERT(npages >= 1 && npages <= SWAP_CLUSTER);
+	KASSERT(slot + npages <= swap_info.swap_size);
+
+	/* The allocator never hands out a run straddling devices. */
+	sd = swap_slot_dev(slot);
+	KASSERT(slot - sd->sd_base + npages <= sd->sd_size);
+
+	for (unsigned i = 0; i < npages; i++) {
+		iov[i].iov_kbase =
+			(void *)PADDR_TO_KVADDR(idx_to_pa(frames[i]));
+		iov[i].iov_len = PAGE_SIZE;
+	}
+
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = npages;
+	ku.uio_offset = (off_t)(slot - sd->sd_base) * PAGE_SIZE;
+	ku.uio_resid = (size_t)npages * PAGE_SIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = NULL;
+
+	swap_io_start(sd);
+	result = VOP_WRITE(sd->sd_vnode, &ku);
+	swap_io_end(sd);
+	if (result) {
+		kprintf("swap_out_cluster: write failed: %s\n",
+			strerror(result));
+	}
+	else {
+		vm_stats_pcpu[curcpu->c_number].vs_swapouts += npages;
+	}
+
+	return result;
+}
+
+/*
+ * Send NPAGES eviction frames to the contiguous slots starting at
+ * SLOT, compressed tier first: each page that compresses well stays
+ * in the zswap pool under its slot number (spilling older compressed
+ * pages to disk as needed), and the stretches that don't make it go
+ * to their slots with clustered writes as before.
+ */
+static
+int
+swap_out_tiered(const unsigned frames[], unsigned npages, unsigned slot)
+{
+	unsigned i, runstart;
+	int result;
+
+	runstart = 0;
+	for (i = 0; i < npages; i++) {
+		if (!zswap_store(slot + i,
+				 (void *)PADDR_TO_KVADDR(
+					 idx_to_pa(frames[i])))) {
+			continue;
+		}
+		VMSTAT_INC(vs_zswapouts);
+		/* Flush the uncompressed stretch before this page. */
+		if (i > runstart) {
+			result = swap_out_cluster(&frames[runstart],
+						  i - runstart,
+						  slot + runstart);
+			if (result) {
+				return result;
+			}
+		}
+		runstart = i + 1;
+	}
+	if (npages > runstart) {
+		result = swap_out_cluster(&frames[runstart],
+					  npages - runstart,
+					  slot + runstart);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
 /*
  * Swap a page in from disk
  */
@@ -802,15 +3964,33 @@ swap_in(paddr_t paddr, unsigned idx)
 {
 	struct iovec iov;
 	struct uio ku;
+	struct swapdev *sd;
+	unsigned oldpri;
 	int result;
 
-	KASSERT(swap_info.swap_vnode != NULL);
+	KASSERT(swap_info.swap_ndevs > 0);
 	KASSERT(idx < swap_info.swap_size);
 
+	/* Compressed tier first: a hit decompresses at memory speed. */
+	if (zswap_load(idx, (void *)PADDR_TO_KVADDR(paddr))) {
+		VMSTAT_INC(vs_zswapins);
+		return 0;
+	}
+
+	sd = swap_slot_dev(idx);
+
 	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
-		  idx * PAGE_SIZE, UIO_READ);
+		  (off_t)(idx - sd->sd_base) * PAGE_SIZE, UIO_READ);
+
+	/* A faulting process is blocked on this; jump the disk queue. */
+	oldpri = curthread->t_iopri;
+	curthread->t_iopri = IOPRI_PAGEIN;
 
-	result = VOP_READ(swap_info.swap_vnode, &ku);
+	swap_io_start(sd);
+	result = VOP_READ(sd->sd_vnode, &ku);
+	swap_io_end(sd);
+
+	curthread->t_iopri = oldpri;
 	if (result) {
 		kprintf("swap_in: read failed: %s\n", strerror(result));
 	}
@@ -819,34 +3999,282 @@ swap_in(paddr_t paddr, unsigned idx)
 }
 
 /*
- * Evict a page to swap when memory is full.
+ * Evict up to MAXPAGES pages with one clustered swap write.
+ *
+ * Victims are gathered one at a time: each is marked CM_EVICTING and
+ * has its PTE locked, which pins the mapping until the write is done.
+ * The whole batch then goes out as a single request to a contiguous
+ * slot run, so the device sees one sequential write and pages that
+ * re-fault in the same order read back sequentially too. (There is no
+ * slot-to-PTE reverse map, so read-side clustering comes entirely
+ * from this disk layout.)
+ *
+ * This is the only path that ever holds more than one PTE lock at a
+ * time; the fault paths take exactly one, so there is no lock-order
+ * cycle to worry about.
+ *
+ * Returns 0 with *evicted_ret set to the number of pages evicted
+ * (at least 1), ENOENT if no victim was found, or an error from the
+ * swap layer.
  */
 int
-vm_evict_page(unsigned *idx_ret)
+vm_evict_cluster(unsigned maxpages, unsigned *evicted_ret)
 {
+	unsigned frames[SWAP_CLUSTER];
+	struct pte *ptes[SWAP_CLUSTER];
+	vaddr_t vaddrs[SWAP_CLUSTER];
+	unsigned n, slot;
 	int result;
-	unsigned victim_idx;
-	paddr_t paddr;
-	unsigned swap_idx;
-	struct addrspace *as;
-	vaddr_t vaddr;
-	struct pte *pte;
 
-	KASSERT(idx_ret != NULL);
+	KASSERT(evicted_ret != NULL);
+
+	if (maxpages > SWAP_CLUSTER) {
+		maxpages = SWAP_CLUSTER;
+	}
+
+	n = 0;
+	while (n < maxpages) {
+		unsigned victim;
+		struct addrspace *as;
+		vaddr_t vaddr;
+		struct pte *pte;
+
+		if (vm_find_eviction_victim(&victim)) {
+			break;
+		}
+		if (vm_mark_page_evicting(victim)) {
+			break;
+		}
+
+		/* Stable now that the frame is CM_EVICTING. */
+		as = coremap[victim].as;
+		vaddr = coremap[victim].vpn * PAGE_SIZE;
+
+		KASSERT(as != NULL);
+
+		pte = pt_get_pte(as, vaddr, false);
+
+		KASSERT(pte != NULL);
+
+		/*
+		 * PTE locks cover a whole L2 node; if this victim
+		 * shares one with a victim we already hold, settle
+		 * for the batch we have.
+		 */
+		if (lock_do_i_hold(pte->pte_lock)) {
+			vm_eviction_aborted(victim);
+			break;
+		}
+
+		lock_acquire(pte->pte_lock);
+
+		/*
+		 * Recheck under the lock. The victim scan skips busy
+		 * entries, but a fault can start filling this frame
+		 * with the PTE lock dropped between the scan and here,
+		 * in which case the entry isn't in RAM state (or no
+		 * longer names this frame). Put the frame back and
+		 * settle for the batch we have.
+		 */
+		if (pte->state != PTE_STATE_RAM || pte->pfn != victim) {
+			lock_release(pte->pte_lock);
+			vm_eviction_aborted(victim);
+			break;
+		}
+
+		frames[n] = victim;
+		ptes[n] = pte;
+		vaddrs[n] = vaddr;
+		n++;
+	}
+
+	if (n == 0) {
+		return ENOENT;
+	}
+
+	/*
+	 * Get a contiguous slot run; under fragmentation settle for a
+	 * shorter batch, releasing victims we can no longer cover.
+	 */
+	while (swap_alloc_run(n, &slot)) {
+		lock_release(ptes[n - 1]->pte_lock);
+		vm_eviction_aborted(frames[n - 1]);
+		n--;
+		if (n == 0) {
+			return ENOMEM;
+		}
+	}
 
-	result = vm_find_eviction_victim(&victim_idx);
+	result = swap_out_tiered(frames, n, slot);
 	if (result) {
+		for (unsigned i = 0; i < n; i++) {
+			swap_free(slot + i);
+			lock_release(ptes[i]->pte_lock);
+			vm_eviction_aborted(frames[i]);
+		}
 		return result;
 	}
 
-	result = vm_mark_page_evicting(victim_idx);
+	/*
+	 * Close the assembly refill path before killing the TLB
+	 * entries: a refill that already read the old pte_fast
+	 * finishes (interrupts off) before servicing the shootdown
+	 * IPI, so the stale entry it may install still gets flushed.
+	 */
+	for (unsigned i = 0; i < n; i++) {
+		ptes[i]->pte_fast = 0;
+	}
+	membar_store_store();
+
+	/*
+	 * Kill the translations on every CPU with one batched
+	 * shootdown before the frames can be reused. The frames are
+	 * still CM_EVICTING, so the owner fields are intact.
+	 */
+	{
+		struct tlbshootdown batch[SWAP_CLUSTER];
+
+		for (unsigned i = 0; i < n; i++) {
+			batch[i].ts_as = coremap[frames[i]].as;
+			batch[i].ts_vaddr = vaddrs[i];
+			tlb_invalidate_as(batch[i].ts_as, vaddrs[i]);
+		}
+		ipi_tlbshootdown_broadcast(batch, n);
+	}
+
+	for (unsigned i = 0; i < n; i++) {
+		ptes[i]->state = PTE_STATE_SWAP;
+		ptes[i]->swap_slot = slot + i;
+		ptes[i]->pfn = 0;
+		pte_sync_fast(ptes[i]);
+
+		lock_release(ptes[i]->pte_lock);
+
+		/* Still CM_EVICTING, so the owner field is intact. */
+		coremap[frames[i]].as->as_evictions++;
+		coremap[frames[i]].as->as_swapslots++;
+
+		vm_eviction_finished(frames[i]);
+
+		VMSTAT_INC(vs_evictions);
+	}
+
+	*evicted_ret = n;
+
+	return 0;
+}
+
+/*
+ * Evict a page to swap when memory is full.
+ */
+int
+vm_evict_page(unsigned *idx_ret)
+{
+	/*
+	 * Callers retry the free lists after this rather than claiming
+	 * the frame, so they only care that one was freed.
+	 */
+	return vm_evict_cluster(1, idx_ret);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Physical memory compaction.
+//
+// Multi-page allocations (thread stacks, allocator slabs) need
+// contiguous low-zone frames, and a long uptime fragments the free
+// runs until cm_run_alloc fails while plenty of scattered single
+// frames sit free. Failed run allocations leave a note for the
+// pagedaemon (see alloc_kpages), which responds by growing the
+// longest free run: the user pages bordering it are migrated -
+// copied to replacement frames and their mappings retargeted, under
+// the same CM_EVICTING protocol eviction uses - so the freed
+// neighbours coalesce with the run. Only private, unwired CM_USER
+// pages can move; kernel pages never do, since kernel code holds
+// their physical addresses directly.
+
+/*
+ * Whether the page at IDX could be migrated: the same test the
+ * eviction scan applies, since migration pins the mapping the same
+ * way. Caller holds cm_lock; the answer is only a hint, as the page
+ * can change state once the lock drops.
+ */
+static
+bool
+cm_page_movable(unsigned idx)
+{
+	return coremap[idx].state == CM_USER &&
+		coremap[idx].refcount == 1 &&
+		coremap[idx].as != NULL &&
+		coremap[idx].wired == 0;
+}
+
+/*
+ * Find the longest free run in ZONE: the longest run in the highest
+ * occupied bucket, falling back to a lone single from the color
+ * lists. Returns its head index and length via *LEN_RET, or CM_NOIDX
+ * if the zone has nothing free at all. Called with cm_lock held.
+ */
+static
+unsigned
+cm_longest_run(unsigned zone, unsigned *len_ret)
+{
+	unsigned b, c, idx, best, bestlen;
+
+	KASSERT(spinlock_do_i_hold(&cm_lock));
+
+	for (b = CM_NBUCKETS; b-- > 1; ) {
+		best = CM_NOIDX;
+		bestlen = 0;
+		for (idx = cm_buckets[zone][b]; idx != CM_NOIDX;
+		     idx = coremap[idx].run_next) {
+			if (coremap[idx].chunk_len > bestlen) {
+				best = idx;
+				bestlen = coremap[idx].chunk_len;
+			}
+		}
+		if (best != CM_NOIDX) {
+			*len_ret = bestlen;
+			return best;
+		}
+	}
+
+	for (c = 0; c < VM_NCOLORS; c++) {
+		idx = cm_colorlists[zone][c];
+		if (idx != CM_NOIDX) {
+			*len_ret = 1;
+			return idx;
+		}
+	}
+	return CM_NOIDX;
+}
+
+/*
+ * Move the contents of user frame SRC into DST and retarget the
+ * owner's mapping. DST must be a private frame of the caller (CM_FIXED
+ * with chunk_len 1, as handed out by the per-CPU caches). SRC sits in
+ * CM_EVICTING with its PTE locked for the duration, exactly as during
+ * eviction, so faults on the page wait instead of racing the copy. On
+ * success SRC has gone back to the free index; on failure (the page
+ * stopped being movable) nothing has changed and the caller keeps DST.
+ */
+static
+int
+vm_migrate_page(unsigned src, unsigned dst)
+{
+	struct addrspace *as;
+	vaddr_t vaddr;
+	struct pte *pte;
+	int result;
+
+	result = vm_mark_page_evicting(src);
 	if (result) {
 		return result;
 	}
 
-	paddr = idx_to_pa(victim_idx);
-	as = coremap[victim_idx].as;
-	vaddr = coremap[victim_idx].vpn * PAGE_SIZE;
+	/* Stable now that the frame is CM_EVICTING. */
+	as = coremap[src].as;
+	vaddr = coremap[src].vpn * PAGE_SIZE;
 
 	KASSERT(as != NULL);
 
@@ -856,35 +4284,116 @@ vm_evict_page(unsigned *idx_ret)
 
 	lock_acquire(pte->pte_lock);
 
-	KASSERT(pte->state == PTE_STATE_RAM);
-	KASSERT(pte->pfn == victim_idx);
-
-	result = swap_alloc(&swap_idx);
-	if (result) {
+	/*
+	 * A fault may be filling SRC with the PTE lock dropped (the
+	 * busy page-in path), in which case the entry isn't in RAM
+	 * state yet; such a page isn't movable right now.
+	 */
+	if (pte->state != PTE_STATE_RAM || pte->pfn != src) {
 		lock_release(pte->pte_lock);
-		vm_eviction_finished(victim_idx);
-		return ENOMEM;
+		vm_eviction_aborted(src);
+		return EBUSY;
 	}
 
-	result = swap_out(paddr, swap_idx);
-	if (result) {
-		swap_free(swap_idx);
-		lock_release(pte->pte_lock);
-		vm_eviction_finished(victim_idx);
-		return result;
-	}
+	/*
+	 * Close the assembly refill path, then kill the old
+	 * translation everywhere. From here on any access to the page
+	 * faults and blocks on the PTE lock, so the copy is stable.
+	 */
+	pte->pte_fast = 0;
+	membar_store_store();
+	vm_tlbshootdown_batch(as, &vaddr, 1);
 
-	tlb_invalidate(vaddr);
+	page_copy((void *)PADDR_TO_KVADDR(idx_to_pa(dst)),
+		  (void *)PADDR_TO_KVADDR(idx_to_pa(src)));
 
-	pte->state = PTE_STATE_SWAP;
-	pte->swap_slot = swap_idx;
-	pte->pfn = 0;
+	/* Publish the new frame, as in alloc_upage. */
+	coremap[dst].as = as;
+	coremap[dst].vpn = VPN(vaddr);
+	coremap[dst].refcount = 1;
+	coremap[dst].wired = 0;
+	membar_store_store();
+	coremap[dst].state = CM_USER;
 
-	lock_release(pte->pte_lock);
+	pte->pfn = dst;
+	pte_sync_fast(pte);
 
-	vm_eviction_finished(victim_idx);
+	lock_release(pte->pte_lock);
 
-	*idx_ret = victim_idx;
+	/* The old frame goes back to the free index. */
+	vm_eviction_finished(src);
 
+	VMSTAT_INC(vs_migrations);
 	return 0;
 }
+
+/*
+ * Try to consolidate a free run of at least WANT pages in the low
+ * zone. Each round finds the longest free run and migrates one of the
+ * user pages bordering it away, so the freed neighbour coalesces with
+ * the run; rounds repeat until the run is long enough, the run is
+ * boxed in by unmovable pages, or a round fails to make the run any
+ * longer (somebody else is consuming the memory faster than we
+ * consolidate it). Called from the pagedaemon; best effort only.
+ */
+static
+void
+vm_compact(unsigned want)
+{
+	unsigned idx, len, lastlen, victim, dst, color;
+
+	KASSERT(want > 1);
+
+	lastlen = 0;
+	for (;;) {
+		spinlock_acquire(&cm_lock);
+
+		idx = cm_longest_run(CM_ZONE_LOW, &len);
+		if (idx == CM_NOIDX || len >= want || len <= lastlen) {
+			spinlock_release(&cm_lock);
+			return;
+		}
+		lastlen = len;
+
+		/*
+		 * Pick a movable page bordering the run, preferring the
+		 * high side. The movability test is a peek;
+		 * vm_migrate_page redoes it under the eviction protocol
+		 * and may still refuse.
+		 */
+		if (idx + len < cm_lowpages && cm_page_movable(idx + len)) {
+			victim = idx + len;
+		}
+		else if (idx > 0 && cm_page_movable(idx - 1)) {
+			victim = idx - 1;
+		}
+		else {
+			/* Boxed in by kernel or wired pages; give up. */
+			spinlock_release(&cm_lock);
+			return;
+		}
+
+		/* Keep the page's cache color across the move. */
+		color = coremap[victim].vpn % VM_NCOLORS;
+
+		spinlock_release(&cm_lock);
+
+		/*
+		 * The replacement frame. Prefer high memory, which
+		 * multi-page (kernel) allocations can't use anyway, so
+		 * migration drains the low zone instead of reshuffling
+		 * it.
+		 */
+		if (!(cm_have_high() &&
+		      cm_pcpu_getpage(CM_ZONE_HIGH, color, &dst)) &&
+		    !cm_pcpu_getpage(CM_ZONE_LOW, color, &dst)) {
+			return;
+		}
+
+		if (vm_migrate_page(victim, dst)) {
+			/* The page changed under us; put DST back. */
+			cm_pcpu_putpage(dst);
+			return;
+		}
+	}
+}
@@ -0,0 +1,476 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <vm.h>
+#include <zswap.h>
+
+/*
+ * Compressed swap tier; see zswap.h for the contract.
+ *
+ * Entries hang off a hash table keyed by swap slot and a doubly
+ * linked LRU list; both are under zs_lock, a spinlock, so nothing
+ * sleeps while holding it. Spilling an entry to disk is the delicate
+ * part: the entry stays in the hash, marked busy, while its (valid)
+ * data is written out, and lookups that hit a busy entry wait for the
+ * writeback to finish and retry. Without that, a fault could miss
+ * here, read the slot from disk before the writeback lands, and get
+ * stale bytes. Waiters sleep on a global writeback generation count
+ * rather than the entry, which may be freed by the time they wake.
+ *
+ * The compressor is a word-granularity zero-run encoding: the pages
+ * worth compressing are mostly sparse heap and stack data, where runs
+ * of zero words dominate. Pages that don't shrink to ZSWAP_MAXCOMP
+ * bytes go straight to disk.
+ */
+
+#define ZSWAP_BUCKETS	64
+
+/* Worth keeping only if it compresses to 3/4 page or better. */
+#define ZSWAP_MAXCOMP	(PAGE_SIZE - PAGE_SIZE / 4)
+
+struct zswap_entry {
+	unsigned ze_slot;		/* swap slot this caches */
+	size_t ze_size;			/* compressed size in bytes */
+	void *ze_data;			/* compressed data */
+	bool ze_busy;			/* writeback in progress */
+	struct zswap_entry *ze_hnext;	/* hash chain */
+	struct zswap_entry *ze_lnext;	/* LRU, toward older */
+	struct zswap_entry *ze_lprev;	/* LRU, toward newer */
+};
+
+static struct zswap_entry *zs_hash[ZSWAP_BUCKETS];
+static struct zswap_entry *zs_lruhead;	/* most recently stored */
+static struct zswap_entry *zs_lrutail;	/* oldest; spilled first */
+static size_t zs_bytes;			/* compressed bytes held */
+static size_t zs_maxbytes;		/* pool budget; 0 = disabled */
+static volatile unsigned zs_wbgen;	/* bumped per writeback done */
+static struct spinlock zs_lock = SPINLOCK_INITIALIZER;
+
+void
+zswap_bootstrap(size_t maxbytes)
+{
+	KASSERT(zs_maxbytes == 0);
+	zs_maxbytes = maxbytes;
+}
+
+////////////////////////////////////////////////////////////
+// Compression
+
+/*
+ * Compress the page at SRC into DST, which has room for MAXBYTES.
+ * The format is a stream of 32-bit tokens: low bit set means the
+ * token counts elided zero words; low bit clear means (token >> 1)
+ * literal words follow. Returns the compressed size in bytes, or 0
+ * if the page doesn't fit in MAXBYTES.
+ */
+static
+size_t
+zswap_compress(const uint32_t *src, uint32_t *dst, size_t maxbytes)
+{
+	unsigned nwords = PAGE_SIZE / sizeof(uint32_t);
+	unsigned maxwords = maxbytes / sizeof(uint32_t);
+	unsigned in, out, run;
+
+	in = 0;
+	out = 0;
+	while (in < nwords) {
+		if (src[in] == 0) {
+			run = 0;
+			while (in < nwords && src[in] == 0) {
+				in++;
+				run++;
+			}
+			if (out == maxwords) {
+				return 0;
+			}
+			dst[out++] = (run << 1) | 1;
+		}
+		else {
+			unsigned start = in;
+
+			while (in < nwords && src[in] != 0) {
+				in++;
+			}
+			run = in - start;
+			if (out + 1 + run > maxwords) {
+				return 0;
+			}
+			dst[out++] = run << 1;
+			memcpy(&dst[out], &src[start],
+			       run * sizeof(uint32_t));
+			out += run;
+		}
+	}
+	return out * sizeof(uint32_t);
+}
+
+/*
+ * Expand NBYTES of compressed data at SRC into the page at DST.
+ */
+static
+void
+zswap_decompress(const uint32_t *src, size_t nbytes, uint32_t *dst)
+{
+	unsigned inwords = nbytes / sizeof(uint32_t);
+	unsigned in, out, run;
+	uint32_t token;
+
+	in = 0;
+	out = 0;
+	while (in < inwords) {
+		token = src[in++];
+		run = token >> 1;
+		if (token & 1) {
+			bzero(&dst[out], run * sizeof(uint32_t));
+		}
+		else {
+			memcpy(&dst[out], &src[in],
+			       run * sizeof(uint32_t));
+			in += run;
+		}
+		out += run;
+	}
+	KASSERT(out == PAGE_SIZE / sizeof(uint32_t));
+}
+
+////////////////////////////////////////////////////////////
+// Pool bookkeeping (all with zs_lock held)
+
+static
+unsigned
+zswap_bucket(unsigned slot)
+{
+	return (slot ^ (slot >> 6)) % ZSWAP_BUCKETS;
+}
+
+static
+struct zswap_entry *
+zswap_find(unsigned slot)
+{
+	struct zswap_entry *ze;
+
+	KASSERT(spinlock_do_i_hold(&zs_lock));
+
+	for (ze = zs_hash[zswap_bucket(slot)]; ze != NULL;
+	     ze = ze->ze_hnext) {
+		if (ze->ze_slot == slot) {
+			return ze;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+zswap_link(struct zswap_entry *ze)
+{
+	unsigned b = zswap_bucket(ze->ze_slot);
+
+	KASSERT(spinlock_do_i_hold(&zs_lock));
+
+	ze->ze_hnext = zs_hash[b];
+	zs_hash[b] = ze;
+
+	ze->ze_lprev = NULL;
+	ze->ze_lnext = zs_lruhead;
+	if (zs_lruhead != NULL) {
+		zs_lruhead->ze_lprev = ze;
+	}
+	zs_lruhead = ze;
+	if (zs_lrutail == NULL) {
+		zs_lrutail = ze;
+	}
+
+	zs_bytes += ze->ze_size;
+}
+
+static
+void
+zswap_unlink_lru(struct zswap_entry *ze)
+{
+	KASSERT(spinlock_do_i_hold(&zs_lock));
+
+	if (ze->ze_lprev != NULL) {
+		ze->ze_lprev->ze_lnext = ze->ze_lnext;
+	}
+	else {
+		zs_lruhead = ze->ze_lnext;
+	}
+	if (ze->ze_lnext != NULL) {
+		ze->ze_lnext->ze_lprev = ze->ze_lprev;
+	}
+	else {
+		zs_lrutail = ze->ze_lprev;
+	}
+	ze->ze_lnext = NULL;
+	ze->ze_lprev = NULL;
+}
+
+static
+void
+zswap_unlink_hash(struct zswap_entry *ze)
+{
+	struct zswap_entry **p;
+
+	KASSERT(spinlock_do_i_hold(&zs_lock));
+
+	for (p = &zs_hash[zswap_bucket(ze->ze_slot)]; *p != ze;
+	     p = &(*p)->ze_hnext) {
+		KASSERT(*p != NULL);
+	}
+	*p = ze->ze_hnext;
+	ze->ze_hnext = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Writeback
+
+/*
+ * Write ZE's page to its reserved disk slot. ZE is marked busy and
+ * off the LRU but still findable in the hash, so concurrent lookups
+ * wait instead of reading the not-yet-written disk slot. Returns the
+ * swap layer's result.
+ */
+static
+int
+zswap_writeback(struct zswap_entry *ze)
+{
+	void *buf;
+	int result;
+
+	KASSERT(ze->ze_busy);
+
+	buf = kmalloc(PAGE_SIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	zswap_decompress(ze->ze_data, ze->ze_size, buf);
+	result = swap_out(KVADDR_TO_PADDR((vaddr_t)buf), ze->ze_slot);
+	kfree(buf);
+	return result;
+}
+
+/*
+ * Make room for NBYTES more by spilling the oldest entries to disk.
+ * Called and returns with zs_lock held; drops it around the I/O.
+ * Returns false if the pool can't be brought under budget (disk
+ * trouble, or every resident entry already mid-writeback).
+ */
+static
+bool
+zswap_makeroom(size_t nbytes)
+{
+	struct zswap_entry *victim;
+	int result;
+
+	KASSERT(spinlock_do_i_hold(&zs_lock));
+
+	while (zs_bytes + nbytes > zs_maxbytes) {
+		victim = zs_lrutail;
+		while (victim != NULL && victim->ze_busy) {
+			victim = victim->ze_lprev;
+		}
+		if (victim == NULL) {
+			return false;
+		}
+
+		victim->ze_busy = true;
+		zswap_unlink_lru(victim);
+		zs_bytes -= victim->ze_size;
+		spinlock_release(&zs_lock);
+
+		result = zswap_writeback(victim);
+
+		spinlock_acquire(&zs_lock);
+		if (result) {
+			/* Keep the data; put it back as the oldest. */
+			kprintf("zswap: writeback of slot %u failed: %s\n",
+				victim->ze_slot, strerror(result));
+			victim->ze_busy = false;
+			victim->ze_lprev = zs_lrutail;
+			victim->ze_lnext = NULL;
+			if (zs_lrutail != NULL) {
+				zs_lrutail->ze_lnext = victim;
+			}
+			else {
+				zs_lruhead = victim;
+			}
+			zs_lrutail = victim;
+			zs_bytes += victim->ze_size;
+			zs_wbgen++;
+			waitaddr_wake(&zs_wbgen, WAITADDR_ALL);
+			return false;
+		}
+		zswap_unlink_hash(victim);
+		zs_wbgen++;
+		waitaddr_wake(&zs_wbgen, WAITADDR_ALL);
+		spinlock_release(&zs_lock);
+
+		kfree(victim->ze_data);
+		kfree(victim);
+
+		spinlock_acquire(&zs_lock);
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+// Public interface
+
+bool
+zswap_store(unsigned slot, const void *src)
+{
+	struct zswap_entry *ze;
+	void *scratch, *data;
+	size_t csize;
+
+	if (zs_maxbytes == 0) {
+		return false;
+	}
+
+	scratch = kmalloc(PAGE_SIZE);
+	if (scratch == NULL) {
+		return false;
+	}
+	csize = zswap_compress(src, scratch, ZSWAP_MAXCOMP);
+	if (csize == 0) {
+		/* Doesn't compress well enough to be worth holding. */
+		kfree(scratch);
+		return false;
+	}
+
+	data = kmalloc(csize);
+	ze = kmalloc(sizeof(*ze));
+	if (data == NULL || ze == NULL) {
+		if (data != NULL) {
+			kfree(data);
+		}
+		if (ze != NULL) {
+			kfree(ze);
+		}
+		kfree(scratch);
+		return false;
+	}
+	memcpy(data, scratch, csize);
+	kfree(scratch);
+
+	ze->ze_slot = slot;
+	ze->ze_size = csize;
+	ze->ze_data = data;
+	ze->ze_busy = false;
+
+	spinlock_acquire(&zs_lock);
+	KASSERT(zswap_find(slot) == NULL);
+	if (!zswap_makeroom(csize)) {
+		spinlock_release(&zs_lock);
+		kfree(data);
+		kfree(ze);
+		return false;
+	}
+	zswap_link(ze);
+	spinlock_release(&zs_lock);
+
+	return true;
+}
+
+bool
+zswap_load(unsigned slot, void *dst)
+{
+	struct zswap_entry *ze;
+	unsigned gen;
+
+	if (zs_maxbytes == 0) {
+		return false;
+	}
+
+	spinlock_acquire(&zs_lock);
+	for (;;) {
+		ze = zswap_find(slot);
+		if (ze == NULL || !ze->ze_busy) {
+			break;
+		}
+		/* Mid-writeback; wait for it to land, then look again. */
+		gen = zs_wbgen;
+		spinlock_release(&zs_lock);
+		waitaddr_sleep(&zs_wbgen, gen);
+		spinlock_acquire(&zs_lock);
+	}
+	if (ze == NULL) {
+		spinlock_release(&zs_lock);
+		return false;
+	}
+	zswap_unlink_hash(ze);
+	zswap_unlink_lru(ze);
+	zs_bytes -= ze->ze_size;
+	spinlock_release(&zs_lock);
+
+	zswap_decompress(ze->ze_data, ze->ze_size, dst);
+	kfree(ze->ze_data);
+	kfree(ze);
+	return true;
+}
+
+void
+zswap_invalidate(unsigned slot)
+{
+	struct zswap_entry *ze;
+	unsigned gen;
+
+	if (zs_maxbytes == 0) {
+		return;
+	}
+
+	spinlock_acquire(&zs_lock);
+	for (;;) {
+		ze = zswap_find(slot);
+		if (ze == NULL || !ze->ze_busy) {
+			break;
+		}
+		gen = zs_wbgen;
+		spinlock_release(&zs_lock);
+		waitaddr_sleep(&zs_wbgen, gen);
+		spinlock_acquire(&zs_lock);
+	}
+	if (ze == NULL) {
+		spinlock_release(&zs_lock);
+		return;
+	}
+	zswap_unlink_hash(ze);
+	zswap_unlink_lru(ze);
+	zs_bytes -= ze->ze_size;
+	spinlock_release(&zs_lock);
+
+	kfree(ze->ze_data);
+	kfree(ze);
+}
@@ -95,12 +95,25 @@ all: includelinks .WAIT $(KERNEL)
 # The version number is kept in the file called "version" in the build
 # directory.
 #
+# symtab.c/.o is also generated on every build: the kernel is linked
+# once with an empty symbol table, mksymtab.sh reads the kernel's text
+# symbols back out with nm, and the kernel is relinked with the real
+# table so it can symbolize its own pcs (see kern/include/ksyms.h).
+# The relink doesn't move the text - symtab.o is pure data, which the
+# linker script places after it - so the recorded addresses stay
+# correct.
+#
 # By immemorial tradition, "size" is run on the kernel after it's linked.
 #
 $(KERNEL):
 	$(KTOP)/conf/newvers.sh $(CONFNAME)
 	$(CC) $(KCFLAGS) -c vers.c
-	$(LD) $(KLDFLAGS) $(OBJS) vers.o -o $(KERNEL)
+	$(KTOP)/conf/mksymtab.sh > symtab.c
+	$(CC) $(KCFLAGS) -c symtab.c
+	$(LD) $(KLDFLAGS) $(OBJS) vers.o symtab.o -o $(KERNEL)
+	$(KTOP)/conf/mksymtab.sh "$(NM)" $(KERNEL) > symtab.c
+	$(CC) $(KCFLAGS) -c symtab.c
+	$(LD) $(KLDFLAGS) $(OBJS) vers.o symtab.o -o $(KERNEL)
 	@echo '*** This is $(CONFNAME) build #'`cat version`' ***'
 	$(SIZE) $(KERNEL)
 
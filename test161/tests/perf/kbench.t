@@ -0,0 +1,10 @@
+---
+name: "Kernel Microbenchmarks"
+description: >
+  Runs the kernel micro-benchmark loops (context switch, locks,
+  kmalloc, user copies, page faults) in check mode, which fails any
+  loop whose median cycles/op exceeds its budget in kbench.c.
+tags: [perf]
+depends: [boot]
+---
+kbench check
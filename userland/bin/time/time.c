@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * time - run a command and report its elapsed and cpu time.
+ * usage: time program [args...]
+ *
+ * The cpu figure comes from getrusage(RUSAGE_CHILDREN) after the
+ * child is reaped, so it covers the command and anything the command
+ * itself waited for. OS/161 doesn't separate user from system time;
+ * the whole total appears as "cpu".
+ *
+ * This program uses these system calls:
+ *    fork execv waitpid getrusage __time _exit
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <err.h>
+
+int
+main(int argc, char *argv[])
+{
+	struct rusage ru;
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	pid_t pid;
+	int status;
+
+	if (argc < 2) {
+		warnx("Usage: time program [args...]");
+		return 1;
+	}
+
+	if (__time(&startsecs, &startnsecs) == -1) {
+		err(1, "__time");
+	}
+
+	pid = fork();
+	if (pid == -1) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		/* child */
+		execv(argv[1], argv + 1);
+		err(1, "%s", argv[1]);
+	}
+
+	if (waitpid(pid, &status, 0) == -1) {
+		err(1, "waitpid");
+	}
+
+	if (__time(&endsecs, &endnsecs) == -1) {
+		err(1, "__time");
+	}
+	if (endnsecs < startnsecs) {
+		endnsecs += 1000000000;
+		endsecs--;
+	}
+
+	if (getrusage(RUSAGE_CHILDREN, &ru) == -1) {
+		err(1, "getrusage");
+	}
+
+	printf("real %lld.%03lus  cpu %lld.%03lds\n",
+	       (long long)(endsecs - startsecs),
+	       (endnsecs - startnsecs) / 1000000,
+	       (long long)ru.ru_utime.tv_sec,
+	       (long)(ru.ru_utime.tv_usec / 1000));
+
+	if (WIFSIGNALED(status)) {
+		warnx("%s: signal %d", argv[1], WTERMSIG(status));
+		return 1;
+	}
+	return WEXITSTATUS(status);
+}
@@ -33,7 +33,18 @@
 /* Get the error codes from the kernel. */
 #include <kern/errno.h>
 
-/* Declare the standard global variable errno. */
+/* Declare the traditional global variable errno. */
 extern int errno;
 
+/*
+ * In a threaded program each thread has its own errno, kept in its
+ * TLS block (see <tls.h>); __errno_ptr returns the calling thread's
+ * slot, falling back to the global when no TLS block is registered.
+ * Plain "errno" accesses go through it, so existing code needn't
+ * change.
+ */
+int *__errno_ptr(void);
+void __set_errno(int err);	/* used by the syscall stubs */
+#define errno (*__errno_ptr())
+
 #endif /* _ERRNO_H_ */
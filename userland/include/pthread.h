@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PTHREAD_H_
+#define _PTHREAD_H_
+
+#include <sys/cdefs.h>
+
+/*
+ * Subset of the POSIX threads interface, layered on the tfork/texit
+ * and futex system calls. See lib/libpthread for the implementation.
+ *
+ * Threads share the whole address space; each gets a stack carved
+ * out of the heap. The process still exits via _exit (or returning
+ * from main), which takes every thread with it: join your threads
+ * before you exit.
+ *
+ * Mutexes and condition variables only enter the kernel when they
+ * actually contend; the uncontended paths are a few instructions.
+ */
+
+struct pthread;			/* opaque; owned by the library */
+typedef struct pthread *pthread_t;
+
+typedef struct {
+	volatile unsigned m_lock;	/* 0 free, 1 held, 2 held+waiters */
+} pthread_mutex_t;
+#define PTHREAD_MUTEX_INITIALIZER { 0 }
+
+typedef struct {
+	volatile unsigned c_seq;	/* bumped by signal/broadcast */
+} pthread_cond_t;
+#define PTHREAD_COND_INITIALIZER { 0 }
+
+/*
+ * Attribute arguments are accepted for source compatibility but must
+ * be NULL; we don't support any attributes.
+ */
+typedef void pthread_attr_t;
+typedef void pthread_mutexattr_t;
+typedef void pthread_condattr_t;
+
+int pthread_create(pthread_t *tret, const pthread_attr_t *attr,
+		   void *(*func)(void *), void *arg);
+int pthread_join(pthread_t t, void **result_ret);
+__DEAD void pthread_exit(void *result);
+pthread_t pthread_self(void);	/* NULL means the main thread */
+
+int pthread_mutex_init(pthread_mutex_t *m, const pthread_mutexattr_t *attr);
+int pthread_mutex_destroy(pthread_mutex_t *m);
+int pthread_mutex_lock(pthread_mutex_t *m);
+int pthread_mutex_trylock(pthread_mutex_t *m);
+int pthread_mutex_unlock(pthread_mutex_t *m);
+
+int pthread_cond_init(pthread_cond_t *c, const pthread_condattr_t *attr);
+int pthread_cond_destroy(pthread_cond_t *c);
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m);
+int pthread_cond_signal(pthread_cond_t *c);
+int pthread_cond_broadcast(pthread_cond_t *c);
+
+#endif /* _PTHREAD_H_ */
@@ -41,6 +41,45 @@
 /* Constant returned by a bunch of stdio functions on error */
 #define EOF (-1)
 
+/* Buffering modes, for setvbuf */
+#define _IONBF 0	/* unbuffered */
+#define _IOLBF 1	/* line buffered */
+#define _IOFBF 2	/* fully buffered */
+
+/* Default stream buffer size */
+#define BUFSIZ 1024
+
+/*
+ * Buffered output stream. Fronts a file descriptor with a buffer so
+ * output-heavy programs don't make one syscall per character. The
+ * fields are libc-private; use the functions below.
+ */
+typedef struct __FILE {
+	int f_fd;			/* underlying file descriptor */
+	int f_mode;			/* _IONBF, _IOLBF, or _IOFBF */
+	int f_err;			/* sticky error flag */
+	size_t f_bufsize;		/* size of f_buf */
+	size_t f_pos;			/* bytes buffered so far */
+	char *f_buf;			/* the buffer in use */
+	char f_stdbuf[BUFSIZ];		/* default buffer */
+} FILE;
+
+/*
+ * The standard streams. stdout is line buffered, stderr unbuffered;
+ * stdin exists only so the name is available (input is not buffered).
+ */
+extern FILE *stdin, *stdout, *stderr;
+
+/* Stream output. exit() flushes; _exit does not. */
+int fflush(FILE *f);			/* NULL flushes all streams */
+int setvbuf(FILE *f, char *buf, int mode, size_t size);
+int fputc(int c, FILE *f);
+int fputs(const char *s, FILE *f);
+size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *f);
+
+/* Stream output for libc internal use; returns 0 or -1 on error. */
+int __fwrite(FILE *f, const char *data, size_t len);
+
 /*
  * The actual guts of printf
  * (for libc internal use only)
@@ -53,6 +92,8 @@ int __vprintf(void (*sendfunc)(void *clientdata, const char *, size_t len),
 /* Printf calls for user programs */
 int printf(const char *fmt, ...);
 int vprintf(const char *fmt, __va_list ap);
+int fprintf(FILE *f, const char *fmt, ...);
+int vfprintf(FILE *f, const char *fmt, __va_list ap);
 int snprintf(char *buf, size_t len, const char *fmt, ...);
 int vsnprintf(char *buf, size_t len, const char *fmt, __va_list ap);
 
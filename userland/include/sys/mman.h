@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+#include <sys/types.h>
+
+/*
+ * Get the PROT_ and MAP_ flags (and MAP_FAILED) from the kernel.
+ */
+#include <kern/mman.h>
+
+/*
+ * mmap maps LEN bytes at OFFSET of the file open on FD (or, with
+ * MAP_ANON, fresh zeroed memory) into the address space and returns
+ * the mapped address, or MAP_FAILED with errno set. ADDR is a hint;
+ * 0 lets the kernel choose. Only MAP_PRIVATE mappings are supported.
+ *
+ * munmap removes a mapping made by mmap; the range must match the
+ * original mapping exactly.
+ *
+ * madvise hints at the access pattern of a range (MADV_ constants
+ * above); the kernel may use it to prefetch or drop pages.
+ */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd,
+	   off_t offset);
+int munmap(void *addr, size_t len);
+int madvise(void *addr, size_t len, int advice);
+
+/*
+ * mlock wires a range into physical memory so it's never paged out
+ * (subject to a per-process budget); munlock undoes it. Wirings are
+ * not inherited across fork.
+ */
+int mlock(const void *addr, size_t len);
+int munlock(const void *addr, size_t len);
+
+#endif /* _SYS_MMAN_H_ */
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _TLS_H_
+#define _TLS_H_
+
+/*
+ * Per-thread state block ("TLS").
+ *
+ * The startup code registers a static block for the main thread
+ * (__tls_init, called from crt0), and libpthread registers one per
+ * created thread, using the settls system call; gettls returns the
+ * calling thread's block. The kernel preserves the pointer per
+ * thread, so libc can reach per-thread state in O(1) instead of
+ * scanning thread stacks under a lock.
+ */
+
+/*
+ * Per-thread cache of small free malloc blocks, kept here so malloc
+ * and free can recycle small blocks without taking the heap lock.
+ * See lib/libc/stdlib/malloc.c.
+ */
+#define __TLS_NMCACHE	8	/* number of size classes cached */
+#define __TLS_MCACHEMAX	32	/* blocks kept per size class */
+
+struct __tls {
+	void *tls_self;		/* owning pthread, or NULL for main */
+	int tls_errno;		/* per-thread errno slot */
+
+	void *tls_mcache[__TLS_NMCACHE];	/* free block chains */
+	unsigned tls_mcount[__TLS_NMCACHE];	/* lengths of same */
+};
+
+/* Register the main thread's block. Called from crt0 before main. */
+void __tls_init(void);
+
+#endif /* _TLS_H_ */
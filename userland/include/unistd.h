@@ -57,6 +57,8 @@
  *     fstat:    sys/stat.h
  *     lstat:    sys/stat.h
  *     mkdir:    sys/stat.h
+ *     mmap:     sys/mman.h
+ *     munmap:   sys/mman.h
  *
  * If this were standard Unix, more prototypes would go in other
  * header files as well, as follows:
@@ -112,6 +114,9 @@
 __DEAD void _exit(int code);
 int execv(const char *prog, char *const *args);
 pid_t fork(void);
+pid_t spawn(const char *prog, char *const *args); /* fork+execv combined */
+/* checkpoint - freeze the process to a file; returns 1 when restored */
+int checkpoint(const char *path);
 pid_t waitpid(pid_t pid, int *returncode, int flags);
 /*
  * Open actually takes either two or three args: the optional third
@@ -119,8 +124,12 @@ pid_t waitpid(pid_t pid, int *returncode, int flags);
  * security and permissions, you can ignore it.
  */
 int open(const char *filename, int flags, ...);
+/* openat - open relative to an open directory; absolute paths ignore fd */
+int openat(int filehandle, const char *filename, int flags, ...);
 ssize_t read(int filehandle, void *buf, size_t size);
 ssize_t write(int filehandle, const void *buf, size_t size);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
 int close(int filehandle);
 int reboot(int code);
 int sync(void);
@@ -131,6 +140,7 @@ int rmdir(const char *dirname);
 pid_t getpid(void);
 int ioctl(int filehandle, int code, void *buf);
 off_t lseek(int filehandle, off_t pos, int code);
+int fadvise(int filehandle, off_t pos, off_t len, int advice); /* FADV_* */
 int fsync(int filehandle);
 int ftruncate(int filehandle, off_t size);
 int remove(const char *filename);
@@ -141,13 +151,34 @@ int chdir(const char *path);
 
 /* Optional. */
 void *sbrk(__intptr_t change);
+int shmget(unsigned key, size_t size); /* find/create shared segment */
+void *shmat(int shmid); /* map it; kernel picks the address */
+int futex(unsigned *addr, int op, unsigned val); /* ops in kern/futex.h */
+int tfork(void (*entry)(void *), void *stack, void *arg); /* extra thread */
+int texit(unsigned *doneaddr); /* thread exit; sets *doneaddr=1 and wakes */
+int settls(void *base); /* set per-thread TLS base; see <tls.h> */
+void *gettls(void); /* read it back; NULL if never set */
 ssize_t getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
+int dup(int filehandle);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
+struct kheapstats; /* in kern/kheapstats.h */
+int __kheapstats(struct kheapstats *stats);
+struct vmstats; /* in kern/vmstat.h */
+int __vmstats(struct vmstats *stats);
+struct pvmstats; /* in kern/vmstat.h */
+int __getvmstats(pid_t pid, struct pvmstats *stats);
+struct netaddr; /* in kern/net.h */
+int socket(int domain, int type, int protocol);
+int bind(int fd, const struct netaddr *addr, size_t addrlen);
+ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+	       const struct netaddr *addr, size_t addrlen);
+ssize_t recvfrom(int fd, void *buf, size_t len, int flags,
+		 struct netaddr *addr, size_t *addrlen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -42,11 +42,9 @@ int
 __puts(const char *str)
 {
 	size_t len;
-	ssize_t ret;
 
 	len = strlen(str);
-	ret = write(STDOUT_FILENO, str, len);
-	if (ret == -1) {
+	if (__fwrite(stdout, str, len)) {
 		return EOF;
 	}
 	return len;
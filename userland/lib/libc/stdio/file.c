@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Buffered output streams.
+ *
+ * Every character printf emitted used to become its own write
+ * syscall, so a program printing ten thousand lines took ten
+ * thousand trips through the trap path. A FILE fronts a descriptor
+ * with a buffer: fully buffered streams flush when the buffer
+ * fills, line buffered streams additionally flush on newline, and
+ * unbuffered streams pass writes straight through.
+ *
+ * stdout is line buffered so console output still appears a line at
+ * a time; stderr is unbuffered so diagnostics escape even if things
+ * are going wrong. exit() flushes everything (but _exit does not,
+ * and neither does a crash), and getchar flushes stdout so a prompt
+ * without a newline shows before input is read.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+
+static FILE __stdin = { .f_fd = STDIN_FILENO, .f_mode = _IONBF };
+static FILE __stdout = { .f_fd = STDOUT_FILENO, .f_mode = _IOLBF };
+static FILE __stderr = { .f_fd = STDERR_FILENO, .f_mode = _IONBF };
+
+FILE *stdin = &__stdin;
+FILE *stdout = &__stdout;
+FILE *stderr = &__stderr;
+
+/*
+ * Raw write to the stream's descriptor, riding out short writes.
+ */
+static
+int
+stream_write(FILE *f, const char *data, size_t len)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = write(f->f_fd, data, len);
+		if (r <= 0) {
+			f->f_err = 1;
+			return -1;
+		}
+		data += r;
+		len -= r;
+	}
+	return 0;
+}
+
+/*
+ * Point the stream at its built-in buffer if none has been chosen.
+ */
+static
+void
+stream_setup(FILE *f)
+{
+	if (f->f_buf == NULL) {
+		f->f_buf = f->f_stdbuf;
+		f->f_bufsize = BUFSIZ;
+	}
+}
+
+int
+fflush(FILE *f)
+{
+	int r0, r1;
+	size_t len;
+
+	if (f == NULL) {
+		r0 = fflush(stdout);
+		r1 = fflush(stderr);
+		return (r0 || r1) ? EOF : 0;
+	}
+
+	if (f->f_pos == 0) {
+		return 0;
+	}
+
+	/*
+	 * Drop the buffered data even if the write fails; otherwise
+	 * a dead descriptor makes every later flush refail on the
+	 * same bytes.
+	 */
+	len = f->f_pos;
+	f->f_pos = 0;
+	return stream_write(f, f->f_buf, len) ? EOF : 0;
+}
+
+int
+setvbuf(FILE *f, char *buf, int mode, size_t size)
+{
+	if (mode != _IONBF && mode != _IOLBF && mode != _IOFBF) {
+		return EOF;
+	}
+	if (fflush(f)) {
+		return EOF;
+	}
+	f->f_mode = mode;
+	if (buf != NULL && size > 0) {
+		f->f_buf = buf;
+		f->f_bufsize = size;
+	}
+	else {
+		f->f_buf = f->f_stdbuf;
+		f->f_bufsize = BUFSIZ;
+	}
+	return 0;
+}
+
+/*
+ * The workhorse: append LEN bytes to the stream, flushing as
+ * dictated by the buffering mode. Libc-internal; the public entry
+ * points below and printf all funnel through here.
+ */
+int
+__fwrite(FILE *f, const char *data, size_t len)
+{
+	size_t space, n;
+	int sawnewline;
+
+	stream_setup(f);
+
+	if (f->f_mode == _IONBF) {
+		return stream_write(f, data, len);
+	}
+
+	sawnewline = (f->f_mode == _IOLBF &&
+		      memchr(data, '\n', len) != NULL);
+
+	while (len > 0) {
+		space = f->f_bufsize - f->f_pos;
+		n = len < space ? len : space;
+		memcpy(f->f_buf + f->f_pos, data, n);
+		f->f_pos += n;
+		data += n;
+		len -= n;
+		if (f->f_pos == f->f_bufsize && fflush(f)) {
+			return -1;
+		}
+	}
+
+	if (sawnewline && fflush(f)) {
+		return -1;
+	}
+	return 0;
+}
+
+int
+fputc(int c, FILE *f)
+{
+	char ch = c;
+
+	if (__fwrite(f, &ch, 1)) {
+		return EOF;
+	}
+	return (int)(unsigned char)ch;
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+	if (__fwrite(f, s, strlen(s))) {
+		return EOF;
+	}
+	return 0;
+}
+
+size_t
+fwrite(const void *ptr, size_t size, size_t nmemb, FILE *f)
+{
+	if (size == 0 || nmemb == 0) {
+		return 0;
+	}
+	if (__fwrite(f, ptr, size * nmemb)) {
+		return 0;
+	}
+	return nmemb;
+}
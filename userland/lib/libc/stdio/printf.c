@@ -40,17 +40,23 @@
 
 
 /*
- * Function passed to __vprintf to do the actual output.
+ * Function passed to __vprintf to do the actual output: append to
+ * the target stream, which batches it up into few large writes.
  */
+struct printf_state {
+	FILE *file;
+	int err;
+};
+
 static
 void
 __printf_send(void *mydata, const char *data, size_t len)
 {
-	ssize_t ret;
-	int *err = mydata;
+	struct printf_state *ps = mydata;
 
-	ret = write(STDOUT_FILENO, data, len);
-	*err = (ret == -1) ? errno : 0;
+	if (__fwrite(ps->file, data, len)) {
+		ps->err = errno;
+	}
 }
 
 /* printf: hand off to vprintf */
@@ -66,14 +72,38 @@ printf(const char *fmt, ...)
 	return chars;
 }
 
-/* vprintf: call __vprintf to do the work. */
+/* vprintf: print to stdout. */
 int
 vprintf(const char *fmt, va_list ap)
 {
-	int chars, err;
-	chars = __vprintf(__printf_send, &err, fmt, ap);
-	if (err) {
-		errno = err;
+	return vfprintf(stdout, fmt, ap);
+}
+
+/* fprintf: hand off to vfprintf */
+int
+fprintf(FILE *f, const char *fmt, ...)
+{
+	int chars;
+	va_list ap;
+
+	va_start(ap, fmt);
+	chars = vfprintf(f, fmt, ap);
+	va_end(ap);
+	return chars;
+}
+
+/* vfprintf: call __vprintf to do the work. */
+int
+vfprintf(FILE *f, const char *fmt, va_list ap)
+{
+	struct printf_state ps;
+	int chars;
+
+	ps.file = f;
+	ps.err = 0;
+	chars = __vprintf(__printf_send, &ps, fmt, ap);
+	if (ps.err) {
+		errno = ps.err;
 		return -1;
 	}
 	return chars;
@@ -30,10 +30,27 @@
 /*
  * User-level malloc and free implementation.
  *
- * This is a basic first-fit allocator. It's intended to be simple and
- * easy to follow. It performs abysmally if the heap becomes larger than
- * physical memory. To get (much) better out-of-core performance, port
- * the kernel's malloc. :-)
+ * Free blocks are kept in segregated size-class bins, so allocation
+ * is a list pop plus maybe a split rather than a walk of the whole
+ * heap, and long-running allocation-churn workloads don't slow down
+ * as the heap grows. Adjacent free blocks are coalesced eagerly, and
+ * free space at the top of the heap is given back to the system with
+ * a negative sbrk once enough of it accumulates.
+ *
+ * The heap layout itself is still the traditional boundary-tag one:
+ * every block carries a header with offsets to both neighbors, which
+ * is what makes coalescing (and heap-walking consistency checks)
+ * possible. The bins are threaded through the free blocks' own data
+ * areas, so they cost no extra memory.
+ *
+ * The heap is shared by all threads (tfork) and guarded by a single
+ * futex-based lock. So that threads don't serialize on it, each
+ * thread also keeps a small cache of free blocks in its TLS block
+ * (see <tls.h>) and recycles matching small requests from there
+ * without locking. Cached blocks stay marked in-use, so coalescing,
+ * trimming, and the consistency checks all ignore them. On non-
+ * OS/161 hosts, where the TLS and futex calls don't exist, the file
+ * still builds but is single-threaded as before.
  */
 
 #include <stdlib.h>
@@ -42,6 +59,13 @@
 #include <err.h>
 #include <assert.h>
 
+#ifdef __mips__
+/* Building for OS/161 proper: thread support is available. */
+#define MALLOC_THREADS
+#include <kern/futex.h>
+#include <tls.h>
+#endif
+
 #undef MALLOCDEBUG
 
 #if defined(__mips__) || defined(__i386__)
@@ -93,14 +117,16 @@ struct mheader {
 	/*
 	 * 64-bit platform. size_t is 64 bits (8 bytes)
 	 * Block size is 16 bytes.
+	 * (The fields must be size_t; plain unsigned is 32 bits and
+	 * can't hold a 60-bit field.)
 	 */
-	unsigned mh_prevblock:60;
-	unsigned mh_pad:1;
-	unsigned mh_magic1:3;
+	size_t mh_prevblock:60;
+	size_t mh_pad:1;
+	size_t mh_magic1:3;
 
-	unsigned mh_nextblock:60;
-	unsigned mh_inuse:1;
-	unsigned mh_magic2:3;
+	size_t mh_nextblock:60;
+	size_t mh_inuse:1;
+	size_t mh_magic2:3;
 
 #else
 #error "please fix me"
@@ -147,12 +173,310 @@ static size_t __malloc_pagesize;
 #define PAGE_SIZE 4096
 #endif
 
+/*
+ * Free blocks are chained into size-class bins, with the links stored
+ * in the blocks' own data areas. The smallest possible data area is
+ * MBLOCKSIZE bytes, which is exactly two pointers, so every free
+ * block can hold its links. The list is doubly linked so coalescing
+ * can unlink a neighbor in constant time.
+ */
+struct mfreelink {
+	struct mheader *mf_nextfree;
+	struct mheader *mf_prevfree;	/* NULL if first in its bin */
+};
+
+#define M_LINK(mh)	((struct mfreelink *)M_DATA(mh))
+
+/*
+ * The bins. Bins 0 through NSMALLBINS-1 hold free blocks of exactly
+ * (index+1)*MBLOCKSIZE data bytes, so for small requests the head of
+ * the bin is always an exact fit. Above that, each bin spans twice
+ * the sizes of the one before it, and the last bin holds everything
+ * too big for the others.
+ *
+ * __malloc_binmap has a bit set for each nonempty bin, so finding a
+ * bin that can satisfy a request is a mask and a scan of one word,
+ * never a walk of the heap.
+ */
+#define NSMALLBINS	16
+#define NLARGEBINS	12
+#define NBINS		(NSMALLBINS + NLARGEBINS)
+
+/*
+ * Give space back to the system only in multiples of this, so a tight
+ * malloc/free loop near a page boundary doesn't turn into a system
+ * call per iteration.
+ */
+#define MTRIMPAGES	4
+
+static struct mheader *__malloc_bins[NBINS];
+static uint32_t __malloc_binmap;
+
 ////////////////////////////////////////////////////////////
 
 /*
- * Static variables - the bottom and top addresses of the heap.
+ * Static variables - the bottom and top addresses of the heap, and
+ * the topmost block (needed to grow and trim the heap without
+ * walking it; may be in use or free).
  */
 static uintptr_t __heapbase, __heaptop;
+static struct mheader *__malloc_topblock;
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Heap lock, held across everything that touches the bins, the block
+ * headers, or the break. The usual three-state futex lock: 0 free, 1
+ * held, 2 held with waiters, so the uncontended lock and unlock are
+ * a single compare-and-swap and the kernel is entered only to sleep
+ * on a held lock or wake a recorded waiter. Local rather than a
+ * pthread mutex so libc doesn't depend on libpthread.
+ */
+
+#ifdef MALLOC_THREADS
+
+static volatile unsigned __malloc_lockword;
+
+/*
+ * LL/SC compare-and-swap: if *W equals EXPECTED, store NEWVAL.
+ * Returns the value read, so the swap happened iff the return value
+ * equals EXPECTED.
+ */
+static
+unsigned
+__malloc_cas(volatile unsigned *w, unsigned expected, unsigned newval)
+{
+	unsigned x;
+	unsigned y;
+
+	for (;;) {
+		y = newval;
+		__asm volatile(
+			".set push;"	 /* save assembler mode */
+			".set mips32;"	 /* allow MIPS32 instructions */
+			".set volatile;" /* avoid unwanted optimization */
+			"ll %0, 0(%2);"	 /*   x = *w */
+			"bne %0, %3, 1f;"/*   skip the store on mismatch */
+			"nop;"
+			"sc %1, 0(%2);"	 /*   *w = y; y = success? */
+			"b 2f;"
+			"nop;"
+			"1: li %1, 2;"	 /*   flag the mismatch */
+			"2:"
+			".set pop"	 /* restore assembler mode */
+			: "=&r" (x), "+r" (y)
+			: "r" (w), "r" (expected));
+		if (y != 0) {
+			/* mismatch (y==2) or successful swap (y==1) */
+			return x;
+		}
+		/* SC failed; retry */
+	}
+}
+
+static
+void
+__malloc_lock(void)
+{
+	unsigned c;
+
+	c = __malloc_cas(&__malloc_lockword, 0, 1);
+	if (c == 0) {
+		/* uncontended */
+		return;
+	}
+	do {
+		if (c == 2 ||
+		    __malloc_cas(&__malloc_lockword, 1, 2) != 0) {
+			futex((unsigned *)&__malloc_lockword,
+			      FUTEX_WAIT, 2);
+		}
+	} while ((c = __malloc_cas(&__malloc_lockword, 0, 2)) != 0);
+}
+
+static
+void
+__malloc_unlock(void)
+{
+	unsigned old;
+
+	do {
+		old = __malloc_lockword;
+	} while (__malloc_cas(&__malloc_lockword, old, 0) != old);
+
+	if (old == 2) {
+		/* there was a recorded waiter; wake one */
+		futex((unsigned *)&__malloc_lockword, FUTEX_WAKE, 1);
+	}
+}
+
+#else /* not MALLOC_THREADS */
+
+#define __malloc_lock()
+#define __malloc_unlock()
+
+#endif /* MALLOC_THREADS */
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Per-thread cache of small free blocks, chained through their own
+ * data areas (the first word; the smallest data area holds a
+ * pointer). A cached block keeps mh_inuse set, so to the shared heap
+ * it looks allocated and nothing coalesces or checks it. Since all
+ * blocks come from the one heap it doesn't matter which thread freed
+ * a block or which reuses it; a thread that exits just strands at
+ * most __TLS_MCACHEMAX blocks per class until the process exits.
+ */
+
+#ifdef MALLOC_THREADS
+
+/*
+ * Try to satisfy a request from the cache. size is the raw request;
+ * only an exactly matching size class is taken, so the caller's own
+ * rounding stays consistent with ours.
+ */
+static
+void *
+__mcache_get(size_t size)
+{
+	struct __tls *tls;
+	unsigned idx;
+	void *x;
+
+	idx = (size + MBLOCKSIZE - 1) >> MBLOCKSHIFT;
+	if (idx == 0) {
+		/* malloc(0) allocates one block */
+		idx = 1;
+	}
+	idx--;
+	if (idx >= __TLS_NMCACHE) {
+		return NULL;
+	}
+	tls = gettls();
+	if (tls == NULL || tls->tls_mcache[idx] == NULL) {
+		return NULL;
+	}
+	x = tls->tls_mcache[idx];
+	tls->tls_mcache[idx] = *(void **)x;
+	tls->tls_mcount[idx]--;
+	return x;
+}
+
+/*
+ * Try to cache a freed pointer. Returns nonzero if it was taken.
+ * Anything questionable is declined so the locked free path can
+ * apply its usual checks and complaints.
+ */
+static
+int
+__mcache_put(void *x)
+{
+	struct __tls *tls;
+	struct mheader *mh;
+	unsigned idx;
+
+	tls = gettls();
+	if (tls == NULL) {
+		return 0;
+	}
+	if ((uintptr_t)x < __heapbase || (uintptr_t)x >= __heaptop) {
+		return 0;
+	}
+	mh = ((struct mheader *)x)-1;
+	if (!M_OK(mh) || !mh->mh_inuse) {
+		return 0;
+	}
+	idx = (M_SIZE(mh) >> MBLOCKSHIFT) - 1;
+	if (idx >= __TLS_NMCACHE ||
+	    tls->tls_mcount[idx] >= __TLS_MCACHEMAX) {
+		return 0;
+	}
+	*(void **)x = tls->tls_mcache[idx];
+	tls->tls_mcache[idx] = x;
+	tls->tls_mcount[idx]++;
+	return 1;
+}
+
+#else /* not MALLOC_THREADS */
+
+#define __mcache_get(size)	NULL
+#define __mcache_put(x)		0
+
+#endif /* MALLOC_THREADS */
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Compute the bin a block of the given data size lives in. size must
+ * be a nonzero multiple of MBLOCKSIZE.
+ */
+static
+unsigned
+__malloc_bin(size_t size)
+{
+	size_t units = size >> MBLOCKSHIFT;
+	unsigned bin;
+
+	if (units <= NSMALLBINS) {
+		return units - 1;
+	}
+
+	bin = NSMALLBINS;
+	units = (units - 1) / NSMALLBINS;
+	while (units > 1 && bin < NBINS - 1) {
+		units >>= 1;
+		bin++;
+	}
+	return bin;
+}
+
+/*
+ * Put a free block on the head of its bin.
+ */
+static
+void
+__malloc_bin_insert(struct mheader *mh)
+{
+	unsigned bin = __malloc_bin(M_SIZE(mh));
+	struct mfreelink *ml = M_LINK(mh);
+
+	ml->mf_nextfree = __malloc_bins[bin];
+	ml->mf_prevfree = NULL;
+	if (__malloc_bins[bin] != NULL) {
+		M_LINK(__malloc_bins[bin])->mf_prevfree = mh;
+	}
+	__malloc_bins[bin] = mh;
+	__malloc_binmap |= (uint32_t)1 << bin;
+}
+
+/*
+ * Take a free block off its bin.
+ */
+static
+void
+__malloc_bin_remove(struct mheader *mh)
+{
+	unsigned bin = __malloc_bin(M_SIZE(mh));
+	struct mfreelink *ml = M_LINK(mh);
+
+	if (ml->mf_prevfree != NULL) {
+		M_LINK(ml->mf_prevfree)->mf_nextfree = ml->mf_nextfree;
+	}
+	else {
+		if (__malloc_bins[bin] != mh) {
+			errx(1, "malloc: Heap corrupt; free block %p "
+			     "not in its bin", (void *)mh);
+		}
+		__malloc_bins[bin] = ml->mf_nextfree;
+	}
+	if (ml->mf_nextfree != NULL) {
+		M_LINK(ml->mf_nextfree)->mf_prevfree = ml->mf_prevfree;
+	}
+	if (__malloc_bins[bin] == NULL) {
+		__malloc_binmap &= ~((uint32_t)1 << bin);
+	}
+}
 
 /*
  * Setup function.
@@ -175,6 +499,9 @@ __malloc_init(void)
 	if (1<<MBLOCKSHIFT != MBLOCKSIZE) {
 		errx(1, "malloc: Internal error - MBLOCKSHIFT wrong");
 	}
+	if (sizeof(struct mfreelink) > MBLOCKSIZE) {
+		errx(1, "malloc: Internal error - free links don't fit");
+	}
 
 	/* init should only be called once. */
 	if (__heapbase!=0 || __heaptop!=0) {
@@ -301,7 +628,8 @@ __malloc_sbrk(size_t size)
 /*
  * Make a new (free) block from the block passed in, leaving size
  * bytes for data in the current block. size must be a multiple of
- * MBLOCKSIZE.
+ * MBLOCKSIZE. The new block goes into its bin; the block passed in
+ * must not be in any bin.
  *
  * Only split if the excess space is at least twice the blocksize -
  * one blocksize to hold a header and one for data.
@@ -343,18 +671,25 @@ __malloc_split(struct mheader *mh, size_t size)
 	if (mhnext != (struct mheader *) __heaptop) {
 		mhnext->mh_prevblock = mhnew->mh_nextblock;
 	}
+	else {
+		__malloc_topblock = mhnew;
+	}
+
+	__malloc_bin_insert(mhnew);
 }
 
 /*
- * malloc itself.
+ * malloc itself (minus the per-thread cache). Called with the heap
+ * lock held.
  */
+static
 void *
-malloc(size_t size)
+__malloc_core(size_t size)
 {
 	struct mheader *mh;
-	uintptr_t i;
-	size_t rightprevblock;
 	size_t morespace;
+	unsigned bin;
+	uint32_t map;
 	void *p;
 
 	if (__heapbase==0) {
@@ -372,41 +707,56 @@ malloc(size_t size)
 	__malloc_dump();
 #endif
 
-	/* Round size up to an integral number of blocks. */
+	/*
+	 * Round size up to an integral number of blocks, at least one
+	 * so a free block can always hold its bin links.
+	 */
+	if (size == 0) {
+		size = 1;
+	}
 	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
 
 	/*
-	 * First-fit search algorithm for available blocks.
-	 * Check to make sure the next/previous sizes all agree.
+	 * Look in the request's own bin. For small bins every member
+	 * is the same size, so the head is an exact fit; for large
+	 * bins members vary within the class, so first-fit along the
+	 * (one) list.
 	 */
-	rightprevblock = 0;
-	mh = NULL;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
-		mh = (struct mheader *) i;
-		if (!M_OK(mh)) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad magic bits",
-			     (unsigned long) i);
-		}
-		if (mh->mh_prevblock != rightprevblock) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad previous-block size %lu "
-			     "(should be %lu)",
-			     (unsigned long) i,
-			     (unsigned long) mh->mh_prevblock << MBLOCKSHIFT,
-			     (unsigned long) rightprevblock << MBLOCKSHIFT);
+	bin = __malloc_bin(size);
+	if (bin < NSMALLBINS) {
+		mh = __malloc_bins[bin];
+	}
+	else {
+		for (mh = __malloc_bins[bin]; mh != NULL;
+		     mh = M_LINK(mh)->mf_nextfree) {
+			if (M_SIZE(mh) >= size) {
+				break;
+			}
 		}
-		rightprevblock = mh->mh_nextblock;
+	}
 
-		/* Can't allocate a block that's in use. */
-		if (mh->mh_inuse) {
-			continue;
+	/*
+	 * Failing that, take the head of the next nonempty bin above;
+	 * every block there is bigger than any request mapping to
+	 * this bin, so it always fits.
+	 */
+	if (mh == NULL) {
+		map = __malloc_binmap & ~(((uint32_t)1 << (bin+1)) - 1);
+		if (map != 0) {
+			bin = 0;
+			while ((map & ((uint32_t)1 << bin)) == 0) {
+				bin++;
+			}
+			mh = __malloc_bins[bin];
 		}
+	}
 
-		/* Can't allocate a block that isn't big enough. */
-		if (M_SIZE(mh) < size) {
-			continue;
+	if (mh != NULL) {
+		if (!M_OK(mh)) {
+			errx(1, "malloc: Heap corrupt; free block at %p"
+			     " has bad magic bits", (void *)mh);
 		}
+		__malloc_bin_remove(mh);
 
 		/* Try splitting block. */
 		__malloc_split(mh, size);
@@ -422,19 +772,18 @@ malloc(size_t size)
 #endif
 		return M_DATA(mh);
 	}
-	if (i!=__heaptop) {
-		errx(1, "malloc: Heap corrupt; ran off end");
-	}
 
 	/*
-	 * Didn't find anything. Expand the heap.
+	 * Nothing free is big enough. Expand the heap.
 	 *
-	 * If the heap is nonempty and the top block (the one mh is
-	 * left pointing to after the above loop) is free, we can
-	 * expand it. Otherwise we need a new block.
+	 * If the heap is nonempty and the top block is free, we can
+	 * expand it (any free top block is too small, or it would
+	 * have been found above). Otherwise we need a new block.
 	 */
+	mh = __malloc_topblock;
 	if (mh != NULL && !mh->mh_inuse) {
 		assert(size > M_SIZE(mh));
+		__malloc_bin_remove(mh);
 		morespace = size - M_SIZE(mh);
 	}
 	else {
@@ -446,6 +795,10 @@ malloc(size_t size)
 
 	p = __malloc_sbrk(morespace);
 	if (p == NULL) {
+		if (mh != NULL && !mh->mh_inuse) {
+			/* put the top block back */
+			__malloc_bin_insert(mh);
+		}
 		return NULL;
 	}
 
@@ -457,12 +810,14 @@ malloc(size_t size)
 	else {
 		/* fill out new header */
 		mh = p;
-		mh->mh_prevblock = rightprevblock;
+		mh->mh_prevblock = (__malloc_topblock != NULL) ?
+			__malloc_topblock->mh_nextblock : 0;
 		mh->mh_magic1 = MMAGIC;
 		mh->mh_magic2 = MMAGIC;
 		mh->mh_pad = 0;
 		mh->mh_inuse = 1;
 		mh->mh_nextblock = M_MKFIELD(morespace);
+		__malloc_topblock = mh;
 	}
 
 	/*
@@ -497,7 +852,9 @@ __malloc_deadbeef(void *ptr, size_t size)
 }
 
 /*
- * Attempt to merge two adjacent blocks (mh below mhnext).
+ * Attempt to merge two adjacent blocks (mh below mhnext). Neither
+ * block may be in a bin; the caller unlinks them first, since the
+ * merge changes the size the bin was chosen by.
  */
 static
 void
@@ -522,16 +879,59 @@ __malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
 	if (mhnextnext != (struct mheader *)__heaptop) {
 		mhnextnext->mh_prevblock = mh->mh_nextblock;
 	}
+	else {
+		__malloc_topblock = mh;
+	}
 
 	/* Deadbeef out the memory used by the now-obsolete header */
 	__malloc_deadbeef(mhnext, sizeof(struct mheader));
 }
 
 /*
- * The actual free() implementation.
+ * Give space at the top of the heap back to the system. mh must be
+ * free and not in any bin. Only whole pages are released, only when
+ * MTRIMPAGES of them have accumulated, and the block always keeps
+ * enough data space for its bin links, so it stays a valid block.
  */
+static
 void
-free(void *x)
+__malloc_trim(struct mheader *mh)
+{
+	size_t release;
+	void *x;
+
+	if (M_NEXT(mh) != (struct mheader *)__heaptop) {
+		/* not the top block */
+		return;
+	}
+
+	release = PAGE_SIZE * ((M_SIZE(mh) - MBLOCKSIZE) / PAGE_SIZE);
+	if (release < MTRIMPAGES*PAGE_SIZE) {
+		return;
+	}
+
+	x = sbrk(-(intptr_t)release);
+	if (x == (void *)-1) {
+		/* the system declined; no harm done */
+		return;
+	}
+
+	__heaptop -= release;
+	mh->mh_nextblock = M_MKFIELD(M_NEXTOFF(mh) - release);
+
+#ifdef MALLOCDEBUG
+	warnx("free: returned %lu bytes to the system",
+	      (unsigned long) release);
+#endif
+}
+
+/*
+ * The actual free() implementation (minus the per-thread cache).
+ * Called with the heap lock held.
+ */
+static
+void
+__free_core(void *x)
 {
 	struct mheader *mh, *mhnext, *mhprev;
 
@@ -574,18 +974,69 @@ free(void *x)
 
 	/* Try merging with the block above (but not if we're at the top) */
 	mhnext = M_NEXT(mh);
-	if (mhnext != (struct mheader *)__heaptop) {
+	if (mhnext != (struct mheader *)__heaptop && !mhnext->mh_inuse) {
+		__malloc_bin_remove(mhnext);
 		__malloc_trymerge(mh, mhnext);
 	}
 
 	/* Try merging with the block below (but not if we're at the bottom) */
 	if (mh != (struct mheader *)__heapbase) {
 		mhprev = M_PREV(mh);
-		__malloc_trymerge(mhprev, mh);
+		if (!mhprev->mh_inuse) {
+			__malloc_bin_remove(mhprev);
+			__malloc_trymerge(mhprev, mh);
+			mh = mhprev;
+		}
 	}
 
+	/*
+	 * Give back heap top space if enough has piled up, then bin
+	 * whatever is left of the merged block.
+	 */
+	__malloc_trim(mh);
+	__malloc_bin_insert(mh);
+
 #ifdef MALLOCDEBUG
 	warnx("free: freed %p", x);
 	__malloc_dump();
 #endif
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Exported entry points: try the calling thread's cache first, and
+ * take the heap lock only when the shared heap is actually touched.
+ */
+
+void *
+malloc(size_t size)
+{
+	void *p;
+
+	p = __mcache_get(size);
+	if (p != NULL) {
+		return p;
+	}
+
+	__malloc_lock();
+	p = __malloc_core(size);
+	__malloc_unlock();
+	return p;
+}
+
+void
+free(void *x)
+{
+	if (x==NULL) {
+		/* safest practice */
+		return;
+	}
+	if (__mcache_put(x)) {
+		return;
+	}
+
+	__malloc_lock();
+	__free_core(x);
+	__malloc_unlock();
+}
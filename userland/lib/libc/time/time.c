@@ -28,15 +28,43 @@
  */
 
 #include <unistd.h>
+#include <kern/userclock.h>
 
 /*
  * POSIX C function: retrieve time in seconds since the epoch.
- * Uses the OS/161 system call __time, which does the same thing
- * but also returns nanoseconds.
+ *
+ * The kernel maintains a read-only clock page at USERCLOCK_ADDR
+ * (see kern/userclock.h); when it is running we read the time from
+ * it directly and never trap. Until the kernel has initialized it
+ * (version still zero), fall back to the __time system call, which
+ * does the same thing but also returns nanoseconds.
  */
 
 time_t
 time(time_t *t)
 {
-	return __time(t, NULL);
+	const struct userclock *uc;
+	__u32 v1, v2;
+	time_t secs;
+
+	uc = (const struct userclock *)USERCLOCK_ADDR;
+
+	do {
+		v1 = uc->uc_version;
+		if (v1 == 0) {
+			/* Clock page not running; take the syscall. */
+			return __time(t, NULL);
+		}
+		if (v1 & 1) {
+			/* Kernel is mid-update; try again. */
+			continue;
+		}
+		secs = uc->uc_secs;
+		v2 = uc->uc_version;
+	} while (v1 != v2);
+
+	if (t != NULL) {
+		*t = secs;
+	}
+	return secs;
 }
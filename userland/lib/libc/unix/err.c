@@ -84,6 +84,12 @@ __printerr(int use_errno, const char *fmt, va_list ap)
 	 */
 	errmsg = strerror(errno);
 
+	/*
+	 * Don't let the message jump ahead of buffered stdout output
+	 * that was printed before the error happened.
+	 */
+	fflush(stdout);
+
 	/*
 	 * Look up the program name.
 	 * Strictly speaking we should pull off the rightmost
@@ -28,9 +28,13 @@
  */
 
 #include <errno.h>
+#include <unistd.h>
+#include <tls.h>
 
 /*
- * Source file that declares the space for the global variable errno.
+ * Source file that declares the space for the global variable errno,
+ * and the indirection that makes errno per-thread once TLS blocks
+ * are in play (see <tls.h>).
  *
  * We also declare the space for __argv, which is used by the err*
  * functions, and __environ, which is used by getenv(). Since these
@@ -42,4 +46,28 @@
 char **__argv;
 char **__environ;
 
+#undef errno
 int errno;
+
+/*
+ * Return the address of the calling thread's errno: the slot in its
+ * TLS block if one is registered, or the traditional global if not
+ * (which can only happen before crt0 runs __tls_init).
+ */
+int *
+__errno_ptr(void)
+{
+	struct __tls *tls = gettls();
+
+	return tls != NULL ? &tls->tls_errno : &errno;
+}
+
+/*
+ * Called from the syscall stub's error path (see e.g. arch/mips/
+ * syscalls-mips.S) with the error code the kernel returned.
+ */
+void
+__set_errno(int err)
+{
+	*__errno_ptr() = err;
+}
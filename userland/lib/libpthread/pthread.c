@@ -0,0 +1,419 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <tls.h>
+#include <kern/futex.h>
+
+/*
+ * Userland threads on the tfork/texit and futex system calls.
+ *
+ * Each thread gets a control block and a heap-allocated stack. The
+ * control block carries the start function, the result, and a done
+ * word. When a thread finishes, it calls texit with the address of
+ * the done word; the *kernel* stores 1 there and futex-wakes it at a
+ * point where the thread will never run in user mode again, so once
+ * pthread_join sees the word set it can safely free the stack.
+ *
+ * Mutexes are the usual three-state futex lock: 0 free, 1 held, 2
+ * held with waiters. The uncontended lock and unlock are a single
+ * compare-and-swap or exchange; the kernel is only entered to sleep
+ * on a held lock or to wake a recorded waiter.
+ *
+ * Condition variables are a sequence word: waiters snapshot it,
+ * release the mutex, and futex-wait for it to change; signal and
+ * broadcast bump it and wake. The futex's compare-under-the-lock
+ * closes the window between the mutex release and the sleep.
+ * Spurious wakeups are possible, as the pthread interface allows.
+ *
+ * Each control block embeds the thread's TLS block (see <tls.h>),
+ * registered with settls as the first thing the new thread does, so
+ * pthread_self is one gettls call rather than a scan of thread
+ * stacks under a lock. There is no preallocated main-thread control
+ * block; main uses the static TLS block from crt0, whose tls_self is
+ * NULL, and pthread_self returns NULL for it.
+ */
+
+#define PTHREAD_STACKSIZE	(64*1024)
+
+struct pthread {
+	struct pthread *t_next;		/* on the live-thread list */
+	void *(*t_func)(void *);	/* start function */
+	void *t_arg;			/* its argument */
+	void *t_result;			/* its return value */
+	void *t_stackbase;		/* base of the malloc'd stack */
+	struct __tls t_tls;		/* TLS block; tls_self points back */
+	volatile unsigned t_done;	/* set to 1 by the kernel in texit */
+};
+
+static struct pthread *pthread_list;
+static pthread_mutex_t pthread_listlock = PTHREAD_MUTEX_INITIALIZER;
+
+////////////////////////////////////////////////////////////
+// atomic operations
+
+/*
+ * LL/SC compare-and-swap, as in the kernel's mips/spinlock.h: if *W
+ * equals EXPECTED, store NEWVAL. Returns the value read, so the swap
+ * happened iff the return value equals EXPECTED. Y is 1 on SC
+ * success, 0 on SC failure (retry), and 2 if the comparison failed
+ * and the store was skipped.
+ */
+static
+unsigned
+atomic_cas(volatile unsigned *w, unsigned expected, unsigned newval)
+{
+	unsigned x;
+	unsigned y;
+
+	for (;;) {
+		y = newval;
+		__asm volatile(
+			".set push;"	 /* save assembler mode */
+			".set mips32;"	 /* allow MIPS32 instructions */
+			".set volatile;" /* avoid unwanted optimization */
+			"ll %0, 0(%2);"	 /*   x = *w */
+			"bne %0, %3, 1f;"/*   skip the store on mismatch */
+			"nop;"
+			"sc %1, 0(%2);"	 /*   *w = y; y = success? */
+			"b 2f;"
+			"nop;"
+			"1: li %1, 2;"	 /*   flag the mismatch */
+			"2:"
+			".set pop"	 /* restore assembler mode */
+			: "=&r" (x), "+r" (y)
+			: "r" (w), "r" (expected));
+		if (y != 0) {
+			/* mismatch (y==2) or successful swap (y==1) */
+			return x;
+		}
+		/* SC failed; retry */
+	}
+}
+
+/*
+ * LL/SC exchange: store NEWVAL, returning the old value.
+ */
+static
+unsigned
+atomic_xchg(volatile unsigned *w, unsigned newval)
+{
+	unsigned x;
+	unsigned y;
+
+	do {
+		y = newval;
+		__asm volatile(
+			".set push;"
+			".set mips32;"
+			".set volatile;"
+			"ll %0, 0(%2);"	/*   x = *w */
+			"sc %1, 0(%2);"	/*   *w = y; y = success? */
+			".set pop"
+			: "=&r" (x), "+r" (y) : "r" (w));
+	} while (y == 0);
+	return x;
+}
+
+/*
+ * Atomic increment, built on the compare-and-swap.
+ */
+static
+void
+atomic_inc(volatile unsigned *w)
+{
+	unsigned old;
+
+	do {
+		old = *w;
+	} while (atomic_cas(w, old, old + 1) != old);
+}
+
+////////////////////////////////////////////////////////////
+// mutexes
+
+int
+pthread_mutex_init(pthread_mutex_t *m, const pthread_mutexattr_t *attr)
+{
+	if (attr != NULL) {
+		return EINVAL;
+	}
+	m->m_lock = 0;
+	return 0;
+}
+
+int
+pthread_mutex_destroy(pthread_mutex_t *m)
+{
+	return m->m_lock == 0 ? 0 : EBUSY;
+}
+
+int
+pthread_mutex_lock(pthread_mutex_t *m)
+{
+	unsigned c;
+
+	c = atomic_cas(&m->m_lock, 0, 1);
+	if (c == 0) {
+		/* uncontended */
+		return 0;
+	}
+	do {
+		/*
+		 * Mark the lock contended so the holder knows to wake
+		 * us, then sleep while it stays that way. The futex
+		 * rechecks the word under its own lock, so a release
+		 * between our store and the sleep is not lost.
+		 */
+		if (c == 2 || atomic_cas(&m->m_lock, 1, 2) != 0) {
+			futex((unsigned *)&m->m_lock, FUTEX_WAIT, 2);
+		}
+	} while ((c = atomic_cas(&m->m_lock, 0, 2)) != 0);
+	return 0;
+}
+
+int
+pthread_mutex_trylock(pthread_mutex_t *m)
+{
+	return atomic_cas(&m->m_lock, 0, 1) == 0 ? 0 : EBUSY;
+}
+
+int
+pthread_mutex_unlock(pthread_mutex_t *m)
+{
+	if (atomic_xchg(&m->m_lock, 0) == 2) {
+		/* there was a recorded waiter; wake one */
+		futex((unsigned *)&m->m_lock, FUTEX_WAKE, 1);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// condition variables
+
+int
+pthread_cond_init(pthread_cond_t *c, const pthread_condattr_t *attr)
+{
+	if (attr != NULL) {
+		return EINVAL;
+	}
+	c->c_seq = 0;
+	return 0;
+}
+
+int
+pthread_cond_destroy(pthread_cond_t *c)
+{
+	(void)c;
+	return 0;
+}
+
+int
+pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m)
+{
+	unsigned seq;
+
+	seq = c->c_seq;
+	pthread_mutex_unlock(m);
+
+	/*
+	 * Sleep unless the sequence number has already moved. EAGAIN
+	 * (it moved) and spurious wakeups both just mean the caller
+	 * rechecks its predicate, which the interface requires anyway.
+	 */
+	futex((unsigned *)&c->c_seq, FUTEX_WAIT, seq);
+
+	pthread_mutex_lock(m);
+	return 0;
+}
+
+int
+pthread_cond_signal(pthread_cond_t *c)
+{
+	atomic_inc(&c->c_seq);
+	futex((unsigned *)&c->c_seq, FUTEX_WAKE, 1);
+	return 0;
+}
+
+int
+pthread_cond_broadcast(pthread_cond_t *c)
+{
+	atomic_inc(&c->c_seq);
+	futex((unsigned *)&c->c_seq, FUTEX_WAKE, 0xffffffff);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// threads
+
+/*
+ * First thing a new thread runs, with its control block in the first
+ * argument register courtesy of tfork. Must never return: there's
+ * nothing on the stack to return to.
+ */
+static
+void
+pthread_start(void *x)
+{
+	struct pthread *t = x;
+
+	/* Register the TLS block before anything can look at errno. */
+	settls(&t->t_tls);
+
+	t->t_result = t->t_func(t->t_arg);
+	texit((unsigned *)&t->t_done);
+
+	/* texit cannot return, but the compiler doesn't know that */
+	_exit(127);
+}
+
+int
+pthread_create(pthread_t *tret, const pthread_attr_t *attr,
+	       void *(*func)(void *), void *arg)
+{
+	struct pthread *t;
+	struct pthread **tp;
+	uintptr_t sp;
+	int err;
+
+	if (attr != NULL) {
+		return EINVAL;
+	}
+
+	t = malloc(sizeof(*t));
+	if (t == NULL) {
+		return ENOMEM;
+	}
+	t->t_stackbase = malloc(PTHREAD_STACKSIZE);
+	if (t->t_stackbase == NULL) {
+		free(t);
+		return ENOMEM;
+	}
+
+	t->t_func = func;
+	t->t_arg = arg;
+	t->t_result = NULL;
+	memset(&t->t_tls, 0, sizeof(t->t_tls));
+	t->t_tls.tls_self = t;
+	t->t_done = 0;
+
+	pthread_mutex_lock(&pthread_listlock);
+	t->t_next = pthread_list;
+	pthread_list = t;
+	pthread_mutex_unlock(&pthread_listlock);
+
+	/* top of the stack, minus the ABI argument save area, 8-aligned */
+	sp = ((uintptr_t)t->t_stackbase + PTHREAD_STACKSIZE - 16)
+		& ~(uintptr_t)7;
+
+	if (tfork(pthread_start, (void *)sp, t) == -1) {
+		err = errno;
+		pthread_mutex_lock(&pthread_listlock);
+		for (tp = &pthread_list; *tp != t; tp = &(*tp)->t_next) {
+			/* nothing */
+		}
+		*tp = t->t_next;
+		pthread_mutex_unlock(&pthread_listlock);
+		free(t->t_stackbase);
+		free(t);
+		return err;
+	}
+
+	*tret = t;
+	return 0;
+}
+
+int
+pthread_join(pthread_t t, void **result_ret)
+{
+	struct pthread **tp;
+
+	/*
+	 * Wait for the kernel's store from texit. EAGAIN means the
+	 * word had already changed, which is what we're waiting for.
+	 */
+	while (t->t_done == 0) {
+		futex((unsigned *)&t->t_done, FUTEX_WAIT, 0);
+	}
+
+	pthread_mutex_lock(&pthread_listlock);
+	for (tp = &pthread_list; *tp != NULL && *tp != t;
+	     tp = &(*tp)->t_next) {
+		/* nothing */
+	}
+	if (*tp == NULL) {
+		/* already joined */
+		pthread_mutex_unlock(&pthread_listlock);
+		return ESRCH;
+	}
+	*tp = t->t_next;
+	pthread_mutex_unlock(&pthread_listlock);
+
+	if (result_ret != NULL) {
+		*result_ret = t->t_result;
+	}
+
+	/* the thread is gone from user mode; the stack is now dead */
+	free(t->t_stackbase);
+	free(t);
+	return 0;
+}
+
+pthread_t
+pthread_self(void)
+{
+	struct __tls *tls = gettls();
+
+	/* tls_self is NULL in the main thread's static block */
+	return tls != NULL ? tls->tls_self : NULL;
+}
+
+void
+pthread_exit(void *result)
+{
+	struct pthread *t = pthread_self();
+
+	if (t == NULL) {
+		/*
+		 * The main thread. We don't keep the process alive
+		 * for the others the way POSIX says to; main should
+		 * join its threads and return.
+		 */
+		_exit(0);
+	}
+
+	t->t_result = result;
+	texit((unsigned *)&t->t_done);
+	_exit(127);
+}
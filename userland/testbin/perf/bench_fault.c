@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Page fault cost: sbrk a run of fresh pages and write one byte to
+ * each. The first pass takes a fault per page (zero-fill, on-demand
+ * allocation, TLB load); the second pass touches pages that are
+ * already resident, giving the no-fault baseline to compare against.
+ */
+
+#include <unistd.h>
+#include <stdint.h>
+#include <err.h>
+
+#include "perf.h"
+
+#define PAGESIZE	4096
+#define NPAGES		256
+
+static uint64_t samples[NSAMPLES];
+
+static
+void
+touchall(char *base, const char *what)
+{
+	uint64_t t0, t1;
+	int i;
+
+	t0 = perf_now();
+	for (i = 0; i < NPAGES; i++) {
+		uint64_t a = perf_now();
+
+		base[(size_t)i * PAGESIZE] = 1;
+		samples[i] = perf_lat(a, perf_now());
+	}
+	t1 = perf_now();
+	perf_report(what, NPAGES, t1 - t0, samples, NPAGES);
+}
+
+void
+bench_fault(void)
+{
+	void *p;
+
+	p = sbrk(NPAGES * PAGESIZE);
+	if (p == (void *)-1) {
+		err(1, "sbrk");
+	}
+
+	touchall(p, "page touch (cold)");
+	touchall(p, "page touch (warm)");
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * File bandwidth: sequential write then sequential read of a 1M
+ * scratch file in 4K chunks, through whatever filesystem the current
+ * directory lives on.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <err.h>
+
+#include "perf.h"
+
+#define CHUNK	4096
+#define NCHUNKS	256
+
+#define SCRATCHFILE	"perf.dat"
+
+static char buf[CHUNK];
+static uint64_t samples[NSAMPLES];
+
+void
+bench_file(void)
+{
+	uint64_t t0, t1;
+	int fd, i;
+	ssize_t r;
+
+	fd = open(SCRATCHFILE, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: create", SCRATCHFILE);
+	}
+	for (i = 0; i < CHUNK; i++) {
+		buf[i] = 'a' + i % 26;
+	}
+
+	t0 = perf_now();
+	for (i = 0; i < NCHUNKS; i++) {
+		uint64_t a = perf_now();
+
+		r = write(fd, buf, sizeof(buf));
+		if (r != sizeof(buf)) {
+			err(1, "%s: write", SCRATCHFILE);
+		}
+		samples[i] = perf_lat(a, perf_now());
+	}
+	t1 = perf_now();
+	close(fd);
+	perf_reportrate("file write", NCHUNKS * CHUNK, t1 - t0);
+	perf_report("file write", NCHUNKS, t1 - t0, samples, NCHUNKS);
+
+	fd = open(SCRATCHFILE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", SCRATCHFILE);
+	}
+
+	t0 = perf_now();
+	for (i = 0; i < NCHUNKS; i++) {
+		uint64_t a = perf_now();
+
+		r = read(fd, buf, sizeof(buf));
+		if (r != sizeof(buf)) {
+			err(1, "%s: read", SCRATCHFILE);
+		}
+		samples[i] = perf_lat(a, perf_now());
+	}
+	t1 = perf_now();
+	close(fd);
+	perf_reportrate("file read", NCHUNKS * CHUNK, t1 - t0);
+	perf_report("file read", NCHUNKS, t1 - t0, samples, NCHUNKS);
+
+	if (remove(SCRATCHFILE) == -1) {
+		warn("%s: remove", SCRATCHFILE);
+	}
+}
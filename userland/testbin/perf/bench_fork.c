@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Process creation throughput: fork+wait, fork+execv+wait, and
+ * spawn+wait. The exec'd image is this program itself, run with -x
+ * so it exits immediately (see driver.c).
+ */
+
+#include <unistd.h>
+#include <stdint.h>
+#include <err.h>
+
+#include "perf.h"
+
+#define NFORK	100
+#define NEXEC	50
+
+#define SELF	"/testbin/perf"
+
+static uint64_t samples[NSAMPLES];
+
+static char *const execargs[] = {
+	(char *)"perf",
+	(char *)"-x",
+	NULL,
+};
+
+static
+void
+waitfor(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) == -1) {
+		err(1, "waitpid");
+	}
+}
+
+void
+bench_fork(void)
+{
+	uint64_t t0, t1;
+	pid_t pid;
+	int i;
+
+	t0 = perf_now();
+	for (i = 0; i < NFORK; i++) {
+		uint64_t a = perf_now();
+
+		pid = fork();
+		if (pid == -1) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			_exit(0);
+		}
+		waitfor(pid);
+		if (i < NSAMPLES) {
+			samples[i] = perf_lat(a, perf_now());
+		}
+	}
+	t1 = perf_now();
+	perf_report("fork+wait", NFORK, t1 - t0, samples, NFORK);
+
+	t0 = perf_now();
+	for (i = 0; i < NEXEC; i++) {
+		uint64_t a = perf_now();
+
+		pid = fork();
+		if (pid == -1) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			execv(SELF, execargs);
+			/* exec failure in the child; don't run the suite */
+			_exit(1);
+		}
+		waitfor(pid);
+		if (i < NSAMPLES) {
+			samples[i] = perf_lat(a, perf_now());
+		}
+	}
+	t1 = perf_now();
+	perf_report("fork+exec+wait", NEXEC, t1 - t0, samples, NEXEC);
+
+	t0 = perf_now();
+	for (i = 0; i < NEXEC; i++) {
+		uint64_t a = perf_now();
+
+		pid = spawn(SELF, execargs);
+		if (pid == -1) {
+			err(1, "spawn");
+		}
+		waitfor(pid);
+		if (i < NSAMPLES) {
+			samples[i] = perf_lat(a, perf_now());
+		}
+	}
+	t1 = perf_now();
+	perf_report("spawn+wait", NEXEC, t1 - t0, samples, NEXEC);
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipe bandwidth (one writer streaming to one reader) and round-trip
+ * latency (one byte ping-ponged over a pair of pipes).
+ */
+
+#include <unistd.h>
+#include <stdint.h>
+#include <err.h>
+
+#include "perf.h"
+
+#define CHUNK		4096
+#define NCHUNKS		256
+#define NROUNDTRIPS	NSAMPLES
+
+static char buf[CHUNK];
+static uint64_t samples[NSAMPLES];
+
+static
+void
+waitfor(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) == -1) {
+		err(1, "waitpid");
+	}
+}
+
+static
+void
+bandwidth(void)
+{
+	uint64_t t0, t1;
+	int fds[2];
+	pid_t pid;
+	int i;
+	ssize_t r;
+
+	if (pipe(fds) == -1) {
+		err(1, "pipe");
+	}
+	pid = fork();
+	if (pid == -1) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		/* reader: drain until the writer closes */
+		close(fds[1]);
+		while ((r = read(fds[0], buf, sizeof(buf))) > 0) {
+			/* discard */
+		}
+		_exit(r == 0 ? 0 : 1);
+	}
+	close(fds[0]);
+
+	t0 = perf_now();
+	for (i = 0; i < NCHUNKS; i++) {
+		r = write(fds[1], buf, sizeof(buf));
+		if (r != sizeof(buf)) {
+			err(1, "pipe write");
+		}
+	}
+	close(fds[1]);
+	waitfor(pid);
+	t1 = perf_now();
+
+	perf_reportrate("pipe stream", NCHUNKS * CHUNK, t1 - t0);
+}
+
+static
+void
+roundtrip(void)
+{
+	uint64_t t0, t1;
+	int ptoc[2], ctop[2];
+	pid_t pid;
+	char c;
+	int i;
+
+	if (pipe(ptoc) == -1 || pipe(ctop) == -1) {
+		err(1, "pipe");
+	}
+	pid = fork();
+	if (pid == -1) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		/* echo one byte back until the parent closes */
+		close(ptoc[1]);
+		close(ctop[0]);
+		while (read(ptoc[0], &c, 1) == 1) {
+			if (write(ctop[1], &c, 1) != 1) {
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+	close(ptoc[0]);
+	close(ctop[1]);
+
+	c = 'p';
+	t0 = perf_now();
+	for (i = 0; i < NROUNDTRIPS; i++) {
+		uint64_t a = perf_now();
+
+		if (write(ptoc[1], &c, 1) != 1) {
+			err(1, "pipe write");
+		}
+		if (read(ctop[0], &c, 1) != 1) {
+			err(1, "pipe read");
+		}
+		samples[i] = perf_lat(a, perf_now());
+	}
+	t1 = perf_now();
+
+	close(ptoc[1]);
+	close(ctop[0]);
+	waitfor(pid);
+
+	perf_report("pipe rtt", NROUNDTRIPS, t1 - t0, samples, NROUNDTRIPS);
+}
+
+void
+bench_pipe(void)
+{
+	bandwidth();
+	roundtrip();
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Syscall latency: getpid (the cheapest call there is) and __time.
+ */
+
+#include <unistd.h>
+#include <stdint.h>
+
+#include "perf.h"
+
+#define GETPID_ITERS	50000
+#define TIME_ITERS	20000
+
+static uint64_t samples[NSAMPLES];
+
+void
+bench_syscall(void)
+{
+	uint64_t t0, t1;
+	time_t secs;
+	unsigned long nsecs;
+	int i;
+
+	/* ops/s from a tight batch, where the timer can't intrude */
+	t0 = perf_now();
+	for (i = 0; i < GETPID_ITERS; i++) {
+		(void)getpid();
+	}
+	t1 = perf_now();
+
+	for (i = 0; i < NSAMPLES; i++) {
+		uint64_t a = perf_now();
+
+		(void)getpid();
+		samples[i] = perf_lat(a, perf_now());
+	}
+	perf_report("getpid", GETPID_ITERS, t1 - t0, samples, NSAMPLES);
+
+	t0 = perf_now();
+	for (i = 0; i < TIME_ITERS; i++) {
+		(void)__time(&secs, &nsecs);
+	}
+	t1 = perf_now();
+
+	for (i = 0; i < NSAMPLES; i++) {
+		uint64_t a = perf_now();
+
+		(void)__time(&secs, &nsecs);
+		samples[i] = perf_lat(a, perf_now());
+	}
+	perf_report("__time", TIME_ITERS, t1 - t0, samples, NSAMPLES);
+}
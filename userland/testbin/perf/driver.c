@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * perf - end-to-end performance benchmarks.
+ *
+ * Usage: perf [benchmark...]
+ *
+ * With no arguments, runs every benchmark. Otherwise runs the named
+ * ones (syscall, fork, pipe, file, fault) in the order given. The -x
+ * flag makes the program exit immediately; the fork benchmark uses
+ * this as its exec target.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#include "perf.h"
+
+static const struct {
+	const char *name;
+	void (*func)(void);
+} benches[] = {
+	{ "syscall",	bench_syscall },
+	{ "fork",	bench_fork },
+	{ "pipe",	bench_pipe },
+	{ "file",	bench_file },
+	{ "fault",	bench_fault },
+};
+
+static const unsigned nbenches = sizeof(benches) / sizeof(benches[0]);
+
+static
+void
+runone(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < nbenches; i++) {
+		if (!strcmp(name, benches[i].name)) {
+			benches[i].func();
+			return;
+		}
+	}
+	errx(1, "unknown benchmark %s "
+	     "(have: syscall fork pipe file fault)", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned i;
+	int j;
+
+	/* exec target for the fork benchmark: do nothing, quickly */
+	if (argc > 1 && !strcmp(argv[1], "-x")) {
+		return 0;
+	}
+
+	if (argc <= 1) {
+		for (i = 0; i < nbenches; i++) {
+			benches[i].func();
+		}
+	}
+	else {
+		for (j = 1; j < argc; j++) {
+			runone(argv[j]);
+		}
+	}
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/perf");
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PERF_H_
+#define _PERF_H_
+
+#include <stdint.h>
+
+/*
+ * perf - end-to-end performance benchmarks.
+ *
+ * Each benchmark measures user-visible cost through the full trap
+ * path and reports in a uniform format: operations per second from a
+ * wall-clock total, and p50/p90/p99 latency over a set of
+ * individually timed operations (with the cost of reading the clock
+ * backed out). Individually timed loops necessarily include the
+ * timer syscalls in their wall-clock totals; for operations much
+ * cheaper than __time, believe the batched ops/s figure and treat
+ * the percentiles as upper bounds.
+ */
+
+/* Most individually timed operations kept for percentiles. */
+#define NSAMPLES 500
+
+/* Timing and reporting plumbing (support.c) */
+uint64_t perf_now(void);
+uint64_t perf_lat(uint64_t t0, uint64_t t1);
+void perf_report(const char *what, unsigned long ops, uint64_t elapsed,
+		 uint64_t *samples, unsigned nsamples);
+void perf_reportrate(const char *what, unsigned long bytes, uint64_t elapsed);
+
+/* The benchmarks */
+void bench_syscall(void);
+void bench_fork(void);
+void bench_pipe(void);
+void bench_file(void);
+void bench_fault(void);
+
+#endif /* _PERF_H_ */
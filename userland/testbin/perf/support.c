@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Timing and reporting plumbing shared by the perf benchmarks.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#include "perf.h"
+
+/*
+ * Nanosecond wall clock on top of __time.
+ */
+uint64_t
+perf_now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	if (__time(&secs, &nsecs) == -1) {
+		err(1, "__time");
+	}
+	return (uint64_t)secs * 1000000000ULL + nsecs;
+}
+
+/*
+ * The cost of one perf_now call, so individually timed operations
+ * can have the timer overhead backed out. Take the minimum of a few
+ * back-to-back pairs; computed once.
+ */
+static
+uint64_t
+perf_timercost(void)
+{
+	static uint64_t cost;
+	uint64_t t0, t1, d;
+	int i;
+
+	if (cost == 0) {
+		cost = (uint64_t)-1;
+		for (i = 0; i < 64; i++) {
+			t0 = perf_now();
+			t1 = perf_now();
+			d = t1 - t0;
+			if (d < cost) {
+				cost = d;
+			}
+		}
+	}
+	return cost;
+}
+
+/*
+ * Latency of one operation bracketed by perf_now calls at T0 and T1,
+ * with the timer overhead subtracted (clamped at zero).
+ */
+uint64_t
+perf_lat(uint64_t t0, uint64_t t1)
+{
+	uint64_t d = t1 - t0;
+	uint64_t cost = perf_timercost();
+
+	return d > cost ? d - cost : 0;
+}
+
+static
+int
+u64cmp(const void *av, const void *bv)
+{
+	uint64_t a = *(const uint64_t *)av;
+	uint64_t b = *(const uint64_t *)bv;
+
+	if (a < b) {
+		return -1;
+	}
+	if (a > b) {
+		return 1;
+	}
+	return 0;
+}
+
+static
+uint64_t
+percentile(const uint64_t *sorted, unsigned n, unsigned pct)
+{
+	unsigned ix = (n * pct) / 100;
+
+	return sorted[ix < n ? ix : n - 1];
+}
+
+/*
+ * Report OPS operations done in ELAPSED ns, and, if SAMPLES is not
+ * NULL, latency percentiles over NSAMPLES individually timed
+ * operations. Sorts SAMPLES in place.
+ *
+ * Each figure also goes out as a METRIC record (see libtest161) so
+ * the perf targets get machine-parseable numbers alongside the prose.
+ */
+void
+perf_report(const char *what, unsigned long ops, uint64_t elapsed,
+	    uint64_t *samples, unsigned nsamples)
+{
+	uint64_t persec, p50, p90, p99;
+
+	if (elapsed == 0) {
+		elapsed = 1;
+	}
+	persec = (uint64_t)ops * 1000000000ULL / elapsed;
+	printf("%s: %lu ops in %llu ns (%llu ops/s)\n", what, ops,
+	       (unsigned long long)elapsed, (unsigned long long)persec);
+	metric_counter(what, persec, "ops/s");
+
+	if (samples != NULL && nsamples > 0) {
+		qsort(samples, nsamples, sizeof(samples[0]), u64cmp);
+		p50 = percentile(samples, nsamples, 50);
+		p90 = percentile(samples, nsamples, 90);
+		p99 = percentile(samples, nsamples, 99);
+		printf("%s: p50 %llu ns, p90 %llu ns, p99 %llu ns "
+		       "(%u samples)\n", what,
+		       (unsigned long long)p50,
+		       (unsigned long long)p90,
+		       (unsigned long long)p99,
+		       nsamples);
+		metric_percentiles(what, nsamples, p50, p90, p99, "ns");
+	}
+}
+
+/*
+ * Report BYTES moved in ELAPSED ns as a bandwidth.
+ */
+void
+perf_reportrate(const char *what, unsigned long bytes, uint64_t elapsed)
+{
+	uint64_t kbs;
+
+	if (elapsed == 0) {
+		elapsed = 1;
+	}
+	kbs = (uint64_t)bytes * 1000000000ULL / elapsed / 1024;
+	printf("%s: %lu bytes in %llu ns (%llu KB/s)\n", what, bytes,
+	       (unsigned long long)elapsed, (unsigned long long)kbs);
+	metric_counter(what, kbs, "KB/s");
+}